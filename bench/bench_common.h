@@ -0,0 +1,58 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef BRPC_BENCH_BENCH_COMMON_H
+#define BRPC_BENCH_BENCH_COMMON_H
+
+#include <stdio.h>
+#include <string>
+#include "butil/string_printf.h"
+
+namespace bench {
+
+// Machine-readable result of one measurement, consumed by
+// bench/compare_ab.py. Each Print() emits a single-line JSON object so
+// the output of a whole suite stays line-parseable even when mixed with
+// ordinary logs on stderr:
+//   {"bench":"echo","protocol":"baidu_std","qps":123456.0,...}
+class JsonReporter {
+public:
+    explicit JsonReporter(const std::string& bench_name) {
+        butil::string_appendf(&_buf, "{\"bench\":\"%s\"", bench_name.c_str());
+    }
+    // Labels describe the configuration being measured.
+    void AddLabel(const char* key, const std::string& value) {
+        butil::string_appendf(&_buf, ",\"%s\":\"%s\"", key, value.c_str());
+    }
+    void AddLabel(const char* key, long value) {
+        butil::string_appendf(&_buf, ",\"%s\":%ld", key, value);
+    }
+    // Metrics are the numbers compared between A/B runs.
+    void AddMetric(const char* key, double value) {
+        butil::string_appendf(&_buf, ",\"%s\":%.3f", key, value);
+    }
+    void Print() {
+        ::printf("%s}\n", _buf.c_str());
+        ::fflush(stdout);
+    }
+private:
+    std::string _buf;
+};
+
+} // namespace bench
+
+#endif  // BRPC_BENCH_BENCH_COMMON_H
@@ -0,0 +1,166 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// Scheduling microbenchmarks of bthread:
+// * create_join:   throughput of starting + joining trivial bthreads.
+// * butex_wake:    round-trips/s of two bthreads ping-ponging on a
+//                  bthread_cond (butex wake is the dominant cost).
+// * work_stealing: one producer starts all bthreads, workers of other
+//                  groups must steal them to stay busy.
+
+#include <gflags/gflags.h>
+#include <vector>
+#include <bthread/bthread.h>
+#include <butil/logging.h>
+#include <butil/time.h>
+#include <butil/atomicops.h>
+#include "bench_common.h"
+
+DEFINE_int32(duration_s, 5, "Seconds that each microbenchmark runs");
+DEFINE_int32(batch_size, 1024, "Bthreads started per batch in "
+             "create_join/work_stealing");
+
+namespace {
+
+void* trivial_bthread(void*) {
+    return NULL;
+}
+
+double RunCreateJoin() {
+    std::vector<bthread_t> tids(FLAGS_batch_size);
+    long ncreated = 0;
+    const int64_t begin_us = butil::gettimeofday_us();
+    const int64_t end_us = begin_us + FLAGS_duration_s * 1000000L;
+    while (butil::gettimeofday_us() < end_us) {
+        for (int i = 0; i < FLAGS_batch_size; ++i) {
+            CHECK_EQ(0, bthread_start_background(&tids[i], NULL,
+                                                 trivial_bthread, NULL));
+        }
+        for (int i = 0; i < FLAGS_batch_size; ++i) {
+            bthread_join(tids[i], NULL);
+        }
+        ncreated += FLAGS_batch_size;
+    }
+    return ncreated * 1000000.0 / (butil::gettimeofday_us() - begin_us);
+}
+
+struct PingPongArg {
+    bthread_mutex_t mutex;
+    bthread_cond_t cond;
+    bool ball_at_server;
+    bool stop;
+    long nround;
+};
+
+void* pingpong_server(void* void_arg) {
+    PingPongArg* arg = static_cast<PingPongArg*>(void_arg);
+    bthread_mutex_lock(&arg->mutex);
+    while (!arg->stop) {
+        while (!arg->ball_at_server && !arg->stop) {
+            bthread_cond_wait(&arg->cond, &arg->mutex);
+        }
+        arg->ball_at_server = false;
+        bthread_cond_signal(&arg->cond);
+    }
+    bthread_mutex_unlock(&arg->mutex);
+    return NULL;
+}
+
+double RunButexWake() {
+    PingPongArg arg;
+    bthread_mutex_init(&arg.mutex, NULL);
+    bthread_cond_init(&arg.cond, NULL);
+    arg.ball_at_server = false;
+    arg.stop = false;
+    arg.nround = 0;
+    bthread_t server;
+    CHECK_EQ(0, bthread_start_background(&server, NULL, pingpong_server,
+                                         &arg));
+    const int64_t begin_us = butil::gettimeofday_us();
+    const int64_t end_us = begin_us + FLAGS_duration_s * 1000000L;
+    bthread_mutex_lock(&arg.mutex);
+    while (butil::gettimeofday_us() < end_us) {
+        arg.ball_at_server = true;
+        bthread_cond_signal(&arg.cond);
+        while (arg.ball_at_server) {
+            bthread_cond_wait(&arg.cond, &arg.mutex);
+        }
+        ++arg.nround;
+    }
+    arg.stop = true;
+    bthread_cond_signal(&arg.cond);
+    bthread_mutex_unlock(&arg.mutex);
+    bthread_join(server, NULL);
+    const double rounds_per_s =
+        arg.nround * 1000000.0 / (butil::gettimeofday_us() - begin_us);
+    bthread_cond_destroy(&arg.cond);
+    bthread_mutex_destroy(&arg.mutex);
+    return rounds_per_s;
+}
+
+butil::atomic<long> g_nstolen_done(0);
+
+void* stealable_bthread(void*) {
+    g_nstolen_done.fetch_add(1, butil::memory_order_relaxed);
+    return NULL;
+}
+
+double RunWorkStealing() {
+    // All bthreads are started from this (pthread) thread and thus are
+    // queued to one TaskGroup; other workers only get them by stealing.
+    std::vector<bthread_t> tids(FLAGS_batch_size);
+    g_nstolen_done.store(0, butil::memory_order_relaxed);
+    const int64_t begin_us = butil::gettimeofday_us();
+    const int64_t end_us = begin_us + FLAGS_duration_s * 1000000L;
+    while (butil::gettimeofday_us() < end_us) {
+        for (int i = 0; i < FLAGS_batch_size; ++i) {
+            CHECK_EQ(0, bthread_start_background(&tids[i], NULL,
+                                                 stealable_bthread, NULL));
+        }
+        for (int i = 0; i < FLAGS_batch_size; ++i) {
+            bthread_join(tids[i], NULL);
+        }
+    }
+    return g_nstolen_done.load(butil::memory_order_relaxed) * 1000000.0 /
+        (butil::gettimeofday_us() - begin_us);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    GFLAGS_NS::ParseCommandLineFlags(&argc, &argv, true);
+
+    {
+        bench::JsonReporter reporter("bthread_create_join");
+        reporter.AddLabel("batch_size", (long)FLAGS_batch_size);
+        reporter.AddMetric("bthreads_per_s", RunCreateJoin());
+        reporter.Print();
+    }
+    {
+        bench::JsonReporter reporter("bthread_butex_wake");
+        reporter.AddMetric("roundtrips_per_s", RunButexWake());
+        reporter.Print();
+    }
+    {
+        bench::JsonReporter reporter("bthread_work_stealing");
+        reporter.AddLabel("batch_size", (long)FLAGS_batch_size);
+        reporter.AddLabel("concurrency", (long)bthread_getconcurrency());
+        reporter.AddMetric("bthreads_per_s", RunWorkStealing());
+        reporter.Print();
+    }
+    return 0;
+}
@@ -0,0 +1,121 @@
+#!/usr/bin/env python
+# Licensed to the Apache Software Foundation (ASF) under one
+# or more contributor license agreements.  See the NOTICE file
+# distributed with this work for additional information
+# regarding copyright ownership.  The ASF licenses this file
+# to you under the Apache License, Version 2.0 (the
+# "License"); you may not use this file except in compliance
+# with the License.  You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing,
+# software distributed under the License is distributed on an
+# "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+# KIND, either express or implied.  See the License for the
+# specific language governing permissions and limitations
+# under the License.
+
+"""A/B runner for the benchmarks under bench/.
+
+Runs the same benchmark binary from two builds with identical arguments,
+parses the single-line JSON objects they print on stdout and reports the
+relative change of every numeric metric, e.g.:
+
+    bench/compare_ab.py --repeat 3 \\
+        baseline_build/bench/echo_bench new_build/bench/echo_bench -- \\
+        -protocol=baidu_std -connection_num=8 -duration_s=10
+
+Metrics are averaged over --repeat runs per side. String-valued fields
+are treated as labels identifying the measurement and must match
+between the two sides.
+"""
+
+import argparse
+import json
+import subprocess
+import sys
+from collections import OrderedDict
+
+
+def run_once(binary, args):
+    """Runs `binary' and returns the parsed JSON lines of its stdout."""
+    output = subprocess.check_output([binary] + args)
+    if not isinstance(output, str):
+        output = output.decode('utf-8')
+    results = []
+    for line in output.splitlines():
+        line = line.strip()
+        if line.startswith('{') and line.endswith('}'):
+            results.append(json.loads(line, object_pairs_hook=OrderedDict))
+    if not results:
+        raise RuntimeError('%s printed no JSON result' % binary)
+    return results
+
+
+def measurement_key(result):
+    """Labels (string/int fields) identify a measurement across runs."""
+    return tuple(sorted((k, v) for k, v in result.items()
+                        if not isinstance(v, float)))
+
+
+def collect(binary, args, repeat):
+    """Returns {measurement_key: {metric: [values...]}}."""
+    collected = OrderedDict()
+    for _ in range(repeat):
+        for result in run_once(binary, args):
+            metrics = collected.setdefault(measurement_key(result),
+                                           OrderedDict())
+            for k, v in result.items():
+                if isinstance(v, float):
+                    metrics.setdefault(k, []).append(v)
+    return collected
+
+
+def mean(values):
+    return sum(values) / len(values)
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description=__doc__,
+        formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--repeat', type=int, default=1,
+                        help='Runs per side, metrics are averaged')
+    parser.add_argument('binary_a', help='Baseline binary')
+    parser.add_argument('binary_b', help='Candidate binary')
+    parser.add_argument('bench_args', nargs='*',
+                        help='Arguments passed to both binaries '
+                        '(prefix with --)')
+    options = parser.parse_args()
+
+    results_a = collect(options.binary_a, options.bench_args, options.repeat)
+    results_b = collect(options.binary_b, options.bench_args, options.repeat)
+
+    fmt = '%-28s %16s %16s %9s'
+    for key, metrics_a in results_a.items():
+        metrics_b = results_b.get(key)
+        labels = ' '.join('%s=%s' % (k, v) for k, v in key)
+        print('== %s ==' % labels)
+        if metrics_b is None:
+            print('   (missing from %s)' % options.binary_b)
+            continue
+        print(fmt % ('metric', 'A', 'B', 'delta'))
+        for metric, values_a in metrics_a.items():
+            values_b = metrics_b.get(metric)
+            if values_b is None:
+                continue
+            a = mean(values_a)
+            b = mean(values_b)
+            delta = '%+.2f%%' % ((b - a) * 100.0 / a) if a else 'n/a'
+            print(fmt % (metric, '%.3f' % a, '%.3f' % b, delta))
+    for key in results_b:
+        if key not in results_a:
+            labels = ' '.join('%s=%s' % (k, v) for k, v in key)
+            print('== %s ==' % labels)
+            print('   (missing from %s)' % options.binary_a)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
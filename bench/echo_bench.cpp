@@ -0,0 +1,185 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// End-to-end echo benchmark: an in-process server and multiple client
+// threads spread over -connection_num connections, modeled on
+// example/multi_threaded_echo_c++. The protocol and the connection count
+// are flags so that one binary covers the baidu_std/h2/http matrix:
+//   echo_bench -protocol=baidu_std -connection_num=8 -thread_num=50
+
+#include <gflags/gflags.h>
+#include <vector>
+#include <bthread/bthread.h>
+#include <butil/logging.h>
+#include <butil/time.h>
+#include <butil/atomicops.h>
+#include <brpc/server.h>
+#include <brpc/channel.h>
+#include <bvar/bvar.h>
+#include "echo.pb.h"
+#include "bench_common.h"
+
+DEFINE_string(protocol, "baidu_std",
+              "Protocol of the channels (baidu_std, http, h2 ...)");
+DEFINE_int32(connection_num, 1, "Number of connections to the server, "
+             "client threads are spread over them evenly");
+DEFINE_int32(thread_num, 50, "Number of threads to send requests");
+DEFINE_bool(use_bthread, false, "Use bthread to send requests");
+DEFINE_int32(request_size, 16, "Bytes of each request");
+DEFINE_int32(attachment_size, 0,
+             "Carry so many byte attachment along with requests");
+DEFINE_int32(duration_s, 10, "Seconds that the benchmark runs");
+DEFINE_int32(port, 8002, "TCP Port of the in-process server");
+DEFINE_int32(timeout_ms, 1000, "RPC timeout in milliseconds");
+
+namespace {
+
+std::string g_request;
+std::string g_attachment;
+volatile bool g_stop = false;
+bvar::LatencyRecorder g_latency_recorder("echo_bench");
+butil::atomic<long> g_nsucceed(0);
+butil::atomic<long> g_nfailed(0);
+
+class EchoServiceImpl : public bench::EchoService {
+public:
+    void Echo(google::protobuf::RpcController* cntl_base,
+              const bench::EchoRequest* request,
+              bench::EchoResponse* response,
+              google::protobuf::Closure* done) {
+        brpc::ClosureGuard done_guard(done);
+        brpc::Controller* cntl = static_cast<brpc::Controller*>(cntl_base);
+        response->set_message(request->message());
+        // Echo the attachment as well, wired directly to network.
+        cntl->response_attachment().append(cntl->request_attachment());
+    }
+};
+
+void* sender(void* arg) {
+    bench::EchoService_Stub stub(
+        static_cast<google::protobuf::RpcChannel*>(arg));
+    while (!g_stop) {
+        bench::EchoRequest request;
+        bench::EchoResponse response;
+        brpc::Controller cntl;
+        request.set_message(g_request);
+        cntl.request_attachment().append(g_attachment);
+        stub.Echo(&cntl, &request, &response, NULL);
+        if (!cntl.Failed()) {
+            g_latency_recorder << cntl.latency_us();
+            g_nsucceed.fetch_add(1, butil::memory_order_relaxed);
+        } else {
+            g_nfailed.fetch_add(1, butil::memory_order_relaxed);
+            bthread_usleep(10000);
+        }
+    }
+    return NULL;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    GFLAGS_NS::ParseCommandLineFlags(&argc, &argv, true);
+
+    brpc::Server server;
+    EchoServiceImpl echo_service;
+    if (server.AddService(&echo_service,
+                          brpc::SERVER_DOESNT_OWN_SERVICE) != 0) {
+        LOG(ERROR) << "Fail to add service";
+        return -1;
+    }
+    if (server.Start(FLAGS_port, NULL) != 0) {
+        LOG(ERROR) << "Fail to start server";
+        return -1;
+    }
+
+    if (FLAGS_connection_num <= 0 || FLAGS_thread_num <= 0 ||
+        FLAGS_request_size <= 0) {
+        LOG(ERROR) << "Invalid -connection_num/-thread_num/-request_size";
+        return -1;
+    }
+    g_request.resize(FLAGS_request_size, 'r');
+    if (FLAGS_attachment_size > 0) {
+        g_attachment.resize(FLAGS_attachment_size, 'a');
+    }
+
+    // One channel with connection_type=single per connection; threads are
+    // spread over the channels round-robin.
+    std::vector<brpc::Channel*> channels(FLAGS_connection_num);
+    brpc::ChannelOptions options;
+    options.protocol = FLAGS_protocol;
+    options.connection_type = "single";
+    options.timeout_ms = FLAGS_timeout_ms;
+    options.max_retry = 0;
+    for (int i = 0; i < FLAGS_connection_num; ++i) {
+        channels[i] = new brpc::Channel;
+        // Different connection_group = different underlying connection.
+        options.connection_group = butil::string_printf("bench_%d", i);
+        if (channels[i]->Init(
+                butil::EndPoint(butil::my_ip(), FLAGS_port), &options) != 0) {
+            LOG(ERROR) << "Fail to initialize channel " << i;
+            return -1;
+        }
+    }
+
+    std::vector<bthread_t> bids(FLAGS_thread_num);
+    std::vector<pthread_t> pids(FLAGS_thread_num);
+    for (int i = 0; i < FLAGS_thread_num; ++i) {
+        void* chan = channels[i % FLAGS_connection_num];
+        if (!FLAGS_use_bthread) {
+            CHECK_EQ(0, pthread_create(&pids[i], NULL, sender, chan));
+        } else {
+            CHECK_EQ(0, bthread_start_background(&bids[i], NULL, sender,
+                                                 chan));
+        }
+    }
+
+    const int64_t begin_us = butil::gettimeofday_us();
+    sleep(FLAGS_duration_s);
+    g_stop = true;
+    for (int i = 0; i < FLAGS_thread_num; ++i) {
+        if (!FLAGS_use_bthread) {
+            pthread_join(pids[i], NULL);
+        } else {
+            bthread_join(bids[i], NULL);
+        }
+    }
+    const double elapsed_s =
+        (butil::gettimeofday_us() - begin_us) / 1000000.0;
+
+    bench::JsonReporter reporter("echo");
+    reporter.AddLabel("protocol", FLAGS_protocol);
+    reporter.AddLabel("connection_num", (long)FLAGS_connection_num);
+    reporter.AddLabel("thread_num", (long)FLAGS_thread_num);
+    reporter.AddLabel("request_size", (long)FLAGS_request_size);
+    reporter.AddLabel("attachment_size", (long)FLAGS_attachment_size);
+    reporter.AddMetric("qps", g_nsucceed.load() / elapsed_s);
+    reporter.AddMetric("failed", g_nfailed.load());
+    reporter.AddMetric("latency_avg_us", g_latency_recorder.latency());
+    reporter.AddMetric("latency_p99_us",
+                       g_latency_recorder.latency_percentile(0.99));
+    reporter.AddMetric("latency_p999_us",
+                       g_latency_recorder.latency_percentile(0.999));
+    reporter.Print();
+
+    server.Stop(0);
+    server.Join();
+    for (size_t i = 0; i < channels.size(); ++i) {
+        delete channels[i];
+    }
+    return 0;
+}
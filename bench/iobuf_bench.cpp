@@ -0,0 +1,124 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// IOBuf operation kernels, reported as ns/op: copying appends of small
+// payloads, reference appends between IOBufs, cutn, copy_to and
+// IOBufAppender. These dominate the serialization paths of all
+// protocols, regressions here show up in every end-to-end number.
+
+#include <gflags/gflags.h>
+#include <butil/logging.h>
+#include <butil/time.h>
+#include <butil/iobuf.h>
+#include "bench_common.h"
+
+DEFINE_int32(iterations, 1000000, "Iterations per kernel");
+DEFINE_int32(small_size, 64, "Bytes of small payloads");
+DEFINE_int32(large_size, 4096, "Bytes of large payloads");
+
+namespace {
+
+double NsPerOp(const butil::Timer& tm, long nops) {
+    return tm.n_elapsed() / (double)nops;
+}
+
+double BenchAppendSmall() {
+    const std::string payload(FLAGS_small_size, 'p');
+    butil::Timer tm;
+    tm.start();
+    for (int i = 0; i < FLAGS_iterations; ++i) {
+        butil::IOBuf buf;
+        buf.append(payload.data(), payload.size());
+    }
+    tm.stop();
+    return NsPerOp(tm, FLAGS_iterations);
+}
+
+double BenchAppendByRef() {
+    butil::IOBuf src;
+    src.resize(FLAGS_large_size, 'p');
+    butil::Timer tm;
+    tm.start();
+    for (int i = 0; i < FLAGS_iterations; ++i) {
+        butil::IOBuf buf;
+        buf.append(src);  // shares blocks by reference
+    }
+    tm.stop();
+    return NsPerOp(tm, FLAGS_iterations);
+}
+
+double BenchCutn() {
+    butil::IOBuf src;
+    src.resize(FLAGS_large_size, 'p');
+    butil::Timer tm;
+    tm.start();
+    for (int i = 0; i < FLAGS_iterations; ++i) {
+        butil::IOBuf from = src;
+        butil::IOBuf to;
+        from.cutn(&to, FLAGS_small_size);
+    }
+    tm.stop();
+    return NsPerOp(tm, FLAGS_iterations);
+}
+
+double BenchCopyTo() {
+    butil::IOBuf src;
+    src.resize(FLAGS_large_size, 'p');
+    std::vector<char> sink(FLAGS_large_size);
+    butil::Timer tm;
+    tm.start();
+    for (int i = 0; i < FLAGS_iterations; ++i) {
+        src.copy_to(&sink[0], FLAGS_large_size);
+    }
+    tm.stop();
+    return NsPerOp(tm, FLAGS_iterations);
+}
+
+double BenchAppender() {
+    const std::string payload(FLAGS_small_size, 'p');
+    butil::IOBufAppender appender;
+    butil::Timer tm;
+    tm.start();
+    for (int i = 0; i < FLAGS_iterations; ++i) {
+        appender.append(payload.data(), payload.size());
+        if ((i & 1023) == 1023) {
+            // Cap memory: take the accumulated buffer away periodically.
+            butil::IOBuf tmp;
+            appender.move_to(tmp);
+        }
+    }
+    tm.stop();
+    return NsPerOp(tm, FLAGS_iterations);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    GFLAGS_NS::ParseCommandLineFlags(&argc, &argv, true);
+
+    bench::JsonReporter reporter("iobuf");
+    reporter.AddLabel("iterations", (long)FLAGS_iterations);
+    reporter.AddLabel("small_size", (long)FLAGS_small_size);
+    reporter.AddLabel("large_size", (long)FLAGS_large_size);
+    reporter.AddMetric("append_small_ns", BenchAppendSmall());
+    reporter.AddMetric("append_by_ref_ns", BenchAppendByRef());
+    reporter.AddMetric("cutn_ns", BenchCutn());
+    reporter.AddMetric("copy_to_ns", BenchCopyTo());
+    reporter.AddMetric("appender_append_ns", BenchAppender());
+    reporter.Print();
+    return 0;
+}
@@ -0,0 +1,156 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// ParallelChannel fan-out benchmark: each call fans out to -fan_out
+// sub-channels pointing at an in-process server, modeled on
+// example/parallel_echo_c++. The cost being measured is the fan-out /
+// merge machinery of ParallelChannel rather than the network.
+
+#include <gflags/gflags.h>
+#include <vector>
+#include <bthread/bthread.h>
+#include <butil/logging.h>
+#include <butil/time.h>
+#include <butil/atomicops.h>
+#include <brpc/server.h>
+#include <brpc/channel.h>
+#include <brpc/parallel_channel.h>
+#include <bvar/bvar.h>
+#include "echo.pb.h"
+#include "bench_common.h"
+
+DEFINE_int32(fan_out, 16, "Number of sub channels of the ParallelChannel");
+DEFINE_int32(thread_num, 8, "Number of threads to send requests");
+DEFINE_int32(request_size, 16, "Bytes of each request");
+DEFINE_int32(duration_s, 10, "Seconds that the benchmark runs");
+DEFINE_int32(port, 8002, "TCP Port of the in-process server");
+DEFINE_int32(timeout_ms, 1000, "RPC timeout in milliseconds");
+
+namespace {
+
+std::string g_request;
+volatile bool g_stop = false;
+bvar::LatencyRecorder g_latency_recorder("parallel_channel_bench");
+butil::atomic<long> g_nsucceed(0);
+butil::atomic<long> g_nfailed(0);
+
+class EchoServiceImpl : public bench::EchoService {
+public:
+    void Echo(google::protobuf::RpcController*,
+              const bench::EchoRequest* request,
+              bench::EchoResponse* response,
+              google::protobuf::Closure* done) {
+        brpc::ClosureGuard done_guard(done);
+        response->set_message(request->message());
+    }
+};
+
+void* sender(void* arg) {
+    bench::EchoService_Stub stub(
+        static_cast<google::protobuf::RpcChannel*>(arg));
+    while (!g_stop) {
+        bench::EchoRequest request;
+        bench::EchoResponse response;
+        brpc::Controller cntl;
+        request.set_message(g_request);
+        stub.Echo(&cntl, &request, &response, NULL);
+        if (!cntl.Failed()) {
+            g_latency_recorder << cntl.latency_us();
+            g_nsucceed.fetch_add(1, butil::memory_order_relaxed);
+        } else {
+            g_nfailed.fetch_add(1, butil::memory_order_relaxed);
+            bthread_usleep(10000);
+        }
+    }
+    return NULL;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    GFLAGS_NS::ParseCommandLineFlags(&argc, &argv, true);
+
+    brpc::Server server;
+    EchoServiceImpl echo_service;
+    if (server.AddService(&echo_service,
+                          brpc::SERVER_DOESNT_OWN_SERVICE) != 0 ||
+        server.Start(FLAGS_port, NULL) != 0) {
+        LOG(ERROR) << "Fail to start server";
+        return -1;
+    }
+    if (FLAGS_fan_out <= 0 || FLAGS_thread_num <= 0 ||
+        FLAGS_request_size <= 0) {
+        LOG(ERROR) << "Invalid -fan_out/-thread_num/-request_size";
+        return -1;
+    }
+    g_request.resize(FLAGS_request_size, 'r');
+
+    brpc::ParallelChannel channel;
+    brpc::ParallelChannelOptions pchan_options;
+    pchan_options.timeout_ms = FLAGS_timeout_ms;
+    if (channel.Init(&pchan_options) != 0) {
+        LOG(ERROR) << "Fail to init ParallelChannel";
+        return -1;
+    }
+    brpc::ChannelOptions sub_options;
+    sub_options.protocol = brpc::PROTOCOL_BAIDU_STD;
+    sub_options.timeout_ms = FLAGS_timeout_ms;
+    sub_options.max_retry = 0;
+    for (int i = 0; i < FLAGS_fan_out; ++i) {
+        brpc::Channel* sub_channel = new brpc::Channel;
+        if (sub_channel->Init(butil::EndPoint(butil::my_ip(), FLAGS_port),
+                              &sub_options) != 0) {
+            LOG(ERROR) << "Fail to init sub channel " << i;
+            return -1;
+        }
+        if (channel.AddChannel(sub_channel, brpc::OWNS_CHANNEL,
+                               NULL, NULL) != 0) {
+            LOG(ERROR) << "Fail to AddChannel, i=" << i;
+            return -1;
+        }
+    }
+
+    std::vector<pthread_t> pids(FLAGS_thread_num);
+    for (int i = 0; i < FLAGS_thread_num; ++i) {
+        CHECK_EQ(0, pthread_create(&pids[i], NULL, sender, &channel));
+    }
+    const int64_t begin_us = butil::gettimeofday_us();
+    sleep(FLAGS_duration_s);
+    g_stop = true;
+    for (int i = 0; i < FLAGS_thread_num; ++i) {
+        pthread_join(pids[i], NULL);
+    }
+    const double elapsed_s =
+        (butil::gettimeofday_us() - begin_us) / 1000000.0;
+
+    bench::JsonReporter reporter("parallel_channel");
+    reporter.AddLabel("fan_out", (long)FLAGS_fan_out);
+    reporter.AddLabel("thread_num", (long)FLAGS_thread_num);
+    reporter.AddLabel("request_size", (long)FLAGS_request_size);
+    reporter.AddMetric("qps", g_nsucceed.load() / elapsed_s);
+    reporter.AddMetric("sub_calls_per_s",
+                       g_nsucceed.load() * (double)FLAGS_fan_out / elapsed_s);
+    reporter.AddMetric("failed", g_nfailed.load());
+    reporter.AddMetric("latency_avg_us", g_latency_recorder.latency());
+    reporter.AddMetric("latency_p99_us",
+                       g_latency_recorder.latency_percentile(0.99));
+    reporter.Print();
+
+    server.Stop(0);
+    server.Join();
+    return 0;
+}
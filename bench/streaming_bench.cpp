@@ -0,0 +1,164 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// Streaming throughput benchmark: the client pushes -msg_size byte
+// messages through a brpc Stream to an in-process server for -duration_s
+// seconds, modeled on example/streaming_echo_c++. Reports messages and
+// megabytes moved per second as seen by the receiver.
+
+#include <gflags/gflags.h>
+#include <bthread/bthread.h>
+#include <butil/logging.h>
+#include <butil/time.h>
+#include <butil/atomicops.h>
+#include <brpc/server.h>
+#include <brpc/channel.h>
+#include <brpc/stream.h>
+#include "echo.pb.h"
+#include "bench_common.h"
+
+DEFINE_int32(msg_size, 1024, "Bytes of each streamed message");
+DEFINE_int32(duration_s, 10, "Seconds that the benchmark runs");
+DEFINE_int32(port, 8002, "TCP Port of the in-process server");
+DEFINE_int32(max_buf_size, 2 * 1024 * 1024,
+             "StreamOptions.max_buf_size of both sides");
+
+namespace {
+
+butil::atomic<long> g_nreceived(0);
+butil::atomic<long> g_bytes_received(0);
+
+class CountingReceiver : public brpc::StreamInputHandler {
+public:
+    int on_received_messages(brpc::StreamId /*id*/,
+                             butil::IOBuf* const messages[],
+                             size_t size) {
+        long bytes = 0;
+        for (size_t i = 0; i < size; ++i) {
+            bytes += messages[i]->size();
+        }
+        g_nreceived.fetch_add(size, butil::memory_order_relaxed);
+        g_bytes_received.fetch_add(bytes, butil::memory_order_relaxed);
+        return 0;
+    }
+    void on_idle_timeout(brpc::StreamId /*id*/) {}
+    void on_closed(brpc::StreamId /*id*/) {}
+};
+
+class StreamingEchoService : public bench::EchoService {
+public:
+    StreamingEchoService() : _sd(brpc::INVALID_STREAM_ID) {}
+    ~StreamingEchoService() {
+        brpc::StreamClose(_sd);
+    }
+    void Echo(google::protobuf::RpcController* controller,
+              const bench::EchoRequest*,
+              bench::EchoResponse* response,
+              google::protobuf::Closure* done) {
+        brpc::ClosureGuard done_guard(done);
+        brpc::Controller* cntl = static_cast<brpc::Controller*>(controller);
+        brpc::StreamOptions stream_options;
+        stream_options.handler = &_receiver;
+        stream_options.max_buf_size = FLAGS_max_buf_size;
+        if (brpc::StreamAccept(&_sd, *cntl, &stream_options) != 0) {
+            cntl->SetFailed("Fail to accept stream");
+            return;
+        }
+        response->set_message("Accepted stream");
+    }
+private:
+    CountingReceiver _receiver;
+    brpc::StreamId _sd;
+};
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    GFLAGS_NS::ParseCommandLineFlags(&argc, &argv, true);
+
+    brpc::Server server;
+    StreamingEchoService service;
+    if (server.AddService(&service, brpc::SERVER_DOESNT_OWN_SERVICE) != 0 ||
+        server.Start(FLAGS_port, NULL) != 0) {
+        LOG(ERROR) << "Fail to start server";
+        return -1;
+    }
+
+    brpc::Channel channel;
+    brpc::ChannelOptions options;
+    options.protocol = brpc::PROTOCOL_BAIDU_STD;
+    if (channel.Init(butil::EndPoint(butil::my_ip(), FLAGS_port),
+                     &options) != 0) {
+        LOG(ERROR) << "Fail to initialize channel";
+        return -1;
+    }
+
+    brpc::Controller cntl;
+    brpc::StreamId stream;
+    brpc::StreamOptions stream_options;
+    stream_options.max_buf_size = FLAGS_max_buf_size;
+    if (brpc::StreamCreate(&stream, cntl, &stream_options) != 0) {
+        LOG(ERROR) << "Fail to create stream";
+        return -1;
+    }
+    bench::EchoService_Stub stub(&channel);
+    bench::EchoRequest request;
+    bench::EchoResponse response;
+    request.set_message("create stream");
+    stub.Echo(&cntl, &request, &response, NULL);
+    if (cntl.Failed()) {
+        LOG(ERROR) << "Fail to connect stream: " << cntl.ErrorText();
+        return -1;
+    }
+
+    butil::IOBuf msg;
+    msg.resize(FLAGS_msg_size, 'm');
+    long nwritten = 0;
+    const int64_t begin_us = butil::gettimeofday_us();
+    const int64_t end_us = begin_us + FLAGS_duration_s * 1000000L;
+    while (butil::gettimeofday_us() < end_us) {
+        const int rc = brpc::StreamWrite(stream, msg);
+        if (rc == 0) {
+            ++nwritten;
+        } else if (rc == EAGAIN) {
+            // The stream is full, wait until writable.
+            const timespec duetime = butil::milliseconds_from_now(100);
+            brpc::StreamWait(stream, &duetime);
+        } else {
+            LOG(ERROR) << "Fail to write stream: " << berror(rc);
+            break;
+        }
+    }
+    const double elapsed_s =
+        (butil::gettimeofday_us() - begin_us) / 1000000.0;
+    // Let in-flight messages drain before reading the counters.
+    usleep(200 * 1000);
+
+    bench::JsonReporter reporter("streaming");
+    reporter.AddLabel("msg_size", (long)FLAGS_msg_size);
+    reporter.AddMetric("written_per_s", nwritten / elapsed_s);
+    reporter.AddMetric("received_per_s", g_nreceived.load() / elapsed_s);
+    reporter.AddMetric(
+        "throughput_mb_s",
+        g_bytes_received.load() / elapsed_s / (1024.0 * 1024.0));
+    reporter.Print();
+
+    brpc::StreamClose(stream);
+    server.Stop(0);
+    server.Join();
+    return 0;
+}
@@ -0,0 +1,117 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// Byte-scanning kernels of butil/simd_search.h against their scalar
+// equivalents, reported as GB/s: memchr2 (the CRLF search of line-based
+// protocols), memmem (multipart-boundary style search) and
+// IOBuf::cut_until which is built on them. The haystack has the match at
+// the very end so every run scans the whole payload.
+
+#include <gflags/gflags.h>
+#include <string.h>
+#include <butil/logging.h>
+#include <butil/time.h>
+#include <butil/iobuf.h>
+#include <butil/simd_search.h>
+#include "bench_common.h"
+
+DEFINE_int32(iterations, 20000, "Iterations per kernel");
+DEFINE_int32(haystack_size, 65536, "Bytes scanned per iteration");
+
+namespace {
+
+double GBps(const butil::Timer& tm, long nbytes) {
+    return nbytes / (double)tm.n_elapsed();  // bytes/ns == GB/s
+}
+
+std::string MakeHaystack(const std::string& tail) {
+    std::string s(FLAGS_haystack_size - tail.size(), 'x');
+    return s + tail;
+}
+
+const char* naive_memchr2(const char* s, size_t n, char c1, char c2) {
+    for (size_t i = 0; i + 2 <= n; ++i) {
+        if (s[i] == c1 && s[i + 1] == c2) {
+            return s + i;
+        }
+    }
+    return NULL;
+}
+
+double BenchMemchr2(bool use_simd) {
+    const std::string hay = MakeHaystack("\r\n");
+    const char* found = NULL;
+    butil::Timer tm;
+    tm.start();
+    for (int i = 0; i < FLAGS_iterations; ++i) {
+        found = use_simd
+            ? butil::simd::memchr2(hay.data(), hay.size(), '\r', '\n')
+            : naive_memchr2(hay.data(), hay.size(), '\r', '\n');
+    }
+    tm.stop();
+    CHECK_EQ(hay.data() + hay.size() - 2, found);
+    return GBps(tm, (long)FLAGS_iterations * hay.size());
+}
+
+double BenchMemmem(bool use_simd) {
+    const std::string NEEDLE = "--boundary--";
+    const std::string hay = MakeHaystack(NEEDLE);
+    const void* found = NULL;
+    butil::Timer tm;
+    tm.start();
+    for (int i = 0; i < FLAGS_iterations; ++i) {
+        found = use_simd
+            ? butil::simd::memmem(hay.data(), hay.size(),
+                                  NEEDLE.data(), NEEDLE.size())
+            : ::memmem(hay.data(), hay.size(), NEEDLE.data(), NEEDLE.size());
+    }
+    tm.stop();
+    CHECK_EQ(hay.data() + hay.size() - NEEDLE.size(), found);
+    return GBps(tm, (long)FLAGS_iterations * hay.size());
+}
+
+double BenchCutUntil() {
+    const std::string hay = MakeHaystack("\r\n");
+    butil::IOBuf src;
+    src.append(hay);
+    butil::Timer tm;
+    tm.start();
+    for (int i = 0; i < FLAGS_iterations; ++i) {
+        butil::IOBuf buf = src;
+        butil::IOBuf before;
+        CHECK_EQ(0, buf.cut_until(&before, "\r\n"));
+    }
+    tm.stop();
+    return GBps(tm, (long)FLAGS_iterations * hay.size());
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    GFLAGS_NS::ParseCommandLineFlags(&argc, &argv, true);
+
+    bench::JsonReporter reporter("string_search");
+    reporter.AddLabel("iterations", (long)FLAGS_iterations);
+    reporter.AddLabel("haystack_size", (long)FLAGS_haystack_size);
+    reporter.AddMetric("memchr2_gbps", BenchMemchr2(true));
+    reporter.AddMetric("memchr2_scalar_gbps", BenchMemchr2(false));
+    reporter.AddMetric("memmem_gbps", BenchMemmem(true));
+    reporter.AddMetric("memmem_libc_gbps", BenchMemmem(false));
+    reporter.AddMetric("cut_until_gbps", BenchCutUntil());
+    reporter.Print();
+    return 0;
+}
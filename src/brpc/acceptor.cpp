@@ -18,14 +18,21 @@
 
 #include <inttypes.h>
 #include <gflags/gflags.h>
-#include "butil/fd_guard.h"                 // fd_guard 
+#include "butil/fd_guard.h"                 // fd_guard
 #include "butil/fd_utility.h"               // make_close_on_exec
 #include "butil/time.h"                     // gettimeofday_us
+#include "butil/string_printf.h"            // string_printf
 #include "brpc/acceptor.h"
 
 
 namespace brpc {
 
+DEFINE_bool(reuseport_acceptors, false,
+            "Listen on one extra SO_REUSEPORT socket per event dispatcher "
+            "in addition to the user-visible one, so that the kernel "
+            "spreads incoming connections among the dispatchers instead of "
+            "funneling them through a single accept queue");
+
 static const int INITIAL_CONNECTION_CAP = 65536;
 
 Acceptor::Acceptor(bthread_keytable_pool_t* pool)
@@ -36,6 +43,7 @@ Acceptor::Acceptor(bthread_keytable_pool_t* pool)
     , _close_idle_tid(INVALID_BTHREAD)
     , _listened_fd(-1)
     , _acception_id(0)
+    , _alive_extra_listeners(0)
     , _empty_cond(&_map_mutex)
     , _ssl_ctx(NULL) {
 }
@@ -85,12 +93,49 @@ int Acceptor::StartAccept(int listened_fd, int idle_timeout_sec,
         LOG(FATAL) << "Fail to create _acception_id";
         return -1;
     }
-    
+
+    const ListenerStat stat = {
+        _acception_id,
+        new bvar::Adder<int64_t>(butil::string_printf(
+            "rpc_acceptor_%d_connection_count", listened_fd))
+    };
+    _listener_stats.push_back(stat);
+
     _listened_fd = listened_fd;
     _status = RUNNING;
     return 0;
 }
 
+int Acceptor::AddExtraListener(int listened_fd) {
+    if (listened_fd < 0) {
+        LOG(ERROR) << "Invalid listened_fd=" << listened_fd;
+        return -1;
+    }
+    BAIDU_SCOPED_LOCK(_map_mutex);
+    if (_status != RUNNING) {
+        LOG(ERROR) << "Acceptor is not running: status=" << status();
+        return -1;
+    }
+    SocketOptions options;
+    options.fd = listened_fd;
+    options.user = this;
+    options.on_edge_triggered_events = OnNewConnections;
+    SocketId acception_id;
+    if (Socket::Create(options, &acception_id) != 0) {
+        LOG(ERROR) << "Fail to create extra acception";
+        return -1;
+    }
+    _extra_acception_ids.push_back(acception_id);
+    ++_alive_extra_listeners;
+    const ListenerStat stat = {
+        acception_id,
+        new bvar::Adder<int64_t>(butil::string_printf(
+            "rpc_acceptor_%d_connection_count", listened_fd))
+    };
+    _listener_stats.push_back(stat);
+    return 0;
+}
+
 void* Acceptor::CloseIdleConnections(void* arg) {
     Acceptor* am = static_cast<Acceptor*>(arg);
     std::vector<SocketId> checking_fds;
@@ -124,6 +169,15 @@ void Acceptor::StopAccept(int /*closewait_ms*/) {
     // Don't set _acception_id to 0 because BeforeRecycle needs it.
     Socket::SetFailed(_acception_id);
 
+    std::vector<SocketId> extra_ids;
+    {
+        BAIDU_SCOPED_LOCK(_map_mutex);
+        extra_ids = _extra_acception_ids;
+    }
+    for (size_t i = 0; i < extra_ids.size(); ++i) {
+        Socket::SetFailed(extra_ids[i]);
+    }
+
     // SetFailed all existing connections. Connections added after this piece
     // of code will be SetFailed directly in OnNewConnectionsUntilEAGAIN
     std::vector<SocketId> erasing_ids;
@@ -165,7 +219,8 @@ void Acceptor::Join() {
         return;
     }
     // `_listened_fd' will be set to -1 once it has been recycled
-    while (_listened_fd > 0 || !_socket_map.empty()) {
+    while (_listened_fd > 0 || _alive_extra_listeners > 0 ||
+           !_socket_map.empty()) {
         _empty_cond.Wait();
     }
     const int saved_idle_timeout_sec = _idle_timeout_sec;
@@ -181,6 +236,11 @@ void Acceptor::Join() {
     
     {
         BAIDU_SCOPED_LOCK(_map_mutex);
+        for (size_t i = 0; i < _listener_stats.size(); ++i) {
+            delete _listener_stats[i].nconn;
+        }
+        _listener_stats.clear();
+        _extra_acception_ids.clear();
         _status = READY;
     }
 }
@@ -298,6 +358,13 @@ void Acceptor::OnNewConnectionsUntilEAGAIN(Socket* acception) {
                 // may be called (inside Socket::OnRecycle) after `Acceptor'
                 // has been destroyed
                 am->_socket_map.insert(socket_id, ConnectStatistics());
+                for (size_t i = 0; i < am->_listener_stats.size(); ++i) {
+                    if (am->_listener_stats[i].acception_id ==
+                        acception->id()) {
+                        *am->_listener_stats[i].nconn << 1;
+                        break;
+                    }
+                }
             }
             if (!is_running) {
                 LOG(WARNING) << "Acceptor on fd=" << acception->fd()
@@ -332,6 +399,13 @@ void Acceptor::BeforeRecycle(Socket* sock) {
         _empty_cond.Broadcast();
         return;
     }
+    for (size_t i = 0; i < _extra_acception_ids.size(); ++i) {
+        if (sock->id() == _extra_acception_ids[i]) {
+            --_alive_extra_listeners;
+            _empty_cond.Broadcast();
+            return;
+        }
+    }
     // If a Socket could not be addressed shortly after its creation, it
     // was not added into `_socket_map'.
     _socket_map.erase(sock->id());
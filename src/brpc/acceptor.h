@@ -18,9 +18,11 @@
 #ifndef BRPC_ACCEPTOR_H
 #define BRPC_ACCEPTOR_H
 
+#include <vector>
 #include "bthread/bthread.h"                       // bthread_t
 #include "butil/synchronization/condition_variable.h"
 #include "butil/containers/flat_map.h"
+#include "bvar/reducer.h"                          // bvar::Adder
 #include "brpc/input_messenger.h"
 
 
@@ -56,6 +58,16 @@ public:
     int StartAccept(int listened_fd, int idle_timeout_sec,
                     const std::shared_ptr<SocketSSLContext>& ssl_ctx);
 
+    // [thread-safe] Accept connections from one more listening socket in
+    // addition to the one passed to StartAccept(), typically bound to the
+    // same port with SO_REUSEPORT so that the kernel spreads incoming
+    // connections among the listeners (see -reuseport_acceptors).
+    // Ownership of `listened_fd' is transferred. Accepted connections go
+    // through the same negotiation path as the ones from StartAccept().
+    // Can only be called after a successful StartAccept().
+    // Return 0 on success, -1 otherwise.
+    int AddExtraListener(int listened_fd);
+
     // [thread-safe] Stop accepting connections.
     // `closewait_ms' is not used anymore.
     void StopAccept(int /*closewait_ms*/);
@@ -99,6 +111,20 @@ private:
     // The Socket tso accept connections.
     SocketId _acception_id;
 
+    // Counters of one listening socket, the adder is exposed as
+    // rpc_acceptor_<fd>_connection_count.
+    struct ListenerStat {
+        SocketId acception_id;
+        bvar::Adder<int64_t>* nconn;  // owned
+    };
+    // One entry per listening socket, including the StartAccept() one.
+    // Guarded by _map_mutex.
+    std::vector<ListenerStat> _listener_stats;
+    // Sockets listening in addition to _acception_id, guarded by _map_mutex.
+    std::vector<SocketId> _extra_acception_ids;
+    // Number of sockets in _extra_acception_ids not recycled yet.
+    size_t _alive_extra_listeners;
+
     butil::Mutex _map_mutex;
     butil::ConditionVariable _empty_cond;
     
@@ -0,0 +1,88 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <algorithm>
+#include "butil/logging.h"
+#include "brpc/controller.h"
+#include "brpc/backup_request_policy.h"
+
+
+namespace brpc {
+
+// Allow bursts of this many backup requests after an idle period.
+static const int MAX_BACKUP_TOKENS_X100 = 100 * 100;
+
+AdaptiveBackupRequestPolicy::AdaptiveBackupRequestPolicy(
+    double quantile, int max_backup_percent)
+    : _quantile(quantile)
+    , _max_backup_percent(max_backup_percent)
+    , _tokens_x100(MAX_BACKUP_TOKENS_X100) {
+    if (!(quantile > 0 && quantile < 1)) {
+        LOG(ERROR) << "Invalid quantile=" << quantile << ", changed to 0.99";
+        _quantile = 0.99;
+    }
+    if (max_backup_percent < 0 || max_backup_percent > 100) {
+        LOG(ERROR) << "Invalid max_backup_percent=" << max_backup_percent
+                   << ", changed to 0";
+        _max_backup_percent = 0;
+    }
+}
+
+int32_t AdaptiveBackupRequestPolicy::GetBackupRequestMs(
+    const Controller*) const {
+    const int64_t lat_us = _latency.latency_percentile(_quantile);
+    if (lat_us <= 0) {
+        // Not enough samples yet, don't send backup requests blindly.
+        return -1;
+    }
+    const int64_t ms = (lat_us + 999) / 1000;
+    return (ms <= 0x7fffffff ? (int32_t)ms : 0x7fffffff);
+}
+
+bool AdaptiveBackupRequestPolicy::DoBackup(const Controller*) {
+    int expected = _tokens_x100.load(butil::memory_order_relaxed);
+    while (expected >= 100) {
+        if (_tokens_x100.compare_exchange_weak(
+                expected, expected - 100, butil::memory_order_relaxed)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void AdaptiveBackupRequestPolicy::OnRPCEnd(const Controller* cntl) {
+    if (cntl->ErrorCode() == 0) {
+        // Failed calls (likely timedout) would inflate the quantile right
+        // when hedging matters most, only successful latencies count.
+        _latency << cntl->latency_us();
+    }
+    if (_max_backup_percent <= 0) {
+        return;
+    }
+    int expected = _tokens_x100.load(butil::memory_order_relaxed);
+    while (expected < MAX_BACKUP_TOKENS_X100) {
+        const int desired = std::min(expected + _max_backup_percent,
+                                     MAX_BACKUP_TOKENS_X100);
+        if (_tokens_x100.compare_exchange_weak(
+                expected, desired, butil::memory_order_relaxed)) {
+            return;
+        }
+    }
+}
+
+} // namespace brpc
@@ -0,0 +1,90 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef BRPC_BACKUP_REQUEST_POLICY_H
+#define BRPC_BACKUP_REQUEST_POLICY_H
+
+#include "butil/atomicops.h"
+#include "bvar/latency_recorder.h"
+
+
+namespace brpc {
+
+class Controller;
+
+// Inherit this class to decide dynamically when a backup request should be
+// sent, instead of the fixed delay in ChannelOptions.backup_request_ms.
+class BackupRequestPolicy {
+public:
+    virtual ~BackupRequestPolicy() {}
+
+    // Returns the time in milliseconds that the call represented by `cntl'
+    // waits before sending its backup request. Called once at the beginning
+    // of each call over the channel. Return a negative number to disable
+    // backup request for the call.
+    virtual int32_t GetBackupRequestMs(const Controller* cntl) const = 0;
+
+    // Called when the backup timer of a call fires. Return false to cancel
+    // sending the backup request, in which case the call just continues
+    // waiting for the original response (or timeout). This is the hook for
+    // budgeting: backup traffic can be bounded to a fraction of normal
+    // traffic no matter how latency distribution changes.
+    virtual bool DoBackup(const Controller* cntl) = 0;
+
+    // Called at the end of each call over the channel, whether a backup
+    // request was sent or not. Implementations feed back latencies here.
+    virtual void OnRPCEnd(const Controller* cntl) = 0;
+};
+
+// A BackupRequestPolicy sending the backup request when a call lasts longer
+// than a latency quantile of recent calls over the same channel, so that
+// the delay tracks the actual tail instead of being hand-tuned. A token
+// bucket refilled by finished calls bounds backup requests to at most
+// `max_backup_percent'% of normal traffic; when the budget runs out,
+// backup requests are skipped rather than delayed.
+// [Example]
+//   brpc::AdaptiveBackupRequestPolicy policy(0.99/*quantile*/,
+//                                            5/*max_backup_percent*/);
+//   brpc::ChannelOptions options;
+//   options.backup_request_policy = &policy;
+// Calls are not hedged until enough latencies were collected to make the
+// quantile meaningful.
+class AdaptiveBackupRequestPolicy : public BackupRequestPolicy {
+public:
+    // `quantile' is within (0, 1), e.g. 0.99 delays the backup request
+    // until the call is slower than 99% of recent calls.
+    // `max_backup_percent' is within [0, 100].
+    AdaptiveBackupRequestPolicy(double quantile, int max_backup_percent);
+
+    int32_t GetBackupRequestMs(const Controller* cntl) const;
+    bool DoBackup(const Controller* cntl);
+    void OnRPCEnd(const Controller* cntl);
+
+private:
+    double _quantile;
+    int _max_backup_percent;
+    // Hundredths of a backup request. Each finished call adds
+    // _max_backup_percent, each sent backup request costs 100.
+    butil::atomic<int> _tokens_x100;
+    bvar::LatencyRecorder _latency;
+};
+
+} // namespace brpc
+
+
+#endif  // BRPC_BACKUP_REQUEST_POLICY_H
@@ -0,0 +1,90 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <gflags/gflags.h>
+#include "butil/logging.h"
+#include "brpc/reloadable_flags.h"
+#include "brpc/baggage.h"
+
+
+namespace brpc {
+
+DEFINE_int32(max_baggage_size, 4096,
+             "Max bytes of the serialized tracing baggage of one request."
+             " Appending beyond the limit fails, keeping baggage bounded"
+             " on every hop");
+BRPC_VALIDATE_GFLAG(max_baggage_size, PassValidate);
+
+int AppendBaggage(butil::IOBuf* baggage,
+                  const butil::StringPiece& key,
+                  const butil::StringPiece& value) {
+    if (key.size() > 0xFFFF || value.size() > 0xFFFF) {
+        LOG(ERROR) << "baggage key/value is longer than 65535 bytes";
+        return -1;
+    }
+    const size_t pair_size = 4 + key.size() + value.size();
+    if (baggage->size() + pair_size > (size_t)FLAGS_max_baggage_size) {
+        LOG(ERROR) << "baggage exceeds -max_baggage_size="
+                   << FLAGS_max_baggage_size;
+        return -1;
+    }
+    char header[4];
+    header[0] = (char)(key.size() >> 8);
+    header[1] = (char)(key.size() & 0xFF);
+    header[2] = (char)(value.size() >> 8);
+    header[3] = (char)(value.size() & 0xFF);
+    baggage->append(header, sizeof(header));
+    baggage->append(key.data(), key.size());
+    baggage->append(value.data(), value.size());
+    return 0;
+}
+
+bool FindBaggage(const butil::IOBuf& baggage,
+                 const butil::StringPiece& key,
+                 std::string* value) {
+    butil::IOBuf it = baggage;  // shallow copy referencing same blocks.
+    bool found = false;
+    char header[4];
+    std::string cur_key;
+    while (it.size() >= sizeof(header)) {
+        it.cutn(header, sizeof(header));
+        const size_t klen =
+            ((size_t)(unsigned char)header[0] << 8) | (unsigned char)header[1];
+        const size_t vlen =
+            ((size_t)(unsigned char)header[2] << 8) | (unsigned char)header[3];
+        if (it.size() < klen + vlen) {
+            LOG(WARNING) << "Corrupted baggage, " << it.size()
+                         << " remaining bytes for a " << klen << '/' << vlen
+                         << " pair";
+            return found;
+        }
+        cur_key.clear();
+        it.cutn(&cur_key, klen);
+        if (key == cur_key) {
+            // Keep scanning: the last occurrence of a key wins.
+            value->clear();
+            it.cutn(value, vlen);
+            found = true;
+        } else {
+            it.pop_front(vlen);
+        }
+    }
+    return found;
+}
+
+} // namespace brpc
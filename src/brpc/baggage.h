@@ -0,0 +1,52 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef BRPC_BAGGAGE_H
+#define BRPC_BAGGAGE_H
+
+#include "butil/iobuf.h"
+#include "butil/strings/string_piece.h"
+
+namespace brpc {
+
+// Tracing baggage is a bounded sequence of key/value pairs travelling
+// with a request across hops, serialized as:
+//   per pair: 2-byte big-endian key length, 2-byte big-endian value
+//             length, key bytes, value bytes.
+// Appending never rewrites existing bytes and the pairs are only decoded
+// by FindBaggage, so a hop that merely passes the baggage on splices the
+// received bytes without parsing them.
+
+// Append `key/value' to `baggage'. Appending an existing key overrides
+// its value (the last occurrence wins in FindBaggage).
+// Returns 0 on success, -1 when key or value exceeds 65535 bytes or the
+// baggage would grow beyond -max_baggage_size.
+int AppendBaggage(butil::IOBuf* baggage,
+                  const butil::StringPiece& key,
+                  const butil::StringPiece& value);
+
+// Find the value of `key' in `baggage' and fill `*value' with it. When
+// the key was appended several times the last occurrence wins.
+// Returns true when the key is present.
+bool FindBaggage(const butil::IOBuf& baggage,
+                 const butil::StringPiece& key,
+                 std::string* value);
+
+} // namespace brpc
+
+#endif  // BRPC_BAGGAGE_H
@@ -134,6 +134,7 @@ void ConnectionsService::PrintConnections(
             "<th>Out/s</th>"
             "<th>OutBytes/m</th>"
             "<th>Out/m</th>"
+            "<th>UnconsumedIn</th>"
             "<th>Rtt/Var(ms)</th>"
             "<th>SocketId</th>"
             "</tr>\n";
@@ -145,7 +146,7 @@ void ConnectionsService::PrintConnections(
         os << "SSL|Protocol    |fd   |"
             "InBytes/s|In/s  |InBytes/m |In/m    |"
             "OutBytes/s|Out/s |OutBytes/m|Out/m   |"
-            "Rtt/Var(ms)|SocketId\n";
+            "UnconsumedIn|Rtt/Var(ms)|SocketId\n";
     }
 
     const char* const bar = (use_html ? "</td><td>" : "|");
@@ -191,6 +192,7 @@ void ConnectionsService::PrintConnections(
                << min_width("-", 6) << bar
                << min_width("-", 10) << bar
                << min_width("-", 8) << bar
+               << min_width("-", 12) << bar
                << min_width("-", 11) << bar;
         } else {
             {
@@ -308,6 +310,7 @@ void ConnectionsService::PrintConnections(
                << min_width(stat.out_num_messages_s, 6) << bar
                << min_width(stat.out_size_m, 10) << bar
                << min_width(stat.out_num_messages_m, 8) << bar
+               << min_width(ptr->unconsumed_in_bytes(), 12) << bar
                << min_width(rtt_display, 11) << bar;
         }
 
@@ -0,0 +1,42 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef BRPC_CONTENTIONS_SERVICE_H
+#define BRPC_CONTENTIONS_SERVICE_H
+
+#include "brpc/builtin_service.pb.h"
+
+
+namespace brpc {
+
+// Dump recently sampled contentions of bthread mutexes at
+// /contentions/bthread. The records are collected continuously by
+// bthread with negligible overhead, unlike /pprof/contention which has
+// to be started and stopped.
+class ContentionsService : public contentions {
+public:
+    void bthread(::google::protobuf::RpcController* cntl_base,
+                 const ::brpc::ContentionsRequest* request,
+                 ::brpc::ContentionsResponse* response,
+                 ::google::protobuf::Closure* done);
+};
+
+} // namespace brpc
+
+
+#endif // BRPC_CONTENTIONS_SERVICE_H
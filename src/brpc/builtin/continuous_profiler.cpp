@@ -0,0 +1,222 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <unistd.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <deque>
+#include <gflags/gflags.h>
+#include "butil/file_util.h"
+#include "butil/string_printf.h"
+#include "butil/synchronization/lock.h"
+#include "butil/scoped_lock.h"              // BAIDU_SCOPED_LOCK
+#include "butil/atomicops.h"
+#include "butil/time.h"
+#include "butil/logging.h"
+#include "brpc/builtin/flamegraph.h"        // ParseCpuProfile
+#include "brpc/builtin/continuous_profiler.h"
+
+extern "C" {
+int __attribute__((weak)) ProfilerStart(const char* fname);
+void __attribute__((weak)) ProfilerStop();
+}
+
+namespace brpc {
+
+DEFINE_bool(continuous_profiling, false,
+            "Keep the CPU profiler running in fixed-length chunks so that "
+            "/pprof/retro can serve profiles of the recent past. Read once "
+            "at server start-up");
+DEFINE_int32(continuous_profiling_chunk_seconds, 30,
+             "Length of one continuous-profiling chunk, also the rounding "
+             "granularity of /pprof/retro?seconds=N");
+DEFINE_int32(continuous_profiling_retention_seconds, 600,
+             "Chunks older than this are deleted");
+
+DECLARE_string(rpc_profiling_dir);          // defined in hotspots_service.cpp
+
+struct ProfileChunk {
+    int64_t start_ts;   // unix seconds
+    int64_t end_ts;
+    std::string path;
+};
+
+// State of the (single) continuous profiler.
+static butil::Mutex* g_chunk_mutex = NULL;
+static std::deque<ProfileChunk>* g_chunks = NULL;
+static butil::atomic<int> g_suspend_count(0);
+static butil::atomic<bool> g_chunk_active(false);
+static bool g_started = false;
+static pthread_mutex_t g_start_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int sanitized_chunk_seconds() {
+    int sec = FLAGS_continuous_profiling_chunk_seconds;
+    if (sec < 5) {
+        sec = 5;
+    } else if (sec > FLAGS_continuous_profiling_retention_seconds) {
+        sec = FLAGS_continuous_profiling_retention_seconds;
+    }
+    return sec;
+}
+
+static void PruneOldChunks(int64_t now) {
+    // Caller holds g_chunk_mutex.
+    const int64_t deadline = now - FLAGS_continuous_profiling_retention_seconds;
+    while (!g_chunks->empty() && g_chunks->front().end_ts < deadline) {
+        unlink(g_chunks->front().path.c_str());
+        g_chunks->pop_front();
+    }
+}
+
+static void* ContinuousProfilingThread(void*) {
+    const std::string dir = FLAGS_rpc_profiling_dir + "/continuous";
+    butil::File::Error error;
+    if (!butil::CreateDirectoryAndGetError(butil::FilePath(dir), &error)) {
+        LOG(ERROR) << "Fail to create directory=`" << dir
+                   << "', continuous profiling is disabled";
+        return NULL;
+    }
+    while (true) {
+        if (g_suspend_count.load(butil::memory_order_acquire) > 0) {
+            usleep(100000L);
+            continue;
+        }
+        const int64_t start_ts = time(NULL);
+        std::string path = butil::string_printf(
+            "%s/%" PRId64 ".prof", dir.c_str(), start_ts);
+        if (!ProfilerStart(path.c_str())) {
+            // An on-demand profiler is running, back off.
+            usleep(1000000L);
+            continue;
+        }
+        g_chunk_active.store(true, butil::memory_order_release);
+        const int chunk_sec = sanitized_chunk_seconds();
+        for (int i = 0; i < chunk_sec * 10; ++i) {
+            if (g_suspend_count.load(butil::memory_order_acquire) > 0) {
+                break;
+            }
+            usleep(100000L);
+        }
+        ProfilerStop();
+        g_chunk_active.store(false, butil::memory_order_release);
+        const int64_t end_ts = time(NULL);
+        ProfileChunk chunk = { start_ts, end_ts, path };
+        BAIDU_SCOPED_LOCK(*g_chunk_mutex);
+        g_chunks->push_back(chunk);
+        PruneOldChunks(end_ts);
+    }
+    return NULL;
+}
+
+void ContinuousProfiler::StartIfNeeded() {
+    if (!FLAGS_continuous_profiling) {
+        return;
+    }
+    if ((void*)ProfilerStart == NULL || (void*)ProfilerStop == NULL) {
+        LOG(WARNING) << "-continuous_profiling is on but the CPU profiler "
+            "is not linked, check out docs/cn/cpu_profiler.md";
+        return;
+    }
+    BAIDU_SCOPED_LOCK(g_start_mutex);
+    if (g_started) {
+        return;
+    }
+    g_chunk_mutex = new butil::Mutex;
+    g_chunks = new std::deque<ProfileChunk>;
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, ContinuousProfilingThread, NULL) != 0) {
+        PLOG(ERROR) << "Fail to create continuous profiling thread";
+        return;
+    }
+    g_started = true;
+    LOG(INFO) << "Started continuous profiling, chunk="
+              << sanitized_chunk_seconds() << "s retention="
+              << FLAGS_continuous_profiling_retention_seconds << "s";
+}
+
+void ContinuousProfiler::Suspend() {
+    g_suspend_count.fetch_add(1, butil::memory_order_acq_rel);
+    // Wait until the running chunk (at most ~100ms away from noticing us)
+    // is flushed, so that the caller's ProfilerStart succeeds.
+    for (int i = 0; i < 50 &&
+             g_chunk_active.load(butil::memory_order_acquire); ++i) {
+        usleep(10000L);
+    }
+}
+
+void ContinuousProfiler::Resume() {
+    g_suspend_count.fetch_sub(1, butil::memory_order_acq_rel);
+}
+
+int ContinuousProfiler::GetRetroProfile(int seconds, butil::IOBuf* out,
+                                        std::string* error) {
+    if (!g_started) {
+        *error = "continuous profiling is off, start the server with "
+            "-continuous_profiling";
+        return -1;
+    }
+    std::vector<std::string> paths;
+    const int64_t now = time(NULL);
+    {
+        BAIDU_SCOPED_LOCK(*g_chunk_mutex);
+        for (std::deque<ProfileChunk>::const_iterator
+                 it = g_chunks->begin(); it != g_chunks->end(); ++it) {
+            if (seconds <= 0 || it->end_ts >= now - seconds) {
+                paths.push_back(it->path);
+            }
+        }
+    }
+    if (paths.empty()) {
+        *error = "no profile chunks cover the requested period yet, chunks "
+            "become available every -continuous_profiling_chunk_seconds";
+        return -1;
+    }
+    std::map<std::vector<uintptr_t>, int64_t> stacks;
+    int64_t period = 0;
+    std::string maps;
+    for (size_t i = 0; i < paths.size(); ++i) {
+        std::string content;
+        if (!butil::ReadFileToString(butil::FilePath(paths[i]), &content)) {
+            LOG(WARNING) << "Fail to read " << paths[i];
+            continue;
+        }
+        // Newer chunks overwrite period/maps, they're identical in practice.
+        if (ParseCpuProfile(content, &stacks, &period, &maps) != 0) {
+            LOG(WARNING) << paths[i] << " is not a binary CPU profile";
+        }
+    }
+    if (stacks.empty()) {
+        *error = "retained chunks contain no samples";
+        return -1;
+    }
+    // Re-emit the merged samples in the same binary format.
+    const uintptr_t header[5] = { 0, 3, 0, (uintptr_t)period, 0 };
+    out->append(header, sizeof(header));
+    for (std::map<std::vector<uintptr_t>, int64_t>::const_iterator
+             it = stacks.begin(); it != stacks.end(); ++it) {
+        const uintptr_t record_head[2] =
+            { (uintptr_t)it->second, it->first.size() };
+        out->append(record_head, sizeof(record_head));
+        out->append(it->first.data(), it->first.size() * sizeof(uintptr_t));
+    }
+    const uintptr_t trailer[3] = { 0, 1, 0 };
+    out->append(trailer, sizeof(trailer));
+    out->append(maps);
+    return 0;
+}
+
+} // namespace brpc
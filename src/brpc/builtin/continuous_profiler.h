@@ -0,0 +1,60 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef BRPC_BUILTIN_CONTINUOUS_PROFILER_H
+#define BRPC_BUILTIN_CONTINUOUS_PROFILER_H
+
+#include <string>
+#include "butil/iobuf.h"
+
+namespace brpc {
+
+// Keeps the gperftools CPU profiler running in fixed-length chunks and
+// retains the chunk files of the recent past, so that /pprof/retro can
+// serve a profile covering an incident that already happened. Controlled
+// by -continuous_profiling* flags, see continuous_profiler.cpp.
+class ContinuousProfiler {
+public:
+    // Start the chunked profiling thread when -continuous_profiling is on
+    // and the CPU profiler is linked. Idempotent.
+    // Called from Server::StartInternal.
+    static void StartIfNeeded();
+
+    // Temporarily stop chunked profiling so that an on-demand profiler can
+    // take over, since gperftools supports one running profile at a time.
+    // Suspend() returns after the current chunk (if any) is flushed.
+    static void Suspend();
+    static void Resume();
+
+    // Merge retained chunks overlapping the last `seconds' seconds (all
+    // retained chunks when seconds <= 0) into one binary CPU profile
+    // appended to *out. Chunks are whole, thus the covered span is rounded
+    // up to -continuous_profiling_chunk_seconds.
+    // Returns 0 on success, -1 otherwise with a reason in *error.
+    static int GetRetroProfile(int seconds, butil::IOBuf* out,
+                               std::string* error);
+};
+
+// RAII around on-demand profiling sections.
+struct ScopedSuspendContinuousProfiling {
+    ScopedSuspendContinuousProfiling() { ContinuousProfiler::Suspend(); }
+    ~ScopedSuspendContinuousProfiling() { ContinuousProfiler::Resume(); }
+};
+
+} // namespace brpc
+
+#endif // BRPC_BUILTIN_CONTINUOUS_PROFILER_H
@@ -0,0 +1,242 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <inttypes.h>
+#include <algorithm>
+#include <map>
+#include <vector>
+#include "butil/file_util.h"                     // butil::ReadFileToString
+#include "butil/logging.h"
+#include "brpc/builtin/pprof_service.h"          // FindSymbolOfAddress
+#include "brpc/builtin/flamegraph.h"
+
+namespace brpc {
+
+// Layout constants mirroring the defaults of flamegraph.pl.
+static const double IMAGE_WIDTH = 1200;
+static const double FRAME_HEIGHT = 16;
+static const double X_PADDING = 10;
+static const double Y_PADDING = 50;
+static const double FONT_SIZE = 12;
+static const double FONT_WIDTH = 0.59 * FONT_SIZE;  // average char width
+static const double MIN_FRAME_WIDTH = 0.1;          // px, thinner are hidden
+
+struct FrameNode {
+    FrameNode() : nsample(0) {}
+    int64_t nsample;
+    std::map<std::string, FrameNode> children;
+};
+
+// A gperftools CPU profile is a sequence of machine words:
+//   header: 0, 3, 0, sampling_period_us, 0
+//   repeated records: count, depth, pc[depth]
+//   trailer: 0, 1, 0
+// followed by a textual copy of /proc/self/maps.
+int ParseCpuProfile(const std::string& content,
+                    std::map<std::vector<uintptr_t>, int64_t>* stacks,
+                    int64_t* period, std::string* maps) {
+    const uintptr_t* s = (const uintptr_t*)content.data();
+    const size_t nslot = content.size() / sizeof(uintptr_t);
+    if (nslot < 5 || s[0] != 0 || s[1] != 3 || s[2] != 0) {
+        return -1;
+    }
+    if (period != NULL) {
+        *period = s[3];
+    }
+    size_t i = 5;
+    while (i + 3 <= nslot) {
+        const uintptr_t count = s[i];
+        const uintptr_t depth = s[i + 1];
+        if (count == 0 && depth == 1 && s[i + 2] == 0) {  // trailer
+            if (maps != NULL) {
+                maps->assign(content, (i + 3) * sizeof(uintptr_t),
+                             std::string::npos);
+            }
+            return 0;
+        }
+        if (depth == 0 || i + 2 + depth > nslot) {
+            return -1;
+        }
+        std::vector<uintptr_t> stack(s + i + 2, s + i + 2 + depth);
+        (*stacks)[stack] += count;
+        i += 2 + depth;
+    }
+    return -1;
+}
+
+// addr of non-leaf frames is a return address, the call instruction is
+// before it, same adjustment as pprof does.
+static const std::string* SymbolizeFrame(
+    uintptr_t addr, bool is_leaf,
+    std::map<uintptr_t, const std::string*>* cache) {
+    const uintptr_t lookup_addr = (is_leaf ? addr : addr - 1);
+    std::map<uintptr_t, const std::string*>::const_iterator
+        it = cache->find(lookup_addr);
+    if (it != cache->end()) {
+        return it->second;
+    }
+    const std::string* name = FindSymbolOfAddress(lookup_addr);
+    (*cache)[lookup_addr] = name;
+    return name;
+}
+
+static void EscapeXml(const std::string& in, std::string* out) {
+    out->clear();
+    out->reserve(in.size());
+    for (size_t i = 0; i < in.size(); ++i) {
+        switch (in[i]) {
+        case '&': out->append("&amp;"); break;
+        case '<': out->append("&lt;"); break;
+        case '>': out->append("&gt;"); break;
+        case '"': out->append("&quot;"); break;
+        default: out->push_back(in[i]);
+        }
+    }
+}
+
+static size_t MaxDepth(const FrameNode& node) {
+    size_t max_child = 0;
+    for (std::map<std::string, FrameNode>::const_iterator
+             it = node.children.begin(); it != node.children.end(); ++it) {
+        max_child = std::max(max_child, MaxDepth(it->second));
+    }
+    return max_child + 1;
+}
+
+// Deterministic warm color from the name, as flamegraph.pl does with its
+// hashed palette so that the same function keeps its color between renders.
+static void NameToColor(const std::string& name, char* buf, size_t buf_size) {
+    uint32_t h = 0;
+    for (size_t i = 0; i < name.size(); ++i) {
+        h = h * 31 + (uint8_t)name[i];
+    }
+    const int r = 205 + (h % 50);
+    const int g = (h / 50) % 230;
+    const int b = (h / 11500) % 55;
+    snprintf(buf, buf_size, "rgb(%d,%d,%d)", r, g, b);
+}
+
+static void RenderNode(butil::IOBufBuilder& os,
+                       const std::string& name,
+                       const FrameNode& node,
+                       int64_t total_samples,
+                       double x, size_t depth, double image_height,
+                       double px_per_sample) {
+    const double w = node.nsample * px_per_sample;
+    if (w < MIN_FRAME_WIDTH) {
+        return;
+    }
+    const double y = image_height - Y_PADDING - (depth + 1) * FRAME_HEIGHT;
+    std::string escaped;
+    EscapeXml(name, &escaped);
+    char colorbuf[24];
+    NameToColor(name, colorbuf, sizeof(colorbuf));
+    os << "<g>\n<title>" << escaped << " (" << node.nsample << " samples, ";
+    char pctbuf[16];
+    snprintf(pctbuf, sizeof(pctbuf), "%.2f",
+             node.nsample * 100.0 / total_samples);
+    os << pctbuf << "%)</title>\n"
+       << "<rect x=\"" << x << "\" y=\"" << y << "\" width=\"" << w
+       << "\" height=\"" << (FRAME_HEIGHT - 1) << "\" fill=\"" << colorbuf
+       << "\" rx=\"2\" ry=\"2\"/>\n";
+    const size_t max_chars = (size_t)(w / FONT_WIDTH);
+    if (max_chars >= 3) {
+        std::string label = name;
+        if (label.size() > max_chars) {
+            label.resize(max_chars - 2);
+            label.append("..");
+        }
+        EscapeXml(label, &escaped);
+        os << "<text x=\"" << (x + 3) << "\" y=\""
+           << (y + FRAME_HEIGHT - 4.5) << "\" font-size=\"" << FONT_SIZE
+           << "\" font-family=\"Verdana\">" << escaped << "</text>\n";
+    }
+    os << "</g>\n";
+    double child_x = x;
+    for (std::map<std::string, FrameNode>::const_iterator
+             it = node.children.begin(); it != node.children.end(); ++it) {
+        RenderNode(os, it->first, it->second, total_samples,
+                   child_x, depth + 1, image_height, px_per_sample);
+        child_x += it->second.nsample * px_per_sample;
+    }
+}
+
+int MakeFlameGraphFromProfile(const std::string& prof_file,
+                              butil::IOBuf* out) {
+    std::string content;
+    if (!butil::ReadFileToString(butil::FilePath(prof_file), &content)) {
+        LOG(WARNING) << "Fail to read " << prof_file;
+        return -1;
+    }
+    std::map<std::vector<uintptr_t>, int64_t> stacks;
+    if (ParseCpuProfile(content, &stacks, NULL, NULL) != 0 || stacks.empty()) {
+        LOG(WARNING) << prof_file << " is not a binary CPU profile";
+        return -1;
+    }
+
+    // Merge stacks into a tree rooted at "all". Stacks in the profile are
+    // leaf-first, a flamegraph grows from the root.
+    FrameNode root;
+    std::map<uintptr_t, const std::string*> frame_cache;
+    char addrbuf[24];
+    for (std::map<std::vector<uintptr_t>, int64_t>::const_iterator
+             it = stacks.begin(); it != stacks.end(); ++it) {
+        const std::vector<uintptr_t>& stack = it->first;
+        root.nsample += it->second;
+        FrameNode* cur = &root;
+        for (size_t i = stack.size(); i > 0; --i) {
+            const bool is_leaf = (i == 1);
+            const std::string* name =
+                SymbolizeFrame(stack[i - 1], is_leaf, &frame_cache);
+            if (name != NULL) {
+                cur = &cur->children[*name];
+            } else {
+                snprintf(addrbuf, sizeof(addrbuf),
+                         "0x%" PRIxPTR, stack[i - 1]);
+                cur = &cur->children[addrbuf];
+            }
+            cur->nsample += it->second;
+        }
+    }
+    if (root.nsample == 0) {
+        return -1;
+    }
+
+    const size_t depth = MaxDepth(root);
+    const double image_height = depth * FRAME_HEIGHT + 2 * Y_PADDING;
+    const double px_per_sample =
+        (IMAGE_WIDTH - 2 * X_PADDING) / (double)root.nsample;
+
+    butil::IOBufBuilder os;
+    os << "<?xml version=\"1.0\" standalone=\"no\"?>\n"
+       << "<svg version=\"1.1\" width=\"" << IMAGE_WIDTH << "\" height=\""
+       << image_height << "\" xmlns=\"http://www.w3.org/2000/svg\" "
+       << "viewBox=\"0 0 " << IMAGE_WIDTH << ' '
+       << image_height << "\">\n"
+       << "<rect x=\"0\" y=\"0\" width=\"" << IMAGE_WIDTH << "\" height=\""
+       << image_height << "\" fill=\"#f8f8f8\"/>\n"
+       << "<text x=\"" << (IMAGE_WIDTH / 2)
+       << "\" y=\"24\" text-anchor=\"middle\" font-size=\"17\" "
+       << "font-family=\"Verdana\">Flame Graph</text>\n";
+    RenderNode(os, "all", root, root.nsample, X_PADDING, 0,
+               image_height, px_per_sample);
+    os << "</svg>\n";
+    os.move_to(*out);
+    return 0;
+}
+
+} // namespace brpc
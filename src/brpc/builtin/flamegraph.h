@@ -0,0 +1,49 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef BRPC_BUILTIN_FLAMEGRAPH_H
+#define BRPC_BUILTIN_FLAMEGRAPH_H
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "butil/iobuf.h"
+
+namespace brpc {
+
+// Parse the binary gperftools CPU profile in `content': sample counts keyed
+// by stack (leaf first) are accumulated into *stacks, the sampling period
+// in microseconds is put into *period and the trailing /proc/self/maps text
+// into *maps, both of which may be NULL.
+// Returns 0 on success, -1 when content is not such a profile.
+int ParseCpuProfile(const std::string& content,
+                    std::map<std::vector<uintptr_t>, int64_t>* stacks,
+                    int64_t* period, std::string* maps);
+
+// Render a flamegraph SVG of the gperftools CPU profile stored at
+// `prof_file' entirely in-process: the profile is parsed and symbolized
+// with the cached symbol map of /pprof/symbol, identical stacks are merged
+// and the SVG is generated directly, without forking to the pprof and
+// flamegraph perl scripts.
+// Returns 0 on success, -1 otherwise (e.g. the file is not a binary CPU
+// profile), callers should fall back to the perl pipeline then.
+int MakeFlameGraphFromProfile(const std::string& prof_file, butil::IOBuf* out);
+
+} // namespace brpc
+
+#endif // BRPC_BUILTIN_FLAMEGRAPH_H
@@ -29,6 +29,8 @@
 #include "brpc/reloadable_flags.h"
 #include "brpc/builtin/pprof_perl.h"
 #include "brpc/builtin/flamegraph_perl.h"
+#include "brpc/builtin/flamegraph.h"
+#include "brpc/builtin/continuous_profiler.h"
 #include "brpc/builtin/hotspots_service.h"
 #include "brpc/details/tcmalloc_extension.h"
 
@@ -40,6 +42,8 @@ void __attribute__((weak)) ProfilerStop();
 namespace bthread {
 bool ContentionProfilerStart(const char* filename);
 void ContentionProfilerStop();
+bool OffCpuProfilerStart(const char* filename);
+void OffCpuProfilerStop();
 }
 
 
@@ -112,9 +116,15 @@ DEFINE_int32(max_profiling_seconds, 300, "upper limit of running time of profile
 BRPC_VALIDATE_GFLAG(max_profiling_seconds, NonNegativeInteger);
 
 DEFINE_int32(max_profiles_kept, 32,
-             "max profiles kept for cpu/heap/growth/contention respectively");
+             "max profiles kept for cpu/heap/growth/contention/offcpu "
+             "respectively");
 BRPC_VALIDATE_GFLAG(max_profiles_kept, PassValidate);
 
+DEFINE_bool(native_flamegraph, true,
+            "Render flamegraphs of CPU profiles in-process instead of "
+            "forking to the pprof/flamegraph perl scripts");
+BRPC_VALIDATE_GFLAG(native_flamegraph, PassValidate);
+
 static const char* const PPROF_FILENAME = "pprof.pl";
 static const char* const FLAMEGRAPH_FILENAME = "flamegraph.pl";
 static int DEFAULT_PROFILING_SECONDS = 10;
@@ -469,6 +479,41 @@ static void DisplayResult(Controller* cntl,
         }
     }
     
+#if defined(OS_LINUX)
+    // Render flamegraphs in-process when possible: forking a large process
+    // just to run perl may fail under memory pressure and takes seconds,
+    // while the native renderer symbolizes with the cached symbol map of
+    // /pprof/symbol. Failures (e.g. non-binary profiles) fall through to
+    // the perl pipeline below.
+    if (FLAGS_native_flamegraph && display_type == DisplayType::kFlameGraph &&
+        !show_ccount && base_name == NULL) {
+        butil::IOBuf svg;
+        if (MakeFlameGraphFromProfile(prof_name, &svg) == 0) {
+            butil::IOBuf tmp;
+            if (cntl->http_request().uri().GetQuery("view") == NULL) {
+                tmp.append(prof_name);
+                tmp.append("[addToProfEnd]");
+            }
+            tmp.append("[");
+            tmp.append(GetBaseName(prof_name));
+            tmp.append("]\n");
+            tmp.append(svg);
+            tmp.swap(prof_result);
+            // Cache result in file, as the perl pipeline does.
+            char result_name[256];
+            MakeCacheName(result_name, sizeof(result_name), prof_name,
+                          GetBaseName(base_name), display_type, show_ccount);
+            if (!WriteSmallFile(result_name, prof_result)) {
+                LOG(ERROR) << "Fail to write " << result_name;
+                CHECK(butil::DeleteFile(butil::FilePath(result_name), false));
+            }
+            os.move_to(resp);
+            resp.append(prof_result);
+            return;
+        }
+    }
+#endif
+
     std::ostringstream cmd_builder;
 
     std::string pprof_tool{GeneratePerlScriptPath(PPROF_FILENAME)};
@@ -639,7 +684,8 @@ static void DoProfiling(ProfilingType type,
     }
 
     const int seconds = ReadSeconds(cntl);
-    if ((type == PROFILING_CPU || type == PROFILING_CONTENTION)) {
+    if ((type == PROFILING_CPU || type == PROFILING_CONTENTION ||
+         type == PROFILING_OFFCPU)) {
         if (seconds < 0) {
             os << "Invalid seconds" << (use_html ? "</body></html>" : "\n");
             os.move_to(cntl->response_attachment());
@@ -657,7 +703,8 @@ static void DoProfiling(ProfilingType type,
         client_info << "(no auth)";
     }
     client_info << " requests for profiling " << ProfilingType2String(type);
-    if (type == PROFILING_CPU || type == PROFILING_CONTENTION) {
+    if (type == PROFILING_CPU || type == PROFILING_CONTENTION ||
+        type == PROFILING_OFFCPU) {
         LOG(INFO) << client_info.str() << " for " << seconds << " seconds";
     } else {
         LOG(INFO) << client_info.str();
@@ -748,6 +795,7 @@ static void DoProfiling(ProfilingType type,
                 HTTP_STATUS_INTERNAL_SERVER_ERROR);
             return NotifyWaiters(type, cntl, view);
         }
+        ScopedSuspendContinuousProfiling suspend_continuous_profiling;
         if (!ProfilerStart(prof_name)) {
             os << "Another profiler (not via /hotspots/cpu) is running, "
                 "try again later" << (use_html ? "</body></html>" : "\n");
@@ -771,6 +819,21 @@ static void DoProfiling(ProfilingType type,
             PLOG(WARNING) << "Profiling has been interrupted";
         }
         bthread::ContentionProfilerStop();
+    } else if (type == PROFILING_OFFCPU) {
+        if (!bthread::OffCpuProfilerStart(prof_name)) {
+            os << "Another profiler (not via /hotspots/offcpu) is running, "
+                "try again later" << (use_html ? "</body></html>" : "\n");
+            os.move_to(resp);
+            cntl->http_response().set_status_code(HTTP_STATUS_SERVICE_UNAVAILABLE);
+            return NotifyWaiters(type, cntl, view);
+        }
+        // NOTE: this sleep is probably sampled as well and shows up in the
+        // result as a full-window wait inside DoProfiling, which doubles as
+        // a time-scale reference of the profiling window.
+        if (bthread_usleep(seconds * 1000000L) != 0) {
+            PLOG(WARNING) << "Profiling has been interrupted";
+        }
+        bthread::OffCpuProfilerStop();
     } else if (type == PROFILING_HEAP) {
         MallocExtension* malloc_ext = MallocExtension::instance();
         if (malloc_ext == NULL || !has_TCMALLOC_SAMPLE_PARAMETER()) {
@@ -844,7 +907,7 @@ static void StartProfiling(ProfilingType type,
     const char* extra_desc = "";
     if (type == PROFILING_CPU) {
         enabled = cpu_profiler_enabled;
-    } else if (type == PROFILING_CONTENTION) {
+    } else if (type == PROFILING_CONTENTION || type == PROFILING_OFFCPU) {
         enabled = true;
     } else if (type == PROFILING_HEAP) {
         enabled = IsHeapProfilerEnabled();
@@ -916,7 +979,7 @@ static void StartProfiling(ProfilingType type,
         "  var past_prof = document.getElementById('view_prof').value;\n"
         "  var base_prof = document.getElementById('base_prof').value;\n"
         "  var display_type = document.getElementById('display_type').value;\n";
-    if (type == PROFILING_CONTENTION) {
+    if (type == PROFILING_CONTENTION || type == PROFILING_OFFCPU) {
         os << "  var show_ccount = document.getElementById('ccount_cb').checked;\n";
     }
     os << "  var targetURL = '/hotspots/" << type_str << "';\n"
@@ -927,7 +990,7 @@ static void StartProfiling(ProfilingType type,
         "  if (base_prof != '') {\n"
         "    targetURL += '&base=' + base_prof;\n"
         "  }\n";
-    if (type == PROFILING_CONTENTION) {
+    if (type == PROFILING_CONTENTION || type == PROFILING_OFFCPU) {
         os <<
         "  if (show_ccount) {\n"
         "    targetURL += '&ccount';\n"
@@ -980,7 +1043,8 @@ static void StartProfiling(ProfilingType type,
         "  }\n"
         "  $.ajax({\n"
         "    url: \"/hotspots/" << type_str << "_non_responsive?console=1";
-    if (type == PROFILING_CPU || type == PROFILING_CONTENTION) {
+    if (type == PROFILING_CPU || type == PROFILING_CONTENTION ||
+        type == PROFILING_OFFCPU) {
         os << "&seconds=" << seconds;
     }
     if (profiling_client.id != 0) {
@@ -1075,7 +1139,7 @@ static void StartProfiling(ProfilingType type,
         "<option value=flame" << (display_type == DisplayType::kFlameGraph ? " selected" : "") << ">flame</option>"
 #endif
         "<option value=text" << (display_type == DisplayType::kText ? " selected" : "") << ">text</option></select>";
-    if (type == PROFILING_CONTENTION) {
+    if (type == PROFILING_CONTENTION || type == PROFILING_OFFCPU) {
         os << "&nbsp;&nbsp;&nbsp;<label for='ccount_cb'>"
             "<input id='ccount_cb' type='checkbox'"
            << (show_ccount ? " checked=''" : "") <<
@@ -1105,7 +1169,8 @@ static void StartProfiling(ProfilingType type,
         return;
     }
 
-    if ((type == PROFILING_CPU || type == PROFILING_CONTENTION) && view == NULL) {
+    if ((type == PROFILING_CPU || type == PROFILING_CONTENTION ||
+         type == PROFILING_OFFCPU) && view == NULL) {
         if (seconds < 0) {
             os << "Invalid seconds</body></html>";
             os.move_to(cntl->response_attachment());
@@ -1129,11 +1194,13 @@ static void StartProfiling(ProfilingType type,
                       / 1000000.0);
         os << "Your request is merged with the request from "
            << profiling_client.point;
-        if (type == PROFILING_CPU || type == PROFILING_CONTENTION) {
+        if (type == PROFILING_CPU || type == PROFILING_CONTENTION ||
+            type == PROFILING_OFFCPU) {
             os << ", showing in about " << wait_seconds << " seconds ...";
         }
     } else {
-        if ((type == PROFILING_CPU || type == PROFILING_CONTENTION) && view == NULL) {
+        if ((type == PROFILING_CPU || type == PROFILING_CONTENTION ||
+             type == PROFILING_OFFCPU) && view == NULL) {
             os << "Profiling " << ProfilingType2String(type) << " for "
                << seconds << " seconds ...";
         } else {
@@ -1183,6 +1250,14 @@ void HotspotsService::contention(
     return StartProfiling(PROFILING_CONTENTION, cntl_base, done);
 }
 
+void HotspotsService::offcpu(
+    ::google::protobuf::RpcController* cntl_base,
+    const ::brpc::HotspotsRequest*,
+    ::brpc::HotspotsResponse*,
+    ::google::protobuf::Closure* done) {
+    return StartProfiling(PROFILING_OFFCPU, cntl_base, done);
+}
+
 void HotspotsService::cpu_non_responsive(
     ::google::protobuf::RpcController* cntl_base,
     const ::brpc::HotspotsRequest*,
@@ -1215,6 +1290,14 @@ void HotspotsService::contention_non_responsive(
     return DoProfiling(PROFILING_CONTENTION, cntl_base, done);
 }
 
+void HotspotsService::offcpu_non_responsive(
+    ::google::protobuf::RpcController* cntl_base,
+    const ::brpc::HotspotsRequest*,
+    ::brpc::HotspotsResponse*,
+    ::google::protobuf::Closure* done) {
+    return DoProfiling(PROFILING_OFFCPU, cntl_base, done);
+}
+
 void HotspotsService::GetTabInfo(TabInfoList* info_list) const {
     TabInfo* info = info_list->add();
     info->path = "/hotspots/cpu";
@@ -1228,6 +1311,9 @@ void HotspotsService::GetTabInfo(TabInfoList* info_list) const {
     info = info_list->add();
     info->path = "/hotspots/contention";
     info->tab_name = "contention";
+    info = info_list->add();
+    info->path = "/hotspots/offcpu";
+    info->tab_name = "offcpu";
 }
 
 } // namespace brpc
@@ -0,0 +1,181 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <map>
+#include <vector>
+#include <gflags/gflags.h>
+#include "butil/debug/stack_trace.h"
+#include "butil/iobuf.h"
+#include "butil/scoped_lock.h"
+#include "butil/time.h"
+#include "bvar/bvar.h"
+#include "brpc/controller.h"           // Controller
+#include "brpc/closure_guard.h"        // ClosureGuard
+#include "brpc/reloadable_flags.h"
+#include "brpc/builtin/iobuf_copies_service.h"
+#include "brpc/builtin/common.h"
+
+namespace brpc {
+
+// Totals of sampled copies, updated outside the ring mutex.
+static bvar::Adder<int64_t> g_sampled_copy_count("iobuf_sampled_copy_count");
+static bvar::Adder<int64_t> g_sampled_copy_bytes("iobuf_sampled_copy_bytes");
+
+// Recent samples, overwritten circularly.
+struct SampledCopy {
+    int64_t bytes;
+    int64_t realtime_us;
+    butil::debug::StackTrace stack;
+};
+static const size_t SAMPLE_RING_CAPACITY = 64;
+
+// Per-call-site totals, keyed by the raw frame addresses of the stack.
+struct CopySiteStat {
+    CopySiteStat() : count(0), bytes(0) {}
+    int64_t count;
+    int64_t bytes;
+    butil::debug::StackTrace stack;
+};
+
+static pthread_mutex_t g_copy_sample_mutex = PTHREAD_MUTEX_INITIALIZER;
+// Leaked on purpose, copies may be sampled during exit as well.
+static SampledCopy* g_copy_ring = NULL;
+static size_t g_ncopy_sampled = 0;
+static std::map<std::string, CopySiteStat>* g_copy_sites = NULL;
+
+// The hook itself never touches IOBufs, but guard against any deep copy
+// made by code called underneath (e.g. inside backtrace) to be safe.
+static __thread bool tls_inside_copy_sampler = false;
+
+DECLARE_int64(iobuf_copy_sample_min_bytes);
+
+static void SampleIOBufCopy(size_t num_copied) {
+    const int64_t min_bytes = FLAGS_iobuf_copy_sample_min_bytes;
+    if (min_bytes < 0 || (int64_t)num_copied < min_bytes ||
+        tls_inside_copy_sampler) {
+        return;
+    }
+    tls_inside_copy_sampler = true;
+    const butil::debug::StackTrace stack;
+    size_t nframes = 0;
+    const void* const* frames = stack.Addresses(&nframes);
+    {
+        BAIDU_SCOPED_LOCK(g_copy_sample_mutex);
+        if (g_copy_ring == NULL) {
+            g_copy_ring = new SampledCopy[SAMPLE_RING_CAPACITY];
+            g_copy_sites = new std::map<std::string, CopySiteStat>;
+        }
+        SampledCopy& slot = g_copy_ring[g_ncopy_sampled % SAMPLE_RING_CAPACITY];
+        ++g_ncopy_sampled;
+        slot.bytes = num_copied;
+        slot.realtime_us = butil::gettimeofday_us();
+        slot.stack = stack;
+        const std::string site_key((const char*)frames,
+                                   nframes * sizeof(void*));
+        CopySiteStat& site = (*g_copy_sites)[site_key];
+        ++site.count;
+        site.bytes += num_copied;
+        if (site.count == 1) {
+            site.stack = stack;
+        }
+    }
+    g_sampled_copy_count << 1;
+    g_sampled_copy_bytes << num_copied;
+    tls_inside_copy_sampler = false;
+}
+
+// Install/uninstall the hook along with the flag so that disabled mode
+// leaves nothing but a predicted branch in the copy paths.
+static bool ValidateIOBufCopySampleMinBytes(const char*, int64_t value) {
+    butil::iobuf::copy_hook = (value >= 0 ? SampleIOBufCopy : NULL);
+    return true;
+}
+
+DEFINE_int64(iobuf_copy_sample_min_bytes, -1,
+             "Sample the stack of every IOBuf deep copy(copy_to/cutn into"
+             " flat memory, append from flat memory) of at least so many"
+             " bytes, shown at /iobuf_copies. Negative values(default)"
+             " turn sampling off");
+BRPC_VALIDATE_GFLAG(iobuf_copy_sample_min_bytes,
+                    ValidateIOBufCopySampleMinBytes);
+
+void IOBufCopiesService::default_method(
+    ::google::protobuf::RpcController* cntl_base,
+    const ::brpc::IOBufCopiesRequest*,
+    ::brpc::IOBufCopiesResponse*,
+    ::google::protobuf::Closure* done) {
+    ClosureGuard done_guard(done);
+    Controller* cntl = static_cast<Controller*>(cntl_base);
+    cntl->http_response().set_content_type("text/plain");
+
+    if (cntl->http_request().uri().GetQuery("clear") != NULL) {
+        BAIDU_SCOPED_LOCK(g_copy_sample_mutex);
+        g_ncopy_sampled = 0;
+        if (g_copy_sites != NULL) {
+            g_copy_sites->clear();
+        }
+        cntl->response_attachment().append("cleared\n");
+        return;
+    }
+
+    // Copy collected data out of the lock: symbolization below is slow
+    // and must not block the sampling hook.
+    std::vector<CopySiteStat> sites;
+    std::vector<SampledCopy> recent;
+    size_t ntotal = 0;
+    {
+        BAIDU_SCOPED_LOCK(g_copy_sample_mutex);
+        ntotal = g_ncopy_sampled;
+        if (g_copy_sites != NULL) {
+            sites.reserve(g_copy_sites->size());
+            for (std::map<std::string, CopySiteStat>::const_iterator
+                     it = g_copy_sites->begin();
+                 it != g_copy_sites->end(); ++it) {
+                sites.push_back(it->second);
+            }
+        }
+        const size_t nkept = std::min(ntotal, SAMPLE_RING_CAPACITY);
+        for (size_t i = 0; i < nkept; ++i) {
+            recent.push_back(
+                g_copy_ring[(ntotal - 1 - i) % SAMPLE_RING_CAPACITY]);
+        }
+    }
+
+    butil::IOBufBuilder os;
+    os << "iobuf_copy_sample_min_bytes: "
+       << FLAGS_iobuf_copy_sample_min_bytes
+       << (FLAGS_iobuf_copy_sample_min_bytes < 0 ? " (sampling off)" : "")
+       << "\nsampled_copies: " << ntotal
+       << "\nsampled_bytes: " << g_sampled_copy_bytes.get_value()
+       << "\n\n" << sites.size() << " call sites:\n";
+    for (size_t i = 0; i < sites.size(); ++i) {
+        os << "\n[site " << i + 1 << "] count=" << sites[i].count
+           << " bytes=" << sites[i].bytes << '\n';
+#if !defined(__UCLIBC__)
+        sites[i].stack.OutputToStream(&os);
+#endif
+    }
+    os << '\n' << recent.size() << " recent samples (newest first):\n";
+    for (size_t i = 0; i < recent.size(); ++i) {
+        os << "sample bytes=" << recent[i].bytes << " time="
+           << PrintedAsDateTime(recent[i].realtime_us) << '\n';
+    }
+    os.move_to(cntl->response_attachment());
+}
+
+} // namespace brpc
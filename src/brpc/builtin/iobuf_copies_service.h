@@ -0,0 +1,45 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef BRPC_IOBUF_COPIES_SERVICE_H
+#define BRPC_IOBUF_COPIES_SERVICE_H
+
+#include "brpc/builtin_service.pb.h"
+
+
+namespace brpc {
+
+// Shows IOBuf deep copies sampled while -iobuf_copy_sample_min_bytes is
+// non-negative: every copy_to(void*)/cutn(void*)/append(const void*)
+// copying at least so many bytes records its stack into a bounded ring
+// and aggregates bytes per call site. Use the page to find copies worth
+// converting to zero-copy code, then turn sampling off again by setting
+// the flag back to -1(default, no overhead besides a predicted branch).
+// Append ?clear to drop collected samples.
+class IOBufCopiesService : public iobuf_copies {
+public:
+    void default_method(::google::protobuf::RpcController* cntl_base,
+                        const ::brpc::IOBufCopiesRequest* request,
+                        ::brpc::IOBufCopiesResponse* response,
+                        ::google::protobuf::Closure* done);
+};
+
+} // namespace brpc
+
+
+#endif // BRPC_IOBUF_COPIES_SERVICE_H
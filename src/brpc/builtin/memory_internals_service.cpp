@@ -0,0 +1,48 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include "butil/iobuf.h"                     // IOBuf::block_count
+#include "butil/memory_sampler.h"            // DescribeMemorySamples
+#include "brpc/controller.h"                 // Controller
+#include "brpc/closure_guard.h"              // ClosureGuard
+#include "brpc/builtin/memory_internals_service.h"
+
+namespace brpc {
+
+void MemoryInternalsService::default_method(
+    ::google::protobuf::RpcController* cntl_base,
+    const ::brpc::MemoryInternalsRequest*,
+    ::brpc::MemoryInternalsResponse*,
+    ::google::protobuf::Closure* done) {
+    ClosureGuard done_guard(done);
+    Controller *cntl = static_cast<Controller*>(cntl_base);
+    cntl->http_response().set_content_type("text/plain");
+    butil::IOBufBuilder os;
+    os << "iobuf_block_count: " << butil::IOBuf::block_count()
+       << "\niobuf_block_memory: " << butil::IOBuf::block_memory()
+       << "\niobuf_medium_block_count: " << butil::IOBuf::medium_block_count()
+       << "\niobuf_huge_block_count: " << butil::IOBuf::huge_block_count()
+       << "\niobuf_tls_block_count: " << butil::IOBuf::tls_block_count()
+       << "\niobuf_tls_block_memory: " << butil::IOBuf::tls_block_memory()
+       << "\niobuf_new_bigview_count: " << butil::IOBuf::new_bigview_count()
+       << "\n\n";
+    butil::DescribeMemorySamples(os);
+    os.move_to(cntl->response_attachment());
+}
+
+} // namespace brpc
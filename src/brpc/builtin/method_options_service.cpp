@@ -0,0 +1,162 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <ostream>
+#include <limits.h>                         // INT_MAX
+#include <stdlib.h>                         // strtol, strtoll
+
+#include "brpc/closure_guard.h"        // ClosureGuard
+#include "brpc/controller.h"           // Controller
+#include "brpc/errno.pb.h"
+#include "brpc/server.h"
+#include "brpc/builtin/method_options_service.h"
+
+
+namespace brpc {
+
+static int ParsePriority(const std::string& value, int* out) {
+    if (value == "high") {
+        *out = REQUEST_PRIORITY_HIGH;
+    } else if (value == "normal") {
+        *out = REQUEST_PRIORITY_NORMAL;
+    } else if (value == "low") {
+        *out = REQUEST_PRIORITY_LOW;
+    } else if (value == "unset") {
+        *out = REQUEST_PRIORITY_UNSET;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+void MethodOptionsService::default_method(
+    ::google::protobuf::RpcController* cntl_base,
+    const ::brpc::MethodOptionsRequest*,
+    ::brpc::MethodOptionsResponse*,
+    ::google::protobuf::Closure* done) {
+    ClosureGuard done_guard(done);
+    Controller* cntl = static_cast<Controller*>(cntl_base);
+    cntl->http_response().set_content_type("text/plain");
+    const std::string& method_name = cntl->http_request().unresolved_path();
+
+    if (method_name.empty()) {
+        // List current overrides.
+        butil::IOBufBuilder os;
+        os << "version: " << _server->method_options().version() << '\n';
+        _server->method_options().Describe(os);
+        os << "\nUse POST /method_options/<full_method_name> with queries"
+            " max_concurrency=N, request_priority=high|normal|low|unset,"
+            " compress_threshold=N, interceptors=on|off to set overrides,"
+            " or ?remove to restore static settings.\n";
+        os.move_to(cntl->response_attachment());
+        return;
+    }
+
+    const Server::MethodProperty* mp =
+        _server->FindMethodPropertyByFullName(method_name);
+    if (mp == NULL || mp->is_builtin_service) {
+        cntl->SetFailed(ENOMETHOD, "No such method: `%s'",
+                        method_name.c_str());
+        return;
+    }
+    if (cntl->http_request().method() != HTTP_METHOD_POST) {
+        cntl->SetFailed(EPERM, "Require POST to modify method options");
+        return;
+    }
+    const URI& uri = cntl->http_request().uri();
+
+    if (uri.GetQuery("remove") != NULL) {
+        if (_server->method_options().Remove(method_name) != 0) {
+            cntl->SetFailed(EINVAL, "`%s' has no overrides",
+                            method_name.c_str());
+            return;
+        }
+        butil::IOBufBuilder os;
+        os << "Removed overrides of `" << method_name << "', version="
+           << _server->method_options().version() << '\n';
+        os.move_to(cntl->response_attachment());
+        return;
+    }
+
+    DynamicMethodOptions opt;
+    // Start from the current overrides so that a POST changing one field
+    // keeps the others.
+    _server->method_options().Get(method_name, &opt);
+    bool changed = false;
+    char* endptr = NULL;
+
+    const std::string* value = uri.GetQuery("max_concurrency");
+    if (value != NULL) {
+        const long v = strtol(value->c_str(), &endptr, 10);
+        if (*endptr != '\0' || v < -1 || v > INT_MAX) {
+            cntl->SetFailed(EINVAL, "Invalid max_concurrency=%s",
+                            value->c_str());
+            return;
+        }
+        opt.max_concurrency = (int)v;
+        changed = true;
+    }
+    value = uri.GetQuery("request_priority");
+    if (value != NULL) {
+        if (ParsePriority(*value, &opt.request_priority) != 0) {
+            cntl->SetFailed(EINVAL, "Invalid request_priority=%s, should be"
+                            " high|normal|low|unset", value->c_str());
+            return;
+        }
+        changed = true;
+    }
+    value = uri.GetQuery("compress_threshold");
+    if (value != NULL) {
+        const int64_t v = strtoll(value->c_str(), &endptr, 10);
+        if (*endptr != '\0' || v < -1) {
+            cntl->SetFailed(EINVAL, "Invalid compress_threshold=%s",
+                            value->c_str());
+            return;
+        }
+        opt.response_compress_threshold = v;
+        changed = true;
+    }
+    value = uri.GetQuery("interceptors");
+    if (value != NULL) {
+        if (*value == "on") {
+            opt.run_interceptors = true;
+        } else if (*value == "off") {
+            opt.run_interceptors = false;
+        } else {
+            cntl->SetFailed(EINVAL, "Invalid interceptors=%s, should be"
+                            " on|off", value->c_str());
+            return;
+        }
+        changed = true;
+    }
+    if (!changed) {
+        cntl->SetFailed(EINVAL, "No options given, nothing to change");
+        return;
+    }
+    if (_server->method_options().Set(method_name, opt) != 0) {
+        cntl->SetFailed(EINVAL, "Fail to set overrides of `%s'",
+                        method_name.c_str());
+        return;
+    }
+    butil::IOBufBuilder os;
+    os << "Set overrides of `" << method_name << "', version="
+       << _server->method_options().version() << '\n';
+    os.move_to(cntl->response_attachment());
+}
+
+} // namespace brpc
@@ -0,0 +1,52 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef BRPC_METHOD_OPTIONS_SERVICE_H
+#define BRPC_METHOD_OPTIONS_SERVICE_H
+
+#include "brpc/builtin_service.pb.h"
+
+
+namespace brpc {
+
+class Server;
+
+// Update Server::method_options() at runtime:
+//   GET  /method_options                       list current overrides
+//   POST /method_options/<full_method_name>?max_concurrency=N
+//        &request_priority=high|normal|low|unset&compress_threshold=N
+//        &interceptors=on|off                  set/replace overrides
+//   POST /method_options/<full_method_name>?remove
+//                                              restore static settings
+class MethodOptionsService : public method_options {
+public:
+    explicit MethodOptionsService(Server* server) : _server(server) {}
+
+    void default_method(::google::protobuf::RpcController* cntl_base,
+                        const ::brpc::MethodOptionsRequest* request,
+                        ::brpc::MethodOptionsResponse* response,
+                        ::google::protobuf::Closure* done);
+
+private:
+    Server* _server;
+};
+
+} // namespace brpc
+
+
+#endif // BRPC_METHOD_OPTIONS_SERVICE_H
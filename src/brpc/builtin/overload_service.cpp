@@ -0,0 +1,116 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <gflags/gflags.h>
+#include "butil/iobuf.h"
+#include "bvar/variable.h"
+#include "brpc/controller.h"           // Controller
+#include "brpc/server.h"               // Server
+#include "brpc/closure_guard.h"        // ClosureGuard
+#include "brpc/tenant_quota.h"         // TenantQuota
+#include "brpc/builtin/overload_service.h"
+#include "brpc/builtin/common.h"
+
+namespace brpc {
+
+// Print "-flag: value", marking flags the user never touched.
+static void PrintFlag(butil::IOBufBuilder& os, const char* flag) {
+    GFLAGS_NS::CommandLineFlagInfo info;
+    if (GFLAGS_NS::GetCommandLineFlagInfo(flag, &info)) {
+        os << '-' << flag << ": " << info.current_value
+           << (info.is_default ? " (default)" : "") << '\n';
+    }
+}
+
+// Print the current value of the bvar exposed as `bvar_name'. Bvars of
+// stages are created lazily, absence simply means the stage never ran.
+static void PrintCounter(butil::IOBufBuilder& os, const char* label,
+                         const char* bvar_name) {
+    const std::string value = bvar::Variable::describe_exposed(bvar_name);
+    os << label << ": " << (value.empty() ? "0" : value) << '\n';
+}
+
+void OverloadService::default_method(
+    ::google::protobuf::RpcController* cntl_base,
+    const ::brpc::OverloadRequest*,
+    ::brpc::OverloadResponse*,
+    ::google::protobuf::Closure* done) {
+    ClosureGuard done_guard(done);
+    Controller* cntl = static_cast<Controller*>(cntl_base);
+    cntl->http_response().set_content_type("text/plain");
+    const Server* server = cntl->server();
+    const ServerOptions& options = server->options();
+    butil::IOBufBuilder os;
+
+    os << "Overload protection stages in the order a request passes"
+          " through them.\n"
+       << "overload_safe profile: "
+       << (options.overload_safe ? "on" : "off")
+       << " (ServerOptions.overload_safe)\n";
+
+    os << "\n[inbound memory caps]\n";
+    PrintFlag(os, "socket_max_unconsumed_bytes");
+    PrintFlag(os, "max_total_unconsumed_bytes");
+    PrintCounter(os, "connections_dropped", "rpc_inbound_memory_drops");
+
+    os << "\n[deadline early-drop]\n";
+    PrintFlag(os, "baidu_std_propagate_timeout");
+    PrintFlag(os, "baidu_std_reject_expired_requests");
+    PrintCounter(os, "requests_dropped", "rpc_expired_request_drops");
+
+    os << "\n[tenant quotas]\n";
+    if (options.tenant_quota != NULL) {
+        int64_t admitted = 0;
+        int64_t rejected = 0;
+        options.tenant_quota->GetTotals(&admitted, &rejected);
+        os << "enabled: yes (per-tenant bvars in /vars)\n"
+           << "requests_admitted: " << admitted << '\n'
+           << "requests_rejected: " << rejected << '\n';
+    } else {
+        os << "enabled: no (set ServerOptions.tenant_quota)\n";
+    }
+
+    os << "\n[concurrency limiter]\n"
+       << "server max_concurrency: ";
+    if (options.max_concurrency > 0) {
+        os << options.max_concurrency;
+    } else {
+        os << "unlimited";
+    }
+    os << "\nmethod max_concurrency: "
+       << options.method_max_concurrency.value()
+       << " (overridable per method, see /method_options)\n"
+       << "rejections are answered with ELIMIT and counted into the error"
+          " counters of methods in /status\n";
+
+    os << "\n[priority lanes]\n";
+    PrintFlag(os, "request_priority_lane_workers");
+    PrintFlag(os, "request_priority_lane_weight_high");
+    PrintFlag(os, "request_priority_lane_weight_normal");
+    PrintFlag(os, "request_priority_lane_weight_low");
+    os << "lanes queue rather than drop; attach methods with"
+          " RequestPriorityOf(), see /method_options\n";
+
+    os << "\n[bulk write-fail drain]\n";
+    PrintCounter(os, "failed_write_queues_drained",
+                 "rpc_socket_fail_drain_count");
+
+    os.move_to(cntl->response_attachment());
+}
+
+} // namespace brpc
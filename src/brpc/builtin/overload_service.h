@@ -0,0 +1,45 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef BRPC_OVERLOAD_SERVICE_H
+#define BRPC_OVERLOAD_SERVICE_H
+
+#include "brpc/builtin_service.pb.h"
+
+
+namespace brpc {
+
+// Shows the overload protection stages of this server in the order a
+// request passes through them -- inbound memory caps, deadline early-drop,
+// tenant quotas, concurrency limiter, priority lanes and the bulk
+// write-fail drain -- with the configuration and drop counters of each
+// stage, so that the shedding behavior under overload can be audited in
+// one place. The stages are wired coherently by
+// ServerOptions.overload_safe, see the comment in server.h.
+class OverloadService : public overload {
+public:
+    void default_method(::google::protobuf::RpcController* cntl_base,
+                        const ::brpc::OverloadRequest* request,
+                        ::brpc::OverloadResponse* response,
+                        ::google::protobuf::Closure* done);
+};
+
+} // namespace brpc
+
+
+#endif // BRPC_OVERLOAD_SERVICE_H
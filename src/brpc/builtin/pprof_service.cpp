@@ -32,6 +32,7 @@
 #include "brpc/controller.h"                // Controller
 #include "brpc/closure_guard.h"             // ClosureGuard
 #include "brpc/builtin/pprof_service.h"
+#include "brpc/builtin/continuous_profiler.h"
 #include "brpc/builtin/common.h"
 #include "brpc/details/tcmalloc_extension.h"
 #include "bthread/bthread.h"                // bthread_usleep
@@ -136,6 +137,7 @@ void PProfService::profile(
         cntl->SetFailed(EPERM, "Fail to create directory=`%s'",dir.value().c_str());
         return;
     }
+    ScopedSuspendContinuousProfiling suspend_continuous_profiling;
     if (!ProfilerStart(prof_name)) {
         cntl->SetFailed(EAGAIN, "Another profiler is running, try again later");
         return;
@@ -517,6 +519,18 @@ static void FindSymbols(butil::IOBuf* out, std::vector<uintptr_t>& addr_list) {
     }
 }
 
+const std::string* FindSymbolOfAddress(uintptr_t addr) {
+    pthread_once(&s_load_symbolmap_once, LoadSymbols);
+    SymbolMap::const_iterator it = symbol_map.lower_bound(addr);
+    if (it == symbol_map.end() || it->first != addr) {
+        if (it == symbol_map.begin()) {
+            return NULL;
+        }
+        --it;
+    }
+    return it->second.empty() ? NULL : &it->second;
+}
+
 void PProfService::symbol(
     ::google::protobuf::RpcController* controller_base,
     const ::brpc::ProfileRequest* /*request*/,
@@ -569,4 +583,31 @@ void PProfService::cmdline(::google::protobuf::RpcController* controller_base,
     cntl->response_attachment().append(buf, nr);
 }
 
+void PProfService::retro(::google::protobuf::RpcController* controller_base,
+                         const ::brpc::ProfileRequest* /*request*/,
+                         ::brpc::ProfileResponse* /*response*/,
+                         ::google::protobuf::Closure* done) {
+    ClosureGuard done_guard(done);
+    Controller* cntl = static_cast<Controller*>(controller_base);
+    cntl->http_response().set_content_type("text/plain");
+    // Unlike /pprof/profile, `seconds' looks backwards: the profile covers
+    // the last N seconds. Defaults to everything retained.
+    int seconds = 0;
+    const std::string* param =
+        cntl->http_request().uri().GetQuery("seconds");
+    if (param != NULL) {
+        char* endptr = NULL;
+        seconds = strtol(param->c_str(), &endptr, 10);
+        if (*endptr != '\0' || seconds <= 0) {
+            cntl->SetFailed(EINVAL, "Invalid seconds=%s", param->c_str());
+            return;
+        }
+    }
+    std::string error;
+    if (ContinuousProfiler::GetRetroProfile(
+            seconds, &cntl->response_attachment(), &error) != 0) {
+        cntl->SetFailed(EAGAIN, "%s", error.c_str());
+    }
+}
+
 } // namespace brpc
@@ -18,6 +18,7 @@
 #ifndef  BRPC_PPROF_SERVICE_H
 #define  BRPC_PPROF_SERVICE_H
 
+#include <stdint.h>                      // uintptr_t
 #include "brpc/builtin_service.pb.h"
 
 
@@ -54,8 +55,20 @@ public:
                  const ::brpc::ProfileRequest* request,
                  ::brpc::ProfileResponse* response,
                  ::google::protobuf::Closure* done);
+
+    // Serve a CPU profile of the recent past merged from the chunks
+    // retained by continuous profiling (-continuous_profiling).
+    void retro(::google::protobuf::RpcController* controller,
+               const ::brpc::ProfileRequest* request,
+               ::brpc::ProfileResponse* response,
+               ::google::protobuf::Closure* done);
 };
 
+// Return name of the symbol containing `addr', or NULL when unknown. Uses
+// the same symbol map as /pprof/symbol which is built at the first call and
+// cached for later lookups.
+const std::string* FindSymbolOfAddress(uintptr_t addr);
+
 } // namespace brpc
 
 
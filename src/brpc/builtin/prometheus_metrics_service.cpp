@@ -19,6 +19,8 @@
 #include <vector>
 #include <iomanip>
 #include <map>
+#include "butil/memory/singleton_on_pthread_once.h"
+#include "butil/synchronization/lock.h"     // butil::Mutex
 #include "brpc/controller.h"                // Controller
 #include "brpc/server.h"                    // Server
 #include "brpc/closure_guard.h"             // ClosureGuard
@@ -37,6 +39,34 @@ namespace brpc {
 // Defined in server.cpp
 extern const char* const g_server_info_prefix;
 
+// Rendered text of a gauge variable from a previous scrape. bvar has no
+// cheap notion of "changed since", so |desc| (the text the value describes
+// to) doubles as the change detector: a variable describing to the same
+// text is appended from |text| without going through the formatting stream
+// again. Summaries assembled from LatencyRecorder are not cached as their
+// percentiles practically change on every scrape under traffic.
+struct CachedGauge {
+    std::string desc;
+    butil::IOBuf text;
+    uint64_t epoch;
+
+    CachedGauge() : epoch(0) {}
+};
+
+// Shared by all scrapes of this process.
+class PrometheusMetricsCache {
+public:
+    PrometheusMetricsCache() : epoch(0) {}
+
+    // Serializes scrapes as well so that concurrent scrapes do not render
+    // the same variables twice.
+    butil::Mutex mutex;
+    // Incremented per scrape. Entries not touched by the current scrape
+    // belong to hidden or destroyed variables and are dropped afterwards.
+    uint64_t epoch;
+    std::map<std::string, CachedGauge> gauges;
+};
+
 // This is a class that convert bvar result to prometheus output.
 // Currently the output only includes gauge and summary for two
 // reasons:
@@ -46,10 +76,12 @@ extern const char* const g_server_info_prefix;
 // calculates quantiles in the server side.
 class PrometheusMetricsDumper : public bvar::Dumper {
 public:
-    explicit PrometheusMetricsDumper(butil::IOBufBuilder* os,
-                                     const std::string& server_prefix)
+    PrometheusMetricsDumper(butil::IOBufBuilder* os,
+                            const std::string& server_prefix,
+                            PrometheusMetricsCache* cache)
         : _os(os)
-        , _server_prefix(server_prefix) {
+        , _server_prefix(server_prefix)
+        , _cache(cache) {
     }
 
     bool dump(const std::string& name, const butil::StringPiece& desc) override;
@@ -78,6 +110,7 @@ private:
 private:
     butil::IOBufBuilder* _os;
     const std::string _server_prefix;
+    PrometheusMetricsCache* _cache;
     std::map<std::string, SummaryItems> _m;
 };
 
@@ -92,9 +125,30 @@ bool PrometheusMetricsDumper::dump(const std::string& name,
         // Leave it to DumpLatencyRecorderSuffix to output Summary.
         return true;
     }
+    if (_cache == NULL) {
+        *_os << "# HELP " << name << '\n'
+             << "# TYPE " << name << " gauge" << '\n'
+             << name << " " << desc << '\n';
+        return true;
+    }
+    CachedGauge& g = _cache->gauges[name];
+    g.epoch = _cache->epoch;
+    if (!g.text.empty() && g.desc == desc) {
+        // Unchanged since a previous scrape, reuse the rendered text.
+        // buf() flushes the stream so that the ordering is kept.
+        _os->buf().append(g.text);
+        return true;
+    }
+    const size_t rendered_begin = _os->buf().size();
     *_os << "# HELP " << name << '\n'
          << "# TYPE " << name << " gauge" << '\n'
          << name << " " << desc << '\n';
+    butil::IOBuf& rendered = _os->buf();
+    g.desc.assign(desc.data(), desc.size());
+    g.text.clear();
+    // Ref-counted slice, no copying of the payload.
+    rendered.append_to(&g.text, rendered.size() - rendered_begin,
+                       rendered_begin);
     return true;
 }
 
@@ -194,12 +248,25 @@ void PrometheusMetricsService::default_method(::google::protobuf::RpcController*
 
 int DumpPrometheusMetricsToIOBuf(butil::IOBuf* output) {
     butil::IOBufBuilder os;
-    PrometheusMetricsDumper dumper(&os, g_server_info_prefix);
+    PrometheusMetricsCache* cache =
+        butil::get_leaky_singleton<PrometheusMetricsCache>();
+    BAIDU_SCOPED_LOCK(cache->mutex);
+    ++cache->epoch;
+    PrometheusMetricsDumper dumper(&os, g_server_info_prefix, cache);
     const int ndump = bvar::Variable::dump_exposed(&dumper, NULL);
     if (ndump < 0) {
         return -1;
     }
     os.move_to(*output);
+    // Drop variables hidden or destroyed since the last scrape.
+    for (std::map<std::string, CachedGauge>::iterator
+             it = cache->gauges.begin(); it != cache->gauges.end();) {
+        if (it->second.epoch != cache->epoch) {
+            cache->gauges.erase(it++);
+        } else {
+            ++it;
+        }
+    }
     return 0;
 }
 
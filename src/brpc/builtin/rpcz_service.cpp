@@ -285,6 +285,11 @@ static void PrintClientSpan(
                 os << " of invalid version=" << ver;
             }
         }
+        if (span.kernel_received_real_us() != 0) {
+            os << " kernel_rx_delay="
+               << span.received_real_us() - span.kernel_received_real_us()
+               << "us";
+        }
         os << std::endl;
     }
 
@@ -334,6 +339,14 @@ static void PrintServerSpan(std::ostream& os, const RpczSpan& span,
     if (span.parent_span_id() != 0) {
         os << " parent_span=" << Hex(span.parent_span_id());
     }
+    if (span.kernel_received_real_us() != 0) {
+        // Time between the last packet entering the kernel and userspace
+        // reading the request, i.e. network/kernel queueing rather than
+        // time spent by this process.
+        os << " kernel_rx_delay="
+           << span.received_real_us() - span.kernel_received_real_us()
+           << "us";
+    }
     os << std::endl;
     if (PrintAnnotationsAndRealTimeSpan(
             os, span.start_parse_real_us(),
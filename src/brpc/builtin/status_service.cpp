@@ -47,6 +47,10 @@ void StatusService::default_method(::google::protobuf::RpcController* cntl_base,
     ClosureGuard done_guard(done);
     Controller *cntl = static_cast<Controller*>(cntl_base);
     const Server* server = cntl->server();
+    const std::string* format = cntl->http_request().uri().GetQuery("format");
+    if (format != NULL && *format == "json") {
+        return DescribeInJson(cntl);
+    }
     const bool use_html = UseHTML(cntl->http_request());
     
     // NOTE: the plain output also fits format of public/configure so that user
@@ -192,6 +196,18 @@ void StatusService::default_method(::google::protobuf::RpcController* cntl_base,
         os << (use_html ? "</h3>\n" : "]\n");
         nshead_svc->_status->Describe(os, desc_options);
         os << '\n';
+        if (nshead_svc->_methods != NULL) {
+            // Break down by methods registered with AddMethod().
+            for (butil::FlatMap<uint64_t,
+                     NsheadService::NsheadMethodProperty>::const_iterator
+                     it = nshead_svc->_methods->begin();
+                 it != nshead_svc->_methods->end(); ++it) {
+                os << (use_html ? "<h4>" : "[.") << it->second.name
+                   << (use_html ? "</h4>\n" : "]\n");
+                it->second.status->Describe(os, desc_options);
+                os << '\n';
+            }
+        }
     }
 #ifdef ENABLE_THRIFT_FRAMED_PROTOCOL
     const ThriftService* thrift_svc = server->options().thrift_service;
@@ -234,6 +250,65 @@ void StatusService::default_method(::google::protobuf::RpcController* cntl_base,
     cntl->set_response_compress_type(COMPRESS_TYPE_GZIP);
 }
 
+void StatusService::DescribeInJson(Controller* cntl) {
+    const Server* server = cntl->server();
+    cntl->http_response().set_content_type("application/json");
+    butil::IOBufBuilder os;
+    os << "{\"version\":\"" << server->version() << '"'
+       << ",\"non_service_error\":" << server->_nerror_bvar.get_value();
+    ServerStatistics ss;
+    server->GetStat(&ss);
+    os << ",\"connection_count\":" << ss.connection_count
+       << ",\"services\":{";
+    const Server::ServiceMap& services = server->_fullname_service_map;
+    std::ostringstream method_os;
+    bool first_service = true;
+    BAIDU_SCOPED_LOCK(_method_json_mutex);
+    for (Server::ServiceMap::const_iterator
+             iter = services.begin(); iter != services.end(); ++iter) {
+        const Server::ServiceProperty& sp = iter->second;
+        if (!sp.is_user_service()) {
+            continue;
+        }
+        CHECK(sp.service);
+        if (dynamic_cast<Tabbed*>(sp.service)) {
+            continue;
+        }
+        const google::protobuf::ServiceDescriptor* d =
+            sp.service->GetDescriptor();
+        os << (first_service ? "\"" : ",\"") << d->full_name() << "\":{";
+        first_service = false;
+        bool first_method = true;
+        const int method_count = d->method_count();
+        for (int j = 0; j < method_count; ++j) {
+            const google::protobuf::MethodDescriptor* md = d->method(j);
+            Server::MethodProperty* mp =
+                server->_method_map.seek(md->full_name());
+            if (mp == NULL || mp->status == NULL) {
+                continue;
+            }
+            os << (first_method ? "\"" : ",\"") << md->name() << "\":";
+            first_method = false;
+            // NOTE: qps/eps/concurrency of a method not processing any
+            // request keep the values of the last rendering, which is fine
+            // for idle methods and saves re-rendering the full percentile
+            // set of every method on every scrape.
+            CachedMethodJson& cache = _method_json_cache[md->full_name()];
+            const int64_t version = mp->status->ProcessedCount();
+            if (cache.version != version) {
+                method_os.str("");
+                mp->status->DescribeAsJson(method_os);
+                cache.version = version;
+                cache.json = method_os.str();
+            }
+            os << cache.json;
+        }
+        os << '}';
+    }
+    os << "}}";
+    os.move_to(cntl->response_attachment());
+}
+
 void StatusService::GetTabInfo(TabInfoList* info_list) const {
     TabInfo* info = info_list->add();
     info->path = "/status";
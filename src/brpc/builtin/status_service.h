@@ -19,6 +19,9 @@
 #ifndef  BRPC_STATUS_SERVICE_H
 #define  BRPC_STATUS_SERVICE_H
 
+#include <map>
+#include <string>
+#include "butil/synchronization/lock.h"     // butil::Mutex
 #include "brpc/builtin_service.pb.h"
 #include "brpc/builtin/tabbed.h"
 
@@ -26,6 +29,7 @@
 namespace brpc {
 
 class Server;
+class Controller;
 
 class StatusService : public status, public Tabbed {
 public:
@@ -35,6 +39,22 @@ public:
                         ::google::protobuf::Closure* done);
 
     void GetTabInfo(TabInfoList* info_list) const;
+
+private:
+    // Render /status?format=json for machine scraping: per-method JSON
+    // fragments are cached and only re-rendered when the method processed
+    // requests since the last scrape, so frequent scraping of servers with
+    // many mostly-idle methods stays cheap.
+    void DescribeInJson(Controller* cntl);
+
+    struct CachedMethodJson {
+        CachedMethodJson() : version(-1) {}
+        int64_t version;    // MethodStatus::ProcessedCount() at rendering
+        std::string json;
+    };
+    butil::Mutex _method_json_mutex;
+    // Keyed by method full name.
+    std::map<std::string, CachedMethodJson> _method_json_cache;
 };
 
 } // namespace brpc
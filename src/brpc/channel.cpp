@@ -31,6 +31,7 @@
 #include "brpc/details/load_balancer_with_naming.h"
 #include "brpc/controller.h"
 #include "brpc/channel.h"
+#include "brpc/response_cache.h"
 #include "brpc/details/usercode_backup_pool.h"       // TooManyUserCode
 #include "brpc/policy/esp_authenticator.h"
 
@@ -43,6 +44,7 @@ ChannelOptions::ChannelOptions()
     : connect_timeout_ms(200)
     , timeout_ms(500)
     , backup_request_ms(-1)
+    , backup_request_policy(NULL)
     , max_retry(3)
     , enable_circuit_breaker(false)
     , protocol(PROTOCOL_BAIDU_STD)
@@ -51,7 +53,9 @@ ChannelOptions::ChannelOptions()
     , log_succeed_without_server(true)
     , auth(NULL)
     , retry_policy(NULL)
+    , response_cache(NULL)
     , ns_filter(NULL)
+    , connections_per_endpoint(1)
 {}
 
 ChannelSSLOptions* ChannelOptions::mutable_ssl_options() {
@@ -61,8 +65,13 @@ ChannelSSLOptions* ChannelOptions::mutable_ssl_options() {
     return _ssl_options.get();
 }
 
-static ChannelSignature ComputeChannelSignature(const ChannelOptions& opt) {
-    if (opt.auth == NULL &&
+// `stripe' is non-zero for the additional connections created by
+// connections_per_endpoint, distinct values yield distinct signatures
+// (thus distinct sockets in SocketMap).
+static ChannelSignature ComputeChannelSignature(const ChannelOptions& opt,
+                                                int stripe = 0) {
+    if (stripe == 0 &&
+        opt.auth == NULL &&
         !opt.has_ssl_options() &&
         opt.connection_group.empty()) {
         // Returning zeroized result by default is more intuitive for users.
@@ -80,6 +89,10 @@ static ChannelSignature ComputeChannelSignature(const ChannelOptions& opt) {
             buf.append("|conng=");
             buf.append(opt.connection_group);
         }
+        if (stripe != 0) {
+            buf.append("|stripe=");
+            buf.append((char*)&stripe, sizeof(stripe));
+        }
         if (opt.auth) {
             buf.append("|auth=");
             buf.append((char*)&opt.auth, sizeof(opt.auth));
@@ -137,6 +150,10 @@ Channel::~Channel() {
     if (_server_id != INVALID_SOCKET_ID) {
         const ChannelSignature sig = ComputeChannelSignature(_options);
         SocketMapRemove(SocketMapKey(_server_address, sig));
+        for (size_t i = 1; i < _server_stripe_ids.size(); ++i) {
+            SocketMapRemove(SocketMapKey(
+                _server_address, ComputeChannelSignature(_options, i)));
+        }
     }
 }
 
@@ -311,6 +328,30 @@ int Channel::InitSingle(const butil::EndPoint& server_addr_and_port,
         LOG(ERROR) << "Fail to insert into SocketMap";
         return -1;
     }
+    if (_options.connections_per_endpoint < 1) {
+        LOG(ERROR) << "Invalid connections_per_endpoint="
+                   << _options.connections_per_endpoint;
+        return -1;
+    }
+    if (_options.connections_per_endpoint > 1) {
+        _server_stripe_ids.reserve(_options.connections_per_endpoint);
+        _server_stripe_ids.push_back(_server_id);
+        for (int i = 1; i < _options.connections_per_endpoint; ++i) {
+            // A different signature makes SocketMap create a different
+            // socket to the same endpoint. Already-inserted stripes are
+            // removed in dtor on failure.
+            SocketId stripe_id;
+            if (SocketMapInsert(
+                    SocketMapKey(server_addr_and_port,
+                                 ComputeChannelSignature(_options, i)),
+                    &stripe_id, ssl_ctx) != 0) {
+                LOG(ERROR) << "Fail to insert stripe=" << i
+                           << " into SocketMap";
+                return -1;
+            }
+            _server_stripe_ids.push_back(stripe_id);
+        }
+    }
     return 0;
 }
 
@@ -363,6 +404,20 @@ static void HandleBackupRequest(void* arg) {
     bthread_id_error(correlation_id, EBACKUPREQUEST);
 }
 
+static void MakeResponseCacheKey(std::string* key,
+                                 const google::protobuf::MethodDescriptor* method,
+                                 const butil::IOBuf& request_buf) {
+    // Keyed by the exact serialized bytes rather than a hash of them:
+    // colliding keys would silently answer with the response of another
+    // request. pb serialization of one message may vary between processes
+    // (unknown fields, maps), at worst a varied form misses the cache.
+    key->clear();
+    key->reserve(method->full_name().size() + 1 + request_buf.size());
+    key->append(method->full_name());
+    key->push_back('\0');
+    request_buf.append_to(key);
+}
+
 void Channel::CallMethod(const google::protobuf::MethodDescriptor* method,
                          google::protobuf::RpcController* controller_base,
                          const google::protobuf::Message* request,
@@ -417,6 +472,17 @@ void Channel::CallMethod(const google::protobuf::MethodDescriptor* method,
     }
     cntl->set_used_by_rpc();
 
+    // Inherit the tracing baggage of the server-side request being handled
+    // in this bthread. IOBuf assignment shares the received bytes, no
+    // parsing or re-serialization happens on pass-through hops.
+    if (cntl->_request_baggage.empty()) {
+        const butil::IOBuf* parent_baggage =
+            (const butil::IOBuf*)bthread::tls_bls.rpc_baggage;
+        if (parent_baggage != NULL && !parent_baggage->empty()) {
+            cntl->_request_baggage = *parent_baggage;
+        }
+    }
+
     if (cntl->_sender == NULL && IsTraceable(Span::tls_parent())) {
         const int64_t start_send_us = butil::cpuwide_time_us();
         const std::string* method_name = NULL;
@@ -444,7 +510,16 @@ void Channel::CallMethod(const google::protobuf::MethodDescriptor* method,
     // overriding connect_timeout_ms does not make sense, just use the
     // one in ChannelOptions
     cntl->_connect_timeout_ms = _options.connect_timeout_ms;
-    if (cntl->backup_request_ms() == UNSET_MAGIC_NUM) {
+    if (_options.backup_request_policy != NULL) {
+        // Policy gets the final word on whether the backup request is
+        // really sent (in OnVersionedRPCReturned) and collects latencies
+        // of finished calls (in OnRPCEnd).
+        cntl->_backup_request_policy = _options.backup_request_policy;
+        if (cntl->backup_request_ms() == UNSET_MAGIC_NUM) {
+            cntl->set_backup_request_ms(
+                _options.backup_request_policy->GetBackupRequestMs(cntl));
+        }
+    } else if (cntl->backup_request_ms() == UNSET_MAGIC_NUM) {
         cntl->set_backup_request_ms(_options.backup_request_ms);
     }
     if (cntl->connection_type() == CONNECTION_TYPE_UNKNOWN) {
@@ -457,7 +532,16 @@ void Channel::CallMethod(const google::protobuf::MethodDescriptor* method,
     cntl->_auth = _options.auth;
 
     if (SingleServer()) {
-        cntl->_single_server_id = _server_id;
+        if (_server_stripe_ids.empty()) {
+            cntl->_single_server_id = _server_id;
+        } else {
+            // Stripe calls onto the parallel connections. Hashing the
+            // correlation id keeps retries/backup of one call on the same
+            // connection while spreading different calls evenly.
+            cntl->_single_server_id = _server_stripe_ids[
+                butil::fmix64(correlation_id.value) %
+                _server_stripe_ids.size()];
+        }
         cntl->_remote_side = _server_address;
     }
 
@@ -481,6 +565,34 @@ void Channel::CallMethod(const google::protobuf::MethodDescriptor* method,
         return cntl->HandleSendFailed();
     }
 
+    if (_options.response_cache != NULL && method != NULL &&
+        response != NULL && cntl->_request_stream == INVALID_STREAM_ID) {
+        MakeResponseCacheKey(&cntl->_response_cache_key, method,
+                             cntl->_request_buf);
+        butil::IOBuf cached;
+        if (_options.response_cache->Get(cntl->_response_cache_key, &cached)) {
+            butil::IOBufAsZeroCopyInputStream wrapper(cached);
+            if (response->ParseFromZeroCopyStream(&wrapper)) {
+                // Fulfilled locally, end the RPC without touching the
+                // network. cntl->_response_cache stays NULL so that EndRPC
+                // does not put the response back.
+                cntl->HandleCachedResponse();
+                if (done == NULL) {
+                    Join(correlation_id);
+                    if (cntl->_span) {
+                        cntl->SubmitSpan();
+                    }
+                    cntl->OnRPCEnd(butil::gettimeofday_us());
+                }
+                return;
+            }
+            // Treat an unparsable entry as a miss, the call below
+            // overwrites it.
+        }
+        // Make EndRPC save the received response under the key.
+        cntl->_response_cache = _options.response_cache;
+    }
+
     if (cntl->_request_stream != INVALID_STREAM_ID) {
         // Currently we cannot handle retry and backup request correctly
         cntl->set_max_retry(0);
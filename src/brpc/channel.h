@@ -23,6 +23,7 @@
 // on internal structures, use opaque pointers instead.
 
 #include <ostream>                          // std::ostream
+#include <vector>                           // std::vector
 #include "bthread/errno.h"                  // Redefine errno
 #include "butil/intrusive_ptr.hpp"          // butil::intrusive_ptr
 #include "butil/ptr_container.h"
@@ -34,6 +35,7 @@
 #include "brpc/controller.h"                // brpc::Controller
 #include "brpc/details/profiler_linker.h"
 #include "brpc/retry_policy.h"
+#include "brpc/backup_request_policy.h"
 #include "brpc/naming_service_filter.h"
 
 namespace brpc {
@@ -64,6 +66,17 @@ struct ChannelOptions {
     // Maximum: 0x7fffffff (roughly 30 days)
     int32_t backup_request_ms;
 
+    // Decide the backup request delay of each call dynamically (e.g. from
+    // a latency quantile) instead of the fixed backup_request_ms above,
+    // and optionally bound backup traffic to a budget. The interface is
+    // defined in src/brpc/backup_request_policy.h
+    // Overrides backup_request_ms when set. A backup_request_ms set at the
+    // Controller still takes precedence over the delay from this policy.
+    // This object is NOT owned by channel and should remain valid when
+    // channel is used.
+    // Default: NULL
+    BackupRequestPolicy* backup_request_policy;
+
     // Retry limit for RPC over this Channel. <=0 means no retry.
     // Overridable by Controller.set_max_retry().
     // Default: 3
@@ -115,6 +128,16 @@ struct ChannelOptions {
     // Default: NULL
     const RetryPolicy* retry_policy;
 
+    // Serve responses of requests identical to a recently answered one
+    // from this cache without issuing any call. The class is defined in
+    // src/brpc/response_cache.h. Only set this for channels whose methods
+    // are ALL idempotent and tolerate responses that are stale by the ttl
+    // of the cache.
+    // This object is NOT owned by channel and should remain valid when
+    // channel is used.
+    // Default: NULL
+    ResponseCache* response_cache;
+
     // Filter ServerNodes (i.e. based on `tag' field of `ServerNode')
     // which are generated by NamingService. The interface is defined
     // in src/brpc/naming_service_filter.h
@@ -123,6 +146,16 @@ struct ChannelOptions {
     // Default: NULL
     const NamingServiceFilter* ns_filter;
 
+    // Number of parallel connections to the server of a single-server
+    // channel. Each call is striped onto one of the connections by hashing
+    // its correlation id, so that a single heavy backend is not limited by
+    // the serialized writes of one fd (one TCP flow rarely saturates fast
+    // NICs). Only meaningful for CONNECTION_TYPE_SINGLE, pooled and short
+    // connections create fds on demand already. Ignored by channels
+    // initialized with a naming service.
+    // Default: 1
+    int connections_per_endpoint;
+
     // Channels with same connection_group share connections.
     // In other words, set to a different value to stop sharing connections.
     // Case-sensitive, leading and trailing spaces are ignored.
@@ -217,6 +250,9 @@ protected:
 
     butil::EndPoint _server_address;
     SocketId _server_id;
+    // All connection stripes(including _server_id) when
+    // ChannelOptions.connections_per_endpoint > 1, empty otherwise.
+    std::vector<SocketId> _server_stripe_ids;
     Protocol::SerializeRequest _serialize_request;
     Protocol::PackRequest _pack_request;
     Protocol::GetMethodName _get_method_name;
@@ -18,6 +18,7 @@
 #include "brpc/circuit_breaker.h"
 
 #include <cmath>
+#include <sched.h>
 #include <gflags/gflags.h>
 
 #include "brpc/errno.pb.h"
@@ -45,6 +46,15 @@ DEFINE_int32(circuit_breaker_max_isolation_duration_ms, 30000,
     "Maximum isolation duration in milliseconds");
 DEFINE_double(circuit_breaker_epsilon_value, 0.02,
     "ema_alpha = 1 - std::pow(epsilon, 1.0 / window_size)");
+DEFINE_int32(circuit_breaker_feedback_batch_size, 1,
+    "Number of calls staged per worker thread before they are folded into "
+    "the error windows. 1 means per-call feedback. Larger values remove "
+    "the shared-cacheline writes on every finished call at the cost of "
+    "the error windows lagging by at most one batch.");
+DEFINE_int32(circuit_breaker_max_feedback_delay_us, 10000,
+    "Staged calls are folded into the error windows at latest this many "
+    "microseconds after the first call of the batch, even if the batch "
+    "is not full yet.");
 
 namespace {
 // EPSILON is used to generate the smoothing coefficient when calculating EMA.
@@ -102,6 +112,38 @@ bool CircuitBreaker::EmaErrorRecorder::OnCallEnd(int error_code,
     return healthy;
 }
 
+bool CircuitBreaker::EmaErrorRecorder::OnBatchedCallEnd(
+    int error_count, int64_t error_latency_sum,
+    int success_count, int64_t success_latency_sum) {
+    const int count = error_count + success_count;
+    if (count == 0) {
+        return true;
+    }
+    int64_t ema_latency = 0;
+    if (success_count > 0) {
+        ema_latency = UpdateBatchedLatency(success_count, success_latency_sum);
+    } else {
+        ema_latency = _ema_latency.load(butil::memory_order_relaxed);
+    }
+    const bool healthy = UpdateBatchedErrorCost(
+        error_count, error_latency_sum, success_count, ema_latency);
+
+    // When the window is initializing, use error_rate to determine
+    // if it needs to be isolated, same as the per-call path.
+    if (_sample_count_when_initializing.load(butil::memory_order_relaxed) < _window_size &&
+        _sample_count_when_initializing.fetch_add(count, butil::memory_order_relaxed) < _window_size) {
+        if (error_count > 0) {
+            const int32_t error_total =
+                _error_count_when_initializing.fetch_add(
+                    error_count, butil::memory_order_relaxed) + error_count;
+            return error_total <= _window_size * _max_error_percent / 100;
+        }
+        return true;
+    }
+
+    return healthy;
+}
+
 void CircuitBreaker::EmaErrorRecorder::Reset() {
     if (_sample_count_when_initializing.load(butil::memory_order_relaxed) < _window_size) {
         _sample_count_when_initializing.store(0, butil::memory_order_relaxed);
@@ -126,6 +168,28 @@ int64_t CircuitBreaker::EmaErrorRecorder::UpdateLatency(int64_t latency) {
     } while(true);
 }
 
+// Feeding k equal samples one by one into the EMA gives
+// ema' = ema * smooth^k + avg * (1 - smooth^k), which we apply in one CAS
+// with avg = latency_sum / success_count.
+int64_t CircuitBreaker::EmaErrorRecorder::UpdateBatchedLatency(
+    int success_count, int64_t latency_sum) {
+    const double smooth_n = std::pow(_smooth, success_count);
+    const int64_t avg_latency = latency_sum / success_count;
+    int64_t ema_latency = _ema_latency.load(butil::memory_order_relaxed);
+    do {
+        int64_t next_ema_latency = 0;
+        if (0 == ema_latency) {
+            next_ema_latency = avg_latency;
+        } else {
+            next_ema_latency =
+                ema_latency * smooth_n + avg_latency * (1 - smooth_n);
+        }
+        if (_ema_latency.compare_exchange_weak(ema_latency, next_ema_latency)) {
+            return next_ema_latency;
+        }
+    } while(true);
+}
+
 bool CircuitBreaker::EmaErrorRecorder::UpdateErrorCost(int64_t error_cost,
                                                        int64_t ema_latency) {
     const int max_mutiple = FLAGS_circuit_breaker_max_failed_latency_mutiple;
@@ -163,6 +227,40 @@ bool CircuitBreaker::EmaErrorRecorder::UpdateErrorCost(int64_t error_cost,
     return true;
 }
 
+// Decay for the successful calls of the batch, then add the (capped) cost
+// of the failed ones, matching what the per-call path converges to.
+bool CircuitBreaker::EmaErrorRecorder::UpdateBatchedErrorCost(
+    int error_count, int64_t error_latency_sum,
+    int success_count, int64_t ema_latency) {
+    const int max_mutiple = FLAGS_circuit_breaker_max_failed_latency_mutiple;
+    int64_t error_cost = error_latency_sum;
+    if (ema_latency != 0) {
+        error_cost = std::min(
+            ema_latency * max_mutiple * error_count, error_latency_sum);
+    }
+    const double decay =
+        (success_count > 0 ? std::pow(_smooth, success_count) : 1.0);
+    int64_t ema_error_cost = _ema_error_cost.load(butil::memory_order_relaxed);
+    int64_t next_ema_error_cost = 0;
+    do {
+        next_ema_error_cost = ema_error_cost * decay + error_cost;
+        if (error_cost == 0 &&
+            next_ema_error_cost < FLAGS_circuit_breaker_min_error_cost_us) {
+            next_ema_error_cost = 0;
+        }
+        if (_ema_error_cost.compare_exchange_weak(
+                ema_error_cost, next_ema_error_cost)) {
+            break;
+        }
+    } while (true);
+    if (error_cost != 0) {
+        const int64_t max_error_cost =
+            ema_latency * _window_size * (_max_error_percent / 100.0) * (1.0 + EPSILON);
+        return next_ema_error_cost <= max_error_cost;
+    }
+    return true;
+}
+
 CircuitBreaker::CircuitBreaker()
     : _long_window(FLAGS_circuit_breaker_long_window_size,
                    FLAGS_circuit_breaker_long_window_error_percent)
@@ -172,6 +270,9 @@ CircuitBreaker::CircuitBreaker()
     , _isolation_duration_ms(FLAGS_circuit_breaker_min_isolation_duration_ms)
     , _isolated_times(0)
     , _broken(false) {
+    if (FLAGS_circuit_breaker_feedback_batch_size > 1) {
+        _batch_groups.reset(new BatchGroup[NUM_BATCH_GROUPS]);
+    }
 }
 
 bool CircuitBreaker::OnCallEnd(int error_code, int64_t latency) {
@@ -188,6 +289,9 @@ bool CircuitBreaker::OnCallEnd(int error_code, int64_t latency) {
     if (_broken.load(butil::memory_order_relaxed)) {
         return false;
     }
+    if (_batch_groups) {
+        return BatchedOnCallEnd(error_code, latency);
+    }
     if (_long_window.OnCallEnd(error_code, latency) &&
         _short_window.OnCallEnd(error_code, latency)) {
         return true;
@@ -196,9 +300,77 @@ bool CircuitBreaker::OnCallEnd(int error_code, int64_t latency) {
     return false;
 }
 
+static butil::atomic<int> g_batch_group_seq(0);
+static __thread int tls_batch_group_index = -1;
+
+bool CircuitBreaker::BatchedOnCallEnd(int error_code, int64_t latency) {
+    if (tls_batch_group_index < 0) {
+        tls_batch_group_index =
+            g_batch_group_seq.fetch_add(1, butil::memory_order_relaxed)
+            & (NUM_BATCH_GROUPS - 1);
+    }
+    BatchGroup* g = &_batch_groups[tls_batch_group_index];
+    while (g->lock.exchange(1, butil::memory_order_acquire)) {
+        // Another thread wrapped onto the same slot, very rare.
+        sched_yield();
+    }
+    const int64_t now_us = butil::cpuwide_time_us();
+    if (g->count == 0) {
+        g->first_sample_time_us = now_us;
+    }
+    ++g->count;
+    if (error_code != 0) {
+        ++g->error_count;
+        g->error_latency_sum += latency;
+    } else {
+        g->success_latency_sum += latency;
+    }
+    int count = 0;
+    int error_count = 0;
+    int64_t error_latency_sum = 0;
+    int64_t success_latency_sum = 0;
+    const bool flush =
+        g->count >= FLAGS_circuit_breaker_feedback_batch_size ||
+        now_us - g->first_sample_time_us >=
+            FLAGS_circuit_breaker_max_feedback_delay_us;
+    if (flush) {
+        count = g->count;
+        error_count = g->error_count;
+        error_latency_sum = g->error_latency_sum;
+        success_latency_sum = g->success_latency_sum;
+        g->count = 0;
+        g->error_count = 0;
+        g->error_latency_sum = 0;
+        g->success_latency_sum = 0;
+    }
+    g->lock.store(0, butil::memory_order_release);
+    if (!flush) {
+        return true;
+    }
+    const int success_count = count - error_count;
+    if (_long_window.OnBatchedCallEnd(error_count, error_latency_sum,
+                                      success_count, success_latency_sum) &&
+        _short_window.OnBatchedCallEnd(error_count, error_latency_sum,
+                                       success_count, success_latency_sum)) {
+        return true;
+    }
+    MarkAsBroken();
+    return false;
+}
+
 void CircuitBreaker::Reset() {
     _long_window.Reset();
     _short_window.Reset();
+    if (_batch_groups) {
+        // The caller guarantees that no one else is feeding us, drop
+        // whatever was staged before the isolation.
+        for (size_t i = 0; i < NUM_BATCH_GROUPS; ++i) {
+            _batch_groups[i].count = 0;
+            _batch_groups[i].error_count = 0;
+            _batch_groups[i].error_latency_sum = 0;
+            _batch_groups[i].success_latency_sum = 0;
+        }
+    }
     _last_reset_time_ms = butil::cpuwide_time_ms();
     _broken.store(false, butil::memory_order_release);
 }
@@ -18,7 +18,10 @@
 #ifndef BRPC_CIRCUIT_BREAKER_H
 #define BRPC_CIRCUIT_BREAKER_H
 
+#include <memory>
+
 #include "butil/atomicops.h"
+#include "butil/macros.h"                   // BAIDU_CACHELINE_ALIGNMENT
 
 namespace brpc {
 
@@ -35,6 +38,10 @@ public:
     // Note: Once OnCallEnd() determined that a node needs to be isolated,
     // it will always return false until you call Reset(). Usually Reset()
     // will be called in the health check thread.
+    // When -circuit_breaker_feedback_batch_size is greater than 1, calls
+    // are staged in per-thread slots and folded into the error windows in
+    // batches, so a call that pushes the node over the error threshold may
+    // only be noticed at the end of its batch.
     bool OnCallEnd(int error_code, int64_t latency);
 
     // Reset CircuitBreaker and clear history data. will erase the historical
@@ -65,11 +72,18 @@ private:
     public:
         EmaErrorRecorder(int windows_size,  int max_error_percent);
         bool OnCallEnd(int error_code, int64_t latency);
+        // Fold a batch of finished calls into the window at once, producing
+        // (approximately) the same EMA as feeding the calls one by one.
+        bool OnBatchedCallEnd(int error_count, int64_t error_latency_sum,
+                              int success_count, int64_t success_latency_sum);
         void Reset();
 
     private:
         int64_t UpdateLatency(int64_t latency);
+        int64_t UpdateBatchedLatency(int success_count, int64_t latency_sum);
         bool UpdateErrorCost(int64_t latency, int64_t ema_latency);
+        bool UpdateBatchedErrorCost(int error_count, int64_t error_latency_sum,
+                                    int success_count, int64_t ema_latency);
 
         const int _window_size;
         const int _max_error_percent;
@@ -81,8 +95,33 @@ private:
         butil::atomic<int64_t> _ema_latency;
     };
 
+    // One staging slot of batched feedback. Each worker thread writes its
+    // own (cacheline-aligned) slot so that finishing a call does not touch
+    // cachelines shared with other workers; the slot is folded into the
+    // error windows once per batch. The lock only contends when more
+    // threads than slots wrapped onto the same index.
+    struct BAIDU_CACHELINE_ALIGNMENT BatchGroup {
+        BatchGroup()
+            : lock(0), count(0), error_count(0)
+            , error_latency_sum(0), success_latency_sum(0)
+            , first_sample_time_us(0) {}
+        butil::atomic<int> lock;
+        int count;
+        int error_count;
+        int64_t error_latency_sum;
+        int64_t success_latency_sum;
+        int64_t first_sample_time_us;
+    };
+
+    bool BatchedOnCallEnd(int error_code, int64_t latency);
+
+    static const size_t NUM_BATCH_GROUPS = 64;
+
     EmaErrorRecorder _long_window;
     EmaErrorRecorder _short_window;
+    // NULL unless -circuit_breaker_feedback_batch_size > 1 when the
+    // breaker was constructed.
+    std::unique_ptr<BatchGroup[]> _batch_groups;
     int64_t _last_reset_time_ms;
     butil::atomic<int> _isolation_duration_ms;
     butil::atomic<int> _isolated_times;
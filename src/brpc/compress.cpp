@@ -92,8 +92,7 @@ bool ParseFromCompressedData(const butil::IOBuf& data,
 bool SerializeAsCompressedData(const google::protobuf::Message& msg,
                                butil::IOBuf* buf, CompressType compress_type) {
     if (compress_type == COMPRESS_TYPE_NONE) {
-        butil::IOBufAsZeroCopyOutputStream wrapper(buf);
-        return msg.SerializeToZeroCopyStream(&wrapper);
+        return SerializePbToIOBuf(msg, buf);
     }
     const CompressHandler* handler = FindCompressHandler(compress_type);
     if (NULL != handler) {
@@ -22,6 +22,7 @@
 #include <gflags/gflags.h>
 #include "bthread/bthread.h"
 #include "butil/build_config.h"    // OS_MACOSX
+#include "butil/object_pool.h"     // butil::get_object
 #include "butil/string_printf.h"
 #include "butil/logging.h"
 #include "butil/time.h"
@@ -30,6 +31,7 @@
 #include "bvar/bvar.h"
 #include "brpc/socket.h"
 #include "brpc/socket_map.h"
+#include "brpc/protocol.h"                      // FindProtocol
 #include "brpc/channel.h"
 #include "brpc/load_balancer.h"
 #include "brpc/closure_guard.h"
@@ -39,9 +41,13 @@
 #include "brpc/server.h"   // Server::_session_local_data_pool
 #include "brpc/simple_data_pool.h"
 #include "brpc/retry_policy.h"
+#include "brpc/backup_request_policy.h"
+#include "brpc/response_cache.h"
+#include "brpc/baggage.h"
 #include "brpc/stream_impl.h"
 #include "brpc/policy/streaming_rpc_protocol.h" // FIXME
 #include "brpc/rpc_dump.h"
+#include "brpc/serialized_request.h"
 #include "brpc/details/usercode_backup_pool.h"  // RunUserCode
 #include "brpc/mongo_service_adaptor.h"
 
@@ -111,6 +117,7 @@ const Controller* GetSubControllerOfSelectiveChannel(
     const RPCSender* sender, int index);
 
 DECLARE_bool(usercode_in_pthread);
+DECLARE_int32(max_pooled_multiplex_calls);
 static const int MAX_RETRY_COUNT = 1000;
 static bvar::Adder<int64_t>* g_ncontroller = NULL;
 
@@ -171,14 +178,22 @@ void Controller::ResetNonPods() {
         DestroyParallelChannelDone(_done);
     }
     delete _sender;
+#if GOOGLE_PROTOBUF_VERSION < 3000000
+    // Normally freed in RunAfterInterceptors(), with protobuf 3+ the array
+    // is on the arena instead and dies with it.
+    free(_interceptor_ctx);
+#endif
     _lb.reset(NULL);
     _current_call.Reset();
     ExcludedServers::Destroy(_accessed);
     _request_buf.clear();
+    _response_cache_key.clear();
     delete _http_request;
     delete _http_response;
+    delete _lazy_request_fields;
     _request_attachment.clear();
     _response_attachment.clear();
+    _request_baggage.clear();
     if (_wpa) {
         _wpa->MarkRPCAsDone(Failed());
         _wpa.reset(NULL);
@@ -195,6 +210,10 @@ void Controller::ResetNonPods() {
         _rpa.reset(NULL);
     }
     delete _remote_stream_settings;
+#if GOOGLE_PROTOBUF_VERSION >= 3000000
+    // Releases everything allocated on the arena in one shot.
+    delete _arena;
+#endif
     _thrift_method_name.clear();
 
     CHECK(_unfinished_call == NULL);
@@ -217,6 +236,7 @@ void Controller::ResetPods() {
     _request_protocol = PROTOCOL_UNKNOWN;
     _max_retry = UNSET_MAGIC_NUM;
     _retry_policy = NULL;
+    _backup_request_policy = NULL;
     _correlation_id = INVALID_BTHREAD_ID;
     _connection_type = CONNECTION_TYPE_UNKNOWN;
     _timeout_ms = UNSET_MAGIC_NUM;
@@ -231,11 +251,16 @@ void Controller::ResetPods() {
     _request_compress_type = COMPRESS_TYPE_NONE;
     _response_compress_type = COMPRESS_TYPE_NONE;
     _fail_limit = UNSET_MAGIC_NUM;
+    _success_limit = UNSET_MAGIC_NUM;
+    _interceptors = NULL;
+    _interceptor_ctx = NULL;
+    _ninterceptors_ran = 0;
     _pipelined_count = 0;
     _log_id = 0;
     _pchan_sub_count = 0;
     _response = NULL;
     _done = NULL;
+    _response_cache = NULL;
     _sender = NULL;
     _request_code = 0;
     _single_server_id = INVALID_SOCKET_ID;
@@ -249,9 +274,115 @@ void Controller::ResetPods() {
     _idl_result = IDL_VOID_RESULT;
     _http_request = NULL;
     _http_response = NULL;
+    _lazy_request_fields = NULL;
     _request_stream = INVALID_STREAM_ID;
     _response_stream = INVALID_STREAM_ID;
     _remote_stream_settings = NULL;
+#if GOOGLE_PROTOBUF_VERSION >= 3000000
+    _arena = NULL;
+#endif
+}
+
+#if GOOGLE_PROTOBUF_VERSION >= 3000000
+google::protobuf::Arena* Controller::arena() {
+    if (_arena == NULL) {
+        _arena = new (std::nothrow) google::protobuf::Arena;
+    }
+    return _arena;
+}
+#endif
+
+static const butil::IOBuf* FindLazyRequestField(
+    const std::vector<std::pair<int, butil::IOBuf> >* fields,
+    int field_number) {
+    if (fields != NULL) {
+        for (size_t i = 0; i < fields->size(); ++i) {
+            if ((*fields)[i].first == field_number) {
+                return &(*fields)[i].second;
+            }
+        }
+    }
+    return NULL;
+}
+
+bool Controller::has_lazy_request_field(int field_number) const {
+    return FindLazyRequestField(_lazy_request_fields, field_number) != NULL;
+}
+
+bool Controller::GetLazyRequestField(int field_number,
+                                     butil::IOBuf* wire_bytes) const {
+    const butil::IOBuf* fragment =
+        FindLazyRequestField(_lazy_request_fields, field_number);
+    if (NULL == fragment) {
+        return false;
+    }
+    wire_bytes->append(*fragment);
+    return true;
+}
+
+bool Controller::ParseLazyRequestField(int field_number,
+                                       google::protobuf::Message* out) const {
+    const butil::IOBuf* fragment =
+        FindLazyRequestField(_lazy_request_fields, field_number);
+    if (NULL == fragment) {
+        return false;
+    }
+    butil::IOBufAsZeroCopyInputStream wrapper(*fragment);
+    // Partial: the fragment does not carry required fields of the
+    // request type.
+    return out->ParsePartialFromZeroCopyStream(&wrapper);
+}
+
+int Controller::RunBeforeInterceptors(const google::protobuf::Message* request) {
+    if (NULL == _interceptors || _interceptors->empty()) {
+        return 0;
+    }
+    const size_t n = _interceptors->size();
+#if GOOGLE_PROTOBUF_VERSION >= 3000000
+    // The contexts die with the arena, no free needed.
+    _interceptor_ctx = google::protobuf::Arena::CreateArray<void*>(arena(), n);
+#else
+    _interceptor_ctx = (void**)malloc(sizeof(void*) * n);
+    if (NULL == _interceptor_ctx) {
+        SetFailed(ENOMEM, "Fail to allocate interceptor contexts");
+        return ENOMEM;
+    }
+#endif
+    memset(_interceptor_ctx, 0, sizeof(void*) * n);
+    const MethodInterceptor* ics = _interceptors->data();
+    for (size_t i = 0; i < n; ++i) {
+        const int rc = ics[i].before(this, request, &_interceptor_ctx[i]);
+        if (rc != 0) {
+            // Respect a more specific failure set by the interceptor itself.
+            if (!FailedInline()) {
+                SetFailed(rc, "Rejected by interceptor %d of %s", (int)i,
+                          _method ? _method->full_name().c_str() : "(null)");
+            }
+            // after() of the rejecting interceptor is not called.
+            return rc;
+        }
+        _ninterceptors_ran = i + 1;
+    }
+    return 0;
+}
+
+void Controller::RunAfterInterceptors() {
+    const int nran = _ninterceptors_ran;
+    _ninterceptors_ran = 0;  // makes this method idempotent
+    if (nran > 0) {
+        const MethodInterceptor* ics = _interceptors->data();
+        // Reverse order so that contexts nest like scopes.
+        for (int i = nran - 1; i >= 0; --i) {
+            if (ics[i].after != NULL) {
+                ics[i].after(this, _interceptor_ctx[i]);
+            }
+        }
+    }
+#if GOOGLE_PROTOBUF_VERSION < 3000000
+    free(_interceptor_ctx);
+#endif
+    _interceptor_ctx = NULL;
+    _interceptors = NULL;
 }
 
 Controller::Call::Call(Controller::Call* rhs)
@@ -302,6 +433,13 @@ void Controller::set_backup_request_ms(int64_t timeout_ms) {
     }
 }
 
+void Controller::OnRPCEnd(int64_t end_time_us) {
+    _end_time_us = end_time_us;
+    if (_backup_request_policy != NULL) {
+        _backup_request_policy->OnRPCEnd(this);
+    }
+}
+
 void Controller::set_max_retry(int max_retry) {
     if (max_retry > MAX_RETRY_COUNT) {
         LOG(WARNING) << "Retry count can't be larger than "
@@ -318,6 +456,16 @@ void Controller::set_log_id(uint64_t log_id) {
     _log_id = log_id;
 }
 
+int Controller::set_request_baggage(const butil::StringPiece& key,
+                                    const butil::StringPiece& value) {
+    return AppendBaggage(&_request_baggage, key, value);
+}
+
+bool Controller::get_request_baggage(const butil::StringPiece& key,
+                                     std::string* value) const {
+    return FindBaggage(_request_baggage, key, value);
+}
+
 
 bool Controller::Failed() const {
     return FailedInline();
@@ -576,6 +724,15 @@ void Controller::OnVersionedRPCReturned(const CompletionInfo& info,
             SetFailed(rc, "Fail to add timer");
             goto END_OF_RPC;
         }
+        if (_backup_request_policy != NULL &&
+            !_backup_request_policy->DoBackup(this)) {
+            // No budget for the backup request. Continue waiting for the
+            // original call as if the backup timer never fired, guarded
+            // by the timeout timer added above.
+            _error_code = saved_error;
+            CHECK_EQ(0, bthread_id_unlock(info.id));
+            return;
+        }
         if (!SingleServer()) {
             if (_accessed == NULL) {
                 _accessed = ExcludedServers::Create(
@@ -603,6 +760,12 @@ void Controller::OnVersionedRPCReturned(const CompletionInfo& info,
         //  * we intercepted error from _unfinished_call in OnVersionedRPCReturned
         //  * ERPCTIMEDOUT/ECANCELED are not retrying error by default.
         CHECK_EQ(current_id(), info.id) << "error_code=" << _error_code;
+        if (!ConsumeRetryBudget()) {
+            // The process-wide -retry_budget_percent is exhausted. Sending
+            // more retries now would amplify the overload that is already
+            // failing requests, end the RPC with the current error.
+            goto END_OF_RPC;
+        }
         if (!SingleServer()) {
             if (_accessed == NULL) {
                 _accessed = ExcludedServers::Create(
@@ -623,6 +786,20 @@ void Controller::OnVersionedRPCReturned(const CompletionInfo& info,
             _http_response->Clear();
         }
         response_attachment().clear();
+        const int32_t backoff_ms =
+            (_retry_policy ? _retry_policy : DefaultRetryPolicy())
+            ->GetBackoffTimeMs(this);
+        if (backoff_ms > 0) {
+            // Wait in-place before re-issuing. The deadline timer is still
+            // armed and will end the RPC on time; skip the wait when it
+            // would cross the deadline since the retry could not finish
+            // anyway.
+            const int64_t backoff_us = backoff_ms * 1000L;
+            if (_deadline_us < 0 ||
+                butil::gettimeofday_us() + backoff_us < _deadline_us) {
+                bthread_usleep(backoff_us);
+            }
+        }
         return IssueRPC(butil::gettimeofday_us());
     }
 
@@ -746,6 +923,23 @@ void Controller::Call::OnComplete(
             }
             break;
         }
+        // Multiplexable pooled connections (correlated protocols under
+        // -max_pooled_multiplex_calls > 1) tolerate unanswered calls:
+        // the late response is dropped by correlation-id lookup just as
+        // on single connections. Keep the connection for the other
+        // calls sharing it unless the error condemns the connection.
+        if (sending_sock != NULL &&
+            FLAGS_max_pooled_multiplex_calls > 1 &&
+            !does_error_affect_main_socket(error_code) &&
+            !sending_sock->is_read_progressive()) {
+            const Protocol* protocol = FindProtocol(c->_request_protocol);
+            if (protocol != NULL &&
+                (protocol->supported_connection_type &
+                 CONNECTION_TYPE_SINGLE)) {
+                sending_sock->ReturnToPool();
+                break;
+            }
+        }
         // fall through
     case CONNECTION_TYPE_SHORT:
         if (sending_sock != NULL) {
@@ -859,6 +1053,19 @@ void Controller::EndRPC(const CompletionInfo& info) {
     if (!_error_code) {
         _error_text.clear();
     }
+    // Save the received response for following identical requests.
+    // _response_cache is left NULL by Channel::CallMethod when the
+    // response was served from the cache, no re-insertion here.
+    // Responses with attachments are not cached since the cache restores
+    // the pb message only.
+    if (_response_cache != NULL && _error_code == 0 && _response != NULL &&
+        _response_attachment.empty()) {
+        butil::IOBuf serialized;
+        butil::IOBufAsZeroCopyOutputStream wrapper(&serialized);
+        if (_response->SerializeToZeroCopyStream(&wrapper)) {
+            _response_cache->Put(_response_cache_key, serialized);
+        }
+    }
     // RPC finished, now it's safe to release `LoadBalancerWithNaming'
     _lb.reset();
     if (_span) {
@@ -954,11 +1161,28 @@ void Controller::HandleSendFailed() {
     OnVersionedRPCReturned(info, new_bthread, _error_code);
 }
 
+void Controller::HandleCachedResponse() {
+    // `_response' was filled from ChannelOptions.response_cache, end the
+    // RPC without issuing any call. _error_code is 0, thus
+    // OnVersionedRPCReturned ends the RPC as a successful response would.
+    // See comments in HandleSendFailed on running done in a new bthread.
+    CHECK(!FailedInline());
+    const CompletionInfo info = { current_id(), false };
+    const bool new_bthread = (_done != NULL && !is_done_allowed_to_run_in_place());
+    OnVersionedRPCReturned(info, new_bthread, 0);
+}
+
 void Controller::IssueRPC(int64_t start_realtime_us) {
     _current_call.begin_time_us = start_realtime_us;
     // Clear last error, Don't clear _error_text because we append to it.
     _error_code = 0;
 
+    if (_current_call.nretry == 0) {
+        // Each begun RPC earns a fraction of one retry into the
+        // process-wide budget consumed in OnVersionedRPCReturned.
+        AddRetryBudget();
+    }
+
     // Make versioned correlation_id.
     // call_id         : unversioned, mainly for ECANCELED and ERPCTIMEDOUT
     // call_id + 1     : first try.
@@ -1050,7 +1274,20 @@ void Controller::IssueRPC(int64_t start_realtime_us) {
     } else {
         int rc = 0;
         if (_connection_type == CONNECTION_TYPE_POOLED) {
-            rc = tmp_sock->GetPooledSocket(&_current_call.sending_sock);
+            // Protocols that could run on single connections correlate
+            // responses with requests, thus their pooled connections
+            // can be multiplexed by a bounded number of concurrent
+            // calls (-max_pooled_multiplex_calls). Progressively-read
+            // responses keep a connection exclusively.
+            bool allow_multiplex = false;
+            if (!is_response_read_progressively()) {
+                const Protocol* protocol = FindProtocol(_request_protocol);
+                allow_multiplex = protocol != NULL &&
+                    (protocol->supported_connection_type &
+                     CONNECTION_TYPE_SINGLE);
+            }
+            rc = tmp_sock->GetPooledSocket(&_current_call.sending_sock,
+                                           allow_multiplex);
         } else if (_connection_type == CONNECTION_TYPE_SHORT) {
             rc = tmp_sock->GetShortSocket(&_current_call.sending_sock);
         } else {
@@ -1337,6 +1574,54 @@ void Controller::reset_sampled_request(SampledRequest* req) {
     _sampled_request = req;
 }
 
+void Controller::ForwardTo(ChannelBase* channel,
+                           google::protobuf::Message* response) {
+    if (channel == NULL) {
+        SetFailed(EINVAL, "Param[channel] is NULL");
+        return;
+    }
+    if (_server == NULL) {
+        SetFailed(EPERM, "ForwardTo() can only be called on server-side"
+                  " Controller");
+        return;
+    }
+    if (!is_forwardable() || _method == NULL) {
+        SetFailed(EINVAL, "The serialized request was not saved, turn on"
+                  " -baidu_std_save_serialized_request at this server");
+        return;
+    }
+    // Splice the received bytes as-is. SerializeRequestDefault appends
+    // serialized_data() without compressing, thus forwarding the original
+    // compress_type along keeps the bytes valid for the backend server.
+    SerializedRequest serialized_req;
+    serialized_req.serialized_data() = _request_buf;
+    Controller backend_cntl;
+    backend_cntl.set_request_compress_type(_request_compress_type);
+    if (has_log_id()) {
+        backend_cntl.set_log_id(log_id());
+    }
+    if (_deadline_us >= 0) {
+        // Give the backend call the remaining budget of this request.
+        const int64_t remain_ms =
+            (_deadline_us - butil::gettimeofday_us()) / 1000L;
+        if (remain_ms <= 0) {
+            SetFailed(ERPCTIMEDOUT, "[ForwardTo] deadline of the request"
+                      " was already exceeded");
+            return;
+        }
+        backend_cntl.set_timeout_ms(remain_ms);
+    }
+    backend_cntl.request_attachment() = _request_attachment;
+    channel->CallMethod(_method, &backend_cntl, &serialized_req,
+                        response, NULL/*block until done*/);
+    if (backend_cntl.Failed()) {
+        SetFailed(backend_cntl.ErrorCode(), "[ForwardTo] %s",
+                  backend_cntl.ErrorText().c_str());
+        return;
+    }
+    _response_attachment = backend_cntl.response_attachment();
+}
+
 void Controller::set_stream_creator(StreamCreator* sc) {
     if (_stream_creator) {
         LOG(FATAL) << "A StreamCreator has been set previously";
@@ -1470,6 +1755,23 @@ static void RegisterQuitSignalOrDie() {
     }
 }
 
+Controller* GetPooledController() {
+    // Objects in the pool were Reset() in ReturnPooledController and fresh
+    // ones are initialized by the constructor, both give out a Controller
+    // in its initial state.
+    return butil::get_object<Controller>();
+}
+
+void ReturnPooledController(Controller* cntl) {
+    if (NULL == cntl) {
+        return;
+    }
+    // Free owned resources now rather than at next GetPooledController()
+    // so that attachments or spans are not kept alive inside the pool.
+    cntl->Reset();
+    butil::return_object(cntl);
+}
+
 bool IsAskedToQuit() {
     pthread_once(&register_quit_signal_once, RegisterQuitSignalOrDie);
     return s_signal_quit;
@@ -23,6 +23,7 @@
 // on internal structures, use opaque pointers instead.
 
 #include <gflags/gflags.h>                     // Users often need gflags
+#include <vector>
 #include "butil/intrusive_ptr.hpp"             // butil::intrusive_ptr
 #include "bthread/errno.h"                     // Redefine errno
 #include "butil/endpoint.h"                    // butil::EndPoint
@@ -43,6 +44,9 @@
 #include "brpc/progressive_attachment.h"       // ProgressiveAttachment
 #include "brpc/progressive_reader.h"           // ProgressiveReader
 #include "brpc/grpc.h"
+#if GOOGLE_PROTOBUF_VERSION >= 3000000
+#include <google/protobuf/arena.h>             // google::protobuf::Arena
+#endif
 
 // EAUTH is defined in MAC
 #ifndef EAUTH
@@ -61,6 +65,7 @@ struct x509_st;
 namespace brpc {
 class Span;
 class Server;
+class ChannelBase;
 class SharedLoadBalancer;
 class ExcludedServers;
 class RPCSender;
@@ -68,8 +73,11 @@ class StreamSettings;
 class SampledRequest;
 class MongoContext;
 class RetryPolicy;
+class BackupRequestPolicy;
+class ResponseCache;
 class InputMessageBase;
 class ThriftStub;
+struct MethodInterceptor;
 namespace policy {
 class OnServerStreamCreated;
 void ProcessMongoRequest(InputMessageBase*);
@@ -141,7 +149,9 @@ friend void policy::ProcessThriftRequest(InputMessageBase*);
     static const uint32_t FLAGS_ENABLED_CIRCUIT_BREAKER = (1 << 17);
     static const uint32_t FLAGS_ALWAYS_PRINT_PRIMITIVE_FIELDS = (1 << 18);
     static const uint32_t FLAGS_HEALTH_CHECK_CALL = (1 << 19);
-    
+    // Server-side: serialized request bytes were saved for ForwardTo().
+    static const uint32_t FLAGS_FORWARDABLE_REQUEST = (1 << 20);
+
 public:
     Controller();
     ~Controller();
@@ -239,10 +249,61 @@ public:
     // directly instead of being serialized into protobuf messages.
     butil::IOBuf& request_attachment() { return _request_attachment; }
 
+    // Tracing baggage: bounded key/value bytes travelling with the request
+    // across baidu_std hops (see brpc/baggage.h for the wire format). A
+    // received baggage is inherited by Channels called within the server
+    // handler's bthread by sharing the original bytes, so intermediate
+    // hops pass the pairs on without decoding or re-serializing them.
+    // Handlers finishing the RPC asynchronously should copy
+    // request_baggage() to the Controllers of their downstream calls
+    // themselves.
+    // Append `key/value', the last occurrence of a key wins.
+    // Returns 0 on success, -1 when exceeding -max_baggage_size.
+    int set_request_baggage(const butil::StringPiece& key,
+                            const butil::StringPiece& value);
+    // Find `key' in the baggage. Returns true when present.
+    bool get_request_baggage(const butil::StringPiece& key,
+                             std::string* value) const;
+    // The serialized baggage.
+    butil::IOBuf& request_baggage() { return _request_baggage; }
+    const butil::IOBuf& request_baggage() const { return _request_baggage; }
+
     ConnectionType connection_type() const { return _connection_type; }
     // Get the called method. May-be NULL for non-pb services.
     const google::protobuf::MethodDescriptor* method() const { return _method; }
 
+    // [Server-side] True if `field_number' of the request was declared
+    // lazy in ServiceOptions.lazy_request_fields and present in the
+    // received request. The field is absent from the parsed request
+    // message, access it with the methods below.
+    bool has_lazy_request_field(int field_number) const;
+    // Append the wire bytes (tag + length + value per occurrence) of the
+    // lazy field to `*wire_bytes'.
+    // Returns false when has_lazy_request_field(field_number) is false.
+    bool GetLazyRequestField(int field_number, butil::IOBuf* wire_bytes) const;
+    // Parse the lazy field into `out' which must be a message of the
+    // request type; only the lazy field is filled on success. Required
+    // fields of the request type are not checked.
+    // Returns false on absent field or invalid data.
+    bool ParseLazyRequestField(int field_number,
+                               google::protobuf::Message* out) const;
+
+    // [Server-side]
+    // Re-send the request being served by this controller to `channel'
+    // synchronously. The serialized request bytes and the attachment are
+    // spliced into the outbound call as-is (not re-serialized, not
+    // re-compressed), so a proxy implementing the same service interface
+    // can relay requests without paying for message serialization. On
+    // success `response' is filled with the backend response and the
+    // backend's response attachment is copied into response_attachment();
+    // on failure this controller is SetFailed() with the backend error.
+    // Requires -baidu_std_save_serialized_request to be on, only works
+    // for requests received through the baidu_std protocol and without
+    // a progressively-read attachment.
+    void ForwardTo(ChannelBase* channel, google::protobuf::Message* response);
+    // True if the serialized request was saved and ForwardTo() may be used.
+    bool is_forwardable() const { return has_flag(FLAGS_FORWARDABLE_REQUEST); }
+
     // Get the controllers for accessing sub channels in combo channels.
     // Ordinary channel:
     //   sub_count() is 0 and sub() is always NULL.
@@ -260,6 +321,13 @@ public:
     int sub_count() const;
     const Controller* sub(int index) const;
 
+    // Used by ParallelChannel/PartitionChannel: when set to a positive
+    // value, this RPC finishes as soon as so many sub calls succeeded
+    // ("partial quorum") and the remaining sub calls are canceled.
+    // Overrides ParallelChannelOptions.success_limit for this call only.
+    void set_success_limit(int value) { _success_limit = value; }
+    int success_limit() const { return _success_limit; }
+
     // Get/own SampledRequest for sending dumped requests.
     // Deleted along with controller.
     void reset_sampled_request(SampledRequest* req);
@@ -289,6 +357,14 @@ public:
     
     // True if ReadProgressiveAttachmentBy() was ever called successfully.
     bool has_progressive_reader() const { return has_flag(FLAGS_PROGRESSIVE_READER); }
+
+    // [Server-side]
+    // True if the attachment of the request was not buffered into
+    // request_attachment() and is being streamed instead, namely the
+    // server received an oversized message with
+    // -baidu_std_streaming_attachment_threshold on. Read the attachment
+    // with ReadProgressiveAttachmentBy().
+    bool has_readable_progressive_attachment() const { return _rpa != NULL; }
     
     // RPC may fail with EOVERCROWDED if the socket to write is too full
     // (limited by -socket_max_unwritten_bytes). In some scenarios, user
@@ -510,6 +586,14 @@ public:
     // -1 means no deadline.
     int64_t deadline_us() const { return _deadline_us; }
 
+#if GOOGLE_PROTOBUF_VERSION >= 3000000
+    // Arena owned by this Controller, created at the first call. Objects
+    // allocated on it(e.g. request/response messages of a server-side call
+    // when -server_message_arena is on) are all released in one shot when
+    // this Controller is Reset() or destroyed.
+    google::protobuf::Arena* arena();
+#endif
+
 private:
     struct CompletionInfo {
         CallId id;           // call_id of the corresponding request
@@ -542,6 +626,11 @@ private:
                                   const std::string& error_text);
     void HandleSendFailed();
 
+    // Called by Channel when the response was served from
+    // ChannelOptions.response_cache, ends the RPC through the same path
+    // as a responded call without issuing any call.
+    void HandleCachedResponse();
+
     static int RunOnCancel(bthread_id_t, void* data, int error_code);
     
     void set_auth_context(const AuthContext* ctx);
@@ -555,6 +644,16 @@ private:
     // the container(MongoContextMessage) and all related cntl(s) are recycled.
     void set_mongo_session_data(MongoContext* data);
 
+    // Run before() of the interceptors of the server-side method in
+    // registration order. Stops at the first one returning non-zero and
+    // fails this controller with the returned code. Called by protocol
+    // code before invoking the method.
+    int RunBeforeInterceptors(const google::protobuf::Message* request);
+
+    // Run after() of the interceptors whose before() succeeded, in reverse
+    // order. Idempotent. Called by protocol code before sending response.
+    void RunAfterInterceptors();
+
     // Reset POD/non-POD fields.
     void ResetPods();
     void ResetNonPods();
@@ -635,9 +734,7 @@ private:
         _end_time_us = begin_time_us;
     }
 
-    void OnRPCEnd(int64_t end_time_us) {
-        _end_time_us = end_time_us;
-    }
+    void OnRPCEnd(int64_t end_time_us);
 
     static void RunDoneInBackupThread(void*);
     void DoneInBackupThread();
@@ -681,6 +778,7 @@ private:
     // after CallMethod.
     int _max_retry;
     const RetryPolicy* _retry_policy;
+    BackupRequestPolicy* _backup_request_policy;
     // Synchronization object for one RPC call. It remains unchanged even 
     // when retry happens. Synchronous RPC will wait on this id.
     CallId _correlation_id;
@@ -689,7 +787,14 @@ private:
 
     // Used by ParallelChannel
     int _fail_limit;
-    
+    int _success_limit;
+
+    // Interceptors of the server-side method (borrowed from the Server)
+    // and their per-request contexts, see RunBeforeInterceptors().
+    const std::vector<MethodInterceptor>* _interceptors;
+    void** _interceptor_ctx;
+    int _ninterceptors_ran;
+
     uint32_t _pipelined_count;
 
     // [Timeout related]
@@ -713,6 +818,9 @@ private:
     int _pchan_sub_count;
     google::protobuf::Message* _response;
     google::protobuf::Closure* _done;
+    // Copied from ChannelOptions.response_cache on cache misses so that
+    // EndRPC saves the received response, left NULL on cache hits.
+    ResponseCache* _response_cache;
     RPCSender* _sender;
     uint64_t _request_code;
     SocketId _single_server_id;
@@ -731,17 +839,32 @@ private:
     Protocol::PackRequest _pack_request;
     const google::protobuf::MethodDescriptor* _method;
     const Authenticator* _auth;
+    // Client-side: the serialized request to be sent. Server-side: the
+    // serialized request as received, saved for ForwardTo() when
+    // -baidu_std_save_serialized_request is on.
     butil::IOBuf _request_buf;
+    // Key of this call in ChannelOptions.response_cache, built from the
+    // method name and the serialized request. Empty when caching is off.
+    std::string _response_cache_key;
     IdlNames _idl_names;
     int64_t _idl_result;
 
     HttpHeader* _http_request;
     HttpHeader* _http_response;
 
-    // Fields with large size but low access frequency 
+    // [Server-side] Wire fragments of request fields declared lazy in
+    // ServiceOptions.lazy_request_fields, cut out before the request was
+    // parsed. The IOBufs keep the received blocks alive until the RPC
+    // ends. Owned. NULL when no lazy field was declared or received.
+    std::vector<std::pair<int, butil::IOBuf> >* _lazy_request_fields;
+
+    // Fields with large size but low access frequency
     butil::IOBuf _request_attachment;
     butil::IOBuf _response_attachment;
 
+    // Serialized tracing baggage, see request_baggage().
+    butil::IOBuf _request_baggage;
+
     // Writable progressive attachment
     butil::intrusive_ptr<ProgressiveAttachment> _wpa;
     // Readable progressive attachment
@@ -755,6 +878,11 @@ private:
     // Defined at both sides
     StreamSettings *_remote_stream_settings;
 
+#if GOOGLE_PROTOBUF_VERSION >= 3000000
+    // Created by arena() at the first call.
+    google::protobuf::Arena* _arena;
+#endif
+
     // Thrift method name, only used when thrift protocol enabled
     std::string _thrift_method_name;
 };
@@ -777,6 +905,19 @@ void Join(CallId id);
 //   brpc::Join(cntl2.call_id());
 google::protobuf::Closure* DoNothing();
 
+// Get a Controller from a thread-local object pool instead of new-ing it,
+// skipping the construction/destruction pair and keeping internal buffers
+// warm across RPCs. The returned Controller is in its initial state and
+// works with Channel::CallMethod exactly like a heap- or stack-constructed
+// one. Return it with ReturnPooledController() after the RPC completes
+// (for asynchronous calls, at the end of done); do NOT delete it.
+Controller* GetPooledController();
+
+// Reset |cntl| and put it back into the pool for future
+// GetPooledController() calls.
+// Must NOT be called while an RPC is in progress.
+void ReturnPooledController(Controller* cntl);
+
 // Convert non-web symbols to web equivalence.
 void WebEscape(const std::string& source, std::string* output);
 
@@ -71,6 +71,13 @@ public:
         return *this;
     }
 
+    // Takes ownership of `fields', freed when the RPC ends.
+    ControllerPrivateAccessor &set_lazy_request_fields(
+        std::vector<std::pair<int, butil::IOBuf> >* fields) {
+        _cntl->_lazy_request_fields = fields;
+        return *this;
+    }
+
     ControllerPrivateAccessor &set_remote_side(const butil::EndPoint& pt) {
         _cntl->_remote_side = pt;
         return *this;
@@ -95,7 +102,16 @@ public:
         _cntl->_request_protocol = protocol;
         return *this;
     }
-    
+
+    // Save the serialized request bytes received by a server so that the
+    // service may relay them through Controller::ForwardTo(). The blocks
+    // of `buf' are shared rather than copied.
+    ControllerPrivateAccessor &set_forwardable_request(const butil::IOBuf& buf) {
+        _cntl->_request_buf = buf;
+        _cntl->add_flag(Controller::FLAGS_FORWARDABLE_REQUEST);
+        return *this;
+    }
+
     Span* span() const { return _cntl->_span; }
 
     uint32_t pipelined_count() const { return _cntl->_pipelined_count; }
@@ -124,6 +140,11 @@ public:
     void set_readable_progressive_attachment(ReadableProgressiveAttachment* s)
     { _cntl->_rpa.reset(s); }
 
+    // Enable ReadProgressiveAttachmentBy() on a server-side controller
+    // whose request attachment is being streamed.
+    void mark_readable_progressively()
+    { _cntl->add_flag(Controller::FLAGS_READ_PROGRESSIVELY); }
+
     void add_with_auth() {
         _cntl->add_flag(Controller::FLAGS_REQUEST_WITH_AUTH);
     }
@@ -139,6 +160,14 @@ public:
     // side is properly set in the RPC sending path.
     void set_deadline_us(int64_t deadline_us) { _cntl->_deadline_us = deadline_us; }
 
+    // Interceptors registered on the server-side method, run around the
+    // method call by protocol code, see comments in controller.h.
+    void set_method_interceptors(const std::vector<MethodInterceptor>* ics)
+    { _cntl->_interceptors = ics; }
+    int run_before_interceptors(const google::protobuf::Message* request)
+    { return _cntl->RunBeforeInterceptors(request); }
+    void run_after_interceptors() { _cntl->RunAfterInterceptors(); }
+
     ControllerPrivateAccessor& set_begin_time_us(int64_t begin_time_us) {
         _cntl->_begin_time_us = begin_time_us;
         _cntl->_end_time_us = UNSET_MAGIC_NUM;
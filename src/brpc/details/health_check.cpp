@@ -23,6 +23,7 @@
 #include "brpc/details/controller_private_accessor.h"
 #include "brpc/global.h"
 #include "brpc/log.h"
+#include "butil/fast_rand.h"
 #include "bthread/unstable.h"
 #include "bthread/bthread.h"
 
@@ -38,6 +39,40 @@ DEFINE_string(health_check_path, "", "Http path of health check call."
         "sure the server functions well).");
 DEFINE_int32(health_check_timeout_ms, 500, "The timeout for both establishing "
         "the connection and the http call to -health_check_path over the connection");
+DEFINE_int32(health_check_concurrency, 0, "Limit the number of connecting "
+        "probes running at the same time if this flag is positive. Useful "
+        "to avoid bursts of connections when many sockets break at the same "
+        "time(e.g. an AZ outage)");
+DEFINE_int32(health_check_backoff_max_s, 0, "If this flag is larger than "
+        "health_check_interval of the socket, double the checking interval "
+        "after each failed probe up to this value");
+DEFINE_int32(health_check_jitter_percent, 0, "Randomize each checking "
+        "interval by +/- so many percents to desynchronize probes of "
+        "sockets that broke at the same time");
+
+// Duration from the start of health checking to Revive(), in milliseconds.
+static bvar::LatencyRecorder g_revive_latency("rpc_socket_revive");
+static butil::atomic<int> g_ninflight_probe(0);
+
+int64_t NextHealthCheckIntervalMs(int64_t interval_s, int hc_count) {
+    int64_t seconds = interval_s;
+    if (FLAGS_health_check_backoff_max_s > interval_s) {
+        for (int i = 1; i < hc_count &&
+                 seconds < FLAGS_health_check_backoff_max_s; ++i) {
+            seconds *= 2;
+        }
+        seconds = std::min(seconds, (int64_t)FLAGS_health_check_backoff_max_s);
+    }
+    int64_t ms = seconds * 1000;
+    if (FLAGS_health_check_jitter_percent > 0) {
+        const int64_t jitter =
+            ms * std::min(FLAGS_health_check_jitter_percent, 100) / 100;
+        if (jitter > 0) {
+            ms += butil::fast_rand_in<int64_t>(-jitter, jitter);
+        }
+    }
+    return ms;
+}
 
 class HealthCheckChannel : public brpc::Channel {
 public:
@@ -152,11 +187,13 @@ public:
 private:
     SocketId _id;
     bool _first_time;
+    int64_t _begin_time_ms;
 };
 
 HealthCheckTask::HealthCheckTask(SocketId id)
     : _id(id)
-    , _first_time(true) {}
+    , _first_time(true)
+    , _begin_time_ms(butil::gettimeofday_ms()) {}
 
 bool HealthCheckTask::OnTriggeringTask(timespec* next_abstime) {
     SocketUniquePtr ptr;
@@ -192,6 +229,17 @@ bool HealthCheckTask::OnTriggeringTask(timespec* next_abstime) {
         }
     }
 
+    if (FLAGS_health_check_concurrency > 0 &&
+        g_ninflight_probe.fetch_add(1, butil::memory_order_relaxed)
+        >= FLAGS_health_check_concurrency) {
+        g_ninflight_probe.fetch_sub(1, butil::memory_order_relaxed);
+        // Too many sockets are being probed right now, retry shortly.
+        // The skipped round is not counted into backoff.
+        *next_abstime = butil::milliseconds_from_now(
+            100 + butil::fast_rand_less_than(900));
+        return true;
+    }
+
     // g_vars must not be NULL because it is newed at the creation of
     // first Socket. When g_vars is used, the socket is at health-checking
     // state, which means the socket must be created and then g_vars can
@@ -203,6 +251,9 @@ bool HealthCheckTask::OnTriggeringTask(timespec* next_abstime) {
     } else {
         hc = ptr->CheckHealth();
     }
+    if (FLAGS_health_check_concurrency > 0) {
+        g_ninflight_probe.fetch_sub(1, butil::memory_order_relaxed);
+    }
     if (hc == 0) {
         if (ptr->CreatedByConnect()) {
             g_vars->channel_conn << -1;
@@ -213,6 +264,7 @@ bool HealthCheckTask::OnTriggeringTask(timespec* next_abstime) {
         }
         ptr->Revive();
         ptr->_hc_count = 0;
+        g_revive_latency << (butil::gettimeofday_ms() - _begin_time_ms);
         if (!FLAGS_health_check_path.empty()) {
             HealthCheckManager::StartCheck(_id, ptr->_health_check_interval_s);
         }
@@ -222,7 +274,8 @@ bool HealthCheckTask::OnTriggeringTask(timespec* next_abstime) {
         return false;
     }
     ++ ptr->_hc_count;
-    *next_abstime = butil::seconds_from_now(ptr->_health_check_interval_s);
+    *next_abstime = butil::milliseconds_from_now(NextHealthCheckIntervalMs(
+        ptr->_health_check_interval_s, ptr->_hc_count));
     return true;
 }
 
@@ -31,6 +31,13 @@ namespace brpc {
 // immediately.
 void StartHealthCheck(SocketId id, int64_t delay_ms);
 
+// Compute the delay in milliseconds before the next probe of a failed
+// socket whose configured interval is `interval_s' seconds and which
+// failed `hc_count' consecutive probes, applying exponential backoff
+// (-health_check_backoff_max_s) and randomization
+// (-health_check_jitter_percent).
+int64_t NextHealthCheckIntervalMs(int64_t interval_s, int hc_count);
+
 } // namespace brpc
 
 #endif
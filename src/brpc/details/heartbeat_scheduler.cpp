@@ -0,0 +1,126 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "butil/time.h"                     // cpuwide_time_us
+#include "butil/fast_rand.h"                // fast_rand_less_than
+#include "butil/memory/singleton_on_pthread_once.h"
+#include "butil/logging.h"
+#include "bthread/bthread.h"                // bthread_start_background
+#include "brpc/socket.h"
+#include "brpc/details/heartbeat_scheduler.h"
+
+namespace brpc {
+
+HeartbeatScheduler::HeartbeatScheduler()
+    : _thread_started(false)
+    , _tid(INVALID_BTHREAD) {
+}
+
+HeartbeatScheduler* HeartbeatScheduler::GetInstance() {
+    return butil::get_leaky_singleton<HeartbeatScheduler>();
+}
+
+// `interval_s' plus up to 1/8 of it, so that sockets created in one
+// burst don't keep pinging in one burst.
+static int64_t JitteredInterval(int interval_s) {
+    return interval_s + butil::fast_rand_less_than(interval_s / 8 + 1);
+}
+
+void HeartbeatScheduler::ScheduleEntry(const Entry& entry) {
+    _wheel[entry.due_s % WHEEL_SIZE].push_back(entry);
+}
+
+void HeartbeatScheduler::Add(SocketId id, int interval_s) {
+    if (interval_s <= 0) {
+        LOG(ERROR) << "Invalid interval_s=" << interval_s;
+        return;
+    }
+    const int64_t now_s = butil::cpuwide_time_us() / 1000000L;
+    Entry entry = { id, now_s + JitteredInterval(interval_s), interval_s };
+    BAIDU_SCOPED_LOCK(_mutex);
+    ScheduleEntry(entry);
+    if (!_thread_started) {
+        const int rc = bthread_start_background(&_tid, NULL, RunThis, this);
+        if (rc != 0) {
+            LOG(ERROR) << "Fail to create heartbeat thread: " << berror(rc);
+            return;
+        }
+        _thread_started = true;
+    }
+}
+
+void* HeartbeatScheduler::RunThis(void* arg) {
+    static_cast<HeartbeatScheduler*>(arg)->Run();
+    return NULL;
+}
+
+void HeartbeatScheduler::Run() {
+    int64_t last_run_s = butil::cpuwide_time_us() / 1000000L;
+    std::vector<Entry> due;
+    while (true) {
+        bthread_usleep(1000000L);
+        const int64_t now_s = butil::cpuwide_time_us() / 1000000L;
+        due.clear();
+        {
+            BAIDU_SCOPED_LOCK(_mutex);
+            // Sweep every bucket passed since the last run in case the
+            // sleep overshot one second.
+            for (int64_t s = last_run_s + 1; s <= now_s; ++s) {
+                std::vector<Entry>& bucket = _wheel[s % WHEEL_SIZE];
+                for (size_t i = 0; i < bucket.size();) {
+                    if (bucket[i].due_s <= now_s) {
+                        due.push_back(bucket[i]);
+                        bucket[i] = bucket.back();
+                        bucket.pop_back();
+                    } else {
+                        // Due at a later turn of the wheel.
+                        ++i;
+                    }
+                }
+            }
+        }
+        last_run_s = now_s;
+        for (size_t i = 0; i < due.size(); ++i) {
+            Entry& entry = due[i];
+            SocketUniquePtr ptr;
+            if (Socket::Address(entry.id, &ptr) != 0) {
+                // SetFailed or recycled, drop the entry.
+                continue;
+            }
+            const int64_t idle_s =
+                (butil::cpuwide_time_us() - ptr->last_active_time_us())
+                / 1000000L;
+            if (idle_s < entry.interval_s) {
+                // The connection talked recently, no ping needed. Check
+                // again when it may have been idle long enough.
+                entry.due_s = now_s + entry.interval_s - idle_s;
+            } else {
+                ptr->_app_ping->SendPing(ptr.get());
+                entry.due_s = now_s + JitteredInterval(entry.interval_s);
+            }
+        }
+        // Reinsert surviving entries with one lock round-trip.
+        BAIDU_SCOPED_LOCK(_mutex);
+        for (size_t i = 0; i < due.size(); ++i) {
+            if (due[i].due_s > now_s) {
+                ScheduleEntry(due[i]);
+            }
+        }
+    }
+}
+
+} // namespace brpc
@@ -0,0 +1,71 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef BRPC_HEARTBEAT_SCHEDULER_H
+#define BRPC_HEARTBEAT_SCHEDULER_H
+
+#include <vector>
+#include "butil/synchronization/lock.h"
+#include "bthread/types.h"
+#include "brpc/socket_id.h"
+
+namespace brpc {
+
+// Shared scheduler sending application-level pings (SocketOptions.app_ping)
+// on sockets that stayed idle for app_ping_interval_s. All registered
+// sockets share one timer wheel with one-second buckets and one bthread
+// sweeping the due bucket every second, so maintaining N mostly-idle
+// connections costs O(pings due this second), not one timer per socket.
+// Ping deadlines are jittered by up to 1/8 of the interval to spread
+// pings of connections established together over time.
+//
+// Entries address their SocketId before each ping and are dropped when
+// the socket was SetFailed or recycled, thus there's no Remove().
+class HeartbeatScheduler {
+public:
+    HeartbeatScheduler();
+
+    static HeartbeatScheduler* GetInstance();
+
+    // Start pinging the socket roughly every `interval_s' seconds of
+    // inactivity. Called once per socket, from Socket::Create.
+    void Add(SocketId id, int interval_s);
+
+private:
+    struct Entry {
+        SocketId id;
+        int64_t due_s;      // cpuwide seconds of the next ping
+        int interval_s;
+    };
+
+    static void* RunThis(void* arg);
+    void Run();
+
+    // Put the entry into the bucket of its deadline. Caller holds _mutex.
+    void ScheduleEntry(const Entry& entry);
+
+    static const size_t WHEEL_SIZE = 512;
+
+    butil::Mutex _mutex;
+    std::vector<Entry> _wheel[WHEEL_SIZE];
+    bool _thread_started;
+    bthread_t _tid;
+};
+
+} // namespace brpc
+
+#endif  // BRPC_HEARTBEAT_SCHEDULER_H
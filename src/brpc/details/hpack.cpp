@@ -345,61 +345,74 @@ private:
 
 };
 
+// Concatenated huffman codes of 2 input bytes, so that the encoder makes
+// one table lookup and one shift per 2 bytes instead of per byte. The
+// longest single code is 30 bits(EOS excluded), a pair fits in 60 bits.
+struct HuffmanPairCode {
+    uint64_t code;
+    uint16_t bit_len;
+};
+
+// 65536 entries indexed by (byte1 << 8) | byte2, built once along with
+// the static table.
+static HuffmanPairCode* s_huffman_pair_table = NULL;
+
 class HuffmanEncoder {
 DISALLOW_COPY_AND_ASSIGN(HuffmanEncoder);
 public:
-    HuffmanEncoder(butil::IOBufAppender* out, const HuffmanCode* table)
+    explicit HuffmanEncoder(butil::IOBufAppender* out)
         : _out(out)
-        , _table(table)
-        , _partial_byte(0)
-        , _remain_bit(8)
-        , _out_bytes(0)
+        , _acc(0)
+        , _nbits(0)
     {}
 
     void Encode(unsigned char byte) {
-        const HuffmanCode code = _table[byte];
-        uint16_t bits_left = code.bit_len;
-        while (bits_left) {
-            const uint16_t adding_bits_len = std::min(_remain_bit, bits_left);
-            const uint8_t adding_bits = static_cast<uint8_t>(
-                    (code.code & ((1u << bits_left) - 1))   // clear leading bits
-                            >> (bits_left - adding_bits_len));  // align to LSB
-            _partial_byte |= adding_bits << (_remain_bit - adding_bits_len);
-            _remain_bit -= adding_bits_len;
-            bits_left -= adding_bits_len;
-            if (!_remain_bit) {
-                ++_out_bytes;
-                _out->push_back(_partial_byte);
-                _remain_bit = 8;
-                _partial_byte = 0;
-            }
+        const HuffmanCode& code = s_huffman_table[byte];
+        AppendBits(code.code, code.bit_len);
+    }
+
+    void EncodePair(unsigned char byte1, unsigned char byte2) {
+        const HuffmanPairCode& code =
+            s_huffman_pair_table[((uint32_t)byte1 << 8) | byte2];
+        if (BAIDU_UNLIKELY(_nbits + code.bit_len > 64)) {
+            // Up to 7 pending bits plus a pair of longest codes does not
+            // fit into the accumulator, append the bytes one by one.
+            Encode(byte1);
+            Encode(byte2);
+            return;
         }
+        AppendBits(code.code, code.bit_len);
     }
 
     void EndStream() {
-        if (_remain_bit == 8u) {
+        if (_nbits == 0) {
             return;
         }
-        DCHECK_LT(_remain_bit, 8u);
+        DCHECK_LT(_nbits, 8u);
         // Add padding `1's to lsb to make _out aligned
-        _partial_byte |= (1 << _remain_bit) - 1;
-        // TODO: push_back is probably costly since it acquires tls everytime it
-        // is invoked.
-        _out->push_back(_partial_byte);
-        _partial_byte = 0;
-        _remain_bit = 0;
+        const uint8_t pad_len = 8 - _nbits;
+        _out->push_back((uint8_t)(
+            (_acc << pad_len) | ((1u << pad_len) - 1)));
+        _acc = 0;
+        _nbits = 0;
         _out = NULL;
-        ++_out_bytes;
     }
 
-    uint32_t out_bytes() const { return _out_bytes; }
-
 private:
+    void AppendBits(uint64_t code, uint16_t bit_len) {
+        // _nbits is at most 7 here and bit_len at most 30 (60 for pairs
+        // checked by EncodePair), no overflow.
+        _acc = (_acc << bit_len) | code;
+        _nbits += bit_len;
+        while (_nbits >= 8) {
+            _nbits -= 8;
+            _out->push_back((uint8_t)(_acc >> _nbits));
+        }
+    }
+
     butil::IOBufAppender* _out;
-    const HuffmanCode* _table;
-    uint8_t  _partial_byte;
-    uint16_t _remain_bit;
-    uint32_t _out_bytes;
+    uint64_t _acc;      // pending bits at the low end
+    uint16_t _nbits;    // 0..7 between appends
 };
 
 class HuffmanDecoder {
@@ -508,6 +521,18 @@ static void CreateStaticTableOrDie() {
     for (size_t i = 0; i < ARRAY_SIZE(s_huffman_table); ++i) {
         s_huffman_tree->AddLeafNode(i, s_huffman_table[i]);
     }
+    // 1MB, the price of halving lookups in the encoding hot loop. Only
+    // paid by processes that actually create HPackers.
+    s_huffman_pair_table = new HuffmanPairCode[256 * 256];
+    for (size_t i = 0; i < 256; ++i) {
+        const HuffmanCode& c1 = s_huffman_table[i];
+        for (size_t j = 0; j < 256; ++j) {
+            const HuffmanCode& c2 = s_huffman_table[j];
+            HuffmanPairCode& pair = s_huffman_pair_table[(i << 8) | j];
+            pair.code = ((uint64_t)c1.code << c2.bit_len) | c2.code;
+            pair.bit_len = c1.bit_len + c2.bit_len;
+        }
+    }
     IndexTableOptions options;
     options.max_size = UINT_MAX;
     options.static_table = s_static_headers;
@@ -581,25 +606,45 @@ inline void EncodeString(butil::IOBufAppender* out, const std::string& s,
         }
         return;
     }
-    // Calculate length of encoded string
+    // Calculate length of encoded string, 2 input bytes per step.
+    const size_t n = s.size();
     uint32_t bit_len = 0;
+    size_t i = 0;
     if (LOWERCASE) {
-        for (size_t i = 0; i < s.size(); ++i) {
-            bit_len += s_huffman_table[(uint8_t)butil::ascii_tolower(s[i])].bit_len;
+        for (; i + 2 <= n; i += 2) {
+            bit_len += s_huffman_pair_table[
+                ((uint32_t)(uint8_t)butil::ascii_tolower(s[i]) << 8)
+                | (uint8_t)butil::ascii_tolower(s[i + 1])].bit_len;
+        }
+        if (i < n) {
+            bit_len += s_huffman_table[
+                (uint8_t)butil::ascii_tolower(s[i])].bit_len;
         }
     } else {
-        for (size_t i = 0; i < s.size(); ++i) {
+        for (; i + 2 <= n; i += 2) {
+            bit_len += s_huffman_pair_table[
+                ((uint32_t)(uint8_t)s[i] << 8) | (uint8_t)s[i + 1]].bit_len;
+        }
+        if (i < n) {
             bit_len += s_huffman_table[(uint8_t)s[i]].bit_len;
         }
     }
     EncodeInteger(out, 0x80, 7, (bit_len >> 3) + !!(bit_len & 7));
-    HuffmanEncoder e(out, s_huffman_table);
+    HuffmanEncoder e(out);
+    i = 0;
     if (LOWERCASE) {
-        for (size_t i = 0; i < s.size(); ++i) {
+        for (; i + 2 <= n; i += 2) {
+            e.EncodePair(butil::ascii_tolower(s[i]),
+                         butil::ascii_tolower(s[i + 1]));
+        }
+        if (i < n) {
             e.Encode(butil::ascii_tolower(s[i]));
         }
     } else {
-        for (size_t i = 0; i < s.size(); ++i) {
+        for (; i + 2 <= n; i += 2) {
+            e.EncodePair(s[i], s[i + 1]);
+        }
+        if (i < n) {
             e.Encode(s[i]);
         }
     }
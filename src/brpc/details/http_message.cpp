@@ -17,6 +17,7 @@
 
 
 #include <cstdlib>
+#include <zlib.h>
 
 #include <string>                               // std::string
 #include <iostream>
@@ -37,8 +38,70 @@ DEFINE_bool(http_verbose, false,
             "[DEBUG] Print EVERY http request/response");
 DEFINE_int32(http_verbose_max_body_length, 512,
              "[DEBUG] Max body length printed when -http_verbose is on");
+DEFINE_bool(http_stream_decompress_body, false,
+            "Inflate gzip-encoded http bodies chunk by chunk as network "
+            "data arrives instead of buffering the whole compressed body "
+            "and inflating it in one shot, keeping peak memory at the "
+            "size of the inflated body and overlapping decompression with "
+            "the network. The content-encoding header is removed from "
+            "messages inflated this way");
+BRPC_VALIDATE_GFLAG(http_stream_decompress_body, PassValidate);
 DECLARE_int64(socket_max_unwritten_bytes);
 
+// Incrementally inflates a gzip(or zlib) stream fed in chunks.
+class GzipInflater {
+public:
+    GzipInflater() : _init_ok(false), _done(false), _ever_fed(false) {
+        memset(&_zs, 0, sizeof(_zs));
+        // 15: max window size; +32: auto-detect gzip/zlib headers.
+        _init_ok = (inflateInit2(&_zs, 15 + 32) == Z_OK);
+    }
+    ~GzipInflater() {
+        if (_init_ok) {
+            inflateEnd(&_zs);
+        }
+    }
+    bool initialized() const { return _init_ok; }
+    // True if the end of the compressed stream was seen.
+    bool done() const { return _done; }
+    bool ever_fed() const { return _ever_fed; }
+
+    // Inflate [data, data+n) and append the output to `out'.
+    // Returns false on corrupted input or trailing garbage.
+    bool Feed(const char* data, size_t n, butil::IOBuf* out) {
+        _ever_fed = true;
+        _zs.next_in = (Bytef*)data;
+        _zs.avail_in = n;
+        char buf[16384];
+        while (_zs.avail_in > 0) {
+            if (_done) {  // trailing data after the compressed stream
+                return false;
+            }
+            _zs.next_out = (Bytef*)buf;
+            _zs.avail_out = sizeof(buf);
+            const int rc = inflate(&_zs, Z_NO_FLUSH);
+            if (rc != Z_OK && rc != Z_STREAM_END && rc != Z_BUF_ERROR) {
+                return false;
+            }
+            out->append(buf, sizeof(buf) - _zs.avail_out);
+            if (rc == Z_STREAM_END) {
+                _done = true;
+            } else if (rc == Z_BUF_ERROR) {
+                // No progress possible, wait for more input.
+                break;
+            }
+        }
+        return true;
+    }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(GzipInflater);
+    z_stream _zs;
+    bool _init_ok;
+    bool _done;
+    bool _ever_fed;
+};
+
 // Implement callbacks for http parser
 
 int HttpMessage::on_message_begin(http_parser *parser) {
@@ -177,6 +240,26 @@ int HttpMessage::on_headers_complete(http_parser *parser) {
             uri.SetHostAndPort(*host_header);
         }
     }
+    if (FLAGS_http_stream_decompress_body &&
+        !http_message->_read_body_progressively) {
+        const std::string* encoding =
+            http_message->header().GetHeader("content-encoding");
+        if (encoding != NULL && *encoding == "gzip") {
+            http_message->_body_inflater = new (std::nothrow) GzipInflater;
+            if (http_message->_body_inflater == NULL ||
+                !http_message->_body_inflater->initialized()) {
+                // Fall back to one-shot decompression after the body
+                // completes, done by the protocol handler.
+                LOG(WARNING) << "Fail to initialize GzipInflater, fall back"
+                                " to in-one-shot decompression";
+                delete http_message->_body_inflater;
+                http_message->_body_inflater = NULL;
+            } else {
+                // The body seen by users is already inflated.
+                http_message->header().RemoveHeader("content-encoding");
+            }
+        }
+    }
     return 0;
 }
 
@@ -241,6 +324,13 @@ int HttpMessage::OnBody(const char *at, const size_t length) {
     }
     if (!_read_body_progressively) {
         // Normal read.
+        if (_body_inflater != NULL) {
+            if (!_body_inflater->Feed(at, length, &_body)) {
+                LOG(WARNING) << "Fail to inflate gzip-encoded http body";
+                return -1;
+            }
+            return 0;
+        }
         // TODO: The input data is from IOBuf as well, possible to append
         // data w/o copying.
         _body.append(at, length);
@@ -293,6 +383,11 @@ int HttpMessage::OnMessageComplete() {
     }
     _cur_header.clear();
     _cur_value = NULL;
+    if (_body_inflater != NULL && _body_inflater->ever_fed() &&
+        !_body_inflater->done()) {
+        LOG(WARNING) << "Gzip-encoded http body ended prematurely";
+        return -1;
+    }
     if (!_read_body_progressively) {
         // Normal read.
         _stage = HTTP_ON_MESSAGE_COMPLELE;
@@ -397,6 +492,7 @@ HttpMessage::HttpMessage(bool read_body_progressively)
     , _stage(HTTP_ON_MESSAGE_BEGIN)
     , _read_body_progressively(read_body_progressively)
     , _body_reader(NULL)
+    , _body_inflater(NULL)
     , _cur_value(NULL)
     , _vmsgbuilder(NULL)
     , _vbodylen(0) {
@@ -405,6 +501,7 @@ HttpMessage::HttpMessage(bool read_body_progressively)
 }
 
 HttpMessage::~HttpMessage() {
+    delete _body_inflater;
     if (_body_reader) {
         ProgressiveReader* saved_body_reader = _body_reader;
         _body_reader = NULL;
@@ -417,6 +514,31 @@ HttpMessage::~HttpMessage() {
     }
 }
 
+void HttpMessage::Reset() {
+    _parsed_length = 0;
+    _stage = HTTP_ON_MESSAGE_BEGIN;
+    _url.clear();
+    _header.Clear();
+    if (_body_reader) {
+        // Same as the destructor: a non-NULL _body_reader means the socket
+        // was broken before completion of the message.
+        ProgressiveReader* saved_body_reader = _body_reader;
+        _body_reader = NULL;
+        saved_body_reader->OnEndOfMessage(
+            butil::Status(ECONNRESET, "The socket was broken"));
+    }
+    _body.clear();
+    delete _body_inflater;
+    _body_inflater = NULL;
+    http_parser_init(&_parser, HTTP_BOTH);
+    _parser.data = this;
+    _cur_header.clear();
+    _cur_value = NULL;
+    delete _vmsgbuilder;
+    _vmsgbuilder = NULL;
+    _vbodylen = 0;
+}
+
 ssize_t HttpMessage::ParseFromArray(const char *data, const size_t length) {
     if (Completed()) {
         if (length == 0) {
@@ -31,6 +31,8 @@
 
 namespace brpc {
 
+class GzipInflater;
+
 enum HttpParserStage {
     HTTP_ON_MESSAGE_BEGIN,
     HTTP_ON_URL,
@@ -49,6 +51,11 @@ public:
     HttpMessage(bool read_body_progressively = false);
     ~HttpMessage();
 
+    // Reset to the state of a newly constructed message, keeping the
+    // capacity of the header map and parser buffers, so that recycled
+    // messages do not re-grow them for every request.
+    void Reset();
+
     const butil::IOBuf &body() const { return _body; }
     butil::IOBuf &body() { return _body; }
 
@@ -81,6 +88,9 @@ public:
     const http_parser& parser() const { return _parser; }
 
     bool read_body_progressively() const { return _read_body_progressively; }
+    // Reset() does not change the flag, recyclers should set it to match
+    // the connection being served.
+    void set_read_body_progressively(bool rbp) { _read_body_progressively = rbp; }
 
     // Send new parts of the body to the reader. If the body already has some
     // data, feed them to the reader immediately.
@@ -105,6 +115,10 @@ private:
     // Read body progressively
     ProgressiveReader* _body_reader;
     butil::IOBuf _body;
+    // Created at headers-completion when -http_stream_decompress_body is
+    // on and the body is gzip-encoded; inflates body chunks into _body as
+    // they arrive so the compressed body is never buffered as a whole.
+    GzipInflater* _body_inflater;
 
     // Parser related members
     struct http_parser _parser;
@@ -1397,8 +1397,21 @@ size_t http_parser_execute (http_parser *parser,
 
         if (c) {
           switch (parser->header_state) {
-            case h_general:
+            case h_general: {
+              /* Skip the whole run of token chars at once instead of
+               * re-entering the state machine per byte. Make up for the
+               * per-byte nread accounting at the loop top. */
+              const char* start = p;
+              while (p + 1 < data + len && TOKEN(p[1])) {
+                p++;
+              }
+              parser->nread += (uint32_t)(p - start);
+              if (parser->nread > (BRPC_HTTP_MAX_HEADER_SIZE)) {
+                SET_ERRNO(HPE_HEADER_OVERFLOW);
+                goto error;
+              }
               break;
+            }
 
             case h_C:
               parser->index++;
@@ -1594,8 +1607,32 @@ size_t http_parser_execute (http_parser *parser,
         c = LOWER(ch);
 
         switch (parser->header_state) {
-          case h_general:
+          case h_general: {
+            /* Scan to the end of line in one step. memchr compiles to
+             * vectorized(SSE2/AVX2) scans in modern libcs, way faster than
+             * the per-byte loop on typical header values. */
+            const char* p_cr = (const char*) memchr(p, CR, data + len - p);
+            const char* p_lf = (const char*) memchr(p, LF, data + len - p);
+            const char* start = p;
+            if (p_cr != NULL) {
+              if (p_lf != NULL && p_lf < p_cr) {
+                p = p_lf;
+              } else {
+                p = p_cr;
+              }
+            } else if (p_lf != NULL) {
+              p = p_lf;
+            } else {
+              p = data + len;
+            }
+            --p;  /* the loop increments p and rechecks nread */
+            parser->nread += (uint32_t)(p - start);
+            if (parser->nread > (BRPC_HTTP_MAX_HEADER_SIZE)) {
+              SET_ERRNO(HPE_HEADER_OVERFLOW);
+              goto error;
+            }
             break;
+          }
 
           case h_connection:
           case h_transfer_encoding:
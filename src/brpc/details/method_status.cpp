@@ -145,6 +145,25 @@ void MethodStatus::Describe(
     }
 }
 
+void MethodStatus::DescribeAsJson(std::ostream& os) const {
+    os << "{\"count\":" << _latency_rec.count()
+       << ",\"qps\":" << _latency_rec.qps()
+       << ",\"error\":" << _nerror_bvar.get_value()
+       << ",\"eps\":" << _eps_bvar.get_value(1)
+       << ",\"latency\":" << _latency_rec.latency()
+       << ",\"latency_50\":" << _latency_rec.latency_percentile(0.5)
+       << ",\"latency_90\":" << _latency_rec.latency_percentile(0.9)
+       << ",\"latency_99\":" << _latency_rec.latency_percentile(0.99)
+       << ",\"latency_999\":" << _latency_rec.latency_percentile(0.999)
+       << ",\"max_latency\":" << _latency_rec.max_latency()
+       << ",\"concurrency\":"
+       << _nconcurrency.load(butil::memory_order_relaxed);
+    if (_cl) {
+        os << ",\"max_concurrency\":" << MaxConcurrency();
+    }
+    os << '}';
+}
+
 void MethodStatus::SetConcurrencyLimiter(ConcurrencyLimiter* cl) {
     _cl.reset(cl);
 }
@@ -38,7 +38,11 @@ public:
     // Call this function when the method is about to be called.
     // Returns false when the method is overloaded. If rejected_cc is not
     // NULL, it's set with the rejected concurrency.
-    bool OnRequested(int* rejected_cc = NULL);
+    // A non-negative `max_concurrency_override' (from the runtime
+    // overrides in Server::method_options()) caps the concurrency instead
+    // of the ConcurrencyLimiter, 0 rejects every call.
+    bool OnRequested(int* rejected_cc = NULL,
+                     int max_concurrency_override = -1);
 
     // Call this when the method just finished.
     // `error_code' : The error code obtained from the controller. Equal to 
@@ -55,6 +59,16 @@ public:
     // Describe internal vars, used by /status
     void Describe(std::ostream &os, const DescribeOptions&) const override;
 
+    // Append stats of this method to `os' as one JSON object, used by
+    // /status?format=json.
+    void DescribeAsJson(std::ostream& os) const;
+
+    // Total number of finished calls (successful + failed), monotonically
+    // increasing. /status?format=json re-renders a method only when this
+    // value changed since the last scrape.
+    int64_t ProcessedCount() const
+    { return _latency_rec.count() + _nerror_bvar.get_value(); }
+
     // Current max_concurrency of the method.
     int MaxConcurrency() const { return _cl ? _cl->MaxConcurrency() : 0; }
 
@@ -89,11 +103,16 @@ private:
     uint64_t _received_us;
 };
 
-inline bool MethodStatus::OnRequested(int* rejected_cc) {
+inline bool MethodStatus::OnRequested(int* rejected_cc,
+                                      int max_concurrency_override) {
     const int cc = _nconcurrency.fetch_add(1, butil::memory_order_relaxed) + 1;
-    if (NULL == _cl || _cl->OnRequested(cc)) {
+    if (max_concurrency_override >= 0) {
+        if (cc <= max_concurrency_override) {
+            return true;
+        }
+    } else if (NULL == _cl || _cl->OnRequested(cc)) {
         return true;
-    } 
+    }
     if (rejected_cc) {
         *rejected_cc = cc;
     }
@@ -20,15 +20,24 @@
 #include <pthread.h>
 #include <gflags/gflags.h>
 #include "bthread/butex.h"
+#include "butil/files/scoped_file.h"             // ScopedFILE
 #include "butil/scoped_lock.h"
 #include "butil/logging.h"
 #include "brpc/log.h"
 #include "brpc/socket_map.h"
+#include "brpc/policy/file_naming_service.h"     // FileNamingService
 #include "brpc/details/naming_service_thread.h"
 
 
 namespace brpc {
 
+DEFINE_string(ns_backup_dir, "",
+              "If set, each naming service thread saves its latest non-empty"
+              " server list to a file under this directory and loads the file"
+              " at startup, so that restarted processes route to last-known"
+              " servers immediately while fresh resolution proceeds in"
+              " background");
+
 struct NSKey {
     std::string protocol;
     std::string service_name;
@@ -91,6 +100,15 @@ void NamingServiceThread::Actions::RemoveServers(
 
 void NamingServiceThread::Actions::ResetServers(
         const std::vector<ServerNode>& servers) {
+    if (servers.empty() && _owner->_warming_up_with_backup) {
+        // The resolution failed or returned nothing yet, keep serving the
+        // servers loaded from the backup file instead of wiping them.
+        EndWait(0);
+        return;
+    }
+    if (!servers.empty()) {
+        _owner->_warming_up_with_backup = false;
+    }
     _servers.assign(servers.begin(), servers.end());
     
     // Diff servers with _last_servers by comparing sorted vectors.
@@ -103,8 +121,17 @@ void NamingServiceThread::Actions::ResetServers(
                      << " duplicated servers";
         _servers.resize(dedup_size);
     }
+    if (_servers == _last_servers) {
+        // Nothing changed, skip diffing, socket-list merging and taking
+        // _owner->_mutex. With periodically polled naming services on
+        // big clusters this is the common case by far, and the watcher
+        // notifications below allocate even when both deltas are empty.
+        EndWait(servers.empty() ? ENODATA : 0);
+        return;
+    }
+
     _added.resize(_servers.size());
-    std::vector<ServerNode>::iterator _added_end = 
+    std::vector<ServerNode>::iterator _added_end =
         std::set_difference(_servers.begin(), _servers.end(),
                             _last_servers.begin(), _last_servers.end(),
                             _added.begin());
@@ -202,6 +229,10 @@ void NamingServiceThread::Actions::ResetServers(
         LOG(INFO) << info.str();
     }
 
+    if (!_last_servers.empty()) {
+        _owner->SaveBackupServers(_last_servers);
+    }
+
     EndWait(servers.empty() ? ENODATA : 0);
 }
 
@@ -225,6 +256,7 @@ int NamingServiceThread::Actions::WaitForFirstBatchOfServers() {
 NamingServiceThread::NamingServiceThread()
     : _tid(0)
     , _ns(NULL)
+    , _warming_up_with_backup(false)
     , _actions(this) {
 }
 
@@ -286,6 +318,29 @@ int NamingServiceThread::Start(NamingService* naming_service,
         _options = *opt_in;
     }
     _last_sockets.clear();
+    if (!FLAGS_ns_backup_dir.empty()) {
+        // Mangle "<protocol>://<service_name>" into a flat file name.
+        std::string fname = protocol + "_" + service_name;
+        for (size_t i = 0; i < fname.size(); ++i) {
+            if (!isalnum(fname[i]) && fname[i] != '.' &&
+                fname[i] != '-' && fname[i] != '_') {
+                fname[i] = '_';
+            }
+        }
+        _backup_path = FLAGS_ns_backup_dir + "/" + fname;
+        std::vector<ServerNode> cached_servers;
+        if (LoadBackupServers(&cached_servers) == 0 &&
+            !cached_servers.empty()) {
+            LOG(INFO) << "Warmed up `" << protocol << "://" << service_name
+                      << "' with " << cached_servers.size()
+                      << " servers from " << _backup_path;
+            _actions.ResetServers(cached_servers);
+            // Set after ResetServers which clears the flag on non-empty
+            // lists: backup servers must survive until the first successful
+            // resolution.
+            _warming_up_with_backup = true;
+        }
+    }
     if (_ns->RunNamingServiceReturnsQuickly()) {
         RunThis(this);
     } else {
@@ -314,6 +369,44 @@ int NamingServiceThread::WaitForFirstBatchOfServers() {
     return 0;
 }
 
+int NamingServiceThread::LoadBackupServers(std::vector<ServerNode>* servers) {
+    if (_backup_path.empty()) {
+        return -1;
+    }
+    // The backup file shares the format of FileNamingService, reuse its
+    // parser (which also de-duplicates and logs invalid lines).
+    policy::FileNamingService fns;
+    return fns.GetServers(_backup_path.c_str(), servers);
+}
+
+void NamingServiceThread::SaveBackupServers(
+    const std::vector<ServerNode>& servers) const {
+    if (_backup_path.empty()) {
+        return;
+    }
+    // Write to a temporary file and rename so that concurrent loaders
+    // never see a partially-written list.
+    const std::string tmp_path = _backup_path + ".tmp";
+    butil::ScopedFILE fp(fopen(tmp_path.c_str(), "w"));
+    if (NULL == fp) {
+        PLOG(WARNING) << "Fail to open " << tmp_path;
+        return;
+    }
+    for (std::vector<ServerNode>::const_iterator it = servers.begin();
+         it != servers.end(); ++it) {
+        if (fprintf(fp.get(), "%s %s\n", butil::endpoint2str(it->addr).c_str(),
+                    it->tag.c_str()) < 0) {
+            PLOG(WARNING) << "Fail to write " << tmp_path;
+            return;
+        }
+    }
+    fp.reset(NULL);
+    if (rename(tmp_path.c_str(), _backup_path.c_str()) != 0) {
+        PLOG(WARNING) << "Fail to rename " << tmp_path
+                      << " to " << _backup_path;
+    }
+}
+
 void NamingServiceThread::ServerNodeWithId2ServerId(
     const std::vector<ServerNodeWithId>& src,
     std::vector<ServerId>* dst, const NamingServiceFilter* filter) {
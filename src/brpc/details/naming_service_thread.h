@@ -110,11 +110,21 @@ private:
         const std::vector<ServerNodeWithId>& src,
         std::vector<ServerId>* dst, const NamingServiceFilter* filter);
 
+    // Load/save last-known servers from/to the file under -ns_backup_dir
+    // so that restarted processes route warmly before the first resolution
+    // completes. No-op when -ns_backup_dir is empty.
+    int LoadBackupServers(std::vector<ServerNode>* servers);
+    void SaveBackupServers(const std::vector<ServerNode>& servers) const;
+
     butil::Mutex _mutex;
     bthread_t _tid;
     NamingService* _ns;
     std::string _protocol;
     std::string _service_name;
+    std::string _backup_path;
+    // True between loading servers from the backup file and the first
+    // successful resolution, suppressing destructive empty resets.
+    bool _warming_up_with_backup;
     GetNamingServiceThreadOptions _options;
     std::vector<ServerNodeWithId> _last_sockets;
     Actions _actions;
@@ -0,0 +1,141 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <gflags/gflags.h>
+#include "butil/logging.h"
+#include "butil/memory/singleton_on_pthread_once.h"
+#include "bthread/bthread.h"                // bthread_start_background
+#include "brpc/details/priority_lanes.h"
+
+namespace brpc {
+
+DEFINE_int32(request_priority_lane_workers, 4,
+             "Number of bthreads draining the priority lanes. This bounds "
+             "how many methods attached to a lane can run at the same time.");
+DEFINE_int32(request_priority_lane_weight_high, 8,
+             "Tasks taken from the high lane per round of weighted "
+             "round-robin while other lanes are not empty.");
+DEFINE_int32(request_priority_lane_weight_normal, 4,
+             "Tasks taken from the normal lane per round of weighted "
+             "round-robin while other lanes are not empty.");
+DEFINE_int32(request_priority_lane_weight_low, 1,
+             "Tasks taken from the low lane per round of weighted "
+             "round-robin while other lanes are not empty.");
+
+PriorityLanes::PriorityLanes()
+    : _num_workers(0)
+    , _num_busy_not_high(0)
+    , _workers_started(false) {
+    RefillCredits();
+}
+
+PriorityLanes* PriorityLanes::GetInstance() {
+    return butil::get_leaky_singleton<PriorityLanes>();
+}
+
+void PriorityLanes::RefillCredits() {
+    _credits[0] = std::max(FLAGS_request_priority_lane_weight_high, 1);
+    _credits[1] = std::max(FLAGS_request_priority_lane_weight_normal, 1);
+    _credits[2] = std::max(FLAGS_request_priority_lane_weight_low, 1);
+}
+
+int PriorityLanes::PickLane() {
+    // Keep one worker out of the normal/low lanes so that slow
+    // low-priority handlers can never occupy every worker.
+    const bool only_high =
+        (_num_workers > 1 && _num_busy_not_high >= _num_workers - 1);
+    for (int round = 0; round < 2; ++round) {
+        for (int i = 0; i < NUM_LANES; ++i) {
+            if (_lanes[i].empty() || (i > 0 && only_high)) {
+                continue;
+            }
+            if (_credits[i] > 0) {
+                --_credits[i];
+                return i;
+            }
+        }
+        // Every eligible non-empty lane ran out of credits.
+        RefillCredits();
+    }
+    return -1;
+}
+
+int PriorityLanes::Submit(int lane, void (*fn)(void*), void* arg) {
+    if (lane < 0 || lane >= NUM_LANES || fn == NULL) {
+        LOG(ERROR) << "Invalid lane=" << lane;
+        return -1;
+    }
+    const Task task = { fn, arg };
+    std::unique_lock<bthread::Mutex> mu(_mutex);
+    if (!_workers_started) {
+        const int nworkers = std::max(FLAGS_request_priority_lane_workers, 1);
+        for (int i = 0; i < nworkers; ++i) {
+            bthread_t tid;
+            if (bthread_start_background(&tid, NULL, RunThis, this) == 0) {
+                ++_num_workers;
+            } else {
+                LOG(ERROR) << "Fail to create lane worker";
+            }
+        }
+        _workers_started = true;
+    }
+    if (_num_workers == 0) {
+        return -1;
+    }
+    _lanes[lane].push_back(task);
+    mu.unlock();
+    _cond.notify_one();
+    return 0;
+}
+
+void* PriorityLanes::RunThis(void* arg) {
+    static_cast<PriorityLanes*>(arg)->Run();
+    return NULL;
+}
+
+void PriorityLanes::Run() {
+    while (true) {
+        Task task;
+        int lane = -1;
+        {
+            std::unique_lock<bthread::Mutex> mu(_mutex);
+            while ((lane = PickLane()) < 0) {
+                _cond.wait(mu);
+            }
+            task = _lanes[lane].front();
+            _lanes[lane].pop_front();
+            if (lane > 0) {
+                ++_num_busy_not_high;
+            }
+        }
+        // Map the lane onto the bthread priority(high=2, normal=1, low=0)
+        // so that a low-lane handler holding a bthread::Mutex is boosted
+        // by higher-lane waiters instead of inverting their latency.
+        bthread_set_priority(NUM_LANES - 1 - lane);
+        task.fn(task.arg);
+        bthread_set_priority(0);
+        if (lane > 0) {
+            std::unique_lock<bthread::Mutex> mu(_mutex);
+            --_num_busy_not_high;
+            mu.unlock();
+            // A worker blocked on only_high may become eligible again.
+            _cond.notify_one();
+        }
+    }
+}
+
+} // namespace brpc
@@ -0,0 +1,75 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef BRPC_DETAILS_PRIORITY_LANES_H
+#define BRPC_DETAILS_PRIORITY_LANES_H
+
+#include <deque>
+#include "bthread/mutex.h"
+#include "bthread/condition_variable.h"
+
+namespace brpc {
+
+// Executes tasks queued into 3 priority lanes with a bounded set of worker
+// bthreads, so that methods attached to a lane (Server::RequestPriorityOf)
+// can no longer occupy every worker in the process and starve cheap
+// requests. Workers drain the lanes with weighted round-robin
+// (-request_priority_lane_weight_{high,normal,low}) and one worker is
+// always kept away from the normal/low lanes, thus a burst of slow
+// low-priority handlers leaves at least one worker for the high lane.
+//
+// Methods not attached to any lane keep running in the bthread that parsed
+// them, exactly as before.
+class PriorityLanes {
+public:
+    static const int NUM_LANES = 3;  // high, normal, low
+
+    PriorityLanes();
+
+    static PriorityLanes* GetInstance();
+
+    // Queue fn(arg) into `lane' (0=high, 1=normal, 2=low) to be run in one
+    // of the worker bthreads. Returns 0 on success, -1 otherwise in which
+    // case the caller should run the task itself.
+    int Submit(int lane, void (*fn)(void*), void* arg);
+
+private:
+    struct Task {
+        void (*fn)(void*);
+        void* arg;
+    };
+
+    static void* RunThis(void* arg);
+    void Run();
+    // Returns the lane to pop from, or -1 if every eligible lane is empty.
+    // Must be called with _mutex held.
+    int PickLane();
+    void RefillCredits();
+
+    bthread::Mutex _mutex;
+    bthread::ConditionVariable _cond;
+    std::deque<Task> _lanes[NUM_LANES];
+    int _credits[NUM_LANES];
+    int _num_workers;
+    // Workers currently running a task of the normal/low lanes.
+    int _num_busy_not_high;
+    bool _workers_started;
+};
+
+} // namespace brpc
+
+#endif  // BRPC_DETAILS_PRIORITY_LANES_H
@@ -76,6 +76,11 @@ public:
         return _server->FindMethodPropertyByNameAndIndex(service_name, method_index);
     }
 
+    // Find by the dense id assigned in Server::Start()
+    const Server::MethodProperty* FindMethodPropertyByIndex(int index) const {
+        return _server->FindMethodPropertyByIndex(index);
+    }
+
     const Server::ServiceProperty*
     FindServicePropertyByFullName(const butil::StringPiece& fullname) const {
         return _server->FindServicePropertyByFullName(fullname);
@@ -0,0 +1,200 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <set>
+#include <vector>
+#include <pthread.h>
+#include <gflags/gflags.h>
+#include "butil/logging.h"
+#include "butil/time.h"
+#include "butil/scoped_lock.h"
+#include "butil/string_splitter.h"
+#include "butil/containers/flat_map.h"
+#include "bthread/butex.h"
+#include "brpc/reloadable_flags.h"
+#include "brpc/details/singleflight.h"
+
+namespace brpc {
+
+DEFINE_string(rpc_singleflight_methods, "",
+              "Comma-separated full method names (e.g. "
+              "\"example.EchoService.Echo\") whose concurrent byte-identical "
+              "requests are coalesced into one execution on the server side");
+DEFINE_int32(rpc_singleflight_ttl_ms, 0,
+             "Serve identical requests from a published singleflight result "
+             "for so many milliseconds after the leader finished. 0 coalesces"
+             " in-flight requests only");
+BRPC_VALIDATE_GFLAG(rpc_singleflight_ttl_ms, NonNegativeInteger);
+
+typedef butil::FlatMap<uint64_t, SingleflightEntry*> SingleflightMap;
+static pthread_mutex_t s_sf_mutex = PTHREAD_MUTEX_INITIALIZER;
+static SingleflightMap* s_sf_map = NULL;
+static size_t s_sf_begin_count = 0;
+
+// -rpc_singleflight_methods is parsed once at first use: turning coalescing
+// on/off per method at runtime would make concurrent Begin/Publish pairs
+// disagree about table membership.
+static pthread_once_t s_sf_methods_once = PTHREAD_ONCE_INIT;
+static std::set<std::string>* s_sf_methods = NULL;
+
+static void InitSingleflightMethods() {
+    std::set<std::string>* methods = new std::set<std::string>;
+    for (butil::StringSplitter sp(FLAGS_rpc_singleflight_methods.c_str(), ',');
+         sp != NULL; ++sp) {
+        std::string name(sp.field(), sp.length());
+        if (!name.empty()) {
+            methods->insert(name);
+        }
+    }
+    s_sf_methods = methods;
+}
+
+bool IsSingleflightMethod(const google::protobuf::MethodDescriptor* m) {
+    pthread_once(&s_sf_methods_once, InitSingleflightMethods);
+    if (s_sf_methods->empty()) {
+        return false;
+    }
+    return s_sf_methods->count(m->full_name());
+}
+
+// FNV-1a over all pieces, good enough for a table whose hits are verified
+// byte-wise anyway.
+static uint64_t HashBytes(uint64_t h, const char* data, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        h = (h ^ (uint8_t)data[i]) * 1099511628211ULL;
+    }
+    return h;
+}
+
+static uint64_t HashBuf(uint64_t h, const butil::IOBuf& buf) {
+    const size_t nblock = buf.backing_block_num();
+    for (size_t i = 0; i < nblock; ++i) {
+        const butil::StringPiece p = buf.backing_block(i);
+        h = HashBytes(h, p.data(), p.size());
+    }
+    return h;
+}
+
+SingleflightEntry::SingleflightEntry()
+    : error_code(0)
+    , _key(0)
+    , _publish_us(0) {
+    _butex = bthread::butex_create_checked<butil::atomic<int> >();
+    _butex->store(0, butil::memory_order_relaxed);
+}
+
+SingleflightEntry::~SingleflightEntry() {
+    bthread::butex_destroy(_butex);
+}
+
+int SingleflightEntry::Wait(const timespec* abstime) {
+    while (_butex->load(butil::memory_order_acquire) == 0) {
+        if (bthread::butex_wait(_butex, 0, abstime) < 0 &&
+            errno != EWOULDBLOCK && errno != EINTR) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+SingleflightEntry* SingleflightBegin(
+    const google::protobuf::MethodDescriptor* m,
+    const butil::IOBuf& request,
+    const butil::IOBuf& attachment,
+    bool* is_leader) {
+    uint64_t key = HashBytes(14695981039346656037ULL,
+                             m->full_name().data(), m->full_name().size());
+    key = HashBuf(key, request);
+    key = HashBuf(key, attachment);
+
+    const int64_t now_us = butil::gettimeofday_us();
+    const int64_t ttl_us = FLAGS_rpc_singleflight_ttl_ms * 1000L;
+    BAIDU_SCOPED_LOCK(s_sf_mutex);
+    if (s_sf_map == NULL) {
+        s_sf_map = new SingleflightMap;
+        CHECK_EQ(0, s_sf_map->init(64, 70));
+    }
+    // Expired published entries are only revisited by identical requests,
+    // sweep the table once in a while so that cold keys do not accumulate.
+    if (++s_sf_begin_count % 256 == 0) {
+        std::vector<uint64_t> expired;
+        for (SingleflightMap::iterator it = s_sf_map->begin();
+             it != s_sf_map->end(); ++it) {
+            const int64_t pub_us = it->second->_publish_us;
+            if (pub_us != 0 && now_us >= pub_us + ttl_us) {
+                expired.push_back(it->first);
+            }
+        }
+        for (size_t i = 0; i < expired.size(); ++i) {
+            SingleflightEntry* e = (*s_sf_map)[expired[i]];
+            s_sf_map->erase(expired[i]);
+            e->RemoveRefManually();
+        }
+    }
+    SingleflightEntry** pentry = s_sf_map->seek(key);
+    if (pentry != NULL) {
+        SingleflightEntry* entry = *pentry;
+        if (!entry->_request.equals(request) ||
+            !entry->_request_attachment.equals(attachment)) {
+            // Hash collision, run both requests independently.
+            return NULL;
+        }
+        const int64_t pub_us = entry->_publish_us;
+        if (pub_us == 0 || now_us < pub_us + ttl_us) {
+            entry->AddRefManually();
+            *is_leader = false;
+            return entry;
+        }
+        // Published but expired, replace with a fresh leader entry.
+        s_sf_map->erase(key);
+        entry->RemoveRefManually();
+    }
+    SingleflightEntry* entry = new SingleflightEntry;
+    entry->_key = key;
+    entry->_request = request;
+    entry->_request_attachment = attachment;
+    entry->AddRefManually();  // the table's reference
+    entry->AddRefManually();  // the caller's reference
+    (*s_sf_map)[key] = entry;
+    *is_leader = true;
+    return entry;
+}
+
+void SingleflightPublish(SingleflightEntry* entry,
+                         int error_code,
+                         const std::string& error_text,
+                         const butil::IOBuf& res_body,
+                         const butil::IOBuf& attachment) {
+    entry->error_code = error_code;
+    entry->error_text = error_text;
+    entry->res_body = res_body;
+    entry->attachment = attachment;
+    entry->_butex->store(1, butil::memory_order_release);
+    bthread::butex_wake_all(entry->_butex);
+    BAIDU_SCOPED_LOCK(s_sf_mutex);
+    entry->_publish_us = butil::gettimeofday_us();
+    if (FLAGS_rpc_singleflight_ttl_ms <= 0) {
+        SingleflightEntry** pentry = s_sf_map->seek(entry->_key);
+        if (pentry != NULL && *pentry == entry) {
+            s_sf_map->erase(entry->_key);
+            entry->RemoveRefManually();
+        }
+    }
+}
+
+} // namespace brpc
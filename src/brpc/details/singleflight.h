@@ -0,0 +1,97 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef BRPC_DETAILS_SINGLEFLIGHT_H
+#define BRPC_DETAILS_SINGLEFLIGHT_H
+
+#include <string>
+#include <google/protobuf/descriptor.h>         // MethodDescriptor
+#include "butil/iobuf.h"
+#include "butil/atomicops.h"
+#include "brpc/shared_object.h"
+
+namespace brpc {
+
+// Server-side coalescing of identical requests ("singleflight"): when
+// several concurrent requests to a method listed in -rpc_singleflight_methods
+// carry byte-identical serialized bodies, only the first one (the leader)
+// runs the service code; the others (followers) block on the leader's entry
+// and reuse its published response. With -rpc_singleflight_ttl_ms > 0 a
+// published result additionally serves identical requests arriving within
+// the TTL after the leader finished.
+//
+// Keyed by a 64-bit hash of (method full name, request bytes, attachment
+// bytes); the original bytes are kept in the entry and compared on every
+// hit, so a hash collision degrades to independent executions instead of
+// returning a wrong response.
+class SingleflightEntry : public SharedObject {
+public:
+    SingleflightEntry();
+
+    // Block until the leader published its result or `abstime' passed
+    // (NULL means no timeout). Returns 0 when the result is available.
+    int Wait(const timespec* abstime);
+
+    // Result published by the leader, valid after Wait() returned 0.
+    // `res_body' is the response serialized without compression; each
+    // follower parses it into its own response and goes through the
+    // ordinary response path with its own correlation id.
+    int error_code;
+    std::string error_text;
+    butil::IOBuf res_body;
+    butil::IOBuf attachment;
+
+private:
+friend SingleflightEntry* SingleflightBegin(
+    const google::protobuf::MethodDescriptor*, const butil::IOBuf&,
+    const butil::IOBuf&, bool*);
+friend void SingleflightPublish(SingleflightEntry*, int, const std::string&,
+                                const butil::IOBuf&, const butil::IOBuf&);
+    ~SingleflightEntry();
+
+    butil::atomic<int>* _butex;  // 0=pending, 1=published
+    uint64_t _key;
+    butil::IOBuf _request;       // for verifying that a hash hit is real
+    butil::IOBuf _request_attachment;
+    int64_t _publish_us;         // gettimeofday_us() at publication
+};
+
+// True when `m' is listed in -rpc_singleflight_methods.
+bool IsSingleflightMethod(const google::protobuf::MethodDescriptor* m);
+
+// Find or create the entry for `m' + request bytes. On success the caller
+// owns one reference (release with RemoveRefManually) and *is_leader tells
+// whether it must run the service and SingleflightPublish() the result.
+// Returns NULL when coalescing is unsafe (different bytes hashed to the
+// same key), in which case the caller executes normally.
+SingleflightEntry* SingleflightBegin(
+    const google::protobuf::MethodDescriptor* m,
+    const butil::IOBuf& request,
+    const butil::IOBuf& attachment,
+    bool* is_leader);
+
+// Called once by the leader: fill in the result, wake all waiters and,
+// when -rpc_singleflight_ttl_ms is 0, remove the entry from the table.
+void SingleflightPublish(SingleflightEntry* entry,
+                         int error_code,
+                         const std::string& error_text,
+                         const butil::IOBuf& res_body,
+                         const butil::IOBuf& attachment);
+
+} // namespace brpc
+
+#endif  // BRPC_DETAILS_SINGLEFLIGHT_H
@@ -0,0 +1,397 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <algorithm>
+#include <gflags/gflags.h>
+#include "butil/fd_guard.h"
+#include "butil/file_util.h"
+#include "butil/files/file_path.h"
+#include "butil/logging.h"
+#include "brpc/reloadable_flags.h"
+#include "brpc/details/span_segments.h"
+
+namespace brpc {
+
+DEFINE_int32(rpcz_segment_bytes, 16 * 1024 * 1024,
+             "Byte capacity of one mmap'd span segment, applied to "
+             "segments created afterwards");
+BRPC_VALIDATE_GFLAG(rpcz_segment_bytes, PositiveInteger);
+
+DECLARE_string(rpcz_database_dir);
+DECLARE_bool(rpcz_keep_span_db);
+
+SpanSegment::SpanSegment()
+    : _base(NULL)
+    , _capacity(0)
+    , _data_end(0)
+    , _min_time(0)
+    , _max_time(0)
+    , _unlink_at_close(false) {
+}
+
+SpanSegment::~SpanSegment() {
+    if (_base != NULL) {
+        munmap(_base, _capacity);
+        _base = NULL;
+    }
+    if (_unlink_at_close && !_path.empty()) {
+        unlink(_path.c_str());
+    }
+}
+
+int SpanSegment::Create(const std::string& path, size_t bytes) {
+    butil::fd_guard fd(open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644));
+    if (fd < 0) {
+        PLOG(ERROR) << "Fail to create " << path;
+        return -1;
+    }
+    if (ftruncate(fd, bytes) != 0) {
+        PLOG(ERROR) << "Fail to resize " << path << " to " << bytes;
+        unlink(path.c_str());
+        return -1;
+    }
+    void* base = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        PLOG(ERROR) << "Fail to mmap " << path;
+        unlink(path.c_str());
+        return -1;
+    }
+    if (_newest_of_trace.init(4096, 70) != 0) {
+        LOG(ERROR) << "Fail to init _newest_of_trace";
+        munmap(base, bytes);
+        unlink(path.c_str());
+        return -1;
+    }
+    _base = (char*)base;
+    _capacity = bytes;
+    _path = path;
+    return 0;
+}
+
+bool SpanSegment::Append(uint64_t trace_id, uint64_t span_id,
+                         int64_t time_key, const std::string& brief,
+                         const std::string& full) {
+    const size_t record_size = sizeof(RecordHeader) + brief.size() + full.size();
+    if (_data_end + record_size > _capacity) {
+        return false;
+    }
+    RecordHeader header;
+    header.trace_id = trace_id;
+    header.span_id = span_id;
+    header.time_us = time_key;
+    const uint32_t* prev = _newest_of_trace.seek(trace_id);
+    header.prev_same_trace = (prev != NULL ? *prev : NO_PREV);
+    header.brief_len = brief.size();
+    header.full_len = full.size();
+    const uint32_t offset = _data_end;
+    char* p = _base + _data_end;
+    memcpy(p, &header, sizeof(header));
+    memcpy(p + sizeof(header), brief.data(), brief.size());
+    memcpy(p + sizeof(header) + brief.size(), full.data(), full.size());
+    _data_end += record_size;
+    if (_offsets.empty()) {
+        _min_time = time_key;
+    }
+    _max_time = time_key;
+    _offsets.push_back(offset);
+    _newest_of_trace[trace_id] = offset;
+    return true;
+}
+
+int SpanSegment::ParseFullAt(uint32_t offset, RpczSpan* out) const {
+    RecordHeader header;
+    memcpy(&header, _base + offset, sizeof(header));
+    if (!out->ParseFromArray(_base + offset + sizeof(header) + header.brief_len,
+                             header.full_len)) {
+        LOG(ERROR) << "Fail to parse RpczSpan at offset=" << offset
+                   << " of " << _path;
+        return -1;
+    }
+    return 0;
+}
+
+int SpanSegment::FindSpan(uint64_t trace_id, uint64_t span_id,
+                          RpczSpan* out) const {
+    const uint32_t* head = _newest_of_trace.seek(trace_id);
+    if (head == NULL) {
+        return -1;
+    }
+    for (uint32_t offset = *head; offset != NO_PREV; ) {
+        RecordHeader header;
+        memcpy(&header, _base + offset, sizeof(header));
+        if (header.span_id == span_id) {
+            return ParseFullAt(offset, out);
+        }
+        offset = header.prev_same_trace;
+    }
+    return -1;
+}
+
+void SpanSegment::FindSpans(uint64_t trace_id,
+                            std::deque<RpczSpan>* out) const {
+    const uint32_t* head = _newest_of_trace.seek(trace_id);
+    if (head == NULL) {
+        return;
+    }
+    // The chain is newest-first, restore insertion order by front-pushing.
+    std::deque<RpczSpan> spans_of_trace;
+    for (uint32_t offset = *head; offset != NO_PREV; ) {
+        RecordHeader header;
+        memcpy(&header, _base + offset, sizeof(header));
+        spans_of_trace.push_front(RpczSpan());
+        if (ParseFullAt(offset, &spans_of_trace.front()) != 0) {
+            spans_of_trace.pop_front();
+        }
+        offset = header.prev_same_trace;
+    }
+    out->insert(out->end(), spans_of_trace.begin(), spans_of_trace.end());
+}
+
+size_t SpanSegment::UpperBound(int64_t time_key) const {
+    // Record times ascend with offsets, binary search the offset array.
+    size_t lo = 0;
+    size_t hi = _offsets.size();
+    while (lo < hi) {
+        const size_t mid = (lo + hi) / 2;
+        RecordHeader header;
+        memcpy(&header, _base + _offsets[mid], sizeof(header));
+        if (header.time_us <= time_key) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+int SpanSegment::BriefSpanAt(size_t index, BriefSpan* out) const {
+    if (index >= _offsets.size()) {
+        return -1;
+    }
+    const uint32_t offset = _offsets[index];
+    RecordHeader header;
+    memcpy(&header, _base + offset, sizeof(header));
+    if (!out->ParseFromArray(_base + offset + sizeof(header),
+                             header.brief_len)) {
+        LOG(ERROR) << "Fail to parse BriefSpan at offset=" << offset
+                   << " of " << _path;
+        return -1;
+    }
+    return 0;
+}
+
+SpanSegmentStore::SpanSegmentStore()
+    : _next_segment_seq(0) {
+}
+
+SpanSegmentStore::~SpanSegmentStore() {
+    const bool remove_files = !FLAGS_rpcz_keep_span_db;
+    BAIDU_SCOPED_LOCK(_mutex);
+    for (size_t i = 0; i < _segments.size(); ++i) {
+        _segments[i]->set_unlink_at_close(remove_files);
+        delete _segments[i];
+    }
+    _segments.clear();
+    if (remove_files && !_dir.empty()) {
+        rmdir(_dir.c_str());
+    }
+}
+
+int SpanSegmentStore::Init(const std::string& database_dir) {
+    char prefix[64];
+    time_t rawtime;
+    time(&rawtime);
+    struct tm lt_buf;
+    struct tm* timeinfo = localtime_r(&rawtime, &lt_buf);
+    const size_t nw = strftime(prefix, sizeof(prefix),
+                               "/segments.%Y%m%d.%H%M%S", timeinfo);
+    snprintf(prefix + nw, sizeof(prefix) - nw, ".%d", getpid());
+    std::string dir = database_dir;
+    dir.append(prefix);
+    butil::File::Error error;
+    if (!butil::CreateDirectoryAndGetError(butil::FilePath(dir), &error)) {
+        LOG(ERROR) << "Fail to create directory=`" << dir << "', " << error;
+        return -1;
+    }
+    BAIDU_SCOPED_LOCK(_mutex);
+    _dir = dir;
+    LOG(INFO) << "Opened " << _dir;
+    return 0;
+}
+
+int SpanSegmentStore::AddSegment(size_t min_bytes) {
+    size_t bytes = (size_t)FLAGS_rpcz_segment_bytes;
+    if (bytes < min_bytes) {
+        bytes = min_bytes;
+    }
+    char name[32];
+    snprintf(name, sizeof(name), "/%08lld", (long long)_next_segment_seq);
+    SpanSegment* seg = new (std::nothrow) SpanSegment;
+    if (seg == NULL) {
+        return -1;
+    }
+    if (seg->Create(_dir + name, bytes) != 0) {
+        delete seg;
+        return -1;
+    }
+    ++_next_segment_seq;
+    _segments.push_back(seg);
+    return 0;
+}
+
+int SpanSegmentStore::Append(uint64_t trace_id, uint64_t span_id,
+                             int64_t time_key, const BriefSpan& brief,
+                             const RpczSpan& full) {
+    std::string brief_buf;
+    std::string full_buf;
+    if (!brief.SerializeToString(&brief_buf) ||
+        !full.SerializeToString(&full_buf)) {
+        LOG(ERROR) << "Fail to serialize span";
+        return -1;
+    }
+    BAIDU_SCOPED_LOCK(_mutex);
+    if (_dir.empty()) {
+        return -1;
+    }
+    const size_t min_bytes = brief_buf.size() + full_buf.size() + 256;
+    if (_segments.empty() && AddSegment(min_bytes) != 0) {
+        return -1;
+    }
+    if (!_segments.back()->Append(trace_id, span_id, time_key,
+                                  brief_buf, full_buf)) {
+        // Rotate to a new segment.
+        if (AddSegment(min_bytes) != 0) {
+            return -1;
+        }
+        if (!_segments.back()->Append(trace_id, span_id, time_key,
+                                      brief_buf, full_buf)) {
+            LOG(ERROR) << "Fail to append to a fresh segment";
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int SpanSegmentStore::FindSpan(uint64_t trace_id, uint64_t span_id,
+                               RpczSpan* out) {
+    BAIDU_SCOPED_LOCK(_mutex);
+    // Newest first: recent spans are browsed more often.
+    for (size_t i = _segments.size(); i > 0; --i) {
+        if (_segments[i - 1]->FindSpan(trace_id, span_id, out) == 0) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+void SpanSegmentStore::FindSpans(uint64_t trace_id,
+                                 std::deque<RpczSpan>* out) {
+    out->clear();
+    BAIDU_SCOPED_LOCK(_mutex);
+    for (size_t i = 0; i < _segments.size(); ++i) {
+        _segments[i]->FindSpans(trace_id, out);
+    }
+}
+
+void SpanSegmentStore::ListSpans(int64_t starting_realtime, size_t max_scan,
+                                 std::deque<BriefSpan>* out,
+                                 SpanFilter* filter) {
+    out->clear();
+    BAIDU_SCOPED_LOCK(_mutex);
+    size_t nscan = 0;
+    // Segments ascend by time: walk them backwards from the newest one
+    // overlapping starting_realtime, records within a segment backwards
+    // from the binary-searched position.
+    for (size_t i = _segments.size(); i > 0 && nscan < max_scan; --i) {
+        const SpanSegment* seg = _segments[i - 1];
+        if (seg->num_records() == 0 || seg->min_time() > starting_realtime) {
+            continue;
+        }
+        size_t index = seg->UpperBound(starting_realtime);
+        BriefSpan brief;
+        for (; index > 0 && nscan < max_scan; --index) {
+            brief.Clear();
+            if (seg->BriefSpanAt(index - 1, &brief) == 0) {
+                if (NULL == filter || filter->Keep(brief)) {
+                    out->push_back(brief);
+                }
+                // Count regardless of the filter to bound the scan, same
+                // as the leveldb backend.
+                ++nscan;
+            }
+        }
+    }
+}
+
+void SpanSegmentStore::RemoveSegmentsBefore(int64_t tm) {
+    BAIDU_SCOPED_LOCK(_mutex);
+    // back() stays writable even when expired, rotation renews it.
+    while (_segments.size() > 1 && _segments.front()->max_time() < tm) {
+        SpanSegment* seg = _segments.front();
+        _segments.pop_front();
+        seg->set_unlink_at_close(true);
+        delete seg;
+    }
+}
+
+void SpanSegmentStore::Describe(std::ostream& os) {
+    BAIDU_SCOPED_LOCK(_mutex);
+    os << "[ " << _dir << " ]\nsegments: " << _segments.size() << '\n';
+    for (size_t i = 0; i < _segments.size(); ++i) {
+        const SpanSegment* seg = _segments[i];
+        os << seg->path() << " records=" << seg->num_records()
+           << " bytes=" << seg->bytes_used() << '/' << seg->capacity()
+           << " time=[" << seg->min_time() << ", " << seg->max_time()
+           << "]\n";
+    }
+}
+
+static pthread_once_t g_segment_store_once = PTHREAD_ONCE_INIT;
+static SpanSegmentStore* g_segment_store = NULL;
+
+static void InitSegmentStore() {
+    SpanSegmentStore* store = new (std::nothrow) SpanSegmentStore;
+    if (store == NULL) {
+        return;
+    }
+    if (store->Init(FLAGS_rpcz_database_dir) != 0) {
+        delete store;
+        return;
+    }
+    g_segment_store = store;
+}
+
+SpanSegmentStore* SpanSegmentStore::GetGlobal() {
+    pthread_once(&g_segment_store_once, InitSegmentStore);
+    return g_segment_store;
+}
+
+SpanSegmentStore* SpanSegmentStore::GetGlobalIfExists() {
+    return g_segment_store;
+}
+
+void SpanSegmentStore::DestroyGlobal() {
+    SpanSegmentStore* store = g_segment_store;
+    g_segment_store = NULL;
+    delete store;
+}
+
+} // namespace brpc
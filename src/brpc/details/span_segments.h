@@ -0,0 +1,169 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef BRPC_DETAILS_SPAN_SEGMENTS_H
+#define BRPC_DETAILS_SPAN_SEGMENTS_H
+
+#include <deque>
+#include <vector>
+#include "butil/containers/flat_map.h"
+#include "butil/synchronization/lock.h"
+#include "brpc/span.h"                        // BriefSpan, RpczSpan, SpanFilter
+
+namespace brpc {
+
+// Time-partitioned storage of rpcz spans, an alternative to the leveldb
+// backend in span.cpp enabled by -rpcz_segment_storage.
+//
+// Spans are appended to fixed-size mmap'd segment files in ascending time
+// order. Each segment keeps an in-memory hash index from trace_id to a
+// chain of its records for O(1) lookups by correlation id, and a sorted
+// offset array for binary searching a time range. Retention drops whole
+// segments whose newest span fell out of -rpcz_keep_span_seconds: one
+// munmap+unlink instead of the per-span deletions of the leveldb backend,
+// keeping memory and disk bounded regardless of span rate.
+
+// One mmap'd file of spans, writable until sealed by rotation.
+class SpanSegment {
+public:
+    SpanSegment();
+    ~SpanSegment();
+
+    // Create the file at `path' with a fixed capacity of `bytes'.
+    // Returns 0 on success, -1 otherwise.
+    int Create(const std::string& path, size_t bytes);
+
+    // Append one span. `time_key' must not decrease between calls.
+    // Returns false when the segment has no room left(caller rotates).
+    bool Append(uint64_t trace_id, uint64_t span_id, int64_t time_key,
+                const std::string& brief, const std::string& full);
+
+    // Find the span matching trace_id/span_id.
+    // Returns 0 on success, -1 otherwise.
+    int FindSpan(uint64_t trace_id, uint64_t span_id, RpczSpan* out) const;
+
+    // Append all spans of `trace_id' to `out' in insertion order.
+    void FindSpans(uint64_t trace_id, std::deque<RpczSpan>* out) const;
+
+    // Index of the newest record with time <= `time_key' plus one,
+    // located by binary search. 0 means no such record.
+    size_t UpperBound(int64_t time_key) const;
+
+    // Parse the BriefSpan of the `index'-th record.
+    // Returns 0 on success, -1 otherwise.
+    int BriefSpanAt(size_t index, BriefSpan* out) const;
+
+    size_t num_records() const { return _offsets.size(); }
+    size_t bytes_used() const { return _data_end; }
+    size_t capacity() const { return _capacity; }
+    int64_t min_time() const { return _min_time; }
+    int64_t max_time() const { return _max_time; }
+    const std::string& path() const { return _path; }
+
+    // Unlink the file when this segment is destroyed.
+    void set_unlink_at_close(bool f) { _unlink_at_close = f; }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(SpanSegment);
+
+    // Layout of one record inside the mapping, followed by the serialized
+    // BriefSpan and RpczSpan. memcpy-ed to avoid unaligned accesses.
+    struct RecordHeader {
+        uint64_t trace_id;
+        uint64_t span_id;
+        int64_t time_us;
+        uint32_t prev_same_trace;  // offset of previous record of the same
+                                   // trace_id, NO_PREV for none.
+        uint32_t brief_len;
+        uint32_t full_len;
+    };
+    static const uint32_t NO_PREV = 0xFFFFFFFFu;
+
+    int ParseFullAt(uint32_t offset, RpczSpan* out) const;
+
+    char* _base;
+    size_t _capacity;
+    size_t _data_end;
+    int64_t _min_time;
+    int64_t _max_time;
+    bool _unlink_at_close;
+    std::string _path;
+    // Offsets of records in ascending time order.
+    std::vector<uint32_t> _offsets;
+    // trace_id -> offset of its newest record(head of the chain).
+    butil::FlatMap<uint64_t, uint32_t> _newest_of_trace;
+};
+
+// The set of segments, rotated by capacity and dropped by retention.
+// All methods are thread-safe.
+class SpanSegmentStore {
+public:
+    // Returns the global instance, NULL when the storage directory can
+    // not be created.
+    static SpanSegmentStore* GetGlobal();
+
+    // Returns the global instance if created, never creates one. For
+    // queries, which must not set up storage of their own.
+    static SpanSegmentStore* GetGlobalIfExists();
+
+    // Delete the global instance, called at program's exit. Segment
+    // files are kept on disk when -rpcz_keep_span_db is on.
+    static void DestroyGlobal();
+
+    SpanSegmentStore();
+    ~SpanSegmentStore();
+
+    // Prepare the directory holding segment files.
+    // Returns 0 on success, -1 otherwise.
+    int Init(const std::string& database_dir);
+
+    // Append one span, rotating to a new segment when the current one is
+    // full. `time_key' must not decrease between calls.
+    // Returns 0 on success, -1 otherwise.
+    int Append(uint64_t trace_id, uint64_t span_id, int64_t time_key,
+               const BriefSpan& brief, const RpczSpan& full);
+
+    // Counterparts of the functions with same names in span.h.
+    int FindSpan(uint64_t trace_id, uint64_t span_id, RpczSpan* out);
+    void FindSpans(uint64_t trace_id, std::deque<RpczSpan>* out);
+    void ListSpans(int64_t starting_realtime, size_t max_scan,
+                   std::deque<BriefSpan>* out, SpanFilter* filter);
+
+    // Drop whole segments whose newest span is before `tm'. O(1) per
+    // dropped segment.
+    void RemoveSegmentsBefore(int64_t tm);
+
+    // Print snapshot of segments into `os'.
+    void Describe(std::ostream& os);
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(SpanSegmentStore);
+
+    // REQUIRES: _mutex is held.
+    int AddSegment(size_t min_bytes);
+
+    butil::Mutex _mutex;
+    std::string _dir;
+    int64_t _next_segment_seq;
+    // Ascending by time, back() is the writable one.
+    std::deque<SpanSegment*> _segments;
+};
+
+} // namespace brpc
+
+#endif  // BRPC_DETAILS_SPAN_SEGMENTS_H
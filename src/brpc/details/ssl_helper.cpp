@@ -24,10 +24,14 @@
 #include <openssl/err.h>
 #include <openssl/x509.h>
 #include <openssl/x509v3.h>
+#include <map>
 #include "butil/unique_ptr.h"
 #include "butil/logging.h"
 #include "butil/ssl_compat.h"
 #include "butil/string_splitter.h"
+#include "butil/hash.h"                // Hash
+#include "butil/time.h"                // gettimeofday_us
+#include "butil/memory/singleton_on_pthread_once.h"
 #include "brpc/socket.h"
 #include "brpc/details/ssl_helper.h"
 
@@ -441,6 +445,165 @@ static int SetSSLOptions(SSL_CTX* ctx, const std::string& ciphers,
     return 0;
 }
 
+static const unsigned char* GetSessionId(SSL_SESSION* sess, unsigned int* len) {
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+    return SSL_SESSION_get_id(sess, len);
+#else
+    *len = sess->session_id_length;
+    return sess->session_id;
+#endif
+}
+
+// A lock-sharded cache of serialized sessions shared by all server
+// certificates (each owning a SSL_CTX) of the process, replacing the
+// per-SSL_CTX internal cache whose single lock serializes concurrent
+// resumptions. Sessions are stored in i2d form so no reference into any
+// SSL_CTX is kept. Note that TLS1.3 resumptions use stateless tickets by
+// default and never look into this cache.
+class ShardedSessionCache {
+public:
+    static const size_t NUM_SHARDS = 16;
+
+    static ShardedSessionCache* GetInstance() {
+        return butil::get_leaky_singleton<ShardedSessionCache>();
+    }
+
+    ShardedSessionCache() : _max_per_shard(20480 / NUM_SHARDS), _lifetime_s(300) {}
+
+    // Called each time a server SSL_CTX enables the shared cache, the last
+    // caller wins. Not thread-safe w.r.t. on-going lookups, which is fine
+    // since contexts are created before serving.
+    void Configure(int cache_size, int lifetime_s) {
+        if (cache_size > 0) {
+            _max_per_shard = std::max(cache_size / (int)NUM_SHARDS, 1);
+        }
+        if (lifetime_s > 0) {
+            _lifetime_s = lifetime_s;
+        }
+    }
+
+    void Put(SSL_SESSION* sess) {
+        unsigned int id_len = 0;
+        const unsigned char* id = GetSessionId(sess, &id_len);
+        if (id == NULL || id_len == 0) {
+            return;
+        }
+        const int data_len = i2d_SSL_SESSION(sess, NULL);
+        if (data_len <= 0) {
+            return;
+        }
+        std::string data;
+        data.resize(data_len);
+        unsigned char* p = (unsigned char*)&data[0];
+        i2d_SSL_SESSION(sess, &p);
+        const std::string key((const char*)id, id_len);
+        const int64_t now_s = butil::gettimeofday_us() / 1000000L;
+        Shard& shard = GetShard(key);
+        BAIDU_SCOPED_LOCK(shard.mutex);
+        if (shard.sessions.size() >= (size_t)_max_per_shard &&
+            shard.sessions.find(key) == shard.sessions.end()) {
+            EvictLocked(shard, now_s);
+        }
+        Entry& e = shard.sessions[key];
+        e.expire_s = now_s + _lifetime_s;
+        e.data.swap(data);
+    }
+
+    SSL_SESSION* Get(const unsigned char* id, int id_len) {
+        const std::string key((const char*)id, id_len);
+        const int64_t now_s = butil::gettimeofday_us() / 1000000L;
+        Shard& shard = GetShard(key);
+        std::string data;
+        {
+            BAIDU_SCOPED_LOCK(shard.mutex);
+            std::map<std::string, Entry>::iterator it = shard.sessions.find(key);
+            if (it == shard.sessions.end()) {
+                return NULL;
+            }
+            if (it->second.expire_s <= now_s) {
+                shard.sessions.erase(it);
+                return NULL;
+            }
+            data = it->second.data;
+        }
+        const unsigned char* p = (const unsigned char*)data.data();
+        return d2i_SSL_SESSION(NULL, &p, data.size());
+    }
+
+    void Remove(SSL_SESSION* sess) {
+        unsigned int id_len = 0;
+        const unsigned char* id = GetSessionId(sess, &id_len);
+        if (id == NULL || id_len == 0) {
+            return;
+        }
+        const std::string key((const char*)id, id_len);
+        Shard& shard = GetShard(key);
+        BAIDU_SCOPED_LOCK(shard.mutex);
+        shard.sessions.erase(key);
+    }
+
+private:
+    struct Entry {
+        int64_t expire_s;
+        std::string data;
+    };
+    struct Shard {
+        butil::Mutex mutex;
+        std::map<std::string, Entry> sessions;
+    };
+
+    Shard& GetShard(const std::string& key) {
+        return _shards[butil::Hash(key) % NUM_SHARDS];
+    }
+
+    // Erase expired entries; if none expired yet, erase the entry expiring
+    // soonest so that Put() always succeeds. Must be called with the
+    // shard's mutex held.
+    static void EvictLocked(Shard& shard, int64_t now_s) {
+        std::map<std::string, Entry>::iterator oldest = shard.sessions.begin();
+        bool erased = false;
+        for (std::map<std::string, Entry>::iterator it = shard.sessions.begin();
+             it != shard.sessions.end();) {
+            if (it->second.expire_s <= now_s) {
+                shard.sessions.erase(it++);
+                erased = true;
+            } else {
+                if (it->second.expire_s < oldest->second.expire_s) {
+                    oldest = it;
+                }
+                ++it;
+            }
+        }
+        if (!erased && oldest != shard.sessions.end()) {
+            shard.sessions.erase(oldest);
+        }
+    }
+
+    Shard _shards[NUM_SHARDS];
+    int _max_per_shard;
+    int _lifetime_s;
+};
+
+static int NewSessionCallback(SSL* /*ssl*/, SSL_SESSION* sess) {
+    ShardedSessionCache::GetInstance()->Put(sess);
+    return 0;  // a serialized copy was taken, no reference to `sess' kept.
+}
+
+static void RemoveSessionCallback(SSL_CTX* /*ctx*/, SSL_SESSION* sess) {
+    ShardedSessionCache::GetInstance()->Remove(sess);
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+static SSL_SESSION* GetSessionCallback(SSL* /*ssl*/, const unsigned char* id,
+                                       int id_len, int* copy) {
+#else
+static SSL_SESSION* GetSessionCallback(SSL* /*ssl*/, unsigned char* id,
+                                       int id_len, int* copy) {
+#endif
+    *copy = 0;
+    return ShardedSessionCache::GetInstance()->Get(id, id_len);
+}
+
 SSL_CTX* CreateClientSSLContext(const ChannelSSLOptions& options) {
     std::unique_ptr<SSL_CTX, FreeSSLCTX> ssl_ctx(
         SSL_CTX_new(SSLv23_client_method()));
@@ -503,6 +666,37 @@ SSL_CTX* CreateServerSSLContext(const std::string& certificate,
     SSL_CTX_set_timeout(ssl_ctx.get(), options.session_lifetime_s);
     SSL_CTX_sess_set_cache_size(ssl_ctx.get(), options.session_cache_size);
 
+    if (options.shared_session_cache) {
+        // Replace the internal cache with the process-wide sharded one so
+        // that sessions are resumable across certificates and lookups do
+        // not contend on one lock.
+        SSL_CTX_set_session_cache_mode(
+            ssl_ctx.get(), SSL_SESS_CACHE_SERVER | SSL_SESS_CACHE_NO_INTERNAL);
+        ShardedSessionCache::GetInstance()->Configure(
+            options.session_cache_size, options.session_lifetime_s);
+        SSL_CTX_sess_set_new_cb(ssl_ctx.get(), NewSessionCallback);
+        SSL_CTX_sess_set_get_cb(ssl_ctx.get(), GetSessionCallback);
+        SSL_CTX_sess_set_remove_cb(ssl_ctx.get(), RemoveSessionCallback);
+    }
+
+    if (options.enable_early_data) {
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+        SSL_CTX_set_max_early_data(ssl_ctx.get(), SSL3_RT_MAX_PLAIN_LENGTH);
+#else
+        LOG(ERROR) << "enable_early_data requires OpenSSL >= 1.1.1";
+        return NULL;
+#endif
+    }
+
+    if (options.enable_ktls) {
+#ifdef SSL_OP_ENABLE_KTLS
+        SSL_CTX_set_options(ssl_ctx.get(), SSL_OP_ENABLE_KTLS);
+#else
+        LOG(ERROR) << "enable_ktls requires OpenSSL >= 3.0";
+        return NULL;
+#endif
+    }
+
 #ifndef OPENSSL_NO_DH
     SSL_CTX_set_tmp_dh_callback(ssl_ctx.get(), SSLGetDHCallback);
 
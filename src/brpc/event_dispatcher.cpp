@@ -17,11 +17,14 @@
 
 
 #include <gflags/gflags.h>                            // DEFINE_int32
+#include "butil/atomicops.h"                          // butil::static_atomic
 #include "butil/compat.h"
 #include "butil/fd_utility.h"                         // make_close_on_exec
 #include "butil/logging.h"                            // LOG
 #include "butil/third_party/murmurhash3/murmurhash3.h"// fmix32
 #include "bthread/bthread.h"                          // bthread_start_background
+#include "bvar/bvar.h"
+#include "bvar/latency_recorder.h"
 #include "brpc/event_dispatcher.h"
 #ifdef BRPC_SOCKET_HAS_EOF
 #include "brpc/details/has_epollrdhup.h"
@@ -35,11 +38,35 @@
 
 namespace brpc {
 
-DEFINE_int32(event_dispatcher_num, 1, "Number of event dispatcher");
+DEFINE_int32(event_dispatcher_num, 1,
+             "Number of event dispatchers over which new fds are "
+             "distributed. May be raised at runtime to spawn more "
+             "dispatchers (bounded by the capacity reserved at start-up) "
+             "or lowered to exclude dispatchers from the assignment of "
+             "new fds. Already-attached fds are not migrated");
+static bool validate_event_dispatcher_num(const char*, int32_t);
+BRPC_VALIDATE_GFLAG(event_dispatcher_num, validate_event_dispatcher_num);
 
-DEFINE_bool(usercode_in_pthread, false, 
+DEFINE_bool(usercode_in_pthread, false,
             "Call user's callback in pthreads, use bthreads otherwise");
 
+DEFINE_string(event_dispatcher_backend, "epoll",
+              "Poller used by event dispatchers, \"epoll\" or \"io_uring\" "
+              "(requires a kernel with io_uring and building with "
+              "BRPC_WITH_IO_URING)");
+
+DEFINE_bool(event_dispatcher_nonblocking, false,
+            "Poll with zero timeout and yield the worker between polls "
+            "instead of blocking a worker pthread inside epoll_wait/kevent, "
+            "so that dispatchers share cores with ordinary bthreads. Useful "
+            "in small containers where a blocked dispatcher occupies a "
+            "whole core");
+
+DEFINE_int32(event_dispatcher_max_poll_interval_us, 100,
+             "Max interval between polls when a nonblocking event dispatcher"
+             " is idle. Smaller values lower latency but cost more cpu");
+BRPC_VALIDATE_GFLAG(event_dispatcher_max_poll_interval_us, PositiveInteger);
+
 EventDispatcher::EventDispatcher()
     : _epfd(-1)
     , _stop(false)
@@ -265,6 +292,7 @@ int EventDispatcher::RemoveConsumer(int fd) {
     EV_SET(&evt, fd, EVFILT_WRITE, EV_DELETE, 0, 0, NULL);
     kevent(_epfd, &evt, 1, NULL, 0, NULL);
 #endif
+    EraseFdDispatcherAssignment(fd);
     return 0;
 }
 
@@ -273,22 +301,59 @@ void* EventDispatcher::RunThis(void* arg) {
     return NULL;
 }
 
+// Initial/maximal number of events consumed by one epoll_wait/kevent.
+static const int INITIAL_EVENT_BATCH_SIZE = 32;
+static const int MAX_EVENT_BATCH_SIZE = 1024;
+// Double the event array after this many consecutive completely-full
+// batches. One full batch may just be a burst; several in a row mean the
+// array is the bottleneck.
+static const int FULL_BATCHES_BEFORE_GROW = 3;
+
+// Numbers of events consumed by single non-empty polls, not latencies.
+// Quantiles of this recorder in /vars show how full the batches are.
+static bvar::LatencyRecorder g_event_batch_size("rpc_event_dispatcher_batch");
+static bvar::Adder<int> g_event_batch_grow("rpc_event_dispatcher_batch_grow");
+
 void EventDispatcher::Run() {
+    int poll_interval_us = 0;
+    // The event array starts small and doubles (up to MAX_EVENT_BATCH_SIZE)
+    // when polls keep filling it completely, so that a busy dispatcher
+    // consumes large batches per syscall while idle ones keep the initial
+    // footprint. The array never shrinks: the maximal memory is trivial and
+    // a once-busy dispatcher is likely to be busy again.
+    int batch_size = INITIAL_EVENT_BATCH_SIZE;
+    int nfull_batch = 0;
+#if defined(OS_LINUX)
+    epoll_event* e = new epoll_event[batch_size];
+#elif defined(OS_MACOSX)
+    struct kevent* e = new struct kevent[batch_size];
+#endif
     while (!_stop) {
+        int n;
 #if defined(OS_LINUX)
-        epoll_event e[32];
+        if (FLAGS_event_dispatcher_nonblocking) {
+            // Zero timeout keeps this bthread schedulable: when nothing
+            // is ready the worker is yielded via bthread_usleep below
+            // rather than being blocked inside the syscall.
+            n = epoll_wait(_epfd, e, batch_size, 0);
+        } else {
 #ifdef BRPC_ADDITIONAL_EPOLL
-        // Performance downgrades in examples.
-        int n = epoll_wait(_epfd, e, ARRAY_SIZE(e), 0);
-        if (n == 0) {
-            n = epoll_wait(_epfd, e, ARRAY_SIZE(e), -1);
-        }
+            // Performance downgrades in examples.
+            n = epoll_wait(_epfd, e, batch_size, 0);
+            if (n == 0) {
+                n = epoll_wait(_epfd, e, batch_size, -1);
+            }
 #else
-        const int n = epoll_wait(_epfd, e, ARRAY_SIZE(e), -1);
+            n = epoll_wait(_epfd, e, batch_size, -1);
 #endif
+        }
 #elif defined(OS_MACOSX)
-        struct kevent e[32];
-        int n = kevent(_epfd, NULL, 0, e, ARRAY_SIZE(e), NULL);
+        if (FLAGS_event_dispatcher_nonblocking) {
+            struct timespec zero_timeout = { 0, 0 };
+            n = kevent(_epfd, NULL, 0, e, batch_size, &zero_timeout);
+        } else {
+            n = kevent(_epfd, NULL, 0, e, batch_size, NULL);
+        }
 #endif
         if (_stop) {
             // epoll_ctl/epoll_wait should have some sort of memory fencing
@@ -308,6 +373,26 @@ void EventDispatcher::Run() {
 #endif
             break;
         }
+        if (n > 0) {
+            g_event_batch_size << n;
+        }
+        if (FLAGS_event_dispatcher_nonblocking) {
+            if (n > 0) {
+                poll_interval_us = 0;
+            } else {
+                // Idle. Sleep as a bthread so that the worker runs other
+                // tasks meanwhile, backing off gradually to bound the cost
+                // of busy-polling.
+                if (poll_interval_us <
+                    FLAGS_event_dispatcher_max_poll_interval_us) {
+                    poll_interval_us = std::min(
+                        poll_interval_us * 2 + 1,
+                        FLAGS_event_dispatcher_max_poll_interval_us);
+                }
+                bthread_usleep(poll_interval_us);
+                continue;
+            }
+        }
         for (int i = 0; i < n; ++i) {
 #if defined(OS_LINUX)
             if (e[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)
@@ -340,37 +425,183 @@ void EventDispatcher::Run() {
             }
 #endif
         }
+        if (n == batch_size && batch_size < MAX_EVENT_BATCH_SIZE) {
+            if (++nfull_batch >= FULL_BATCHES_BEFORE_GROW) {
+                nfull_batch = 0;
+                batch_size *= 2;
+                delete [] e;
+#if defined(OS_LINUX)
+                e = new epoll_event[batch_size];
+#elif defined(OS_MACOSX)
+                e = new struct kevent[batch_size];
+#endif
+                g_event_batch_grow << 1;
+            }
+        } else {
+            nfull_batch = 0;
+        }
     }
+    delete [] e;
 }
 
-static EventDispatcher* g_edisp = NULL;
+static EventDispatcher** g_edisp = NULL;
 static pthread_once_t g_edisp_once = PTHREAD_ONCE_INIT;
+// Capacity of g_edisp, reserved at start-up so that raising
+// -event_dispatcher_num later never reallocates the array under
+// concurrent lock-free readers.
+static int g_edisp_capacity = 0;
+// Dispatchers created so far, g_edisp[0, created). Never decreased: a
+// dispatcher retired by lowering -event_dispatcher_num keeps running and
+// serving its attached fds, it is merely excluded from the assignment of
+// new fds. Destroying a dispatcher with fds still attached is unsafe.
+static butil::static_atomic<int> g_edisp_created = BUTIL_STATIC_ATOMIC_INIT(0);
+// Dispatchers that new fds are distributed over, g_edisp[0, active).
+static butil::static_atomic<int> g_edisp_active = BUTIL_STATIC_ATOMIC_INIT(0);
+// Guards creation of dispatchers and growth of the fd/dispatcher map.
+static pthread_mutex_t g_edisp_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int get_active_event_dispatcher_num(void*) {
+    return g_edisp_active.load(butil::memory_order_relaxed);
+}
+static bvar::PassiveStatus<int> g_edisp_active_bvar(
+    "rpc_event_dispatcher_count", get_active_event_dispatcher_num, NULL);
+
+// Maps fd to the index of its dispatcher so that AddConsumer and the
+// matching RemoveEpollOut/RemoveConsumer always reach the same epoll even
+// if -event_dispatcher_num changed in between. Hashing the fd over the
+// current active count at every call site (as before dispatchers became
+// scalable) would route EPOLL_CTL_DEL to a wrong epfd after a change and
+// leak the fd inside the old one. Entries store index + 1, 0 means
+// unassigned. The array is grown under g_edisp_mutex and republished; the
+// old array is intentionally leaked since lock-free readers may still be
+// using it.
+struct FdIndexMap {
+    size_t size;
+    butil::static_atomic<uint32_t>* entries;
+};
+static butil::static_atomic<FdIndexMap*> g_fd_index_map
+    = BUTIL_STATIC_ATOMIC_INIT(NULL);
+
+static int get_assigned_dispatcher_index(int fd) {
+    FdIndexMap* m = g_fd_index_map.load(butil::memory_order_acquire);
+    if (m != NULL && (size_t)fd < m->size) {
+        return (int)m->entries[fd].load(butil::memory_order_relaxed) - 1;
+    }
+    return -1;
+}
+
+static void set_assigned_dispatcher_index(int fd, int index) {
+    BAIDU_SCOPED_LOCK(g_edisp_mutex);
+    FdIndexMap* m = g_fd_index_map.load(butil::memory_order_relaxed);
+    if (m == NULL || (size_t)fd >= m->size) {
+        size_t new_size = (m != NULL ? m->size : 32768);
+        while (new_size <= (size_t)fd) {
+            new_size *= 2;
+        }
+        FdIndexMap* new_map = new FdIndexMap;
+        new_map->size = new_size;
+        new_map->entries = new butil::static_atomic<uint32_t>[new_size];
+        memset(new_map->entries, 0, sizeof(*new_map->entries) * new_size);
+        if (m != NULL) {
+            memcpy(new_map->entries, m->entries,
+                   sizeof(*m->entries) * m->size);
+        }
+        g_fd_index_map.store(new_map, butil::memory_order_release);
+        m = new_map;
+    }
+    m->entries[fd].store((uint32_t)(index + 1), butil::memory_order_relaxed);
+}
+
+void EraseFdDispatcherAssignment(int fd) {
+    FdIndexMap* m = g_fd_index_map.load(butil::memory_order_acquire);
+    if (m != NULL && fd >= 0 && (size_t)fd < m->size) {
+        m->entries[fd].store(0, butil::memory_order_relaxed);
+    }
+}
 
 static void StopAndJoinGlobalDispatchers() {
-    for (int i = 0; i < FLAGS_event_dispatcher_num; ++i) {
-        g_edisp[i].Stop();
-        g_edisp[i].Join();
+    const int ncreated = g_edisp_created.load(butil::memory_order_acquire);
+    for (int i = 0; i < ncreated; ++i) {
+        g_edisp[i]->Stop();
+        g_edisp[i]->Join();
     }
 }
+
+static EventDispatcher* NewEventDispatcher() {
+    if (FLAGS_event_dispatcher_backend == "epoll") {
+        return new EventDispatcher;
+    }
+#if defined(OS_LINUX) && defined(BRPC_WITH_IO_URING)
+    if (FLAGS_event_dispatcher_backend == "io_uring") {
+        return new IOUringEventDispatcher;
+    }
+#endif
+    LOG(ERROR) << "Unsupported event_dispatcher_backend=`"
+               << FLAGS_event_dispatcher_backend << "', fall back to epoll";
+    return new EventDispatcher;
+}
+
 void InitializeGlobalDispatchers() {
-    g_edisp = new EventDispatcher[FLAGS_event_dispatcher_num];
-    for (int i = 0; i < FLAGS_event_dispatcher_num; ++i) {
+    BAIDU_SCOPED_LOCK(g_edisp_mutex);
+    const int initial_num = FLAGS_event_dispatcher_num;
+    g_edisp_capacity = std::max(initial_num, 64);
+    g_edisp = new EventDispatcher*[g_edisp_capacity];
+    memset(g_edisp, 0, sizeof(EventDispatcher*) * g_edisp_capacity);
+    for (int i = 0; i < initial_num; ++i) {
+        g_edisp[i] = NewEventDispatcher();
         const bthread_attr_t attr = FLAGS_usercode_in_pthread ?
             BTHREAD_ATTR_PTHREAD : BTHREAD_ATTR_NORMAL;
-        CHECK_EQ(0, g_edisp[i].Start(&attr));
+        CHECK_EQ(0, g_edisp[i]->Start(&attr));
     }
+    g_edisp_created.store(initial_num, butil::memory_order_release);
+    g_edisp_active.store(initial_num, butil::memory_order_release);
     // This atexit is will be run before g_task_control.stop() because above
     // Start() initializes g_task_control by creating bthread (to run epoll/kqueue).
     CHECK_EQ(0, atexit(StopAndJoinGlobalDispatchers));
 }
 
+static bool validate_event_dispatcher_num(const char*, int32_t val) {
+    if (val < 1) {
+        return false;
+    }
+    BAIDU_SCOPED_LOCK(g_edisp_mutex);
+    if (g_edisp == NULL) {
+        // Dispatchers are not initialized yet (parsing flags at start-up),
+        // only the range needs checking.
+        return true;
+    }
+    if (val > g_edisp_capacity) {
+        LOG(ERROR) << "event_dispatcher_num=" << val
+                   << " exceeds the capacity=" << g_edisp_capacity
+                   << " reserved at start-up";
+        return false;
+    }
+    for (int i = g_edisp_created.load(butil::memory_order_relaxed);
+         i < val; ++i) {
+        EventDispatcher* d = NewEventDispatcher();
+        const bthread_attr_t attr = FLAGS_usercode_in_pthread ?
+            BTHREAD_ATTR_PTHREAD : BTHREAD_ATTR_NORMAL;
+        if (d->Start(&attr) != 0) {
+            LOG(ERROR) << "Fail to start EventDispatcher";
+            delete d;
+            return false;
+        }
+        g_edisp[i] = d;
+        g_edisp_created.store(i + 1, butil::memory_order_release);
+    }
+    g_edisp_active.store(val, butil::memory_order_release);
+    return true;
+}
+
 EventDispatcher& GetGlobalEventDispatcher(int fd) {
     pthread_once(&g_edisp_once, InitializeGlobalDispatchers);
-    if (FLAGS_event_dispatcher_num == 1) {
-        return g_edisp[0];
+    int index = get_assigned_dispatcher_index(fd);
+    if (index < 0) {
+        const int active = g_edisp_active.load(butil::memory_order_acquire);
+        index = (active == 1 ? 0 : (int)(butil::fmix32(fd) % active));
+        set_assigned_dispatcher_index(fd, index);
     }
-    int index = butil::fmix32(fd) % FLAGS_event_dispatcher_num;
-    return g_edisp[index];
+    return *g_edisp[index];
 }
 
 } // namespace brpc
@@ -22,6 +22,10 @@
 #include "butil/macros.h"                     // DISALLOW_COPY_AND_ASSIGN
 #include "bthread/types.h"                   // bthread_t, bthread_attr_t
 #include "brpc/socket.h"                     // Socket, SocketId
+#if defined(OS_LINUX) && defined(BRPC_WITH_IO_URING)
+#include <map>
+#include "butil/synchronization/lock.h"       // butil::Mutex
+#endif
 
 
 namespace brpc {
@@ -42,13 +46,13 @@ public:
     virtual int Start(const bthread_attr_t* consumer_thread_attr);
 
     // True iff this dispatcher is running in a bthread
-    bool Running() const;
+    virtual bool Running() const;
 
     // Stop bthread of this dispatcher.
-    void Stop();
+    virtual void Stop();
 
     // Suspend calling thread until bthread of this dispatcher stops.
-    void Join();
+    virtual void Join();
 
     // When edge-triggered events happen on `fd', call
     // `on_edge_triggered_events' of `socket_id'.
@@ -56,31 +60,31 @@ public:
     // When the file descriptor is removed from internal epoll, the Socket
     // will be dereferenced once additionally.
     // Returns 0 on success, -1 otherwise.
-    int AddConsumer(SocketId socket_id, int fd);
+    virtual int AddConsumer(SocketId socket_id, int fd);
 
     // Watch EPOLLOUT event on `fd' into epoll device. If `pollin' is
     // true, EPOLLIN event will also be included and EPOLL_CTL_MOD will
     // be used instead of EPOLL_CTL_ADD. When event arrives,
     // `Socket::HandleEpollOut' will be called with `socket_id'
     // Returns 0 on success, -1 otherwise and errno is set
-    int AddEpollOut(SocketId socket_id, int fd, bool pollin);
-    
+    virtual int AddEpollOut(SocketId socket_id, int fd, bool pollin);
+
     // Remove EPOLLOUT event on `fd'. If `pollin' is true, EPOLLIN event
     // will be kept and EPOLL_CTL_MOD will be used instead of EPOLL_CTL_DEL
     // Returns 0 on success, -1 otherwise and errno is set
-    int RemoveEpollOut(SocketId socket_id, int fd, bool pollin);
+    virtual int RemoveEpollOut(SocketId socket_id, int fd, bool pollin);
 
-private:
+protected:
     DISALLOW_COPY_AND_ASSIGN(EventDispatcher);
 
     // Calls Run()
     static void* RunThis(void* arg);
 
     // Thread entry.
-    void Run();
+    virtual void Run();
 
     // Remove the file descriptor `fd' from epoll.
-    int RemoveConsumer(int fd);
+    virtual int RemoveConsumer(int fd);
 
     // The epoll to watch events.
     int _epfd;
@@ -98,8 +102,84 @@ private:
     int _wakeup_fds[2];
 };
 
+#if defined(OS_LINUX) && defined(BRPC_WITH_IO_URING)
+// An EventDispatcher polling readiness through io_uring (IORING_OP_POLL_ADD,
+// multishot when the kernel supports it) instead of epoll. Readiness events
+// are dispatched to Socket::StartInputEvent/HandleEpollOut exactly like the
+// epoll backend, so Socket::ProcessEvent works unchanged. Selected by
+// -event_dispatcher_backend=io_uring.
+class IOUringEventDispatcher : public EventDispatcher {
+public:
+    IOUringEventDispatcher();
+    ~IOUringEventDispatcher();
+
+    int Start(const bthread_attr_t* consumer_thread_attr);
+    bool Running() const;
+    void Stop();
+    void Join();
+    int AddConsumer(SocketId socket_id, int fd);
+    int AddEpollOut(SocketId socket_id, int fd, bool pollin);
+    int RemoveEpollOut(SocketId socket_id, int fd, bool pollin);
+
+protected:
+    void Run();
+    int RemoveConsumer(int fd);
+
+private:
+    // One armed poll on a fd. Owned by this dispatcher, freed in Run() after
+    // all in-flight completions referencing it were reaped.
+    struct PollConsumer;
+
+    // Re/arm the poll of `c' with c->poll_events. Cancels the previous poll
+    // first when `rearm' is true. Returns 0 on success, -1 otherwise.
+    int ArmPoll(PollConsumer* c, bool rearm);
+    // Cancel the armed poll of `c' (if any). Returns 0 on success.
+    int CancelPoll(PollConsumer* c);
+    // Drop one reference of `c' (an armed poll or the CQE being
+    // processed); frees the node when it was removed and this was the
+    // last reference.
+    void DerefPollConsumer(PollConsumer* c);
+    // Push one SQE and submit it. Thread-safe. Returns 0 on success.
+    int SubmitSqe(const void* sqe);
+    // Wake up Run() blocked in io_uring_enter().
+    void SubmitWakeup();
+
+    // io_uring instance and mmap-ed rings.
+    int _ring_fd;
+    void* _sq_ring;
+    size_t _sq_ring_size;
+    void* _cq_ring;
+    size_t _cq_ring_size;
+    void* _sqes;
+    size_t _sqes_size;
+    unsigned _sq_entries;
+    unsigned _cq_entries;
+    unsigned* _sq_head;
+    unsigned* _sq_tail;
+    unsigned* _sq_mask;
+    unsigned* _sq_array;
+    unsigned* _cq_head;
+    unsigned* _cq_tail;
+    unsigned* _cq_mask;
+    void* _cqes;
+    // true until the kernel rejects IORING_POLL_ADD_MULTI.
+    bool _multishot;
+
+    // Serializes SQE allocation and submission from arbitrary threads.
+    butil::Mutex _submit_mutex;
+    // Guards _consumers.
+    butil::Mutex _consumer_mutex;
+    std::map<int, PollConsumer*> _consumers;
+};
+#endif  // OS_LINUX && BRPC_WITH_IO_URING
+
 EventDispatcher& GetGlobalEventDispatcher(int fd);
 
+// Forget the dispatcher assigned to `fd'. Called by RemoveConsumer of
+// dispatcher implementations after detaching the fd, so that a reused fd
+// number is distributed over the dispatchers active at that time.
+void EraseFdDispatcherAssignment(int fd);
+
 } // namespace brpc
 
 
@@ -0,0 +1,525 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include "butil/build_config.h"
+
+#if defined(OS_LINUX) && defined(BRPC_WITH_IO_URING)
+
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+// <linux/io_uring.h> pulls in <linux/fs.h> whose BLOCK_SIZE macro would
+// clobber butil::SingleThreadedPool::BLOCK_SIZE in the headers below.
+#ifdef BLOCK_SIZE
+#undef BLOCK_SIZE
+#endif
+#include "butil/atomicops.h"                  // butil::atomic
+#include "butil/fd_utility.h"                 // make_close_on_exec
+#include "butil/logging.h"                    // LOG
+#include "bthread/bthread.h"                  // bthread_start_background
+#include "brpc/event_dispatcher.h"
+
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup 425
+#endif
+#ifndef __NR_io_uring_enter
+#define __NR_io_uring_enter 426
+#endif
+
+// Not present in older kernel headers; the runtime kernel may still reject
+// it, which is handled by falling back to oneshot polls.
+#ifndef IORING_POLL_ADD_MULTI
+#define IORING_POLL_ADD_MULTI (1U << 0)
+#endif
+#ifndef IORING_CQE_F_MORE
+#define IORING_CQE_F_MORE (1U << 1)
+#endif
+
+namespace brpc {
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params* p) {
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int ring_fd, unsigned to_submit,
+                              unsigned min_complete, unsigned flags) {
+    return syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete,
+                   flags, NULL, 0);
+}
+
+// Bits of PollConsumer::state below.
+static const int POLL_CONSUMER_REMOVED = 1;
+static const int POLL_CONSUMER_REF = 2;
+
+struct IOUringEventDispatcher::PollConsumer {
+    SocketId socket_id;
+    int fd;
+    // POLLIN / POLLIN|POLLOUT, mirroring what the epoll backend registers.
+    unsigned poll_events;
+    // Lifecycle word shared by the dispatcher thread and threads calling
+    // Add*/Remove*: bit 0 is set once by RemoveConsumer when the node
+    // left _consumers, higher bits count references -- armed polls whose
+    // terminal CQE was not fully processed yet, including the CQE Run()
+    // is handling right now. The thread bringing the word to `removed
+    // with zero references' frees the node, so exactly one thread ever
+    // deletes it and none touches it afterwards.
+    butil::atomic<int> state;
+};
+
+IOUringEventDispatcher::IOUringEventDispatcher()
+    : _ring_fd(-1)
+    , _sq_ring(NULL)
+    , _sq_ring_size(0)
+    , _cq_ring(NULL)
+    , _cq_ring_size(0)
+    , _sqes(NULL)
+    , _sqes_size(0)
+    , _sq_entries(0)
+    , _cq_entries(0)
+    , _multishot(true) {
+    // The epoll/kqueue fd created by the base constructor is unused by this
+    // backend.
+    if (_epfd >= 0) {
+        close(_epfd);
+        _epfd = -1;
+    }
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    const int ring_fd = sys_io_uring_setup(1024, &p);
+    if (ring_fd < 0) {
+        PLOG(FATAL) << "Fail to io_uring_setup";
+        return;
+    }
+    _sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    _cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (_cq_ring_size > _sq_ring_size) {
+            _sq_ring_size = _cq_ring_size;
+        }
+        _cq_ring_size = _sq_ring_size;
+    }
+    _sq_ring = mmap(NULL, _sq_ring_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    if (_sq_ring == MAP_FAILED) {
+        PLOG(FATAL) << "Fail to mmap SQ ring";
+        _sq_ring = NULL;
+        close(ring_fd);
+        return;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        _cq_ring = _sq_ring;
+    } else {
+        _cq_ring = mmap(NULL, _cq_ring_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+        if (_cq_ring == MAP_FAILED) {
+            PLOG(FATAL) << "Fail to mmap CQ ring";
+            _cq_ring = NULL;
+            munmap(_sq_ring, _sq_ring_size);
+            _sq_ring = NULL;
+            close(ring_fd);
+            return;
+        }
+    }
+    _sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    _sqes = mmap(NULL, _sqes_size, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+    if (_sqes == MAP_FAILED) {
+        PLOG(FATAL) << "Fail to mmap SQEs";
+        _sqes = NULL;
+        if (_cq_ring != _sq_ring) {
+            munmap(_cq_ring, _cq_ring_size);
+        }
+        munmap(_sq_ring, _sq_ring_size);
+        _sq_ring = NULL;
+        _cq_ring = NULL;
+        close(ring_fd);
+        return;
+    }
+    char* sq = (char*)_sq_ring;
+    char* cq = (char*)_cq_ring;
+    _sq_entries = p.sq_entries;
+    _cq_entries = p.cq_entries;
+    _sq_head = (unsigned*)(sq + p.sq_off.head);
+    _sq_tail = (unsigned*)(sq + p.sq_off.tail);
+    _sq_mask = (unsigned*)(sq + p.sq_off.ring_mask);
+    _sq_array = (unsigned*)(sq + p.sq_off.array);
+    _cq_head = (unsigned*)(cq + p.cq_off.head);
+    _cq_tail = (unsigned*)(cq + p.cq_off.tail);
+    _cq_mask = (unsigned*)(cq + p.cq_off.ring_mask);
+    _cqes = cq + p.cq_off.cqes;
+    CHECK_EQ(0, butil::make_close_on_exec(ring_fd));
+    _ring_fd = ring_fd;
+}
+
+IOUringEventDispatcher::~IOUringEventDispatcher() {
+    Stop();
+    Join();
+    for (std::map<int, PollConsumer*>::iterator
+             it = _consumers.begin(); it != _consumers.end(); ++it) {
+        delete it->second;
+    }
+    _consumers.clear();
+    if (_sqes) {
+        munmap(_sqes, _sqes_size);
+        _sqes = NULL;
+    }
+    if (_cq_ring && _cq_ring != _sq_ring) {
+        munmap(_cq_ring, _cq_ring_size);
+    }
+    _cq_ring = NULL;
+    if (_sq_ring) {
+        munmap(_sq_ring, _sq_ring_size);
+        _sq_ring = NULL;
+    }
+    if (_ring_fd >= 0) {
+        close(_ring_fd);
+        _ring_fd = -1;
+    }
+}
+
+int IOUringEventDispatcher::Start(const bthread_attr_t* consumer_thread_attr) {
+    if (_ring_fd < 0) {
+        LOG(FATAL) << "io_uring was not created";
+        return -1;
+    }
+    if (_tid != 0) {
+        LOG(FATAL) << "Already started this dispatcher(" << this
+                   << ") in bthread=" << _tid;
+        return -1;
+    }
+    _consumer_thread_attr = (consumer_thread_attr ?
+                             *consumer_thread_attr : BTHREAD_ATTR_NORMAL);
+    int rc = bthread_start_background(
+        &_tid, &_consumer_thread_attr, RunThis, this);
+    if (rc) {
+        LOG(FATAL) << "Fail to create io_uring thread: " << berror(rc);
+        return -1;
+    }
+    return 0;
+}
+
+bool IOUringEventDispatcher::Running() const {
+    return !_stop && _ring_fd >= 0 && _tid != 0;
+}
+
+void IOUringEventDispatcher::Stop() {
+    _stop = true;
+    if (_ring_fd >= 0) {
+        SubmitWakeup();
+    }
+}
+
+void IOUringEventDispatcher::Join() {
+    if (_tid) {
+        bthread_join(_tid, NULL);
+        _tid = 0;
+    }
+}
+
+int IOUringEventDispatcher::SubmitSqe(const void* sqe_in) {
+    const struct io_uring_sqe* sqe = (const struct io_uring_sqe*)sqe_in;
+    BAIDU_SCOPED_LOCK(_submit_mutex);
+    const unsigned mask = *_sq_mask;
+    const unsigned head = __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE);
+    unsigned tail = *_sq_tail;
+    if (tail - head >= _sq_entries) {
+        // SQ is full: everything submitted so far has not been consumed,
+        // which should not happen since we submit eagerly.
+        errno = EBUSY;
+        return -1;
+    }
+    const unsigned index = tail & mask;
+    memcpy((struct io_uring_sqe*)_sqes + index, sqe, sizeof(*sqe));
+    _sq_array[index] = index;
+    __atomic_store_n(_sq_tail, tail + 1, __ATOMIC_RELEASE);
+    if (sys_io_uring_enter(_ring_fd, 1, 0, 0) < 0) {
+        PLOG(WARNING) << "Fail to io_uring_enter ring_fd=" << _ring_fd;
+        return -1;
+    }
+    return 0;
+}
+
+void IOUringEventDispatcher::SubmitWakeup() {
+    struct io_uring_sqe sqe;
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_NOP;
+    sqe.user_data = 0;
+    SubmitSqe(&sqe);
+}
+
+int IOUringEventDispatcher::CancelPoll(PollConsumer* c) {
+    // The completion of the cancelation itself is not interesting, tag it
+    // with user_data=0.
+    struct io_uring_sqe rm;
+    memset(&rm, 0, sizeof(rm));
+    rm.opcode = IORING_OP_POLL_REMOVE;
+    rm.addr = (uint64_t)(uintptr_t)c;
+    rm.user_data = 0;
+    return SubmitSqe(&rm);
+}
+
+void IOUringEventDispatcher::DerefPollConsumer(PollConsumer* c) {
+    if (c->state.fetch_sub(POLL_CONSUMER_REF, butil::memory_order_acq_rel)
+        == (POLL_CONSUMER_REF | POLL_CONSUMER_REMOVED)) {
+        delete c;
+    }
+}
+
+int IOUringEventDispatcher::ArmPoll(PollConsumer* c, bool rearm) {
+    if (rearm) {
+        // Cancel the currently armed poll (if any).
+        if (CancelPoll(c) != 0) {
+            return -1;
+        }
+    }
+    struct io_uring_sqe sqe;
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_POLL_ADD;
+    sqe.fd = c->fd;
+    sqe.poll_events = c->poll_events | POLLERR | POLLHUP;
+    if (_multishot) {
+        sqe.len = IORING_POLL_ADD_MULTI;
+    }
+    sqe.user_data = (uint64_t)(uintptr_t)c;
+    c->state.fetch_add(POLL_CONSUMER_REF, butil::memory_order_acq_rel);
+    if (SubmitSqe(&sqe) != 0) {
+        DerefPollConsumer(c);
+        return -1;
+    }
+    return 0;
+}
+
+int IOUringEventDispatcher::AddConsumer(SocketId socket_id, int fd) {
+    if (_ring_fd < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    PollConsumer* c = new PollConsumer;
+    c->socket_id = socket_id;
+    c->fd = fd;
+    c->poll_events = POLLIN;
+    c->state.store(0, butil::memory_order_relaxed);
+    {
+        BAIDU_SCOPED_LOCK(_consumer_mutex);
+        std::pair<std::map<int, PollConsumer*>::iterator, bool> r =
+            _consumers.insert(std::make_pair(fd, c));
+        if (!r.second) {
+            delete c;
+            errno = EEXIST;
+            return -1;
+        }
+    }
+    if (ArmPoll(c, false) != 0) {
+        bool erased = false;
+        {
+            BAIDU_SCOPED_LOCK(_consumer_mutex);
+            std::map<int, PollConsumer*>::iterator it = _consumers.find(fd);
+            if (it != _consumers.end() && it->second == c) {
+                _consumers.erase(it);
+                erased = true;
+            }
+        }
+        // A concurrent RemoveConsumer that erased the node first also
+        // took over freeing it.
+        if (erased &&
+            c->state.fetch_or(POLL_CONSUMER_REMOVED,
+                              butil::memory_order_acq_rel) == 0) {
+            delete c;
+        }
+        return -1;
+    }
+    return 0;
+}
+
+int IOUringEventDispatcher::AddEpollOut(SocketId socket_id, int fd,
+                                        bool pollin) {
+    if (_ring_fd < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    PollConsumer* c = NULL;
+    if (pollin) {
+        BAIDU_SCOPED_LOCK(_consumer_mutex);
+        std::map<int, PollConsumer*>::iterator it = _consumers.find(fd);
+        if (it == _consumers.end()) {
+            // Same as the epoll backend after RemoveConsumer.
+            errno = ENOENT;
+            return -1;
+        }
+        c = it->second;
+        c->poll_events = POLLIN | POLLOUT;
+    } else {
+        c = new PollConsumer;
+        c->socket_id = socket_id;
+        c->fd = fd;
+        c->poll_events = POLLOUT;
+        c->state.store(0, butil::memory_order_relaxed);
+        BAIDU_SCOPED_LOCK(_consumer_mutex);
+        std::pair<std::map<int, PollConsumer*>::iterator, bool> r =
+            _consumers.insert(std::make_pair(fd, c));
+        if (!r.second) {
+            delete c;
+            errno = EEXIST;
+            return -1;
+        }
+    }
+    return ArmPoll(c, pollin/*cancel previous POLLIN-only poll*/);
+}
+
+int IOUringEventDispatcher::RemoveEpollOut(SocketId /*socket_id*/, int fd,
+                                           bool pollin) {
+    PollConsumer* c = NULL;
+    {
+        BAIDU_SCOPED_LOCK(_consumer_mutex);
+        std::map<int, PollConsumer*>::iterator it = _consumers.find(fd);
+        if (it == _consumers.end()) {
+            errno = ENOENT;
+            return -1;
+        }
+        c = it->second;
+    }
+    if (pollin) {
+        c->poll_events = POLLIN;
+        return ArmPoll(c, true);
+    }
+    return RemoveConsumer(fd);
+}
+
+int IOUringEventDispatcher::RemoveConsumer(int fd) {
+    if (fd < 0) {
+        return -1;
+    }
+    PollConsumer* c = NULL;
+    {
+        BAIDU_SCOPED_LOCK(_consumer_mutex);
+        std::map<int, PollConsumer*>::iterator it = _consumers.find(fd);
+        if (it == _consumers.end()) {
+            return -1;
+        }
+        c = it->second;
+        _consumers.erase(it);
+    }
+    EraseFdDispatcherAssignment(fd);
+    if (c->state.fetch_or(POLL_CONSUMER_REMOVED,
+                          butil::memory_order_acq_rel) == 0) {
+        // No armed poll and no CQE being processed references the node.
+        delete c;
+        return 0;
+    }
+    // An armed poll (or the CQE Run() is handling) still references `c'.
+    // Cancel the poll; the last DerefPollConsumer() in Run() frees the
+    // node.
+    CancelPoll(c);
+    return 0;
+}
+
+void IOUringEventDispatcher::Run() {
+    while (!_stop) {
+        const unsigned head = *_cq_head;
+        if (head == __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE)) {
+            if (sys_io_uring_enter(_ring_fd, 0, 1, IORING_ENTER_GETEVENTS) < 0) {
+                if (EINTR == errno) {
+                    continue;
+                }
+                PLOG(FATAL) << "Fail to io_uring_enter ring_fd=" << _ring_fd;
+                break;
+            }
+        }
+        if (_stop) {
+            break;
+        }
+        const unsigned mask = *_cq_mask;
+        unsigned h = *_cq_head;
+        const unsigned tail = __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE);
+        for (; h != tail; ++h) {
+            const struct io_uring_cqe* cqe =
+                (const struct io_uring_cqe*)_cqes + (h & mask);
+            PollConsumer* c = (PollConsumer*)(uintptr_t)cqe->user_data;
+            const int32_t res = cqe->res;
+            const uint32_t flags = cqe->flags;
+            __atomic_store_n(_cq_head, h + 1, __ATOMIC_RELEASE);
+            if (c == NULL) {  // wakeup NOP or poll-remove completion
+                continue;
+            }
+            // The reference of this CQE is dropped via DerefPollConsumer
+            // only after we are completely done with `c', so a concurrent
+            // RemoveConsumer never frees the node under our feet.
+            const bool terminal = (res < 0) || !(flags & IORING_CQE_F_MORE);
+            if (c->state.load(butil::memory_order_acquire)
+                & POLL_CONSUMER_REMOVED) {
+                if (terminal) {
+                    DerefPollConsumer(c);
+                } else {
+                    // A multishot poll armed after the cancelation of
+                    // RemoveConsumer slipped through, cancel it again.
+                    CancelPoll(c);
+                }
+                continue;
+            }
+            if (res == -EINVAL && _multishot) {
+                // Kernel does not support IORING_POLL_ADD_MULTI, fall back
+                // to oneshot polls from now on.
+                _multishot = false;
+                ArmPoll(c, false);
+                if (c->state.load(butil::memory_order_acquire)
+                    & POLL_CONSUMER_REMOVED) {
+                    // Removed concurrently, the cancelation of
+                    // RemoveConsumer may have missed the new poll.
+                    CancelPoll(c);
+                }
+                DerefPollConsumer(c);  // -EINVAL is terminal
+                continue;
+            }
+            if (res < 0 && res != -ECANCELED) {
+                LOG(WARNING) << "Poll on fd=" << c->fd << " failed: "
+                             << berror(-res);
+                DerefPollConsumer(c);  // errors are terminal
+                continue;
+            }
+            const unsigned revents = (res > 0 ? (unsigned)res : 0);
+            if (terminal && res >= 0) {
+                // Oneshot (or downgraded multishot) poll fired, re-arm
+                // before dispatching so no edge is missed, mirroring
+                // EPOLLET semantics.
+                ArmPoll(c, false);
+                if (c->state.load(butil::memory_order_acquire)
+                    & POLL_CONSUMER_REMOVED) {
+                    // Removed concurrently, the cancelation of
+                    // RemoveConsumer may have missed the new poll.
+                    CancelPoll(c);
+                }
+            }
+            if (revents & (POLLIN | POLLERR | POLLHUP)) {
+                Socket::StartInputEvent(c->socket_id, revents,
+                                        _consumer_thread_attr);
+            }
+            if (revents & (POLLOUT | POLLERR | POLLHUP)) {
+                Socket::HandleEpollOut(c->socket_id);
+            }
+            if (terminal) {
+                DerefPollConsumer(c);
+            }
+        }
+    }
+}
+
+} // namespace brpc
+
+#endif  // OS_LINUX && BRPC_WITH_IO_URING
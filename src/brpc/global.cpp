@@ -43,6 +43,7 @@
 #include "brpc/policy/round_robin_load_balancer.h"
 #include "brpc/policy/weighted_round_robin_load_balancer.h"
 #include "brpc/policy/randomized_load_balancer.h"
+#include "brpc/policy/power_of_two_choices_load_balancer.h"
 #include "brpc/policy/locality_aware_load_balancer.h"
 #include "brpc/policy/consistent_hashing_load_balancer.h"
 #include "brpc/policy/hasher.h"
@@ -52,6 +53,8 @@
 #include "brpc/compress.h"
 #include "brpc/policy/gzip_compress.h"
 #include "brpc/policy/snappy_compress.h"
+#include "brpc/policy/lz4_compress.h"
+#include "brpc/policy/zstd_compress.h"
 
 // Protocols
 #include "brpc/protocol.h"
@@ -77,6 +80,7 @@
 // Concurrency Limiters
 #include "brpc/concurrency_limiter.h"
 #include "brpc/policy/auto_concurrency_limiter.h"
+#include "brpc/policy/gradient_concurrency_limiter.h"
 #include "brpc/policy/constant_concurrency_limiter.h"
 
 #include "brpc/input_messenger.h"     // get_or_new_client_side_messenger
@@ -89,6 +93,8 @@
 #endif
 #include "butil/fd_guard.h"
 #include "butil/files/file_watcher.h"
+#include "butil/string_splitter.h"    // StringSplitter
+#include "brpc/global.h"
 
 extern "C" {
 // defined in gperftools/malloc_extension_c.h
@@ -104,6 +110,13 @@ DEFINE_int32(free_memory_to_system_interval, 0,
              "values <= 0 disables this feature");
 BRPC_VALIDATE_GFLAG(free_memory_to_system_interval, PassValidate);
 
+DEFINE_int32(iobuf_tls_cache_limit_mb, 64,
+             "Soft limit(in MB) of memory kept in IOBuf TLS block caches of "
+             "all threads. When the total exceeds the limit, caches of "
+             "threads idle for over a second are reclaimed. Values < 0 "
+             "disable the reclamation");
+BRPC_VALIDATE_GFLAG(iobuf_tls_cache_limit_mb, PassValidate);
+
 namespace policy {
 // Defined in http_rpc_protocol.cpp
 void InitCommonStrings();
@@ -134,6 +147,7 @@ struct GlobalExtensions {
     RoundRobinLoadBalancer rr_lb;
     WeightedRoundRobinLoadBalancer wrr_lb;
     RandomizedLoadBalancer randomized_lb;
+    PowerOfTwoChoicesLoadBalancer p2c_lb;
     LocalityAwareLoadBalancer la_lb;
     ConsistentHashingLoadBalancer ch_mh_lb;
     ConsistentHashingLoadBalancer ch_md5_lb;
@@ -141,12 +155,68 @@ struct GlobalExtensions {
     DynPartLoadBalancer dynpart_lb;
 
     AutoConcurrencyLimiter auto_cl;
+    GradientConcurrencyLimiter gradient_cl;
     ConstantConcurrencyLimiter constant_cl;
 };
 
 static pthread_once_t register_extensions_once = PTHREAD_ONCE_INIT;
 static GlobalExtensions* g_ext = NULL;
 
+DEFINE_string(enabled_protocols, "all",
+              "Comma-separated names of optional protocols to initialize,"
+              " or `all'. baidu_std, streaming_rpc and http (carrying the"
+              " builtin services) are always initialized. Tools that only"
+              " talk one protocol can shorten startup with e.g."
+              " -enabled_protocols=baidu_std. Read once at global"
+              " initialization, set it before creating channels/servers");
+
+// Timeline of initialization phases, see RecordStartupPhase().
+static pthread_mutex_t g_startup_phase_mutex = PTHREAD_MUTEX_INITIALIZER;
+static std::vector<std::pair<std::string, int64_t> >* g_startup_phases = NULL;
+
+void RecordStartupPhase(const char* name, int64_t time_us) {
+    BAIDU_SCOPED_LOCK(g_startup_phase_mutex);
+    if (g_startup_phases == NULL) {
+        // Leaked on purpose, phases may be recorded during exit as well.
+        g_startup_phases =
+            new std::vector<std::pair<std::string, int64_t> >;
+    }
+    g_startup_phases->push_back(std::make_pair(std::string(name), time_us));
+}
+
+static void PrintStartupPhases(std::ostream& os, void*) {
+    BAIDU_SCOPED_LOCK(g_startup_phase_mutex);
+    if (g_startup_phases == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < g_startup_phases->size(); ++i) {
+        if (i != 0) {
+            os << ' ';
+        }
+        os << (*g_startup_phases)[i].first << '='
+           << (*g_startup_phases)[i].second << "us";
+    }
+}
+static bvar::PassiveStatus<std::string> g_startup_phases_bvar(
+    "rpc_startup_phases", PrintStartupPhases, NULL);
+
+// Returns true when `name' is listed in -enabled_protocols. Only
+// consulted for optional protocols, the essential ones register
+// unconditionally.
+static bool ProtocolEnabled(const butil::StringPiece& name,
+                            const std::string& enabled_list) {
+    if (enabled_list == "all") {
+        return true;
+    }
+    for (butil::StringSplitter sp(enabled_list.c_str(), ','); sp != NULL;
+         ++sp) {
+        if (name == butil::StringPiece(sp.field(), sp.length())) {
+            return true;
+        }
+    }
+    return false;
+}
+
 static long ReadPortOfDummyServer(const char* filename) {
     butil::fd_guard fd(open(filename, O_RDONLY));
     if (fd < 0) {
@@ -186,6 +256,27 @@ static int64_t GetIOBufNewBigViewCount(void*) {
 static int64_t GetIOBufBlockMemory(void*) {
     return butil::IOBuf::block_memory();
 }
+static int64_t GetIOBufMediumBlockCount(void*) {
+    return butil::IOBuf::medium_block_count();
+}
+static int64_t GetIOBufHugeBlockCount(void*) {
+    return butil::IOBuf::huge_block_count();
+}
+static int64_t GetIOBufTLSBlockCount(void*) {
+    return butil::IOBuf::tls_block_count();
+}
+static int64_t GetIOBufTLSBlockMemory(void*) {
+    return butil::IOBuf::tls_block_memory();
+}
+static int64_t GetIOBufTLSBlockHitCount(void*) {
+    return butil::IOBuf::tls_block_hit_count();
+}
+static int64_t GetIOBufTLSBlockMissCount(void*) {
+    return butil::IOBuf::tls_block_miss_count();
+}
+static int64_t GetIOBufTLSBlockReclaimedCount(void*) {
+    return butil::IOBuf::tls_block_reclaimed_count();
+}
 
 // Defined in server.cpp
 extern butil::static_atomic<int> g_running_server_count;
@@ -207,6 +298,24 @@ static void* GlobalUpdate(void*) {
         "iobuf_newbigview_second", &var_iobuf_new_bigview_count);
     bvar::PassiveStatus<int64_t> var_iobuf_block_memory(
         "iobuf_block_memory", GetIOBufBlockMemory, NULL);
+    bvar::PassiveStatus<int64_t> var_iobuf_medium_block_count(
+        "iobuf_medium_block_count", GetIOBufMediumBlockCount, NULL);
+    bvar::PassiveStatus<int64_t> var_iobuf_huge_block_count(
+        "iobuf_huge_block_count", GetIOBufHugeBlockCount, NULL);
+    bvar::PassiveStatus<int64_t> var_iobuf_tls_block_count(
+        "iobuf_tls_block_count", GetIOBufTLSBlockCount, NULL);
+    bvar::PassiveStatus<int64_t> var_iobuf_tls_block_memory(
+        "iobuf_tls_block_memory", GetIOBufTLSBlockMemory, NULL);
+    bvar::PassiveStatus<int64_t> var_iobuf_tls_block_hit_count(
+        GetIOBufTLSBlockHitCount, NULL);
+    bvar::PerSecond<bvar::PassiveStatus<int64_t> > var_iobuf_tls_block_hit_second(
+        "iobuf_tls_block_hit_second", &var_iobuf_tls_block_hit_count);
+    bvar::PassiveStatus<int64_t> var_iobuf_tls_block_miss_count(
+        GetIOBufTLSBlockMissCount, NULL);
+    bvar::PerSecond<bvar::PassiveStatus<int64_t> > var_iobuf_tls_block_miss_second(
+        "iobuf_tls_block_miss_second", &var_iobuf_tls_block_miss_count);
+    bvar::PassiveStatus<int64_t> var_iobuf_tls_block_reclaimed_count(
+        "iobuf_tls_block_reclaimed_count", GetIOBufTLSBlockReclaimedCount, NULL);
     bvar::PassiveStatus<int> var_running_server_count(
         "rpc_server_count", GetRunningServerCount, NULL);
 
@@ -258,6 +367,13 @@ static void* GlobalUpdate(void*) {
             }
         }
 
+        const int tls_cache_limit_mb =
+            FLAGS_iobuf_tls_cache_limit_mb/*reloadable*/;
+        if (tls_cache_limit_mb >= 0) {
+            butil::IOBuf::reclaim_idle_tls_block_caches(
+                (size_t)tls_cache_limit_mb * 1024 * 1024);
+        }
+
         const int return_mem_interval =
             FLAGS_free_memory_to_system_interval/*reloadable*/;
         if (return_mem_interval > 0 &&
@@ -309,6 +425,12 @@ static void GlobalInitializeOrDieImpl() {
     // values even if the gflags will be set after main().          //
     //////////////////////////////////////////////////////////////////
 
+    // Read once: the flag is documented as only effective before
+    // initialization, changing it afterwards must not have an effect.
+    const std::string enabled_list = FLAGS_enabled_protocols;
+    const int64_t init_start_us = butil::cpuwide_time_us();
+    int64_t phase_start_us = init_start_us;
+
     // Ignore SIGPIPE.
     struct sigaction oldact;
     if (sigaction(SIGPIPE, NULL, &oldact) != 0 ||
@@ -330,6 +452,8 @@ static void GlobalInitializeOrDieImpl() {
     if (SSLThreadInit() != 0 || SSLDHInit() != 0) {
         exit(1);
     }
+    RecordStartupPhase("ssl", butil::cpuwide_time_us() - phase_start_us);
+    phase_start_us = butil::cpuwide_time_us();
 
     // Defined in http_rpc_protocol.cpp
     InitCommonStrings();
@@ -356,11 +480,14 @@ static void GlobalInitializeOrDieImpl() {
     LoadBalancerExtension()->RegisterOrDie("rr", &g_ext->rr_lb);
     LoadBalancerExtension()->RegisterOrDie("wrr", &g_ext->wrr_lb);
     LoadBalancerExtension()->RegisterOrDie("random", &g_ext->randomized_lb);
+    LoadBalancerExtension()->RegisterOrDie("p2c", &g_ext->p2c_lb);
     LoadBalancerExtension()->RegisterOrDie("la", &g_ext->la_lb);
     LoadBalancerExtension()->RegisterOrDie("c_murmurhash", &g_ext->ch_mh_lb);
     LoadBalancerExtension()->RegisterOrDie("c_md5", &g_ext->ch_md5_lb);
     LoadBalancerExtension()->RegisterOrDie("c_ketama", &g_ext->ch_ketama_lb);
     LoadBalancerExtension()->RegisterOrDie("_dynpart", &g_ext->dynpart_lb);
+    RecordStartupPhase("extensions", butil::cpuwide_time_us() - phase_start_us);
+    phase_start_us = butil::cpuwide_time_us();
 
     // Compress Handlers
     const CompressHandler gzip_compress =
@@ -378,6 +505,28 @@ static void GlobalInitializeOrDieImpl() {
     if (RegisterCompressHandler(COMPRESS_TYPE_SNAPPY, snappy_compress) != 0) {
         exit(1);
     }
+    const CompressHandler snappy_framed_compress =
+        { SnappyFramedCompress, SnappyFramedDecompress, "snappy-framed" };
+    if (RegisterCompressHandler(COMPRESS_TYPE_SNAPPY_FRAMED,
+                                snappy_framed_compress) != 0) {
+        exit(1);
+    }
+#ifdef BRPC_WITH_LZ4
+    const CompressHandler lz4_compress =
+        { LZ4Compress, LZ4Decompress, "lz4" };
+    if (RegisterCompressHandler(COMPRESS_TYPE_LZ4, lz4_compress) != 0) {
+        exit(1);
+    }
+#endif
+#ifdef BRPC_WITH_ZSTD
+    const CompressHandler zstd_compress =
+        { ZstdCompress, ZstdDecompress, "zstd" };
+    if (RegisterCompressHandler(COMPRESS_TYPE_ZSTD, zstd_compress) != 0) {
+        exit(1);
+    }
+#endif
+    RecordStartupPhase("compress", butil::cpuwide_time_us() - phase_start_us);
+    phase_start_us = butil::cpuwide_time_us();
 
     // Protocols
     Protocol baidu_protocol = { ParseRpcMessage,
@@ -410,164 +559,202 @@ static void GlobalInitializeOrDieImpl() {
         exit(1);
     }
 
-    Protocol http2_protocol = { ParseH2Message,
-                                SerializeHttpRequest, PackH2Request,
-                                ProcessHttpRequest, ProcessHttpResponse,
-                                VerifyHttpRequest, ParseHttpServerAddress,
-                                GetHttpMethodName,
-                                CONNECTION_TYPE_SINGLE,
-                                "h2" };
-    if (RegisterProtocol(PROTOCOL_H2, http2_protocol) != 0) {
-        exit(1);
+// Latency-critical deployments talking baidu_std only may define
+// BRPC_BAIDU_STD_PROTOCOL_ONLY to skip registration of all the protocols
+// below, shortening startup and letting LTO prune and inline what is
+// actually used. baidu_std, streaming_rpc(which baidu_std falls back to)
+// and http(builtin services) are always registered. -enabled_protocols
+// offers the same pruning at runtime without a rebuild.
+#ifndef BRPC_BAIDU_STD_PROTOCOL_ONLY
+    if (ProtocolEnabled("h2", enabled_list)) {
+        Protocol http2_protocol = { ParseH2Message,
+                                    SerializeHttpRequest, PackH2Request,
+                                    ProcessHttpRequest, ProcessHttpResponse,
+                                    VerifyHttpRequest, ParseHttpServerAddress,
+                                    GetHttpMethodName,
+                                    CONNECTION_TYPE_SINGLE,
+                                    "h2" };
+        if (RegisterProtocol(PROTOCOL_H2, http2_protocol) != 0) {
+            exit(1);
+        }
     }
 
-    Protocol hulu_protocol = { ParseHuluMessage,
-                               SerializeRequestDefault, PackHuluRequest,
-                               ProcessHuluRequest, ProcessHuluResponse,
-                               VerifyHuluRequest, NULL, NULL,
-                               CONNECTION_TYPE_ALL, "hulu_pbrpc" };
-    if (RegisterProtocol(PROTOCOL_HULU_PBRPC, hulu_protocol) != 0) {
-        exit(1);
+    if (ProtocolEnabled("hulu_pbrpc", enabled_list)) {
+        Protocol hulu_protocol = { ParseHuluMessage,
+                                   SerializeRequestDefault, PackHuluRequest,
+                                   ProcessHuluRequest, ProcessHuluResponse,
+                                   VerifyHuluRequest, NULL, NULL,
+                                   CONNECTION_TYPE_ALL, "hulu_pbrpc" };
+        if (RegisterProtocol(PROTOCOL_HULU_PBRPC, hulu_protocol) != 0) {
+            exit(1);
+        }
     }
 
-    // Only valid at client side
-    Protocol nova_protocol = { ParseNsheadMessage,
-                               SerializeNovaRequest, PackNovaRequest,
-                               NULL, ProcessNovaResponse,
-                               NULL, NULL, NULL,
-                               CONNECTION_TYPE_POOLED_AND_SHORT,  "nova_pbrpc" };
-    if (RegisterProtocol(PROTOCOL_NOVA_PBRPC, nova_protocol) != 0) {
-        exit(1);
+    if (ProtocolEnabled("nova_pbrpc", enabled_list)) {
+        // Only valid at client side
+        Protocol nova_protocol = { ParseNsheadMessage,
+                                   SerializeNovaRequest, PackNovaRequest,
+                                   NULL, ProcessNovaResponse,
+                                   NULL, NULL, NULL,
+                                   CONNECTION_TYPE_POOLED_AND_SHORT,  "nova_pbrpc" };
+        if (RegisterProtocol(PROTOCOL_NOVA_PBRPC, nova_protocol) != 0) {
+            exit(1);
+        }
     }
 
-    // Only valid at client side
-    Protocol public_pbrpc_protocol = { ParseNsheadMessage,
-                                       SerializePublicPbrpcRequest,
-                                       PackPublicPbrpcRequest,
-                                       NULL, ProcessPublicPbrpcResponse,
-                                       NULL, NULL, NULL,
-                                       // public_pbrpc server implementation
-                                       // doesn't support full duplex
-                                       CONNECTION_TYPE_POOLED_AND_SHORT,
-                                       "public_pbrpc" };
-    if (RegisterProtocol(PROTOCOL_PUBLIC_PBRPC, public_pbrpc_protocol) != 0) {
-        exit(1);
+    if (ProtocolEnabled("public_pbrpc", enabled_list)) {
+        // Only valid at client side
+        Protocol public_pbrpc_protocol = { ParseNsheadMessage,
+                                           SerializePublicPbrpcRequest,
+                                           PackPublicPbrpcRequest,
+                                           NULL, ProcessPublicPbrpcResponse,
+                                           NULL, NULL, NULL,
+                                           // public_pbrpc server implementation
+                                           // doesn't support full duplex
+                                           CONNECTION_TYPE_POOLED_AND_SHORT,
+                                           "public_pbrpc" };
+        if (RegisterProtocol(PROTOCOL_PUBLIC_PBRPC, public_pbrpc_protocol) != 0) {
+            exit(1);
+        }
     }
 
-    Protocol sofa_protocol = { ParseSofaMessage,
-                               SerializeRequestDefault, PackSofaRequest,
-                               ProcessSofaRequest, ProcessSofaResponse,
-                               VerifySofaRequest, NULL, NULL,
-                               CONNECTION_TYPE_ALL, "sofa_pbrpc" };
-    if (RegisterProtocol(PROTOCOL_SOFA_PBRPC, sofa_protocol) != 0) {
-        exit(1);
+    if (ProtocolEnabled("sofa_pbrpc", enabled_list)) {
+        Protocol sofa_protocol = { ParseSofaMessage,
+                                   SerializeRequestDefault, PackSofaRequest,
+                                   ProcessSofaRequest, ProcessSofaResponse,
+                                   VerifySofaRequest, NULL, NULL,
+                                   CONNECTION_TYPE_ALL, "sofa_pbrpc" };
+        if (RegisterProtocol(PROTOCOL_SOFA_PBRPC, sofa_protocol) != 0) {
+            exit(1);
+        }
     }
 
-    // Only valid at server side. We generalize all the protocols that
-    // prefixes with nshead as `nshead_protocol' and specify the content
-    // parsing after nshead by ServerOptions.nshead_service.
-    Protocol nshead_protocol = { ParseNsheadMessage,
-                                 SerializeNsheadRequest, PackNsheadRequest,
-                                 ProcessNsheadRequest, ProcessNsheadResponse,
-                                 VerifyNsheadRequest, NULL, NULL,
-                                 CONNECTION_TYPE_POOLED_AND_SHORT, "nshead" };
-    if (RegisterProtocol(PROTOCOL_NSHEAD, nshead_protocol) != 0) {
-        exit(1);
+    if (ProtocolEnabled("nshead", enabled_list)) {
+        // Only valid at server side. We generalize all the protocols that
+        // prefixes with nshead as `nshead_protocol' and specify the content
+        // parsing after nshead by ServerOptions.nshead_service.
+        Protocol nshead_protocol = { ParseNsheadMessage,
+                                     SerializeNsheadRequest, PackNsheadRequest,
+                                     ProcessNsheadRequest, ProcessNsheadResponse,
+                                     VerifyNsheadRequest, NULL, NULL,
+                                     CONNECTION_TYPE_POOLED_AND_SHORT, "nshead" };
+        if (RegisterProtocol(PROTOCOL_NSHEAD, nshead_protocol) != 0) {
+            exit(1);
+        }
     }
 
-    Protocol mc_binary_protocol = { ParseMemcacheMessage,
-                                    SerializeMemcacheRequest,
-                                    PackMemcacheRequest,
-                                    NULL, ProcessMemcacheResponse,
-                                    NULL, NULL, GetMemcacheMethodName,
-                                    CONNECTION_TYPE_ALL, "memcache" };
-    if (RegisterProtocol(PROTOCOL_MEMCACHE, mc_binary_protocol) != 0) {
-        exit(1);
+    if (ProtocolEnabled("memcache", enabled_list)) {
+        Protocol mc_binary_protocol = { ParseMemcacheMessage,
+                                        SerializeMemcacheRequest,
+                                        PackMemcacheRequest,
+                                        NULL, ProcessMemcacheResponse,
+                                        NULL, NULL, GetMemcacheMethodName,
+                                        CONNECTION_TYPE_ALL, "memcache" };
+        if (RegisterProtocol(PROTOCOL_MEMCACHE, mc_binary_protocol) != 0) {
+            exit(1);
+        }
     }
 
-    Protocol redis_protocol = { ParseRedisMessage,
-                                SerializeRedisRequest,
-                                PackRedisRequest,
-                                ProcessRedisRequest, ProcessRedisResponse,
-                                NULL, NULL, GetRedisMethodName,
-                                CONNECTION_TYPE_ALL, "redis" };
-    if (RegisterProtocol(PROTOCOL_REDIS, redis_protocol) != 0) {
-        exit(1);
+    if (ProtocolEnabled("redis", enabled_list)) {
+        Protocol redis_protocol = { ParseRedisMessage,
+                                    SerializeRedisRequest,
+                                    PackRedisRequest,
+                                    ProcessRedisRequest, ProcessRedisResponse,
+                                    NULL, NULL, GetRedisMethodName,
+                                    CONNECTION_TYPE_ALL, "redis" };
+        if (RegisterProtocol(PROTOCOL_REDIS, redis_protocol) != 0) {
+            exit(1);
+        }
     }
 
-    Protocol mongo_protocol = { ParseMongoMessage,
-                                NULL, NULL,
-                                ProcessMongoRequest, NULL,
-                                NULL, NULL, NULL,
-                                CONNECTION_TYPE_POOLED, "mongo" };
-    if (RegisterProtocol(PROTOCOL_MONGO, mongo_protocol) != 0) {
-        exit(1);
+    if (ProtocolEnabled("mongo", enabled_list)) {
+        Protocol mongo_protocol = { ParseMongoMessage,
+                                    NULL, NULL,
+                                    ProcessMongoRequest, NULL,
+                                    NULL, NULL, NULL,
+                                    CONNECTION_TYPE_POOLED, "mongo" };
+        if (RegisterProtocol(PROTOCOL_MONGO, mongo_protocol) != 0) {
+            exit(1);
+        }
     }
 
 // Use Macro is more straight forward than weak link technology(becasue of static link issue)
 #ifdef ENABLE_THRIFT_FRAMED_PROTOCOL
-    Protocol thrift_binary_protocol = {
-        policy::ParseThriftMessage,
-        policy::SerializeThriftRequest, policy::PackThriftRequest,
-        policy::ProcessThriftRequest, policy::ProcessThriftResponse,
-        policy::VerifyThriftRequest, NULL, NULL,
-        CONNECTION_TYPE_POOLED_AND_SHORT, "thrift" };
-    if (RegisterProtocol(PROTOCOL_THRIFT, thrift_binary_protocol) != 0) {
-        exit(1);
+    if (ProtocolEnabled("thrift", enabled_list)) {
+        Protocol thrift_binary_protocol = {
+            policy::ParseThriftMessage,
+            policy::SerializeThriftRequest, policy::PackThriftRequest,
+            policy::ProcessThriftRequest, policy::ProcessThriftResponse,
+            policy::VerifyThriftRequest, NULL, NULL,
+            CONNECTION_TYPE_POOLED_AND_SHORT, "thrift" };
+        if (RegisterProtocol(PROTOCOL_THRIFT, thrift_binary_protocol) != 0) {
+            exit(1);
+        }
     }
 #endif
 
-    // Only valid at client side
-    Protocol ubrpc_compack_protocol = {
-        ParseNsheadMessage,
-        SerializeUbrpcCompackRequest, PackUbrpcRequest,
-        NULL, ProcessUbrpcResponse,
-        NULL, NULL, NULL,
-        CONNECTION_TYPE_POOLED_AND_SHORT,  "ubrpc_compack" };
-    if (RegisterProtocol(PROTOCOL_UBRPC_COMPACK, ubrpc_compack_protocol) != 0) {
-        exit(1);
+    if (ProtocolEnabled("ubrpc_compack", enabled_list)) {
+        // Only valid at client side
+        Protocol ubrpc_compack_protocol = {
+            ParseNsheadMessage,
+            SerializeUbrpcCompackRequest, PackUbrpcRequest,
+            NULL, ProcessUbrpcResponse,
+            NULL, NULL, NULL,
+            CONNECTION_TYPE_POOLED_AND_SHORT,  "ubrpc_compack" };
+        if (RegisterProtocol(PROTOCOL_UBRPC_COMPACK, ubrpc_compack_protocol) != 0) {
+            exit(1);
+        }
     }
-    Protocol ubrpc_mcpack2_protocol = {
-        ParseNsheadMessage,
-        SerializeUbrpcMcpack2Request, PackUbrpcRequest,
-        NULL, ProcessUbrpcResponse,
-        NULL, NULL, NULL,
-        CONNECTION_TYPE_POOLED_AND_SHORT,  "ubrpc_mcpack2" };
-    if (RegisterProtocol(PROTOCOL_UBRPC_MCPACK2, ubrpc_mcpack2_protocol) != 0) {
-        exit(1);
+    if (ProtocolEnabled("ubrpc_mcpack2", enabled_list)) {
+        Protocol ubrpc_mcpack2_protocol = {
+            ParseNsheadMessage,
+            SerializeUbrpcMcpack2Request, PackUbrpcRequest,
+            NULL, ProcessUbrpcResponse,
+            NULL, NULL, NULL,
+            CONNECTION_TYPE_POOLED_AND_SHORT,  "ubrpc_mcpack2" };
+        if (RegisterProtocol(PROTOCOL_UBRPC_MCPACK2, ubrpc_mcpack2_protocol) != 0) {
+            exit(1);
+        }
     }
 
-    // Only valid at client side
-    Protocol nshead_mcpack_protocol = {
-        ParseNsheadMessage,
-        SerializeNsheadMcpackRequest, PackNsheadMcpackRequest,
-        NULL, ProcessNsheadMcpackResponse,
-        NULL, NULL, NULL,
-        CONNECTION_TYPE_POOLED_AND_SHORT,  "nshead_mcpack" };
-    if (RegisterProtocol(PROTOCOL_NSHEAD_MCPACK, nshead_mcpack_protocol) != 0) {
-        exit(1);
+    if (ProtocolEnabled("nshead_mcpack", enabled_list)) {
+        // Only valid at client side
+        Protocol nshead_mcpack_protocol = {
+            ParseNsheadMessage,
+            SerializeNsheadMcpackRequest, PackNsheadMcpackRequest,
+            NULL, ProcessNsheadMcpackResponse,
+            NULL, NULL, NULL,
+            CONNECTION_TYPE_POOLED_AND_SHORT,  "nshead_mcpack" };
+        if (RegisterProtocol(PROTOCOL_NSHEAD_MCPACK, nshead_mcpack_protocol) != 0) {
+            exit(1);
+        }
     }
 
-    Protocol rtmp_protocol = {
-        ParseRtmpMessage,
-        SerializeRtmpRequest, PackRtmpRequest,
-        ProcessRtmpMessage, ProcessRtmpMessage,
-        NULL, NULL, NULL,
-        (ConnectionType)(CONNECTION_TYPE_SINGLE|CONNECTION_TYPE_SHORT),
-        "rtmp" };
-    if (RegisterProtocol(PROTOCOL_RTMP, rtmp_protocol) != 0) {
-        exit(1);
+    if (ProtocolEnabled("rtmp", enabled_list)) {
+        Protocol rtmp_protocol = {
+            ParseRtmpMessage,
+            SerializeRtmpRequest, PackRtmpRequest,
+            ProcessRtmpMessage, ProcessRtmpMessage,
+            NULL, NULL, NULL,
+            (ConnectionType)(CONNECTION_TYPE_SINGLE|CONNECTION_TYPE_SHORT),
+            "rtmp" };
+        if (RegisterProtocol(PROTOCOL_RTMP, rtmp_protocol) != 0) {
+            exit(1);
+        }
     }
 
-    Protocol esp_protocol = {
-        ParseEspMessage,
-        SerializeEspRequest, PackEspRequest,
-        NULL, ProcessEspResponse,
-        NULL, NULL, NULL,
-        CONNECTION_TYPE_POOLED_AND_SHORT, "esp"};
-    if (RegisterProtocol(PROTOCOL_ESP, esp_protocol) != 0) {
-        exit(1);
+    if (ProtocolEnabled("esp", enabled_list)) {
+        Protocol esp_protocol = {
+            ParseEspMessage,
+            SerializeEspRequest, PackEspRequest,
+            NULL, ProcessEspResponse,
+            NULL, NULL, NULL,
+            CONNECTION_TYPE_POOLED_AND_SHORT, "esp"};
+        if (RegisterProtocol(PROTOCOL_ESP, esp_protocol) != 0) {
+            exit(1);
+        }
     }
+#endif  // BRPC_BAIDU_STD_PROTOCOL_ONLY
 
     std::vector<Protocol> protocols;
     ListProtocols(&protocols);
@@ -586,9 +773,11 @@ static void GlobalInitializeOrDieImpl() {
             }
         }
     }
+    RecordStartupPhase("protocols", butil::cpuwide_time_us() - phase_start_us);
 
     // Concurrency Limiters
     ConcurrencyLimiterExtension()->RegisterOrDie("auto", &g_ext->auto_cl);
+    ConcurrencyLimiterExtension()->RegisterOrDie("gradient", &g_ext->gradient_cl);
     ConcurrencyLimiterExtension()->RegisterOrDie("constant", &g_ext->constant_cl);
     
     if (FLAGS_usercode_in_pthread) {
@@ -603,6 +792,9 @@ static void GlobalInitializeOrDieImpl() {
     bthread_t th;
     CHECK(bthread_start_background(&th, NULL, GlobalUpdate, NULL) == 0)
         << "Fail to start GlobalUpdate";
+
+    RecordStartupPhase("global_init",
+                       butil::cpuwide_time_us() - init_start_us);
 }
 
 void GlobalInitializeOrDie() {
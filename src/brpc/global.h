@@ -19,6 +19,8 @@
 #ifndef BRPC_GLOBAL_H
 #define BRPC_GLOBAL_H
 
+#include <stdint.h>
+
 
 namespace brpc {
 
@@ -26,6 +28,11 @@ namespace brpc {
 // `brpc/policy/' directory
 void GlobalInitializeOrDie();
 
+// Record that a named phase of process/server initialization took
+// `time_us' microseconds. All recorded phases are shown by the bvar
+// `rpc_startup_phases' so that init cost is trackable per release.
+void RecordStartupPhase(const char* name, int64_t time_us);
+
 } // namespace brpc
 
 
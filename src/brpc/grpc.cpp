@@ -23,6 +23,7 @@
 #include "brpc/errno.pb.h"
 #include "brpc/http_status_code.h"
 #include "butil/logging.h"
+#include "butil/sys_byteorder.h"
 
 namespace brpc {
 
@@ -205,4 +206,39 @@ int64_t ConvertGrpcTimeoutToUS(const std::string* grpc_timeout) {
     CHECK(false) << "Impossible";
 }
 
+int ParseGrpcMessage(butil::IOBufBytesIterator& it, GrpcMessage* out) {
+    char prefix[5];
+    if (it.copy_and_forward(prefix, sizeof(prefix)) != sizeof(prefix)) {
+        return -1;  // truncated prefix
+    }
+    if (prefix[0] != 0 && prefix[0] != 1) {
+        return -1;  // reserved values of the compressed flag
+    }
+    uint32_t message_length;  // big-endian on wire
+    memcpy(&message_length, prefix + 1, sizeof(message_length));
+    message_length = butil::NetToHost32(message_length);
+    if (message_length > it.bytes_left()) {
+        return -1;  // truncated message
+    }
+    out->compressed = prefix[0];
+    out->data.clear();
+    it.append_and_forward(&out->data, message_length);
+    return 0;
+}
+
+ssize_t ParseGrpcMessages(const butil::IOBuf& body,
+                          std::vector<GrpcMessage>* out) {
+    ssize_t nmsg = 0;
+    butil::IOBufBytesIterator it(body);
+    while (it.bytes_left() > 0) {
+        out->resize(out->size() + 1);
+        if (ParseGrpcMessage(it, &out->back()) != 0) {
+            out->pop_back();
+            return -1;
+        }
+        ++nmsg;
+    }
+    return nmsg;
+}
+
 } // namespace brpc
@@ -20,7 +20,9 @@
 #define BRPC_GRPC_H
 
 #include <map>
+#include <vector>
 #include <brpc/http2.h>
+#include "butil/iobuf.h"
 
 namespace brpc {
 
@@ -155,6 +157,28 @@ void PercentEncode(const std::string& str, std::string* str_out);
 
 void PercentDecode(const std::string& str, std::string* str_out);
 
+// One length-prefixed gRPC message sliced out of a larger buffer.
+// `data' references blocks of the source buffer instead of copying them.
+struct GrpcMessage {
+    GrpcMessage() : compressed(false) {}
+    butil::IOBuf data;
+    bool compressed;
+};
+
+// Validate the 5-byte prefix at `it' and slice the message it describes
+// into `out', forwarding the iterator past the message. Returns 0 on
+// success, -1 when the prefix is malformed(reserved compression value)
+// or the message is truncated.
+int ParseGrpcMessage(butil::IOBufBytesIterator& it, GrpcMessage* out);
+
+// Walk `body' once, validating every message prefix, and append one
+// slice per message to `out' for batched dispatch, instead of cutting
+// prefixes message by message which walks the buffer repeatedly.
+// Returns the number of appended messages, or -1 when any prefix is
+// malformed or a message is truncated(`out' may hold leading intact
+// messages then).
+ssize_t ParseGrpcMessages(const butil::IOBuf& body,
+                          std::vector<GrpcMessage>* out);
 
 } // namespace brpc
 
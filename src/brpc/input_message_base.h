@@ -47,8 +47,12 @@ public:
     // [Internal]
     int64_t received_us() const { return _received_us; }
     int64_t base_real_us() const { return _base_real_us; }
+    // Time that the last packet of this message entered the kernel,
+    // 0 when unavailable. See -rpcz_kernel_rx_timestamp.
+    int64_t kernel_received_real_us() const { return _kernel_received_real_us; }
 
 protected:
+    InputMessageBase() : _kernel_received_real_us(0) {}
     virtual ~InputMessageBase();
 
 private:
@@ -57,6 +61,7 @@ friend void* ProcessInputMessage(void*);
 friend class Stream;
     int64_t _received_us;
     int64_t _base_real_us;
+    int64_t _kernel_received_real_us;
     SocketUniquePtr _socket;
     void (*_process)(InputMessageBase* msg);
     const void* _arg;
@@ -17,16 +17,26 @@
 
 
 #include <gflags/gflags.h>
+#include "butil/build_config.h"                  // OS_LINUX
+#if defined(OS_LINUX)
+#include <sys/ioctl.h>                           // ioctl
+#include <linux/sockios.h>                       // SIOCGSTAMPNS
+#endif
 #include "butil/fd_guard.h"                      // fd_guard
 #include "butil/logging.h"                       // CHECK
 #include "butil/time.h"                          // cpuwide_time_us
 #include "butil/fd_utility.h"                    // make_non_blocking
+#include "butil/containers/flat_map.h"           // FlatMap
+#include "butil/memory/singleton_on_pthread_once.h" // get_leaky_singleton
 #include "bthread/bthread.h"                     // bthread_start_background
 #include "bthread/unstable.h"                   // bthread_flush
 #include "bvar/bvar.h"                          // bvar::Adder
 #include "brpc/options.pb.h"               // ProtocolType
 #include "brpc/reloadable_flags.h"         // BRPC_VALIDATE_GFLAG
 #include "brpc/protocol.h"                 // ListProtocols
+#ifdef BRPC_BAIDU_STD_PROTOCOL_ONLY
+#include "brpc/policy/baidu_rpc_protocol.h" // ParseRpcMessage
+#endif
 #include "brpc/input_messenger.h"
 
 
@@ -52,23 +62,134 @@ DEFINE_bool(log_connection_close, false,
             "Print log when remote side closes the connection");
 BRPC_VALIDATE_GFLAG(log_connection_close, PassValidate);
 
+DEFINE_bool(cache_protocol_of_remote_side, false,
+            "Remember the protocol detected on a connection and use it as the"
+            " initial guess when the same remote side connects again, so that"
+            " reconnections of long-lived peers skip protocol detection");
+BRPC_VALIDATE_GFLAG(cache_protocol_of_remote_side, PassValidate);
+
+DEFINE_bool(batch_process_input_messages, false,
+            "Process all messages parsed from one read event in a single"
+            " bthread instead of starting one bthread per message. Cuts"
+            " scheduling cost on connections with many small messages at"
+            " the price of less parallelism between them");
+BRPC_VALIDATE_GFLAG(batch_process_input_messages, PassValidate);
+
+DEFINE_bool(connection_affinity, false,
+            "Queue the bthreads processing messages of one connection to the"
+            " bthread worker hashed from its SocketId, trading work stealing"
+            " for cache locality of per-connection state(parsing context,"
+            " SSL state). Best-effort: saturated workers are still stolen"
+            " from. Useful for TLS-heavy or few-but-fat connections");
+BRPC_VALIDATE_GFLAG(connection_affinity, PassValidate);
+
+DEFINE_bool(rpcz_kernel_rx_timestamp, false,
+            "Attach the kernel receiving time of the last packet(read with"
+            " SIOCGSTAMPNS) to in-coming messages so that /rpcz separates"
+            " network/kernel queueing from application time. Costs an extra"
+            " ioctl per read when on. Linux only");
+BRPC_VALIDATE_GFLAG(rpcz_kernel_rx_timestamp, PassValidate);
+
+DEFINE_int64(socket_max_unconsumed_bytes, 0,
+             "Max bytes read from one connection but not consumed by protocol"
+             " parsing yet(huge or trickled messages). A connection exceeding"
+             " the limit is closed with EOVERCROWDED instead of buffering the"
+             " message fully. <=0 means unlimited");
+BRPC_VALIDATE_GFLAG(socket_max_unconsumed_bytes, PassValidate);
+
+DEFINE_int64(max_total_unconsumed_bytes, 0,
+             "Max unconsumed inbound bytes summed over all connections. When"
+             " the limit is reached, connections holding unconsumed data that"
+             " try to read more are closed with EOVERCROWDED, protecting the"
+             " process from being OOMed by a few huge messages. <=0 means"
+             " unlimited");
+BRPC_VALIDATE_GFLAG(max_total_unconsumed_bytes, PassValidate);
+
+// 0 is `no affinity' for bthread_attr_t.affinity, avoid it.
+static inline unsigned ConnectionAffinity(SocketId id) {
+    const unsigned a = (unsigned)id;
+    return a ? a : 1;
+}
+
 DECLARE_bool(usercode_in_pthread);
 DECLARE_uint64(max_body_size);
 
 const size_t MSG_SIZE_WINDOW = 10;  // Take last so many message into stat.
+const size_t READ_SIZE_WINDOW = 8;  // Take last so many reads into stat.
 const size_t MIN_ONCE_READ = 4096;
 const size_t MAX_ONCE_READ = 524288;
 
+// Bytes returned per read syscall over all sockets, for verifying that
+// the adaptive size hint actually reduces the number of syscalls.
+static bvar::IntRecorder g_bytes_per_read("socket_bytes_per_read");
+
+// Connections closed with EOVERCROWDED by the inbound buffer caps above,
+// shown at /overload.
+static bvar::Adder<int64_t> g_inbound_memory_drops("rpc_inbound_memory_drops");
+
+// Map remote side to the protocol(index) selected on previous connections
+// so that a reconnected peer starts from the right protocol directly.
+// A stale or wrong hint only costs one extra Parse since CutInputMessage
+// falls back to trying other protocols on PARSE_ERROR_TRY_OTHERS.
+class ProtocolHintMap {
+public:
+    ProtocolHintMap() {
+        CHECK_EQ(0, _map.init(MAP_SIZE * 2));
+    }
+
+    // Returns -1 when the remote side was never seen.
+    int Get(const butil::EndPoint& remote_side) {
+        BAIDU_SCOPED_LOCK(_mutex);
+        const int* index = _map.seek(remote_side);
+        return index ? *index : -1;
+    }
+
+    void Set(const butil::EndPoint& remote_side, int index) {
+        BAIDU_SCOPED_LOCK(_mutex);
+        if (_map.seek(remote_side) == NULL && _map.size() >= MAP_SIZE) {
+            // Full. Losing hints of new peers is acceptable, they just
+            // go through the detection as before.
+            return;
+        }
+        _map[remote_side] = index;
+    }
+
+private:
+    static const size_t MAP_SIZE = 4096;
+    butil::Mutex _mutex;
+    butil::FlatMap<butil::EndPoint, int,
+                   butil::DefaultHasher<butil::EndPoint> > _map;
+};
+
+static ProtocolHintMap* get_protocol_hint_map() {
+    return butil::get_leaky_singleton<ProtocolHintMap>();
+}
+
 ParseResult InputMessenger::CutInputMessage(
         Socket* m, size_t* index, bool read_eof) {
-    const int preferred = m->preferred_index();
+    int preferred = m->preferred_index();
+    if (preferred < 0 && FLAGS_cache_protocol_of_remote_side) {
+        preferred = get_protocol_hint_map()->Get(m->remote_side());
+        if (preferred >= 0) {
+            m->set_preferred_index(preferred);
+        }
+    }
     const int max_index = (int)_max_index.load(butil::memory_order_acquire);
     // Try preferred handler first. The preferred_index is set on last
     // selection or by client.
     if (preferred >= 0 && preferred <= max_index
             && _handlers[preferred].parse != NULL) {
         ParseResult result =
-            _handlers[preferred].parse(&m->_read_buf, m, read_eof, _handlers[preferred].arg);
+#ifdef BRPC_BAIDU_STD_PROTOCOL_ONLY
+            // Statically bind the parser of the only wire protocol so
+            // that the compiler(or LTO) can inline it into the read loop
+            // instead of calling through the pointer in _handlers.
+            (preferred == PROTOCOL_BAIDU_STD)
+            ? policy::ParseRpcMessage(&m->_read_buf, m, read_eof,
+                                      _handlers[preferred].arg) :
+#endif
+            _handlers[preferred].parse(&m->_read_buf, m, read_eof,
+                                       _handlers[preferred].arg);
         if (result.is_ok() ||
             result.error() == PARSE_ERROR_NOT_ENOUGH_DATA) {
             *index = preferred;
@@ -108,6 +229,9 @@ ParseResult InputMessenger::CutInputMessage(
         if (result.is_ok() ||
             result.error() == PARSE_ERROR_NOT_ENOUGH_DATA) {
             m->set_preferred_index(i);
+            if (FLAGS_cache_protocol_of_remote_side) {
+                get_protocol_hint_map()->Set(m->remote_side(), i);
+            }
             *index = i;
             return result;
         } else if (result.error() != PARSE_ERROR_TRY_OTHERS) {
@@ -136,6 +260,16 @@ void* ProcessInputMessage(void* void_arg) {
     return NULL;
 }
 
+static void* ProcessInputMessageBatch(void* void_arg) {
+    std::vector<InputMessageBase*>* msgs =
+        static_cast<std::vector<InputMessageBase*>*>(void_arg);
+    for (size_t i = 0; i < msgs->size(); ++i) {
+        ProcessInputMessage((*msgs)[i]);
+    }
+    delete msgs;
+    return NULL;
+}
+
 struct RunLastMessage {
     inline void operator()(InputMessageBase* last_msg) {
         ProcessInputMessage(last_msg);
@@ -157,6 +291,9 @@ static void QueueMessage(InputMessageBase* to_run_msg,
                           BTHREAD_ATTR_PTHREAD :
                           BTHREAD_ATTR_NORMAL) | BTHREAD_NOSIGNAL;
     tmp.keytable_pool = keytable_pool;
+    if (FLAGS_connection_affinity) {
+        tmp.affinity = ConnectionAffinity(to_run_msg->socket()->id());
+    }
     if (bthread_start_background(
             &th, &tmp, ProcessInputMessage, to_run_msg) == 0) {
         ++*num_bthread_created;
@@ -165,6 +302,58 @@ static void QueueMessage(InputMessageBase* to_run_msg,
     }
 }
 
+// Collect messages parsed from one read event and process them in a single
+// bthread instead of one bthread each, saving creation and wake-up cost
+// for connections carrying many small messages. Messages of one batch are
+// processed sequentially in parsing order which keeps the per-connection
+// ordering that separate-but-sequentially-started bthreads provided.
+class InputMessageBatcher {
+public:
+    InputMessageBatcher() : _keytable_pool(NULL) {}
+    ~InputMessageBatcher() { Flush(); }
+
+    void Add(InputMessageBase* msg, bthread_keytable_pool_t* keytable_pool) {
+        if (msg) {
+            _msgs.push_back(msg);
+            _keytable_pool = keytable_pool;
+        }
+    }
+
+    void Flush() {
+        if (_msgs.empty()) {
+            return;
+        }
+        if (_msgs.size() == 1u) {
+            InputMessageBase* msg = _msgs[0];
+            _msgs.clear();
+            int num_bthread_created = 0;
+            QueueMessage(msg, &num_bthread_created, _keytable_pool);
+            if (num_bthread_created) {
+                bthread_flush();
+            }
+            return;
+        }
+        std::vector<InputMessageBase*>* batch =
+            new std::vector<InputMessageBase*>;
+        batch->swap(_msgs);
+        bthread_t th;
+        bthread_attr_t tmp = (FLAGS_usercode_in_pthread ?
+                              BTHREAD_ATTR_PTHREAD : BTHREAD_ATTR_NORMAL);
+        tmp.keytable_pool = _keytable_pool;
+        if (FLAGS_connection_affinity) {
+            tmp.affinity = ConnectionAffinity((*batch)[0]->socket()->id());
+        }
+        if (bthread_start_background(
+                &th, &tmp, ProcessInputMessageBatch, batch) != 0) {
+            ProcessInputMessageBatch(batch);
+        }
+    }
+
+private:
+    std::vector<InputMessageBase*> _msgs;
+    bthread_keytable_pool_t* _keytable_pool;
+};
+
 void InputMessenger::OnNewMessages(Socket* m) {
     // Notes:
     // - If the socket has only one message, the message will be parsed and
@@ -184,19 +373,51 @@ void InputMessenger::OnNewMessages(Socket* m) {
     // message, even if the socket is about to be closed. This should be
     // OK in most cases.
     std::unique_ptr<InputMessageBase, RunLastMessage> last_msg;
+    InputMessageBatcher batcher;  // flushes on destruction
     bool read_eof = false;
     while (!read_eof) {
         const int64_t received_us = butil::cpuwide_time_us();
         const int64_t base_realtime = butil::gettimeofday_us() - received_us;
 
-        // Calculate bytes to be read.
-        size_t once_read = m->_avg_msg_size * 16;
+        // Calculate bytes to be read from the estimation of bytes-per-read,
+        // with 2x headroom so that a burst moderately larger than the
+        // average is still taken in one syscall.
+        size_t once_read = m->_avg_read_size * 2;
         if (once_read < MIN_ONCE_READ) {
             once_read = MIN_ONCE_READ;
         } else if (once_read > MAX_ONCE_READ) {
             once_read = MAX_ONCE_READ;
         }
 
+        // Enforce inbound buffer quotas before reading more: unconsumed
+        // data only grows until a complete message is cut, so a client
+        // whose buffer already exceeds the caps can never be parsed
+        // within them and is closed instead of buffered further.
+        if (FLAGS_socket_max_unconsumed_bytes > 0 &&
+            (int64_t)m->_read_buf.length() >=
+            FLAGS_socket_max_unconsumed_bytes) {
+            m->SetFailed(EOVERCROWDED, "Close %s: %" PRIu64 " unconsumed"
+                         " bytes exceed -socket_max_unconsumed_bytes",
+                         m->description().c_str(),
+                         (uint64_t)m->_read_buf.length());
+            g_inbound_memory_drops << 1;
+            return;
+        }
+        if (FLAGS_max_total_unconsumed_bytes > 0 &&
+            !m->_read_buf.empty() &&
+            Socket::TotalUnconsumedInBytes() >=
+            FLAGS_max_total_unconsumed_bytes) {
+            // Only connections actually holding unconsumed data are
+            // closed, ones with cleanly parsed buffers keep serving.
+            m->SetFailed(EOVERCROWDED, "Close %s holding %" PRIu64
+                         " unconsumed bytes: total unconsumed bytes exceed"
+                         " -max_total_unconsumed_bytes",
+                         m->description().c_str(),
+                         (uint64_t)m->_read_buf.length());
+            g_inbound_memory_drops << 1;
+            return;
+        }
+
         // Read.
         const ssize_t nr = m->DoRead(once_read);
         if (nr <= 0) {
@@ -223,6 +444,34 @@ void InputMessenger::OnNewMessages(Socket* m) {
         }
         
         m->AddInputBytes(nr);
+        if (nr > 0) {
+            g_bytes_per_read << nr;
+            // Update the estimation of bytes-per-read. Grow immediately when
+            // the hint was filled up since the socket likely has more data
+            // pending, otherwise converge by EWMA so that one small read
+            // does not shrink the hint sharply.
+            if ((size_t)nr >= once_read) {
+                m->_avg_read_size = std::min(once_read * 2, MAX_ONCE_READ);
+            } else {
+                m->_avg_read_size =
+                    (m->_avg_read_size * (READ_SIZE_WINDOW - 1) + nr)
+                    / READ_SIZE_WINDOW;
+            }
+        }
+
+        // Kernel receiving time of the last packet taken in by this read.
+        // Messages cut below carry the timestamp so that rpcz attributes
+        // the gap before `received_us' to the network/kernel instead of
+        // the application.
+        int64_t kernel_rx_real_us = 0;
+#if defined(OS_LINUX)
+        if (nr > 0 && FLAGS_rpcz_kernel_rx_timestamp) {
+            struct timespec ts;
+            if (ioctl(m->fd(), SIOCGSTAMPNS, &ts) == 0) {
+                kernel_rx_real_us = ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+            }
+        }
+#endif
 
         // Avoid this socket to be closed due to idle_timeout_s
         m->_last_readtime_us.store(received_us, butil::memory_order_relaxed);
@@ -280,12 +529,17 @@ void InputMessenger::OnNewMessages(Socket* m) {
             }
             pr.message()->_received_us = received_us;
             pr.message()->_base_real_us = base_realtime;
+            pr.message()->_kernel_received_real_us = kernel_rx_real_us;
                         
             // This unique_ptr prevents msg to be lost before transfering
             // ownership to last_msg
             DestroyingPtr<InputMessageBase> msg(pr.message());
-            QueueMessage(last_msg.release(), &num_bthread_created,
+            if (FLAGS_batch_process_input_messages) {
+                batcher.Add(last_msg.release(), m->_keytable_pool);
+            } else {
+                QueueMessage(last_msg.release(), &num_bthread_created,
                              m->_keytable_pool);
+            }
             if (handlers[index].process == NULL) {
                 LOG(ERROR) << "process of index=" << index << " is NULL";
                 continue;
@@ -324,9 +578,13 @@ void InputMessenger::OnNewMessages(Socket* m) {
                 num_bthread_created = 0;
             }
         }
+        m->SyncUnconsumedInBytes();
         if (num_bthread_created) {
             bthread_flush();
         }
+        // Dispatch the batch of this read event, if any. Delaying it to
+        // the next event would add unbounded latency on idle connections.
+        batcher.Flush();
     }
 
     if (read_eof) {
@@ -17,6 +17,9 @@
 
 
 #include <gflags/gflags.h>
+#include "butil/fast_rand.h"
+#include "butil/time.h"
+#include "brpc/socket.h"
 #include "brpc/reloadable_flags.h"
 #include "brpc/load_balancer.h"
 
@@ -26,6 +29,19 @@ namespace brpc {
 DEFINE_bool(show_lb_in_vars, false, "Describe LoadBalancers in vars");
 BRPC_VALIDATE_GFLAG(show_lb_in_vars, PassValidate);
 
+DEFINE_int32(lb_slow_start_window_s, 0,
+             "When positive, a newly added server ramps up from receiving"
+             " about 5% of its normal share of requests to the full share"
+             " over so many seconds, so that its cold caches do not spike"
+             " latency. 0 disables slow start.");
+BRPC_VALIDATE_GFLAG(lb_slow_start_window_s, PassValidate);
+
+// A warming server keeps at least this share of its normal traffic.
+static const int64_t MIN_SLOW_START_PERCENT = 5;
+// Give up re-selecting after so many attempts and keep the last pick,
+// otherwise a mostly-new cluster could starve the selection.
+static const int MAX_SLOW_START_RESELECT = 3;
+
 // For assigning unique names for lb.
 static butil::static_atomic<int> g_lb_counter = BUTIL_STATIC_ATOMIC_INIT(0);
 
@@ -117,5 +133,86 @@ bool SharedLoadBalancer::ParseParameters(const butil::StringPiece& lb_protocol,
 
     return true;
 }
-																				 
+
+bool SharedLoadBalancer::AddJoinTime(JoinTimeMap& bg, const SocketId& id,
+                                     const int64_t& now_us) {
+    bg.time_of_join[id] = now_us;
+    return true;
+}
+
+bool SharedLoadBalancer::RemoveJoinTime(JoinTimeMap& bg, const SocketId& id) {
+    return bg.time_of_join.erase(id) != 0;
+}
+
+bool SharedLoadBalancer::AddJoinTimeInBatch(
+    JoinTimeMap& bg, const std::vector<ServerId>& servers,
+    const int64_t& now_us) {
+    for (size_t i = 0; i < servers.size(); ++i) {
+        bg.time_of_join[servers[i].id] = now_us;
+    }
+    return !servers.empty();
+}
+
+bool SharedLoadBalancer::RemoveJoinTimeInBatch(
+    JoinTimeMap& bg, const std::vector<ServerId>& servers) {
+    size_t count = 0;
+    for (size_t i = 0; i < servers.size(); ++i) {
+        count += bg.time_of_join.erase(servers[i].id);
+    }
+    return count != 0;
+}
+
+void SharedLoadBalancer::RecordJoinTime(const ServerId& server) {
+    _join_times.Modify(AddJoinTime, server.id, butil::gettimeofday_us());
+}
+
+void SharedLoadBalancer::ForgetJoinTime(const ServerId& server) {
+    _join_times.Modify(RemoveJoinTime, server.id);
+}
+
+void SharedLoadBalancer::RecordJoinTimeInBatch(
+    const std::vector<ServerId>& servers) {
+    _join_times.Modify(AddJoinTimeInBatch, servers, butil::gettimeofday_us());
+}
+
+void SharedLoadBalancer::ForgetJoinTimeInBatch(
+    const std::vector<ServerId>& servers) {
+    _join_times.Modify(RemoveJoinTimeInBatch, servers);
+}
+
+int SharedLoadBalancer::ApplySlowStart(const LoadBalancer::SelectIn& in,
+                                       LoadBalancer::SelectOut* out) {
+    const int64_t window_us =
+        (int64_t)FLAGS_lb_slow_start_window_s * 1000000L;
+    for (int i = 0; ; ++i) {
+        int64_t elapsed_us = window_us;
+        {
+            butil::DoublyBufferedData<JoinTimeMap>::ScopedPtr ptr;
+            if (_join_times.Read(&ptr) == 0) {
+                std::map<SocketId, int64_t>::const_iterator it =
+                    ptr->time_of_join.find((*out->ptr)->id());
+                if (it != ptr->time_of_join.end()) {
+                    elapsed_us = in.begin_time_us - it->second;
+                }
+            }
+        }
+        if (elapsed_us >= window_us) {  // warmed up.
+            return 0;
+        }
+        if (elapsed_us < 0) {
+            elapsed_us = 0;
+        }
+        const int64_t percent = MIN_SLOW_START_PERCENT +
+            (100 - MIN_SLOW_START_PERCENT) * elapsed_us / window_us;
+        if ((int64_t)butil::fast_rand_less_than(100) < percent ||
+            i >= MAX_SLOW_START_RESELECT) {
+            return 0;
+        }
+        const int rc = _lb->SelectServer(in, out);
+        if (rc != 0 || out->need_feedback) {
+            return rc;
+        }
+    }
+}
+
 } // namespace brpc
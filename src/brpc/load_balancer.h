@@ -19,6 +19,8 @@
 #ifndef BRPC_LOAD_BALANCER_H
 #define BRPC_LOAD_BALANCER_H
 
+#include <map>
+#include "butil/containers/doubly_buffered_data.h"
 #include "bvar/passive_status.h"
 #include "brpc/describable.h"
 #include "brpc/destroyable.h"
@@ -108,6 +110,7 @@ protected:
 };
 
 DECLARE_bool(show_lb_in_vars);
+DECLARE_int32(lb_slow_start_window_s);
 
 // A intrusively shareable load balancer created from name.
 class SharedLoadBalancer : public SharedObject, public NonConstDescribable {
@@ -122,13 +125,23 @@ public:
         if (FLAGS_show_lb_in_vars && !_exposed) {
             ExposeLB();
         }
-        return _lb->SelectServer(in, out);
+        const int rc = _lb->SelectServer(in, out);
+        // Slow start only wraps feedback-free policies: a pick discarded
+        // here would leave a feedback-expecting policy (e.g. la) with
+        // unbalanced in-flight accounting, and such policies already shift
+        // load to new servers gradually on their own.
+        if (rc == 0 && !out->need_feedback &&
+            FLAGS_lb_slow_start_window_s > 0) {
+            return ApplySlowStart(in, out);
+        }
+        return rc;
     }
 
     void Feedback(const LoadBalancer::CallInfo& info) { _lb->Feedback(info); }
     
     bool AddServer(const ServerId& server) {
         if (_lb->AddServer(server)) {
+            RecordJoinTime(server);
             _weight_sum.fetch_add(1, butil::memory_order_relaxed);
             return true;
         }
@@ -136,15 +149,17 @@ public:
     }
     bool RemoveServer(const ServerId& server) {
         if (_lb->RemoveServer(server)) {
+            ForgetJoinTime(server);
             _weight_sum.fetch_sub(1, butil::memory_order_relaxed);
             return true;
         }
         return false;
     }
-    
+
     size_t AddServersInBatch(const std::vector<ServerId>& servers) {
         size_t n = _lb->AddServersInBatch(servers);
         if (n) {
+            RecordJoinTimeInBatch(servers);
             _weight_sum.fetch_add(n, butil::memory_order_relaxed);
         }
         return n;
@@ -153,6 +168,7 @@ public:
     size_t RemoveServersInBatch(const std::vector<ServerId>& servers) {
         size_t n = _lb->RemoveServersInBatch(servers);
         if (n) {
+            ForgetJoinTimeInBatch(servers);
             _weight_sum.fetch_sub(n, butil::memory_order_relaxed);
         }
         return n;
@@ -165,15 +181,41 @@ public:
     }
 
 private:
+    // Time(us) at which each server was added, for slow start. Join times
+    // are always maintained so that -lb_slow_start_window_s can be turned
+    // on at runtime.
+    struct JoinTimeMap {
+        std::map<SocketId, int64_t> time_of_join;
+    };
+
     static bool ParseParameters(const butil::StringPiece& lb_protocol,
                                 std::string* lb_name,
                                 butil::StringPiece* lb_params);
     static void DescribeLB(std::ostream& os, void* arg);
     void ExposeLB();
 
+    // Re-select with ramping probability when the server addressed into
+    // `out' is still inside its slow-start window.
+    int ApplySlowStart(const LoadBalancer::SelectIn& in,
+                       LoadBalancer::SelectOut* out);
+
+    static bool AddJoinTime(JoinTimeMap& bg, const SocketId& id,
+                            const int64_t& now_us);
+    static bool RemoveJoinTime(JoinTimeMap& bg, const SocketId& id);
+    static bool AddJoinTimeInBatch(JoinTimeMap& bg,
+                                   const std::vector<ServerId>& servers,
+                                   const int64_t& now_us);
+    static bool RemoveJoinTimeInBatch(JoinTimeMap& bg,
+                                      const std::vector<ServerId>& servers);
+    void RecordJoinTime(const ServerId& server);
+    void ForgetJoinTime(const ServerId& server);
+    void RecordJoinTimeInBatch(const std::vector<ServerId>& servers);
+    void ForgetJoinTimeInBatch(const std::vector<ServerId>& servers);
+
     LoadBalancer* _lb;
     butil::atomic<int> _weight_sum;
     volatile bool _exposed;
+    butil::DoublyBufferedData<JoinTimeMap> _join_times;
     butil::Mutex _st_mutex;
     bvar::PassiveStatus<std::string> _st;
 };
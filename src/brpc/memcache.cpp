@@ -359,6 +359,54 @@ bool MemcacheRequest::Delete(const butil::StringPiece& key) {
     return GetOrDelete(policy::MC_BINARY_DELETE, key);
 }
 
+// Each key is a quiet GETKQ whose opaque is the index of the key, so that
+// PopMultiGet() can tell which key a hit belongs to without comparing keys.
+// The server suppresses responses to missed quiet gets, thus the trailing
+// noop (whose response is never suppressed) marks the end of the batch and
+// is the only operation counted into _pipelined_count.
+bool MemcacheRequest::MultiGet(const butil::StringPiece* keys, size_t count) {
+    if (count == 0) {
+        LOG(ERROR) << "Param[count] must be positive";
+        return false;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        const butil::StringPiece& key = keys[i];
+        const policy::MemcacheRequestHeader header = {
+            policy::MC_MAGIC_REQUEST,
+            policy::MC_BINARY_GETKQ,
+            butil::HostToNet16(key.size()),
+            0,
+            policy::MC_BINARY_RAW_BYTES,
+            0,
+            butil::HostToNet32(key.size()),
+            butil::HostToNet32(i),
+            0
+        };
+        if (_buf.append(&header, sizeof(header))) {
+            return false;
+        }
+        if (_buf.append(key.data(), key.size())) {
+            return false;
+        }
+    }
+    const policy::MemcacheRequestHeader noop_header = {
+        policy::MC_MAGIC_REQUEST,
+        policy::MC_BINARY_NOOP,
+        0,
+        0,
+        policy::MC_BINARY_RAW_BYTES,
+        0,
+        0,
+        butil::HostToNet32(count),
+        0
+    };
+    if (_buf.append(&noop_header, sizeof(noop_header))) {
+        return false;
+    }
+    ++_pipelined_count;
+    return true;
+}
+
 struct FlushHeaderWithExtras {
     policy::MemcacheRequestHeader header;
     uint32_t exptime;
@@ -489,6 +537,86 @@ bool MemcacheResponse::PopGet(
     return false;
 }
 
+// A batch consists of zero or more GETKQ hits followed by one NOOP.
+// (if hit):
+// MUST have extras.
+// MUST have key.
+// MAY have value.
+bool MemcacheResponse::PopMultiGet(
+    size_t count, std::vector<MultiGetHit>* hits) {
+    while (true) {
+        const size_t n = _buf.size();
+        policy::MemcacheResponseHeader header;
+        if (n < sizeof(header)) {
+            butil::string_printf(&_err, "buffer is too small to contain a header");
+            return false;
+        }
+        _buf.copy_to(&header, sizeof(header));
+        if (header.command == (uint8_t)policy::MC_BINARY_NOOP) {
+            // End of the batch.
+            if (header.opaque != count) {
+                butil::string_printf(&_err, "opaque=%u of the noop does not"
+                          " equal key count=%u", header.opaque, (unsigned)count);
+                return false;
+            }
+            _buf.pop_front(sizeof(header) + header.total_body_length);
+            _err.clear();
+            return true;
+        }
+        if (header.command != (uint8_t)policy::MC_BINARY_GETKQ) {
+            butil::string_printf(&_err, "not a GETKQ/NOOP response");
+            return false;
+        }
+        if (n < sizeof(header) + header.total_body_length) {
+            butil::string_printf(&_err, "response=%u < header=%u + body=%u",
+                      (unsigned)n, (unsigned)sizeof(header), header.total_body_length);
+            return false;
+        }
+        if (header.status != (uint16_t)STATUS_SUCCESS) {
+            // Quiet gets never respond to misses, a non-success status is a
+            // real error aborting the batch.
+            const int value_size = (int)header.total_body_length
+                - (int)header.extras_length - (int)header.key_length;
+            if (value_size < 0) {
+                butil::string_printf(&_err, "value_size=%d is negative", value_size);
+                return false;
+            }
+            _buf.pop_front(sizeof(header) + header.extras_length +
+                          header.key_length);
+            _err.clear();
+            _buf.cutn(&_err, value_size);
+            return false;
+        }
+        if (header.extras_length != 4u) {
+            butil::string_printf(&_err, "GETKQ response must have flags as extras,"
+                      " actual length=%u", header.extras_length);
+            return false;
+        }
+        if (header.opaque >= count) {
+            butil::string_printf(&_err, "opaque=%u is out of key count=%u",
+                      header.opaque, (unsigned)count);
+            return false;
+        }
+        const int value_size = (int)header.total_body_length
+            - (int)header.extras_length - (int)header.key_length;
+        if (value_size < 0) {
+            butil::string_printf(&_err, "value_size=%d is negative", value_size);
+            return false;
+        }
+        hits->push_back(MultiGetHit());
+        MultiGetHit& hit = hits->back();
+        hit.index = header.opaque;
+        hit.cas_value = header.cas_value;
+        _buf.pop_front(sizeof(header));
+        uint32_t raw_flags = 0;
+        _buf.cutn(&raw_flags, sizeof(raw_flags));
+        hit.flags = butil::NetToHost32(raw_flags);
+        // The returned key is redundant given the opaque.
+        _buf.pop_front(header.key_length);
+        _buf.cutn(&hit.value, value_size);
+    }
+}
+
 // MUST NOT have extras
 // MUST NOT have key
 // MUST NOT have value
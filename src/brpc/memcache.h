@@ -20,6 +20,7 @@
 #define BRPC_MEMCACHE_H
 
 #include <string>
+#include <vector>
 #include <google/protobuf/message.h>
 
 #include "butil/iobuf.h"
@@ -53,6 +54,17 @@ public:
 
     bool Get(const butil::StringPiece& key);
 
+    // Pack `keys' as one multi-get: every key is sent as a quiet GETKQ
+    // followed by one NOOP marking the end of the batch. The server only
+    // responds to hits, saving one 24-byte header plus parsing per missed
+    // key compared with packing plain GETs. Pop the result with
+    // MemcacheResponse::PopMultiGet().
+    // Notice that the whole batch increases pipelined_count() by just 1
+    // (for the noop) regardless of the number of keys.
+    bool MultiGet(const butil::StringPiece* keys, size_t count);
+    bool MultiGet(const std::vector<butil::StringPiece>& keys)
+    { return MultiGet(keys.data(), keys.size()); }
+
     // If the cas_value(Data Version Check) is non-zero, the requested operation
     // MUST only succeed if the item exists and has a cas_value identical to the
     // provided value.
@@ -182,6 +194,21 @@ public:
    
     bool PopGet(butil::IOBuf* value, uint32_t* flags, uint64_t* cas_value);
     bool PopGet(std::string* value, uint32_t* flags, uint64_t* cas_value);
+
+    // One hit of a MultiGet. `index' is the position of the key inside the
+    // key list given to MemcacheRequest::MultiGet().
+    struct MultiGetHit {
+        size_t index;
+        uint32_t flags;
+        uint64_t cas_value;
+        butil::IOBuf value;
+    };
+    // Pop all responses of a MultiGet packing `count' keys. Hits are
+    // appended to `hits' in the order that the server returned them;
+    // missed keys simply do not appear since their (quiet) responses were
+    // suppressed. Returns false and sets LastError() on malformed data.
+    bool PopMultiGet(size_t count, std::vector<MultiGetHit>* hits);
+
     bool PopSet(uint64_t* cas_value);
     bool PopAdd(uint64_t* cas_value);
     bool PopReplace(uint64_t* cas_value);
@@ -0,0 +1,98 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include "brpc/method_options.h"
+
+
+namespace brpc {
+
+DynamicMethodOptions::DynamicMethodOptions()
+    : max_concurrency(-1)
+    , request_priority(-1)  // REQUEST_PRIORITY_UNSET
+    , response_compress_threshold(-1)
+    , run_interceptors(true) {
+}
+
+MethodOptionsTable::MethodOptionsTable() : _version(0) {
+}
+
+MethodOptionsTable::~MethodOptionsTable() {
+}
+
+bool MethodOptionsTable::Get(const butil::StringPiece& full_method_name,
+                             DynamicMethodOptions* out) const {
+    butil::DoublyBufferedData<Table>::ScopedPtr ptr;
+    if (_table.Read(&ptr) != 0) {
+        return false;
+    }
+    Table::const_iterator it =
+        ptr->find(full_method_name.as_string());
+    if (it == ptr->end()) {
+        return false;
+    }
+    *out = it->second;
+    return true;
+}
+
+size_t MethodOptionsTable::SetEntry(
+    Table& table,
+    const std::pair<const std::string*, const DynamicMethodOptions*>& entry) {
+    table[*entry.first] = *entry.second;
+    return 1;
+}
+
+size_t MethodOptionsTable::RemoveEntry(Table& table, const std::string& name) {
+    return table.erase(name);
+}
+
+int MethodOptionsTable::Set(const std::string& full_method_name,
+                            const DynamicMethodOptions& options) {
+    const std::pair<const std::string*, const DynamicMethodOptions*>
+        entry(&full_method_name, &options);
+    if (!_table.Modify(SetEntry, entry)) {
+        return -1;
+    }
+    _version.fetch_add(1, butil::memory_order_relaxed);
+    return 0;
+}
+
+int MethodOptionsTable::Remove(const std::string& full_method_name) {
+    if (!_table.Modify(RemoveEntry, full_method_name)) {
+        return -1;
+    }
+    _version.fetch_add(1, butil::memory_order_relaxed);
+    return 0;
+}
+
+void MethodOptionsTable::Describe(std::ostream& os) const {
+    butil::DoublyBufferedData<Table>::ScopedPtr ptr;
+    if (_table.Read(&ptr) != 0) {
+        return;
+    }
+    for (Table::const_iterator it = ptr->begin(); it != ptr->end(); ++it) {
+        const DynamicMethodOptions& opt = it->second;
+        os << it->first
+           << " max_concurrency=" << opt.max_concurrency
+           << " request_priority=" << opt.request_priority
+           << " compress_threshold=" << opt.response_compress_threshold
+           << " interceptors=" << (opt.run_interceptors ? "on" : "off")
+           << '\n';
+    }
+}
+
+} // namespace brpc
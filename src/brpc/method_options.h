@@ -0,0 +1,106 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef BRPC_METHOD_OPTIONS_H
+#define BRPC_METHOD_OPTIONS_H
+
+#include <map>
+#include <string>
+#include <ostream>
+#include "butil/macros.h"
+#include "butil/atomicops.h"
+#include "butil/strings/string_piece.h"
+#include "butil/containers/doubly_buffered_data.h"
+
+namespace brpc {
+
+// Runtime overrides of per-method settings that otherwise can only be
+// changed before the server starts. Fields at their defaults keep the
+// static setting of the method.
+struct DynamicMethodOptions {
+    // >= 0 caps concurrent calls of the method regardless of its static
+    // ConcurrencyLimiter (0 drains the method), -1 keeps the limiter.
+    int max_concurrency;
+
+    // Value of enum RequestPriority(server.h) moving the method to
+    // another priority lane, REQUEST_PRIORITY_UNSET(-1) keeps the static
+    // lane.
+    int request_priority;
+
+    // >= 0: responses smaller than this many bytes are sent uncompressed
+    // even when the method set a response compress type, -1 compresses
+    // as the method asked.
+    int64_t response_compress_threshold;
+
+    // false skips the interceptors registered on the method.
+    bool run_interceptors;
+
+    DynamicMethodOptions();
+};
+
+// The table of DynamicMethodOptions of a Server, keyed by full method
+// names ("example.EchoService.Echo"), updatable while the server is
+// serving through the /method_options builtin service. Backed by
+// DoublyBufferedData: a request reads one immutable snapshot and an
+// update replaces the whole table atomically, so a config rollout is
+// never half-applied to a request. Every successful update bumps
+// version() which identifies the config generation in effect.
+class MethodOptionsTable {
+public:
+    MethodOptionsTable();
+    ~MethodOptionsTable();
+
+    // Fill `*out' with the overrides of `full_method_name'.
+    // Returns false when the method has no overrides.
+    bool Get(const butil::StringPiece& full_method_name,
+             DynamicMethodOptions* out) const;
+
+    // Set/replace the overrides of `full_method_name'.
+    // Returns 0 on success, -1 otherwise.
+    int Set(const std::string& full_method_name,
+            const DynamicMethodOptions& options);
+
+    // Drop the overrides of `full_method_name', restoring its static
+    // settings. Returns 0 on success, -1 when the method had no entry.
+    int Remove(const std::string& full_method_name);
+
+    // Sequence number bumped by every successful Set()/Remove().
+    int64_t version() const
+    { return _version.load(butil::memory_order_relaxed); }
+
+    // Print all entries into `os', one per line.
+    void Describe(std::ostream& os) const;
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(MethodOptionsTable);
+
+    typedef std::map<std::string, DynamicMethodOptions> Table;
+
+    static size_t SetEntry(
+        Table& table,
+        const std::pair<const std::string*,
+                        const DynamicMethodOptions*>& entry);
+    static size_t RemoveEntry(Table& table, const std::string& name);
+
+    mutable butil::DoublyBufferedData<Table> _table;
+    butil::atomic<int64_t> _version;
+};
+
+} // namespace brpc
+
+#endif  // BRPC_METHOD_OPTIONS_H
@@ -25,13 +25,15 @@ namespace brpc {
 
 BAIDU_CASSERT(sizeof(nshead_t) == 36, sizeof_nshead_must_be_36);
 
-NsheadService::NsheadService() : _additional_space(0) {
+NsheadService::NsheadService() : _additional_space(0), _methods(NULL) {
     _status = new (std::nothrow) MethodStatus;
     LOG_IF(FATAL, _status == NULL) << "Fail to new MethodStatus";
 }
 
 NsheadService::NsheadService(const NsheadServiceOptions& options)
-    : _status(NULL), _additional_space(options.additional_space) {
+    : _status(NULL)
+    , _additional_space(options.additional_space)
+    , _methods(NULL) {
     if (options.generate_status) {
         _status = new (std::nothrow) MethodStatus;
         LOG_IF(FATAL, _status == NULL) << "Fail to new MethodStatus";
@@ -41,6 +43,43 @@ NsheadService::NsheadService(const NsheadServiceOptions& options)
 NsheadService::~NsheadService() {
     delete _status;
     _status = NULL;
+    if (_methods != NULL) {
+        for (butil::FlatMap<uint64_t, NsheadMethodProperty>::iterator
+                 it = _methods->begin(); it != _methods->end(); ++it) {
+            delete it->second.status;
+        }
+        delete _methods;
+        _methods = NULL;
+    }
+}
+
+int NsheadService::AddMethod(uint64_t selector,
+                             NsheadMethodProcessor processor,
+                             const butil::StringPiece& name) {
+    if (NULL == processor) {
+        LOG(ERROR) << "Parameter [processor] is NULL";
+        return -1;
+    }
+    if (NULL == _methods) {
+        _methods = new (std::nothrow)
+            butil::FlatMap<uint64_t, NsheadMethodProperty>;
+        if (_methods == NULL || _methods->init(64) != 0) {
+            LOG(ERROR) << "Fail to init _methods";
+            delete _methods;
+            _methods = NULL;
+            return -1;
+        }
+    }
+    if (_methods->seek(selector) != NULL) {
+        LOG(ERROR) << "selector=" << selector << " was already registered";
+        return -1;
+    }
+    NsheadMethodProperty& mp = (*_methods)[selector];
+    mp.processor = processor;
+    mp.name.assign(name.data(), name.size());
+    mp.status = new (std::nothrow) MethodStatus;
+    LOG_IF(FATAL, mp.status == NULL) << "Fail to new MethodStatus";
+    return 0;
 }
 
 void NsheadService::Describe(std::ostream &os, const DescribeOptions&) const {
@@ -49,15 +88,26 @@ void NsheadService::Describe(std::ostream &os, const DescribeOptions&) const {
 
 void NsheadService::Expose(const butil::StringPiece& prefix) {
     _cached_name = butil::class_name_str(*this);
-    if (_status == NULL) {
-        return;
-    }
     std::string s;
-    s.reserve(prefix.size() + 1 + _cached_name.size());
-    s.append(prefix.data(), prefix.size());
-    s.push_back('_');
-    s.append(_cached_name);
-    _status->Expose(s);
+    if (_status != NULL) {
+        s.reserve(prefix.size() + 1 + _cached_name.size());
+        s.append(prefix.data(), prefix.size());
+        s.push_back('_');
+        s.append(_cached_name);
+        _status->Expose(s);
+    }
+    if (_methods != NULL) {
+        for (butil::FlatMap<uint64_t, NsheadMethodProperty>::iterator
+                 it = _methods->begin(); it != _methods->end(); ++it) {
+            s.clear();
+            s.append(prefix.data(), prefix.size());
+            s.push_back('_');
+            s.append(_cached_name);
+            s.push_back('_');
+            s.append(it->second.name);
+            it->second.status->Expose(s);
+        }
+    }
 }
 
 } // namespace brpc
@@ -22,6 +22,7 @@
 #include "brpc/controller.h"                 // Controller
 #include "brpc/nshead_message.h"             // NsheadMessage
 #include "brpc/describable.h"
+#include "butil/containers/flat_map.h"       // butil::FlatMap
 
 
 namespace brpc {
@@ -67,6 +68,9 @@ friend class DeleteNsheadClosure;
     NsheadMessage _response;
     bool _do_respond;
     void* _additional_space;
+    // Status of the method(or the whole service) handling the request,
+    // set before the handler is called.
+    MethodStatus* _method_status;
     Controller _controller;
 };
 
@@ -80,6 +84,18 @@ struct NsheadServiceOptions {
     size_t additional_space;
 };
 
+class NsheadService;
+
+// Signature of a handler registered by NsheadService::AddMethod().
+// `service' is the NsheadService that the handler was registered on,
+// semantics of the other parameters are same as ProcessNsheadRequest().
+typedef void (*NsheadMethodProcessor)(NsheadService* service,
+                                      const Server& server,
+                                      Controller* controller,
+                                      const NsheadMessage& request,
+                                      NsheadMessage* response,
+                                      NsheadClosure* done);
+
 // Inherit this class to let brpc server understands nshead requests.
 class NsheadService : public Describable {
 public:
@@ -87,6 +103,25 @@ public:
     NsheadService(const NsheadServiceOptions&);
     virtual ~NsheadService();
 
+    // Register `processor' to handle requests whose selector (returned by
+    // GetMethodSelector()) equals `selector'. The selector->handler map is
+    // sealed when the server starts and resolved with a single lock-free
+    // probe per request. Requests with an unregistered selector still go
+    // to ProcessNsheadRequest(). Each registered method gets its own
+    // QPS/latency/concurrency in /status under `name', which the
+    // service-level status does not break down.
+    // Must be called before the server is started.
+    // Returns 0 on success, -1 otherwise.
+    int AddMethod(uint64_t selector, NsheadMethodProcessor processor,
+                  const butil::StringPiece& name);
+
+    // Override to map a request to the selector of its handler when
+    // methods were registered with AddMethod(). The default implementation
+    // selects by id of the nshead, which legacy gateways commonly use to
+    // multiplex services on one port.
+    virtual uint64_t GetMethodSelector(const NsheadMessage& request) const
+    { return request.head.id; }
+
     // Implement this method to handle nshead requests. Notice that this
     // method can be called with a failed Controller(something wrong with the
     // request before calling this method), in which case the implemenetation
@@ -115,11 +150,20 @@ friend class Server;
 
 private:
     void Expose(const butil::StringPiece& prefix);
-    
+
+    struct NsheadMethodProperty {
+        NsheadMethodProcessor processor;
+        MethodStatus* status;
+        std::string name;
+    };
+
     // Tracking status of non NsheadPbService
     MethodStatus* _status;
     size_t _additional_space;
     std::string _cached_name;
+    // Selector -> handler, filled by AddMethod() before the server starts
+    // thus needs no lock at lookup. NULL when AddMethod was never called.
+    butil::FlatMap<uint64_t, NsheadMethodProperty>* _methods;
 };
 
 } // namespace brpc
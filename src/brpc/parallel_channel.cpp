@@ -16,12 +16,19 @@
 // under the License.
 
 
+#include <vector>
+#include <gflags/gflags.h>
 #include "bthread/bthread.h"                  // bthread_id_xx
 #include "bthread/unstable.h"                 // bthread_timer_add
 #include "butil/atomicops.h"
 #include "butil/time.h"
 #include "butil/macros.h"
+#include "butil/scoped_lock.h"
+#include "bvar/latency_recorder.h"
+#include "brpc/reloadable_flags.h"
 #include "brpc/details/controller_private_accessor.h"
+#include "brpc/compress.h"                    // SerializeAsCompressedData
+#include "brpc/serialized_request.h"
 #include "brpc/parallel_channel.h"
 
 
@@ -29,11 +36,40 @@ namespace brpc {
 
 ParallelChannelOptions::ParallelChannelOptions()
     : timeout_ms(500)
-    , fail_limit(-1) {
+    , fail_limit(-1)
+    , success_limit(-1)
+    , share_serialized_request(false) {
 }
 
 DECLARE_bool(usercode_in_pthread);
 
+DEFINE_bool(pchan_sub_call_latency, false,
+            "Export latency of successful sub calls of ParallelChannel as"
+            " the bvar family pchan_sub_call_<index>, revealing which"
+            " sub channel(e.g. partition) drags down the whole call");
+BRPC_VALIDATE_GFLAG(pchan_sub_call_latency, PassValidate);
+
+// Lazily created per-sub-call-index recorders shared by all parallel
+// channels in the process, NULL until the index is seen with the flag on.
+static pthread_mutex_t s_sub_call_latency_mutex = PTHREAD_MUTEX_INITIALIZER;
+static std::vector<bvar::LatencyRecorder*>* s_sub_call_latency = NULL;
+
+static bvar::LatencyRecorder* GetSubCallLatencyRecorder(int index) {
+    BAIDU_SCOPED_LOCK(s_sub_call_latency_mutex);
+    if (s_sub_call_latency == NULL) {
+        s_sub_call_latency = new std::vector<bvar::LatencyRecorder*>;
+    }
+    if (index >= (int)s_sub_call_latency->size()) {
+        s_sub_call_latency->resize(index + 1, NULL);
+    }
+    if ((*s_sub_call_latency)[index] == NULL) {
+        char name[48];
+        snprintf(name, sizeof(name), "pchan_sub_call_%d", index);
+        (*s_sub_call_latency)[index] = new bvar::LatencyRecorder(name);
+    }
+    return (*s_sub_call_latency)[index];
+}
+
 // Not see difference when memory is cached.
 #ifdef BRPC_CACHE_PCHAN_MEM
 struct Memory {
@@ -45,13 +81,16 @@ static __thread Memory tls_cached_pchan_mem = { 0, NULL };
 
 class ParallelChannelDone : public google::protobuf::Closure {
 private:
-    ParallelChannelDone(int fail_limit, int ndone, int nchan, int memsize,
+    ParallelChannelDone(int fail_limit, int success_limit, int ndone,
+                        int nchan, int memsize,
                         Controller* cntl, google::protobuf::Closure* user_done)
         : _fail_limit(fail_limit)
+        , _success_limit(success_limit)
         , _ndone(ndone)
         , _nchan(nchan)
         , _memsize(memsize)
         , _current_fail(0)
+        , _current_success(0)
         , _current_done(0)
         , _cntl(cntl)
         , _user_done(user_done)
@@ -89,8 +128,8 @@ public:
     };
     
     static ParallelChannelDone* Create(
-        int fail_limit, int ndone, const SubCall* aps, int nchan,
-        Controller* cntl, google::protobuf::Closure* user_done) {
+        int fail_limit, int success_limit, int ndone, const SubCall* aps,
+        int nchan, Controller* cntl, google::protobuf::Closure* user_done) {
         // We need to create the object in this way because _sub_done is
         // dynamically allocated.
         // The memory layout:
@@ -131,7 +170,7 @@ public:
         }
 #endif
         ParallelChannelDone* d = new (mem) ParallelChannelDone(
-            fail_limit, ndone, nchan, memsize, cntl, user_done);
+            fail_limit, success_limit, ndone, nchan, memsize, cntl, user_done);
 
         // Apply client settings of _cntl to controllers of sub calls, except
         // timeout. If we let sub channel do their timeout separately, when
@@ -220,6 +259,10 @@ public:
         if (fin != NULL) {
             // [ called from SubDone::Run() ]
 
+            if (FLAGS_pchan_sub_call_latency && !fin->cntl.FailedInline()) {
+                *GetSubCallLatencyRecorder(fin - _sub_done)
+                    << fin->cntl.latency_us();
+            }
             // Count failed sub calls, if fail_limit is reached, cancel others.
             if (fin->cntl.FailedInline() &&
                 _current_fail.fetch_add(1, butil::memory_order_relaxed) + 1
@@ -231,6 +274,18 @@ public:
                     }
                 }
             }
+            // Count successful sub calls, if success_limit("partial quorum")
+            // is reached, the aggregate is good enough, cancel stragglers.
+            if (_success_limit > 0 && !fin->cntl.FailedInline() &&
+                _current_success.fetch_add(1, butil::memory_order_relaxed) + 1
+                == _success_limit) {
+                for (int i = 0; i < _ndone; ++i) {
+                    SubDone* sd = sub_done(i);
+                    if (fin != sd) {
+                        bthread_id_error(sd->cntl.call_id(), ECANCELED);
+                    }
+                }
+            }
             // NOTE: Don't access any member after the fetch_add because
             // another thread may already go down and Destroy()-ed this object.
             const uint32_t saved_ndone = _ndone;
@@ -343,8 +398,16 @@ public:
             }
         }
 
+        // Quorum of successes makes the call successful regardless of how
+        // many stragglers got canceled; nfailed == _ndone still marks the
+        // unconditional failures above (merging errors).
+        const bool quorum_ok =
+            (_success_limit > 0 && nfailed < _ndone &&
+             _current_success.load(butil::memory_order_relaxed)
+             >= _success_limit);
+
         // Note: 1 <= _fail_limit <= _ndone.
-        if (nfailed >= _fail_limit) {
+        if (nfailed >= _fail_limit && !quorum_ok) {
             // If controller was already failed, don't change it.
             if (!_cntl->FailedInline()) {
                 char buf[16];
@@ -423,6 +486,7 @@ public:
 
 private:
     int _fail_limit;
+    int _success_limit;
     int _ndone;
     int _nchan;
 #if defined(__clang__)
@@ -431,6 +495,7 @@ private:
     int _memsize;
 #endif
     butil::atomic<int> _current_fail;
+    butil::atomic<int> _current_success;
     butil::atomic<uint32_t> _current_done;
     Controller* _cntl;
     google::protobuf::Closure* _user_done;
@@ -580,8 +645,12 @@ void ParallelChannel::CallMethod(
     cntl->set_used_by_rpc();
 
     ParallelChannelDone* d = NULL;
+    SerializedRequest* shared_req = NULL;
+    // True once some SubDone took over deletion of shared_req.
+    bool shared_req_owned = false;
     int ndone = nchan;
     int fail_limit = 1;
+    int success_limit = 0;
     DEFINE_SMALL_ARRAY(SubCall, aps, nchan, 64);
 
     if (cntl->FailedInline()) {
@@ -598,6 +667,29 @@ void ParallelChannel::CallMethod(
         goto FAIL;
     }
 
+    if (_options.share_serialized_request && request != NULL &&
+        request->GetDescriptor() != SerializedRequest::descriptor()) {
+        // Serialize (and compress, the type is inherited by sub calls via
+        // ApplyClientSettings) once here. The default pb serializer of sub
+        // channels just appends the shared bytes without copying.
+        if (!request->IsInitialized()) {
+            cntl->SetFailed(EREQUEST, "Missing required fields in request: %s",
+                            request->InitializationErrorString().c_str());
+            goto FAIL;
+        }
+        shared_req = new (std::nothrow) SerializedRequest;
+        if (shared_req == NULL) {
+            cntl->SetFailed(ENOMEM, "Fail to new SerializedRequest");
+            goto FAIL;
+        }
+        if (!SerializeAsCompressedData(*request, &shared_req->serialized_data(),
+                                       cntl->request_compress_type())) {
+            cntl->SetFailed(EREQUEST, "Fail to compress request, "
+                            "compress_type=%d", (int)cntl->request_compress_type());
+            goto FAIL;
+        }
+    }
+
     for (int i = 0; i < nchan; ++i) {
         SubChan& sub_chan = _chans[i];
         if (sub_chan.call_mapper != NULL) {
@@ -609,6 +701,11 @@ void ParallelChannel::CallMethod(
                 cntl->SetFailed(
                     EREQUEST, "CallMapper of channel[%d] returns Bad()", i);
                 goto FAIL;
+            } else if (shared_req != NULL && aps[i].request == request &&
+                       !(aps[i].flags & DELETE_REQUEST)) {
+                // The mapper passed the original request through, share the
+                // serialized form with it as well.
+                aps[i].request = shared_req;
             }
         } else {
             google::protobuf::Message* cur_res = response->New();
@@ -616,7 +713,9 @@ void ParallelChannel::CallMethod(
                 cntl->SetFailed(ENOMEM, "Fail to new response");
                 goto FAIL;
             }
-            aps[i] = SubCall(method, request, cur_res, DELETE_RESPONSE);
+            aps[i] = SubCall(method,
+                             (shared_req != NULL ? shared_req : request),
+                             cur_res, DELETE_RESPONSE);
         }
     }
     if (ndone <= 0) {
@@ -635,9 +734,17 @@ void ParallelChannel::CallMethod(
             fail_limit = ndone;
         }
     }
-    
-    d = ParallelChannelDone::Create(fail_limit, ndone, aps, nchan,
-                                    cntl, done);
+
+    // The per-call setting takes precedence over the channel-level one.
+    success_limit = (cntl->_success_limit != UNSET_MAGIC_NUM ?
+                     cntl->_success_limit : _options.success_limit);
+    if (success_limit < 0 || success_limit >= ndone) {
+        // Waiting for all sub calls is the same as having no quorum.
+        success_limit = 0;
+    }
+
+    d = ParallelChannelDone::Create(fail_limit, success_limit, ndone, aps,
+                                    nchan, cntl, done);
     if (NULL == d) {
         cntl->SetFailed(ENOMEM, "Fail to new ParallelChannelDone");
         goto FAIL;
@@ -650,8 +757,21 @@ void ParallelChannel::CallMethod(
             sd->ap = aps[i];
             sd->shared_data = d;
             sd->merger = sub_chan.merger;
+            if (shared_req != NULL && !shared_req_owned &&
+                sd->ap.request == shared_req) {
+                // Exactly one SubDone deletes the shared request. All
+                // SubDones are destructed together in Destroy() after every
+                // sub call finished, no sub call can still be using it.
+                sd->ap.flags |= DELETE_REQUEST;
+                shared_req_owned = true;
+            }
         }
     }
+    if (shared_req != NULL && !shared_req_owned) {
+        // All mappers replaced the request, nobody uses the shared form.
+        delete shared_req;
+        shared_req = NULL;
+    }
     cntl->_response = response;
     cntl->_done = d;
     cntl->add_flag(Controller::FLAGS_DESTROY_CID_IN_DONE);
@@ -698,6 +818,9 @@ void ParallelChannel::CallMethod(
 
 FAIL:
     // The RPC was failed after locking call_id and before calling sub channels.
+    if (shared_req != NULL && !shared_req_owned) {
+        delete shared_req;
+    }
     if (d) {
         // Set the _done to NULL to make sure cntl->sub(any_index) is NULL.
         cntl->_done = NULL;
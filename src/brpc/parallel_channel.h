@@ -154,6 +154,27 @@ struct ParallelChannelOptions {
     // does not fail unless all sub RPC failed.
     int fail_limit;
 
+    // If positive, the RPC finishes as soon as this many sub RPC succeeded
+    // ("partial quorum") and the remaining sub RPC are canceled, so that a
+    // straggler sub channel no longer determines latency of the whole call
+    // when an aggregate of part of the responses is good enough. Canceled
+    // sub RPC are not counted against fail_limit.
+    // Overridable per call by Controller.set_success_limit().
+    // Default: -1, the RPC waits for all sub RPC as before.
+    int success_limit;
+
+    // Serialize (and compress) the request once and share the bytes with
+    // all sub calls instead of letting each sub channel serialize the
+    // same request again, which dominates CPU cost of large fan-outs.
+    // Sub calls whose CallMapper returns a different request object still
+    // serialize on their own.
+    // NOTE: Only enable this when sub channels use protocols serializing
+    // requests with the default pb serializer (baidu_std, hulu_pbrpc,
+    // sofa_pbrpc etc). Protocols with their own request format(e.g. http)
+    // don't accept pre-serialized bytes.
+    // Default: false
+    bool share_serialized_request;
+
     // Construct with default options.
     ParallelChannelOptions();
 };
@@ -110,6 +110,7 @@ int PartitionChannelBase::Init(int num_partition_kinds,
     ParallelChannelOptions pchan_options;
     pchan_options.timeout_ms = options.timeout_ms;
     pchan_options.fail_limit = options.fail_limit;
+    pchan_options.success_limit = options.success_limit;
     if (ParallelChannel::Init(&pchan_options) != 0) {
         LOG(ERROR) << "Fail to init PartitionChannel as ParallelChannel";
         return -1;
@@ -187,7 +188,7 @@ void PartitionChannelBase::OnRemovedServers(
 // ================= PartitionChannel ====================
 
 PartitionChannelOptions::PartitionChannelOptions()
-    : ChannelOptions(), fail_limit(-1) {
+    : ChannelOptions(), fail_limit(-1), success_limit(-1) {
 }
 
 PartitionChannel::PartitionChannel()
@@ -63,6 +63,13 @@ struct PartitionChannelOptions : public ChannelOptions {
     // will not be canceled until all sub calls failed.
     int fail_limit;
 
+    // If positive, make the RPC return as soon as this many partitions
+    // responded successfully and cancel the straggler partitions, instead
+    // of letting the slowest partition determine latency of the whole call.
+    // Overridable per call by Controller.set_success_limit().
+    // Default: -1, wait for all partitions as before.
+    int success_limit;
+
     // Check comments on ParallelChannel.AddChannel in parallel_channel.h
     // Sub channels in PartitionChannel share the same mapper and merger.
     butil::intrusive_ptr<CallMapper> call_mapper;
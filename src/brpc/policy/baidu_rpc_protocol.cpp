@@ -16,6 +16,7 @@
 // under the License.
 
 
+#include <algorithm>                            // std::min
 #include <google/protobuf/descriptor.h>         // MethodDescriptor
 #include <google/protobuf/message.h>            // Message
 #include <google/protobuf/io/zero_copy_stream_impl_lite.h>
@@ -24,6 +25,9 @@
 #include "butil/time.h"
 #include "butil/iobuf.h"                         // butil::IOBuf
 #include "butil/raw_pack.h"                      // RawPacker RawUnpacker
+#include "butil/containers/flat_map.h"           // FlatMap
+#include "butil/memory/singleton_on_pthread_once.h" // get_leaky_singleton
+#include "bvar/bvar.h"                          // bvar::Adder
 #include "brpc/controller.h"                    // Controller
 #include "brpc/socket.h"                        // Socket
 #include "brpc/server.h"                        // Server
@@ -31,11 +35,16 @@
 #include "brpc/compress.h"                      // ParseFromCompressedData
 #include "brpc/stream_impl.h"
 #include "brpc/rpc_dump.h"                      // SampledRequest
+#include "brpc/tenant_quota.h"
+#include "brpc/request_mirror.h"                  // TenantQuota
+#include "brpc/reloadable_flags.h"              // BRPC_VALIDATE_GFLAG
 #include "brpc/policy/baidu_rpc_meta.pb.h"      // RpcRequestMeta
 #include "brpc/policy/baidu_rpc_protocol.h"
 #include "brpc/policy/most_common_message.h"
 #include "brpc/policy/streaming_rpc_protocol.h"
 #include "brpc/details/usercode_backup_pool.h"
+#include "brpc/details/priority_lanes.h"
+#include "brpc/details/singleflight.h"
 #include "brpc/details/controller_private_accessor.h"
 #include "brpc/details/server_private_accessor.h"
 
@@ -51,6 +60,58 @@ DEFINE_bool(baidu_protocol_use_fullname, true,
             "If this flag is true, baidu_std puts service.full_name in requests"
             ", otherwise puts service.name (required by jprotobuf).");
 
+#if GOOGLE_PROTOBUF_VERSION >= 3000000
+DEFINE_bool(server_message_arena, false,
+            "Allocate request/response messages of server-side baidu_std "
+            "calls on an arena owned by the Controller, releasing them in "
+            "one shot when the RPC ends instead of one free per message");
+#endif
+
+DEFINE_int64(baidu_std_streaming_attachment_threshold, -1,
+             "Attachments of server-side baidu_std requests larger than so "
+             "many bytes are fed to the service progressively through "
+             "Controller.ReadProgressiveAttachmentBy() while still being "
+             "received, instead of buffering the whole message before "
+             "processing. <=0 buffers everything as before");
+BRPC_VALIDATE_GFLAG(baidu_std_streaming_attachment_threshold, PassValidate);
+
+DEFINE_bool(baidu_std_save_serialized_request, false,
+            "Save the serialized bytes of server-side baidu_std requests "
+            "into the Controller so that proxies may relay them through "
+            "Controller.ForwardTo() without re-serializing the request");
+BRPC_VALIDATE_GFLAG(baidu_std_save_serialized_request, PassValidate);
+
+DEFINE_bool(baidu_std_propagate_timeout, false,
+            "Send the remaining time budget of each RPC inside the request "
+            "meta so that servers know the absolute deadline of requests. "
+            "Note: turning this on bypasses -cache_serialized_rpc_meta for "
+            "RPCs with a timeout since their meta is no longer constant");
+BRPC_VALIDATE_GFLAG(baidu_std_propagate_timeout, PassValidate);
+
+DEFINE_bool(baidu_std_reject_expired_requests, false,
+            "Reject requests whose propagated deadline was already exceeded "
+            "before deserialization and the user callback, saving servers in "
+            "overload from executing work that no client waits for anymore");
+BRPC_VALIDATE_GFLAG(baidu_std_reject_expired_requests, PassValidate);
+
+// Requests dropped because their deadline already passed, shown at
+// /overload.
+static bvar::Adder<int64_t> g_expired_request_drops("rpc_expired_request_drops");
+
+DEFINE_int32(baidu_std_body_copy_limit, 512,
+             "Message bodies no longer than so many bytes are copied behind "
+             "the header+meta of the packet instead of linked in as separate "
+             "blocks, so that small messages stay in one contiguous block "
+             "(one iovec in writev, better parse locality). <=0 always links");
+BRPC_VALIDATE_GFLAG(baidu_std_body_copy_limit, PassValidate);
+
+DEFINE_bool(cache_serialized_rpc_meta, false,
+            "Cache the serialized bytes of the constant part of the RpcMeta "
+            "of each (method, compress_type) pair and append the per-call "
+            "fields by hand, skipping the protobuf serialization of the meta "
+            "when baidu_std clients pack requests");
+BRPC_VALIDATE_GFLAG(cache_serialized_rpc_meta, PassValidate);
+
 // Notes:
 // 1. 12-byte header [PRPC][body_size][meta_size]
 // 2. body_size and meta_size are in network byte order
@@ -89,8 +150,183 @@ static void SerializeRpcHeaderAndMeta(
     }
 }
 
+// Append `body' to `out', copying when it is small: the bytes continue the
+// block holding header+meta(which has plenty of space left for bodies
+// within the limit), keeping the whole packet in one contiguous block
+// instead of 2+ linked blocks. Bigger bodies are linked in by reference
+// as before.
+static void AppendBody(butil::IOBuf* out, const butil::IOBuf& body) {
+    if ((int64_t)body.size() > (int64_t)FLAGS_baidu_std_body_copy_limit) {
+        out->append(body);
+        return;
+    }
+    const size_t nblock = body.backing_block_num();
+    for (size_t i = 0; i < nblock; ++i) {
+        const butil::StringPiece blk = body.backing_block(i);
+        out->append(blk.data(), blk.size());
+    }
+}
+
+// State of an oversized attachment that is handed to the service while
+// still being received. While bytes are pending it is the parsing context
+// of the socket; it is also set as the readable progressive attachment of
+// the server-side Controller, echoing what HTTP does for progressively
+// read bodies. Bytes arriving before the service sets a reader are
+// buffered; afterwards they are fed to the reader directly from parsing,
+// thus a blocking reader throttles further reads on the socket.
+class StreamingAttachment : public ReadableProgressiveAttachment
+                          , public Destroyable {
+public:
+    explicit StreamingAttachment(size_t remaining)
+        : _reader(NULL)
+        , _remaining(remaining)
+        , _ended(false) {
+        // add one ref for Destroy()
+        butil::intrusive_ptr<StreamingAttachment>(this).detach();
+    }
+
+    // Bytes not yet received. Only read and decreased by the parsing
+    // thread, no locking needed there.
+    size_t remaining() const { return _remaining; }
+
+    // Called from parsing with newly-arrived bytes, no more than
+    // remaining(). Returns 0 on success, -1 when the reader failed
+    // permanently and the socket should be closed.
+    int Feed(butil::IOBuf* bytes) {
+        std::unique_lock<butil::Mutex> mu(_mutex);
+        _remaining -= bytes->size();
+        if (_ended) {  // the reader failed before, drop the bytes.
+            bytes->clear();
+            return -1;
+        }
+        if (_reader == NULL) {
+            _buffered.append(butil::IOBuf::Movable(*bytes));
+            return 0;
+        }
+        // Deliver under the lock to keep ordering with the flush in
+        // ReadProgressiveAttachmentBy().
+        ProgressiveReader* r = _reader;
+        const bool done = (_remaining == 0);
+        for (size_t i = 0; i < bytes->backing_block_num(); ++i) {
+            const butil::StringPiece blk = bytes->backing_block(i);
+            butil::Status st = r->OnReadOnePart(blk.data(), blk.size());
+            if (!st.ok()) {
+                _reader = NULL;
+                _ended = true;
+                mu.unlock();
+                r->OnEndOfMessage(st);
+                return -1;
+            }
+        }
+        bytes->clear();
+        if (done) {
+            _reader = NULL;
+            _ended = true;
+            mu.unlock();
+            r->OnEndOfMessage(butil::Status::OK());
+        }
+        return 0;
+    }
+
+    // @ReadableProgressiveAttachment
+    void ReadProgressiveAttachmentBy(ProgressiveReader* r) {
+        std::unique_lock<butil::Mutex> mu(_mutex);
+        if (_reader != NULL || _ended) {
+            const butil::Status st =
+                (_error.ok() && _reader == NULL && _buffered.empty()
+                 ? butil::Status(EPERM, "ReadProgressiveAttachmentBy can't"
+                                 " be called more than once")
+                 : (_error.ok() ? butil::Status(EPERM, "A reader was already"
+                                                " set") : _error));
+            mu.unlock();
+            return r->OnEndOfMessage(st);
+        }
+        // Feed bytes that arrived before the reader was set. Delivering
+        // under the lock blocks concurrent Feed() from parsing, which is
+        // the intended flow control.
+        while (!_buffered.empty()) {
+            const butil::StringPiece blk = _buffered.backing_block(0);
+            butil::Status st = r->OnReadOnePart(blk.data(), blk.size());
+            if (!st.ok()) {
+                _ended = true;
+                mu.unlock();
+                return r->OnEndOfMessage(st);
+            }
+            _buffered.pop_front(blk.size());
+        }
+        if (!_error.ok()) {  // the socket broke before completion.
+            _ended = true;
+            const butil::Status st = _error;
+            mu.unlock();
+            return r->OnEndOfMessage(st);
+        }
+        if (_remaining == 0) {
+            _ended = true;
+            mu.unlock();
+            return r->OnEndOfMessage(butil::Status::OK());
+        }
+        _reader = r;
+    }
+
+    // @Destroyable
+    // Called when the socket resets its parsing context: after the last
+    // byte was fed, or when the connection broke halfway.
+    void Destroy() {
+        ProgressiveReader* r = NULL;
+        butil::Status st;
+        {
+            BAIDU_SCOPED_LOCK(_mutex);
+            if (!_ended && _remaining > 0) {
+                _error = butil::Status(
+                    ECONNRESET, "The socket was broken before the whole"
+                    " attachment was received");
+                st = _error;
+                if (_reader != NULL) {
+                    r = _reader;
+                    _reader = NULL;
+                    _ended = true;
+                }
+            }
+        }
+        if (r != NULL) {
+            r->OnEndOfMessage(st);
+        }
+        butil::intrusive_ptr<StreamingAttachment>(this, false);
+    }
+
+private:
+    butil::Mutex _mutex;
+    butil::IOBuf _buffered;      // arrived before the reader was set
+    ProgressiveReader* _reader;
+    size_t _remaining;
+    bool _ended;                 // OnEndOfMessage was (or won't ever be) called
+    butil::Status _error;        // sticky failure from the socket
+};
+
 ParseResult ParseRpcMessage(butil::IOBuf* source, Socket* socket,
-                            bool /*read_eof*/, const void*) {
+                            bool /*read_eof*/, const void* arg) {
+    StreamingAttachment* sa =
+        static_cast<StreamingAttachment*>(socket->parsing_context());
+    if (sa != NULL) {
+        // An attachment is being streamed, feed it before looking for the
+        // next message.
+        const size_t nfeed = std::min(source->size(), sa->remaining());
+        if (nfeed > 0) {
+            butil::IOBuf bytes;
+            source->cutn(&bytes, nfeed);
+            if (sa->Feed(&bytes) != 0) {
+                return MakeParseError(PARSE_ERROR_ABSOLUTELY_WRONG);
+            }
+        }
+        if (sa->remaining() > 0) {
+            return MakeParseError(PARSE_ERROR_NOT_ENOUGH_DATA);
+        }
+        socket->reset_parsing_context(NULL);  // destroys `sa'
+        if (source->empty()) {
+            return MakeParseError(PARSE_ERROR_NOT_ENOUGH_DATA);
+        }
+        // Fall through to cut the next message.
+    }
     char header_buf[12];
     const size_t n = source->copy_to(header_buf, sizeof(header_buf));
     if (n >= 4) {
@@ -116,6 +352,40 @@ ParseResult ParseRpcMessage(butil::IOBuf* source, Socket* socket,
                    << socket->remote_side() << " is too large";
         return MakeParseError(PARSE_ERROR_TOO_BIG_DATA);
     } else if (source->length() < sizeof(header_buf) + body_size) {
+        if (arg != NULL/*server-side*/ &&
+            FLAGS_baidu_std_streaming_attachment_threshold > 0 &&
+            meta_size <= body_size &&
+            source->length() >= sizeof(header_buf) + meta_size) {
+            // The message is incomplete. If the missing part belongs to an
+            // attachment bigger than the threshold, hand out the message
+            // right now and stream the rest of the attachment into the
+            // service while it is being received.
+            std::string meta_str;
+            source->copy_to(&meta_str, meta_size, sizeof(header_buf));
+            RpcMeta meta;
+            if (meta.ParseFromArray(meta_str.data(), meta_str.size()) &&
+                meta.has_request() &&
+                !meta.has_stream_settings() &&
+                meta.attachment_size() >
+                    FLAGS_baidu_std_streaming_attachment_threshold &&
+                (uint32_t)meta.attachment_size() <= body_size - meta_size &&
+                source->length() >= sizeof(header_buf) + body_size
+                                    - meta.attachment_size()) {
+                source->pop_front(sizeof(header_buf));
+                MostCommonMessage* msg = MostCommonMessage::Get();
+                source->cutn(&msg->meta, meta_size);
+                source->cutn(&msg->payload,
+                             body_size - meta_size - meta.attachment_size());
+                StreamingAttachment* sa =
+                    new StreamingAttachment(meta.attachment_size());
+                msg->rpa.reset(sa);
+                // Bytes of the attachment after this message are fed to
+                // `sa' at the beginning of following calls to this
+                // function, until the attachment is complete.
+                socket->reset_parsing_context(sa);
+                return MakeMessage(msg);
+            }
+        }
         return MakeParseError(PARSE_ERROR_NOT_ENOUGH_DATA);
     }
     if (meta_size > body_size) {
@@ -148,8 +418,25 @@ void SendRpcResponse(int64_t correlation_id,
     Socket* sock = accessor.get_sending_socket();
     std::unique_ptr<Controller, LogErrorTextAndDelete> recycle_cntl(cntl);
     ConcurrencyRemover concurrency_remover(method_status, cntl, received_us);
-    std::unique_ptr<const google::protobuf::Message> recycle_req(req);
-    std::unique_ptr<const google::protobuf::Message> recycle_res(res);
+    // Run after() of interceptors (if any) before the response is
+    // serialized so that they may still modify it.
+    accessor.run_after_interceptors();
+    // Messages allocated on the arena of `cntl' are released altogether
+    // when `recycle_cntl' deletes it(after req/res going out of scope),
+    // don't delete them one by one.
+    std::unique_ptr<const google::protobuf::Message> recycle_req;
+    std::unique_ptr<const google::protobuf::Message> recycle_res;
+#if GOOGLE_PROTOBUF_VERSION >= 3000000
+    if (req == NULL || req->GetArena() == NULL) {
+        recycle_req.reset(req);
+    }
+    if (res == NULL || res->GetArena() == NULL) {
+        recycle_res.reset(res);
+    }
+#else
+    recycle_req.reset(req);
+    recycle_res.reset(res);
+#endif
     
     StreamId response_stream_id = accessor.response_stream();
 
@@ -164,6 +451,19 @@ void SendRpcResponse(int64_t correlation_id,
     // If user calls `SetFailed' on Controller, we don't serialize
     // response either
     CompressType type = cntl->response_compress_type();
+    if (type != COMPRESS_TYPE_NONE && res != NULL && !cntl->Failed() &&
+        cntl->server() != NULL && cntl->method() != NULL) {
+        // Runtime compression threshold from /method_options: small
+        // responses are cheaper to send raw than to compress.
+        DynamicMethodOptions dyn_opt;
+        if (cntl->server()->method_options().Get(
+                cntl->method()->full_name(), &dyn_opt) &&
+            dyn_opt.response_compress_threshold >= 0 &&
+            (int64_t)res->ByteSize() < dyn_opt.response_compress_threshold) {
+            type = COMPRESS_TYPE_NONE;
+            cntl->set_response_compress_type(COMPRESS_TYPE_NONE);
+        }
+    }
     if (res != NULL && !cntl->Failed()) {
         if (!res->IsInitialized()) {
             cntl->SetFailed(
@@ -219,7 +519,11 @@ void SendRpcResponse(int64_t correlation_id,
     butil::IOBuf res_buf;
     SerializeRpcHeaderAndMeta(&res_buf, meta, res_size + attached_size);
     if (append_body) {
-        res_buf.append(res_body.movable());
+        if ((int64_t)res_body.size() <= (int64_t)FLAGS_baidu_std_body_copy_limit) {
+            AppendBody(&res_buf, res_body);
+        } else {
+            res_buf.append(res_body.movable());
+        }
         if (attached_size) {
             res_buf.append(cntl->response_attachment().movable());
         }
@@ -276,8 +580,14 @@ struct CallMethodInBackupThreadArgs {
 
 static void CallMethodInBackupThread(void* void_args) {
     CallMethodInBackupThreadArgs* args = (CallMethodInBackupThreadArgs*)void_args;
+    // Expose the baggage to Channels called within the handler. The
+    // controller outlives the handler's body, where the inheriting calls
+    // are made; the slot is cleared before anything else runs here.
+    bthread::tls_bls.rpc_baggage =
+        &static_cast<Controller*>(args->controller)->request_baggage();
     args->service->CallMethod(args->method, args->controller, args->request,
                               args->response, args->done);
+    bthread::tls_bls.rpc_baggage = NULL;
     delete args;
 }
 
@@ -299,6 +609,96 @@ void EndRunningCallMethodInPool(
     return EndRunningUserCodeInPool(CallMethodInBackupThread, args);
 };
 
+// Methods get dense ids at Server::Start(). Remember ids of recently served
+// methods in each worker so that steady-state requests address the method
+// by array index, skipping the hashing of its full name per request. Hits
+// are validated by comparing names with the indexed method, thus a stale
+// hint (e.g. across a server restart) just degrades to the hash lookup.
+struct MethodIndexHint {
+    const Server* server;
+    int method_index;
+};
+static const size_t NUM_METHOD_INDEX_HINTS = 8;
+static __thread MethodIndexHint tls_method_index_hints[NUM_METHOD_INDEX_HINTS];
+static __thread size_t tls_next_method_index_hint = 0;
+
+static const Server::MethodProperty* FindMethodPropertyByHints(
+        const ServerPrivateAccessor& server_accessor, const Server* server,
+        const butil::StringPiece& svc_name,
+        const butil::StringPiece& method_name) {
+    for (size_t i = 0; i < NUM_METHOD_INDEX_HINTS; ++i) {
+        const MethodIndexHint& hint = tls_method_index_hints[i];
+        if (hint.server != server) {
+            continue;
+        }
+        const Server::MethodProperty* mp =
+            server_accessor.FindMethodPropertyByIndex(hint.method_index);
+        if (mp != NULL && mp->method != NULL &&
+            method_name == mp->method->name() &&
+            svc_name == mp->method->service()->full_name()) {
+            return mp;
+        }
+    }
+    return NULL;
+}
+
+static void RememberMethodIndexHint(const Server* server, int method_index) {
+    if (method_index < 0) {
+        return;
+    }
+    for (size_t i = 0; i < NUM_METHOD_INDEX_HINTS; ++i) {
+        const MethodIndexHint& hint = tls_method_index_hints[i];
+        if (hint.server == server && hint.method_index == method_index) {
+            return;
+        }
+    }
+    MethodIndexHint& hint = tls_method_index_hints[tls_next_method_index_hint];
+    tls_next_method_index_hint =
+        (tls_next_method_index_hint + 1) % NUM_METHOD_INDEX_HINTS;
+    hint.server = server;
+    hint.method_index = method_index;
+}
+
+// The leader of a coalesced request publishes its result right before the
+// ordinary response path consumes it, so that followers blocked in
+// ProcessRpcRequest can send the same response under their own correlation
+// ids.
+class SingleflightDone : public google::protobuf::Closure {
+public:
+    SingleflightDone(SingleflightEntry* entry, Controller* cntl,
+                     const google::protobuf::Message* res,
+                     google::protobuf::Closure* done)
+        : _entry(entry), _cntl(cntl), _res(res), _done(done) {}
+
+    void Run() {
+        int error_code = _cntl->ErrorCode();
+        std::string error_text;
+        butil::IOBuf res_body;
+        if (error_code != 0) {
+            error_text = _cntl->ErrorText();
+        } else if (!SerializeAsCompressedData(*_res, &res_body,
+                                              COMPRESS_TYPE_NONE)) {
+            // SendRpcResponse will fail on the same response, report the
+            // same error to followers.
+            error_code = ERESPONSE;
+            error_text = "Fail to serialize response";
+        }
+        // Must happen before SendRpcResponse moves the attachment away.
+        SingleflightPublish(_entry, error_code, error_text, res_body,
+                            _cntl->response_attachment());
+        _entry->RemoveRefManually();
+        google::protobuf::Closure* done = _done;
+        delete this;
+        done->Run();
+    }
+
+private:
+    SingleflightEntry* _entry;
+    Controller* _cntl;
+    const google::protobuf::Message* _res;
+    google::protobuf::Closure* _done;
+};
+
 void ProcessRpcRequest(InputMessageBase* msg_base) {
     const int64_t start_parse_us = butil::cpuwide_time_us();
     DestroyingPtr<MostCommonMessage> msg(static_cast<MostCommonMessage*>(msg_base));
@@ -328,6 +728,22 @@ void ProcessRpcRequest(InputMessageBase* msg_base) {
         sample->submit(start_parse_us);
     }
 
+    RequestMirror* request_mirror = server->options().request_mirror;
+    if (request_mirror != NULL && request_mirror->Sample()) {
+        SampledRequest* mirrored = new (std::nothrow) SampledRequest;
+        if (mirrored != NULL) {
+            mirrored->meta.set_service_name(request_meta.service_name());
+            mirrored->meta.set_method_name(request_meta.method_name());
+            mirrored->meta.set_compress_type((CompressType)meta.compress_type());
+            mirrored->meta.set_protocol_type(PROTOCOL_BAIDU_STD);
+            mirrored->meta.set_attachment_size(meta.attachment_size());
+            mirrored->meta.set_authentication_data(meta.authentication_data());
+            // Shares blocks with the inbound payload, no copying.
+            mirrored->request = msg->payload;
+            request_mirror->Mirror(mirrored);
+        }
+    }
+
     std::unique_ptr<Controller> cntl(new (std::nothrow) Controller);
     if (NULL == cntl.get()) {
         LOG(WARNING) << "Fail to new Controller";
@@ -353,6 +769,15 @@ void ProcessRpcRequest(InputMessageBase* msg_base) {
         .set_request_protocol(PROTOCOL_BAIDU_STD)
         .set_begin_time_us(msg->received_us())
         .move_in_server_receiving_sock(socket_guard);
+    if (request_meta.has_timeout_ms()) {
+        // Remaining budget sent by the client, turned into an absolute
+        // deadline based on when the request was received.
+        accessor.set_deadline_us(request_meta.timeout_ms() * 1000L +
+                                 msg->base_real_us());
+    }
+    if (request_meta.has_baggage()) {
+        cntl->request_baggage().append(request_meta.baggage());
+    }
 
     if (meta.has_stream_settings()) {
         accessor.set_remote_stream_settings(meta.release_stream_settings());
@@ -373,6 +798,7 @@ void ProcessRpcRequest(InputMessageBase* msg_base) {
         span->set_remote_side(cntl->remote_side());
         span->set_protocol(PROTOCOL_BAIDU_STD);
         span->set_received_us(msg->received_us());
+        span->set_kernel_received_real_us(msg->kernel_received_real_us());
         span->set_start_parse_us(start_parse_us);
         span->set_request_size(msg->payload.size() + msg->meta.size() + 12);
     }
@@ -389,7 +815,18 @@ void ProcessRpcRequest(InputMessageBase* msg_base) {
                             butil::endpoint2str(socket->remote_side()).c_str());
             break;
         }
-        
+
+        if (FLAGS_baidu_std_reject_expired_requests &&
+            cntl->deadline_us() >= 0 &&
+            butil::gettimeofday_us() >= cntl->deadline_us()) {
+            // No client waits for the result anymore, executing the
+            // request would be wasted work.
+            cntl->SetFailed(ERPCTIMEDOUT, "Deadline of the request was "
+                            "already exceeded before execution");
+            g_expired_request_drops << 1;
+            break;
+        }
+
         if (!server_accessor.AddConcurrency(cntl.get())) {
             cntl->SetFailed(
                 ELIMIT, "Reached server's max_concurrency=%d",
@@ -416,9 +853,15 @@ void ProcessRpcRequest(InputMessageBase* msg_base) {
             }
             svc_name = sp->service->GetDescriptor()->full_name();
         }
-        const Server::MethodProperty* mp =
-            server_accessor.FindMethodPropertyByFullName(
+        const Server::MethodProperty* mp = FindMethodPropertyByHints(
+            server_accessor, server, svc_name, request_meta.method_name());
+        if (NULL == mp) {
+            mp = server_accessor.FindMethodPropertyByFullName(
                 svc_name, request_meta.method_name());
+            if (mp != NULL) {
+                RememberMethodIndexHint(server, mp->index);
+            }
+        }
         if (NULL == mp) {
             cntl->SetFailed(ENOMETHOD, "Fail to find method=%s/%s",
                             request_meta.service_name().c_str(),
@@ -434,10 +877,24 @@ void ProcessRpcRequest(InputMessageBase* msg_base) {
         }
         // Switch to service-specific error.
         non_service_error.release();
+        TenantQuota* tenant_quota = server->options().tenant_quota;
+        if (tenant_quota != NULL && !mp->is_builtin_service &&
+            !tenant_quota->OnRequested(*cntl)) {
+            cntl->SetFailed(ELIMIT, "Rejected by tenant quota");
+            break;
+        }
+        // Runtime overrides set through /method_options, read once as an
+        // atomic snapshot applied to this whole request.
+        DynamicMethodOptions dyn_opt;
+        const bool has_dyn_opt =
+            !mp->is_builtin_service &&
+            server->method_options().Get(mp->method->full_name(), &dyn_opt);
         method_status = mp->status;
         if (method_status) {
             int rejected_cc = 0;
-            if (!method_status->OnRequested(&rejected_cc)) {
+            if (!method_status->OnRequested(
+                    &rejected_cc,
+                    has_dyn_opt ? dyn_opt.max_concurrency : -1)) {
                 cntl->SetFailed(ELIMIT, "Rejected by %s's ConcurrencyLimiter, concurrency=%d",
                                 mp->method->full_name().c_str(), rejected_cc);
                 break;
@@ -445,6 +902,10 @@ void ProcessRpcRequest(InputMessageBase* msg_base) {
         }
         google::protobuf::Service* svc = mp->service;
         const google::protobuf::MethodDescriptor* method = mp->method;
+        const RequestPriority request_priority =
+            (has_dyn_opt && dyn_opt.request_priority != REQUEST_PRIORITY_UNSET)
+            ? (RequestPriority)dyn_opt.request_priority
+            : mp->request_priority;
         accessor.set_method(method);
         if (span) {
             span->ResetServerSpanName(method->full_name());
@@ -452,7 +913,13 @@ void ProcessRpcRequest(InputMessageBase* msg_base) {
         const int reqsize = static_cast<int>(msg->payload.size());
         butil::IOBuf req_buf;
         butil::IOBuf* req_buf_ptr = &msg->payload;
-        if (meta.has_attachment_size()) {
+        if (msg->rpa != NULL) {
+            // The attachment is oversized and still being received, the
+            // payload only contains the serialized request. Let the service
+            // consume the attachment through ReadProgressiveAttachmentBy().
+            accessor.set_readable_progressive_attachment(msg->rpa.get());
+            accessor.mark_readable_progressively();
+        } else if (meta.has_attachment_size()) {
             if (reqsize < meta.attachment_size()) {
                 cntl->SetFailed(EREQUEST,
                     "attachment_size=%d is larger than request_size=%d",
@@ -464,17 +931,103 @@ void ProcessRpcRequest(InputMessageBase* msg_base) {
             req_buf_ptr = &req_buf;
             cntl->request_attachment().swap(msg->payload);
         }
+        if (FLAGS_baidu_std_save_serialized_request && msg->rpa == NULL) {
+            accessor.set_forwardable_request(*req_buf_ptr);
+        }
 
         CompressType req_cmp_type = (CompressType)meta.compress_type();
+#if GOOGLE_PROTOBUF_VERSION >= 3000000
+        if (FLAGS_server_message_arena) {
+            // The messages are owned by the arena of `cntl' and die with
+            // it, `req'/`res' must not delete them(ensured by the
+            // GetArena() checks in SendRpcResponse).
+            google::protobuf::Arena* arena = cntl->arena();
+            req.reset(svc->GetRequestPrototype(method).New(arena));
+            res.reset(svc->GetResponsePrototype(method).New(arena));
+        } else {
+            req.reset(svc->GetRequestPrototype(method).New());
+            res.reset(svc->GetResponsePrototype(method).New());
+        }
+#else
         req.reset(svc->GetRequestPrototype(method).New());
-        if (!ParseFromCompressedData(*req_buf_ptr, req.get(), req_cmp_type)) {
+        res.reset(svc->GetResponsePrototype(method).New());
+#endif
+        const butil::IOBuf* parse_buf_ptr = req_buf_ptr;
+        butil::IOBuf eager_req_buf;
+        if (!mp->params.lazy_request_fields.empty() &&
+            req_cmp_type == COMPRESS_TYPE_NONE && msg->rpa == NULL) {
+            // Cut fields declared lazy out of the request and keep their
+            // wire bytes on `cntl', the eager remainder is parsed below.
+            // `req_buf_ptr' stays complete for singleflight/forwarding.
+            std::unique_ptr<std::vector<std::pair<int, butil::IOBuf> > >
+                lazy_fields(new std::vector<std::pair<int, butil::IOBuf> >);
+            if (RemoveLazyFieldsFromIOBuf(*req_buf_ptr,
+                                          mp->params.lazy_request_fields,
+                                          &eager_req_buf,
+                                          lazy_fields.get())) {
+                if (!lazy_fields->empty()) {
+                    accessor.set_lazy_request_fields(lazy_fields.release());
+                }
+                parse_buf_ptr = &eager_req_buf;
+            }
+            // On a split failure the full parse below reports the
+            // malformed request.
+        }
+        if (!ParseFromCompressedData(*parse_buf_ptr, req.get(), req_cmp_type)) {
             cntl->SetFailed(EREQUEST, "Fail to parse request message, "
-                            "CompressType=%s, request_size=%d", 
+                            "CompressType=%s, request_size=%d",
                             CompressTypeToCStr(req_cmp_type), reqsize);
             break;
         }
-        
-        res.reset(svc->GetResponsePrototype(method).New());
+        if (!mp->interceptors.empty() &&
+            (!has_dyn_opt || dyn_opt.run_interceptors)) {
+            // Contexts are carried by `cntl', after() of the interceptors
+            // runs in SendRpcResponse just before the response is sent.
+            accessor.set_method_interceptors(&mp->interceptors);
+            if (accessor.run_before_interceptors(req.get()) != 0) {
+                break;  // cntl was set failed, respond with the error
+            }
+        }
+        SingleflightEntry* sf_entry = NULL;
+        bool sf_leader = false;
+        if (msg->rpa == NULL && accessor.remote_stream_settings() == NULL &&
+            IsSingleflightMethod(method)) {
+            sf_entry = SingleflightBegin(method, *req_buf_ptr,
+                                         cntl->request_attachment(),
+                                         &sf_leader);
+        }
+        if (sf_entry != NULL && !sf_leader) {
+            timespec abstime;
+            timespec* pabstime = NULL;
+            if (cntl->deadline_us() >= 0) {
+                abstime = butil::microseconds_to_timespec(cntl->deadline_us());
+                pabstime = &abstime;
+            }
+            const int wait_rc = sf_entry->Wait(pabstime);
+            if (wait_rc == 0) {
+                if (sf_entry->error_code != 0) {
+                    cntl->SetFailed(sf_entry->error_code, "%s",
+                                    sf_entry->error_text.c_str());
+                } else if (!ParseFromCompressedData(
+                               sf_entry->res_body, res.get(),
+                               COMPRESS_TYPE_NONE)) {
+                    cntl->SetFailed(ERESPONSE,
+                                    "Fail to parse coalesced response");
+                } else {
+                    cntl->response_attachment() = sf_entry->attachment;
+                }
+            } else {
+                // The deadline passed while waiting, same situation as the
+                // expired-deadline rejection above.
+                cntl->SetFailed(ERPCTIMEDOUT, "Deadline of the request was "
+                                "exceeded while waiting for the coalesced "
+                                "execution");
+                g_expired_request_drops << 1;
+            }
+            sf_entry->RemoveRefManually();
+            // Respond through the ordinary path with our correlation id.
+            break;
+        }
         // `socket' will be held until response has been sent
         google::protobuf::Closure* done = ::brpc::NewCallback<
             int64_t, Controller*, const google::protobuf::Message*,
@@ -483,6 +1036,9 @@ void ProcessRpcRequest(InputMessageBase* msg_base) {
                 &SendRpcResponse, meta.correlation_id(), cntl.get(), 
                 req.get(), res.get(), server,
                 method_status, msg->received_us());
+        if (sf_entry != NULL) {
+            done = new SingleflightDone(sf_entry, cntl.get(), res.get(), done);
+        }
 
         // optional, just release resourse ASAP
         msg.reset();
@@ -493,12 +1049,39 @@ void ProcessRpcRequest(InputMessageBase* msg_base) {
             span->AsParent();
         }
         if (!FLAGS_usercode_in_pthread) {
-            return svc->CallMethod(method, cntl.release(), 
-                                   req.release(), res.release(), done);
+            if (request_priority != REQUEST_PRIORITY_UNSET) {
+                CallMethodInBackupThreadArgs* args = new CallMethodInBackupThreadArgs;
+                args->service = svc;
+                args->method = method;
+                args->controller = cntl.release();
+                args->request = req.release();
+                args->response = res.release();
+                args->done = done;
+                if (PriorityLanes::GetInstance()->Submit(
+                        request_priority, CallMethodInBackupThread, args) == 0) {
+                    return;
+                }
+                // Fail to queue into the lane, run in place as an
+                // unprioritized method would.
+                cntl.reset(static_cast<Controller*>(args->controller));
+                req.reset(const_cast<google::protobuf::Message*>(args->request));
+                res.reset(args->response);
+                delete args;
+            }
+            Controller* released_cntl = cntl.release();
+            // See the comment in CallMethodInBackupThread on lifetime.
+            bthread::tls_bls.rpc_baggage = &released_cntl->request_baggage();
+            svc->CallMethod(method, released_cntl,
+                            req.release(), res.release(), done);
+            bthread::tls_bls.rpc_baggage = NULL;
+            return;
         }
         if (BeginRunningUserCode()) {
-            svc->CallMethod(method, cntl.release(), 
+            Controller* released_cntl = cntl.release();
+            bthread::tls_bls.rpc_baggage = &released_cntl->request_baggage();
+            svc->CallMethod(method, released_cntl,
                             req.release(), res.release(), done);
+            bthread::tls_bls.rpc_baggage = NULL;
             return EndRunningUserCodeInPlace();
         } else {
             return EndRunningCallMethodInPool(
@@ -568,6 +1151,7 @@ void ProcessRpcResponse(InputMessageBase* msg_base) {
     if (span) {
         span->set_base_real_us(msg->base_real_us());
         span->set_received_us(msg->received_us());
+        span->set_kernel_received_real_us(msg->kernel_received_real_us());
         span->set_response_size(msg->meta.size() + msg->payload.size() + 12);
         span->set_start_parse_us(start_parse_us);
     }
@@ -616,6 +1200,113 @@ void ProcessRpcResponse(InputMessageBase* msg_base) {
     accessor.OnResponse(cid, saved_error);
 }
 
+// On the client side, RpcMeta of different calls to one method generally
+// only differ in correlation_id and attachment_size: the request sub-message
+// and compress_type are fully determined by the method and the compression
+// choice. Cache the serialized bytes of these constant fields once per
+// (method, compress_type) and append the two per-call varint fields by hand,
+// so that hot calls do not build and serialize a protobuf message at all.
+struct MetaSkeletonKey {
+    const google::protobuf::MethodDescriptor* method;
+    int compress_type;
+};
+inline bool operator==(const MetaSkeletonKey& k1, const MetaSkeletonKey& k2) {
+    return k1.method == k2.method && k1.compress_type == k2.compress_type;
+}
+struct MetaSkeletonKeyHasher {
+    size_t operator()(const MetaSkeletonKey& key) const {
+        return butil::DefaultHasher<const void*>()(key.method) * 101
+            + key.compress_type;
+    }
+};
+
+class RpcMetaSkeletonMap {
+public:
+    RpcMetaSkeletonMap() {
+        CHECK_EQ(0, _map.init(MAP_SIZE * 2));
+    }
+
+    // Get the serialized constant part of the RpcMeta of (method,
+    // compress_type), which is built on first access and never freed, thus
+    // usable without locking. Returns NULL when the map is full.
+    const std::string* Get(const google::protobuf::MethodDescriptor* method,
+                           int compress_type) {
+        const MetaSkeletonKey key = { method, compress_type };
+        {
+            BAIDU_SCOPED_LOCK(_mutex);
+            std::string* const* ps = _map.seek(key);
+            if (ps != NULL) {
+                return *ps;
+            }
+            if (_map.size() >= MAP_SIZE) {
+                // Unlikely that a process calls that many distinct methods.
+                // New ones just take the ordinary serialization path.
+                return NULL;
+            }
+        }
+        RpcMeta meta;
+        RpcRequestMeta* request_meta = meta.mutable_request();
+        request_meta->set_service_name(FLAGS_baidu_protocol_use_fullname ?
+                                       method->service()->full_name() :
+                                       method->service()->name());
+        request_meta->set_method_name(method->name());
+        meta.set_compress_type(compress_type);
+        std::string* skeleton = new std::string;
+        CHECK(meta.SerializeToString(skeleton));
+        BAIDU_SCOPED_LOCK(_mutex);
+        std::string* const* ps = _map.seek(key);
+        if (ps != NULL) { // raced with another caller of the same method.
+            delete skeleton;
+            return *ps;
+        }
+        _map[key] = skeleton;
+        return skeleton;
+    }
+
+private:
+    static const size_t MAP_SIZE = 1024;
+    butil::Mutex _mutex;
+    butil::FlatMap<MetaSkeletonKey, std::string*, MetaSkeletonKeyHasher> _map;
+};
+
+static RpcMetaSkeletonMap* get_rpc_meta_skeleton_map() {
+    return butil::get_leaky_singleton<RpcMetaSkeletonMap>();
+}
+
+// Append the rpc header and the meta assembled from `skeleton' plus the
+// per-call fields to `out'. correlation_id(4) and attachment_size(5) have
+// larger field numbers than any field in the skeleton, so appending them
+// keeps the output byte-identical to a full serialization.
+// Returns false when the meta is too long for the on-stack buffer, in which
+// case the caller should serialize the meta in the ordinary way.
+static bool SerializeCachedRpcHeaderAndMeta(
+        butil::IOBuf* out, const std::string& skeleton,
+        uint64_t correlation_id, int attachment_size, int payload_size) {
+    using ::google::protobuf::io::CodedOutputStream;
+    int meta_size = (int)skeleton.size()
+        + 1/*tag*/ + CodedOutputStream::VarintSize64(correlation_id);
+    if (attachment_size) {
+        meta_size += 1/*tag*/ + CodedOutputStream::VarintSize32(attachment_size);
+    }
+    if (meta_size > 244) {
+        return false;
+    }
+    char header_and_meta[12 + meta_size];
+    PackRpcHeader(header_and_meta, meta_size, payload_size);
+    uint8_t* p = (uint8_t*)header_and_meta + 12;
+    memcpy(p, skeleton.data(), skeleton.size());
+    p += skeleton.size();
+    *p++ = (4 << 3); // tag of correlation_id, WIRETYPE_VARINT
+    p = CodedOutputStream::WriteVarint64ToArray(correlation_id, p);
+    if (attachment_size) {
+        *p++ = (5 << 3); // tag of attachment_size, WIRETYPE_VARINT
+        p = CodedOutputStream::WriteVarint32ToArray(attachment_size, p);
+    }
+    CHECK_EQ((char*)p, header_and_meta + sizeof(header_and_meta));
+    out->append(header_and_meta, sizeof(header_and_meta));
+    return true;
+}
+
 void PackRpcRequest(butil::IOBuf* req_buf,
                     SocketMessage**,
                     uint64_t correlation_id,
@@ -623,13 +1314,36 @@ void PackRpcRequest(butil::IOBuf* req_buf,
                     Controller* cntl,
                     const butil::IOBuf& request_body,
                     const Authenticator* auth) {
+    ControllerPrivateAccessor accessor(cntl);
+    if (FLAGS_cache_serialized_rpc_meta &&
+        !(FLAGS_baidu_std_propagate_timeout && cntl->deadline_us() >= 0) &&
+        // Baggage lives inside the request submessage of the meta and
+        // cannot be appended after the cached skeleton.
+        cntl->request_baggage().empty() &&
+        method != NULL && auth == NULL && !cntl->has_log_id() &&
+        accessor.request_stream() == INVALID_STREAM_ID &&
+        accessor.span() == NULL) {
+        const std::string* skeleton = get_rpc_meta_skeleton_map()->Get(
+            method, cntl->request_compress_type());
+        const size_t attached_size = cntl->request_attachment().length();
+        if (skeleton != NULL &&
+            SerializeCachedRpcHeaderAndMeta(
+                req_buf, *skeleton, correlation_id, (int)attached_size,
+                request_body.length() + attached_size)) {
+            AppendBody(req_buf, request_body);
+            if (attached_size) {
+                AppendBody(req_buf, cntl->request_attachment());
+            }
+            return;
+        }
+    }
+
     RpcMeta meta;
     if (auth && auth->GenerateCredential(
             meta.mutable_authentication_data()) != 0) {
         return cntl->SetFailed(EREQUEST, "Fail to generate credential");
     }
 
-    ControllerPrivateAccessor accessor(cntl);
     RpcRequestMeta* request_meta = meta.mutable_request();
     if (method) {
         request_meta->set_service_name(FLAGS_baidu_protocol_use_fullname ?
@@ -648,6 +1362,17 @@ void PackRpcRequest(butil::IOBuf* req_buf,
     if (cntl->has_log_id()) {
         request_meta->set_log_id(cntl->log_id());
     }
+    if (FLAGS_baidu_std_propagate_timeout && cntl->deadline_us() >= 0) {
+        // Remaining budget measured at pack time, thus naturally
+        // decremented hop by hop through pass-through channels.
+        const int64_t remain_ms =
+            (cntl->deadline_us() - butil::gettimeofday_us()) / 1000L;
+        request_meta->set_timeout_ms(remain_ms > 0 ? remain_ms : 1);
+    }
+    if (!cntl->request_baggage().empty()) {
+        // The serialized pairs are copied as-is, never decoded here.
+        cntl->request_baggage().copy_to(request_meta->mutable_baggage());
+    }
     meta.set_correlation_id(correlation_id);
     StreamId request_stream_id = accessor.request_stream();
     if (request_stream_id != INVALID_STREAM_ID) {
@@ -674,9 +1399,9 @@ void PackRpcRequest(butil::IOBuf* req_buf,
     }
 
     SerializeRpcHeaderAndMeta(req_buf, meta, req_size + attached_size);
-    req_buf->append(request_body);
+    AppendBody(req_buf, request_body);
     if (attached_size) {
-        req_buf->append(cntl->request_attachment());
+        AppendBody(req_buf, cntl->request_attachment());
     }
 }
 
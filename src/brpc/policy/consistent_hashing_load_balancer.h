@@ -21,9 +21,11 @@
 
 #include <stdint.h>                                     // uint32_t
 #include <functional>
+#include <memory>                                       // std::shared_ptr
 #include <vector>                                       // std::vector
 #include "butil/endpoint.h"                              // butil::EndPoint
 #include "butil/containers/doubly_buffered_data.h"
+#include "butil/containers/flat_map.h"
 #include "brpc/load_balancer.h"
 
 
@@ -64,9 +66,15 @@ public:
     LoadBalancer *New(const butil::StringPiece& params) const;
     void Destroy();
     int SelectServer(const SelectIn &in, SelectOut *out);
+    void Feedback(const CallInfo& info);
     void Describe(std::ostream &os, const DescribeOptions& options);
 
 private:
+    // Inflight requests of one server, shared by all its replicas and both
+    // buffers of _db_inflight. Only maintained when _load_factor > 0.
+    typedef std::shared_ptr<butil::atomic<int64_t> > InflightCounter;
+    typedef butil::FlatMap<SocketId, InflightCounter> InflightMap;
+
     bool SetParameters(const butil::StringPiece& params);
     void GetLoads(std::map<butil::EndPoint, double> *load_map);
     static size_t AddBatch(std::vector<Node> &bg, const std::vector<Node> &fg,
@@ -75,9 +83,21 @@ private:
                               const std::vector<ServerId> &servers, bool *executed);
     static size_t Remove(std::vector<Node> &bg, const std::vector<Node> &fg,
                          const ServerId& server, bool *executed);
+    static size_t AddInflight(InflightMap& bg, const SocketId& id,
+                              const InflightCounter& counter);
+    static size_t RemoveInflight(InflightMap& bg, const SocketId& id);
+    static bool IsOverloaded(const InflightMap& inflight, SocketId id,
+                             int64_t threshold);
     size_t _num_replicas;
     ConsistentHashingLoadBalancerType _type;
+    // When positive, skip servers whose inflight count exceeds _load_factor
+    // times the average during SelectServer, a.k.a consistent hashing with
+    // bounded loads. Collisions of hot keys spill to the next server on the
+    // ring instead of melting one backend.
+    double _load_factor;
+    butil::atomic<int64_t> _total_inflight;
     butil::DoublyBufferedData<std::vector<Node> > _db_hash_ring;
+    butil::DoublyBufferedData<InflightMap> _db_inflight;
 };
 
 }  // namespace policy
@@ -19,15 +19,84 @@
 #include "butil/build_config.h"                       // OS_MACOSX
 #include <netdb.h>                                    // gethostbyname_r
 #include <stdlib.h>                                   // strtol
+#include <map>                                        // std::map
 #include <string>                                     // std::string
+#include <gflags/gflags.h>
+#include "butil/scoped_lock.h"
+#include "butil/time.h"                               // gettimeofday_us
 #include "bthread/bthread.h"
 #include "brpc/log.h"
+#include "brpc/reloadable_flags.h"
 #include "brpc/policy/domain_naming_service.h"
 
 
 namespace brpc {
 namespace policy {
 
+DEFINE_int32(dns_cache_ttl_s, 0,
+             "Cache successfully resolved addresses of a domain for so many"
+             " seconds and share them between all channels of this process,"
+             " so that a fan-out over many channels to same domains does not"
+             " query DNS repeatedly at startup. <=0 disables the cache");
+BRPC_VALIDATE_GFLAG(dns_cache_ttl_s, PassValidate);
+
+DEFINE_int32(dns_negative_cache_ttl_s, 1,
+             "Cache resolution failures of a domain for so many seconds when"
+             " -dns_cache_ttl_s is turned on, protecting restarting processes"
+             " from hammering unreachable DNS servers. <=0 disables negative"
+             " caching");
+BRPC_VALIDATE_GFLAG(dns_negative_cache_ttl_s, PassValidate);
+
+namespace {
+struct DnsCacheEntry {
+    std::vector<butil::ip_t> ips;
+    int64_t expire_us;
+    bool failed;
+};
+typedef std::map<std::string, DnsCacheEntry> DnsCache;
+// Shared by all instances (each NamingServiceThread news its own copy of
+// this NamingService), protected by s_dns_cache_mutex. Keyed by host only:
+// channels to different ports of one domain share the entry.
+pthread_mutex_t s_dns_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+DnsCache* s_dns_cache = NULL;
+
+bool GetCachedAddresses(const std::string& host,
+                        std::vector<butil::ip_t>* ips, bool* failed) {
+    BAIDU_SCOPED_LOCK(s_dns_cache_mutex);
+    if (s_dns_cache == NULL) {
+        return false;
+    }
+    DnsCache::iterator it = s_dns_cache->find(host);
+    if (it == s_dns_cache->end()) {
+        return false;
+    }
+    if (butil::gettimeofday_us() >= it->second.expire_us) {
+        s_dns_cache->erase(it);
+        return false;
+    }
+    *ips = it->second.ips;
+    *failed = it->second.failed;
+    return true;
+}
+
+void CacheAddresses(const std::string& host,
+                    const std::vector<butil::ip_t>& ips, bool failed) {
+    const int ttl_s =
+        failed ? FLAGS_dns_negative_cache_ttl_s : FLAGS_dns_cache_ttl_s;
+    if (ttl_s <= 0) {
+        return;
+    }
+    BAIDU_SCOPED_LOCK(s_dns_cache_mutex);
+    if (s_dns_cache == NULL) {
+        s_dns_cache = new DnsCache;
+    }
+    DnsCacheEntry& entry = (*s_dns_cache)[host];
+    entry.ips = ips;
+    entry.expire_us = butil::gettimeofday_us() + ttl_s * 1000000L;
+    entry.failed = failed;
+}
+}  // namespace
+
 DomainNamingService::DomainNamingService() : _aux_buf_len(0) {}
 
 int DomainNamingService::GetServers(const char* dns_name,
@@ -76,12 +145,40 @@ int DomainNamingService::GetServers(const char* dns_name,
         return -1;
     }
 
+    std::vector<butil::ip_t> ips;
+    const bool use_cache = FLAGS_dns_cache_ttl_s > 0;
+    bool cached_failure = false;
+    if (use_cache && GetCachedAddresses(buf, &ips, &cached_failure)) {
+        if (cached_failure) {
+            RPC_VLOG << "Return cached failure of resolving `" << buf << '\'';
+            return -1;
+        }
+    } else if (ResolveHost(buf, &ips) != 0) {
+        if (use_cache) {
+            CacheAddresses(buf, ips/*empty*/, true);
+        }
+        return -1;
+    } else if (use_cache) {
+        CacheAddresses(buf, ips, false);
+    }
+
+    butil::EndPoint point;
+    point.port = port;
+    for (size_t i = 0; i < ips.size(); ++i) {
+        point.ip = ips[i];
+        servers->push_back(ServerNode(point, std::string()));
+    }
+    return 0;
+}
+
+int DomainNamingService::ResolveHost(const char* host,
+                                     std::vector<butil::ip_t>* ips) {
 #if defined(OS_MACOSX)
     _aux_buf_len = 0; // suppress unused warning
     // gethostbyname on MAC is thread-safe (with current usage) since the
     // returned hostent is TLS. Check following link for the ref:
     // https://lists.apple.com/archives/darwin-dev/2006/May/msg00008.html
-    struct hostent* result = gethostbyname(buf);
+    struct hostent* result = gethostbyname(host);
     if (result == NULL) {
         LOG(WARNING) << "result of gethostbyname is NULL";
         return -1;
@@ -98,7 +195,7 @@ int DomainNamingService::GetServers(const char* dns_name,
     do {
         result = NULL;
         error = 0;
-        ret = gethostbyname_r(buf, &ent, _aux_buf.get(), _aux_buf_len,
+        ret = gethostbyname_r(host, &ent, _aux_buf.get(), _aux_buf_len,
                               &result, &error);
         if (ret != ERANGE) { // _aux_buf is not long enough
             break;
@@ -106,11 +203,11 @@ int DomainNamingService::GetServers(const char* dns_name,
         _aux_buf_len *= 2;
         _aux_buf.reset(new char[_aux_buf_len]);
         RPC_VLOG << "Resized _aux_buf to " << _aux_buf_len
-                 << ", dns_name=" << dns_name;
+                 << ", host=" << host;
     } while (1);
     if (ret != 0) {
         // `hstrerror' is thread safe under linux
-        LOG(WARNING) << "Can't resolve `" << buf << "', return=`" << berror(ret)
+        LOG(WARNING) << "Can't resolve `" << host << "', return=`" << berror(ret)
                      << "' herror=`" << hstrerror(error) << '\'';
         return -1;
     }
@@ -120,13 +217,12 @@ int DomainNamingService::GetServers(const char* dns_name,
     }
 #endif
 
-    butil::EndPoint point;
-    point.port = port;
     for (int i = 0; result->h_addr_list[i] != NULL; ++i) {
         if (result->h_addrtype == AF_INET) {
             // Only fetch IPv4 addresses
-            bcopy(result->h_addr_list[i], &point.ip, result->h_length);
-            servers->push_back(ServerNode(point, std::string()));
+            butil::ip_t ip;
+            bcopy(result->h_addr_list[i], &ip, result->h_length);
+            ips->push_back(ip);
         } else {
             LOG(WARNING) << "Found address of unsupported protocol="
                          << result->h_addrtype;
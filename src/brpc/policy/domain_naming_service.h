@@ -20,6 +20,7 @@
 #define  BRPC_POLICY_DOMAIN_NAMING_SERVICE_H
 
 #include "brpc/periodic_naming_service.h"
+#include "butil/endpoint.h"
 #include "butil/unique_ptr.h"
 
 
@@ -37,9 +38,13 @@ private:
     void Describe(std::ostream& os, const DescribeOptions&) const override;
 
     NamingService* New() const override;
-    
+
     void Destroy() override;
 
+    // Resolve `host' into all its IPv4 addresses with the system resolver.
+    // Returns 0 on success, -1 otherwise.
+    int ResolveHost(const char* host, std::vector<butil::ip_t>* ips);
+
 private:
     std::unique_ptr<char[]> _aux_buf;
     size_t _aux_buf_len;
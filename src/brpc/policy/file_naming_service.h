@@ -23,10 +23,14 @@
 
 
 namespace brpc {
+
+class NamingServiceThread;
+
 namespace policy {
 
 class FileNamingService : public NamingService {
 friend class ConsulNamingService;
+friend class ::brpc::NamingServiceThread;
 private:
     int RunNamingService(const char* service_name,
                          NamingServiceActions* actions) override;
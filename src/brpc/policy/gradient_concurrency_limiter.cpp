@@ -0,0 +1,206 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <cmath>
+#include <gflags/gflags.h>
+#include "brpc/errno.pb.h"
+#include "brpc/policy/gradient_concurrency_limiter.h"
+
+namespace bthread {
+
+DECLARE_int32(bthread_concurrency);
+
+}  // namespace bthread
+
+namespace brpc {
+namespace policy {
+
+DEFINE_int32(gradient_cl_sample_window_size_ms, 1000,
+             "Duration of the sampling window.");
+DEFINE_int32(gradient_cl_min_sample_count, 100,
+             "During the duration of the sampling window, if the number of "
+             "requests collected is less than this value, the sampling window "
+             "will be discarded.");
+DEFINE_int32(gradient_cl_max_sample_count, 200,
+             "During the duration of the sampling window, once the number of "
+             "requests collected is greater than this value, even if the "
+             "duration of the window has not ended, the max_concurrency will "
+             "be updated and a new sampling window will be started.");
+DEFINE_double(gradient_cl_sampling_interval_ms, 0.1,
+             "Interval for sampling request in gradient concurrency limiter");
+DEFINE_int32(gradient_cl_initial_max_concurrency, 40,
+             "Initial max concurrency for gradient concurrency limiter");
+DEFINE_int32(gradient_cl_max_concurrency, 1000,
+             "The limit will never grow beyond this value.");
+DEFINE_double(gradient_cl_tolerance, 1.5,
+              "The latency of a sample window may exceed the long-term EMA "
+              "of latency by this multiple before the limit starts to "
+              "shrink. Must be >= 1.");
+DEFINE_double(gradient_cl_smoothing, 0.2,
+              "Weight of the newly computed limit when it is merged into "
+              "the current limit, the value range is 0-1. The smaller the "
+              "value, the smaller the effect of a single sample_window.");
+DEFINE_double(gradient_cl_alpha_factor_for_ema, 0.05,
+              "The smoothing coefficient used in the calculation of the "
+              "long-term EMA of latency, the value range is 0-1. The "
+              "smaller the value, the longer the effective memory.");
+DEFINE_bool(gradient_cl_enable_error_punish, true,
+            "Whether to consider failed requests when calculating the "
+            "latency of a sample window");
+DEFINE_double(gradient_cl_fail_punish_ratio, 1.0,
+              "Use the failed requests to punish normal requests. The larger "
+              "the configuration item, the more aggressive the penalty strategy.");
+
+GradientConcurrencyLimiter::GradientConcurrencyLimiter()
+    : _max_concurrency(FLAGS_gradient_cl_initial_max_concurrency)
+    , _smoothed_limit(FLAGS_gradient_cl_initial_max_concurrency)
+    , _long_rtt_us(0)
+    , _last_sampling_time_us(0) {
+}
+
+GradientConcurrencyLimiter* GradientConcurrencyLimiter::New(
+    const AdaptiveMaxConcurrency&) const {
+    return new (std::nothrow) GradientConcurrencyLimiter;
+}
+
+bool GradientConcurrencyLimiter::OnRequested(int current_concurrency) {
+    return current_concurrency <= _max_concurrency;
+}
+
+void GradientConcurrencyLimiter::OnResponded(int error_code, int64_t latency_us) {
+    if (ELIMIT == error_code) {
+        return;
+    }
+
+    const int64_t now_time_us = butil::gettimeofday_us();
+    int64_t last_sampling_time_us =
+        _last_sampling_time_us.load(butil::memory_order_relaxed);
+
+    if (last_sampling_time_us == 0 ||
+        now_time_us - last_sampling_time_us >=
+            FLAGS_gradient_cl_sampling_interval_ms * 1000) {
+        bool sample_this_call = _last_sampling_time_us.compare_exchange_strong(
+            last_sampling_time_us, now_time_us, butil::memory_order_relaxed);
+        if (sample_this_call) {
+            bool sample_window_submitted = AddSample(error_code, latency_us,
+                                                     now_time_us);
+            if (sample_window_submitted) {
+                // The following log prints has data-race in extreme cases,
+                // unless you are in debug, you should not open it.
+                VLOG(1)
+                    << "Sample window submitted, current max_concurrency:"
+                    << _max_concurrency
+                    << ", long_rtt_us:" << _long_rtt_us;
+            }
+        }
+    }
+}
+
+int GradientConcurrencyLimiter::MaxConcurrency() {
+    return _max_concurrency;
+}
+
+bool GradientConcurrencyLimiter::AddSample(int error_code,
+                                           int64_t latency_us,
+                                           int64_t sampling_time_us) {
+    std::unique_lock<butil::Mutex> lock_guard(_sw_mutex);
+    if (_sw.start_time_us == 0) {
+        _sw.start_time_us = sampling_time_us;
+    }
+
+    if (error_code != 0 && FLAGS_gradient_cl_enable_error_punish) {
+        ++_sw.failed_count;
+        _sw.total_failed_us += latency_us;
+    } else if (error_code == 0) {
+        ++_sw.succ_count;
+        _sw.total_succ_us += latency_us;
+    }
+
+    if (_sw.succ_count + _sw.failed_count < FLAGS_gradient_cl_min_sample_count) {
+        if (sampling_time_us - _sw.start_time_us >=
+            FLAGS_gradient_cl_sample_window_size_ms * 1000) {
+            // If the sample size is insufficient at the end of the sampling
+            // window, discard the entire sampling window
+            ResetSampleWindow(sampling_time_us);
+        }
+        return false;
+    }
+    if (sampling_time_us - _sw.start_time_us <
+        FLAGS_gradient_cl_sample_window_size_ms * 1000 &&
+        _sw.succ_count + _sw.failed_count < FLAGS_gradient_cl_max_sample_count) {
+        return false;
+    }
+
+    if (_sw.succ_count > 0) {
+        UpdateMaxConcurrency();
+    } else {
+        // All request failed
+        _max_concurrency = std::max(bthread::FLAGS_bthread_concurrency,
+                                    _max_concurrency / 2);
+        _smoothed_limit = _max_concurrency;
+    }
+    ResetSampleWindow(sampling_time_us);
+    return true;
+}
+
+void GradientConcurrencyLimiter::ResetSampleWindow(int64_t sampling_time_us) {
+    _sw.start_time_us = sampling_time_us;
+    _sw.succ_count = 0;
+    _sw.failed_count = 0;
+    _sw.total_failed_us = 0;
+    _sw.total_succ_us = 0;
+}
+
+void GradientConcurrencyLimiter::UpdateMaxConcurrency() {
+    const double failed_punish =
+        _sw.total_failed_us * FLAGS_gradient_cl_fail_punish_ratio;
+    const double short_rtt_us =
+        (failed_punish + _sw.total_succ_us) / _sw.succ_count;
+
+    const double ema_factor = FLAGS_gradient_cl_alpha_factor_for_ema;
+    if (_long_rtt_us <= 0) {
+        _long_rtt_us = short_rtt_us;
+    } else {
+        _long_rtt_us =
+            short_rtt_us * ema_factor + _long_rtt_us * (1 - ema_factor);
+    }
+    // When the load stays high for a long time the EMA would slowly creep
+    // up and make the high latency look normal, pull it back towards the
+    // current sample instead so that overload keeps being penalized.
+    if (_long_rtt_us > short_rtt_us * 2) {
+        _long_rtt_us = short_rtt_us * 2;
+    }
+
+    // gradient <= 1: the limit only grows through the sqrt headroom and
+    // shrinks as soon as the window latency exceeds the long-term latency
+    // by more than the tolerance.
+    const double gradient = std::max(
+        0.5, std::min(1.0, FLAGS_gradient_cl_tolerance
+                      * _long_rtt_us / short_rtt_us));
+    const double next_limit =
+        _smoothed_limit * gradient + std::sqrt(_smoothed_limit);
+    const double smoothing = FLAGS_gradient_cl_smoothing;
+    _smoothed_limit =
+        _smoothed_limit * (1 - smoothing) + next_limit * smoothing;
+    _smoothed_limit = std::max(
+        (double)bthread::FLAGS_bthread_concurrency,
+        std::min(_smoothed_limit, (double)FLAGS_gradient_cl_max_concurrency));
+    _max_concurrency = std::ceil(_smoothed_limit);
+}
+
+}  // namespace policy
+}  // namespace brpc
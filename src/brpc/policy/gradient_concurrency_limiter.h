@@ -0,0 +1,85 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef BRPC_POLICY_GRADIENT_CONCURRENCY_LIMITER_H
+#define BRPC_POLICY_GRADIENT_CONCURRENCY_LIMITER_H
+
+#include "bvar/bvar.h"
+#include "brpc/concurrency_limiter.h"
+
+namespace brpc {
+namespace policy {
+
+// An alternative to AutoConcurrencyLimiter selected with
+// ServerOptions.max_concurrency = "gradient".
+//
+// The limit is driven by the gradient between a long-term EMA of latency
+// and the latency of the current sample window:
+//   gradient = clamp(tolerance * long_rtt / short_rtt, 0.5, 1.0)
+//   next_limit = limit * gradient + sqrt(limit)
+// The sqrt(limit) headroom is what lets the limit grow, so unlike the
+// min-latency limiter there is no periodic remeasurement that halves
+// max_concurrency and dips throughput every interval.
+class GradientConcurrencyLimiter : public ConcurrencyLimiter {
+public:
+    GradientConcurrencyLimiter();
+
+    bool OnRequested(int current_concurrency) override;
+
+    void OnResponded(int error_code, int64_t latency_us) override;
+
+    int MaxConcurrency() override;
+
+    GradientConcurrencyLimiter* New(const AdaptiveMaxConcurrency&) const override;
+
+private:
+    struct SampleWindow {
+        SampleWindow()
+            : start_time_us(0)
+            , succ_count(0)
+            , failed_count(0)
+            , total_failed_us(0)
+            , total_succ_us(0) {}
+        int64_t start_time_us;
+        int32_t succ_count;
+        int32_t failed_count;
+        int64_t total_failed_us;
+        int64_t total_succ_us;
+    };
+
+    bool AddSample(int error_code, int64_t latency_us, int64_t sampling_time_us);
+
+    // The following methods are not thread safe and can only be called
+    // in AddSample()
+    void UpdateMaxConcurrency();
+    void ResetSampleWindow(int64_t sampling_time_us);
+
+    // modified per sample-window or more
+    int _max_concurrency;
+    double _smoothed_limit;
+    double _long_rtt_us;
+
+    // modified per sample.
+    butil::atomic<int64_t> BAIDU_CACHELINE_ALIGNMENT _last_sampling_time_us;
+    butil::Mutex _sw_mutex;
+    SampleWindow _sw;
+};
+
+}  // namespace policy
+}  // namespace brpc
+
+#endif // BRPC_POLICY_GRADIENT_CONCURRENCY_LIMITER_H
@@ -16,8 +16,12 @@
 // under the License.
 
 
+#include <vector>
+#include <gflags/gflags.h>
 #include <google/protobuf/io/gzip_stream.h>    // GzipXXXStream
 #include "butil/logging.h"
+#include "bthread/bthread.h"
+#include "brpc/reloadable_flags.h"
 #include "brpc/policy/gzip_compress.h"
 #include "brpc/protocol.h"
 
@@ -25,6 +29,11 @@
 namespace brpc {
 namespace policy {
 
+DEFINE_int32(gzip_parallel_chunk_bytes, 1024 * 1024,
+             "Chunk size of ParallelGzipCompress, each chunk is compressed"
+             " into an independent gzip member by its own bthread");
+BRPC_VALIDATE_GFLAG(gzip_parallel_chunk_bytes, PositiveInteger);
+
 static void LogError(const google::protobuf::io::GzipOutputStream& gzip) {
     if (gzip.ZlibErrorMessage()) {
         LOG(WARNING) << "Fail to decompress: " << gzip.ZlibErrorMessage();
@@ -141,6 +150,65 @@ inline bool GzipDecompressBase(
     return true;
 }
 
+namespace {
+struct ParallelGzipPart {
+    butil::IOBuf in;
+    butil::IOBuf out;
+    const GzipCompressOptions* options;
+    bool ok;
+};
+
+void* RunParallelGzipPart(void* arg) {
+    ParallelGzipPart* part = static_cast<ParallelGzipPart*>(arg);
+    part->ok = GzipCompress(part->in, &part->out, part->options);
+    return NULL;
+}
+}  // namespace
+
+bool ParallelGzipCompress(const butil::IOBuf& in, butil::IOBuf* out,
+                          const GzipCompressOptions* options_in) {
+    if (options_in != NULL &&
+        options_in->format != google::protobuf::io::GzipOutputStream::GZIP) {
+        LOG(ERROR) << "ParallelGzipCompress only supports the GZIP format";
+        return false;
+    }
+    const size_t chunk_bytes =
+        (size_t)std::max(FLAGS_gzip_parallel_chunk_bytes, 1);
+    if (in.size() <= chunk_bytes) {
+        return GzipCompress(in, out, options_in);
+    }
+    const size_t nparts = (in.size() + chunk_bytes - 1) / chunk_bytes;
+    std::vector<ParallelGzipPart> parts(nparts);
+    butil::IOBuf remains = in;  // only references blocks, no copying
+    for (size_t i = 0; i < nparts; ++i) {
+        remains.cutn(&parts[i].in, chunk_bytes);
+        parts[i].options = options_in;
+        parts[i].ok = false;
+    }
+    std::vector<bthread_t> tids(nparts - 1, (bthread_t)0);
+    for (size_t i = 1; i < nparts; ++i) {
+        if (bthread_start_background(&tids[i - 1], NULL,
+                                     RunParallelGzipPart, &parts[i]) != 0) {
+            tids[i - 1] = 0;
+            RunParallelGzipPart(&parts[i]);
+        }
+    }
+    // Compress the first chunk in this thread instead of idling on join.
+    RunParallelGzipPart(&parts[0]);
+    for (size_t i = 1; i < nparts; ++i) {
+        if (tids[i - 1] != 0) {
+            bthread_join(tids[i - 1], NULL);
+        }
+    }
+    for (size_t i = 0; i < nparts; ++i) {
+        if (!parts[i].ok) {
+            return false;
+        }
+        out->append(butil::IOBuf::Movable(parts[i].out));
+    }
+    return true;
+}
+
 bool ZlibCompress(const google::protobuf::Message& res, butil::IOBuf* buf) {
     butil::IOBufAsZeroCopyOutputStream wrapper(buf);
     google::protobuf::io::GzipOutputStream::Options zlib_opt;
@@ -41,6 +41,16 @@ bool ZlibDecompress(const butil::IOBuf& buf, google::protobuf::Message* msg);
 bool GzipCompress(const butil::IOBuf& in, butil::IOBuf* out,
                   const GzipCompressOptions*);
 
+// Above with `in' split into -gzip_parallel_chunk_bytes chunks compressed
+// into independent gzip members by concurrent bthreads and concatenated in
+// order (pigz-style). The output is a standard multi-member gzip stream,
+// decompressible by GzipDecompress and common http clients, slightly larger
+// than single-member output. Inputs not larger than one chunk fall back to
+// GzipCompress. The options must not specify the ZLIB format which cannot
+// be concatenated.
+bool ParallelGzipCompress(const butil::IOBuf& in, butil::IOBuf* out,
+                          const GzipCompressOptions*);
+
 // Put decompressed `in' into `out'.
 bool GzipDecompress(const butil::IOBuf& in, butil::IOBuf* out);
 bool ZlibDecompress(const butil::IOBuf& in, butil::IOBuf* out);
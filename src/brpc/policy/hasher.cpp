@@ -19,6 +19,7 @@
 #include <limits.h>
 #include <openssl/md5.h>
 #include "butil/third_party/murmurhash3/murmurhash3.h"
+#include "butil/simd_hash.h"
 #include "brpc/policy/hasher.h"
 
 
@@ -73,6 +74,10 @@ uint32_t MurmurHash32V(const butil::StringPiece* keys, size_t num_keys) {
     return hash;
 }
 
+void MurmurHash32x4(const butil::StringPiece keys[4], uint32_t out[4]) {
+    butil::simd::MurmurHash3_x86_32_x4(keys, 0, out);
+}
+
 /* The crc32 functions and data was originally written by Spencer
  * Garrett <srg@quick.com> and was gleaned from the PostgreSQL source
  * tree via the files contrib/ltree/crc32.[ch] and from FreeBSD at
@@ -35,6 +35,10 @@ uint32_t MD5Hash32V(const butil::StringPiece* keys, size_t num_keys);
 
 uint32_t MurmurHash32(const void* key, size_t len);
 uint32_t MurmurHash32V(const butil::StringPiece* keys, size_t num_keys);
+// Same results as 4 MurmurHash32 calls, hashing the keys in the lanes
+// of one vector register where SIMD is available. Used by bulk hashing
+// such as building the virtual-node ring of chash.
+void MurmurHash32x4(const butil::StringPiece keys[4], uint32_t out[4]);
 
 }  // namespace policy
 } // namespace brpc
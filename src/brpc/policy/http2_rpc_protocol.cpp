@@ -17,6 +17,7 @@
 
 
 #include "brpc/policy/http2_rpc_protocol.h"
+#include "butil/memory/singleton_on_pthread_once.h"
 #include "brpc/details/controller_private_accessor.h"
 #include "brpc/server.h"
 #include "butil/base64.h"
@@ -47,6 +48,17 @@ DEFINE_bool(h2_hpack_encode_name, false,
 DEFINE_bool(h2_hpack_encode_value, false,
             "Encode value in HTTP2 headers with huffman encoding");
 
+DEFINE_int32(h2_client_connection_num, 1,
+             "Number of HTTP2 connections to each server. New streams go to"
+             " the connection with fewest active streams; an extra connection"
+             " is brought up only when every existing one carries streams,"
+             " relieving MAX_CONCURRENT_STREAMS and head-of-line blocking");
+
+static bool CheckConnectionNum(const char*, int32_t val) {
+    return val >= 1 && (size_t)val <= Socket::MAX_AGENT_SOCKET_NUM;
+}
+BRPC_VALIDATE_GFLAG(h2_client_connection_num, CheckConnectionNum);
+
 static bool CheckStreamWindowSize(const char*, int32_t val) {
     return val >= 0;
 }
@@ -144,9 +156,50 @@ static int WriteAck(Socket* s, const void* data, size_t n) {
     sendbuf.append(data, n);
     Socket::WriteOptions wopt;
     wopt.ignore_eovercrowded = true;
+    // A delayed WINDOW_UPDATE/PING-ack stalls or even fails(GOAWAY) the
+    // connection, jump before pending DATA of other RPCs.
+    wopt.urgent = true;
     return s->Write(&sendbuf, &wopt);
 }
 
+int H2Context::WriteControlFrame(const void* data, size_t n) {
+    {
+        std::unique_lock<butil::Mutex> mu(_control_frame_mutex);
+        if (_batching_control_frames) {
+            _queued_control_frames.append(data, n);
+            return 0;
+        }
+    }
+    return WriteAck(_socket, data, n);
+}
+
+void H2Context::BeginControlFrameBatch() {
+    std::unique_lock<butil::Mutex> mu(_control_frame_mutex);
+    _batching_control_frames = true;
+}
+
+void H2Context::FlushControlFrames() {
+    butil::IOBuf sendbuf;
+    {
+        std::unique_lock<butil::Mutex> mu(_control_frame_mutex);
+        _batching_control_frames = false;
+        if (_queued_control_frames.empty()) {
+            return;
+        }
+        sendbuf.swap(_queued_control_frames);
+    }
+    Socket::WriteOptions wopt;
+    wopt.ignore_eovercrowded = true;
+    wopt.urgent = true;
+    if (_socket->Write(&sendbuf, &wopt) != 0) {
+        // The peer is likely to wait for the queued acks, fail the
+        // connection as the unbatched writes did.
+        LOG(WARNING) << "Fail to write control frames to " << *_socket;
+        _socket->SetFailed(errno, "Fail to write control frames: %s",
+                           berror(errno));
+    }
+}
+
 // [ https://tools.ietf.org/html/rfc7540#section-6.5.1 ]
 
 enum H2SettingsIdentifier {
@@ -332,7 +385,8 @@ H2Context::H2Context(Socket* socket, const Server* server)
     , _last_sent_stream_id(1)
     , _goaway_stream_id(-1)
     , _remote_settings_received(false)
-    , _deferred_window_update(0) {
+    , _deferred_window_update(0)
+    , _batching_control_frames(false) {
     // Stop printing the field which is useless for remote settings.
     _remote_settings.connection_window_size = 0;
     // Maximize the window size to make sending big request possible before
@@ -485,7 +539,7 @@ ParseResult H2Context::Consume(
             char settingsbuf[FRAME_HEAD_SIZE + H2_SETTINGS_MAX_BYTE_SIZE +
                              FRAME_HEAD_SIZE + 4/*for WU*/];
             const size_t nb = SerializeH2SettingsFrameAndWU(_unack_local_settings, settingsbuf);
-            if (WriteAck(socket, settingsbuf, nb) != 0) {
+            if (WriteControlFrame(settingsbuf, nb) != 0) {
                 LOG(WARNING) << "Fail to respond http2-client with settings to " << *socket;
                 return MakeParseError(PARSE_ERROR_ABSOLUTELY_WRONG);
             }
@@ -513,7 +567,7 @@ ParseResult H2Context::Consume(
             SerializeFrameHead(rstbuf, 4, H2_FRAME_RST_STREAM,
                                0, h2_res.stream_id());
             SaveUint32(rstbuf + FRAME_HEAD_SIZE, h2_res.error());
-            if (WriteAck(_socket, rstbuf, sizeof(rstbuf)) != 0) {
+            if (WriteControlFrame(rstbuf, sizeof(rstbuf)) != 0) {
                 LOG(WARNING) << "Fail to send RST_STREAM to " << *_socket;
                 return MakeParseError(PARSE_ERROR_ABSOLUTELY_WRONG);
             }
@@ -534,7 +588,7 @@ ParseResult H2Context::Consume(
             SerializeFrameHead(goawaybuf, 8, H2_FRAME_GOAWAY, 0, 0);
             SaveUint32(goawaybuf + FRAME_HEAD_SIZE, _last_received_stream_id);
             SaveUint32(goawaybuf + FRAME_HEAD_SIZE + 4, h2_res.error());
-            if (WriteAck(_socket, goawaybuf, sizeof(goawaybuf)) != 0) {
+            if (WriteControlFrame(goawaybuf, sizeof(goawaybuf)) != 0) {
                 LOG(WARNING) << "Fail to send GOAWAY to " << *_socket;
                 return MakeParseError(PARSE_ERROR_ABSOLUTELY_WRONG);
             }
@@ -764,7 +818,7 @@ H2ParseResult H2StreamContext::OnData(
             const int64_t conn_wu = stream_wu + _conn_ctx->ReleaseDeferredWindowUpdate();
             SerializeFrameHead(p, 4, H2_FRAME_WINDOW_UPDATE, 0, 0);
             SaveUint32(p + FRAME_HEAD_SIZE, conn_wu);
-            if (WriteAck(_conn_ctx->_socket, winbuf, sizeof(winbuf)) != 0) {
+            if (_conn_ctx->WriteControlFrame(winbuf, sizeof(winbuf)) != 0) {
                 LOG(WARNING) << "Fail to send WINDOW_UPDATE to " << *_conn_ctx->_socket;
                 return MakeH2Error(H2_INTERNAL_ERROR);
             }
@@ -906,7 +960,7 @@ H2ParseResult H2Context::OnSettings(
     // Respond with ack
     char headbuf[FRAME_HEAD_SIZE];
     SerializeFrameHead(headbuf, 0, H2_FRAME_SETTINGS, H2_FLAGS_ACK, 0);
-    if (WriteAck(_socket, headbuf, sizeof(headbuf)) != 0) {
+    if (WriteControlFrame(headbuf, sizeof(headbuf)) != 0) {
         LOG(WARNING) << "Fail to respond settings with ack to " << *_socket;
         return MakeH2Error(H2_PROTOCOL_ERROR);
     }
@@ -942,7 +996,7 @@ H2ParseResult H2Context::OnPing(
     char pongbuf[FRAME_HEAD_SIZE + 8];
     SerializeFrameHead(pongbuf, 8, H2_FRAME_PING, H2_FLAGS_ACK, 0);
     it.copy_and_forward(pongbuf + FRAME_HEAD_SIZE, 8);
-    if (WriteAck(_socket, pongbuf, sizeof(pongbuf)) != 0) {
+    if (WriteControlFrame(pongbuf, sizeof(pongbuf)) != 0) {
         LOG(WARNING) << "Fail to send ack of PING to " << *_socket;
         return MakeH2Error(H2_PROTOCOL_ERROR);
     }
@@ -1085,7 +1139,7 @@ void H2Context::DeferWindowUpdate(int64_t size) {
             char winbuf[FRAME_HEAD_SIZE + 4];
             SerializeFrameHead(winbuf, 4, H2_FRAME_WINDOW_UPDATE, 0, 0);
             SaveUint32(winbuf + FRAME_HEAD_SIZE, conn_wu);
-            if (WriteAck(_socket, winbuf, sizeof(winbuf)) != 0) {
+            if (WriteControlFrame(winbuf, sizeof(winbuf)) != 0) {
                 LOG(WARNING) << "Fail to send WINDOW_UPDATE";
             }
         }
@@ -1120,6 +1174,9 @@ ParseResult ParseH2Message(butil::IOBuf *source, Socket *socket,
     butil::IOBufBytesIterator it(*source);
     size_t last_bytes_left = it.bytes_left();
     CHECK_EQ(last_bytes_left, source->size());
+    // Acks to frames consumed below are coalesced into one write issued
+    // before returning, instead of one write per incoming frame.
+    ctx->BeginControlFrameBatch();
     while (true) {
         ParseResult res = ctx->Consume(it, socket);
         if (res.is_ok()) {
@@ -1131,6 +1188,7 @@ ParseResult ParseH2Message(butil::IOBuf *source, Socket *socket,
         }
         source->pop_front(source->size() - last_bytes_left);
         ctx->ClearAbandonedStreams();
+        ctx->FlushControlFrames();
         return res;
     }
 }
@@ -1232,6 +1290,21 @@ int H2StreamContext::ConsumeHeaders(butil::IOBufBytesIterator& it) {
         if (rc == 0) {
             break;
         }
+        if (FLAGS_http_verbose) {
+            butil::IOBufBuilder* vs = this->_vmsgbuilder;
+            if (vs == NULL) {
+                vs = new butil::IOBufBuilder;
+                this->_vmsgbuilder = vs;
+                if (_conn_ctx->is_server_side()) {
+                    *vs << "[ H2 REQUEST @" << butil::my_ip() << " ]";
+                } else {
+                    *vs << "[ H2 RESPONSE @" << butil::my_ip() << " ]";
+                }
+            }
+            // print \n first to be consistent with code in http_message.cpp
+            *vs << "\n< " << pair.name << " = " << pair.value;
+        }
+
         const char* const name = pair.name.c_str();
         bool matched = false;
         if (name[0] == ':') { // reserved names
@@ -1287,22 +1360,7 @@ int H2StreamContext::ConsumeHeaders(butil::IOBufBytesIterator& it) {
             h.set_content_type(pair.value);
         } else {
             // TODO: AppendHeader?
-            h.SetHeader(pair.name, pair.value);
-        }
-
-        if (FLAGS_http_verbose) {
-            butil::IOBufBuilder* vs = this->_vmsgbuilder;
-            if (vs == NULL) {
-                vs = new butil::IOBufBuilder;
-                this->_vmsgbuilder = vs;
-                if (_conn_ctx->is_server_side()) {
-                    *vs << "[ H2 REQUEST @" << butil::my_ip() << " ]";
-                } else {
-                    *vs << "[ H2 RESPONSE @" << butil::my_ip() << " ]";
-                }
-            }
-            // print \n first to be consistent with code in http_message.cpp
-            *vs << "\n< " << pair.name << " = " << pair.value;
+            h.SetHeader(std::move(pair.name), std::move(pair.value));
         }
     }
     return 0;
@@ -1636,11 +1694,42 @@ void H2UnsentRequest::Print(std::ostream& os) const {
 
 }
 
+// Header-block fragments of the canonical gRPC response, pre-encoded with
+// HPACK_NOT_INDEX_HEADER so that they involve no dynamic table on either
+// side and can be appended to streams of any connection as-is. Encoding
+// flags (-h2_hpack_encode_*) are read once at the first use.
+struct GrpcOkFragments {
+    GrpcOkFragments() {
+        HPacker hpacker;
+        CHECK_EQ(0, hpacker.Init(H2Settings::DEFAULT_HEADER_TABLE_SIZE));
+        HPackOptions options;
+        options.index_policy = HPACK_NOT_INDEX_HEADER;
+        options.encode_name = FLAGS_h2_hpack_encode_name;
+        options.encode_value = FLAGS_h2_hpack_encode_value;
+        const CommonStrings* const common = get_common_strings();
+        butil::IOBufAppender appender;
+        hpacker.Encode(&appender, HPacker::Header(
+                           common->H2_STATUS, common->STATUS_200), options);
+        hpacker.Encode(&appender, HPacker::Header(
+                           common->CONTENT_TYPE, common->CONTENT_TYPE_GRPC),
+                       options);
+        appender.move_to(ok_headers);
+        hpacker.Encode(&appender, HPacker::Header(
+                           common->GRPC_STATUS, "0"), options);
+        appender.move_to(ok_trailer);
+    }
+    // :status 200 + content-type: application/grpc
+    butil::IOBuf ok_headers;
+    // grpc-status: 0
+    butil::IOBuf ok_trailer;
+};
+
 H2UnsentResponse::H2UnsentResponse(Controller* c, int stream_id, bool is_grpc)
     : _size(0)
     , _stream_id(stream_id)
     , _http_response(c->release_http_response())
-    , _is_grpc(is_grpc) {
+    , _is_grpc(is_grpc)
+    , _use_grpc_ok_fragment(false) {
     _data.swap(c->response_attachment());
     if (is_grpc) {
         _grpc_status = ErrorCodeToGrpcStatus(c->ErrorCode());
@@ -1657,6 +1746,13 @@ H2UnsentResponse* H2UnsentResponse::New(Controller* c, int stream_id, bool is_gr
     const size_t memsize = offsetof(H2UnsentResponse, _list) +
         sizeof(HPacker::Header) * maxsize;
     H2UnsentResponse* msg = new (malloc(memsize)) H2UnsentResponse(c, stream_id, is_grpc);
+    if (is_grpc && h->status_code() == 200 &&
+        h->content_type() == common->CONTENT_TYPE_GRPC) {
+        // Matches the pre-encoded fragments, skip per-response encoding of
+        // these headers in AppendAndDestroySelf.
+        msg->_use_grpc_ok_fragment = true;
+        return msg;
+    }
     // :status
     if (h->status_code() == 200) {
         msg->push(common->H2_STATUS, common->STATUS_200);
@@ -1716,6 +1812,14 @@ H2UnsentResponse::AppendAndDestroySelf(butil::IOBuf* out, Socket* socket) {
     options.encode_name = FLAGS_h2_hpack_encode_name;
     options.encode_value = FLAGS_h2_hpack_encode_value;
 
+    const GrpcOkFragments* grpc_frags = NULL;
+    if (_use_grpc_ok_fragment) {
+        // The common OK response: append the pre-encoded bytes instead of
+        // running hpack on identical headers again. Pseudo-headers stay
+        // first because the fragment is appended before user headers.
+        grpc_frags = butil::get_leaky_singleton<GrpcOkFragments>();
+        appender.buf().append(grpc_frags->ok_headers);
+    }
     for (size_t i = 0; i < _size; ++i) {
         hpacker.Encode(&appender, _list[i], options);
     }
@@ -1731,14 +1835,21 @@ H2UnsentResponse::AppendAndDestroySelf(butil::IOBuf* out, Socket* socket) {
 
     butil::IOBuf trailer_frag;
     if (_is_grpc) {
-        HPacker::Header status_header("grpc-status",
-                                      butil::string_printf("%d", _grpc_status));
-        hpacker.Encode(&appender, status_header, options);
-        if (!_grpc_message.empty()) {
-            HPacker::Header msg_header("grpc-message", _grpc_message);
-            hpacker.Encode(&appender, msg_header, options);
+        if (_grpc_status == GRPC_OK && _grpc_message.empty()) {
+            if (grpc_frags == NULL) {
+                grpc_frags = butil::get_leaky_singleton<GrpcOkFragments>();
+            }
+            trailer_frag.append(grpc_frags->ok_trailer);
+        } else {
+            HPacker::Header status_header("grpc-status",
+                                          butil::string_printf("%d", _grpc_status));
+            hpacker.Encode(&appender, status_header, options);
+            if (!_grpc_message.empty()) {
+                HPacker::Header msg_header("grpc-message", _grpc_message);
+                hpacker.Encode(&appender, msg_header, options);
+            }
+            appender.move_to(trailer_frag);
         }
-        appender.move_to(trailer_frag);
     }
 
     PackH2Message(out, frag, trailer_frag, _data, _stream_id, ctx);
@@ -1808,12 +1919,58 @@ void PackH2Request(butil::IOBuf*,
 
 static bool IsH2SocketValid(Socket* s) {
     H2Context* c = static_cast<H2Context*>(s->parsing_context());
-    return (c == NULL || !c->RunOutStreams());
+    // A connection in GOAWAY rejects new streams but must stay up until
+    // streams at or below the last accepted id have drained; routing new
+    // streams elsewhere while GetAgentSocket() replaces the slot gives
+    // exactly that.
+    return (c == NULL ||
+            (!c->RunOutStreams() && c->state() != H2_CONNECTION_GOAWAY));
+}
+
+// Pick the h2 connection carrying fewest active streams among the agent
+// slots of `*inout', bringing up a new connection only when every usable
+// one is busy (and -h2_client_connection_num is not reached yet).
+// Returns 0 on success with `*inout' replaced by the picked connection.
+static int GetLeastLoadedH2Socket(SocketUniquePtr* inout) {
+    size_t num = (size_t)FLAGS_h2_client_connection_num;
+    if (num > Socket::MAX_AGENT_SOCKET_NUM) {
+        num = Socket::MAX_AGENT_SOCKET_NUM;
+    }
+    if (num <= 1) {
+        return (*inout)->GetAgentSocket(inout, IsH2SocketValid);
+    }
+    SocketUniquePtr best;
+    size_t best_load = std::numeric_limits<size_t>::max();
+    size_t first_empty = num;
+    for (size_t i = 0; i < num; ++i) {
+        SocketUniquePtr tmp;
+        if ((*inout)->PeekAgentSocket(&tmp, i) != 0 ||
+            tmp->Failed() || !IsH2SocketValid(tmp.get())) {
+            if (first_empty == num) {
+                first_empty = i;
+            }
+            continue;
+        }
+        H2Context* c = static_cast<H2Context*>(tmp->parsing_context());
+        const size_t load = (c != NULL ? c->VolatilePendingStreamSize() : 0);
+        if (load < best_load) {
+            best_load = load;
+            best.swap(tmp);
+        }
+    }
+    if (best != NULL && (best_load == 0 || first_empty >= num)) {
+        inout->swap(best);
+        return 0;
+    }
+    // Either no usable connection yet or all of them are busy: create or
+    // replace the first empty/invalid slot.
+    return (*inout)->GetAgentSocket(
+        inout, first_empty < num ? first_empty : 0, IsH2SocketValid);
 }
 
 StreamUserData* H2GlobalStreamCreator::OnCreatingStream(
         SocketUniquePtr* inout, Controller* cntl) {
-    if ((*inout)->GetAgentSocket(inout, IsH2SocketValid) != 0) {
+    if (GetLeastLoadedH2Socket(inout) != 0) {
         cntl->SetFailed(EINTERNAL, "Fail to create agent socket");
         return NULL;
     }
@@ -220,6 +220,9 @@ private:
     std::unique_ptr<HttpHeader> _http_response;
     butil::IOBuf _data;
     bool _is_grpc;
+    // True when the response matches the pre-encoded canonical gRPC header
+    // fragments (status 200 + application/grpc), bypassing hpack encoding.
+    bool _use_grpc_ok_fragment;
     GrpcStatus _grpc_status;
     std::string _grpc_message;
     HPacker::Header _list[0];
@@ -230,6 +233,11 @@ class H2StreamContext : public HttpContext {
 public:
     H2StreamContext(bool read_body_progressively);
     ~H2StreamContext();
+
+    // @SharedObject
+    // H2 stream contexts are not pooled (unlike HttpContext), delete as
+    // before.
+    void BeforeRecycled() { delete this; }
     void Init(H2Context* conn_ctx, int stream_id);
 
     // Decode headers in HPACK from *it and set into this->header(). The input
@@ -351,11 +359,25 @@ public:
     void DeferWindowUpdate(int64_t);
     int64_t ReleaseDeferredWindowUpdate();
 
+    // Write a small control frame(SETTINGS/PING ack, WINDOW_UPDATE,
+    // RST_STREAM, GOAWAY) of `n' bytes to the connection. Inside a parse
+    // pass the frame is queued and coalesced with control frames of other
+    // streams into one write issued at the end of the pass, otherwise it
+    // is written out immediately.
+    // Returns 0 on success, -1 otherwise.
+    int WriteControlFrame(const void* data, size_t n);
+
 private:
 friend class H2StreamContext;
 friend class H2UnsentRequest;
 friend class H2UnsentResponse;
 friend void InitFrameHandlers();
+friend ParseResult ParseH2Message(butil::IOBuf*, Socket*, bool, const void*);
+
+    // Called by ParseH2Message around Consume() to batch control frames
+    // written during one parse pass. @WriteControlFrame
+    void BeginControlFrameBatch();
+    void FlushControlFrames();
 
     ParseResult ConsumeFrameHead(butil::IOBufBytesIterator&, H2FrameHead*);
 
@@ -395,6 +417,9 @@ friend void InitFrameHandlers();
     mutable butil::Mutex _stream_mutex;
     StreamMap _pending_streams;
     butil::atomic<int64_t> _deferred_window_update;
+    mutable butil::Mutex _control_frame_mutex;
+    butil::IOBuf _queued_control_frames;
+    bool _batching_control_frames;
 };
 
 inline int H2Context::AllocateClientStreamId() {
@@ -22,11 +22,15 @@
 #include <json2pb/json_to_pb.h>                    // JsonToProtoMessage
 
 #include "butil/unique_ptr.h"                       // std::unique_ptr
+#include "butil/object_pool.h"                      // butil::get_object
+#include "butil/containers/mru_cache.h"             // butil::MRUCache
+#include "butil/thread_local.h"                     // thread_atexit
 #include "butil/string_splitter.h"                  // StringMultiSplitter
 #include "butil/string_printf.h"
 #include "butil/time.h"
 #include "butil/sys_byteorder.h"
 #include "brpc/compress.h"
+#include "brpc/reloadable_flags.h"             // BRPC_VALIDATE_GFLAG
 #include "brpc/errno.pb.h"                     // ENOSERVICE, ENOMETHOD
 #include "brpc/controller.h"                   // Controller
 #include "brpc/server.h"                       // Server
@@ -34,6 +38,7 @@
 #include "brpc/span.h"
 #include "brpc/socket.h"                       // Socket
 #include "brpc/http_status_code.h"             // HTTP_STATUS_*
+#include "brpc/tenant_quota.h"                 // TenantQuota
 #include "brpc/details/controller_private_accessor.h"
 #include "brpc/builtin/index_service.h"        // IndexService
 #include "brpc/policy/gzip_compress.h"
@@ -61,6 +66,20 @@ DEFINE_int32(http_max_error_length, 2048, "Max printed length of a http error");
 DEFINE_int32(http_body_compress_threshold, 512, "Not compress http body when "
              "it's less than so many bytes.");
 
+DEFINE_int64(http_parallel_gzip_threshold_bytes, -1, "Compress http response "
+             "bodies not smaller than so many bytes with ParallelGzipCompress "
+             "(multi-member gzip stitched from chunks compressed by concurrent "
+             "bthreads). Negative values always compress in the calling "
+             "thread.");
+BRPC_VALIDATE_GFLAG(http_parallel_gzip_threshold_bytes, PassValidate);
+
+DEFINE_int32(http_uri_resolution_cache_size, 128,
+             "Max number of URI paths whose path->method resolution results "
+             "are cached in each worker, skipping repeated path matching "
+             "(incl. restful mappings) for the few hot paths that most HTTP "
+             "services see. <=0 disables the cache");
+BRPC_VALIDATE_GFLAG(http_uri_resolution_cache_size, PassValidate);
+
 DEFINE_string(http_header_of_user_ip, "", "http requests sent by proxies may "
               "set the client ip in http headers. When this flag is non-empty, "
               "brpc will read ip:port from the specified header for "
@@ -131,6 +150,7 @@ CommonStrings::CommonStrings()
     , H2_METHOD(":method")
     , METHOD_GET("GET")
     , METHOD_POST("POST")
+    , CONTENT_TYPE_GRPC("application/grpc")
     , TE("te")
     , TRAILERS("trailers")
     , GRPC_ENCODING("grpc-encoding")
@@ -237,15 +257,16 @@ static bool RemoveGrpcPrefix(butil::IOBuf* body, bool* compressed) {
         *compressed = false;
         return true;
     }
-    const size_t sz = body->size();
-    if (sz < (size_t)5) {
+    // Unary calls carry exactly one message, streamed bodies go through
+    // ParseGrpcMessages() instead.
+    butil::IOBufBytesIterator it(*body);
+    GrpcMessage msg;
+    if (ParseGrpcMessage(it, &msg) != 0 || it.bytes_left() != 0) {
         return false;
     }
-    char buf[5];
-    body->cutn(buf, sizeof(buf));
-    *compressed = buf[0];
-    const size_t message_length = butil::NetToHost32(*(uint32_t*)(buf + 1));
-    return (message_length + 5 == sz);
+    *compressed = msg.compressed;
+    body->swap(msg.data);
+    return true;
 }
 
 void ProcessHttpResponse(InputMessageBase* msg) {
@@ -279,6 +300,7 @@ void ProcessHttpResponse(InputMessageBase* msg) {
     if (span) {
         span->set_base_real_us(msg->base_real_us());
         span->set_received_us(msg->received_us());
+        span->set_kernel_received_real_us(msg->kernel_received_real_us());
         // TODO: changing when imsg_guard->read_body_progressively() is true
         span->set_response_size(imsg_guard->parsed_length());
         span->set_start_parse_us(start_parse_us);
@@ -835,7 +857,12 @@ HttpResponseSender::~HttpResponseSender() {
             && (is_http2 || SupportGzip(cntl))) {
             TRACEPRINTF("Compressing response=%lu", (unsigned long)response_size);
             butil::IOBuf tmpbuf;
-            if (GzipCompress(cntl->response_attachment(), &tmpbuf, NULL)) {
+            const bool compress_ok =
+                (FLAGS_http_parallel_gzip_threshold_bytes >= 0 &&
+                 response_size >= (size_t)FLAGS_http_parallel_gzip_threshold_bytes)
+                ? ParallelGzipCompress(cntl->response_attachment(), &tmpbuf, NULL)
+                : GzipCompress(cntl->response_attachment(), &tmpbuf, NULL);
+            if (compress_ok) {
                 cntl->response_attachment().swap(tmpbuf);
                 if (is_grpc) {
                     grpc_compressed = true;
@@ -1004,10 +1031,9 @@ FindMethodPropertyByURIImpl(const std::string& uri_path, const Server* server,
     return NULL;
 }
 
-// Used in UT, don't be static
-const Server::MethodProperty*
-FindMethodPropertyByURI(const std::string& uri_path, const Server* server,
-                        std::string* unresolved_path) {
+static const Server::MethodProperty*
+FindMethodPropertyByURINoCache(const std::string& uri_path, const Server* server,
+                               std::string* unresolved_path) {
     const Server::MethodProperty* mp =
         FindMethodPropertyByURIImpl(uri_path, server, unresolved_path);
     if (mp != NULL) {
@@ -1029,6 +1055,90 @@ FindMethodPropertyByURI(const std::string& uri_path, const Server* server,
     return NULL;
 }
 
+// Thread-local cache of resolved URI paths: most HTTP services receive
+// nearly all requests on a handful of distinct paths, re-matching them
+// against service/method/restful maps on every request is wasted work.
+// Being thread-local avoids any locking on the hot path; entries are
+// dropped when the process-wide method-resolution version moves on
+// (server (re)started or services changed).
+struct UriResolutionEntry {
+    const Server* server;
+    const Server::MethodProperty* mp;
+    std::string unresolved_path;
+};
+struct UriResolutionCache {
+    typedef butil::MRUCache<std::string, UriResolutionEntry> CacheMap;
+
+    UriResolutionCache() : map(CacheMap::NO_AUTO_EVICT), version(0) {}
+
+    CacheMap map;
+    uint64_t version;
+    // Reused between lookups to save allocations of the key.
+    std::string reused_key;
+};
+static BAIDU_THREAD_LOCAL UriResolutionCache* tls_uri_cache = NULL;
+
+static void DeleteUriResolutionCache(void* arg) {
+    delete static_cast<UriResolutionCache*>(arg);
+}
+
+// Used in UT, don't be static
+const Server::MethodProperty*
+FindMethodPropertyByURI(const std::string& uri_path, const Server* server,
+                        std::string* unresolved_path) {
+    if (FLAGS_http_uri_resolution_cache_size <= 0 || unresolved_path == NULL) {
+        return FindMethodPropertyByURINoCache(uri_path, server, unresolved_path);
+    }
+    UriResolutionCache* cache = tls_uri_cache;
+    if (cache == NULL) {
+        cache = new (std::nothrow) UriResolutionCache;
+        if (cache == NULL) {
+            return FindMethodPropertyByURINoCache(
+                uri_path, server, unresolved_path);
+        }
+        butil::thread_atexit(DeleteUriResolutionCache, cache);
+        tls_uri_cache = cache;
+    }
+    const uint64_t version = GetMethodResolutionVersion();
+    if (cache->version != version) {
+        cache->map.Clear();
+        cache->version = version;
+    }
+    cache->reused_key.assign(uri_path);
+    UriResolutionCache::CacheMap::iterator it = cache->map.Get(cache->reused_key);
+    if (it != cache->map.end() && it->second.server == server) {
+        *unresolved_path = it->second.unresolved_path;
+        return it->second.mp;
+    }
+    const Server::MethodProperty* mp =
+        FindMethodPropertyByURINoCache(uri_path, server, unresolved_path);
+    if (mp != NULL) {
+        // Negative results are not cached: they're either errors which
+        // need no speed-up or handled by fuzzy patterns whose matching
+        // may depend on more than the path.
+        UriResolutionEntry entry;
+        entry.server = server;
+        entry.mp = mp;
+        entry.unresolved_path = *unresolved_path;
+        cache->map.Put(cache->reused_key, entry);
+        cache->map.ShrinkToSize((size_t)FLAGS_http_uri_resolution_cache_size);
+    }
+    return mp;
+}
+
+void HttpContext::BeforeRecycled() {
+    _is_stage2 = false;
+    // The ref owned by the socket (if any) was dropped before ref count
+    // hit zero, but play safe against contexts recycled without Destroy().
+    SocketUniquePtr sock(ReleaseSocket());
+    // Reset to the state of a newly constructed context, including the
+    // "one ref for Destroy" taken in the constructor, so that get_object()
+    // hands it out as-is.
+    Reset();
+    AddRefManually();
+    butil::return_object(this);
+}
+
 ParseResult ParseHttpMessage(butil::IOBuf *source, Socket *socket,
                              bool read_eof, const void* /*arg*/) {
     HttpContext* http_imsg = 
@@ -1044,11 +1154,14 @@ ParseResult ParseHttpMessage(butil::IOBuf *source, Socket *socket,
             //    source is likely to be empty.
             return MakeParseError(PARSE_ERROR_NOT_ENOUGH_DATA);
         }
-        http_imsg = new (std::nothrow) HttpContext(socket->is_read_progressive());
+        http_imsg = butil::get_object<HttpContext>(socket->is_read_progressive());
         if (http_imsg == NULL) {
-            LOG(FATAL) << "Fail to new HttpContext";
+            LOG(FATAL) << "Fail to get HttpContext";
             return MakeParseError(PARSE_ERROR_NO_RESOURCE);
         }
+        // Recycled contexts keep the flag of the connection they served
+        // before, which may differ.
+        http_imsg->set_read_body_progressively(socket->is_read_progressive());
         // Parsing http is costly, parsing an incomplete http message from the
         // beginning repeatedly should be avoided, otherwise the cost may reach
         // O(n^2) in the worst case. Save incomplete http messages in sockets
@@ -1290,6 +1403,7 @@ void ProcessHttpRequest(InputMessageBase *msg) {
         span->set_log_id(cntl->log_id());
         span->set_remote_side(user_addr);
         span->set_received_us(msg->received_us());
+        span->set_kernel_received_real_us(msg->kernel_received_real_us());
         span->set_start_parse_us(start_parse_us);
         span->set_protocol(is_http2 ? PROTOCOL_H2 : PROTOCOL_HTTP);
         span->set_request_size(imsg_guard->parsed_length());
@@ -1342,6 +1456,12 @@ void ProcessHttpRequest(InputMessageBase *msg) {
     }
     // Switch to service-specific error.
     non_service_error.release();
+    TenantQuota* tenant_quota = server->options().tenant_quota;
+    if (tenant_quota != NULL && !sp->is_builtin_service &&
+        !tenant_quota->OnRequested(*cntl)) {
+        cntl->SetFailed(ELIMIT, "Rejected by tenant quota");
+        return;
+    }
     MethodStatus* method_status = sp->status;
     resp_sender.set_method_status(method_status);
     if (method_status) {
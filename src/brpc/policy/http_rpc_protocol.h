@@ -112,6 +112,12 @@ public:
         return SetBodyReader(r);
     }
 
+protected:
+    // @SharedObject
+    // Recycle into a butil::ObjectPool instead of deletion so that the
+    // header map and parser buffers keep their capacity across messages.
+    void BeforeRecycled();
+
 private:
     bool _is_stage2;
 };
@@ -0,0 +1,183 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifdef BRPC_WITH_LZ4
+
+#include <lz4frame.h>
+#include "butil/logging.h"
+#include "brpc/policy/lz4_compress.h"
+#include "brpc/protocol.h"
+
+
+namespace brpc {
+namespace policy {
+
+bool LZ4Compress(const butil::IOBuf& in, butil::IOBuf* out) {
+    LZ4F_compressionContext_t cctx = NULL;
+    size_t rc = LZ4F_createCompressionContext(&cctx, LZ4F_VERSION);
+    if (LZ4F_isError(rc)) {
+        LOG(WARNING) << "Fail to LZ4F_createCompressionContext: "
+                     << LZ4F_getErrorName(rc);
+        return false;
+    }
+    LZ4F_preferences_t prefs;
+    memset(&prefs, 0, sizeof(prefs));
+    prefs.frameInfo.contentSize = in.size();
+    bool success = false;
+    do {
+        // `scratch' is the destination of one LZ4F_compress* call and is
+        // appended to `out' afterwards. The input IOBuf is walked block by
+        // block without being flattened. 64 extra bytes cover the frame
+        // header produced by LZ4F_compressBegin.
+        std::string scratch;
+        scratch.resize(LZ4F_compressBound(0, &prefs) + 64);
+        rc = LZ4F_compressBegin(cctx, &scratch[0], scratch.size(), &prefs);
+        if (LZ4F_isError(rc)) {
+            LOG(WARNING) << "Fail to LZ4F_compressBegin: "
+                         << LZ4F_getErrorName(rc);
+            break;
+        }
+        out->append(scratch.data(), rc);
+        butil::IOBufAsZeroCopyInputStream in_stream(in);
+        const void* data = NULL;
+        int size = 0;
+        bool failed = false;
+        while (in_stream.Next(&data, &size)) {
+            const size_t bound = LZ4F_compressBound(size, &prefs);
+            if (scratch.size() < bound) {
+                scratch.resize(bound);
+            }
+            rc = LZ4F_compressUpdate(cctx, &scratch[0], scratch.size(),
+                                     data, size, NULL);
+            if (LZ4F_isError(rc)) {
+                LOG(WARNING) << "Fail to LZ4F_compressUpdate: "
+                             << LZ4F_getErrorName(rc);
+                failed = true;
+                break;
+            }
+            out->append(scratch.data(), rc);
+        }
+        if (failed) {
+            break;
+        }
+        rc = LZ4F_compressEnd(cctx, &scratch[0], scratch.size(), NULL);
+        if (LZ4F_isError(rc)) {
+            LOG(WARNING) << "Fail to LZ4F_compressEnd: "
+                         << LZ4F_getErrorName(rc);
+            break;
+        }
+        out->append(scratch.data(), rc);
+        success = true;
+    } while (false);
+    LZ4F_freeCompressionContext(cctx);
+    return success;
+}
+
+bool LZ4Decompress(const butil::IOBuf& in, butil::IOBuf* out) {
+    LZ4F_decompressionContext_t dctx = NULL;
+    size_t rc = LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION);
+    if (LZ4F_isError(rc)) {
+        LOG(WARNING) << "Fail to LZ4F_createDecompressionContext: "
+                     << LZ4F_getErrorName(rc);
+        return false;
+    }
+    butil::IOBufAsZeroCopyInputStream in_stream(in);
+    butil::IOBufAsZeroCopyOutputStream out_stream(out);
+    const char* src = NULL;
+    size_t src_size = 0;
+    size_t src_pos = 0;
+    char* dst = NULL;
+    size_t dst_size = 0;
+    size_t dst_pos = 0;
+    bool input_exhausted = false;
+    bool success = true;
+    // LZ4F_decompress returns 0 when the frame is fully decoded.
+    rc = 1;
+    do {
+        if (src_pos == src_size && !input_exhausted) {
+            const void* data = NULL;
+            int size = 0;
+            if (in_stream.Next(&data, &size)) {
+                src = (const char*)data;
+                src_size = size;
+                src_pos = 0;
+            } else {
+                input_exhausted = true;
+            }
+        }
+        if (dst_pos == dst_size) {
+            void* data = NULL;
+            int size = 0;
+            if (!out_stream.Next(&data, &size)) {
+                success = false;
+                break;
+            }
+            dst = (char*)data;
+            dst_size = size;
+            dst_pos = 0;
+        }
+        size_t dst_n = dst_size - dst_pos;
+        size_t src_n = src_size - src_pos;
+        rc = LZ4F_decompress(dctx, dst + dst_pos, &dst_n,
+                             src + src_pos, &src_n, NULL);
+        if (LZ4F_isError(rc)) {
+            LOG(WARNING) << "Fail to LZ4F_decompress: "
+                         << LZ4F_getErrorName(rc);
+            success = false;
+            break;
+        }
+        src_pos += src_n;
+        dst_pos += dst_n;
+        // Loop until the input is consumed and the decoder has flushed
+        // everything(it may still buffer data when dst was filled up).
+    } while (!input_exhausted || src_pos < src_size || dst_pos == dst_size);
+    if (success) {
+        if (dst_size > dst_pos) {
+            out_stream.BackUp(dst_size - dst_pos);
+        }
+        // rc is 0 iff the frame was completely decoded, otherwise the
+        // input was truncated.
+        success = (rc == 0);
+    }
+    LZ4F_freeDecompressionContext(dctx);
+    return success;
+}
+
+bool LZ4Compress(const google::protobuf::Message& msg, butil::IOBuf* buf) {
+    butil::IOBuf serialized_pb;
+    butil::IOBufAsZeroCopyOutputStream wrapper(&serialized_pb);
+    if (msg.SerializeToZeroCopyStream(&wrapper)) {
+        return LZ4Compress(serialized_pb, buf);
+    }
+    LOG(WARNING) << "Fail to serialize input pb=" << &msg;
+    return false;
+}
+
+bool LZ4Decompress(const butil::IOBuf& data, google::protobuf::Message* msg) {
+    butil::IOBuf binary_pb;
+    if (LZ4Decompress(data, &binary_pb)) {
+        return ParsePbFromIOBuf(msg, binary_pb);
+    }
+    LOG(WARNING) << "Fail to LZ4Decompress, size=" << data.size();
+    return false;
+}
+
+}  // namespace policy
+} // namespace brpc
+
+#endif // BRPC_WITH_LZ4
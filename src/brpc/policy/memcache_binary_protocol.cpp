@@ -52,6 +52,7 @@ static pthread_once_t supported_cmd_map_once = PTHREAD_ONCE_INIT;
 static void InitSupportedCommandMap() {
     butil::bit_array_clear(supported_cmd_map, 256);
     butil::bit_array_set(supported_cmd_map, MC_BINARY_GET);
+    butil::bit_array_set(supported_cmd_map, MC_BINARY_GETKQ);
     butil::bit_array_set(supported_cmd_map, MC_BINARY_SET);
     butil::bit_array_set(supported_cmd_map, MC_BINARY_ADD);
     butil::bit_array_set(supported_cmd_map, MC_BINARY_REPLACE);
@@ -137,6 +138,11 @@ ParseResult ParseMemcacheMessage(butil::IOBuf* source,
             DestroyingPtr<MostCommonMessage> auth_msg(
                  static_cast<MostCommonMessage*>(socket->release_parsing_context()));
             socket->GivebackPipelinedInfo(pi);
+        } else if (header->command == MC_BINARY_GETKQ) {
+            // A quiet response (hit of a MultiGet) is always followed by
+            // more responses until the terminating noop, don't count it
+            // against the pipelined operations.
+            socket->GivebackPipelinedInfo(pi);
         } else {
             if (++msg->pi.count >= pi.count) {
                 CHECK_EQ(msg->pi.count, pi.count);
@@ -168,6 +174,7 @@ void ProcessMemcacheResponse(InputMessageBase* msg_base) {
     if (span) {
         span->set_base_real_us(msg->base_real_us());
         span->set_received_us(msg->received_us());
+        span->set_kernel_received_real_us(msg->kernel_received_real_us());
         span->set_response_size(msg->meta.length());
         span->set_start_parse_us(start_parse_us);
     }
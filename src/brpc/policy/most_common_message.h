@@ -20,7 +20,9 @@
 #define BRPC_POLICY_MOST_COMMON_MESSAGE_H
 
 #include "butil/object_pool.h"
+#include "butil/intrusive_ptr.hpp"
 #include "brpc/input_messenger.h"
+#include "brpc/progressive_reader.h"
 
 
 namespace brpc {
@@ -34,6 +36,10 @@ struct BAIDU_CACHELINE_ALIGNMENT MostCommonMessage : public InputMessageBase {
     butil::IOBuf meta;
     butil::IOBuf payload;
     PipelinedInfo pi;
+    // Set by protocols that hand out the message before its whole body
+    // arrived(e.g. baidu_std with -baidu_std_streaming_attachment_threshold),
+    // holding the part that is still being received.
+    butil::intrusive_ptr<ReadableProgressiveAttachment> rpa;
 
     inline static MostCommonMessage* Get() {
         return butil::get_object<MostCommonMessage>();
@@ -44,6 +50,7 @@ struct BAIDU_CACHELINE_ALIGNMENT MostCommonMessage : public InputMessageBase {
         meta.clear();
         payload.clear();
         pi.reset();
+        rpa.reset();
         butil::return_object(this);
     }
 };
@@ -125,6 +125,7 @@ void ProcessNovaResponse(InputMessageBase* msg_base) {
     if (span) {
         span->set_base_real_us(msg->base_real_us());
         span->set_received_us(msg->received_us());
+        span->set_kernel_received_real_us(msg->kernel_received_real_us());
         span->set_response_size(msg->meta.size() + msg->payload.size());
         span->set_start_parse_us(start_parse_us);
     }
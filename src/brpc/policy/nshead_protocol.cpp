@@ -44,7 +44,8 @@ NsheadClosure::NsheadClosure(void* additional_space)
     : _server(NULL)
     , _received_us(0)
     , _do_respond(true)
-    , _additional_space(additional_space) {
+    , _additional_space(additional_space)
+    , _method_status(NULL) {
 }
 
 NsheadClosure::~NsheadClosure() {
@@ -73,7 +74,7 @@ void NsheadClosure::Run() {
         span->set_start_send_us(butil::cpuwide_time_us());
     }
     Socket* sock = accessor.get_sending_socket();
-    MethodStatus* method_status = _server->options().nshead_service->_status;
+    MethodStatus* method_status = _method_status;
     ConcurrencyRemover concurrency_remover(method_status, &_controller, _received_us);
     if (!method_status) {
         // Judge errors belongings.
@@ -170,6 +171,9 @@ ParseResult ParseNsheadMessage(butil::IOBuf* source,
 
 struct CallMethodInBackupThreadArgs {
     NsheadService* service;
+    // Handler registered by NsheadService::AddMethod() for the request,
+    // NULL to call the virtual ProcessNsheadRequest() instead.
+    NsheadMethodProcessor processor;
     const Server* server;
     Controller* controller;
     const NsheadMessage* request;
@@ -179,13 +183,19 @@ struct CallMethodInBackupThreadArgs {
 
 static void CallMethodInBackupThread(void* void_args) {
     CallMethodInBackupThreadArgs* args = (CallMethodInBackupThreadArgs*)void_args;
-    args->service->ProcessNsheadRequest(*args->server, args->controller,
-                                        *args->request, args->response,
-                                        args->done);
+    if (args->processor != NULL) {
+        args->processor(args->service, *args->server, args->controller,
+                        *args->request, args->response, args->done);
+    } else {
+        args->service->ProcessNsheadRequest(*args->server, args->controller,
+                                            *args->request, args->response,
+                                            args->done);
+    }
     delete args;
 }
 
 static void EndRunningCallMethodInPool(NsheadService* service,
+                                       NsheadMethodProcessor processor,
                                        const Server& server,
                                        Controller* controller,
                                        const NsheadMessage& request,
@@ -193,6 +203,7 @@ static void EndRunningCallMethodInPool(NsheadService* service,
                                        NsheadClosure* done) {
     CallMethodInBackupThreadArgs* args = new CallMethodInBackupThreadArgs;
     args->service = service;
+    args->processor = processor;
     args->server = &server;
     args->controller = controller;
     args->request = &request;
@@ -231,11 +242,7 @@ void ProcessNsheadRequest(InputMessageBase* msg_base) {
 
     // Switch to service-specific error.
     non_service_error.release();
-    MethodStatus* method_status = service->_status;
-    if (method_status) {
-        CHECK(method_status->OnRequested());
-    }
-    
+
     void* sub_space = NULL;
     if (service->_additional_space) {
         sub_space = (char*)space + sizeof(NsheadClosure);
@@ -249,7 +256,21 @@ void ProcessNsheadRequest(InputMessageBase* msg_base) {
     msg->payload.swap(req->body);
     nshead_done->_received_us = msg->received_us();
     nshead_done->_server = server;
-    
+
+    // Resolve the handler registered for the request, if any, and account
+    // the request on its own status rather than the service-level one.
+    const NsheadService::NsheadMethodProperty* selected_method = NULL;
+    if (service->_methods != NULL) {
+        selected_method = service->_methods->seek(
+            service->GetMethodSelector(*req));
+    }
+    MethodStatus* method_status =
+        (selected_method ? selected_method->status : service->_status);
+    nshead_done->_method_status = method_status;
+    if (method_status) {
+        CHECK(method_status->OnRequested());
+    }
+
     ServerPrivateAccessor server_accessor(server);
     ControllerPrivateAccessor accessor(cntl);
     const bool security_mode = server->options().security_mode() &&
@@ -280,6 +301,7 @@ void ProcessNsheadRequest(InputMessageBase* msg_base) {
         span->set_remote_side(cntl->remote_side());
         span->set_protocol(PROTOCOL_NSHEAD);
         span->set_received_us(msg->received_us());
+        span->set_kernel_received_real_us(msg->kernel_received_real_us());
         span->set_start_parse_us(start_parse_us);
         span->set_request_size(sizeof(nshead_t) + req_head->body_len);
     }
@@ -309,19 +331,30 @@ void ProcessNsheadRequest(InputMessageBase* msg_base) {
 
     msg.reset();  // optional, just release resourse ASAP
     if (span) {
-        span->ResetServerSpanName(service->_cached_name);
+        span->ResetServerSpanName(selected_method != NULL ?
+                                  selected_method->name :
+                                  service->_cached_name);
         span->set_start_callback_us(butil::cpuwide_time_us());
         span->AsParent();
     }
+    NsheadMethodProcessor processor =
+        (selected_method ? selected_method->processor : NULL);
     if (!FLAGS_usercode_in_pthread) {
+        if (processor != NULL) {
+            return processor(service, *server, cntl, *req, res, nshead_done);
+        }
         return service->ProcessNsheadRequest(*server, cntl, *req, res, nshead_done);
     }
     if (BeginRunningUserCode()) {
-        service->ProcessNsheadRequest(*server, cntl, *req, res, nshead_done);
+        if (processor != NULL) {
+            processor(service, *server, cntl, *req, res, nshead_done);
+        } else {
+            service->ProcessNsheadRequest(*server, cntl, *req, res, nshead_done);
+        }
         return EndRunningUserCodeInPlace();
     } else {
         return EndRunningCallMethodInPool(
-            service, *server, cntl, *req, res, nshead_done);
+            service, processor, *server, cntl, *req, res, nshead_done);
     }
 }
 
@@ -344,6 +377,7 @@ void ProcessNsheadResponse(InputMessageBase* msg_base) {
     if (span) {
         span->set_base_real_us(msg->base_real_us());
         span->set_received_us(msg->received_us());
+        span->set_kernel_received_real_us(msg->kernel_received_real_us());
         span->set_response_size(msg->payload.length());
         span->set_start_parse_us(start_parse_us);
     }
@@ -0,0 +1,241 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <algorithm>                                   // std::max
+#include "butil/fast_rand.h"
+#include "butil/time.h"
+#include "brpc/socket.h"
+#include "brpc/policy/power_of_two_choices_load_balancer.h"
+
+namespace brpc {
+namespace policy {
+
+// Number of sampled pairs tried before degenerating to a linear scan.
+// Both servers of a pair being excluded/unavailable is rare, resampling
+// a couple of times keeps the scan off the common path.
+static const int P2C_MAX_SAMPLES = 3;
+
+// Peek at the borrowed socket to skip failed or unavailable servers without
+// the refcounting in Address(). The result may be stale, thus the addressed
+// socket still needs to be checked afterwards.
+inline bool ProbeAvailable(SocketId id) {
+    Socket* const probe = Socket::AddressBorrowed(id);
+    return probe != NULL && probe->IsAvailable();
+}
+
+bool PowerOfTwoChoicesLoadBalancer::Add(Servers& bg, const ServerId& id) {
+    if (bg.server_list.capacity() < 128) {
+        bg.server_list.reserve(128);
+    }
+    std::map<SocketId, size_t>::iterator it = bg.server_map.find(id.id);
+    if (it != bg.server_map.end()) {
+        return false;
+    }
+    Server server;
+    server.id = id;
+    // Both buffers and re-adds within one Modify share the stats through
+    // the shared_ptr, never reset an existing counter here.
+    server.stats = std::make_shared<ServerStats>();
+    bg.server_map[id.id] = bg.server_list.size();
+    bg.server_list.push_back(server);
+    return true;
+}
+
+bool PowerOfTwoChoicesLoadBalancer::Remove(Servers& bg, const ServerId& id) {
+    std::map<SocketId, size_t>::iterator it = bg.server_map.find(id.id);
+    if (it != bg.server_map.end()) {
+        const size_t index = it->second;
+        bg.server_list[index] = bg.server_list.back();
+        bg.server_map[bg.server_list[index].id.id] = index;
+        bg.server_list.pop_back();
+        bg.server_map.erase(it);
+        return true;
+    }
+    return false;
+}
+
+size_t PowerOfTwoChoicesLoadBalancer::BatchAdd(
+    Servers& bg, const std::vector<ServerId>& servers) {
+    size_t count = 0;
+    for (size_t i = 0; i < servers.size(); ++i) {
+        count += !!Add(bg, servers[i]);
+    }
+    return count;
+}
+
+size_t PowerOfTwoChoicesLoadBalancer::BatchRemove(
+    Servers& bg, const std::vector<ServerId>& servers) {
+    size_t count = 0;
+    for (size_t i = 0; i < servers.size(); ++i) {
+        count += !!Remove(bg, servers[i]);
+    }
+    return count;
+}
+
+bool PowerOfTwoChoicesLoadBalancer::AddServer(const ServerId& id) {
+    return _db_servers.Modify(Add, id);
+}
+
+bool PowerOfTwoChoicesLoadBalancer::RemoveServer(const ServerId& id) {
+    return _db_servers.Modify(Remove, id);
+}
+
+size_t PowerOfTwoChoicesLoadBalancer::AddServersInBatch(
+    const std::vector<ServerId>& servers) {
+    const size_t n = _db_servers.Modify(BatchAdd, servers);
+    LOG_IF(ERROR, n != servers.size())
+        << "Fail to AddServersInBatch, expected " << servers.size()
+        << " actually " << n;
+    return n;
+}
+
+size_t PowerOfTwoChoicesLoadBalancer::RemoveServersInBatch(
+    const std::vector<ServerId>& servers) {
+    const size_t n = _db_servers.Modify(BatchRemove, servers);
+    LOG_IF(ERROR, n != servers.size())
+        << "Fail to RemoveServersInBatch, expected " << servers.size()
+        << " actually " << n;
+    return n;
+}
+
+int64_t PowerOfTwoChoicesLoadBalancer::Score(const ServerStats& stats) {
+    // Before the first feedback latency is 0, scoring by inflight alone
+    // so that new servers are explored instead of flooded.
+    const int64_t latency =
+        std::max<int64_t>(stats.latency_us.load(butil::memory_order_relaxed), 1);
+    return latency * (stats.inflight.load(butil::memory_order_relaxed) + 1);
+}
+
+int PowerOfTwoChoicesLoadBalancer::SelectServer(
+    const SelectIn& in, SelectOut* out) {
+    butil::DoublyBufferedData<Servers>::ScopedPtr s;
+    if (_db_servers.Read(&s) != 0) {
+        return ENOMEM;
+    }
+    const size_t n = s->server_list.size();
+    if (n == 0) {
+        return ENODATA;
+    }
+    for (int attempt = 0; attempt < P2C_MAX_SAMPLES; ++attempt) {
+        size_t i1 = butil::fast_rand_less_than(n);
+        size_t i2 = i1;
+        if (n > 1) {
+            i2 = butil::fast_rand_less_than(n - 1);
+            if (i2 >= i1) {
+                ++i2;
+            }
+        }
+        const Server* pair[2] = { &s->server_list[i1], &s->server_list[i2] };
+        if (Score(*pair[1]->stats) < Score(*pair[0]->stats)) {
+            std::swap(pair[0], pair[1]);
+        }
+        for (int k = 0; k < 2; ++k) {
+            const Server& cand = *pair[k];
+            if (!ExcludedServers::IsExcluded(in.excluded, cand.id.id)
+                && ProbeAvailable(cand.id.id)
+                && Socket::Address(cand.id.id, out->ptr) == 0
+                && (*out->ptr)->IsAvailable()) {
+                cand.stats->inflight.fetch_add(1, butil::memory_order_relaxed);
+                out->need_feedback = true;
+                return 0;
+            }
+        }
+    }
+    // Unlucky with sampling, walk the whole list as other policies do.
+    size_t offset = butil::fast_rand_less_than(n);
+    for (size_t i = 0; i < n; ++i) {
+        const Server& cand = s->server_list[offset];
+        if (((i + 1) == n  // always take last chance
+             || !ExcludedServers::IsExcluded(in.excluded, cand.id.id))
+            && ProbeAvailable(cand.id.id)
+            && Socket::Address(cand.id.id, out->ptr) == 0
+            && (*out->ptr)->IsAvailable()) {
+            cand.stats->inflight.fetch_add(1, butil::memory_order_relaxed);
+            out->need_feedback = true;
+            return 0;
+        }
+        offset = (offset + 1) % n;
+    }
+    return EHOSTDOWN;
+}
+
+void PowerOfTwoChoicesLoadBalancer::Feedback(const CallInfo& info) {
+    butil::DoublyBufferedData<Servers>::ScopedPtr s;
+    if (_db_servers.Read(&s) != 0) {
+        return;
+    }
+    std::map<SocketId, size_t>::const_iterator
+        it = s->server_map.find(info.server_id);
+    if (it == s->server_map.end()) {
+        // The server was removed between selection and feedback, its
+        // stats are gone with it.
+        return;
+    }
+    ServerStats& stats = *s->server_list[it->second].stats;
+    stats.inflight.fetch_sub(1, butil::memory_order_relaxed);
+    const int64_t latency = butil::gettimeofday_us() - info.begin_time_us;
+    if (latency >= 0) {
+        // EWMA with alpha=1/4. Racing feedbacks may drop an update which
+        // is fine for an estimate. Failed RPCs are counted with their
+        // elapsed time as well, consistently-failing servers are handled
+        // by health checking rather than scores.
+        const int64_t old = stats.latency_us.load(butil::memory_order_relaxed);
+        stats.latency_us.store(old ? old + (latency - old) / 4 : latency,
+                               butil::memory_order_relaxed);
+    }
+}
+
+PowerOfTwoChoicesLoadBalancer* PowerOfTwoChoicesLoadBalancer::New(
+    const butil::StringPiece& params) const {
+    if (!params.empty()) {
+        LOG(ERROR) << "p2c load balancer does not support parameters";
+        return NULL;
+    }
+    return new (std::nothrow) PowerOfTwoChoicesLoadBalancer;
+}
+
+void PowerOfTwoChoicesLoadBalancer::Destroy() {
+    delete this;
+}
+
+void PowerOfTwoChoicesLoadBalancer::Describe(
+    std::ostream& os, const DescribeOptions& options) {
+    if (!options.verbose) {
+        os << "p2c";
+        return;
+    }
+    os << "PowerOfTwoChoices{";
+    butil::DoublyBufferedData<Servers>::ScopedPtr s;
+    if (_db_servers.Read(&s) != 0) {
+        os << "fail to read _db_servers";
+    } else {
+        os << "n=" << s->server_list.size() << ':';
+        for (size_t i = 0; i < s->server_list.size(); ++i) {
+            const Server& server = s->server_list[i];
+            os << ' ' << server.id << '('
+               << "latency=" << server.stats->latency_us.load(
+                   butil::memory_order_relaxed)
+               << "us inflight=" << server.stats->inflight.load(
+                   butil::memory_order_relaxed) << ')';
+        }
+    }
+    os << '}';
+}
+
+}  // namespace policy
+} // namespace brpc
@@ -0,0 +1,86 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef BRPC_POLICY_POWER_OF_TWO_CHOICES_LOAD_BALANCER_H
+#define BRPC_POLICY_POWER_OF_TWO_CHOICES_LOAD_BALANCER_H
+
+#include <memory>                                      // std::shared_ptr
+#include <vector>                                      // std::vector
+#include <map>                                         // std::map
+#include "butil/containers/doubly_buffered_data.h"
+#include "brpc/load_balancer.h"
+
+namespace brpc {
+namespace policy {
+
+// This LoadBalancer samples two servers randomly per selection and picks
+// the one with the lower (EWMA latency x (inflight + 1)), a.k.a the
+// power-of-two-choices strategy. Reacts to bursty load skews faster and
+// much more cheaply than the weight tree maintained by "la": feedbacks
+// only touch two relaxed atomics of the answering server, no lock.
+class PowerOfTwoChoicesLoadBalancer : public LoadBalancer {
+public:
+    bool AddServer(const ServerId& id);
+    bool RemoveServer(const ServerId& id);
+    size_t AddServersInBatch(const std::vector<ServerId>& servers);
+    size_t RemoveServersInBatch(const std::vector<ServerId>& servers);
+    int SelectServer(const SelectIn& in, SelectOut* out);
+    void Feedback(const CallInfo& info);
+    PowerOfTwoChoicesLoadBalancer* New(const butil::StringPiece&) const;
+    void Destroy();
+    void Describe(std::ostream& os, const DescribeOptions&);
+
+private:
+    // Shared by both buffers of _db_servers so that counts survive
+    // membership changes. Updated with relaxed atomics, the balancer only
+    // needs them to be approximately right.
+    struct ServerStats {
+        ServerStats() : inflight(0), latency_us(0) {}
+        butil::atomic<int64_t> inflight;
+        butil::atomic<int64_t> latency_us;  // EWMA, 0 until first feedback
+    };
+    typedef std::shared_ptr<ServerStats> StatsPtr;
+
+    struct Server {
+        ServerId id;
+        StatsPtr stats;
+    };
+    struct Servers {
+        std::vector<Server> server_list;
+        std::map<SocketId, size_t> server_map;
+    };
+
+    // Expected remaining work on the server: what the next response would
+    // cost (EWMA latency) multiplied by how many are already waiting.
+    // Servers without any feedback yet score lowest so new servers are
+    // explored quickly.
+    static int64_t Score(const ServerStats& stats);
+
+    static bool Add(Servers& bg, const ServerId& id);
+    static bool Remove(Servers& bg, const ServerId& id);
+    static size_t BatchAdd(Servers& bg, const std::vector<ServerId>& servers);
+    static size_t BatchRemove(Servers& bg, const std::vector<ServerId>& servers);
+
+    butil::DoublyBufferedData<Servers> _db_servers;
+};
+
+}  // namespace policy
+} // namespace brpc
+
+
+#endif  // BRPC_POLICY_POWER_OF_TWO_CHOICES_LOAD_BALANCER_H
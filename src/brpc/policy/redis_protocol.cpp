@@ -96,6 +96,15 @@ int ConsumeCommand(RedisConnContext* ctx,
             snprintf(buf, sizeof(buf), "ERR unknown command `%s`", args[0].as_string().c_str());
             output.SetError(buf);
         } else {
+            if (ctx->batched_size == 0) {
+                // Not in a transaction(checked above) nor a batch: let the
+                // handler append the reply directly, skipping the
+                // RedisReply tree for simple replies.
+                RedisInlineReplyWriter writer(appender);
+                if (ch->RunInline(args, &writer)) {
+                    return 0;
+                }
+            }
             result = ch->Run(args, &output, flush_batched);
             if (result == REDIS_CMD_CONTINUE) {
                 if (ctx->batched_size != 0) {
@@ -265,6 +274,7 @@ void ProcessRedisResponse(InputMessageBase* msg_base) {
     if (span) {
         span->set_base_real_us(msg->base_real_us());
         span->set_received_us(msg->received_us());
+        span->set_kernel_received_real_us(msg->kernel_received_real_us());
         span->set_response_size(msg->response.ByteSize());
         span->set_start_parse_us(start_parse_us);
     }
@@ -33,6 +33,14 @@ inline uint32_t GenRandomStride() {
     return prime_offset[butil::fast_rand_less_than(ARRAY_SIZE(prime_offset))];
 }
 
+// Peek at the borrowed socket to skip failed or unavailable servers without
+// the refcounting in Address(). The result may be stale, thus the addressed
+// socket still needs to be checked afterwards.
+inline bool ProbeAvailable(SocketId id) {
+    Socket* const probe = Socket::AddressBorrowed(id);
+    return probe != NULL && probe->IsAvailable();
+}
+
 bool RoundRobinLoadBalancer::Add(Servers& bg, const ServerId& id) {
     if (bg.server_list.capacity() < 128) {
         bg.server_list.reserve(128);
@@ -128,6 +136,7 @@ int RoundRobinLoadBalancer::SelectServer(const SelectIn& in, SelectOut* out) {
         const SocketId id = s->server_list[tls.offset].id;
         if (((i + 1) == n  // always take last chance
              || !ExcludedServers::IsExcluded(in.excluded, id))
+            && ProbeAvailable(id)
             && Socket::Address(id, out->ptr) == 0
             && (*out->ptr)->IsAvailable()) {
             s.tls() = tls;
@@ -16,7 +16,13 @@
 // under the License.
 
 
+#include <stdlib.h>                            // malloc, free
+#include <string.h>                            // memcpy, memcmp
+#include <algorithm>                           // std::min
+#include <new>                                 // std::nothrow
 #include "butil/logging.h"
+#include "butil/crc32c.h"
+#include "butil/thread_local.h"                // thread_atexit
 #include "butil/third_party/snappy/snappy.h"
 #include "brpc/policy/snappy_compress.h"
 #include "brpc/protocol.h"
@@ -60,5 +66,246 @@ bool SnappyDecompress(const butil::IOBuf& in, butil::IOBuf* out) {
     return butil::snappy::Uncompress(&source, &sink);
 }
 
+// ===== Snappy framing format =====
+// See butil/third_party/snappy/framing_format.txt for the layout. Each
+// chunk starts with 1 byte of type and a 3-byte little-endian length.
+
+// Max uncompressed bytes in one chunk, required by the framing format.
+static const size_t FRAMED_MAX_UNCOMPRESSED_CHUNK = 65536;
+// Fragments not shorter than this are compressed directly from the block
+// backing the IOBuf, shorter ones are coalesced into the TLS scratch
+// first to avoid producing many tiny chunks.
+static const size_t FRAMED_MIN_DIRECT_FRAGMENT = 4096;
+
+static const char FRAMED_STREAM_ID[10] =
+    { '\xff', '\x06', '\x00', '\x00', 's', 'N', 'a', 'P', 'p', 'Y' };
+
+static const unsigned char FRAMED_CHUNK_COMPRESSED = 0x00;
+static const unsigned char FRAMED_CHUNK_UNCOMPRESSED = 0x01;
+static const unsigned char FRAMED_CHUNK_STREAM_ID = 0xff;
+
+// Scratch buffers for compressing/uncompressing one chunk, cached in TLS
+// so that the hot path does not allocate. ~142K per thread that (un)compresses.
+struct FramedScratch {
+    char* uncompressed;  // FRAMED_MAX_UNCOMPRESSED_CHUNK bytes
+    char* compressed;    // MaxCompressedLength(FRAMED_MAX_UNCOMPRESSED_CHUNK)
+};
+static BAIDU_THREAD_LOCAL FramedScratch* tls_framed_scratch = NULL;
+
+static void delete_framed_scratch(void* arg) {
+    FramedScratch* s = static_cast<FramedScratch*>(arg);
+    free(s->uncompressed);
+    free(s->compressed);
+    delete s;
+    tls_framed_scratch = NULL;
+}
+
+static FramedScratch* get_framed_scratch() {
+    FramedScratch* s = tls_framed_scratch;
+    if (s == NULL) {
+        s = new (std::nothrow) FramedScratch;
+        if (s == NULL) {
+            return NULL;
+        }
+        s->uncompressed = (char*)malloc(FRAMED_MAX_UNCOMPRESSED_CHUNK);
+        s->compressed = (char*)malloc(
+            butil::snappy::MaxCompressedLength(FRAMED_MAX_UNCOMPRESSED_CHUNK));
+        if (s->uncompressed == NULL || s->compressed == NULL) {
+            free(s->uncompressed);
+            free(s->compressed);
+            delete s;
+            return NULL;
+        }
+        butil::thread_atexit(delete_framed_scratch, s);
+        tls_framed_scratch = s;
+    }
+    return s;
+}
+
+// Compress [data, data+n) as one chunk and append it to `out'. Falls back
+// to an uncompressed chunk when snappy does not shrink the data.
+static void AppendFramedChunk(butil::IOBuf* out, char* compressed_scratch,
+                              const char* data, size_t n) {
+    const uint32_t masked_crc =
+        butil::crc32c::Mask(butil::crc32c::Value(data, n));
+    size_t compressed_len = 0;
+    butil::snappy::RawCompress(data, n, compressed_scratch, &compressed_len);
+    const char* body = NULL;
+    size_t body_len = 0;
+    char header[8];
+    if (compressed_len < n) {
+        header[0] = FRAMED_CHUNK_COMPRESSED;
+        body = compressed_scratch;
+        body_len = compressed_len;
+    } else {
+        header[0] = FRAMED_CHUNK_UNCOMPRESSED;
+        body = data;
+        body_len = n;
+    }
+    const uint32_t chunk_len = body_len + 4/*crc*/;
+    header[1] = chunk_len & 0xff;
+    header[2] = (chunk_len >> 8) & 0xff;
+    header[3] = (chunk_len >> 16) & 0xff;
+    header[4] = masked_crc & 0xff;
+    header[5] = (masked_crc >> 8) & 0xff;
+    header[6] = (masked_crc >> 16) & 0xff;
+    header[7] = (masked_crc >> 24) & 0xff;
+    out->append(header, sizeof(header));
+    out->append(body, body_len);
+}
+
+bool SnappyFramedCompress(const butil::IOBuf& in, butil::IOBuf* out) {
+    FramedScratch* scratch = get_framed_scratch();
+    if (scratch == NULL) {
+        LOG(WARNING) << "Fail to allocate scratch for framed snappy";
+        return false;
+    }
+    out->append(FRAMED_STREAM_ID, sizeof(FRAMED_STREAM_ID));
+    size_t pending = 0;  // bytes coalesced in scratch->uncompressed.
+    const size_t nblock = in.backing_block_num();
+    for (size_t i = 0; i < nblock; ++i) {
+        butil::StringPiece f = in.backing_block(i);
+        while (!f.empty()) {
+            if (pending == 0 && f.size() >= FRAMED_MIN_DIRECT_FRAGMENT) {
+                // Compress directly from the backing block, no copying.
+                const size_t n =
+                    std::min(f.size(), FRAMED_MAX_UNCOMPRESSED_CHUNK);
+                AppendFramedChunk(out, scratch->compressed, f.data(), n);
+                f.remove_prefix(n);
+                continue;
+            }
+            const size_t n =
+                std::min(f.size(), FRAMED_MAX_UNCOMPRESSED_CHUNK - pending);
+            memcpy(scratch->uncompressed + pending, f.data(), n);
+            pending += n;
+            f.remove_prefix(n);
+            if (pending == FRAMED_MAX_UNCOMPRESSED_CHUNK) {
+                AppendFramedChunk(out, scratch->compressed,
+                                  scratch->uncompressed, pending);
+                pending = 0;
+            }
+        }
+    }
+    if (pending > 0) {
+        AppendFramedChunk(out, scratch->compressed,
+                          scratch->uncompressed, pending);
+    }
+    return true;
+}
+
+bool SnappyFramedDecompress(const butil::IOBuf& in, butil::IOBuf* out) {
+    FramedScratch* scratch = get_framed_scratch();
+    if (scratch == NULL) {
+        LOG(WARNING) << "Fail to allocate scratch for framed snappy";
+        return false;
+    }
+    butil::IOBuf rest = in;
+    bool saw_stream_id = false;
+    while (!rest.empty()) {
+        char header[4];
+        if (rest.cutn(header, sizeof(header)) != sizeof(header)) {
+            LOG(WARNING) << "Truncated chunk header";
+            return false;
+        }
+        const unsigned char type = header[0];
+        const uint32_t chunk_len = (uint8_t)header[1]
+            | ((uint8_t)header[2] << 8) | ((uint8_t)header[3] << 16);
+        if (rest.length() < chunk_len) {
+            LOG(WARNING) << "Truncated chunk, type=" << (int)type
+                         << " len=" << chunk_len;
+            return false;
+        }
+        if (!saw_stream_id && type != FRAMED_CHUNK_STREAM_ID) {
+            LOG(WARNING) << "Not started with the stream identifier";
+            return false;
+        }
+        if (type == FRAMED_CHUNK_STREAM_ID) {
+            char id[6];
+            if (chunk_len != sizeof(id) ||
+                rest.cutn(id, sizeof(id)) != sizeof(id) ||
+                memcmp(id, "sNaPpY", sizeof(id)) != 0) {
+                LOG(WARNING) << "Invalid stream identifier";
+                return false;
+            }
+            saw_stream_id = true;
+        } else if (type == FRAMED_CHUNK_COMPRESSED ||
+                   type == FRAMED_CHUNK_UNCOMPRESSED) {
+            char crc_buf[4];
+            if (chunk_len < sizeof(crc_buf)) {
+                LOG(WARNING) << "Chunk too short to contain crc";
+                return false;
+            }
+            rest.cutn(crc_buf, sizeof(crc_buf));
+            const uint32_t expected_crc = butil::crc32c::Unmask(
+                (uint8_t)crc_buf[0] | ((uint8_t)crc_buf[1] << 8) |
+                ((uint8_t)crc_buf[2] << 16) |
+                ((uint32_t)(uint8_t)crc_buf[3] << 24));
+            const size_t body_len = chunk_len - sizeof(crc_buf);
+            if (type == FRAMED_CHUNK_UNCOMPRESSED) {
+                butil::IOBuf body;
+                rest.cutn(&body, body_len);
+                if (butil::crc32c::Extend(0, body) != expected_crc) {
+                    LOG(WARNING) << "Corrupted uncompressed chunk";
+                    return false;
+                }
+                out->append(body);
+            } else {
+                if (body_len > butil::snappy::MaxCompressedLength(
+                        FRAMED_MAX_UNCOMPRESSED_CHUNK)) {
+                    LOG(WARNING) << "Compressed chunk too long, len="
+                                 << body_len;
+                    return false;
+                }
+                const char* cdata =
+                    (const char*)rest.fetch(scratch->compressed, body_len);
+                size_t uncompressed_len = 0;
+                if (cdata == NULL ||
+                    !butil::snappy::GetUncompressedLength(
+                        cdata, body_len, &uncompressed_len) ||
+                    uncompressed_len > FRAMED_MAX_UNCOMPRESSED_CHUNK ||
+                    !butil::snappy::RawUncompress(cdata, body_len,
+                                                  scratch->uncompressed)) {
+                    LOG(WARNING) << "Corrupted compressed chunk";
+                    return false;
+                }
+                if (butil::crc32c::Value(scratch->uncompressed,
+                                         uncompressed_len) != expected_crc) {
+                    LOG(WARNING) << "Crc mismatch of compressed chunk";
+                    return false;
+                }
+                out->append(scratch->uncompressed, uncompressed_len);
+                rest.pop_front(body_len);
+            }
+        } else if (type == 0xfe/*padding*/ || type >= 0x80/*skippable*/) {
+            rest.pop_front(chunk_len);
+        } else {
+            LOG(WARNING) << "Unknown unskippable chunk, type=" << (int)type;
+            return false;
+        }
+    }
+    return saw_stream_id;
+}
+
+bool SnappyFramedCompress(const google::protobuf::Message& msg,
+                          butil::IOBuf* buf) {
+    butil::IOBuf serialized_pb;
+    butil::IOBufAsZeroCopyOutputStream wrapper(&serialized_pb);
+    if (msg.SerializeToZeroCopyStream(&wrapper)) {
+        return SnappyFramedCompress(serialized_pb, buf);
+    }
+    LOG(WARNING) << "Fail to serialize input pb=" << &msg;
+    return false;
+}
+
+bool SnappyFramedDecompress(const butil::IOBuf& data,
+                            google::protobuf::Message* msg) {
+    butil::IOBuf binary_pb;
+    if (SnappyFramedDecompress(data, &binary_pb)) {
+        return ParsePbFromIOBuf(msg, binary_pb);
+    }
+    LOG(WARNING) << "Fail to decompress framed snappy, size=" << data.size();
+    return false;
+}
+
 }  // namespace policy
 } // namespace brpc
@@ -38,6 +38,28 @@ bool SnappyCompress(const butil::IOBuf& in, butil::IOBuf* out);
 // Put decompressed `in' into `out'.
 bool SnappyDecompress(const butil::IOBuf& in, butil::IOBuf* out);
 
+// Snappy framing format(butil/third_party/snappy/framing_format.txt):
+// the input is cut into chunks of at most 64K which are compressed
+// independently, so that decompression streams through the data instead
+// of materializing the whole uncompressed payload at once. Chunks are
+// aligned with the blocks backing the IOBuf when possible to compress
+// directly from block memory, and the per-chunk scratch buffers are
+// cached in TLS rather than allocated each time. Each chunk carries a
+// masked crc32c of the uncompressed data which is verified on
+// decompression.
+
+// Compress serialized `msg' into `buf'.
+bool SnappyFramedCompress(const google::protobuf::Message& msg, butil::IOBuf* buf);
+
+// Parse `msg' from decompressed `buf'
+bool SnappyFramedDecompress(const butil::IOBuf& data, google::protobuf::Message* msg);
+
+// Put compressed `in' into `out'.
+bool SnappyFramedCompress(const butil::IOBuf& in, butil::IOBuf* out);
+
+// Put decompressed `in' into `out'.
+bool SnappyFramedDecompress(const butil::IOBuf& in, butil::IOBuf* out);
+
 }  // namespace policy
 } // namespace brpc
 
@@ -370,6 +370,7 @@ void ProcessSofaRequest(InputMessageBase* msg_base) {
         span->set_remote_side(cntl->remote_side());
         span->set_protocol(PROTOCOL_SOFA_PBRPC);
         span->set_received_us(msg->received_us());
+        span->set_kernel_received_real_us(msg->kernel_received_real_us());
         span->set_start_parse_us(start_parse_us);
         span->set_request_size(msg->meta.size() + msg->payload.size() + 24);
     }
@@ -502,6 +503,7 @@ void ProcessSofaResponse(InputMessageBase* msg_base) {
     if (span) {
         span->set_base_real_us(msg->base_real_us());
         span->set_received_us(msg->received_us());
+        span->set_kernel_received_real_us(msg->kernel_received_real_us());
         span->set_response_size(msg->meta.size() + msg->payload.size() + 24);
         span->set_start_parse_us(start_parse_us);
     }
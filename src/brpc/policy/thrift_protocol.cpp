@@ -36,6 +36,7 @@
 
 #include <thrift/Thrift.h>
 #include <thrift/transport/TBufferTransports.h>
+#include <thrift/transport/TVirtualTransport.h>
 #include <thrift/protocol/TBinaryProtocol.h>
 #include <thrift/TApplicationException.h>
 
@@ -120,17 +121,28 @@ WriteThriftMessageBegin(char* buf,
     *p = htonl(seq_id);
 }
 
+// Reads thrift data from slices of an IOBuf directly instead of copying the
+// whole body into a contiguous TMemoryBuffer first, which matters for large
+// structs. Fields are still copied piece-by-piece into the target struct by
+// the generated code, but that is inherent to deserialization.
+class IOBufThriftTransport
+    : public ::apache::thrift::transport::TVirtualTransport<IOBufThriftTransport> {
+public:
+    explicit IOBufThriftTransport(const butil::IOBuf& body) : _it(body) {}
+
+    uint32_t read(uint8_t* buf, uint32_t len) {
+        return _it.copy_and_forward(buf, len);
+    }
+
+private:
+    butil::IOBufBytesIterator _it;
+};
+
 bool ReadThriftStruct(const butil::IOBuf& body,
                       ThriftMessageBase* raw_msg,
                       int16_t expected_fid) {
-    const size_t body_len  = body.size();
-    uint8_t* thrift_buffer = (uint8_t*)malloc(body_len);
-    body.copy_to(thrift_buffer, body_len);
-    auto in_buffer =
-        THRIFT_STDCXX::make_shared<apache::thrift::transport::TMemoryBuffer>(
-            thrift_buffer, body_len,
-            ::apache::thrift::transport::TMemoryBuffer::TAKE_OWNERSHIP);
-    apache::thrift::protocol::TBinaryProtocolT<apache::thrift::transport::TMemoryBuffer> iprot(in_buffer);
+    auto in_buffer = THRIFT_STDCXX::make_shared<IOBufThriftTransport>(body);
+    apache::thrift::protocol::TBinaryProtocolT<IOBufThriftTransport> iprot(in_buffer);
 
     // The following code was taken from thrift auto generate code
     std::string fname;
@@ -166,14 +178,8 @@ bool ReadThriftStruct(const butil::IOBuf& body,
 
 void ReadThriftException(const butil::IOBuf& body,
                          ::apache::thrift::TApplicationException* x) {
-    size_t body_len  = body.size();
-    uint8_t* thrift_buffer = (uint8_t*)malloc(body_len);
-    body.copy_to(thrift_buffer, body_len);
-    auto in_buffer =
-        THRIFT_STDCXX::make_shared<apache::thrift::transport::TMemoryBuffer>(
-            thrift_buffer, body_len,
-            ::apache::thrift::transport::TMemoryBuffer::TAKE_OWNERSHIP);
-    apache::thrift::protocol::TBinaryProtocolT<apache::thrift::transport::TMemoryBuffer> iprot(in_buffer);
+    auto in_buffer = THRIFT_STDCXX::make_shared<IOBufThriftTransport>(body);
+    apache::thrift::protocol::TBinaryProtocolT<IOBufThriftTransport> iprot(in_buffer);
 
     x->read(&iprot);
     iprot.readMessageEnd();
@@ -513,6 +519,7 @@ void ProcessThriftRequest(InputMessageBase* msg_base) {
         span->set_remote_side(cntl->remote_side());
         span->set_protocol(PROTOCOL_THRIFT);
         span->set_received_us(msg->received_us());
+        span->set_kernel_received_real_us(msg->kernel_received_real_us());
         span->set_start_parse_us(start_parse_us);
         span->set_request_size(sizeof(thrift_head_t) + req->body.size());
     }
@@ -574,6 +581,7 @@ void ProcessThriftResponse(InputMessageBase* msg_base) {
     if (span) {
         span->set_base_real_us(msg->base_real_us());
         span->set_received_us(msg->received_us());
+        span->set_kernel_received_real_us(msg->kernel_received_real_us());
         span->set_response_size(msg->payload.length());
         span->set_start_parse_us(start_parse_us);
     }
@@ -73,6 +73,14 @@ uint64_t GetStride(const uint64_t weight_sum, const size_t num) {
 namespace brpc {
 namespace policy {
 
+// Peek at the borrowed socket to skip failed or unavailable servers without
+// the refcounting in Address(). The result may be stale, thus the addressed
+// socket still needs to be checked afterwards.
+inline bool ProbeAvailable(SocketId id) {
+    Socket* const probe = Socket::AddressBorrowed(id);
+    return probe != NULL && probe->IsAvailable();
+}
+
 bool WeightedRoundRobinLoadBalancer::Add(Servers& bg, const ServerId& id) {
     if (bg.server_list.capacity() < 128) {
         bg.server_list.reserve(128);
@@ -181,6 +189,7 @@ int WeightedRoundRobinLoadBalancer::SelectServer(const SelectIn& in, SelectOut*
     while (remain_servers > 0) {
         SocketId server_id = GetServerInNextStride(s->server_list, filter, tls_temp);
         if (!ExcludedServers::IsExcluded(in.excluded, server_id)
+            && ProbeAvailable(server_id)
             && Socket::Address(server_id, out->ptr) == 0
             && (*out->ptr)->IsAvailable()) {
             // update tls.
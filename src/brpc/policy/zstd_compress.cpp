@@ -0,0 +1,266 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifdef BRPC_WITH_ZSTD
+
+#include <pthread.h>
+#include <zstd.h>
+#include <zdict.h>
+#include <gflags/gflags.h>
+#include "butil/logging.h"
+#include "butil/file_util.h"
+#include "brpc/policy/zstd_compress.h"
+#include "brpc/protocol.h"
+
+
+namespace brpc {
+namespace policy {
+
+DEFINE_int32(zstd_compress_level, 3,
+             "The zstd compression level of all channels/servers which "
+             "compress with COMPRESS_TYPE_ZSTD, larger level compresses "
+             "better but slower");
+DEFINE_string(zstd_dict_file, "",
+              "If this flag is non-empty, load a zstd dictionary(trained "
+              "with `zstd --train') from the file and use it in both "
+              "compression and decompression. Client and server must load "
+              "the same dictionary");
+
+static pthread_once_t s_load_dict_once = PTHREAD_ONCE_INIT;
+static std::string* s_dict = NULL;
+
+static void LoadZstdDict() {
+    if (FLAGS_zstd_dict_file.empty()) {
+        return;
+    }
+    std::string* dict = new std::string;
+    if (!butil::ReadFileToString(butil::FilePath(FLAGS_zstd_dict_file), dict)) {
+        LOG(ERROR) << "Fail to read zstd dictionary from "
+                   << FLAGS_zstd_dict_file;
+        delete dict;
+        return;
+    }
+    // The id is embedded into headers of compressed frames so that a
+    // decompressing peer loading a different dictionary rejects the data
+    // instead of producing garbage.
+    LOG(INFO) << "Loaded zstd dictionary from " << FLAGS_zstd_dict_file
+              << " size=" << dict->size()
+              << " id=" << ZDICT_getDictID(dict->data(), dict->size());
+    s_dict = dict;
+}
+
+static const std::string* GetZstdDict() {
+    pthread_once(&s_load_dict_once, LoadZstdDict);
+    return s_dict;
+}
+
+// Feed blocks of `in' into `cctx' one by one so that the IOBuf is never
+// flattened into a continuous buffer.
+static bool ZstdCompressStream(ZSTD_CCtx* cctx,
+                               const butil::IOBuf& in, butil::IOBuf* out) {
+    butil::IOBufAsZeroCopyInputStream in_stream(in);
+    butil::IOBufAsZeroCopyOutputStream out_stream(out);
+    ZSTD_inBuffer in_buf = { NULL, 0, 0 };
+    ZSTD_outBuffer out_buf = { NULL, 0, 0 };
+    ZSTD_EndDirective mode = ZSTD_e_continue;
+    size_t remaining = 0;
+    do {
+        if (in_buf.pos == in_buf.size && mode == ZSTD_e_continue) {
+            const void* data = NULL;
+            int size = 0;
+            if (in_stream.Next(&data, &size)) {
+                in_buf.src = data;
+                in_buf.size = size;
+                in_buf.pos = 0;
+            }
+            if ((size_t)in_stream.ByteCount() == in.size()) {
+                mode = ZSTD_e_end;
+            }
+        }
+        if (out_buf.pos == out_buf.size) {
+            void* data = NULL;
+            int size = 0;
+            if (!out_stream.Next(&data, &size)) {
+                return false;
+            }
+            out_buf.dst = data;
+            out_buf.size = size;
+            out_buf.pos = 0;
+        }
+        remaining = ZSTD_compressStream2(cctx, &out_buf, &in_buf, mode);
+        if (ZSTD_isError(remaining)) {
+            LOG(WARNING) << "Fail to ZSTD_compressStream2: "
+                         << ZSTD_getErrorName(remaining);
+            return false;
+        }
+    } while (in_buf.pos < in_buf.size || mode != ZSTD_e_end || remaining != 0);
+    if (out_buf.size > out_buf.pos) {
+        out_stream.BackUp(out_buf.size - out_buf.pos);
+    }
+    return true;
+}
+
+static bool ZstdDecompressStream(ZSTD_DCtx* dctx,
+                                 const butil::IOBuf& in, butil::IOBuf* out) {
+    butil::IOBufAsZeroCopyInputStream in_stream(in);
+    butil::IOBufAsZeroCopyOutputStream out_stream(out);
+    ZSTD_inBuffer in_buf = { NULL, 0, 0 };
+    ZSTD_outBuffer out_buf = { NULL, 0, 0 };
+    bool input_exhausted = false;
+    // An empty input can not be a complete frame.
+    size_t rc = 1;
+    do {
+        if (in_buf.pos == in_buf.size && !input_exhausted) {
+            const void* data = NULL;
+            int size = 0;
+            if (in_stream.Next(&data, &size)) {
+                in_buf.src = data;
+                in_buf.size = size;
+                in_buf.pos = 0;
+            } else {
+                input_exhausted = true;
+            }
+        }
+        if (out_buf.pos == out_buf.size) {
+            void* data = NULL;
+            int size = 0;
+            if (!out_stream.Next(&data, &size)) {
+                return false;
+            }
+            out_buf.dst = data;
+            out_buf.size = size;
+            out_buf.pos = 0;
+        }
+        rc = ZSTD_decompressStream(dctx, &out_buf, &in_buf);
+        if (ZSTD_isError(rc)) {
+            LOG(WARNING) << "Fail to ZSTD_decompressStream: "
+                         << ZSTD_getErrorName(rc);
+            return false;
+        }
+        // Loop until the input is consumed and the decoder has flushed
+        // everything(it may still buffer data when out_buf was filled up).
+    } while (!input_exhausted || in_buf.pos < in_buf.size ||
+             out_buf.pos == out_buf.size);
+    if (out_buf.size > out_buf.pos) {
+        out_stream.BackUp(out_buf.size - out_buf.pos);
+    }
+    // rc is 0 iff the last frame was completely decoded and flushed.
+    return rc == 0;
+}
+
+bool ZstdCompress(const butil::IOBuf& in, butil::IOBuf* out) {
+    ZSTD_CCtx* cctx = ZSTD_createCCtx();
+    if (NULL == cctx) {
+        LOG(WARNING) << "Fail to ZSTD_createCCtx";
+        return false;
+    }
+    size_t rc = ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel,
+                                       FLAGS_zstd_compress_level);
+    if (!ZSTD_isError(rc)) {
+        const std::string* dict = GetZstdDict();
+        if (dict != NULL) {
+            rc = ZSTD_CCtx_loadDictionary(cctx, dict->data(), dict->size());
+        }
+    }
+    bool success = false;
+    if (ZSTD_isError(rc)) {
+        LOG(WARNING) << "Fail to setup ZSTD_CCtx: " << ZSTD_getErrorName(rc);
+    } else {
+        success = ZstdCompressStream(cctx, in, out);
+    }
+    ZSTD_freeCCtx(cctx);
+    return success;
+}
+
+bool ZstdDecompress(const butil::IOBuf& in, butil::IOBuf* out) {
+    ZSTD_DCtx* dctx = ZSTD_createDCtx();
+    if (NULL == dctx) {
+        LOG(WARNING) << "Fail to ZSTD_createDCtx";
+        return false;
+    }
+    size_t rc = 0;
+    const std::string* dict = GetZstdDict();
+    if (dict != NULL) {
+        rc = ZSTD_DCtx_loadDictionary(dctx, dict->data(), dict->size());
+    }
+    bool success = false;
+    if (ZSTD_isError(rc)) {
+        LOG(WARNING) << "Fail to setup ZSTD_DCtx: " << ZSTD_getErrorName(rc);
+    } else {
+        success = ZstdDecompressStream(dctx, in, out);
+    }
+    ZSTD_freeDCtx(dctx);
+    return success;
+}
+
+bool ZstdTrainDict(const std::vector<butil::IOBuf>& samples,
+                   size_t max_dict_size, std::string* dict) {
+    if (samples.empty() || max_dict_size == 0 || NULL == dict) {
+        LOG(WARNING) << "Invalid parameter";
+        return false;
+    }
+    // ZDICT requires continuous samples.
+    std::string flat;
+    std::vector<size_t> sizes;
+    sizes.reserve(samples.size());
+    size_t total = 0;
+    for (size_t i = 0; i < samples.size(); ++i) {
+        total += samples[i].size();
+    }
+    flat.reserve(total);
+    for (size_t i = 0; i < samples.size(); ++i) {
+        samples[i].append_to(&flat);
+        sizes.push_back(samples[i].size());
+    }
+    dict->resize(max_dict_size);
+    const size_t rc = ZDICT_trainFromBuffer(
+        &(*dict)[0], max_dict_size, flat.data(), sizes.data(),
+        (unsigned)sizes.size());
+    if (ZDICT_isError(rc)) {
+        LOG(WARNING) << "Fail to ZDICT_trainFromBuffer: "
+                     << ZDICT_getErrorName(rc);
+        dict->clear();
+        return false;
+    }
+    dict->resize(rc);
+    return true;
+}
+
+bool ZstdCompress(const google::protobuf::Message& msg, butil::IOBuf* buf) {
+    butil::IOBuf serialized_pb;
+    butil::IOBufAsZeroCopyOutputStream wrapper(&serialized_pb);
+    if (msg.SerializeToZeroCopyStream(&wrapper)) {
+        return ZstdCompress(serialized_pb, buf);
+    }
+    LOG(WARNING) << "Fail to serialize input pb=" << &msg;
+    return false;
+}
+
+bool ZstdDecompress(const butil::IOBuf& data, google::protobuf::Message* msg) {
+    butil::IOBuf binary_pb;
+    if (ZstdDecompress(data, &binary_pb)) {
+        return ParsePbFromIOBuf(msg, binary_pb);
+    }
+    LOG(WARNING) << "Fail to ZstdDecompress, size=" << data.size();
+    return false;
+}
+
+}  // namespace policy
+} // namespace brpc
+
+#endif // BRPC_WITH_ZSTD
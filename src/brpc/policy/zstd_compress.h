@@ -0,0 +1,62 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef BRPC_POLICY_ZSTD_COMPRESS_H
+#define BRPC_POLICY_ZSTD_COMPRESS_H
+
+#ifdef BRPC_WITH_ZSTD
+
+#include <vector>
+#include <google/protobuf/message.h>          // Message
+#include "butil/iobuf.h"                       // IOBuf
+
+
+namespace brpc {
+namespace policy {
+
+// Compression level is controlled by -zstd_compress_level and an optional
+// dictionary(shared by compression and decompression) is loaded from
+// -zstd_dict_file, see zstd_compress.cpp.
+
+// Compress serialized `msg' into `buf'.
+bool ZstdCompress(const google::protobuf::Message& msg, butil::IOBuf* buf);
+
+// Parse `msg' from decompressed `buf'
+bool ZstdDecompress(const butil::IOBuf& data, google::protobuf::Message* msg);
+
+// Put compressed `in' into `out'.
+bool ZstdCompress(const butil::IOBuf& in, butil::IOBuf* out);
+
+// Put decompressed `in' into `out'.
+bool ZstdDecompress(const butil::IOBuf& in, butil::IOBuf* out);
+
+// Train a dictionary of at most `max_dict_size' bytes from `samples'
+// (e.g. requests collected by rpc_dump, see tools/rpc_zdict) and put it
+// into `dict'. The result can be saved to a file and loaded on both ends
+// with -zstd_dict_file. Training needs many samples, roughly 100x the
+// dictionary size, to be effective.
+// Returns true on success, false otherwise.
+bool ZstdTrainDict(const std::vector<butil::IOBuf>& samples,
+                   size_t max_dict_size, std::string* dict);
+
+}  // namespace policy
+} // namespace brpc
+
+#endif // BRPC_WITH_ZSTD
+
+#endif // BRPC_POLICY_ZSTD_COMPRESS_H
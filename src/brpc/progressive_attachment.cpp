@@ -37,6 +37,7 @@ ProgressiveAttachment::ProgressiveAttachment(SocketUniquePtr& movable_httpsock,
     : _before_http_1_1(before_http_1_1)
     , _pause_from_mark_rpc_as_done(false)
     , _rpc_state(RPC_RUNNING)
+    , _corked(false)
     , _notify_id(INVALID_BTHREAD_ID) {
     _httpsock.swap(movable_httpsock);
 }
@@ -49,12 +50,20 @@ ProgressiveAttachment::~ProgressiveAttachment() {
             // note: _httpsock may already be failed.
             if (_rpc_state.load(butil::memory_order_relaxed) == RPC_SUCCEED) {
                 butil::IOBuf tmpbuf;
+                // Flush chunks still corked along with the ending chunk.
+                tmpbuf.swap(_corked_buf);
                 tmpbuf.append("0\r\n\r\n", 5);
                 Socket::WriteOptions wopt;
                 wopt.ignore_eovercrowded = true;
                 _httpsock->Write(&tmpbuf, &wopt);
             }
         } else {
+            if (!_corked_buf.empty() &&
+                _rpc_state.load(butil::memory_order_relaxed) == RPC_SUCCEED) {
+                Socket::WriteOptions wopt;
+                wopt.ignore_eovercrowded = true;
+                _httpsock->Write(&_corked_buf, &wopt);
+            }
             // Close _httpsock to notify the client that all the content has
             // been transferred.
             // Note: invoke ReleaseAdditionalReference instead of SetFailed to
@@ -140,6 +149,20 @@ int ProgressiveAttachment::Write(const butil::IOBuf& data) {
     // The RPC is already done (http headers were written into the socket)
     // write into the socket directly.
     if (rpc_state == RPC_SUCCEED) {
+        if (_corked) {
+            std::unique_lock<butil::Mutex> mu(_mutex);
+            // Racing with Uncork() is fine: chunks appended before the
+            // flush go out with it, later ones are written directly.
+            if (_corked) {
+                if (_corked_buf.size() >=
+                    (size_t)FLAGS_socket_max_unwritten_bytes) {
+                    errno = EOVERCROWDED;
+                    return -1;
+                }
+                AppendAsChunk(&_corked_buf, data, _before_http_1_1);
+                return 0;
+            }
+        }
         butil::IOBuf tmpbuf;
         AppendAsChunk(&tmpbuf, data, _before_http_1_1);
         return _httpsock->Write(&tmpbuf);
@@ -173,6 +196,18 @@ int ProgressiveAttachment::Write(const void* data, size_t n) {
     // The RPC is already done (http headers were written into the socket)
     // write into the socket directly.
     if (rpc_state == RPC_SUCCEED) {
+        if (_corked) {
+            std::unique_lock<butil::Mutex> mu(_mutex);
+            if (_corked) {
+                if (_corked_buf.size() >=
+                    (size_t)FLAGS_socket_max_unwritten_bytes) {
+                    errno = EOVERCROWDED;
+                    return -1;
+                }
+                AppendAsChunk(&_corked_buf, data, n, _before_http_1_1);
+                return 0;
+            }
+        }
         butil::IOBuf tmpbuf;
         AppendAsChunk(&tmpbuf, data, n, _before_http_1_1);
         return _httpsock->Write(&tmpbuf);
@@ -182,6 +217,26 @@ int ProgressiveAttachment::Write(const void* data, size_t n) {
     }
 }
 
+void ProgressiveAttachment::Cork() {
+    std::unique_lock<butil::Mutex> mu(_mutex);
+    _corked = true;
+}
+
+int ProgressiveAttachment::Uncork() {
+    butil::IOBuf pending;
+    {
+        std::unique_lock<butil::Mutex> mu(_mutex);
+        _corked = false;
+        pending.swap(_corked_buf);
+    }
+    if (pending.empty()) {
+        return 0;
+    }
+    // _corked_buf is only filled after the RPC succeeded, thus headers
+    // were already written and `pending' can go out directly.
+    return _httpsock->Write(&pending);
+}
+
 void ProgressiveAttachment::MarkRPCAsDone(bool rpc_failed) {
     // Notes:
     // * Writing here is more timely than being flushed in next Write(), in
@@ -39,6 +39,21 @@ public:
     int Write(const butil::IOBuf& data);
     int Write(const void* data, size_t n);
 
+    // [Thread-safe]
+    // Stop writing each chunk to the socket separately: following Write()s
+    // accumulate in a buffer until Uncork() flushes them in one write.
+    // Corking amortizes the per-write overhead when many small chunks are
+    // pushed back-to-back (e.g. server-sent events) and is a no-op while
+    // the RPC carrying this attachment is still running, since chunks are
+    // buffered until the RPC is done anyway.
+    void Cork();
+
+    // Flush chunks accumulated since Cork() in one write and restore the
+    // write-each-chunk behavior. Chunks still corked at destruction are
+    // flushed along with the ending chunk.
+    // Returns 0 on success, -1 otherwise and errno is set.
+    int Uncork();
+
     // Get ip/port of peer/self.
     butil::EndPoint remote_side() const;
     butil::EndPoint local_side() const;
@@ -69,6 +84,9 @@ protected:
     butil::Mutex _mutex;
     SocketUniquePtr _httpsock;
     butil::IOBuf _saved_buf;
+    // Filled by Write() between Cork() and Uncork() (under _mutex).
+    bool _corked;
+    butil::IOBuf _corked_buf;
     bthread_id_t _notify_id;
 
 private:
@@ -27,6 +27,8 @@ const uint64_t PB_TOTAL_BYETS_LIMITS =
 #undef private
 
 #include <google/protobuf/io/zero_copy_stream_impl_lite.h>
+#include <google/protobuf/wire_format_lite.h>      // WireFormatLite
+#include <algorithm>                               // std::find
 #include <gflags/gflags.h>
 #include "butil/logging.h"
 #include "butil/memory/singleton_on_pthread_once.h"
@@ -219,6 +221,98 @@ bool ParsePbFromIOBuf(google::protobuf::Message* msg, const butil::IOBuf& buf) {
     return ParsePbFromZeroCopyStreamInlined(msg, &stream);
 }
 
+bool SerializePbToIOBuf(const google::protobuf::Message& msg, butil::IOBuf* buf) {
+    // Caches sizes of sub-messages for SerializeWithCachedSizesToArray.
+    const int byte_size = msg.ByteSize();
+    if (byte_size < 0) {
+        return false;
+    }
+    // Covers the typical telemetry/meta message of a few dozen scalar
+    // fields without being a burden on bthread stacks.
+    const size_t STACK_BUF_SIZE = 1024;
+    if ((size_t)byte_size <= STACK_BUF_SIZE) {
+        uint8_t stack_buf[STACK_BUF_SIZE];
+        uint8_t* const end = msg.SerializeWithCachedSizesToArray(stack_buf);
+        if (end != stack_buf + byte_size) {
+            return false;
+        }
+        return buf->append(stack_buf, byte_size) == 0;
+    }
+    butil::IOBufAsZeroCopyOutputStream wrapper(buf);
+    return msg.SerializeToZeroCopyStream(&wrapper);
+}
+
+bool RemoveLazyFieldsFromIOBuf(
+    const butil::IOBuf& source, const std::vector<int>& fields,
+    butil::IOBuf* eager,
+    std::vector<std::pair<int, butil::IOBuf> >* lazy_out) {
+    // First pass: walk the top-level fields and remember byte ranges
+    // (including tag and length) of the lazy ones.
+    struct LazyRange {
+        size_t begin;
+        size_t end;
+        int field_number;
+    };
+    std::vector<LazyRange> ranges;
+    {
+        butil::IOBufAsZeroCopyInputStream wrapper(source);
+        google::protobuf::io::CodedInputStream cis(&wrapper);
+        while (true) {
+            const size_t tag_pos = cis.CurrentPosition();
+            const uint32_t tag = cis.ReadTag();
+            if (tag == 0) {
+                // EOF or a corrupted tag, distinguished by the position.
+                if (tag_pos != source.size()) {
+                    return false;
+                }
+                break;
+            }
+            const int field_number = (int)(tag >> 3);
+            if (std::find(fields.begin(), fields.end(), field_number)
+                != fields.end()) {
+                if ((tag & 7) != google::protobuf::internal::
+                    WireFormatLite::WIRETYPE_LENGTH_DELIMITED) {
+                    return false;
+                }
+                uint32_t len = 0;
+                if (!cis.ReadVarint32(&len) || !cis.Skip(len)) {
+                    return false;
+                }
+                const LazyRange range =
+                    { tag_pos, (size_t)cis.CurrentPosition(), field_number };
+                ranges.push_back(range);
+            } else if (!google::protobuf::internal::WireFormatLite::SkipField(
+                           &cis, tag)) {
+                return false;
+            }
+        }
+    }
+    // Second pass: split `source' along the ranges, sharing blocks.
+    butil::IOBuf rest = source;
+    size_t consumed = 0;
+    for (size_t i = 0; i < ranges.size(); ++i) {
+        const LazyRange& r = ranges[i];
+        if (r.begin > consumed) {
+            rest.cutn(eager, r.begin - consumed);
+        }
+        butil::IOBuf fragment;
+        rest.cutn(&fragment, r.end - r.begin);
+        consumed = r.end;
+        size_t j = 0;
+        for (; j < lazy_out->size(); ++j) {
+            if ((*lazy_out)[j].first == r.field_number) {
+                (*lazy_out)[j].second.append(fragment);
+                break;
+            }
+        }
+        if (j == lazy_out->size()) {
+            lazy_out->push_back(std::make_pair(r.field_number, fragment));
+        }
+    }
+    eager->append(rest);
+    return true;
+}
+
 bool ParsePbFromArray(google::protobuf::Message* msg,
                       const void* data, size_t size) {
     google::protobuf::io::ArrayInputStream stream(data, size);
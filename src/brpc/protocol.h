@@ -196,6 +196,28 @@ bool ParsePbFromIOBuf(google::protobuf::Message* msg, const butil::IOBuf& buf);
 bool ParsePbFromArray(google::protobuf::Message* msg, const void* data, size_t size);
 bool ParsePbFromString(google::protobuf::Message* msg, const std::string& str);
 
+// Serialize `msg' and append the bytes to `buf'. Messages fitting into a
+// stack buffer go through the array path of pb which writes fields
+// back-to-back without the bound checks of CodedOutputStream, notably
+// faster for flat messages with a handful of scalar fields (the common
+// shape of metrics/telemetry). Output bytes are identical to
+// msg.SerializeToZeroCopyStream() which larger messages fall back to.
+bool SerializePbToIOBuf(const google::protobuf::Message& msg, butil::IOBuf* buf);
+
+// Cut the top-level fields numbered in `fields' out of the serialized
+// message bytes `source': bytes of the other fields are appended to
+// `eager' while complete wire fragments (tag + length + value, multiple
+// occurrences of a repeated field concatenated) of the removed fields are
+// appended to `lazy_out'. Zero-copy, all outputs share blocks with
+// `source'. Used by servers to skip parsing of request fields declared in
+// ServiceOptions.lazy_request_fields.
+// Returns false without touching the outputs when `source' is not valid
+// wire-format data or a listed field is not length-delimited.
+bool RemoveLazyFieldsFromIOBuf(
+    const butil::IOBuf& source, const std::vector<int>& fields,
+    butil::IOBuf* eager,
+    std::vector<std::pair<int, butil::IOBuf> >* lazy_out);
+
 // Deleter for unique_ptr to print error_text of the controller when
 // -log_error_text is on, then delete the controller if `delete_cntl' is true
 class LogErrorTextAndDelete {
@@ -202,6 +202,54 @@ bool RedisRequest::SerializeTo(butil::IOBuf* buf) const {
     return true;
 }
 
+// Cut the piece before "\r\n" into `line'. `buf' is positioned after the
+// separator afterwards.
+static bool CutLine(butil::IOBuf& buf, std::string* line) {
+    butil::IOBuf piece;
+    if (buf.cut_until(&piece, "\r\n") != 0) {
+        return false;
+    }
+    line->clear();
+    piece.copy_to(line);
+    return true;
+}
+
+bool RedisRequest::GetFirstCommandKey(std::string* key) const {
+    if (_ncommand == 0) {
+        return false;
+    }
+    // Parse the serialized form(*<nargs>\r\n followed by $<len>\r\n<arg>\r\n
+    // for each argument) rather than remembering keys at AddCommand time,
+    // so that requests merged from other requests work as well. Copying
+    // the IOBuf only references blocks.
+    butil::IOBuf buf = _buf;
+    std::string line;
+    if (!CutLine(buf, &line) || line.empty() || line[0] != '*') {
+        return false;
+    }
+    const long nargs = strtol(line.c_str() + 1, NULL, 10);
+    if (nargs < 2) {  // the command carries no key.
+        return false;
+    }
+    // Skip the command name, then cut the key.
+    for (int i = 0; i < 2; ++i) {
+        if (!CutLine(buf, &line) || line.empty() || line[0] != '$') {
+            return false;
+        }
+        const long len = strtol(line.c_str() + 1, NULL, 10);
+        if (len < 0 || (size_t)len + 2 > buf.size()) {
+            return false;
+        }
+        if (i == 0) {
+            buf.pop_front(len + 2);
+        } else {
+            key->clear();
+            buf.cutn(key, len);
+        }
+    }
+    return true;
+}
+
 const ::google::protobuf::Descriptor* RedisRequest::descriptor() {
     return RedisRequestBase::descriptor();
 }
@@ -436,23 +484,81 @@ std::ostream& operator<<(std::ostream& os, const RedisResponse& response) {
     return os;
 }
 
+size_t RedisService::CommandHasher::operator()(const butil::StringPiece& s) const {
+    size_t result = 0;
+    for (size_t i = 0; i < s.size(); ++i) {
+        result = result * 101 + butil::ToLowerASCII(s[i]);
+    }
+    return result;
+}
+
+bool RedisService::CommandEqual::operator()(
+    const std::string& s1, const butil::StringPiece& s2) const {
+    if (s1.size() != s2.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < s1.size(); ++i) {
+        if (butil::ToLowerASCII(s1[i]) != butil::ToLowerASCII(s2[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+RedisService::RedisService() {
+    // Low load factor keeps most commands in their home bucket, making a
+    // lookup one hash plus one(rarely two) probes.
+    CHECK_EQ(0, _command_map.init(64, 50));
+}
+
 bool RedisService::AddCommandHandler(const std::string& name, RedisCommandHandler* handler) {
     std::string lcname = StringToLowerASCII(name);
-    auto it = _command_map.find(lcname);
-    if (it != _command_map.end()) {
+    if (_command_map.seek(lcname) != NULL) {
         LOG(ERROR) << "redis command name=" << name << " exist";
         return false;
     }
     _command_map[lcname] = handler;
     return true;
 }
- 
+
 RedisCommandHandler* RedisService::FindCommandHandler(const butil::StringPiece& name) const {
-    auto it = _command_map.find(name.as_string());
-    if (it != _command_map.end()) {
-        return it->second;
-    }
-    return NULL;
+    RedisCommandHandler* const* ph = _command_map.seek(name);
+    return ph ? *ph : NULL;
+}
+
+void RedisInlineReplyWriter::AddStatus(const butil::StringPiece& str) {
+    _appender->push_back('+');
+    _appender->append(str.data(), str.size());
+    _appender->append("\r\n", 2);
+}
+
+void RedisInlineReplyWriter::AddError(const butil::StringPiece& str) {
+    _appender->push_back('-');
+    _appender->append(str.data(), str.size());
+    _appender->append("\r\n", 2);
+}
+
+void RedisInlineReplyWriter::AddInteger(int64_t value) {
+    _appender->push_back(':');
+    _appender->append_decimal(value);
+    _appender->append("\r\n", 2);
+}
+
+void RedisInlineReplyWriter::AddString(const butil::StringPiece& str) {
+    _appender->push_back('$');
+    _appender->append_decimal(str.size());
+    _appender->append("\r\n", 2);
+    _appender->append(str.data(), str.size());
+    _appender->append("\r\n", 2);
+}
+
+void RedisInlineReplyWriter::AddNullString() {
+    _appender->append("$-1\r\n", 5);
+}
+
+bool RedisCommandHandler::RunInline(const std::vector<butil::StringPiece>&,
+                                    RedisInlineReplyWriter*) {
+    return false;
 }
 
 RedisCommandHandler* RedisCommandHandler::NewTransactionHandler() {
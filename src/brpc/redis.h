@@ -20,9 +20,9 @@
 #define BRPC_REDIS_H
 
 #include <google/protobuf/message.h>
-#include <unordered_map>
 #include <memory>
 #include <list>
+#include "butil/containers/flat_map.h"
 #include "butil/iobuf.h"
 #include "butil/strings/string_piece.h"
 #include "butil/arena.h"
@@ -106,6 +106,12 @@ public:
     // Serialize the request into `buf'. Return true on success.
     bool SerializeTo(butil::IOBuf* buf) const;
 
+    // Get the key(the 2nd component) of the first command into `key', used
+    // by RedisClusterChannel to pick the node serving the key's slot.
+    // Returns false when this request is empty or the first command carries
+    // no key(e.g. PING).
+    bool GetFirstCommandKey(std::string* key) const;
+
     // Protobuf methods.
     RedisRequest* New() const;
     void CopyFrom(const ::google::protobuf::Message& from);
@@ -216,11 +222,12 @@ std::ostream& operator<<(std::ostream& os, const RedisResponse&);
 class RedisCommandHandler;
 
 // Container of CommandHandlers.
-// Assign an instance to ServerOption.redis_service to enable redis support. 
+// Assign an instance to ServerOption.redis_service to enable redis support.
 class RedisService {
 public:
+    RedisService();
     virtual ~RedisService() {}
-    
+
     // Call this function to register `handler` that can handle command `name`.
     bool AddCommandHandler(const std::string& name, RedisCommandHandler* handler);
 
@@ -228,10 +235,45 @@ public:
     RedisCommandHandler* FindCommandHandler(const butil::StringPiece& name) const;
 
 private:
-    typedef std::unordered_map<std::string, RedisCommandHandler*> CommandMap;
+    // Hash and compare command names case-insensitively, so that the verb
+    // bytes still sitting in the parsed request can be looked up directly,
+    // without lowering and copying them into a std::string per command.
+    struct CommandHasher {
+        size_t operator()(const butil::StringPiece& s) const;
+        size_t operator()(const std::string& s) const
+        { return operator()(butil::StringPiece(s)); }
+    };
+    struct CommandEqual {
+        bool operator()(const std::string& s1, const butil::StringPiece& s2) const;
+        bool operator()(const std::string& s1, const std::string& s2) const
+        { return operator()(s1, butil::StringPiece(s2)); }
+    };
+    typedef butil::FlatMap<std::string, RedisCommandHandler*,
+                           CommandHasher, CommandEqual> CommandMap;
     CommandMap _command_map;
 };
 
+// Appends RESP-encoded replies straight into the buffer sent to the client.
+// Building a RedisReply costs an arena allocation plus a serialization pass
+// per reply; handlers answering with simple statuses/integers/strings can
+// skip both by implementing RunInline() with this writer.
+// Each AddXXX() appends one complete reply.
+class RedisInlineReplyWriter {
+public:
+    explicit RedisInlineReplyWriter(butil::IOBufAppender* appender)
+        : _appender(appender) {}
+
+    // `str' must not contain \r or \n.
+    void AddStatus(const butil::StringPiece& str);   // +str\r\n
+    void AddError(const butil::StringPiece& str);    // -str\r\n
+    void AddInteger(int64_t value);                  // :value\r\n
+    void AddString(const butil::StringPiece& str);   // $len\r\nstr\r\n
+    void AddNullString();                            // $-1\r\n
+
+private:
+    butil::IOBufAppender* _appender;
+};
+
 enum RedisCommandHandlerResult {
     REDIS_CMD_HANDLED = 0,
     REDIS_CMD_CONTINUE = 1,
@@ -243,6 +285,13 @@ class RedisCommandHandler {
 public:
     virtual ~RedisCommandHandler() {}
 
+    // Optional fast path tried before Run() when the command is not part of
+    // a transaction or a batch: append the complete reply through `writer'
+    // and return true, or return false(default) to fall back to Run() with
+    // a RedisReply tree.
+    virtual bool RunInline(const std::vector<butil::StringPiece>& args,
+                           RedisInlineReplyWriter* writer);
+
     // Once Server receives commands, it will first find the corresponding handlers and
     // call them sequentially(one by one) according to the order that requests arrive,
     // just like what redis-server does.
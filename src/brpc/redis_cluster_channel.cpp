@@ -0,0 +1,441 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <algorithm>
+#include <set>
+#include "bthread/bthread.h"
+#include "butil/fast_rand.h"
+#include "butil/string_splitter.h"
+#include "brpc/closure_guard.h"
+#include "brpc/controller.h"
+#include "brpc/redis.h"
+#include "brpc/redis_cluster_channel.h"
+
+namespace brpc {
+
+// A redis cluster has 16384 slots.
+static const int NUM_REDIS_SLOTS = 16384;
+
+// Stop following redirections after so many hops. MOVED chains longer than
+// one hop only happen when the topology changes faster than we refresh.
+static const int MAX_REDIRECTS = 5;
+
+// CRC16 (CCITT) used by redis cluster for key->slot mapping, identical to
+// crc16.c in the redis source so that slots computed here agree with the
+// server's.
+static const uint16_t crc16tab[256] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
+    0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef,
+    0x1231, 0x0210, 0x3273, 0x2252, 0x52b5, 0x4294, 0x72f7, 0x62d6,
+    0x9339, 0x8318, 0xb37b, 0xa35a, 0xd3bd, 0xc39c, 0xf3ff, 0xe3de,
+    0x2462, 0x3443, 0x0420, 0x1401, 0x64e6, 0x74c7, 0x44a4, 0x5485,
+    0xa56a, 0xb54b, 0x8528, 0x9509, 0xe5ee, 0xf5cf, 0xc5ac, 0xd58d,
+    0x3653, 0x2672, 0x1611, 0x0630, 0x76d7, 0x66f6, 0x5695, 0x46b4,
+    0xb75b, 0xa77a, 0x9719, 0x8738, 0xf7df, 0xe7fe, 0xd79d, 0xc7bc,
+    0x48c4, 0x58e5, 0x6886, 0x78a7, 0x0840, 0x1861, 0x2802, 0x3823,
+    0xc9cc, 0xd9ed, 0xe98e, 0xf9af, 0x8948, 0x9969, 0xa90a, 0xb92b,
+    0x5af5, 0x4ad4, 0x7ab7, 0x6a96, 0x1a71, 0x0a50, 0x3a33, 0x2a12,
+    0xdbfd, 0xcbdc, 0xfbbf, 0xeb9e, 0x9b79, 0x8b58, 0xbb3b, 0xab1a,
+    0x6ca6, 0x7c87, 0x4ce4, 0x5cc5, 0x2c22, 0x3c03, 0x0c60, 0x1c41,
+    0xedae, 0xfd8f, 0xcdec, 0xddcd, 0xad2a, 0xbd0b, 0x8d68, 0x9d49,
+    0x7e97, 0x6eb6, 0x5ed5, 0x4ef4, 0x3e13, 0x2e32, 0x1e51, 0x0e70,
+    0xff9f, 0xefbe, 0xdfdd, 0xcffc, 0xbf1b, 0xaf3a, 0x9f59, 0x8f78,
+    0x9188, 0x81a9, 0xb1ca, 0xa1eb, 0xd10c, 0xc12d, 0xf14e, 0xe16f,
+    0x1080, 0x00a1, 0x30c2, 0x20e3, 0x5004, 0x4025, 0x7046, 0x6067,
+    0x83b9, 0x9398, 0xa3fb, 0xb3da, 0xc33d, 0xd31c, 0xe37f, 0xf35e,
+    0x02b1, 0x1290, 0x22f3, 0x32d2, 0x4235, 0x5214, 0x6277, 0x7256,
+    0xb5ea, 0xa5cb, 0x95a8, 0x8589, 0xf56e, 0xe54f, 0xd52c, 0xc50d,
+    0x34e2, 0x24c3, 0x14a0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
+    0xa7db, 0xb7fa, 0x8799, 0x97b8, 0xe75f, 0xf77e, 0xc71d, 0xd73c,
+    0x26d3, 0x36f2, 0x0691, 0x16b0, 0x6657, 0x7676, 0x4615, 0x5634,
+    0xd94c, 0xc96d, 0xf90e, 0xe92f, 0x99c8, 0x89e9, 0xb98a, 0xa9ab,
+    0x5844, 0x4865, 0x7806, 0x6827, 0x18c0, 0x08e1, 0x3882, 0x28a3,
+    0xcb7d, 0xdb5c, 0xeb3f, 0xfb1e, 0x8bf9, 0x9bd8, 0xabbb, 0xbb9a,
+    0x4a75, 0x5a54, 0x6a37, 0x7a16, 0x0af1, 0x1ad0, 0x2ab3, 0x3a92,
+    0xfd2e, 0xed0f, 0xdd6c, 0xcd4d, 0xbdaa, 0xad8b, 0x9de8, 0x8dc9,
+    0x7c26, 0x6c07, 0x5c64, 0x4c45, 0x3ca2, 0x2c83, 0x1ce0, 0x0cc1,
+    0xef1f, 0xff3e, 0xcf5d, 0xdf7c, 0xaf9b, 0xbfba, 0x8fd9, 0x9ff8,
+    0x6e17, 0x7e36, 0x4e55, 0x5e74, 0x2e93, 0x3eb2, 0x0ed1, 0x1ef0
+};
+
+static uint16_t crc16(const char* buf, size_t len) {
+    uint16_t crc = 0;
+    for (size_t i = 0; i < len; ++i) {
+        crc = (crc << 8) ^ crc16tab[((crc >> 8) ^ (uint8_t)buf[i]) & 0x00FF];
+    }
+    return crc;
+}
+
+int RedisClusterChannel::KeySlot(const butil::StringPiece& key) {
+    // Hash only the content between the first {} pair when it's non-empty,
+    // so that users can force related keys into one slot(hash tags).
+    const size_t open = key.find('{');
+    if (open != butil::StringPiece::npos) {
+        const size_t close = key.find('}', open + 1);
+        if (close != butil::StringPiece::npos && close != open + 1) {
+            return crc16(key.data() + open + 1, close - open - 1)
+                % NUM_REDIS_SLOTS;
+        }
+    }
+    return crc16(key.data(), key.size()) % NUM_REDIS_SLOTS;
+}
+
+RedisClusterChannel::RedisClusterChannel() {}
+
+RedisClusterChannel::~RedisClusterChannel() {
+    BAIDU_SCOPED_LOCK(_node_mutex);
+    for (std::map<butil::EndPoint, Channel*>::iterator
+             it = _node_channels.begin(); it != _node_channels.end(); ++it) {
+        delete it->second;
+    }
+    _node_channels.clear();
+}
+
+int RedisClusterChannel::Init(const char* seed_servers,
+                              const ChannelOptions* options) {
+    if (seed_servers == NULL || *seed_servers == '\0') {
+        LOG(ERROR) << "Parameter[seed_servers] is empty";
+        return -1;
+    }
+    if (options != NULL) {
+        _options = *options;
+    }
+    _options.protocol = PROTOCOL_REDIS;
+    for (butil::StringSplitter sp(seed_servers, ','); sp; ++sp) {
+        const std::string addr(sp.field(), sp.length());
+        butil::EndPoint pt;
+        if (butil::str2endpoint(addr.c_str(), &pt) != 0 &&
+            butil::hostname2endpoint(addr.c_str(), &pt) != 0) {
+            LOG(ERROR) << "Invalid address=`" << addr << '\'';
+            return -1;
+        }
+        _seeds.push_back(pt);
+    }
+    if (_seeds.empty()) {
+        LOG(ERROR) << "No valid address in `" << seed_servers << '\'';
+        return -1;
+    }
+    return 0;
+}
+
+size_t RedisClusterChannel::ReplaceSlotTable(SlotTable& bg,
+                                             const SlotTable& new_table) {
+    bg = new_table;
+    return 1;
+}
+
+butil::EndPoint RedisClusterChannel::NodeOfSlot(int slot) {
+    butil::DoublyBufferedData<SlotTable>::ScopedPtr ptr;
+    if (_slot_table.Read(&ptr) != 0 || ptr->ranges.empty()) {
+        return butil::EndPoint();
+    }
+    if (slot < 0) {  // keyless command, any node will do.
+        return ptr->ranges[
+            butil::fast_rand_less_than(ptr->ranges.size())].node;
+    }
+    SlotRange target;
+    target.start = slot;
+    std::vector<SlotRange>::const_iterator it = std::upper_bound(
+        ptr->ranges.begin(), ptr->ranges.end(), target);
+    if (it == ptr->ranges.begin()) {
+        return butil::EndPoint();
+    }
+    --it;
+    if (slot <= it->end) {
+        return it->node;
+    }
+    return butil::EndPoint();
+}
+
+Channel* RedisClusterChannel::GetNodeChannel(const butil::EndPoint& node) {
+    BAIDU_SCOPED_LOCK(_node_mutex);
+    std::map<butil::EndPoint, Channel*>::iterator it =
+        _node_channels.find(node);
+    if (it != _node_channels.end()) {
+        return it->second;
+    }
+    Channel* chan = new Channel;
+    if (chan->Init(node, &_options) != 0) {
+        LOG(ERROR) << "Fail to init sub channel to " << node;
+        delete chan;
+        return NULL;
+    }
+    _node_channels[node] = chan;
+    return chan;
+}
+
+int RedisClusterChannel::RefreshSlotTable() {
+    // Ask current masters first, fall back to the seeds. Entries are
+    // deduplicated since a master usually serves several ranges.
+    std::vector<butil::EndPoint> candidates;
+    {
+        std::set<butil::EndPoint> seen;
+        butil::DoublyBufferedData<SlotTable>::ScopedPtr ptr;
+        if (_slot_table.Read(&ptr) == 0) {
+            for (size_t i = 0; i < ptr->ranges.size(); ++i) {
+                if (seen.insert(ptr->ranges[i].node).second) {
+                    candidates.push_back(ptr->ranges[i].node);
+                }
+            }
+        }
+        for (size_t i = 0; i < _seeds.size(); ++i) {
+            if (seen.insert(_seeds[i]).second) {
+                candidates.push_back(_seeds[i]);
+            }
+        }
+    }
+    RedisRequest request;
+    request.AddCommand("CLUSTER SLOTS");
+    for (size_t i = 0; i < candidates.size(); ++i) {
+        Channel* chan = GetNodeChannel(candidates[i]);
+        if (chan == NULL) {
+            continue;
+        }
+        Controller cntl;
+        RedisResponse response;
+        chan->CallMethod(NULL, &cntl, &request, &response, NULL);
+        if (cntl.Failed() || response.reply_size() == 0 ||
+            !response.reply(0).is_array()) {
+            LOG(WARNING) << "Fail to get CLUSTER SLOTS from "
+                         << candidates[i] << ": "
+                         << (cntl.Failed() ? cntl.ErrorText() : "bad reply");
+            continue;
+        }
+        // Each element: [start, end, [master_ip, master_port, ...],
+        // replicas...]. Only masters are routed to.
+        const RedisReply& slots = response.reply(0);
+        SlotTable new_table;
+        bool parse_ok = true;
+        for (size_t j = 0; j < slots.size(); ++j) {
+            const RedisReply& r = slots[j];
+            if (!r.is_array() || r.size() < 3 ||
+                !r[0].is_integer() || !r[1].is_integer() ||
+                !r[2].is_array() || r[2].size() < 2 ||
+                !r[2][0].is_string() || !r[2][1].is_integer()) {
+                parse_ok = false;
+                break;
+            }
+            SlotRange range;
+            range.start = r[0].integer();
+            range.end = r[1].integer();
+            if (butil::str2endpoint(r[2][0].c_str(), r[2][1].integer(),
+                                    &range.node) != 0 &&
+                butil::hostname2endpoint(r[2][0].c_str(), r[2][1].integer(),
+                                         &range.node) != 0) {
+                parse_ok = false;
+                break;
+            }
+            new_table.ranges.push_back(range);
+        }
+        if (!parse_ok || new_table.ranges.empty()) {
+            LOG(WARNING) << "Unparsable CLUSTER SLOTS reply from "
+                         << candidates[i];
+            continue;
+        }
+        std::sort(new_table.ranges.begin(), new_table.ranges.end());
+        _slot_table.Modify(ReplaceSlotTable, new_table);
+        return 0;
+    }
+    LOG(ERROR) << "Fail to refresh slot table from all " << candidates.size()
+               << " known nodes";
+    return -1;
+}
+
+// Recognize "-MOVED <slot> <host>:<port>" and "-ASK <slot> <host>:<port>"
+// in the first reply. Returns true with `node' set to the redirection
+// target, `is_moved' tells the two apart.
+static bool ParseRedirect(const RedisResponse& response,
+                          butil::EndPoint* node, bool* is_moved) {
+    if (response.reply_size() == 0 || !response.reply(0).is_error()) {
+        return false;
+    }
+    const char* msg = response.reply(0).error_message();
+    if (strncmp(msg, "MOVED ", 6) == 0) {
+        *is_moved = true;
+        msg += 6;
+    } else if (strncmp(msg, "ASK ", 4) == 0) {
+        *is_moved = false;
+        msg += 4;
+    } else {
+        return false;
+    }
+    const char* sp = strchr(msg, ' ');  // skip the slot number.
+    if (sp == NULL) {
+        return false;
+    }
+    return butil::str2endpoint(sp + 1, node) == 0 ||
+        butil::hostname2endpoint(sp + 1, node) == 0;
+}
+
+void RedisClusterChannel::DoCall(Controller* cntl,
+                                 const RedisRequest* request,
+                                 RedisResponse* response) {
+    int slot = -1;
+    std::string key;
+    if (request->GetFirstCommandKey(&key)) {
+        slot = KeySlot(key);
+    }
+    butil::EndPoint node = NodeOfSlot(slot);
+    if (node == butil::EndPoint()) {  // empty or incomplete table.
+        if (RefreshSlotTable() != 0) {
+            cntl->SetFailed(EHOSTDOWN, "Fail to get cluster topology");
+            return;
+        }
+        node = NodeOfSlot(slot);
+        if (node == butil::EndPoint()) {
+            cntl->SetFailed(EHOSTDOWN, "No node serves slot=%d", slot);
+            return;
+        }
+    }
+    for (int redirects = 0; ; ++redirects) {
+        Channel* chan = GetNodeChannel(node);
+        if (chan == NULL) {
+            cntl->SetFailed(EHOSTDOWN, "Fail to connect to %s",
+                            butil::endpoint2str(node).c_str());
+            return;
+        }
+        Controller sub_cntl;
+        if (cntl->timeout_ms() != UNSET_MAGIC_NUM) {
+            sub_cntl.set_timeout_ms(cntl->timeout_ms());
+        }
+        RedisResponse sub_response;
+        chan->CallMethod(NULL, &sub_cntl, request, &sub_response, NULL);
+        if (sub_cntl.Failed()) {
+            cntl->SetFailed(sub_cntl.ErrorCode(), "[%s] %s",
+                            butil::endpoint2str(node).c_str(),
+                            sub_cntl.ErrorText().c_str());
+            return;
+        }
+        bool is_moved = false;
+        butil::EndPoint redirect;
+        if (redirects < MAX_REDIRECTS &&
+            ParseRedirect(sub_response, &redirect, &is_moved)) {
+            if (is_moved) {
+                // The slot was migrated, the whole topology probably
+                // changed with it.
+                RefreshSlotTable();
+            }
+            // NOTE: an ASK redirection should be preceded by ASKING on the
+            // target. We retry without it: a target still importing the
+            // slot answers MOVED back to the source which counts against
+            // MAX_REDIRECTS, so a migration in progress surfaces as the
+            // final MOVED/ASK error instead of looping.
+            node = redirect;
+            continue;
+        }
+        response->Swap(&sub_response);
+        return;
+    }
+}
+
+namespace {
+struct AsyncCallArgs {
+    RedisClusterChannel* channel;
+    Controller* cntl;
+    const RedisRequest* request;
+    RedisResponse* response;
+    google::protobuf::Closure* done;
+};
+}
+
+void* RedisClusterChannel::RunAsyncCall(void* arg) {
+    AsyncCallArgs* args = static_cast<AsyncCallArgs*>(arg);
+    args->channel->DoCall(args->cntl, args->request, args->response);
+    args->done->Run();
+    delete args;
+    return NULL;
+}
+
+void RedisClusterChannel::CallMethod(
+    const google::protobuf::MethodDescriptor* /*method*/,
+    google::protobuf::RpcController* controller,
+    const google::protobuf::Message* request,
+    google::protobuf::Message* response,
+    google::protobuf::Closure* done) {
+    Controller* cntl = static_cast<Controller*>(controller);
+    const RedisRequest* redis_request =
+        dynamic_cast<const RedisRequest*>(request);
+    RedisResponse* redis_response = dynamic_cast<RedisResponse*>(response);
+    if (redis_request == NULL || redis_response == NULL) {
+        ClosureGuard done_guard(done);
+        cntl->SetFailed(EREQUEST, "request/response must be "
+                        "RedisRequest/RedisResponse");
+        return;
+    }
+    if (done == NULL) {
+        DoCall(cntl, redis_request, redis_response);
+        return;
+    }
+    // Redirection handling inside DoCall is synchronous, carry
+    // asynchronous calls in a bthread.
+    AsyncCallArgs* args = new AsyncCallArgs;
+    args->channel = this;
+    args->cntl = cntl;
+    args->request = redis_request;
+    args->response = redis_response;
+    args->done = done;
+    bthread_t th;
+    if (bthread_start_background(&th, NULL, RunAsyncCall, args) != 0) {
+        PLOG(ERROR) << "Fail to start bthread, run the call in place";
+        RunAsyncCall(args);
+    }
+}
+
+void RedisClusterChannel::Describe(std::ostream& os,
+                                   const DescribeOptions& options) const {
+    os << "RedisClusterChannel[";
+    for (size_t i = 0; i < _seeds.size(); ++i) {
+        if (i != 0) {
+            os << ',';
+        }
+        os << _seeds[i];
+    }
+    size_t nnode = 0;
+    {
+        BAIDU_SCOPED_LOCK(_node_mutex);
+        nnode = _node_channels.size();
+    }
+    os << "] nodes=" << nnode;
+    if (options.verbose) {
+        butil::DoublyBufferedData<SlotTable>::ScopedPtr ptr;
+        if (const_cast<RedisClusterChannel*>(this)->_slot_table.Read(&ptr)
+            == 0) {
+            for (size_t i = 0; i < ptr->ranges.size(); ++i) {
+                os << "\nslots " << ptr->ranges[i].start << '-'
+                   << ptr->ranges[i].end << " -> " << ptr->ranges[i].node;
+            }
+        }
+    }
+}
+
+int RedisClusterChannel::CheckHealth() {
+    BAIDU_SCOPED_LOCK(_node_mutex);
+    if (_node_channels.empty()) {
+        return -1;
+    }
+    for (std::map<butil::EndPoint, Channel*>::iterator
+             it = _node_channels.begin(); it != _node_channels.end(); ++it) {
+        // CheckHealth() is protected in Channel, call through the base.
+        if (static_cast<ChannelBase*>(it->second)->CheckHealth() == 0) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+} // namespace brpc
@@ -0,0 +1,135 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef BRPC_REDIS_CLUSTER_CHANNEL_H
+#define BRPC_REDIS_CLUSTER_CHANNEL_H
+
+// To brpc developers: This is a header included by user, don't depend
+// on internal structures, use opaque pointers instead.
+
+#include <map>
+#include <vector>
+#include "butil/containers/doubly_buffered_data.h"
+#include "butil/strings/string_piece.h"
+#include "butil/synchronization/lock.h"
+#include "brpc/channel.h"
+
+namespace brpc {
+
+class RedisRequest;
+class RedisResponse;
+
+// Access a redis cluster directly without a proxy tier. This channel
+// learns the slot->node mapping from CLUSTER SLOTS, routes each
+// RedisRequest to the master serving the slot of its first key(CRC16 over
+// the hash tag as specified by the cluster spec) and follows MOVED
+// redirections with a topology refresh. Commands inside one RedisRequest
+// are pipelined to the same node, thus all keys of a multi-command request
+// should hash to the same slot(use hash tags), otherwise the server
+// replies CROSSSLOT errors.
+//
+// Example:
+//   RedisClusterChannel channel;
+//   ChannelOptions options;
+//   if (channel.Init("127.0.0.1:7000,127.0.0.1:7001", &options) != 0) {
+//       LOG(ERROR) << "Fail to init RedisClusterChannel";
+//       return -1;
+//   }
+//   RedisRequest request;
+//   request.AddCommand("GET mykey");
+//   RedisResponse response;
+//   Controller cntl;
+//   channel.CallMethod(NULL, &cntl, &request, &response, NULL);
+class RedisClusterChannel : public ChannelBase {
+public:
+    RedisClusterChannel();
+    ~RedisClusterChannel();
+
+    // Initialize with comma-separated `seed_servers' in "host:port" form.
+    // Seeds only bootstrap the topology, all masters learned from CLUSTER
+    // SLOTS are contacted directly afterwards. `options' is applied to the
+    // per-node sub channels(protocol is forced to redis) and copied, thus
+    // can be deallocated after this call.
+    // Returns 0 on success, -1 otherwise.
+    int Init(const char* seed_servers, const ChannelOptions* options);
+
+    // Route `request'(must be a RedisRequest, ditto `response') to the
+    // node serving the slot of its first key. A request without key
+    // (e.g. PING) goes to an arbitrary node. When `done' is non-NULL the
+    // call runs in a background bthread and `done' is called after
+    // `response' is filled.
+    void CallMethod(const google::protobuf::MethodDescriptor* method,
+                    google::protobuf::RpcController* controller,
+                    const google::protobuf::Message* request,
+                    google::protobuf::Message* response,
+                    google::protobuf::Closure* done);
+
+    // Fetch CLUSTER SLOTS from a known node and replace the slot table.
+    // Called automatically before the first routed request and on MOVED
+    // errors, public for users who want to warm up the topology at
+    // start-up. Returns 0 on success, -1 when no node answered.
+    int RefreshSlotTable();
+
+    // Slot of `key' as defined by the redis cluster spec: CRC16 over the
+    // hash tag({...} substring when present, otherwise the whole key)
+    // modulo 16384.
+    static int KeySlot(const butil::StringPiece& key);
+
+    void Describe(std::ostream& os, const DescribeOptions& options) const;
+    int CheckHealth();
+
+private:
+DISALLOW_COPY_AND_ASSIGN(RedisClusterChannel);
+
+    struct SlotRange {
+        int start;
+        int end;
+        butil::EndPoint node;
+        bool operator<(const SlotRange& rhs) const { return start < rhs.start; }
+    };
+    // Sorted by `start', ranges don't overlap.
+    struct SlotTable {
+        std::vector<SlotRange> ranges;
+    };
+    static size_t ReplaceSlotTable(SlotTable& bg, const SlotTable& new_table);
+
+    // Master of `slot' according to the current table. A negative `slot'
+    // picks an arbitrary node. Returns a default-constructed EndPoint when
+    // the table is empty.
+    butil::EndPoint NodeOfSlot(int slot);
+
+    // Get or create the sub channel to `node'. Channels are created
+    // lazily and kept until destruction, a cluster has a bounded number
+    // of nodes. Returns NULL when initialization fails.
+    Channel* GetNodeChannel(const butil::EndPoint& node);
+
+    // The synchronous routed call with bounded redirections.
+    void DoCall(Controller* cntl, const RedisRequest* request,
+                RedisResponse* response);
+    static void* RunAsyncCall(void* arg);
+
+    ChannelOptions _options;
+    std::vector<butil::EndPoint> _seeds;
+    butil::DoublyBufferedData<SlotTable> _slot_table;
+    std::map<butil::EndPoint, Channel*> _node_channels;
+    mutable butil::Mutex _node_mutex;
+};
+
+} // namespace brpc
+
+#endif  // BRPC_REDIS_CLUSTER_CHANNEL_H
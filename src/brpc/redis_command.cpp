@@ -361,6 +361,51 @@ RedisCommandParser::RedisCommandParser()
     , _length(0)
     , _index(0) {}
 
+// Parse "<fc><decimal>\r\n" at the front of `buf' without consuming it, in
+// one pass over the bytes instead of copy_to + find("\r\n") + strtoll.
+// Stricter than strtoll: exactly the canonical form sent by redis clients
+// is accepted, no leading spaces or pluses. Same code as in redis_reply.cpp.
+// Returns 1 on success and sets `*value' to the decimal and `*crlf_pos' to
+// the offset of '\r', 0 if `buf' does not contain the full header yet, -1
+// if the header is malformed.
+static int ParseIntegerHeader(const butil::IOBuf& buf, int64_t* value,
+                              size_t* crlf_pos) {
+    char intbuf[32];  // enough for fc + '-' + 64-bit decimal + \r\n
+    const size_t ncopied = buf.copy_to(intbuf, sizeof(intbuf));
+    size_t i = 1;  // skip fc
+    bool negative = false;
+    if (i < ncopied && intbuf[i] == '-') {
+        negative = true;
+        ++i;
+    }
+    const size_t first_digit = i;
+    uint64_t d = 0;
+    for (; i < ncopied; ++i) {
+        const uint8_t digit = (uint8_t)(intbuf[i] - '0');
+        if (digit > 9) {
+            break;
+        }
+        if (d > (std::numeric_limits<uint64_t>::max() - 9) / 10) {
+            return -1;
+        }
+        d = d * 10 + digit;
+    }
+    if (i + 1 >= ncopied) {
+        // A valid header fits in intbuf, if the copy was truncated the
+        // header can't be valid no matter what follows.
+        return (ncopied == sizeof(intbuf) ? -1 : 0);
+    }
+    if (i == first_digit || intbuf[i] != '\r' || intbuf[i + 1] != '\n') {
+        return -1;
+    }
+    if (d > (uint64_t)std::numeric_limits<int64_t>::max()) {
+        return -1;
+    }
+    *value = (negative ? -(int64_t)d : (int64_t)d);
+    *crlf_pos = i;
+    return 1;
+}
+
 ParseError RedisCommandParser::Consume(butil::IOBuf& buf,
                                        std::vector<butil::StringPiece>* args,
                                        butil::Arena* arena) {
@@ -376,17 +421,15 @@ ParseError RedisCommandParser::Consume(butil::IOBuf& buf,
     if (_parsing_array && *pfc != '$') {
         return PARSE_ERROR_ABSOLUTELY_WRONG;
     }
-    char intbuf[32];  // enough for fc + 64-bit decimal + \r\n
-    const size_t ncopied = buf.copy_to(intbuf, sizeof(intbuf) - 1);
-    intbuf[ncopied] = '\0';
-    const size_t crlf_pos = butil::StringPiece(intbuf, ncopied).find("\r\n");
-    if (crlf_pos == butil::StringPiece::npos) {  // not enough data
+    int64_t value = 0;
+    size_t crlf_pos = 0;
+    const int rc = ParseIntegerHeader(buf, &value, &crlf_pos);
+    if (rc == 0) {  // not enough data
         return PARSE_ERROR_NOT_ENOUGH_DATA;
     }
-    char* endptr = NULL;
-    int64_t value = strtoll(intbuf + 1/*skip fc*/, &endptr, 10);
-    if (endptr != intbuf + crlf_pos) {
-        LOG(ERROR) << '`' << intbuf + 1 << "' is not a valid 64-bit decimal";
+    if (rc < 0) {
+        LOG(ERROR) << "Not ended with a valid 64-bit decimal after fc="
+                   << *pfc;
         return PARSE_ERROR_ABSOLUTELY_WRONG;
     }
     if (value < 0) {
@@ -23,6 +23,7 @@
 // on internal structures, use opaque pointers instead.
 
 #include <stdint.h>
+#include "butil/atomicops.h"
 
 // Register an always-true valiator to a gflag so that the gflag is treated as
 // reloadable by brpc. If a validator exists, abort the program.
@@ -40,9 +41,46 @@
         ::brpc::RegisterFlagValidatorOrDie(                       \
             &FLAGS_##flag, (validate_fn))
 
+// Like BRPC_VALIDATE_GFLAG, but additionally defines cached_FLAGS_<flag>,
+// an atomic shadow of the gflag refreshed by the registered validator.
+// Code on hot paths should read the shadow with BRPC_CACHED_FLAG(flag)
+// instead of FLAGS_<flag>: reads of the shadow are relaxed atomic loads
+// which never tear against concurrent SetCommandLineOption() and never
+// touch gflags' registry. Use within global scope after DEFINE_xxx(flag),
+// and BRPC_DECLARE_CACHED_GFLAG in files reading the flag.
+#define BRPC_CACHED_VALIDATE_GFLAG(flag, validate_fn)                   \
+    ::brpc::CachedFlag<decltype(FLAGS_##flag)>                          \
+        cached_FLAGS_##flag(FLAGS_##flag);                              \
+    static bool validate_and_cache_FLAGS_##flag(                        \
+        const char* name, decltype(FLAGS_##flag) value) {               \
+        if (!(validate_fn)(name, value)) {                              \
+            return false;                                               \
+        }                                                               \
+        cached_FLAGS_##flag.set(value);                                 \
+        return true;                                                    \
+    }                                                                   \
+    const int register_FLAGS_ ## flag ## _dummy                         \
+                 __attribute__((__unused__)) =                          \
+        ::brpc::RegisterFlagValidatorOrDie(                             \
+            &FLAGS_##flag, validate_and_cache_FLAGS_##flag)
+
+#define BRPC_DECLARE_CACHED_GFLAG(type, flag)                           \
+    extern ::brpc::CachedFlag<type> cached_FLAGS_##flag
+
+#define BRPC_CACHED_FLAG(flag) (cached_FLAGS_##flag.get())
 
 namespace brpc {
 
+// An atomically-updated shadow of a gflag, see BRPC_CACHED_VALIDATE_GFLAG.
+template <typename T> class CachedFlag {
+public:
+    explicit CachedFlag(T initial_value) : _value(initial_value) {}
+    T get() const { return _value.load(butil::memory_order_relaxed); }
+    void set(T new_value) { _value.store(new_value, butil::memory_order_relaxed); }
+private:
+    butil::atomic<T> _value;
+};
+
 extern bool PassValidate(const char*, bool);
 extern bool PassValidate(const char*, int32_t);
 extern bool PassValidate(const char*, int64_t);
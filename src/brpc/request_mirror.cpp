@@ -0,0 +1,146 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include "butil/logging.h"
+#include "butil/fast_rand.h"
+#include "brpc/callback.h"
+#include "brpc/controller.h"
+#include "brpc/serialized_request.h"
+#include "brpc/request_mirror.h"
+
+namespace brpc {
+
+RequestMirrorOptions::RequestMirrorOptions()
+    : sample_percent(1)
+    , max_inflight(1024)
+    , timeout_ms(500) {
+}
+
+RequestMirror::RequestMirror()
+    : _init(false)
+    , _inflight(0) {
+}
+
+RequestMirror::~RequestMirror() {
+}
+
+int RequestMirror::Init(const RequestMirrorOptions& options) {
+    if (options.naming_service_url.empty()) {
+        LOG(ERROR) << "Invalid RequestMirrorOptions.naming_service_url: empty";
+        return -1;
+    }
+    if (options.sample_percent < 0 || options.sample_percent > 100) {
+        LOG(ERROR) << "Invalid RequestMirrorOptions.sample_percent="
+                   << options.sample_percent << ", must be in [0, 100]";
+        return -1;
+    }
+    if (options.max_inflight <= 0) {
+        LOG(ERROR) << "Invalid RequestMirrorOptions.max_inflight="
+                   << options.max_inflight;
+        return -1;
+    }
+    ChannelOptions chan_options;
+    chan_options.protocol = PROTOCOL_BAIDU_STD;
+    chan_options.timeout_ms = options.timeout_ms;
+    // A congested mirror should shed load rather than amplify it.
+    chan_options.max_retry = 0;
+    int rc = 0;
+    if (options.load_balancer_name.empty()) {
+        rc = _channel.Init(options.naming_service_url.c_str(), &chan_options);
+    } else {
+        rc = _channel.Init(options.naming_service_url.c_str(),
+                           options.load_balancer_name.c_str(), &chan_options);
+    }
+    if (rc != 0) {
+        LOG(ERROR) << "Fail to init channel to mirror destination `"
+                   << options.naming_service_url << '\'';
+        return -1;
+    }
+    _options = options;
+    _init = true;
+    return 0;
+}
+
+bool RequestMirror::Sample() {
+    if (!_init || _options.sample_percent <= 0) {
+        return false;
+    }
+    if (_options.sample_percent >= 100) {
+        return true;
+    }
+    return butil::fast_rand_less_than(100) < (uint64_t)_options.sample_percent;
+}
+
+// Ends a mirrored RPC: releases the inflight budget and counts failures.
+// Running as the `done' of CallMethod, thus responsible for deleting cntl.
+class RequestMirrorResponseHandler {
+public:
+    static void Run(RequestMirror* mirror, Controller* cntl) {
+        std::unique_ptr<Controller> cntl_guard(cntl);
+        if (cntl->Failed()) {
+            mirror->_failed << 1;
+        }
+        mirror->_inflight.fetch_sub(1, butil::memory_order_relaxed);
+    }
+};
+
+void RequestMirror::Mirror(SampledRequest* sample) {
+    std::unique_ptr<SampledRequest> sample_guard(sample);
+    if (!_init || sample == NULL) {
+        return;
+    }
+    if (_inflight.fetch_add(1, butil::memory_order_relaxed) >=
+        _options.max_inflight) {
+        // Mirror destination lags behind, drop instead of queueing.
+        _inflight.fetch_sub(1, butil::memory_order_relaxed);
+        _dropped << 1;
+        return;
+    }
+    Controller* cntl = new (std::nothrow) Controller;
+    if (NULL == cntl) {
+        _inflight.fetch_sub(1, butil::memory_order_relaxed);
+        return;
+    }
+    // Sending through the sampled request works exactly as rpc_replay:
+    // the serialized body and attachment go out as-is, sharing blocks
+    // with the inbound message by refcount.
+    SerializedRequest req;
+    cntl->reset_sampled_request(sample_guard.release());
+    if (sample->meta.attachment_size() > 0) {
+        sample->request.cutn(
+            &req.serialized_data(),
+            sample->request.size() - sample->meta.attachment_size());
+        cntl->request_attachment() = sample->request.movable();
+    } else {
+        req.serialized_data() = sample->request.movable();
+    }
+    _mirrored << 1;
+    google::protobuf::Closure* done =
+        ::brpc::NewCallback(RequestMirrorResponseHandler::Run, this, cntl);
+    _channel.CallMethod(NULL/*method in cntl->sampled_request()*/,
+                        cntl, &req, NULL/*ignore response*/, done);
+}
+
+void RequestMirror::Expose(const butil::StringPiece& prefix) {
+    std::string expose_prefix = prefix.as_string();
+    _mirrored.expose_as(expose_prefix, "mirrored_requests");
+    _dropped.expose_as(expose_prefix, "mirror_dropped");
+    _failed.expose_as(expose_prefix, "mirror_failed");
+}
+
+} // namespace brpc
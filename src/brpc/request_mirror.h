@@ -0,0 +1,107 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef BRPC_REQUEST_MIRROR_H
+#define BRPC_REQUEST_MIRROR_H
+
+#include "butil/atomicops.h"
+#include "butil/strings/string_piece.h"
+#include "bvar/bvar.h"
+#include "brpc/channel.h"
+#include "brpc/rpc_dump.h"                     // SampledRequest
+
+namespace brpc {
+
+struct RequestMirrorOptions {
+    // Constructed with default options.
+    RequestMirrorOptions();
+
+    // Where mirrored requests are sent, same format as the first two
+    // parameters of Channel::Init. When `load_balancer_name' is empty
+    // `naming_service_url' must be a single "host:port".
+    std::string naming_service_url;
+    std::string load_balancer_name;
+
+    // Percentage of inbound requests mirrored, in [0, 100].
+    // Default: 1
+    int sample_percent;
+
+    // Max number of unfinished mirrored RPCs. Requests sampled while the
+    // mirror destination lags behind this budget are dropped instead of
+    // queued, so a slow mirror never builds up memory in the server.
+    // Default: 1024
+    int max_inflight;
+
+    // Timeout of mirrored RPCs in milliseconds.
+    // Default: 500
+    int timeout_ms;
+};
+
+// Tee a sampled fraction of inbound requests to another server while they
+// are served normally, so that a new version can be validated against live
+// traffic without the dump/replay turnaround of rpc_dump. Mirrored calls
+// are fire-and-forget: responses are ignored and errors only counted. The
+// request payload is shared by refcount with the inbound message, nothing
+// is copied.
+//
+// Example:
+//   static RequestMirror mirror;
+//   RequestMirrorOptions mirror_options;
+//   mirror_options.naming_service_url = "10.0.0.5:8000";
+//   mirror_options.sample_percent = 5;
+//   if (mirror.Init(mirror_options) != 0) { ... }
+//   server_options.request_mirror = &mirror;
+class RequestMirror {
+public:
+    RequestMirror();
+    virtual ~RequestMirror();
+
+    // Initialize the channel to the mirror destination. Must be called
+    // before adding to ServerOptions.
+    // Returns 0 on success, -1 otherwise.
+    int Init(const RequestMirrorOptions& options);
+
+    // Returns true when the current request should be mirrored. Cheap
+    // enough to be called for every request.
+    bool Sample();
+
+    // Send `sample' to the mirror destination asynchronously. Ownership
+    // of `sample' is taken. Dropped silently (counted in a bvar) when
+    // max_inflight is reached.
+    void Mirror(SampledRequest* sample);
+
+    // Expose internal counters prefixed with `prefix', called by Server.
+    void Expose(const butil::StringPiece& prefix);
+
+private:
+friend class RequestMirrorResponseHandler;
+    DISALLOW_COPY_AND_ASSIGN(RequestMirror);
+
+    RequestMirrorOptions _options;
+    bool _init;
+    Channel _channel;
+    butil::atomic<int> _inflight;
+    bvar::Adder<int64_t> _mirrored;
+    bvar::Adder<int64_t> _dropped;
+    bvar::Adder<int64_t> _failed;
+};
+
+} // namespace brpc
+
+
+#endif  // BRPC_REQUEST_MIRROR_H
@@ -0,0 +1,94 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include "butil/time.h"                      // gettimeofday_us
+#include "butil/scoped_lock.h"               // BAIDU_SCOPED_LOCK
+#include "brpc/response_cache.h"
+
+
+namespace brpc {
+
+ResponseCacheOptions::ResponseCacheOptions()
+    : ttl_ms(1000)
+    , max_bytes(64 * 1024 * 1024UL) {
+}
+
+ResponseCache::ResponseCache(const ResponseCacheOptions& options)
+    : _options(options)
+    // Bounded by bytes (in Put) rather than by entries.
+    , _cache(CacheMap::NO_AUTO_EVICT)
+    , _bytes(0) {
+}
+
+ResponseCache::~ResponseCache() {
+}
+
+bool ResponseCache::Get(const std::string& key, butil::IOBuf* buf) {
+    const int64_t now_us = butil::gettimeofday_us();
+    BAIDU_SCOPED_LOCK(_mutex);
+    CacheMap::iterator it = _cache.Get(key);
+    if (it == _cache.end()) {
+        return false;
+    }
+    if (now_us - it->second.fetch_real_us > _options.ttl_ms * 1000L) {
+        // Too stale. Remove the entry so that it does not occupy the
+        // bytes bound until being asked again.
+        _bytes -= it->second.data.size();
+        _cache.Erase(it);
+        return false;
+    }
+    // Copying an IOBuf only references the blocks, the caller parses from
+    // the copy outside the lock without racing with eviction.
+    *buf = it->second.data;
+    return true;
+}
+
+void ResponseCache::Put(const std::string& key, const butil::IOBuf& buf) {
+    if (buf.size() > _options.max_bytes) {
+        return;
+    }
+    const int64_t now_us = butil::gettimeofday_us();
+    BAIDU_SCOPED_LOCK(_mutex);
+    CacheMap::iterator it = _cache.Peek(key);
+    if (it != _cache.end()) {
+        // MRUCache::Put replaces the entry, account its bytes out first.
+        _bytes -= it->second.data.size();
+    }
+    CacheEntry entry;
+    entry.data = buf;
+    entry.fetch_real_us = now_us;
+    _cache.Put(key, entry);
+    _bytes += buf.size();
+    while (_bytes > _options.max_bytes) {
+        CacheMap::reverse_iterator oldest = _cache.rbegin();
+        _bytes -= oldest->second.data.size();
+        _cache.Erase(oldest);
+    }
+}
+
+size_t ResponseCache::size() const {
+    BAIDU_SCOPED_LOCK(_mutex);
+    return _cache.size();
+}
+
+size_t ResponseCache::bytes() const {
+    BAIDU_SCOPED_LOCK(_mutex);
+    return _bytes;
+}
+
+} // namespace brpc
@@ -0,0 +1,95 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef BRPC_RESPONSE_CACHE_H
+#define BRPC_RESPONSE_CACHE_H
+
+#include <string>
+#include "butil/iobuf.h"                     // butil::IOBuf
+#include "butil/containers/mru_cache.h"      // butil::MRUCache
+#include "butil/synchronization/lock.h"      // butil::Mutex
+
+
+namespace brpc {
+
+struct ResponseCacheOptions {
+    // Constructed with default options.
+    ResponseCacheOptions();
+
+    // Cached responses older than this many milliseconds are treated as
+    // missing and replaced by the next received response.
+    // Default: 1000
+    int32_t ttl_ms;
+
+    // Total bytes of cached responses never exceed this value, least
+    // recently used entries are evicted when a new response would break
+    // the bound. Responses larger than the bound are not cached at all.
+    // Default: 64MB
+    size_t max_bytes;
+};
+
+// A cache of serialized responses keyed by serialized requests, for
+// serving repetitive idempotent RPC (e.g. fetching a config that rarely
+// changes) from memory without touching the network. Set
+// ChannelOptions.response_cache to enable. One cache may be shared by
+// multiple channels and is thread-safe, but entries are keyed by method
+// name and request bytes only, thus channels sharing a cache must target
+// the same logical service. Not useful for methods with side effects or
+// time-sensitive responses: a cached response may be up to ttl_ms stale.
+class ResponseCache {
+public:
+    explicit ResponseCache(const ResponseCacheOptions& options);
+    ~ResponseCache();
+
+    // Copy the serialized response cached under `key' into `*buf' and
+    // mark the entry as most-recently-used.
+    // Returns true iff the entry exists and is not older than ttl_ms,
+    // stale entries are removed.
+    bool Get(const std::string& key, butil::IOBuf* buf);
+
+    // Cache the serialized response in `buf' under `key', replacing any
+    // previous entry with the same key.
+    void Put(const std::string& key, const butil::IOBuf& buf);
+
+    const ResponseCacheOptions& options() const { return _options; }
+
+    // Number of cached entries and total bytes of cached responses.
+    size_t size() const;
+    size_t bytes() const;
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(ResponseCache);
+
+    struct CacheEntry {
+        butil::IOBuf data;
+        int64_t fetch_real_us;  // when the response was received
+    };
+    // MRU rather than a plain hashmap so that eviction under max_bytes
+    // removes the entries least likely to be asked again.
+    typedef butil::MRUCache<std::string, CacheEntry> CacheMap;
+
+    ResponseCacheOptions _options;
+    mutable butil::Mutex _mutex;
+    CacheMap _cache;
+    size_t _bytes;
+};
+
+} // namespace brpc
+
+
+#endif  // BRPC_RESPONSE_CACHE_H
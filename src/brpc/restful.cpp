@@ -17,6 +17,7 @@
 
 
 #include <google/protobuf/descriptor.h>
+#include "butil/atomicops.h"
 #include "brpc/log.h"
 #include "brpc/restful.h"
 #include "brpc/details/method_status.h"
@@ -510,4 +511,15 @@ RestfulMap::FindMethodProperty(const butil::StringPiece& method_path,
     return NULL;
 }
 
+// Starting from 1 so that caches initialized with 0 miss at first use.
+static butil::atomic<uint64_t> g_method_resolution_version(1);
+
+uint64_t GetMethodResolutionVersion() {
+    return g_method_resolution_version.load(butil::memory_order_acquire);
+}
+
+void BumpMethodResolutionVersion() {
+    g_method_resolution_version.fetch_add(1, butil::memory_order_release);
+}
+
 } // namespace brpc
@@ -108,6 +108,15 @@ private:
 
 std::ostream& operator<<(std::ostream& os, const RestfulMethodPath&);
 
+// Version of path->method resolution results of all servers in this
+// process. Bumped whenever any server (re)starts or changes its service
+// set, so that caches of resolution results (see FindMethodPropertyByURI
+// in http_rpc_protocol.cpp) can invalidate entries pointing into
+// rebuilt/freed method tables.
+uint64_t GetMethodResolutionVersion();
+// Called by Server on changes invalidating previous resolutions.
+void BumpMethodResolutionVersion();
+
 } // namespace brpc
 
 
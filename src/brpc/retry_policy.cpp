@@ -16,13 +16,35 @@
 // under the License.
 
 
+#include <gflags/gflags.h>
+#include "butil/fast_rand.h"
+#include "butil/atomicops.h"
+#include "bvar/bvar.h"
+#include "brpc/reloadable_flags.h"
 #include "brpc/retry_policy.h"
 
 
 namespace brpc {
 
+DEFINE_int32(retry_budget_percent, 0,
+             "Process-wide budget for retries as a percentage of begun RPCs."
+             " Retries beyond the budget are not sent and the RPC ends with"
+             " the error that triggered them. 0 disables the budget");
+
+static bool validate_retry_budget_percent(const char*, int32_t v) {
+    return v >= 0 && v <= 100;
+}
+BRPC_VALIDATE_GFLAG(retry_budget_percent, validate_retry_budget_percent);
+
+static bvar::Adder<int64_t> s_retry_denied_by_budget(
+    "rpc_retry_denied_by_budget");
+
 RetryPolicy::~RetryPolicy() {}
 
+int32_t RetryPolicy::GetBackoffTimeMs(const Controller*) const {
+    return 0;
+}
+
 class RpcRetryPolicy : public RetryPolicy {
 public:
     bool DoRetry(const Controller* controller) const {
@@ -46,6 +68,92 @@ public:
     }
 };
 
+// True for errors of a specific server instance rather than of the whole
+// cluster. Backoff does not help with these: the instance was already fed
+// into its CircuitBreaker (when enabled) and excluded from further server
+// selections of the RPC, the retry should reach another instance at once.
+static bool is_instance_error(int error_code) {
+    return (EFAILEDSOCKET == error_code
+            || EEOF == error_code
+            || EHOSTDOWN == error_code
+            || ELOGOFF == error_code
+            || EPIPE == error_code
+            || ECONNREFUSED == error_code
+            || ECONNRESET == error_code);
+}
+
+RetryPolicyWithBackoff::RetryPolicyWithBackoff(
+    int32_t base_backoff_ms, int32_t max_backoff_ms)
+    : _base_backoff_ms(base_backoff_ms)
+    , _max_backoff_ms(max_backoff_ms) {
+    if (_base_backoff_ms < 1) {
+        _base_backoff_ms = 1;
+    }
+    if (_max_backoff_ms < _base_backoff_ms) {
+        _max_backoff_ms = _base_backoff_ms;
+    }
+}
+
+bool RetryPolicyWithBackoff::DoRetry(const Controller* controller) const {
+    return DefaultRetryPolicy()->DoRetry(controller);
+}
+
+int32_t RetryPolicyWithBackoff::GetBackoffTimeMs(
+    const Controller* controller) const {
+    if (is_instance_error(controller->ErrorCode())) {
+        return 0;
+    }
+    // nretry was already incremented for the retry being issued, thus it's
+    // 1 for the first retry.
+    const int nretry = controller->retried_count();
+    int64_t bound = _max_backoff_ms;
+    if (nretry - 1 < 30 && (_base_backoff_ms << (nretry - 1)) < bound) {
+        bound = _base_backoff_ms << (nretry - 1);
+    }
+    // Full jitter: uniform over [0, bound].
+    return (int32_t)butil::fast_rand_less_than((uint64_t)bound + 1);
+}
+
+// Milli-tokens, so that percentages below 100 accumulate without rounding
+// to zero. One retry costs RETRY_TOKEN_SCALE.
+static const int64_t RETRY_TOKEN_SCALE = 1000;
+static butil::atomic<int64_t> g_retry_tokens(0);
+
+void AddRetryBudget() {
+    const int32_t percent = FLAGS_retry_budget_percent;
+    if (percent <= 0) {
+        return;
+    }
+    const int64_t earn = percent * RETRY_TOKEN_SCALE / 100;
+    // Cap the bucket at the budget earned by the last 1000 requests so
+    // that a long error-free period does not pile up tokens for an
+    // unbounded retry burst later.
+    const int64_t cap = earn * 1000;
+    int64_t expected = g_retry_tokens.load(butil::memory_order_relaxed);
+    do {
+        if (expected >= cap) {
+            return;
+        }
+    } while (!g_retry_tokens.compare_exchange_weak(
+                 expected, expected + earn, butil::memory_order_relaxed));
+}
+
+bool ConsumeRetryBudget() {
+    if (FLAGS_retry_budget_percent <= 0) {
+        return true;
+    }
+    int64_t expected = g_retry_tokens.load(butil::memory_order_relaxed);
+    do {
+        if (expected < RETRY_TOKEN_SCALE) {
+            s_retry_denied_by_budget << 1;
+            return false;
+        }
+    } while (!g_retry_tokens.compare_exchange_weak(
+                 expected, expected - RETRY_TOKEN_SCALE,
+                 butil::memory_order_relaxed));
+    return true;
+}
+
 // NOTE(gejun): g_default_policy can't be deleted on process's exit because
 // client-side may still retry and use the policy at exit
 static pthread_once_t g_default_policy_once = PTHREAD_ONCE_INIT;
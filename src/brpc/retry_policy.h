@@ -68,11 +68,51 @@ public:
     virtual bool DoRetry(const Controller* controller) const = 0;
     //                                                   ^
     //                                don't forget the const modifier
+
+    // Returns the time in milliseconds that the retry decided by DoRetry()
+    // should wait before being issued. 0 (the default) issues the retry
+    // immediately, which was the only behavior before this method existed.
+    // The wait is skipped when it would cross the deadline of the RPC, in
+    // which case the RPC soon fails with the error that triggered the retry.
+    virtual int32_t GetBackoffTimeMs(const Controller* controller) const;
+};
+
+// A RetryPolicy retrying the same errors as the default one, with
+// exponential backoff: the k-th retry waits up to min(base_backoff_ms *
+// 2^(k-1), max_backoff_ms) milliseconds, jittered uniformly over [0, that
+// bound] so that retries from many clients do not arrive at an overloaded
+// server in synchronized waves. Errors that indicate a broken instance
+// rather than overload (connection failures etc.) are retried without
+// backoff: the failed server was already reported to its CircuitBreaker
+// and excluded from the server selection of this RPC, thus the retry goes
+// to another instance immediately.
+// Set ChannelOptions.retry_policy to an instance of this class (or a
+// subclass overriding DoRetry) to enable backoff for a channel. The
+// instance must live as long as the channel.
+class RetryPolicyWithBackoff : public RetryPolicy {
+public:
+    RetryPolicyWithBackoff(int32_t base_backoff_ms, int32_t max_backoff_ms);
+    bool DoRetry(const Controller* controller) const;
+    int32_t GetBackoffTimeMs(const Controller* controller) const;
+
+private:
+    int32_t _base_backoff_ms;
+    int32_t _max_backoff_ms;
 };
 
 // Get the RetryPolicy used by brpc.
 const RetryPolicy* DefaultRetryPolicy();
 
+// Process-wide retry budget, controlled by -retry_budget_percent: each RPC
+// issuing its first attempt earns that percentage of one retry token, each
+// retry spends one token. When the bucket is empty the retry is not sent
+// and the RPC ends with the error that triggered it, so that retries are
+// bounded to roughly -retry_budget_percent of the request rate no matter
+// how many channels are retrying. Both functions are no-ops returning true
+// when the flag is 0 (the default).
+void AddRetryBudget();
+bool ConsumeRetryBudget();
+
 } // namespace brpc
 
 
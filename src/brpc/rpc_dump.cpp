@@ -18,6 +18,8 @@
 
 #include <gflags/gflags.h>
 #include <fcntl.h>                    // O_CREAT
+#include <sys/mman.h>                 // mmap
+#include <sys/stat.h>                 // fstat
 #include "butil/file_util.h"
 #include "butil/raw_pack.h"
 #include "butil/unique_ptr.h"
@@ -57,14 +59,29 @@ DEFINE_int32(rpc_dump_max_files, 32,
              "If new file is needed, oldest file is removed.");
 DEFINE_int32(rpc_dump_max_requests_in_one_file, 1000,
              "Max number of requests in one dumped file");
+DEFINE_bool(rpc_dump_write_index, false,
+            "Append an offset index to each dumped file so that the file "
+            "can be replayed randomly via IndexedSampleReader");
 
 BRPC_VALIDATE_GFLAG(rpc_dump, PassValidate);
+BRPC_VALIDATE_GFLAG(rpc_dump_write_index, PassValidate);
 BRPC_VALIDATE_GFLAG(rpc_dump_max_requests_in_one_file, PositiveInteger);
 BRPC_VALIDATE_GFLAG(rpc_dump_max_files, PositiveInteger);
 
 static const size_t UNWRITTEN_BUFSIZE = 1024 * 1024;
 static const int64_t FLUSH_TIMEOUT = 2000000L; // 2s
 
+// Layout of the index appended to a dumped file when
+// -rpc_dump_write_index is on:
+//   "PRPX" | pack32(count) | count * pack64(offset) | pack32(count) | "PRPX"
+// The trailing count/magic let a reader locate the index by seeking from
+// the end of file; the leading ones let sequential SampleIterator skip it.
+static const char* const INDEX_MAGIC = "PRPX";
+static const size_t INDEX_OVERHEAD = 16;  // leading/trailing magic+count
+
+static SampledRequest* PopOneSample(butil::IOBuf& buf, bool* format_error,
+                                    bool* reached_index);
+
 class RpcDumpContext {
 public:
     void SaveFlags();
@@ -72,15 +89,17 @@ public:
     void SetRound(size_t round);
     
     void Dump(size_t round, SampledRequest*);
-    
+
     static bool Serialize(butil::IOBuf& buf, SampledRequest* sample);
-    
+
     RpcDumpContext()
         : _cur_req_count(0)
+        , _next_offset(0)
         , _cur_fd(-1)
         , _last_round(0)
         , _max_requests_in_one_file(0)
         , _max_files(0)
+        , _write_index(false)
         , _sched_write_time(butil::gettimeofday_us() + FLUSH_TIMEOUT)
         , _last_file_time(0)
     {
@@ -97,13 +116,20 @@ public:
     }
     
 private:
+    // Append the offset index of current file to _cur_fd.
+    void WriteIndex();
+
     std::string _command_name;
     int _cur_req_count; // written #req in current file
+    // offsets of requests in current file, for the offset index.
+    std::vector<uint64_t> _offsets;
+    uint64_t _next_offset; // offset of the next request in current file
     int _cur_fd;        // fd of current file
     size_t _last_round;
     // save gflags which could be reloaded at anytime.
     int _max_requests_in_one_file;
     int _max_files;
+    bool _write_index;
     int64_t _sched_write_time;     // duetime of last write
     int64_t _last_file_time;  // time for the postfix of last file
     // the queue for remembering oldest file to remove.
@@ -149,6 +175,7 @@ void RpcDumpContext::SaveFlags() {
 
     _max_requests_in_one_file = FLAGS_rpc_dump_max_requests_in_one_file;
     _max_files = FLAGS_rpc_dump_max_files;
+    _write_index = FLAGS_rpc_dump_write_index;
 }
 
 // Dump a request.
@@ -158,9 +185,14 @@ void RpcDumpContext::Dump(size_t round, SampledRequest* sample) {
         SaveFlags();
     }
 
+    const size_t old_size = _unwritten_buf.size();
     if (!Serialize(_unwritten_buf, sample)) {
         return;
     }
+    // Always track offsets(cheap) so that toggling -rpc_dump_write_index
+    // in the middle of a file still yields a complete index at closure.
+    _offsets.push_back(_next_offset);
+    _next_offset += _unwritten_buf.size() - old_size;
     ++_cur_req_count;
     if (_cur_req_count >= _max_requests_in_one_file) {
         // Reach the limit of #request in a file.
@@ -227,10 +259,45 @@ void RpcDumpContext::Dump(size_t round, SampledRequest* sample) {
     if (fail_to_write || _cur_req_count >= _max_requests_in_one_file) {
         // clean up
         if (_cur_fd >= 0) {
+            if (!fail_to_write && _write_index) {
+                WriteIndex();
+            }
             close(_cur_fd);
             _cur_fd = -1;
         }
         _cur_req_count = 0;
+        _offsets.clear();
+        _next_offset = 0;
+    }
+}
+
+void RpcDumpContext::WriteIndex() {
+    if (_offsets.empty()) {
+        return;
+    }
+    butil::IOBuf buf;
+    char header[8];
+    uint32_t* dummy = (uint32_t*)header;  // suppress strict-alias warning
+    *dummy = *(uint32_t*)INDEX_MAGIC;
+    butil::RawPacker(header + 4).pack32(_offsets.size());
+    buf.append(header, sizeof(header));
+    for (size_t i = 0; i < _offsets.size(); ++i) {
+        char off_buf[8];
+        butil::RawPacker(off_buf).pack64(_offsets[i]);
+        buf.append(off_buf, sizeof(off_buf));
+    }
+    char footer[8];
+    butil::RawPacker(footer).pack32(_offsets.size());
+    dummy = (uint32_t*)(footer + 4);
+    *dummy = *(uint32_t*)INDEX_MAGIC;
+    buf.append(footer, sizeof(footer));
+    while (!buf.empty()) {
+        if (buf.cut_into_file_descriptor(_cur_fd) < 0) {
+            if (errno != EINTR && errno != EAGAIN) {
+                PLOG(ERROR) << "Fail to write index into " << _cur_filename;
+                return;
+            }
+        }
     }
 }
 
@@ -275,11 +342,14 @@ SampleIterator::~SampleIterator() {
 SampledRequest* SampleIterator::Next() {
     if (!_cur_buf.empty()) {
         bool error = false;
-        SampledRequest* r = Pop(_cur_buf, &error);
+        bool reached_index = false;
+        SampledRequest* r = PopOneSample(_cur_buf, &error, &reached_index);
         if (r) {
             return r;
         }
-        if (error) {
+        if (error || reached_index) {
+            // Skip the rest of current file: it's either broken or only
+            // contains the offset index.
             _cur_buf.clear();
             if (_cur_fd >= 0) {
                 ::close(_cur_fd);
@@ -319,13 +389,22 @@ SampledRequest* SampleIterator::Next() {
     }
 }
 
-SampledRequest* SampleIterator::Pop(butil::IOBuf& buf, bool* format_error) {
+// Parse one request from `buf'. Set `format_error' to true when the buf
+// does not match the format, set `reached_index' to true when the buf
+// begins with the offset index appended by -rpc_dump_write_index, in
+// which case the rest of the file contains no more samples.
+static SampledRequest* PopOneSample(butil::IOBuf& buf, bool* format_error,
+                                    bool* reached_index) {
     char backing_buf[12];
     const char* p = (const char*)buf.fetch(backing_buf, sizeof(backing_buf));
     if (NULL == p) {  // buf.length() < sizeof(backing_buf)
         return NULL;
     }
     if (*(const uint32_t*)p != *(const uint32_t*)"PRPC") {
+        if (*(const uint32_t*)p == *(const uint32_t*)INDEX_MAGIC) {
+            *reached_index = true;
+            return NULL;
+        }
         LOG(ERROR) << "Unmatched magic string";
         *format_error = true;
         return NULL;
@@ -359,6 +438,117 @@ SampledRequest* SampleIterator::Pop(butil::IOBuf& buf, bool* format_error) {
     return req.release();
 }
 
+SampledRequest* SampleIterator::Pop(butil::IOBuf& buf, bool* format_error) {
+    bool reached_index = false;
+    SampledRequest* sample = PopOneSample(buf, format_error, &reached_index);
+    if (reached_index) {
+        buf.clear();
+    }
+    return sample;
+}
+
+static void DeleteNothing(void*) {}
+
+IndexedSampleReader::IndexedSampleReader()
+    : _map(MAP_FAILED)
+    , _map_size(0)
+    , _index(NULL)
+    , _count(0)
+    , _data_end(0) {
+}
+
+IndexedSampleReader::~IndexedSampleReader() {
+    Close();
+}
+
+void IndexedSampleReader::Close() {
+    if (_map != MAP_FAILED) {
+        munmap(_map, _map_size);
+        _map = MAP_FAILED;
+    }
+    _map_size = 0;
+    _index = NULL;
+    _count = 0;
+    _data_end = 0;
+}
+
+int IndexedSampleReader::Open(const std::string& path) {
+    Close();
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        PLOG(ERROR) << "Fail to open " << path;
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        PLOG(ERROR) << "Fail to fstat " << path;
+        ::close(fd);
+        return -1;
+    }
+    if ((size_t)st.st_size < INDEX_OVERHEAD) {
+        ::close(fd);
+        return -1;
+    }
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);  // the mapping remains valid after closing the fd
+    if (map == MAP_FAILED) {
+        PLOG(ERROR) << "Fail to mmap " << path;
+        return -1;
+    }
+    const char* base = (const char*)map;
+    const size_t size = st.st_size;
+    if (memcmp(base + size - 4, INDEX_MAGIC, 4) != 0) {
+        RPC_VLOG << path << " has no index";
+        munmap(map, size);
+        return -1;
+    }
+    uint32_t count = 0;
+    butil::RawUnpacker(base + size - 8).unpack32(count);
+    if (count == 0 || size < INDEX_OVERHEAD + 8 * (size_t)count) {
+        LOG(ERROR) << "Invalid count=" << count << " in index of " << path;
+        munmap(map, size);
+        return -1;
+    }
+    const size_t index_begin = size - INDEX_OVERHEAD - 8 * (size_t)count;
+    uint32_t count2 = 0;
+    butil::RawUnpacker(base + index_begin + 4).unpack32(count2);
+    if (memcmp(base + index_begin, INDEX_MAGIC, 4) != 0 || count2 != count) {
+        LOG(ERROR) << "Broken index in " << path;
+        munmap(map, size);
+        return -1;
+    }
+    _map = map;
+    _map_size = size;
+    _index = base + index_begin + 8;
+    _count = count;
+    _data_end = index_begin;
+    return 0;
+}
+
+SampledRequest* IndexedSampleReader::Get(size_t index) const {
+    if (index >= _count) {
+        return NULL;
+    }
+    uint64_t begin = 0;
+    uint64_t end = _data_end;
+    butil::RawUnpacker(_index + 8 * index).unpack64(begin);
+    if (index + 1 < _count) {
+        butil::RawUnpacker(_index + 8 * (index + 1)).unpack64(end);
+    }
+    if (begin >= end || end > _data_end) {
+        LOG(ERROR) << "Invalid range[" << begin << ',' << end
+                   << ") at index=" << index;
+        return NULL;
+    }
+    // Reference the mapping directly. The no-op deleter is correct since
+    // the mapping outlives returned samples as documented in rpc_dump.h.
+    butil::IOBuf buf;
+    buf.append_user_data((char*)_map + begin, end - begin, DeleteNothing);
+    bool format_error = false;
+    bool reached_index = false;
+    return PopOneSample(buf, &format_error, &reached_index);
+}
+
 #undef DUMPED_FILE_PREFIX
 
 } // namespace brpc
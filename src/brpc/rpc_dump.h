@@ -93,13 +93,48 @@ private:
     // Parse on request from the buf. Set `format_error' to true when
     // the buf does not match the format.
     static SampledRequest* Pop(butil::IOBuf& buf, bool* format_error);
-    
+
     butil::IOPortal _cur_buf;
     int _cur_fd;
     butil::FileEnumerator* _enum;
     butil::FilePath _dir;
 };
 
+// Random access to samples in a single dumped file that ends with an
+// offset index, which is appended when -rpc_dump_write_index is on.
+// The file is mmap()-ed and requests returned by Get() reference the
+// mapping directly without copying, thus they must not be accessed
+// after this reader is destroyed or Close()-ed.
+class IndexedSampleReader {
+public:
+    IndexedSampleReader();
+    ~IndexedSampleReader();
+
+    // Map the file at `path' and locate the index at its end.
+    // Returns 0 on success, -1 otherwise(including files without index).
+    int Open(const std::string& path);
+
+    // Unmap the file. Called in dtor as well.
+    void Close();
+
+    // Number of samples in the mapped file.
+    size_t count() const { return _count; }
+
+    // Parse the index-th sample. The `request' field of the returned
+    // sample references the mapping. This method is thread-safe.
+    // Returns the sample which should be deleted by caller, NULL on error.
+    SampledRequest* Get(size_t index) const;
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(IndexedSampleReader);
+
+    void* _map;
+    size_t _map_size;
+    const char* _index;   // start of the offset array inside the mapping
+    size_t _count;
+    uint64_t _data_end;   // offset where sample records end
+};
+
 } // namespace brpc
 
 
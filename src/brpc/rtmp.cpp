@@ -1270,6 +1270,25 @@ int RtmpStreamBase::SendMessage(uint32_t timestamp,
     return _rtmpsock->Write(msg);
 }
 
+int RtmpStreamBase::SendSharedMessage(uint32_t timestamp,
+                                      uint8_t message_type,
+                                      const butil::IOBuf& body) {
+    if (_rtmpsock == NULL || _chunk_stream_id == 0 || _paused) {
+        errno = EPERM;
+        return -1;
+    }
+    SocketMessagePtr<policy::RtmpUnsentMessage> msg(new policy::RtmpUnsentMessage);
+    msg->header.timestamp = timestamp;
+    msg->header.message_length = body.size();
+    msg->header.message_type = message_type;
+    msg->header.stream_id = _message_stream_id;
+    msg->chunk_stream_id = _chunk_stream_id;
+    // The assignment shares blocks of `body' by reference instead of
+    // copying the payload.
+    msg->body = body;
+    return _rtmpsock->Write(msg);
+}
+
 int RtmpStreamBase::SendControlMessage(
     uint8_t message_type, const void* body, size_t size) {
     if (_rtmpsock == NULL) {
@@ -1457,6 +1476,102 @@ int RtmpStreamBase::SendStopMessage(const butil::StringPiece&) {
     return -1;
 }
 
+template <typename Msg>
+size_t RtmpStreamBase::SendBodyToStreams(
+    RtmpStreamBase* const* streams, size_t nstream,
+    uint32_t timestamp, uint8_t message_type, const butil::IOBuf& body,
+    const Msg& msg, int (RtmpStreamBase::*send_one)(const Msg&)) {
+    size_t nsent = 0;
+    for (size_t i = 0; i < nstream; ++i) {
+        RtmpStreamBase* st = streams[i];
+        if (st == NULL) {
+            continue;
+        }
+        if (st->socket() == NULL) {
+            // Not bound to a connection directly (e.g. a retrying stream
+            // forwarding to its sub-stream), use the per-stream path.
+            if ((st->*send_one)(msg) == 0) {
+                ++nsent;
+            }
+            continue;
+        }
+        if (st->SendSharedMessage(timestamp, message_type, body) == 0) {
+            ++nsent;
+        }
+    }
+    return nsent;
+}
+
+size_t RtmpStreamBase::SendAudioMessageToStreams(
+    RtmpStreamBase* const* streams, size_t nstream,
+    const RtmpAudioMessage& msg) {
+    butil::IOBuf body;
+    const char audio_head =
+        ((msg.codec & 0xF) << 4)
+        | ((msg.rate & 0x3) << 2)
+        | ((msg.bits & 0x1) << 1)
+        | (msg.type & 0x1);
+    body.push_back(audio_head);
+    body.append(msg.data);
+    return SendBodyToStreams(
+        streams, nstream, msg.timestamp, policy::RTMP_MESSAGE_AUDIO, body,
+        msg, &RtmpStreamBase::SendAudioMessage);
+}
+
+size_t RtmpStreamBase::SendAACMessageToStreams(
+    RtmpStreamBase* const* streams, size_t nstream,
+    const RtmpAACMessage& msg) {
+    butil::IOBuf body;
+    char aac_head[2];
+    aac_head[0] = ((FLV_AUDIO_AAC & 0xF) << 4)
+        | ((msg.rate & 0x3) << 2)
+        | ((msg.bits & 0x1) << 1)
+        | (msg.type & 0x1);
+    aac_head[1] = (FlvAACPacketType)msg.packet_type;
+    body.append(aac_head, sizeof(aac_head));
+    body.append(msg.data);
+    return SendBodyToStreams(
+        streams, nstream, msg.timestamp, policy::RTMP_MESSAGE_AUDIO, body,
+        msg, &RtmpStreamBase::SendAACMessage);
+}
+
+size_t RtmpStreamBase::SendVideoMessageToStreams(
+    RtmpStreamBase* const* streams, size_t nstream,
+    const RtmpVideoMessage& msg) {
+    if (!policy::is_video_frame_type_valid(msg.frame_type)) {
+        LOG(WARNING) << "Invalid frame_type=" << (int)msg.frame_type;
+    }
+    if (!policy::is_video_codec_valid(msg.codec)) {
+        LOG(WARNING) << "Invalid codec=" << (int)msg.codec;
+    }
+    butil::IOBuf body;
+    const char video_head = ((msg.frame_type & 0xF) << 4) | (msg.codec & 0xF);
+    body.push_back(video_head);
+    body.append(msg.data);
+    return SendBodyToStreams(
+        streams, nstream, msg.timestamp, policy::RTMP_MESSAGE_VIDEO, body,
+        msg, &RtmpStreamBase::SendVideoMessage);
+}
+
+size_t RtmpStreamBase::SendAVCMessageToStreams(
+    RtmpStreamBase* const* streams, size_t nstream,
+    const RtmpAVCMessage& msg) {
+    if (!policy::is_video_frame_type_valid(msg.frame_type)) {
+        LOG(WARNING) << "Invalid frame_type=" << (int)msg.frame_type;
+    }
+    butil::IOBuf body;
+    char avc_head[5];
+    char* p = avc_head;
+    *p++ = ((msg.frame_type & 0xF) << 4) | (FLV_VIDEO_AVC & 0xF);
+    *p++ = (FlvAVCPacketType)msg.packet_type;
+    policy::WriteBigEndian3Bytes(&p, msg.composition_time);
+    body.append(avc_head, sizeof(avc_head));
+    body.append(msg.data);
+    return SendBodyToStreams(
+        streams, nstream, msg.timestamp, policy::RTMP_MESSAGE_VIDEO, body,
+        msg, &RtmpStreamBase::SendAVCMessage);
+}
+
 const char* RtmpObjectEncoding2Str(RtmpObjectEncoding e) {
     switch (e) {
     case RTMP_AMF0: return "AMF0";
@@ -553,6 +553,32 @@ public:
     // on implementation of the stream.
     virtual int SendStopMessage(const butil::StringPiece& error_description);
 
+    // Send the same media message to all of `streams[0..nstream-1]', which
+    // is the typical 1->N fan-out of live broadcasting. The FLV header and
+    // payload are serialized only once and shared by reference among the
+    // write requests of all streams: only the small per-connection chunk
+    // headers are generated privately when the message is cut into chunks,
+    // thus fanning one message out to thousands of subscribers does not
+    // multiply the payload in memory. With -socket_write_batching on,
+    // flushes of the subscriber sockets are batched as well.
+    // A stream that can not accept the message right now (paused, stopped,
+    // play() not received yet) is skipped rather than failing the whole
+    // call; a stream that is not bound to a connection directly (e.g.
+    // RtmpRetryingClientStream) falls back to its own SendXXXMessage().
+    // Returns the number of streams that the message was queued to.
+    static size_t SendAudioMessageToStreams(
+        RtmpStreamBase* const* streams, size_t nstream,
+        const RtmpAudioMessage& msg);
+    static size_t SendAACMessageToStreams(
+        RtmpStreamBase* const* streams, size_t nstream,
+        const RtmpAACMessage& msg);
+    static size_t SendVideoMessageToStreams(
+        RtmpStreamBase* const* streams, size_t nstream,
+        const RtmpVideoMessage& msg);
+    static size_t SendAVCMessageToStreams(
+        RtmpStreamBase* const* streams, size_t nstream,
+        const RtmpAVCMessage& msg);
+
     // // Call user's procedure at server-side.
     // // request == NULL  : send AMF null as the parameter.
     // // response == NULL : response is not needed.
@@ -608,9 +634,24 @@ friend class policy::OnServerStreamCreated;
     virtual ~RtmpStreamBase();
 
     int SendMessage(uint32_t timestamp, uint8_t message_type,
-                    const butil::IOBuf& body); 
+                    const butil::IOBuf& body);
     int SendControlMessage(uint8_t message_type, const void* body, size_t);
 
+    // Same as SendMessage() except that a stream unable to accept the
+    // message (including paused) fails quietly, which suits fan-out where
+    // per-subscriber logging would be flooding.
+    int SendSharedMessage(uint32_t timestamp, uint8_t message_type,
+                          const butil::IOBuf& body);
+
+    // Shared by SendXXXMessageToStreams(): queue the FLV-tagged `body'
+    // into every stream, falling back to `send_one' (virtually dispatched)
+    // for streams without a directly-bound connection. Defined in rtmp.cpp.
+    template <typename Msg>
+    static size_t SendBodyToStreams(
+        RtmpStreamBase* const* streams, size_t nstream,
+        uint32_t timestamp, uint8_t message_type, const butil::IOBuf& body,
+        const Msg& msg, int (RtmpStreamBase::*send_one)(const Msg&));
+
     // OnStop is mutually exclusive with OnXXXMessage, following methods
     // implement the exclusion.
     bool BeginProcessingMessage(const char* fun_name);
@@ -16,22 +16,41 @@
 // under the License.
 
 
+#include <algorithm>
 #include <map>
+#include <vector>
 #include <gflags/gflags.h>
 #include "bthread/bthread.h"                         // bthread_id_xx
+#include "bvar/latency_recorder.h"
 #include "brpc/socket.h"                             // SocketUser
 #include "brpc/load_balancer.h"                      // LoadBalancer
 #include "brpc/details/controller_private_accessor.h"        // RPCSender
 #include "brpc/selective_channel.h"
+#include "brpc/reloadable_flags.h"
 #include "brpc/global.h"
 
 
 namespace brpc {
 
-DEFINE_int32(channel_check_interval, 1, 
+DEFINE_int32(channel_check_interval, 1,
              "seconds between consecutive health-checking of unaccessible"
              " sub channels inside SelectiveChannel");
 
+DEFINE_double(schan_latency_exclusion_factor, 0,
+              "If positive, a sub channel inside SelectiveChannel whose p90"
+              " latency exceeds the median p90 of all sub channels multiplied"
+              " by this factor is temporarily skipped by channel selection."
+              " 0 turns the mechanism off");
+BRPC_VALIDATE_GFLAG(schan_latency_exclusion_factor, PassValidate);
+DEFINE_int32(schan_latency_check_interval_ms, 1000,
+             "Interval between re-evaluations of latency-based exclusion of"
+             " sub channels inside SelectiveChannel");
+BRPC_VALIDATE_GFLAG(schan_latency_check_interval_ms, PositiveInteger);
+DEFINE_int32(schan_latency_probe_interval_ms, 100,
+             "A latency-excluded sub channel still receives one probe request"
+             " per this interval so that its recovery is noticed");
+BRPC_VALIDATE_GFLAG(schan_latency_probe_interval_ms, PositiveInteger);
+
 namespace schan {
 
 // This map is generally very small, std::map may be good enough.
@@ -41,6 +60,14 @@ typedef std::map<ChannelBase*, Socket*> ChannelToIdMap;
 class SubChannel : public SocketUser {
 public:
     ChannelBase* chan;
+    // Rolling latency of successful sub calls, fed by SubDone and consumed
+    // by ChannelBalancer to exclude channels that are much slower than
+    // their group (-schan_latency_exclusion_factor).
+    bvar::LatencyRecorder latency;
+    butil::atomic<bool> latency_excluded;
+    butil::atomic<int64_t> next_probe_us;
+
+    SubChannel() : chan(NULL), latency_excluded(false), next_probe_us(0) {}
 
     // internal channel is deleted after the fake Socket is SetFailed
     void BeforeRecycle(Socket*) {
@@ -80,7 +107,7 @@ public:
         bool need_feedback;
     };
     
-    ChannelBalancer() {}
+    ChannelBalancer() : _last_latency_check_us(0) {}
     ~ChannelBalancer();
     int Init(const char* lb_name);
     int AddChannel(ChannelBase* sub_channel,
@@ -91,9 +118,14 @@ public:
     void Describe(std::ostream& os, const DescribeOptions&);
 
 private:
+    // Re-evaluate which sub channels are latency-excluded, at most once
+    // per -schan_latency_check_interval_ms.
+    void MaybeUpdateLatencyExclusion();
+
     butil::Mutex _mutex;
     // Find out duplicated sub channels.
     ChannelToIdMap _chan_map;
+    butil::atomic<int64_t> _last_latency_check_us;
 };
 
 class SubDone;
@@ -233,13 +265,83 @@ void ChannelBalancer::RemoveAndDestroyChannel(SelectiveChannel::ChannelHandle ha
 
 inline int ChannelBalancer::SelectChannel(const LoadBalancer::SelectIn& in,
                                           SelectOut* out) {
-    LoadBalancer::SelectOut sel_out(&out->fake_sock);
-    const int rc = SelectServer(in, &sel_out);
-    if (rc != 0) {
-        return rc;
+    const bool check_latency = (FLAGS_schan_latency_exclusion_factor > 0);
+    if (check_latency) {
+        MaybeUpdateLatencyExclusion();
+    }
+    // Re-select a few times when the picked channel is latency-excluded.
+    // If every pick is excluded (or the retries run out), the last pick is
+    // used anyway: a slow channel is still better than failing the call.
+    for (int i = 0; ; ++i) {
+        out->fake_sock.reset(NULL);
+        LoadBalancer::SelectOut sel_out(&out->fake_sock);
+        const int rc = SelectServer(in, &sel_out);
+        if (rc != 0) {
+            return rc;
+        }
+        out->need_feedback = sel_out.need_feedback;
+        if (!check_latency || i >= 3) {
+            return 0;
+        }
+        SubChannel* sub = static_cast<SubChannel*>(out->fake_sock->user());
+        if (!sub->latency_excluded.load(butil::memory_order_relaxed)) {
+            return 0;
+        }
+        // Excluded channels keep receiving sparse probe requests so that
+        // their latency stays measured and recovery is noticed.
+        const int64_t now_us = butil::gettimeofday_us();
+        int64_t next_probe_us =
+            sub->next_probe_us.load(butil::memory_order_relaxed);
+        if (now_us >= next_probe_us &&
+            sub->next_probe_us.compare_exchange_strong(
+                next_probe_us,
+                now_us + FLAGS_schan_latency_probe_interval_ms * 1000L,
+                butil::memory_order_relaxed)) {
+            return 0;
+        }
+    }
+}
+
+void ChannelBalancer::MaybeUpdateLatencyExclusion() {
+    const int64_t now_us = butil::gettimeofday_us();
+    int64_t last_us = _last_latency_check_us.load(butil::memory_order_relaxed);
+    if (now_us < last_us + FLAGS_schan_latency_check_interval_ms * 1000L ||
+        !_last_latency_check_us.compare_exchange_strong(
+            last_us, now_us, butil::memory_order_relaxed)) {
+        return;
+    }
+    BAIDU_SCOPED_LOCK(_mutex);
+    std::vector<std::pair<SubChannel*, int64_t> > p90s;
+    std::vector<int64_t> measured;
+    p90s.reserve(_chan_map.size());
+    for (ChannelToIdMap::const_iterator it = _chan_map.begin();
+         it != _chan_map.end(); ++it) {
+        SubChannel* sub = static_cast<SubChannel*>(it->second->user());
+        const int64_t p90 = sub->latency.latency_percentile(0.9);
+        p90s.push_back(std::make_pair(sub, p90));
+        if (p90 > 0) {
+            measured.push_back(p90);
+        }
+    }
+    // A median over less than 2 measured channels says nothing about the
+    // group, do not exclude anyone.
+    if (measured.size() < 2) {
+        for (size_t i = 0; i < p90s.size(); ++i) {
+            p90s[i].first->latency_excluded.store(
+                false, butil::memory_order_relaxed);
+        }
+        return;
+    }
+    std::nth_element(measured.begin(), measured.begin() + measured.size() / 2,
+                     measured.end());
+    const int64_t median_p90 = measured[measured.size() / 2];
+    const double threshold = median_p90 * FLAGS_schan_latency_exclusion_factor;
+    for (size_t i = 0; i < p90s.size(); ++i) {
+        const bool excluded = (p90s[i].second > 0 &&
+                               (double)p90s[i].second > threshold);
+        p90s[i].first->latency_excluded.store(
+            excluded, butil::memory_order_relaxed);
     }
-    out->need_feedback = sel_out.need_feedback;
-    return 0;
 }
 
 int ChannelBalancer::CheckHealth() {
@@ -367,6 +469,13 @@ void SubDone::Run() {
         main_cntl->SetFailed(_cntl._error_text);
         main_cntl->_error_code = _cntl._error_code;
     } else {
+        if (FLAGS_schan_latency_exclusion_factor > 0) {
+            SocketUniquePtr peer;
+            if (Socket::Address(_peer_id, &peer) == 0) {
+                static_cast<SubChannel*>(peer->user())->latency
+                    << _cntl.latency_us();
+            }
+        }
         if (_cntl._response != main_cntl->_response) {
             main_cntl->_response->GetReflection()->Swap(
                 main_cntl->_response, _cntl._response);
@@ -21,12 +21,15 @@
 #include <arpa/inet.h>                              // inet_aton
 #include <fcntl.h>                                  // O_CREAT
 #include <sys/stat.h>                               // mkdir
+#include <sys/socket.h>                             // setsockopt
 #include <gflags/gflags.h>
 #include <google/protobuf/descriptor.h>             // ServiceDescriptor
 #include "idl_options.pb.h"                         // option(idl_support)
 #include "bthread/unstable.h"                       // bthread_keytable_pool_init
 #include "butil/macros.h"                            // ARRAY_SIZE
 #include "butil/fd_guard.h"                          // fd_guard
+#include "butil/unix_socket.h"                       // unix_socket_listen
+#include "butil/string_splitter.h"                   // StringSplitter
 #include "butil/logging.h"                           // CHECK
 #include "butil/time.h"
 #include "butil/class_name.h"
@@ -43,6 +46,8 @@
 #ifdef ENABLE_THRIFT_FRAMED_PROTOCOL
 #include "brpc/thrift_service.h"               // ThriftService
 #endif
+#include "brpc/tenant_quota.h"                 // TenantQuota
+#include "brpc/request_mirror.h"               // RequestMirror
 #include "brpc/builtin/bad_method_service.h"   // BadMethodService
 #include "brpc/builtin/get_favicon_service.h"
 #include "brpc/builtin/get_js_service.h"
@@ -56,13 +61,19 @@
 #include "brpc/builtin/index_service.h"        // IndexService
 #include "brpc/builtin/connections_service.h"  // ConnectionsService
 #include "brpc/builtin/flags_service.h"        // FlagsService
+#include "brpc/builtin/method_options_service.h" // MethodOptionsService
+#include "brpc/builtin/iobuf_copies_service.h"   // IOBufCopiesService
 #include "brpc/builtin/vars_service.h"         // VarsService
 #include "brpc/builtin/rpcz_service.h"         // RpczService
 #include "brpc/builtin/dir_service.h"          // DirService
 #include "brpc/builtin/pprof_service.h"        // PProfService
+#include "brpc/builtin/continuous_profiler.h"  // ContinuousProfiler
 #include "brpc/builtin/bthreads_service.h"     // BthreadsService
 #include "brpc/builtin/ids_service.h"          // IdsService
 #include "brpc/builtin/sockets_service.h"      // SocketsService
+#include "brpc/builtin/memory_internals_service.h"  // MemoryInternalsService
+#include "brpc/builtin/overload_service.h"     // OverloadService
+#include "brpc/builtin/contentions_service.h"  // ContentionsService
 #include "brpc/builtin/hotspots_service.h"     // HotspotsService
 #include "brpc/builtin/prometheus_metrics_service.h"
 #include "brpc/details/method_status.h"
@@ -87,6 +98,8 @@ extern "C" {
 void* bthread_get_assigned_data();
 }
 
+DECLARE_bool(reuse_port);   // defined in butil/endpoint.cpp
+
 namespace brpc {
 
 BAIDU_CASSERT(sizeof(int32_t) == sizeof(butil::subtle::Atomic32),
@@ -112,6 +125,8 @@ DEFINE_bool(enable_threads_service, false, "Enable /threads");
 
 DECLARE_int32(usercode_backup_threads);
 DECLARE_bool(usercode_in_pthread);
+DECLARE_bool(reuseport_acceptors);
+DECLARE_int32(event_dispatcher_num);
 
 const int INITIAL_SERVICE_CAP = 64;
 const int INITIAL_CERT_MAP = 64;
@@ -128,6 +143,9 @@ ServerOptions::ServerOptions()
     , server_owns_auth(false)
     , num_threads(8)
     , max_concurrency(0)
+    , tenant_quota(NULL)
+    , request_mirror(NULL)
+    , overload_safe(false)
     , session_local_data_factory(NULL)
     , reserved_session_local_data(0)
     , thread_local_data_factory(NULL)
@@ -165,7 +183,9 @@ Server::MethodProperty::MethodProperty()
     , http_url(NULL)
     , service(NULL)
     , method(NULL)
-    , status(NULL) {
+    , status(NULL)
+    , request_priority(REQUEST_PRIORITY_UNSET)
+    , index(-1) {
 }
 
 static timeval GetUptime(void* arg/*start_time*/) {
@@ -318,6 +338,12 @@ void* Server::UpdateDerivedVars(void* arg) {
     if (server->options().nshead_service) {
         server->options().nshead_service->Expose(prefix);
     }
+    if (server->options().tenant_quota) {
+        server->options().tenant_quota->Expose(prefix);
+    }
+    if (server->options().request_mirror) {
+        server->options().request_mirror->Expose(prefix);
+    }
 
 #ifdef ENABLE_THRIFT_FRAMED_PROTOCOL
     if (server->options().thrift_service) {
@@ -382,6 +408,7 @@ Server::Server(ProfilerLinker)
     , _builtin_service_count(0)
     , _virtual_service_count(0)
     , _failed_to_set_max_concurrency_of_method(false)
+    , _failed_to_set_priority_of_method(false)
     , _am(NULL)
     , _internal_am(NULL)
     , _first_service(NULL)
@@ -389,6 +416,9 @@ Server::Server(ProfilerLinker)
     , _global_restful_map(NULL)
     , _last_start_time(0)
     , _derivative_thread(INVALID_BTHREAD)
+    , _handoff_sockfd(-1)
+    , _handoff_thread(0)
+    , _handoff_done(false)
     , _keytable_pool(NULL)
     , _concurrency(0) {
     BAIDU_CASSERT(offsetof(Server, _concurrency) % 64 == 0,
@@ -490,6 +520,14 @@ int Server::AddBuiltinServices() {
         LOG(ERROR) << "Fail to add ListService";
         return -1;
     }
+    if (AddBuiltinService(new (std::nothrow) MethodOptionsService(this))) {
+        LOG(ERROR) << "Fail to add MethodOptionsService";
+        return -1;
+    }
+    if (AddBuiltinService(new (std::nothrow) IOBufCopiesService)) {
+        LOG(ERROR) << "Fail to add IOBufCopiesService";
+        return -1;
+    }
     if (AddBuiltinService(new (std::nothrow) PrometheusMetricsService)) {
         LOG(ERROR) << "Fail to add MetricsService";
         return -1;
@@ -528,6 +566,18 @@ int Server::AddBuiltinServices() {
         LOG(ERROR) << "Fail to add SocketsService";
         return -1;
     }
+    if (AddBuiltinService(new (std::nothrow) MemoryInternalsService)) {
+        LOG(ERROR) << "Fail to add MemoryInternalsService";
+        return -1;
+    }
+    if (AddBuiltinService(new (std::nothrow) OverloadService)) {
+        LOG(ERROR) << "Fail to add OverloadService";
+        return -1;
+    }
+    if (AddBuiltinService(new (std::nothrow) ContentionsService)) {
+        LOG(ERROR) << "Fail to add ContentionsService";
+        return -1;
+    }
     if (AddBuiltinService(new (std::nothrow) GetFaviconService)) {
         LOG(ERROR) << "Fail to add GetFaviconService";
         return -1;
@@ -698,6 +748,38 @@ static bool CreateConcurrencyLimiter(const AdaptiveMaxConcurrency& amc,
 
 static AdaptiveMaxConcurrency g_default_max_concurrency_of_method(0);
 
+// Set `flag' to `value' unless the user already set it explicitly, so
+// that the overload_safe profile never overrides a tuned setting.
+static void SetFlagIfDefault(const char* flag, const char* value) {
+    GFLAGS_NS::CommandLineFlagInfo info;
+    if (!GFLAGS_NS::GetCommandLineFlagInfo(flag, &info) || !info.is_default) {
+        return;
+    }
+    if (GFLAGS_NS::SetCommandLineOption(flag, value).empty()) {
+        LOG(WARNING) << "Fail to set -" << flag << '=' << value;
+    }
+}
+
+// The curated preset behind ServerOptions.overload_safe: the pieces of
+// overload protection that are safe without per-service knowledge, tuned
+// to work together. See the comment of the option in server.h.
+static void ApplyOverloadSafeProfile(ServerOptions* options) {
+    // Drop requests whose client stopped waiting instead of executing
+    // them, the earliest and cheapest shedding stage.
+    SetFlagIfDefault("baidu_std_propagate_timeout", "true");
+    SetFlagIfDefault("baidu_std_reject_expired_requests", "true");
+    // Cap inbound buffering so that huge or trickled messages cannot OOM
+    // the process, oversized connections are closed with EOVERCROWDED.
+    SetFlagIfDefault("socket_max_unconsumed_bytes", "67108864");   // 64M
+    SetFlagIfDefault("max_total_unconsumed_bytes", "1073741824");  // 1G
+    // Adapt method-level concurrency to measured latency instead of a
+    // hand-tuned constant.
+    if (options->method_max_concurrency ==
+        AdaptiveMaxConcurrency::UNLIMITED()) {
+        options->method_max_concurrency = "gradient";
+    }
+}
+
 int Server::StartInternal(const butil::ip_t& ip,
                           const PortRange& port_range,
                           const ServerOptions *opt) {
@@ -708,6 +790,12 @@ int Server::StartInternal(const butil::ip_t& ip,
             "fix it before starting server";
         return -1;
     }
+    if (_failed_to_set_priority_of_method) {
+        _failed_to_set_priority_of_method = false;
+        LOG(ERROR) << "previous call to RequestPriorityOf() was failed, "
+            "fix it before starting server";
+        return -1;
+    }
     if (InitializeOnce() != 0) {
         LOG(ERROR) << "Fail to initialize Server[" << version() << ']';
         return -1;
@@ -731,6 +819,10 @@ int Server::StartInternal(const butil::ip_t& ip,
         _options = ServerOptions();
     }
 
+    if (_options.overload_safe) {
+        ApplyOverloadSafeProfile(&_options);
+    }
+
     if (!_options.h2_settings.IsValid(true/*log_error*/)) {
         LOG(ERROR) << "Invalid h2_settings";
         return -1;
@@ -879,11 +971,14 @@ int Server::StartInternal(const butil::ip_t& ip,
 
     _concurrency = 0;
 
-    if (_options.has_builtin_services &&
-        _builtin_service_count <= 0 &&
-        AddBuiltinServices() != 0) {
-        LOG(ERROR) << "Fail to add builtin services";
-        return -1;
+    if (_options.has_builtin_services && _builtin_service_count <= 0) {
+        const int64_t builtin_start_us = butil::cpuwide_time_us();
+        if (AddBuiltinServices() != 0) {
+            LOG(ERROR) << "Fail to add builtin services";
+            return -1;
+        }
+        RecordStartupPhase("builtin_services",
+                           butil::cpuwide_time_us() - builtin_start_us);
     }
     // If a server is started/stopped for mutiple times and one of the options
     // sets has_builtin_service to true, builtin services will be enabled for
@@ -893,6 +988,8 @@ int Server::StartInternal(const butil::ip_t& ip,
             "consistent on ServerOptions.has_builtin_services";
         return -1;
     }
+    // No-op unless -continuous_profiling is on.
+    ContinuousProfiler::StartIfNeeded();
 
     // Prepare all restful maps
     for (ServiceMap::const_iterator it = _fullname_service_map.begin();
@@ -915,8 +1012,15 @@ int Server::StartInternal(const butil::ip_t& ip,
         bthread_setconcurrency(_options.num_threads);
     }
 
+    // Assign dense ids to methods so that hot paths which resolved a method
+    // once can address it by array index afterwards. Rebuilt on each start
+    // since services may be added or removed between runs.
+    _indexed_methods.clear();
+    _indexed_methods.reserve(_method_map.size());
     for (MethodMap::iterator it = _method_map.begin();
         it != _method_map.end(); ++it) {
+        it->second.index = (int)_indexed_methods.size();
+        _indexed_methods.push_back(&it->second);
         if (it->second.is_builtin_service) {
             it->second.status->SetConcurrencyLimiter(NULL);
         } else {
@@ -939,10 +1043,66 @@ int Server::StartInternal(const butil::ip_t& ip,
                    << port_range.max_port << ']';
         return -1;
     }
+    if (FLAGS_reuseport_acceptors && !FLAGS_reuse_port) {
+#if defined(SO_REUSEPORT)
+        LOG(INFO) << "Turn on -reuse_port, required by -reuseport_acceptors";
+        FLAGS_reuse_port = true;
+#else
+        LOG(ERROR) << "Missing def of SO_REUSEPORT while -reuseport_acceptors"
+                      " is on";
+        return -1;
+#endif
+    }
     _listen_addr.ip = ip;
-    for (int port = port_range.min_port; port <= port_range.max_port; ++port) {
+    // Take over listening fds from a previous process serving them at
+    // listen_fd_handoff_path, so that deploys keep the listening socket
+    // open. Absence of the path simply means there's no predecessor.
+    butil::fd_guard handoff_main_fd;
+    butil::fd_guard handoff_internal_fd;
+    if (!_options.listen_fd_handoff_path.empty() &&
+        access(_options.listen_fd_handoff_path.c_str(), F_OK) == 0) {
+        butil::fd_guard conn(butil::unix_socket_connect(
+                                 _options.listen_fd_handoff_path.c_str()));
+        if (conn >= 0) {
+            // Don't hang on a predecessor that accepted but never sends,
+            // e.g. one that already handed its fds to another process.
+            timeval rcv_timeout = { 3, 0 };
+            setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO,
+                       &rcv_timeout, sizeof(rcv_timeout));
+            int fds[2] = { -1, -1 };
+            const int nfd = butil::unix_socket_recv_fds(conn, fds, 2);
+            if (nfd >= 1) {
+                handoff_main_fd.reset(fds[0]);
+                if (nfd >= 2) {
+                    handoff_internal_fd.reset(fds[1]);
+                }
+                LOG(INFO) << "Took over " << nfd << " listening fd(s) from "
+                          << _options.listen_fd_handoff_path;
+            } else {
+                LOG(WARNING) << "Fail to take over listening fds from "
+                             << _options.listen_fd_handoff_path
+                             << ", listen anew";
+            }
+        }
+    }
+    int takenover_port = -1;
+    if (handoff_main_fd >= 0) {
+        takenover_port = get_port_from_fd(handoff_main_fd);
+        if (takenover_port < port_range.min_port ||
+            takenover_port > port_range.max_port) {
+            LOG(WARNING) << "Taken-over listener on port=" << takenover_port
+                         << " is out of port_range=[" << port_range.min_port
+                         << '-' << port_range.max_port << "], ignored";
+            handoff_main_fd.reset(-1);
+            takenover_port = -1;
+        }
+    }
+    for (int port = (takenover_port >= 0 ? takenover_port : port_range.min_port);
+         port <= port_range.max_port; ++port) {
         _listen_addr.port = port;
-        butil::fd_guard sockfd(tcp_listen(_listen_addr));
+        butil::fd_guard sockfd(handoff_main_fd >= 0 ?
+                               handoff_main_fd.release() :
+                               tcp_listen(_listen_addr));
         if (sockfd < 0) {
             if (port != port_range.max_port) { // not the last port, try next
                 continue;
@@ -986,6 +1146,26 @@ int Server::StartInternal(const butil::ip_t& ip,
             return -1;
         }
         sockfd.release();
+        if (FLAGS_reuseport_acceptors) {
+            // One extra SO_REUSEPORT listener per additional event
+            // dispatcher. The kernel spreads incoming connections evenly
+            // among the listeners; each listener is assigned to a
+            // dispatcher by the usual fd hash, thus the spreading over
+            // dispatchers is statistical rather than exact.
+            for (int i = 1; i < FLAGS_event_dispatcher_num; ++i) {
+                butil::fd_guard extra_fd(tcp_listen(_listen_addr));
+                if (extra_fd < 0) {
+                    PLOG(ERROR) << "Fail to listen " << _listen_addr
+                                << " with SO_REUSEPORT";
+                    return -1;
+                }
+                if (_am->AddExtraListener(extra_fd) != 0) {
+                    LOG(ERROR) << "Fail to add extra listener";
+                    return -1;
+                }
+                extra_fd.release();
+            }
+        }
         break; // stop trying
     }
     if (_options.internal_port >= 0 && _options.has_builtin_services) {
@@ -1002,7 +1182,20 @@ int Server::StartInternal(const butil::ip_t& ip,
         }
         butil::EndPoint internal_point = _listen_addr;
         internal_point.port = _options.internal_port;
-        butil::fd_guard sockfd(tcp_listen(internal_point));
+        butil::fd_guard sockfd;
+        if (handoff_internal_fd >= 0) {
+            if (get_port_from_fd(handoff_internal_fd) == _options.internal_port) {
+                sockfd.reset(handoff_internal_fd.release());
+            } else {
+                LOG(WARNING) << "Taken-over internal listener does not match"
+                                " internal_port=" << _options.internal_port
+                             << ", ignored";
+                handoff_internal_fd.reset(-1);
+            }
+        }
+        if (sockfd < 0) {
+            sockfd.reset(tcp_listen(internal_point));
+        }
         if (sockfd < 0) {
             LOG(ERROR) << "Fail to listen " << internal_point << " (internal)";
             return -1;
@@ -1025,6 +1218,12 @@ int Server::StartInternal(const butil::ip_t& ip,
 
     PutPidFileIfNeeded();
 
+    if (StartHandoffServerIfNeeded() != 0) {
+        LOG(ERROR) << "Fail to serve listening fds at "
+                   << _options.listen_fd_handoff_path;
+        return -1;
+    }
+
     // Launch _derivative_thread.
     CHECK_EQ(INVALID_BTHREAD, _derivative_thread);
     if (bthread_start_background(&_derivative_thread, NULL,
@@ -1053,6 +1252,9 @@ int Server::StartInternal(const butil::ip_t& ip,
     }
     // For trackme reporting
     SetTrackMeAddress(butil::EndPoint(butil::my_ip(), http_port));
+    // Methods/restful maps were possibly rebuilt, caches of resolution
+    // results must not serve entries from before the start.
+    BumpMethodResolutionVersion();
     revert_server.release();
     return 0;
 }
@@ -1099,6 +1301,7 @@ int Server::Stop(int timeout_ms) {
 
     LOG(INFO) << "Server[" << version() << "] is going to quit";
 
+    StopHandoffServer();
     if (_am) {
         _am->StopAccept(timeout_ms);
     }
@@ -1160,6 +1363,73 @@ int Server::Join() {
     return 0;
 }
 
+// Parse ServiceOptions.lazy_request_fields("METHOD => NUM NUM, ...") and
+// validate listed fields against request types of `sd'.
+// Returns 0 on success.
+static int ParseLazyRequestFieldMappings(
+        const butil::StringPiece& mappings,
+        const google::protobuf::ServiceDescriptor* sd,
+        std::map<std::string, std::vector<int> >* out) {
+    for (butil::StringSplitter sp(mappings.data(),
+                                  mappings.data() + mappings.size(), ',');
+         sp != NULL; ++sp) {
+        butil::StringPiece part(sp.field(), sp.length());
+        const size_t pos = part.find("=>");
+        if (pos == butil::StringPiece::npos) {
+            LOG(ERROR) << "Missing `=>' in `" << part << '\'';
+            return -1;
+        }
+        butil::StringPiece method_name = part.substr(0, pos);
+        method_name.trim_spaces();
+        const google::protobuf::MethodDescriptor* md =
+            sd->FindMethodByName(method_name.as_string());
+        if (NULL == md) {
+            LOG(ERROR) << "Unknown method=`" << method_name << "' in "
+                       << sd->full_name();
+            return -1;
+        }
+        std::vector<int>* fields = &(*out)[md->name()];
+        const butil::StringPiece field_list = part.substr(pos + 2);
+        for (butil::StringSplitter fsp(
+                 field_list.data(), field_list.data() + field_list.size(), ' ');
+             fsp != NULL; ++fsp) {
+            const std::string field_str(fsp.field(), fsp.length());
+            char* endptr = NULL;
+            const long n = strtol(field_str.c_str(), &endptr, 10);
+            if (*endptr != '\0' || n <= 0) {
+                LOG(ERROR) << "Invalid field number=`" << field_str
+                           << "' for method=" << md->full_name();
+                return -1;
+            }
+            const google::protobuf::FieldDescriptor* fd =
+                md->input_type()->FindFieldByNumber((int)n);
+            if (NULL == fd) {
+                LOG(ERROR) << "No field numbered " << n << " in "
+                           << md->input_type()->full_name();
+                return -1;
+            }
+            if (fd->is_required()) {
+                LOG(ERROR) << fd->full_name() << " must not be required"
+                    " to be parsed lazily";
+                return -1;
+            }
+            if (fd->type() != google::protobuf::FieldDescriptor::TYPE_MESSAGE &&
+                fd->type() != google::protobuf::FieldDescriptor::TYPE_BYTES &&
+                fd->type() != google::protobuf::FieldDescriptor::TYPE_STRING) {
+                LOG(ERROR) << fd->full_name() << " is not a length-delimited"
+                    " field and can't be parsed lazily";
+                return -1;
+            }
+            fields->push_back((int)n);
+        }
+        if (fields->empty()) {
+            LOG(ERROR) << "No fields listed for method=" << md->full_name();
+            return -1;
+        }
+    }
+    return 0;
+}
+
 int Server::AddServiceInternal(google::protobuf::Service* service,
                                bool is_builtin_service,
                                const ServiceOptions& svc_opt) {
@@ -1200,6 +1470,15 @@ int Server::AddServiceInternal(google::protobuf::Service* service,
     // defined `option (idl_support) = true' or not.
     const bool is_idl_support = sd->file()->options().GetExtension(idl_support);
 
+    std::map<std::string, std::vector<int> > lazy_fields_by_method;
+    if (!svc_opt.lazy_request_fields.empty() &&
+        ParseLazyRequestFieldMappings(svc_opt.lazy_request_fields, sd,
+                                      &lazy_fields_by_method) != 0) {
+        LOG(ERROR) << "Fail to parse lazy_request_fields=`"
+                   << svc_opt.lazy_request_fields << '\'';
+        return -1;
+    }
+
     Tabbed* tabbed = dynamic_cast<Tabbed*>(service);
     for (int i = 0; i < sd->method_count(); ++i) {
         const google::protobuf::MethodDescriptor* md = sd->method(i);
@@ -1209,6 +1488,11 @@ int Server::AddServiceInternal(google::protobuf::Service* service,
         mp.params.is_tabbed = !!tabbed;
         mp.params.allow_http_body_to_pb = svc_opt.allow_http_body_to_pb;
         mp.params.pb_bytes_to_base64 = svc_opt.pb_bytes_to_base64;
+        std::map<std::string, std::vector<int> >::const_iterator
+            lazy_it = lazy_fields_by_method.find(md->name());
+        if (lazy_it != lazy_fields_by_method.end()) {
+            mp.params.lazy_request_fields = lazy_it->second;
+        }
         mp.service = service;
         mp.method = md;
         mp.status = new MethodStatus;
@@ -1379,6 +1663,7 @@ int Server::AddServiceInternal(google::protobuf::Service* service,
             }
         }
     }
+    BumpMethodResolutionVersion();
     return 0;
 }
 
@@ -1515,6 +1800,7 @@ int Server::RemoveService(google::protobuf::Service* service) {
             _first_service = NULL;
         }
     }
+    BumpMethodResolutionVersion();
     return 0;
 }
 
@@ -1542,9 +1828,11 @@ void Server::ClearServices() {
     _fullname_service_map.clear();
     _service_map.clear();
     _method_map.clear();
+    _indexed_methods.clear();
     _builtin_service_count = 0;
     _virtual_service_count = 0;
     _first_service = NULL;
+    BumpMethodResolutionVersion();
 }
 
 google::protobuf::Service* Server::FindServiceByFullName(
@@ -1681,6 +1969,93 @@ void Server::PutPidFileIfNeeded() {
     CHECK_EQ(0, close(fd));
 }
 
+void* Server::RunListenerHandoff(void* arg) {
+    Server* server = static_cast<Server*>(arg);
+    while (true) {
+        const int conn = accept(server->_handoff_sockfd, NULL, NULL);
+        if (conn < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // The socket was shutdown in StopHandoffServer().
+            break;
+        }
+        if (server->_handoff_done.load(butil::memory_order_relaxed)) {
+            // Already handed off, the connector reads EOF and fails.
+            close(conn);
+            continue;
+        }
+        int fds[2];
+        size_t nfd = 0;
+        const int main_fd =
+            server->_am ? server->_am->listened_fd() : -1;
+        if (main_fd >= 0) {
+            fds[nfd++] = main_fd;
+        }
+        const int internal_fd =
+            server->_internal_am ? server->_internal_am->listened_fd() : -1;
+        if (internal_fd >= 0) {
+            fds[nfd++] = internal_fd;
+        }
+        if (nfd == 0 || butil::unix_socket_send_fds(conn, fds, nfd) != 0) {
+            close(conn);
+            continue;
+        }
+        close(conn);
+        LOG(INFO) << "Server[" << server->version() << "] handed off " << nfd
+                  << " listening fd(s) to a successor, stop accepting new"
+                     " connections";
+        server->_handoff_done.store(true, butil::memory_order_relaxed);
+        // Stop accepting and release idle connections. Established
+        // connections are still served until Stop()/Join(). The successor
+        // removes and rebinds the socket file at the handoff path.
+        server->_am->StopAccept(0);
+        if (server->_internal_am) {
+            server->_internal_am->StopAccept(0);
+        }
+        // Keep answering (and rejecting) later connectors until Stop().
+    }
+    return NULL;
+}
+
+int Server::StartHandoffServerIfNeeded() {
+    if (_options.listen_fd_handoff_path.empty()) {
+        return 0;
+    }
+    _handoff_done.store(false, butil::memory_order_relaxed);
+    // The predecessor (if any) was already consulted in StartInternal(),
+    // removing a leftover socket file is safe.
+    _handoff_sockfd = butil::unix_socket_listen(
+        _options.listen_fd_handoff_path.c_str(), true);
+    if (_handoff_sockfd < 0) {
+        LOG(ERROR) << "Fail to listen at "
+                   << _options.listen_fd_handoff_path;
+        return -1;
+    }
+    if (pthread_create(&_handoff_thread, NULL, RunListenerHandoff, this) != 0) {
+        PLOG(ERROR) << "Fail to create the listener-handoff thread";
+        close(_handoff_sockfd);
+        _handoff_sockfd = -1;
+        remove(_options.listen_fd_handoff_path.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+void Server::StopHandoffServer() {
+    if (_handoff_sockfd < 0) {
+        return;
+    }
+    if (!_handoff_done.load(butil::memory_order_relaxed)) {
+        remove(_options.listen_fd_handoff_path.c_str());
+    }
+    // Wake up the accept() blocked in RunListenerHandoff.
+    shutdown(_handoff_sockfd, SHUT_RDWR);
+    pthread_join(_handoff_thread, NULL);
+    close(_handoff_sockfd);
+    _handoff_sockfd = -1;
+}
+
 void Server::RunUntilAskedToQuit() {
     while (!IsAskedToQuit()) {
         bthread_usleep(1000000L);
@@ -1810,6 +2185,14 @@ Server::FindMethodPropertyByNameAndIndex(const butil::StringPiece& service_name,
     return FindMethodPropertyByFullName(method->full_name());
 }
 
+const Server::MethodProperty*
+Server::FindMethodPropertyByIndex(int index) const {
+    if (index < 0 || (size_t)index >= _indexed_methods.size()) {
+        return NULL;
+    }
+    return _indexed_methods[index];
+}
+
 const Server::ServiceProperty*
 Server::FindServicePropertyByFullName(const butil::StringPiece& fullname) const {
     return _fullname_service_map.seek(fullname);
@@ -2078,6 +2461,25 @@ int Server::MaxConcurrencyOf(const butil::StringPiece& full_method_name) const {
     return MaxConcurrencyOf(_method_map.seek(full_method_name));
 }
 
+int Server::AddMethodInterceptor(const butil::StringPiece& full_method_name,
+                                 const MethodInterceptor& interceptor) {
+    if (IsRunning()) {
+        LOG(ERROR) << "AddMethodInterceptor is only allowed before Start()";
+        return -1;
+    }
+    if (NULL == interceptor.before) {
+        LOG(ERROR) << "MethodInterceptor.before must be set";
+        return -1;
+    }
+    MethodProperty* mp = _method_map.seek(full_method_name);
+    if (NULL == mp) {
+        LOG(ERROR) << "Fail to find method=" << full_method_name;
+        return -1;
+    }
+    mp->interceptors.push_back(interceptor);
+    return 0;
+}
+
 AdaptiveMaxConcurrency& Server::MaxConcurrencyOf(const butil::StringPiece& full_service_name,
                               const butil::StringPiece& method_name) {
     MethodProperty* mp = const_cast<MethodProperty*>(
@@ -2107,6 +2509,66 @@ int Server::MaxConcurrencyOf(google::protobuf::Service* service,
     return MaxConcurrencyOf(service->GetDescriptor()->full_name(), method_name);
 }
 
+static RequestPriority g_default_request_priority = REQUEST_PRIORITY_UNSET;
+
+RequestPriority& Server::RequestPriorityOf(MethodProperty* mp) {
+    if (IsRunning()) {
+        LOG(WARNING) << "RequestPriorityOf is only allowd before Server started";
+        return g_default_request_priority;
+    }
+    return mp->request_priority;
+}
+
+RequestPriority Server::RequestPriorityOf(const MethodProperty* mp) const {
+    if (mp == NULL) {
+        return REQUEST_PRIORITY_UNSET;
+    }
+    return mp->request_priority;
+}
+
+RequestPriority& Server::RequestPriorityOf(const butil::StringPiece& full_method_name) {
+    MethodProperty* mp = _method_map.seek(full_method_name);
+    if (mp == NULL) {
+        LOG(ERROR) << "Fail to find method=" << full_method_name;
+        _failed_to_set_priority_of_method = true;
+        return g_default_request_priority;
+    }
+    return RequestPriorityOf(mp);
+}
+
+RequestPriority Server::RequestPriorityOf(const butil::StringPiece& full_method_name) const {
+    return RequestPriorityOf(_method_map.seek(full_method_name));
+}
+
+RequestPriority& Server::RequestPriorityOf(const butil::StringPiece& full_service_name,
+                              const butil::StringPiece& method_name) {
+    MethodProperty* mp = const_cast<MethodProperty*>(
+        FindMethodPropertyByFullName(full_service_name, method_name));
+    if (mp == NULL) {
+        LOG(ERROR) << "Fail to find method=" << full_service_name
+                   << '/' << method_name;
+        _failed_to_set_priority_of_method = true;
+        return g_default_request_priority;
+    }
+    return RequestPriorityOf(mp);
+}
+
+RequestPriority Server::RequestPriorityOf(const butil::StringPiece& full_service_name,
+                             const butil::StringPiece& method_name) const {
+    return RequestPriorityOf(FindMethodPropertyByFullName(
+                                 full_service_name, method_name));
+}
+
+RequestPriority& Server::RequestPriorityOf(google::protobuf::Service* service,
+                              const butil::StringPiece& method_name) {
+    return RequestPriorityOf(service->GetDescriptor()->full_name(), method_name);
+}
+
+RequestPriority Server::RequestPriorityOf(google::protobuf::Service* service,
+                             const butil::StringPiece& method_name) const {
+    return RequestPriorityOf(service->GetDescriptor()->full_name(), method_name);
+}
+
 #ifdef SSL_CTRL_SET_TLSEXT_HOSTNAME
 int Server::SSLSwitchCTXByHostname(struct ssl_st* ssl,
                                    int* al, Server* server) {
@@ -27,6 +27,7 @@
                                   // e.g. bthread_usleep
 #include <google/protobuf/service.h>                 // google::protobuf::Service
 #include "butil/macros.h"                            // DISALLOW_COPY_AND_ASSIGN
+#include "butil/atomicops.h"                         // butil::atomic
 #include "butil/containers/doubly_buffered_data.h"   // DoublyBufferedData
 #include "bvar/bvar.h"
 #include "butil/containers/case_ignored_flat_map.h"  // [CaseIgnored]FlatMap
@@ -39,6 +40,7 @@
 #include "brpc/details/profiler_linker.h"
 #include "brpc/health_reporter.h"
 #include "brpc/adaptive_max_concurrency.h"
+#include "brpc/method_options.h"            // MethodOptionsTable
 #include "brpc/http2.h"
 #include "brpc/redis.h"
 
@@ -54,6 +56,8 @@ class RestfulMap;
 class RtmpService;
 class RedisService;
 struct SocketSSLContext;
+class TenantQuota;
+class RequestMirror;
 
 struct ServerOptions {
     ServerOptions();  // Constructed with default options.
@@ -66,6 +70,17 @@ struct ServerOptions {
     // of the server will be created when the server is started.
     // Default: ""
     std::string pid_file;
+
+    // If this option is not empty, Start() first tries to take over the
+    // listening fd(s) of a previous server process from the unix domain
+    // socket at this path instead of binding new ones, then serves its own
+    // listening fd(s) at the same path for the next process. When a
+    // successor takes the fd(s) over, this server stops accepting new
+    // connections but keeps serving established ones until Stop()/Join(),
+    // so that deploys never drop the listening socket and clients migrate
+    // to the new process without a reconnect spike.
+    // Default: "" (disabled)
+    std::string listen_fd_handoff_path;
     
     // Process requests in format of nshead_t + blob.
     // Owned by Server and deleted in server's destructor.
@@ -122,6 +137,38 @@ struct ServerOptions {
     // Overridable by Server.MaxConcurrencyOf().
     AdaptiveMaxConcurrency method_max_concurrency;
 
+    // Tenant-aware admission control enforced before requests are
+    // dispatched, so that tenants sharing the same methods cannot starve
+    // each other. Requests beyond the weighted-fair share of their tenant
+    // are rejected with ELIMIT before the method-level ConcurrencyLimiter
+    // runs. Check out src/brpc/tenant_quota.h for details.
+    // NOT owned by Server and must be valid when Server is running.
+    // NOTE: accesses to builtin services are not limited by this option.
+    // Default: NULL (disabled)
+    TenantQuota* tenant_quota;
+
+    // Tee a sampled fraction of inbound baidu_std requests to another
+    // server while serving them normally, for validating new versions
+    // against live traffic. The mirrored copy shares the request payload
+    // by refcount, responses from the mirror destination are ignored and
+    // requests beyond the inflight budget are dropped. Check out
+    // src/brpc/request_mirror.h for details.
+    // NOT owned by Server and must be valid when Server is running.
+    // Default: NULL (disabled)
+    RequestMirror* request_mirror;
+
+    // Apply the curated overload protection profile when the server
+    // starts: deadline propagation plus early drop of expired requests,
+    // inbound memory caps(64MB per connection, 1GB total) and the
+    // gradient concurrency limiter as the default of method-level max
+    // concurrencies. Each piece is only applied when its flag/option was
+    // left at the default, so explicit settings always win. Per-method
+    // priority lanes(RequestPriorityOf) and tenant_quota above need
+    // per-service knowledge and stay opt-in. Drop counters of every
+    // stage are shown at /overload.
+    // Default: false
+    bool overload_safe;
+
     // -------------------------------------------------------
     // Differences between session-local and thread-local data
     // -------------------------------------------------------
@@ -255,6 +302,19 @@ struct ServerStatistics {
     int builtin_service_count;
 };
 
+// Priority lane that a method's user callback runs in, settable with
+// Server::RequestPriorityOf(). Methods left at REQUEST_PRIORITY_UNSET run
+// in the bthread that parsed them as usual; methods attached to a lane are
+// executed by a bounded pool of workers draining the lanes with weighted
+// round-robin, so that heavy low-priority methods can no longer occupy
+// every worker and make cheap requests queue behind them.
+enum RequestPriority {
+    REQUEST_PRIORITY_UNSET = -1,
+    REQUEST_PRIORITY_HIGH = 0,
+    REQUEST_PRIORITY_NORMAL = 1,
+    REQUEST_PRIORITY_LOW = 2
+};
+
 // Represent server's ownership of services.
 enum ServiceOwnership {
     SERVER_OWNS_SERVICE,
@@ -288,10 +348,47 @@ struct ServiceOptions {
     // Default: true
     bool allow_http_body_to_pb;
 
-    // decode json string to protobuf bytes using base64 decoding when this 
+    // decode json string to protobuf bytes using base64 decoding when this
     // option is turned on.
     // Default: false if BAIDU_INTERNAL is defined, otherwise true
     bool pb_bytes_to_base64;
+
+    // If this option is non-empty, listed request fields are not parsed
+    // eagerly on the server: their wire bytes are cut out of the request
+    // before parsing and kept as zero-copy IOBuf slices, accessible from
+    // the method through Controller::ParseLazyRequestField(). Useful for
+    // rarely-inspected large submessages whose parse would dominate the
+    // request cost. Mappings are in form of:
+    // "METHOD1 => FIELD_NUM1 FIELD_NUM2, METHOD2 => FIELD_NUM3 ..." where
+    // METHODs are method names of the service and FIELD_NUMs are numbers
+    // of length-delimited (message/string/bytes) non-required fields of
+    // the request. Only effective for uncompressed baidu_std requests,
+    // compressed ones are still parsed eagerly.
+    // Default: empty
+    std::string lazy_request_fields;
+};
+
+// Hooks run around a server-side method call, registered per method with
+// Server::AddMethodInterceptor(). Plain function pointers so that a chain
+// of interceptors compiles into a flat array invoked without virtual
+// dispatch or per-request allocations.
+struct MethodInterceptor {
+    // Called in the server thread right before the method, in registration
+    // order. `*ctx' is NULL on entry and may be set to a per-request
+    // context; allocate the context from cntl->arena() so that it's
+    // released together with the RPC without an extra free.
+    // Returning non-zero fails the RPC with the returned code and skips
+    // the method; after() of interceptors that already ran before() is
+    // still called.
+    int (*before)(Controller* cntl,
+                  const google::protobuf::Message* request,
+                  void** ctx);
+    // Called just before the response is sent, in reverse registration
+    // order, no matter whether the method succeeded or failed.
+    // Leave NULL when not needed.
+    void (*after)(Controller* cntl, void* ctx);
+
+    MethodInterceptor() : before(NULL), after(NULL) {}
 };
 
 // Represent ports inside [min_port, max_port]
@@ -340,6 +437,9 @@ public:
             bool is_tabbed;
             bool allow_http_body_to_pb;
             bool pb_bytes_to_base64;
+            // Numbers of request fields not parsed eagerly, see
+            // ServiceOptions.lazy_request_fields. Empty for most methods.
+            std::vector<int> lazy_request_fields;
             OpaqueParams();
         };
         OpaqueParams params;        
@@ -350,6 +450,12 @@ public:
         const google::protobuf::MethodDescriptor* method;
         MethodStatus* status;
         AdaptiveMaxConcurrency max_concurrency;
+        RequestPriority request_priority;
+        // Interceptors run around each call to the method, in order.
+        std::vector<MethodInterceptor> interceptors;
+        // Position in Server::_indexed_methods, assigned in Start().
+        // -1 before the server is started.
+        int index;
 
         MethodProperty();
     };
@@ -525,6 +631,43 @@ public:
     int MaxConcurrencyOf(google::protobuf::Service* service,
                          const butil::StringPiece& method_name) const;
 
+    // Register an interceptor around each call to the method, e.g.
+    //    server.AddMethodInterceptor("example.EchoService.Echo", ic);
+    // Interceptors run in registration order, see comments on
+    // MethodInterceptor for the calling convention.
+    // Note: This interface can ONLY be called between AddService() and
+    // Start().
+    // Returns 0 on success, -1 otherwise.
+    int AddMethodInterceptor(const butil::StringPiece& full_method_name,
+                             const MethodInterceptor& interceptor);
+
+    // Get/set the priority lane associated with a method, see the comment
+    // on RequestPriority above. Example:
+    //    server.RequestPriorityOf("example.EchoService.Echo") =
+    //        brpc::REQUEST_PRIORITY_HIGH;
+    // Note: These interfaces can ONLY be called before the server is started.
+    RequestPriority& RequestPriorityOf(const butil::StringPiece& full_method_name);
+    RequestPriority RequestPriorityOf(const butil::StringPiece& full_method_name) const;
+
+    RequestPriority& RequestPriorityOf(const butil::StringPiece& full_service_name,
+                          const butil::StringPiece& method_name);
+    RequestPriority RequestPriorityOf(const butil::StringPiece& full_service_name,
+                          const butil::StringPiece& method_name) const;
+
+    RequestPriority& RequestPriorityOf(google::protobuf::Service* service,
+                          const butil::StringPiece& method_name);
+    RequestPriority RequestPriorityOf(google::protobuf::Service* service,
+                          const butil::StringPiece& method_name) const;
+
+    // Runtime overrides of per-method settings (max_concurrency, priority
+    // lane, response compression threshold, interceptor toggles), usable
+    // while the server is serving -- unlike the setters above which only
+    // work before Start(). Updatable over HTTP through the builtin
+    // /method_options service. See comments in method_options.h.
+    MethodOptionsTable& method_options() { return _method_options; }
+    const MethodOptionsTable& method_options() const
+    { return _method_options; }
+
 private:
 friend class StatusService;
 friend class ProtobufsService;
@@ -532,6 +675,7 @@ friend class ConnectionsService;
 friend class BadMethodService;
 friend class ServerPrivateAccessor;
 friend class PrometheusMetricsService;
+friend class MethodOptionsService;
 friend class Controller;
 
     int AddServiceInternal(google::protobuf::Service* service,
@@ -571,6 +715,13 @@ friend class Controller;
     void GenerateVersionIfNeeded();
     void PutPidFileIfNeeded();
 
+    // Listen at ServerOptions.listen_fd_handoff_path (if set) in a
+    // separate thread to pass our listening fds to a successor process.
+    // Returns 0 on success (or when the option is unset), -1 otherwise.
+    int StartHandoffServerIfNeeded();
+    void StopHandoffServer();
+    static void* RunListenerHandoff(void*);
+
     const MethodProperty*
     FindMethodPropertyByFullName(const butil::StringPiece& fullname) const;
 
@@ -581,7 +732,12 @@ friend class Controller;
     const MethodProperty*
     FindMethodPropertyByNameAndIndex(const butil::StringPiece& service_name,
                                      int method_index) const;
-    
+
+    // Find method by the dense id assigned to it in Start(), which is
+    // MethodProperty.index of the method. Returns NULL when the id is out
+    // of range.
+    const MethodProperty* FindMethodPropertyByIndex(int index) const;
+
     const ServiceProperty*
     FindServicePropertyByFullName(const butil::StringPiece& fullname) const;
 
@@ -616,6 +772,9 @@ friend class Controller;
 
     AdaptiveMaxConcurrency& MaxConcurrencyOf(MethodProperty*);
     int MaxConcurrencyOf(const MethodProperty*) const;
+
+    RequestPriority& RequestPriorityOf(MethodProperty*);
+    RequestPriority RequestPriorityOf(const MethodProperty*) const;
     
     DISALLOW_COPY_AND_ASSIGN(Server);
 
@@ -628,12 +787,18 @@ friend class Controller;
     // number of the virtual services for mapping URL to methods.
     int _virtual_service_count;
     bool _failed_to_set_max_concurrency_of_method;
+    bool _failed_to_set_priority_of_method;
     Acceptor* _am;
     Acceptor* _internal_am;
     
     // Use method->full_name() as key
     MethodMap _method_map;
 
+    // Dense id -> method, rebuilt in Start(). Lets hot paths that already
+    // resolved a method once address it by array index afterwards instead
+    // of hashing its full name on each request.
+    std::vector<MethodProperty*> _indexed_methods;
+
     // Use service->full_name() as key
     ServiceMap _fullname_service_map;
     
@@ -658,6 +823,9 @@ friend class Controller;
     // Reloadable SSL mappings
     butil::DoublyBufferedData<CertMaps> _reload_cert_maps;
 
+    // Runtime per-method overrides, see method_options().
+    MethodOptionsTable _method_options;
+
     // Holds the memory of all SSL_CTXs
     SSLContextMap _ssl_ctx_map;
     
@@ -667,6 +835,14 @@ friend class Controller;
     std::string _version;
     time_t _last_start_time;
     bthread_t _derivative_thread;
+
+    // Listening unix socket at ServerOptions.listen_fd_handoff_path,
+    // accepted by _handoff_thread. -1 when the option is unset.
+    int _handoff_sockfd;
+    pthread_t _handoff_thread;
+    // Set by _handoff_thread after fds were passed to a successor. The
+    // successor owns the handoff path from then on, don't remove it.
+    butil::atomic<bool> _handoff_done;
     
     bthread_keytable_pool_t* _keytable_pool;
 
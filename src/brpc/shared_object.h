@@ -44,17 +44,22 @@ public:
     int AddRefManually()
     { return _nref.fetch_add(1, butil::memory_order_relaxed); }
 
-    // Remove one ref, if the ref_count hit zero, delete this object.
+    // Remove one ref, if the ref_count hit zero, recycle this object,
+    // which deletes it by default.
     // Same as butil::intrusive_ptr<T>(obj, false).reset(NULL)
     void RemoveRefManually() {
         if (_nref.fetch_sub(1, butil::memory_order_release) == 1) {
             butil::atomic_thread_fence(butil::memory_order_acquire);
-            delete this;
+            BeforeRecycled();
         }
     }
 
 protected:
     virtual ~SharedObject() { }
+
+    // Called when the ref count hits zero. Override this method to put
+    // the object back into pools instead of deleting it.
+    virtual void BeforeRecycled() { delete this; }
 private:
     butil::atomic<int> _nref;
 };
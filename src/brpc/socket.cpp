@@ -25,8 +25,13 @@
 #include <mesalink/openssl/x509.h>
 #endif
 #include <netinet/tcp.h>                         // getsockopt
+#include <algorithm>                             // std::max
+#include <vector>
 #include <gflags/gflags.h>
 #include "bthread/unstable.h"                    // bthread_timer_del
+#include "bthread/processor.h"                   // BT_LOOP_WHEN
+#include "bthread/mutex.h"                       // bthread::Mutex
+#include "bthread/condition_variable.h"          // bthread::ConditionVariable
 #include "butil/fd_utility.h"                     // make_non_blocking
 #include "butil/fd_guard.h"                       // fd_guard
 #include "butil/time.h"                           // cpuwide_time_us
@@ -34,6 +39,9 @@
 #include "butil/logging.h"                        // CHECK
 #include "butil/macros.h"
 #include "butil/class_name.h"                     // butil::class_name
+#include "butil/memory/singleton_on_pthread_once.h"
+#include "butil/third_party/murmurhash3/murmurhash3.h" // fmix64
+#include "bthread/execution_queue.h"              // WriteBatcher
 #include "brpc/log.h"
 #include "brpc/reloadable_flags.h"          // BRPC_VALIDATE_GFLAG
 #include "brpc/errno.pb.h"
@@ -48,6 +56,7 @@
 #include "brpc/policy/rtmp_protocol.h"  // FIXME
 #include "brpc/periodic_task.h"
 #include "brpc/details/health_check.h"
+#include "brpc/details/heartbeat_scheduler.h"
 #if defined(OS_MACOSX)
 #include <sys/event.h>
 #endif
@@ -79,20 +88,69 @@ DEFINE_int32(socket_send_buffer_size, -1,
 
 DEFINE_int32(ssl_bio_buffer_size, 16*1024, "Set buffer size for SSL read/write");
 
+DEFINE_int32(ssl_handshake_concurrency, 0,
+             "Max number of SSL handshakes running simultaneously, extra"
+             " handshakes wait until a running one finishes. Prevents a"
+             " reconnect storm of many TLS clients from occupying all"
+             " workers with crypto. <=0 means unlimited");
+BRPC_VALIDATE_GFLAG(ssl_handshake_concurrency, PassValidate);
+
 DEFINE_int64(socket_max_unwritten_bytes, 64 * 1024 * 1024,
              "Max unwritten bytes in each socket, if the limit is reached,"
              " Socket.Write fails with EOVERCROWDED");
+// Read on every Write() and ReleaseAdditionalReference(), cache the value
+// to keep the reads free of gflags internals.
+BRPC_CACHED_VALIDATE_GFLAG(socket_max_unwritten_bytes, PassValidate);
 
 DEFINE_int32(max_connection_pool_size, 100,
              "Max number of pooled connections to a single endpoint");
 BRPC_VALIDATE_GFLAG(max_connection_pool_size, PassValidate);
 
+DEFINE_int32(max_pooled_multiplex_calls, 1,
+             "Max number of concurrent calls multiplexed on one pooled"
+             " connection for protocols whose responses are correlated"
+             " with requests(e.g. baidu_std), bounding #connections to"
+             " one endpoint under high concurrency. 1(default) keeps"
+             " the exclusive one-call-per-connection behavior");
+BRPC_VALIDATE_GFLAG(max_pooled_multiplex_calls, PassValidate);
+
+DEFINE_int32(pooled_multiplex_large_msg_size, 131072,
+             "Pooled connections whose average incoming message size"
+             " exceeds this many bytes are not multiplexed, avoiding"
+             " head-of-line blocking behind large responses");
+BRPC_VALIDATE_GFLAG(pooled_multiplex_large_msg_size, PassValidate);
+
 DEFINE_int32(connect_timeout_as_unreachable, 3,
              "If the socket failed to connect due to ETIMEDOUT for so many "
              "times *continuously*, the error is changed to ENETUNREACH which "
              "fails the main socket as well when this socket is pooled.");
 
+DEFINE_bool(socket_write_batching, false,
+            "Drain background writes of multiple sockets in shared batcher "
+            "bthreads instead of one KeepWrite bthread per socket, combining "
+            "flushes under fan-out workloads");
+DEFINE_int32(socket_write_batcher_num, 1,
+             "Number of batcher bthreads when -socket_write_batching is on");
+DEFINE_int32(socket_urgent_write_max_preempt, 64,
+             "Max number of urgent writes moved before ordinary writes "
+             "pending on one socket between completions of ordinary writes, "
+             "bounding the delay that control messages may add to data");
+
+DEFINE_int32(socket_write_aggregation_us, 0,
+             "When positive, the first write on an idle connection is "
+             "delayed up to so many microseconds and flushed in the "
+             "background, so that writes issued meanwhile on the same "
+             "connection are combined into fewer syscalls (Nagle-like). "
+             "Trades up to so much latency for throughput, mainly useful "
+             "for servers answering heavily pipelined connections");
+BRPC_VALIDATE_GFLAG(socket_write_aggregation_us, NonNegativeInteger);
+DEFINE_int32(socket_write_aggregation_bytes, 65536,
+             "Writes of at least so many bytes bypass the aggregation "
+             "delay of -socket_write_aggregation_us and go out at once");
+BRPC_VALIDATE_GFLAG(socket_write_aggregation_bytes, PositiveInteger);
+
 DECLARE_int32(health_check_timeout_ms);
+DECLARE_bool(connection_affinity);
 
 static bool validate_connect_timeout_as_unreachable(const char*, int32_t v) {
     return v >= 2 && v < 1000/*large enough*/;
@@ -109,21 +167,36 @@ public:
     ~SocketPool();
 
     // Get an address-able socket. If the pool is empty, create one.
+    // When `allow_multiplex' is true a connection already carrying fewer
+    // than -max_pooled_multiplex_calls concurrent calls may be returned.
     // Returns 0 on success.
-    int GetSocket(SocketUniquePtr* ptr);
-    
+    int GetSocket(SocketUniquePtr* ptr, bool allow_multiplex);
+
     // Return a socket (which was returned by GetSocket) back to the pool,
     // if the pool is full, setfail the socket directly.
     void ReturnSocket(Socket* sock);
-    
+
+    // End one of the concurrent calls multiplexed on `sock'. Returns
+    // true when it was the last one and the socket must go through
+    // ReturnSocket (the caller detaches _shared_part first).
+    bool FinishOneCall(Socket* sock);
+
     // Get all pooled sockets inside.
     void ListSockets(std::vector<SocketId>* list, size_t max_count);
-    
+
 private:
+    // Take one multiplexed slot of a socket in _shareable, NULL when
+    // none qualifies. Entries of failed sockets are dropped on the way.
+    // Called with _mutex held.
+    Socket* TakeShareableSocket(SocketUniquePtr* ptr, int max_calls);
+
     // options used to create this instance
     SocketOptions _options;
     butil::Mutex _mutex;
     std::vector<SocketId> _pool;
+    // Sockets carrying 1..K-1 concurrent calls, candidates for
+    // multiplexed gets. Guarded by _mutex.
+    std::vector<SocketId> _shareable;
     butil::EndPoint _remote_side;
     butil::atomic<int> _numfree; // #free sockets in all sub pools.
     butil::atomic<int> _numinflight; // #inflight sockets in all sub pools.
@@ -273,6 +346,79 @@ void Socket::SharedPart::UpdateStatsEverySecond(int64_t now_ms) {
 
 SocketVarsCollector* g_vars = NULL;
 
+// Duration from the start of connect() to being connected(TCP established),
+// in microseconds. Useful for sizing timeouts and watching reconnect storms.
+static bvar::LatencyRecorder g_connect_latency("rpc_socket_connect");
+
+// Duration of SSL handshakes including the time queued behind
+// -ssl_handshake_concurrency, in microseconds.
+static bvar::LatencyRecorder g_ssl_handshake_latency("rpc_socket_ssl_handshake");
+
+static bthread::Mutex g_ssl_handshake_mutex;
+static bthread::ConditionVariable g_ssl_handshake_cond;
+static int g_ssl_nhandshaking = 0;
+static int g_ssl_nhandshake_queued = 0;
+
+static int GetSSLHandshakeQueued(void*) { return g_ssl_nhandshake_queued; }
+static bvar::PassiveStatus<int> g_ssl_handshake_queued_bvar(
+    "rpc_socket_ssl_handshake_queued", GetSSLHandshakeQueued, NULL);
+
+// Bytes sitting in _read_buf of all sockets waiting to be parsed.
+static butil::atomic<int64_t> g_total_unconsumed_in_bytes(0);
+static int64_t GetTotalUnconsumedInBytes(void*) {
+    return g_total_unconsumed_in_bytes.load(butil::memory_order_relaxed);
+}
+static bvar::PassiveStatus<int64_t> g_total_unconsumed_in_bytes_bvar(
+    "rpc_socket_unconsumed_in_bytes", GetTotalUnconsumedInBytes, NULL);
+
+int64_t Socket::TotalUnconsumedInBytes() {
+    return g_total_unconsumed_in_bytes.load(butil::memory_order_relaxed);
+}
+
+void Socket::SyncUnconsumedInBytes() {
+    const int64_t cur = (int64_t)_read_buf.length();
+    const int64_t old =
+        _unconsumed_in_bytes.exchange(cur, butil::memory_order_relaxed);
+    if (cur != old) {
+        g_total_unconsumed_in_bytes.fetch_add(
+            cur - old, butil::memory_order_relaxed);
+    }
+}
+
+// Scopes one run of Socket::SSLHandshake(). When -ssl_handshake_concurrency
+// is positive, at most so many handshakes run at the same time and extra
+// ones wait here, on bthread primitives thus yielding the worker instead
+// of blocking it. Destruction wakes one waiter and samples the duration.
+class ScopedSSLHandshake {
+public:
+    ScopedSSLHandshake() : _start_us(butil::cpuwide_time_us()), _limited(false) {
+        const int cap = FLAGS_ssl_handshake_concurrency;
+        if (cap > 0) {
+            std::unique_lock<bthread::Mutex> mu(g_ssl_handshake_mutex);
+            ++g_ssl_nhandshake_queued;
+            while (g_ssl_nhandshaking >= cap) {
+                g_ssl_handshake_cond.wait(mu);
+            }
+            --g_ssl_nhandshake_queued;
+            ++g_ssl_nhandshaking;
+            _limited = true;
+        }
+    }
+    ~ScopedSSLHandshake() {
+        if (_limited) {
+            {
+                std::unique_lock<bthread::Mutex> mu(g_ssl_handshake_mutex);
+                --g_ssl_nhandshaking;
+            }
+            g_ssl_handshake_cond.notify_one();
+        }
+        g_ssl_handshake_latency << (butil::cpuwide_time_us() - _start_us);
+    }
+private:
+    int64_t _start_us;
+    bool _limited;
+};
+
 static pthread_once_t s_create_vars_once = PTHREAD_ONCE_INIT;
 static void CreateVars() {
     g_vars = new SocketVarsCollector;
@@ -295,6 +441,11 @@ bool Socket::CreatedByConnect() const {
 }
 
 SocketMessage* const DUMMY_USER_MESSAGE = (SocketMessage*)0x1;
+// Bit 1 of WriteRequest._pc_and_udmsg marks an urgent request. The bit is
+// never set in a real SocketMessage*(at least 8-byte aligned) nor in
+// DUMMY_USER_MESSAGE(0x1), and survives clearing of the user message so
+// that ReturnSuccessfulWriteRequest still sees it.
+const uint64_t URGENT_WRITE_MASK = 0x2;
 const uint32_t MAX_PIPELINED_COUNT = 32768;
 
 struct BAIDU_CACHELINE_ALIGNMENT Socket::WriteRequest {
@@ -304,7 +455,7 @@ struct BAIDU_CACHELINE_ALIGNMENT Socket::WriteRequest {
     WriteRequest* next;
     bthread_id_t id_wait;
     Socket* socket;
-    
+
     uint32_t pipelined_count() const {
         return (_pc_and_udmsg >> 48) & 0x7FFF;
     }
@@ -315,10 +466,20 @@ struct BAIDU_CACHELINE_ALIGNMENT Socket::WriteRequest {
         _pc_and_udmsg &= 0xFFFFFFFFFFFFULL;
     }
     SocketMessage* user_message() const {
-        return (SocketMessage*)(_pc_and_udmsg & 0xFFFFFFFFFFFFULL);
+        return (SocketMessage*)(_pc_and_udmsg &
+                                (0xFFFFFFFFFFFFULL & ~URGENT_WRITE_MASK));
     }
     void clear_user_message() {
-        _pc_and_udmsg &= 0xFFFF000000000000ULL;
+        _pc_and_udmsg &= (0xFFFF000000000000ULL | URGENT_WRITE_MASK);
+    }
+    // Set from WriteOptions.urgent, promoted before ordinary requests by
+    // PreemptUrgentWrites(). Kept as a bit of _pc_and_udmsg to keep the
+    // struct within one cacheline.
+    bool is_urgent() const {
+        return _pc_and_udmsg & URGENT_WRITE_MASK;
+    }
+    void mark_urgent() {
+        _pc_and_udmsg |= URGENT_WRITE_MASK;
     }
     void set_pipelined_count_and_user_message(
         uint32_t pc, SocketMessage* msg, bool with_auth) {
@@ -337,7 +498,8 @@ struct BAIDU_CACHELINE_ALIGNMENT Socket::WriteRequest {
                 // is already failed.
                 (void)msg->AppendAndDestroySelf(&dummy_buf, NULL);
             }
-            set_pipelined_count_and_user_message(0, NULL, false);
+            clear_pipelined_count_and_with_auth();
+            clear_user_message();  // keeps the urgent bit
             return true;
         }
         return false;
@@ -365,7 +527,7 @@ void Socket::WriteRequest::Setup(Socket* s) {
         }
         const int64_t before_write =
             s->_unwritten_bytes.fetch_add(data.size(), butil::memory_order_relaxed);
-        if (before_write + (int64_t)data.size() >= FLAGS_socket_max_unwritten_bytes) {
+        if (before_write + (int64_t)data.size() >= s->max_unwritten_bytes()) {
             s->_overcrowded = true;
         }
     }
@@ -386,6 +548,118 @@ void Socket::WriteRequest::Setup(Socket* s) {
 Socket::WriteRequest* const Socket::WriteRequest::UNCONNECTED =
     (Socket::WriteRequest*)(intptr_t)-1;
 
+// Drains background writes of many sockets in a fixed set of consumer
+// bthreads (-socket_write_batching). Compared with one KeepWrite bthread
+// per socket, WriteRequests accumulate behind the queue and are flushed
+// with fewer writev calls and bthread wakeups under fan-out workloads.
+// A socket whose kernel buffer is full is handed back to a dedicated
+// KeepWrite bthread (the only thing that may wait for epollout), so one
+// blocked socket never stalls the batch.
+class WriteBatcher {
+public:
+    static WriteBatcher* GetGlobalWriteBatcher();
+
+    // Take over the background write of `req' (including the reference
+    // stored in req->socket). Returns 0 on success, -1 otherwise and the
+    // caller still owns `req'.
+    int Dispatch(Socket::WriteRequest* req);
+
+private:
+friend class butil::GetLeakySingleton<WriteBatcher>;
+    WriteBatcher();
+    static int ExecuteWrites(
+        void* meta, bthread::TaskIterator<Socket::WriteRequest*>& iter);
+
+    std::vector<bthread::ExecutionQueueId<Socket::WriteRequest*> > _queues;
+};
+
+WriteBatcher::WriteBatcher() {
+    const int nqueue = std::max(FLAGS_socket_write_batcher_num, 1);
+    _queues.resize(nqueue);
+    bthread::ExecutionQueueOptions q_opt;
+    for (int i = 0; i < nqueue; ++i) {
+        CHECK_EQ(0, bthread::execution_queue_start(
+                     &_queues[i], &q_opt, ExecuteWrites, NULL));
+    }
+}
+
+WriteBatcher* WriteBatcher::GetGlobalWriteBatcher() {
+    return butil::get_leaky_singleton<WriteBatcher>();
+}
+
+int WriteBatcher::Dispatch(Socket::WriteRequest* req) {
+    const size_t index =
+        butil::fmix64(req->socket->id()) % _queues.size();
+    return bthread::execution_queue_execute(_queues[index], req);
+}
+
+int WriteBatcher::ExecuteWrites(
+    void* /*meta*/, bthread::TaskIterator<Socket::WriteRequest*>& iter) {
+    if (iter.is_queue_stopped()) {
+        return 0;
+    }
+    for (; iter; ++iter) {
+        Socket::WriteRequest* req = *iter;
+        SocketUniquePtr s(req->socket);
+        Socket::WriteRequest* cur_tail = NULL;
+        do {
+            // req was written, skip it.
+            if (req->next != NULL && req->data.empty()) {
+                Socket::WriteRequest* const saved_req = req;
+                req = req->next;
+                s->ReturnSuccessfulWriteRequest(saved_req);
+            }
+            if (req->next != NULL &&
+                s->_nurgent_unwritten.load(butil::memory_order_relaxed) > 0) {
+                s->PreemptUrgentWrites(&req->next, &cur_tail);
+            }
+            const ssize_t nw = s->DoWrite(req);
+            if (nw < 0) {
+                if (errno != EAGAIN && errno != EOVERCROWDED) {
+                    const int saved_errno = errno;
+                    PLOG_IF(WARNING, errno != EPIPE)
+                        << "Fail to keep-write into " << *s;
+                    s->SetFailed(saved_errno,
+                                 "Fail to keep-write into %s: %s",
+                                 s->description().c_str(),
+                                 berror(saved_errno));
+                    s->ReleaseAllFailedWriteRequests(req);
+                    break;
+                }
+                // Kernel buffer is full, move the socket out of the batch
+                // into a dedicated KeepWrite bthread which is allowed to
+                // wait for epollout.
+                req->socket = s.release();
+                bthread_t th;
+                if (bthread_start_background(
+                        &th, &BTHREAD_ATTR_NORMAL,
+                        Socket::KeepWrite, req) != 0) {
+                    LOG(FATAL) << "Fail to start KeepWrite";
+                    Socket::KeepWrite(req);
+                }
+                break;
+            }
+            s->AddOutputBytes(nw);
+            // Release WriteRequest until non-empty data or last request.
+            while (req->next != NULL && req->data.empty()) {
+                Socket::WriteRequest* const saved_req = req;
+                req = req->next;
+                s->ReturnSuccessfulWriteRequest(saved_req);
+            }
+            if (NULL == cur_tail) {
+                for (cur_tail = req; cur_tail->next != NULL;
+                     cur_tail = cur_tail->next);
+            }
+            if (s->IsWriteComplete(cur_tail, (req == cur_tail), &cur_tail)) {
+                CHECK_EQ(cur_tail, req);
+                s->ReturnSuccessfulWriteRequest(req);
+                break;
+            }
+        } while (true);
+    }
+    return 0;
+}
+
 class Socket::EpollOutRequest : public SocketUser {
 public:
     EpollOutRequest() : fd(-1), timer_id(0)
@@ -422,18 +696,20 @@ Socket::Socket(Forbidden)
     , _fd(-1)
     , _tos(0)
     , _reset_fd_real_us(-1)
+    , _connect_start_us(0)
     , _on_edge_triggered_events(NULL)
     , _user(NULL)
     , _conn(NULL)
+    , _io(NULL)
     , _this_id(0)
     , _preferred_index(-1)
-    , _hc_count(0)
     , _last_msg_size(0)
     , _avg_msg_size(0)
+    , _avg_read_size(0)
+    , _unconsumed_in_bytes(0)
     , _last_readtime_us(0)
     , _parsing_context(NULL)
     , _correlation_id(0)
-    , _health_check_interval_s(-1)
     , _ninprocess(1)
     , _auth_flag_error(0)
     , _auth_id(INVALID_BTHREAD_ID)
@@ -442,22 +718,35 @@ Socket::Socket(Forbidden)
     , _ssl_session(NULL)
     , _connection_type_for_progressive_read(CONNECTION_TYPE_UNKNOWN)
     , _controller_released_socket(false)
-    , _overcrowded(false)
+    , _pooled_mux_calls(0)
+    , _pooled_mux_shared(false)
+    , _on_writable(NULL)
+    , _on_writable_arg(NULL)
+    , _writable_notify_armed(false)
     , _fail_me_at_server_stop(false)
     , _logoff_flag(false)
     , _recycle_flag(false)
     , _error_code(0)
     , _pipeline_q(NULL)
-    , _last_writetime_us(0)
-    , _unwritten_bytes(0)
-    , _epollout_butex(NULL)
-    , _write_head(NULL)
     , _stream_set(NULL)
+    , _hc_count(0)
+    , _health_check_interval_s(-1)
     , _ninflight_app_health_check(0)
+    , _write_head(NULL)
+    , _epollout_butex(NULL)
+    , _unwritten_bytes(0)
+    , _last_writetime_us(0)
+    , _nurgent_unwritten(0)
+    , _nurgent_promoted(0)
+    , _overcrowded(false)
+    , _max_unwritten_bytes(0)
 {
     CreateVarsOnce();
     pthread_mutex_init(&_id_wait_list_mutex, NULL);
     _epollout_butex = bthread::butex_create_checked<butil::atomic<int> >();
+    for (size_t i = 0; i < WRITE_REQUEST_CACHE_SIZE; ++i) {
+        _write_req_cache[i].store(NULL, butil::memory_order_relaxed);
+    }
 }
 
 Socket::~Socket() {
@@ -465,61 +754,158 @@ Socket::~Socket() {
     bthread::butex_destroy(_epollout_butex);
 }
 
+// Never called: the asserts break compilation when the hot/cold grouping
+// in socket.h regresses, e.g. a field added at the end lands on the
+// cacheline of the write path.
+void Socket::CheckCachelineLayout() {
+    // The versioned refcount leads the object and shares its cacheline
+    // with nothing else.
+    BAIDU_CASSERT(offsetof(Socket, _versioned_ref) == 0,
+                  versioned_ref_leads_the_object);
+    BAIDU_CASSERT(offsetof(Socket, _shared_part) == BAIDU_CACHELINE_SIZE,
+                  versioned_ref_alone_on_first_cacheline);
+    // The write path owns the last cacheline exclusively.
+    BAIDU_CASSERT(offsetof(Socket, _write_head) % BAIDU_CACHELINE_SIZE == 0,
+                  write_group_starts_a_cacheline);
+    BAIDU_CASSERT(sizeof(Socket) - offsetof(Socket, _write_head) ==
+                  BAIDU_CACHELINE_SIZE, write_group_fits_last_cacheline);
+    // Health-check bookkeeping stays off the write line.
+    BAIDU_CASSERT(offsetof(Socket, _ninflight_app_health_check) <
+                  offsetof(Socket, _write_head),
+                  hc_fields_before_write_group);
+}
+
+inline Socket::WriteRequest* Socket::AllocWriteRequest() {
+    for (size_t i = 0; i < WRITE_REQUEST_CACHE_SIZE; ++i) {
+        WriteRequest* req =
+            _write_req_cache[i].load(butil::memory_order_relaxed);
+        if (req != NULL && _write_req_cache[i].compare_exchange_strong(
+                req, NULL, butil::memory_order_acquire,
+                butil::memory_order_relaxed)) {
+            return req;
+        }
+    }
+    return butil::get_object<WriteRequest>();
+}
+
+inline void Socket::FreeWriteRequest(Socket::WriteRequest* p) {
+    for (size_t i = 0; i < WRITE_REQUEST_CACHE_SIZE; ++i) {
+        if (_write_req_cache[i].load(butil::memory_order_relaxed) == NULL) {
+            WriteRequest* expected = NULL;
+            if (_write_req_cache[i].compare_exchange_strong(
+                    expected, p, butil::memory_order_release,
+                    butil::memory_order_relaxed)) {
+                return;
+            }
+        }
+    }
+    butil::return_object(p);
+}
+
+void Socket::DrainWriteRequestCache() {
+    for (size_t i = 0; i < WRITE_REQUEST_CACHE_SIZE; ++i) {
+        WriteRequest* req = _write_req_cache[i].exchange(
+            NULL, butil::memory_order_acquire);
+        if (req != NULL) {
+            butil::return_object(req);
+        }
+    }
+}
+
 void Socket::ReturnSuccessfulWriteRequest(Socket::WriteRequest* p) {
     DCHECK(p->data.empty());
     AddOutputMessages(1);
+    if (p->is_urgent()) {
+        _nurgent_unwritten.fetch_sub(1, butil::memory_order_relaxed);
+    } else {
+        // An ordinary request went out, urgent ones may jump again.
+        _nurgent_promoted = 0;
+    }
     const bthread_id_t id_wait = p->id_wait;
-    butil::return_object(p);
+    FreeWriteRequest(p);
     if (id_wait != INVALID_BTHREAD_ID) {
         NotifyOnFailed(id_wait);
     }
 }
 
-void Socket::ReturnFailedWriteRequest(Socket::WriteRequest* p, int error_code,
-                                      const std::string& error_text) {
+bthread_id_t Socket::ReclaimFailedWriteRequest(Socket::WriteRequest* p) {
+    if (p->is_urgent()) {
+        _nurgent_unwritten.fetch_sub(1, butil::memory_order_relaxed);
+    }
     if (!p->reset_pipelined_count_and_user_message()) {
         CancelUnwrittenBytes(p->data.size());
     }
     p->data.clear();  // data is probably not written.
     const bthread_id_t id_wait = p->id_wait;
-    butil::return_object(p);
+    FreeWriteRequest(p);
+    return id_wait;
+}
+
+void Socket::ReturnFailedWriteRequest(Socket::WriteRequest* p, int error_code,
+                                      const std::string& error_text) {
+    const bthread_id_t id_wait = ReclaimFailedWriteRequest(p);
     if (id_wait != INVALID_BTHREAD_ID) {
         bthread_id_error2(id_wait, error_code, error_text);
     }
 }
 
 Socket::WriteRequest* Socket::ReleaseWriteRequestsExceptLast(
-    Socket::WriteRequest* req, int error_code, const std::string& error_text) {
+    Socket::WriteRequest* req, std::vector<bthread_id_t>* failed_ids) {
     WriteRequest* p = req;
     while (p->next != NULL) {
         WriteRequest* const saved_next = p->next;
-        ReturnFailedWriteRequest(p, error_code, error_text);
+        const bthread_id_t id_wait = ReclaimFailedWriteRequest(p);
+        if (id_wait != INVALID_BTHREAD_ID) {
+            failed_ids->push_back(id_wait);
+        }
         p = saved_next;
     }
     return p;
 }
 
+// Time from entering ReleaseAllFailedWriteRequests to having errored all
+// correlation ids of the queued requests. This is the drain that delays
+// failover when a connection with a long write queue breaks.
+static bvar::LatencyRecorder g_fail_drain_latency("rpc_socket_fail_drain");
+
 void Socket::ReleaseAllFailedWriteRequests(Socket::WriteRequest* req) {
     CHECK(Failed());
     pthread_mutex_lock(&_id_wait_list_mutex);
     const int error_code = non_zero_error_code();
     const std::string error_text = _error_text;
     pthread_mutex_unlock(&_id_wait_list_mutex);
+    const int64_t start_us = butil::cpuwide_time_us();
+    // Reclaim the whole queue first so that buffered data and unwritten
+    // byte accounting are released in one quick pass, then error the
+    // collected correlation ids in one batch. Erroring an id runs its
+    // error callback inline and dominates the drain of a long queue,
+    // keeping it out of the reclaiming loop shortens the time the queue
+    // (and its buffers) stays alive.
+    std::vector<bthread_id_t> failed_ids;
     // Notice that `req' is not tail if Address after IsWriteComplete fails.
     do {
-        req = ReleaseWriteRequestsExceptLast(req, error_code, error_text);
+        req = ReleaseWriteRequestsExceptLast(req, &failed_ids);
         if (!req->reset_pipelined_count_and_user_message()) {
             CancelUnwrittenBytes(req->data.size());
         }
         req->data.clear();  // MUST, otherwise IsWriteComplete is false
     } while (!IsWriteComplete(req, true, NULL));
-    ReturnFailedWriteRequest(req, error_code, error_text);
+    const bthread_id_t last_id = ReclaimFailedWriteRequest(req);
+    if (last_id != INVALID_BTHREAD_ID) {
+        failed_ids.push_back(last_id);
+    }
+    if (!failed_ids.empty()) {
+        bthread_id_error2_batched(&failed_ids[0], failed_ids.size(),
+                                  error_code, error_text);
+    }
+    g_fail_drain_latency << butil::cpuwide_time_us() - start_us;
 }
 
 int Socket::ResetFileDescriptor(int fd) {
     // Reset message sizes when fd is changed.
     _last_msg_size = 0;
     _avg_msg_size = 0;
+    _avg_read_size = 0;
     // MUST store `_fd' before adding itself into epoll device to avoid
     // race conditions with the callback function inside epoll
     _fd.store(fd, butil::memory_order_release);
@@ -598,7 +984,13 @@ int Socket::Create(const SocketOptions& options, SocketId* id) {
     m->_on_edge_triggered_events = options.on_edge_triggered_events;
     m->_user = options.user;
     m->_conn = options.conn;
+    m->_io = options.io;
     m->_app_connect = options.app_connect;
+    m->_app_ping = options.app_ping;
+    m->_max_unwritten_bytes = options.max_unwritten_bytes;
+    m->_on_writable = options.on_writable;
+    m->_on_writable_arg = options.on_writable_arg;
+    m->_writable_notify_armed.store(false, butil::memory_order_relaxed);
     // nref can be non-zero due to concurrent AddressSocket().
     // _this_id will only be used in destructor/Destroy of referenced
     // slots, which is safe and properly fenced. Although it's better
@@ -628,6 +1020,8 @@ int Socket::Create(const SocketOptions& options, SocketId* id) {
     m->_ssl_ctx = options.initial_ssl_ctx;
     m->_connection_type_for_progressive_read = CONNECTION_TYPE_UNKNOWN;
     m->_controller_released_socket.store(false, butil::memory_order_relaxed);
+    m->_pooled_mux_calls = 0;
+    m->_pooled_mux_shared = false;
     m->_overcrowded = false;
     // May be non-zero for RTMP connections.
     m->_fail_me_at_server_stop = false;
@@ -635,7 +1029,10 @@ int Socket::Create(const SocketOptions& options, SocketId* id) {
     m->_recycle_flag.store(false, butil::memory_order_relaxed);
     m->_error_code = 0;
     m->_error_text.clear();
-    m->_agent_socket_id.store(INVALID_SOCKET_ID, butil::memory_order_relaxed);
+    for (size_t i = 0; i < MAX_AGENT_SOCKET_NUM; ++i) {
+        m->_agent_socket_ids[i].store(INVALID_SOCKET_ID,
+                                      butil::memory_order_relaxed);
+    }
     m->_ninflight_app_health_check.store(0, butil::memory_order_relaxed);
     // NOTE: last two params are useless in bthread > r32787
     const int rc = bthread_id_list_init(&m->_id_wait_list, 512, 512);
@@ -656,6 +1053,10 @@ int Socket::Create(const SocketOptions& options, SocketId* id) {
                      berror(saved_errno));
         return -1;
     }
+    if (options.app_ping != NULL && options.app_ping_interval_s > 0) {
+        HeartbeatScheduler::GetInstance()->Add(
+            m->_this_id, options.app_ping_interval_s);
+    }
     *id = m->_this_id;
     return 0;
 }
@@ -710,6 +1111,7 @@ int Socket::WaitAndReset(int32_t expected_nref) {
     // Must clear _read_buf otehrwise even if the connections is recovered,
     // the kept old data is likely to make parsing fail.
     _read_buf.clear();
+    SyncUnconsumedInBytes();
     _ninprocess.store(1, butil::memory_order_relaxed);
     _auth_flag_error.store(0, butil::memory_order_relaxed);
     const int rc = bthread_id_create(&_auth_id, NULL, NULL);
@@ -952,11 +1354,15 @@ void Socket::OnRecycle() {
         _app_connect.swap(tmp);
         tmp->StopConnect(this);
     }
+    _app_ping.reset();
     if (_conn) {
         SocketConnection* const saved_conn = _conn;
         _conn = NULL;
         saved_conn->BeforeRecycle(this);
     }
+    _io = NULL;
+    _on_writable = NULL;
+    _on_writable_arg = NULL;
     if (_user) {
         SocketUser* const saved_user = _user;
         _user = NULL;
@@ -978,6 +1384,7 @@ void Socket::OnRecycle() {
     }
     reset_parsing_context(NULL);
     _read_buf.clear();
+    SyncUnconsumedInBytes();
 
     _auth_flag_error.store(0, butil::memory_order_relaxed);
     bthread_id_error(_auth_id, 0);
@@ -990,7 +1397,12 @@ void Socket::OnRecycle() {
     }
 
     _ssl_ctx = NULL;
-    
+
+    // All WriteRequests were released before recycling.
+    DCHECK_EQ(0, _nurgent_unwritten.load(butil::memory_order_relaxed));
+    _nurgent_promoted = 0;
+    DrainWriteRequestCache();
+
     delete _pipeline_q;
     _pipeline_q = NULL;
 
@@ -1000,14 +1412,17 @@ void Socket::OnRecycle() {
     delete _stream_set;
     _stream_set = NULL;
 
-    const SocketId asid = _agent_socket_id.load(butil::memory_order_relaxed);
-    if (asid != INVALID_SOCKET_ID) {
-        SocketUniquePtr ptr;
-        if (Socket::Address(asid, &ptr) == 0) {
-            ptr->ReleaseAdditionalReference();
+    for (size_t i = 0; i < MAX_AGENT_SOCKET_NUM; ++i) {
+        const SocketId asid =
+            _agent_socket_ids[i].load(butil::memory_order_relaxed);
+        if (asid != INVALID_SOCKET_ID) {
+            SocketUniquePtr ptr;
+            if (Socket::Address(asid, &ptr) == 0) {
+                ptr->ReleaseAdditionalReference();
+            }
         }
     }
-    
+
     g_vars->nsocket << -1;
 }
 
@@ -1018,6 +1433,10 @@ void* Socket::ProcessEvent(void* arg) {
     return NULL;
 }
 
+// Max number of WriteRequests gathered into one writev(and one collected
+// segment in IsWriteComplete).
+static const size_t DATA_LIST_MAX = 256;
+
 // Check if there're new requests appended.
 // If yes, point old_head to to reversed new requests and return false;
 // If no:
@@ -1051,15 +1470,50 @@ bool Socket::IsWriteComplete(Socket::WriteRequest* old_head,
     // Above acquire fence pairs release fence of exchange in Write() to make
     // sure that we see all fields of requests set.
 
-    // Someone added new requests.
-    // Reverse the list until old_head.
-    WriteRequest* tail = NULL;
+    // Someone added new requests. The chain hangs from newest to oldest:
+    // collect it into a bounded array so that linking and Setup() are done
+    // in a single oldest-to-newest pass without reversing in place. The
+    // calling sequence of Setup() matters for protocols using
+    // pipelined_count and must be oldest to newest.
+    WriteRequest* seg[DATA_LIST_MAX];
+    size_t nseg = 0;
     WriteRequest* p = new_head;
+    bool overflow = false;
     do {
-        while (p->next == WriteRequest::UNCONNECTED) {
-            // TODO(gejun): elaborate this
-            sched_yield();
+        // The producer exchanged `p' into _write_head but has not set
+        // p->next yet(1~2 instructions away), pause briefly before
+        // yielding the CPU.
+        BT_LOOP_WHEN(p->next == WriteRequest::UNCONNECTED,
+                     30/*nops before sched_yield*/);
+        if (nseg >= DATA_LIST_MAX) {
+            overflow = true;
+            break;
+        }
+        seg[nseg++] = p;
+        p = p->next;
+        CHECK(p != NULL);
+    } while (p != old_head);
+
+    if (!overflow) {
+        // Link old list with new list and run Setup() on the fly.
+        old_head->next = seg[nseg - 1];
+        for (size_t i = nseg; i > 0; --i) {
+            WriteRequest* const q = seg[i - 1];
+            q->next = (i > 1 ? seg[i - 2] : NULL);
+            q->Setup(this);
         }
+        if (new_tail) {
+            *new_tail = new_head;
+        }
+        return false;
+    }
+
+    // Over-long chain(rare, implies a huge backlog), reverse in place.
+    WriteRequest* tail = NULL;
+    p = new_head;
+    do {
+        BT_LOOP_WHEN(p->next == WriteRequest::UNCONNECTED,
+                     30/*nops before sched_yield*/);
         WriteRequest* const saved_next = p->next;
         p->next = tail;
         tail = p;
@@ -1069,9 +1523,6 @@ bool Socket::IsWriteComplete(Socket::WriteRequest* old_head,
 
     // Link old list with new list.
     old_head->next = tail;
-    // Call Setup() from oldest to newest, notice that the calling sequence
-    // matters for protocols using pipelined_count, this is why we don't
-    // calling Setup in above loop which is from newest to oldest.
     for (WriteRequest* q = tail; q; q = q->next) {
         q->Setup(this);
     }
@@ -1128,6 +1579,7 @@ int Socket::Connect(const timespec* abstime,
     serv_addr.sin_family = AF_INET;
     serv_addr.sin_addr = remote_side().ip;
     serv_addr.sin_port = htons(remote_side().port);
+    _connect_start_us = butil::cpuwide_time_us();
     const int rc = ::connect(
         sockfd, (struct sockaddr*)&serv_addr, sizeof(serv_addr));
     if (rc != 0 && errno != EINPROGRESS) {
@@ -1226,6 +1678,10 @@ int Socket::CheckConnected(int sockfd) {
     if (CreatedByConnect()) {
         g_vars->channel_conn << 1;
     }
+    if (_connect_start_us > 0) {
+        g_connect_latency << (butil::cpuwide_time_us() - _connect_start_us);
+        _connect_start_us = 0;
+    }
     // Doing SSL handshake after TCP connected
     return SSLHandshake(sockfd, false);
 }
@@ -1447,10 +1903,20 @@ int Socket::Write(butil::IOBuf* data, const WriteOptions* options_in) {
     }
 
     if (!opt.ignore_eovercrowded && _overcrowded) {
+        if (_on_writable != NULL) {
+            // Arm the notification before re-reading _overcrowded so that
+            // a drain racing with us can not slip between the two: either
+            // we see the drained state here, or CancelUnwrittenBytes sees
+            // the armed flag.
+            _writable_notify_armed.store(true, butil::memory_order_seq_cst);
+            if (!_overcrowded) {
+                NotifyOnWritable();
+            }
+        }
         return SetError(opt.id_wait, EOVERCROWDED);
     }
 
-    WriteRequest* req = butil::get_object<WriteRequest>();
+    WriteRequest* req = AllocWriteRequest();
     if (!req) {
         return SetError(opt.id_wait, ENOMEM);
     }
@@ -1462,6 +1928,10 @@ int Socket::Write(butil::IOBuf* data, const WriteOptions* options_in) {
     req->id_wait = opt.id_wait;
     req->set_pipelined_count_and_user_message(
         opt.pipelined_count, DUMMY_USER_MESSAGE, opt.with_auth);
+    if (opt.urgent) {
+        req->mark_urgent();
+        _nurgent_unwritten.fetch_add(1, butil::memory_order_relaxed);
+    }
     return StartWrite(req, opt);
 }
 
@@ -1484,10 +1954,20 @@ int Socket::Write(SocketMessagePtr<>& msg, const WriteOptions* options_in) {
     }
     
     if (!opt.ignore_eovercrowded && _overcrowded) {
+        if (_on_writable != NULL) {
+            // Arm the notification before re-reading _overcrowded so that
+            // a drain racing with us can not slip between the two: either
+            // we see the drained state here, or CancelUnwrittenBytes sees
+            // the armed flag.
+            _writable_notify_armed.store(true, butil::memory_order_seq_cst);
+            if (!_overcrowded) {
+                NotifyOnWritable();
+            }
+        }
         return SetError(opt.id_wait, EOVERCROWDED);
     }
     
-    WriteRequest* req = butil::get_object<WriteRequest>();
+    WriteRequest* req = AllocWriteRequest();
     if (!req) {
         return SetError(opt.id_wait, ENOMEM);
     }
@@ -1497,6 +1977,10 @@ int Socket::Write(SocketMessagePtr<>& msg, const WriteOptions* options_in) {
     req->next = WriteRequest::UNCONNECTED;
     req->id_wait = opt.id_wait;
     req->set_pipelined_count_and_user_message(opt.pipelined_count, msg.release(), opt.with_auth);
+    if (opt.urgent) {
+        req->mark_urgent();
+        _nurgent_unwritten.fetch_add(1, butil::memory_order_relaxed);
+    }
     return StartWrite(req, opt);
 }
 
@@ -1544,12 +2028,40 @@ int Socket::StartWrite(WriteRequest* req, const WriteOptions& opt) {
         // in the background.
         goto KEEPWRITE_IN_BACKGROUND;
     }
-    
+
+    // Nagle-like aggregation: keep the queue open for up to
+    // -socket_write_aggregation_us instead of writing inline, so that
+    // writes pushed onto this queue meanwhile are flushed together by the
+    // background writer with fewer syscalls. Big payloads gain nothing
+    // from waiting and go out at once.
+    if (FLAGS_socket_write_aggregation_us > 0 &&
+        req->data.size() < (size_t)FLAGS_socket_write_aggregation_bytes) {
+        ReAddress(&ptr_for_keep_write);
+        req->socket = ptr_for_keep_write.release();
+        bthread_timer_t timer;
+        if (bthread_timer_add(
+                &timer,
+                butil::microseconds_from_now(FLAGS_socket_write_aggregation_us),
+                LaunchDelayedKeepWrite, req) == 0) {
+            return 0;
+        }
+        PLOG(WARNING) << "Fail to add timer, flush immediately";
+        if (bthread_start_background(&th, &BTHREAD_ATTR_NORMAL,
+                                     KeepWrite, req) != 0) {
+            LOG(FATAL) << "Fail to start KeepWrite";
+            KeepWrite(req);
+        }
+        return 0;
+    }
+
     // Write once in the calling thread. If the write is not complete,
     // continue it in KeepWrite thread.
     if (_conn) {
         butil::IOBuf* data_arr[1] = { &req->data };
         nw = _conn->CutMessageIntoFileDescriptor(fd(), data_arr, 1);
+    } else if (_io) {
+        butil::IOBuf* data_arr[1] = { &req->data };
+        nw = _io->Write(this, data_arr, 1);
     } else {
         nw = req->data.cut_into_file_descriptor(fd());
     }
@@ -1574,6 +2086,13 @@ int Socket::StartWrite(WriteRequest* req, const WriteOptions& opt) {
 KEEPWRITE_IN_BACKGROUND:
     ReAddress(&ptr_for_keep_write);
     req->socket = ptr_for_keep_write.release();
+    // SSL writes may block the consumer bthread, keep them in dedicated
+    // KeepWrite bthreads.
+    if (FLAGS_socket_write_batching && ssl_state() == SSL_OFF) {
+        if (WriteBatcher::GetGlobalWriteBatcher()->Dispatch(req) == 0) {
+            return 0;
+        }
+    }
     if (bthread_start_background(&th, &BTHREAD_ATTR_NORMAL,
                                  KeepWrite, req) != 0) {
         LOG(FATAL) << "Fail to start KeepWrite";
@@ -1590,7 +2109,67 @@ FAIL_TO_WRITE:
     return -1;
 }
 
-static const size_t DATA_LIST_MAX = 256;
+// Timer callback flushing a queue held open by -socket_write_aggregation_us.
+// Runs in the timer thread, hand over to a bthread (or the write batcher)
+// instead of writing here.
+void Socket::LaunchDelayedKeepWrite(void* arg) {
+    WriteRequest* req = static_cast<WriteRequest*>(arg);
+    if (FLAGS_socket_write_batching && req->socket->ssl_state() == SSL_OFF) {
+        if (WriteBatcher::GetGlobalWriteBatcher()->Dispatch(req) == 0) {
+            return;
+        }
+    }
+    bthread_t th;
+    if (bthread_start_background(&th, &BTHREAD_ATTR_NORMAL,
+                                 KeepWrite, req) != 0) {
+        LOG(FATAL) << "Fail to start KeepWrite";
+        KeepWrite(req);
+    }
+}
+
+// Stably partition the list headed by *pnext so that urgent requests
+// precede ordinary ones. Only the background writer owning the queue may
+// call this, and only on fully set-up requests behind the (possibly
+// partially written) current request, thus messages never interleave on
+// the wire. A leading run of urgent requests is already in front and
+// costs no budget; each actual jump consumes one unit of
+// -socket_urgent_write_max_preempt, which is refilled when an ordinary
+// request completes, so continuous control traffic cannot starve data.
+void Socket::PreemptUrgentWrites(WriteRequest** pnext,
+                                 WriteRequest** pcur_tail) {
+    WriteRequest* urgent_head = NULL;
+    WriteRequest** urgent_ptail = &urgent_head;
+    WriteRequest* ordinary_head = NULL;
+    WriteRequest** ordinary_ptail = &ordinary_head;
+    WriteRequest* ordinary_last = NULL;
+    bool moved = false;
+    for (WriteRequest* p = *pnext; p != NULL;) {
+        WriteRequest* const saved_next = p->next;
+        if (p->is_urgent() && ordinary_head != NULL &&
+            _nurgent_promoted < FLAGS_socket_urgent_write_max_preempt) {
+            *urgent_ptail = p;
+            urgent_ptail = &p->next;
+            ++_nurgent_promoted;
+            moved = true;
+        } else {
+            *ordinary_ptail = p;
+            ordinary_ptail = &p->next;
+            ordinary_last = p;
+        }
+        p = saved_next;
+    }
+    if (!moved) {
+        // Links were rebuilt as they were, including the ending NULL.
+        return;
+    }
+    // `moved' implies at least one ordinary request, which ends the list.
+    *urgent_ptail = ordinary_head;
+    *ordinary_ptail = NULL;
+    *pnext = urgent_head;
+    if (pcur_tail != NULL && *pcur_tail != NULL) {
+        *pcur_tail = ordinary_last;
+    }
+}
 
 void* Socket::KeepWrite(void* void_arg) {
     g_vars->nkeepwrite << 1;
@@ -1608,6 +2187,10 @@ void* Socket::KeepWrite(void* void_arg) {
             req = req->next;
             s->ReturnSuccessfulWriteRequest(saved_req);
         }
+        if (req->next != NULL &&
+            s->_nurgent_unwritten.load(butil::memory_order_relaxed) > 0) {
+            s->PreemptUrgentWrites(&req->next, &cur_tail);
+        }
         const ssize_t nw = s->DoWrite(req);
         if (nw < 0) {
             if (errno != EAGAIN && errno != EOVERCROWDED) {
@@ -1681,6 +2264,8 @@ ssize_t Socket::DoWrite(WriteRequest* req) {
         // Write IOBuf in the batch array into the fd.
         if (_conn) {
             return _conn->CutMessageIntoFileDescriptor(fd(), data_list, ndata);
+        } else if (_io) {
+            return _io->Write(this, data_list, ndata);
         } else {
             ssize_t nw = butil::IOBuf::cut_multiple_into_file_descriptor(
                 fd(), data_list, ndata);
@@ -1734,6 +2319,8 @@ int Socket::SSLHandshake(int fd, bool server_mode) {
         return 0;
     }
 
+    ScopedSSLHandshake hs_scope;
+
     // TODO: Reuse ssl session id for client
     if (_ssl_session) {
         // Free the last session, which may be deprecated when socket failed
@@ -1752,6 +2339,48 @@ int Socket::SSLHandshake(int fd, bool server_mode) {
 
     _ssl_state = SSL_CONNECTING;
 
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+    if (server_mode && SSL_CTX_get_max_early_data(_ssl_ctx->raw_ctx) > 0) {
+        // Drain TLS1.3 0-RTT data into _read_buf before completing the
+        // handshake, the bytes are parsed as ordinary request data by the
+        // caller afterwards.
+        char early_buf[4096];
+        size_t nread = 0;
+        int rc;
+        while ((rc = SSL_read_early_data(_ssl_session, early_buf,
+                                         sizeof(early_buf), &nread))
+               != SSL_READ_EARLY_DATA_FINISH) {
+            if (rc == SSL_READ_EARLY_DATA_SUCCESS) {
+                _read_buf.append(early_buf, nread);
+                continue;
+            }
+            const int ssl_error = SSL_get_error(_ssl_session, rc);
+            if (ssl_error == SSL_ERROR_WANT_READ) {
+#if defined(OS_LINUX)
+                if (bthread_fd_wait(fd, EPOLLIN) != 0) {
+#elif defined(OS_MACOSX)
+                if (bthread_fd_wait(fd, EVFILT_READ) != 0) {
+#endif
+                    return -1;
+                }
+            } else if (ssl_error == SSL_ERROR_WANT_WRITE) {
+#if defined(OS_LINUX)
+                if (bthread_fd_wait(fd, EPOLLOUT) != 0) {
+#elif defined(OS_MACOSX)
+                if (bthread_fd_wait(fd, EVFILT_WRITE) != 0) {
+#endif
+                    return -1;
+                }
+            } else {
+                errno = ESSL;
+                LOG(ERROR) << "Fail to SSL_read_early_data: "
+                           << SSLError(ERR_get_error());
+                return -1;
+            }
+        }
+    }
+#endif  // OPENSSL_VERSION_NUMBER >= 0x10101000L
+
     // Loop until SSL handshake has completed. For SSL_ERROR_WANT_READ/WRITE,
     // we use bthread_fd_wait as polling mechanism instead of EventDispatcher
     // as it may confuse the origin event processing code.
@@ -1759,6 +2388,14 @@ int Socket::SSLHandshake(int fd, bool server_mode) {
         int rc = SSL_do_handshake(_ssl_session);
         if (rc == 1) {
             _ssl_state = SSL_CONNECTED;
+#ifdef SSL_OP_ENABLE_KTLS
+            // Swapping in buffered BIOs would detach the kTLS-enabled
+            // socket BIO and fall back to userspace record encryption.
+            if (BIO_get_ktls_send(SSL_get_wbio(_ssl_session)) > 0 ||
+                BIO_get_ktls_recv(SSL_get_rbio(_ssl_session)) > 0) {
+                return 0;
+            }
+#endif
             AddBIOBuffer(_ssl_session, fd, FLAGS_ssl_bio_buffer_size);
             return 0;
         }
@@ -1803,6 +2440,8 @@ int Socket::SSLHandshake(int fd, bool server_mode) {
 }
 
 ssize_t Socket::DoRead(size_t size_hint) {
+    // Bytes of TLS1.3 early data appended into _read_buf while handshaking.
+    size_t early_nr = 0;
     if (ssl_state() == SSL_UNKNOWN) {
         int error_code = 0;
         _ssl_state = DetectSSLState(fd(), &error_code);
@@ -1815,12 +2454,15 @@ ssize_t Socket::DoRead(size_t size_hint) {
                 return -1;
             }
 
-        case SSL_CONNECTING:
+        case SSL_CONNECTING: {
+            const size_t size_before_handshake = _read_buf.length();
             if (SSLHandshake(fd(), true) != 0) {
                 errno = EINVAL;
                 return -1;
             }
+            early_nr = _read_buf.length() - size_before_handshake;
             break;
+        }
 
         case SSL_CONNECTED:
             CHECK(false) << "Impossible to reach here";
@@ -1832,6 +2474,9 @@ ssize_t Socket::DoRead(size_t size_hint) {
     }
     // _ssl_state has been set
     if (ssl_state() == SSL_OFF) {
+        if (_io) {
+            return _io->Read(this, &_read_buf, size_hint);
+        }
         return _read_buf.append_from_file_descriptor(fd(), size_hint);
     }
 
@@ -1867,6 +2512,11 @@ ssize_t Socket::DoRead(size_t size_hint) {
         break;
     }
     }
+    if (early_nr > 0) {
+        // Count the 0-RTT bytes taken during the handshake so that the
+        // caller parses them even if the channel had nothing more to read.
+        return (nr > 0 ? nr : 0) + (ssize_t)early_nr;
+    }
     return nr;
 }
 
@@ -1956,6 +2606,12 @@ int Socket::StartInputEvent(SocketId id, uint32_t events,
 
         bthread_attr_t attr = thread_attr;
         attr.keytable_pool = p->_keytable_pool;
+        if (FLAGS_connection_affinity) {
+            // Keep reading/parsing of one connection on the same worker,
+            // processing bthreads follow in QueueMessage.
+            const unsigned a = (unsigned)id;
+            attr.affinity = (a ? a : 1);
+        }
         if (bthread_start_urgent(&tid, &attr, ProcessEvent, p) != 0) {
             LOG(FATAL) << "Fail to start ProcessEvent";
             ProcessEvent(p);
@@ -2079,6 +2735,7 @@ void Socket::DebugSocket(std::ostream& os, SocketId id) {
     const int64_t cpuwide_now = butil::cpuwide_time_us();
     os << "\nhc_count=" << ptr->_hc_count
        << "\navg_input_msg_size=" << ptr->_avg_msg_size
+       << "\navg_read_size=" << ptr->_avg_read_size
         // NOTE: We're assuming that butil::IOBuf.size() is thread-safe, it is now
         // however it's not guaranteed.
        << "\nread_buf=" << ptr->_read_buf.size()
@@ -2117,10 +2774,19 @@ void Socket::DebugSocket(std::ostream& os, SocketId id) {
        << "\nninflight_app_health_check="
        << ptr->_ninflight_app_health_check.load(butil::memory_order_relaxed)
        << "\nagent_socket_id=";
-    const SocketId asid = ptr->_agent_socket_id.load(butil::memory_order_relaxed);
-    if (asid != INVALID_SOCKET_ID) {
-        os << asid;
-    } else {
+    bool has_agent_socket = false;
+    for (size_t i = 0; i < Socket::MAX_AGENT_SOCKET_NUM; ++i) {
+        const SocketId asid =
+            ptr->_agent_socket_ids[i].load(butil::memory_order_relaxed);
+        if (asid != INVALID_SOCKET_ID) {
+            if (has_agent_socket) {
+                os << ',';
+            }
+            has_agent_socket = true;
+            os << asid;
+        }
+    }
+    if (!has_agent_socket) {
         os << "(none)";
     }
     os << "\ncid=" << ptr->_correlation_id
@@ -2280,8 +2946,68 @@ inline SocketPool::~SocketPool() {
     }
 }
 
-inline int SocketPool::GetSocket(SocketUniquePtr* ptr) {
+inline Socket* SocketPool::TakeShareableSocket(SocketUniquePtr* ptr,
+                                               int max_calls) {
+    const int64_t large_msg = FLAGS_pooled_multiplex_large_msg_size;
+    while (!_shareable.empty()) {
+        const SocketId sid = _shareable.back();
+        SocketUniquePtr tmp;
+        if (Socket::Address(sid, &tmp) != 0) {
+            // The socket failed with calls inflight, drop the entry.
+            _shareable.pop_back();
+            continue;
+        }
+        if (large_msg > 0 && tmp->_avg_msg_size >= (uint32_t)large_msg) {
+            // Carrying large responses, stop sharing it to avoid
+            // head-of-line blocking. Inflight calls finish as usual.
+            tmp->_pooled_mux_shared = false;
+            _shareable.pop_back();
+            continue;
+        }
+        if (++tmp->_pooled_mux_calls >= max_calls) {
+            tmp->_pooled_mux_shared = false;
+            _shareable.pop_back();
+        }
+        ptr->reset(tmp.release());
+        return ptr->get();
+    }
+    return NULL;
+}
+
+inline bool SocketPool::FinishOneCall(Socket* sock) {
+    const int max_mux_calls = FLAGS_max_pooled_multiplex_calls;
+    const int64_t large_msg = FLAGS_pooled_multiplex_large_msg_size;
+    BAIDU_SCOPED_LOCK(_mutex);
+    if (sock->_pooled_mux_calls <= 1) {
+        sock->_pooled_mux_calls = 0;
+        if (sock->_pooled_mux_shared) {
+            for (std::vector<SocketId>::iterator it = _shareable.begin();
+                 it != _shareable.end(); ++it) {
+                if (*it == sock->id()) {
+                    _shareable.erase(it);
+                    break;
+                }
+            }
+            sock->_pooled_mux_shared = false;
+        }
+        return true;
+    }
+    --sock->_pooled_mux_calls;
+    if (!sock->_pooled_mux_shared &&
+        max_mux_calls > 1 &&
+        sock->_pooled_mux_calls < max_mux_calls &&
+        (large_msg <= 0 || sock->_avg_msg_size < (uint32_t)large_msg)) {
+        // Dropped below the cap, offer the freed slot again.
+        sock->_pooled_mux_shared = true;
+        _shareable.push_back(sock->id());
+    }
+    return false;
+}
+
+inline int SocketPool::GetSocket(SocketUniquePtr* ptr, bool allow_multiplex) {
     const int connection_pool_size = FLAGS_max_connection_pool_size;
+    const int max_mux_calls = FLAGS_max_pooled_multiplex_calls;
+    const bool multiplex = allow_multiplex && max_mux_calls > 1;
 
     // In prev rev, SocketPool could be sharded into multiple SubSocketPools to
     // reduce thread contentions. The sharding key is mixed from pthread-id so
@@ -2313,6 +3039,20 @@ inline int SocketPool::GetSocket(SocketUniquePtr* ptr) {
             // is likely to be valid.
             if (Socket::Address(sid, ptr) == 0) {
                 _numinflight.fetch_add(1, butil::memory_order_relaxed);
+                BAIDU_SCOPED_LOCK(_mutex);
+                (*ptr)->_pooled_mux_calls = 1;
+                if (multiplex) {
+                    (*ptr)->_pooled_mux_shared = true;
+                    _shareable.push_back(sid);
+                }
+                return 0;
+            }
+        }
+        if (multiplex) {
+            // No free connection, share an inflight one below its cap
+            // before creating a new fd.
+            BAIDU_SCOPED_LOCK(_mutex);
+            if (TakeShareableSocket(ptr, max_mux_calls) != NULL) {
                 return 0;
             }
         }
@@ -2323,6 +3063,12 @@ inline int SocketPool::GetSocket(SocketUniquePtr* ptr) {
     if (get_client_side_messenger()->Create(opt, &sid) == 0 &&
         Socket::Address(sid, ptr) == 0) {
         _numinflight.fetch_add(1, butil::memory_order_relaxed);
+        BAIDU_SCOPED_LOCK(_mutex);
+        (*ptr)->_pooled_mux_calls = 1;
+        if (multiplex) {
+            (*ptr)->_pooled_mux_shared = true;
+            _shareable.push_back(sid);
+        }
         return 0;
     }
     return -1;
@@ -2397,7 +3143,8 @@ void Socket::ShareStats(Socket* main_socket) {
     }
 }
 
-int Socket::GetPooledSocket(SocketUniquePtr* pooled_socket) {
+int Socket::GetPooledSocket(SocketUniquePtr* pooled_socket,
+                            bool allow_multiplex) {
     if (pooled_socket == NULL) {
         LOG(ERROR) << "pooled_socket is NULL";
         return -1;
@@ -2426,11 +3173,14 @@ int Socket::GetPooledSocket(SocketUniquePtr* pooled_socket) {
             socket_pool = expected;
         }
     }
-    if (socket_pool->GetSocket(pooled_socket) != 0) {
+    if (socket_pool->GetSocket(pooled_socket, allow_multiplex) != 0) {
         return -1;
     }
     (*pooled_socket)->ShareStats(this);
-    CHECK((*pooled_socket)->parsing_context() == NULL)
+    // Multiplexed connections may legitimately carry a partially
+    // received response of another call here, like single connections.
+    CHECK(FLAGS_max_pooled_multiplex_calls > 1 ||
+          (*pooled_socket)->parsing_context() == NULL)
         << "context=" << (*pooled_socket)->parsing_context()
         << " is not NULL when " << *(*pooled_socket) << " is got from"
         " SocketPool, the protocol implementation is buggy";
@@ -2438,20 +3188,33 @@ int Socket::GetPooledSocket(SocketUniquePtr* pooled_socket) {
 }
 
 int Socket::ReturnToPool() {
-    SharedPart* sp = _shared_part.exchange(NULL, butil::memory_order_acquire);
-    if (sp == NULL) {
+    SharedPart* checked_sp = GetSharedPart();
+    if (checked_sp == NULL) {
         LOG(ERROR) << "_shared_part is NULL";
         SetFailed(EINVAL, "_shared_part is NULL");
         return -1;
     }
-    SocketPool* pool = sp->socket_pool.load(butil::memory_order_consume);
+    SocketPool* pool = checked_sp->socket_pool.load(butil::memory_order_consume);
     if (pool == NULL) {
         LOG(ERROR) << "_shared_part->socket_pool is NULL";
         SetFailed(EINVAL, "_shared_part->socket_pool is NULL");
-        sp->RemoveRefManually();
         return -1;
     }
-    CHECK(parsing_context() == NULL)
+    if (!pool->FinishOneCall(this)) {
+        // Other calls are still multiplexed on this socket, it stays
+        // out of the free pool and keeps _shared_part.
+        return 0;
+    }
+    SharedPart* sp = _shared_part.exchange(NULL, butil::memory_order_acquire);
+    if (sp == NULL) {
+        LOG(ERROR) << "_shared_part is NULL";
+        SetFailed(EINVAL, "_shared_part is NULL");
+        return -1;
+    }
+    // Multiplexed connections may hold a partial late response of an
+    // already-ended call here, resumed at the next get, like single
+    // connections do.
+    CHECK(FLAGS_max_pooled_multiplex_calls > 1 || parsing_context() == NULL)
         << "context=" << parsing_context() << " is not released when "
         << *this << " is returned to SocketPool, the protocol "
         "implementation is buggy";
@@ -2521,8 +3284,15 @@ int Socket::GetShortSocket(SocketUniquePtr* short_socket) {
     return 0;
 }
 
-int Socket::GetAgentSocket(SocketUniquePtr* out, bool (*checkfn)(Socket*)) {
-    SocketId id = _agent_socket_id.load(butil::memory_order_relaxed);
+const size_t Socket::MAX_AGENT_SOCKET_NUM;
+
+int Socket::GetAgentSocket(SocketUniquePtr* out, size_t index,
+                           bool (*checkfn)(Socket*)) {
+    if (index >= MAX_AGENT_SOCKET_NUM) {
+        LOG(ERROR) << "Invalid agent socket index=" << index;
+        return -1;
+    }
+    SocketId id = _agent_socket_ids[index].load(butil::memory_order_relaxed);
     SocketUniquePtr tmp_sock;
     do {
         if (Socket::Address(id, &tmp_sock) == 0) {
@@ -2543,7 +3313,7 @@ int Socket::GetAgentSocket(SocketUniquePtr* out, bool (*checkfn)(Socket*)) {
             tmp_sock->ReleaseAdditionalReference();
         } while (1);
 
-        if (_agent_socket_id.compare_exchange_strong(
+        if (_agent_socket_ids[index].compare_exchange_strong(
                 id, tmp_sock->id(), butil::memory_order_acq_rel)) {
             out->swap(tmp_sock);
             return 0;
@@ -2553,8 +3323,11 @@ int Socket::GetAgentSocket(SocketUniquePtr* out, bool (*checkfn)(Socket*)) {
     } while (1);
 }
 
-int Socket::PeekAgentSocket(SocketUniquePtr* out) const {
-    SocketId id = _agent_socket_id.load(butil::memory_order_relaxed);
+int Socket::PeekAgentSocket(SocketUniquePtr* out, size_t index) const {
+    if (index >= MAX_AGENT_SOCKET_NUM) {
+        return -1;
+    }
+    SocketId id = _agent_socket_ids[index].load(butil::memory_order_relaxed);
     if (id == INVALID_SOCKET_ID) {
         return -1;
     }
@@ -2579,16 +3352,69 @@ void Socket::AddInputBytes(size_t bytes) {
 void Socket::AddInputMessages(size_t count) {
     GetOrNewSharedPart()->in_num_messages.fetch_add(count, butil::memory_order_relaxed);
 }
+int64_t Socket::max_unwritten_bytes() const {
+    return _max_unwritten_bytes > 0 ?
+        _max_unwritten_bytes : BRPC_CACHED_FLAG(socket_max_unwritten_bytes);
+}
+
+struct OnWritableNotification {
+    void (*fn)(SocketId, void*);
+    SocketId id;
+    void* arg;
+};
+
+static void* RunOnWritableNotification(void* void_arg) {
+    OnWritableNotification* n = static_cast<OnWritableNotification*>(void_arg);
+    n->fn(n->id, n->arg);
+    delete n;
+    return NULL;
+}
+
+void Socket::NotifyOnWritable() {
+    bool armed = true;
+    if (!_writable_notify_armed.compare_exchange_strong(
+            armed, false, butil::memory_order_acquire,
+            butil::memory_order_relaxed)) {
+        return;
+    }
+    // Copy everything the callback needs: by the time the bthread runs,
+    // this socket may be recycled already.
+    OnWritableNotification* n = new OnWritableNotification;
+    n->fn = _on_writable;
+    n->id = _this_id;
+    n->arg = _on_writable_arg;
+    // Start a bthread to call the callback: this function runs on write
+    // paths which must not block in user code.
+    bthread_t th;
+    if (bthread_start_background(
+            &th, &BTHREAD_ATTR_NORMAL, RunOnWritableNotification, n) != 0) {
+        LOG(FATAL) << "Fail to start RunOnWritableNotification";
+        RunOnWritableNotification(n);
+    }
+}
+
 void Socket::CancelUnwrittenBytes(size_t bytes) {
     const int64_t before_minus =
         _unwritten_bytes.fetch_sub(bytes, butil::memory_order_relaxed);
-    if (before_minus < (int64_t)bytes + FLAGS_socket_max_unwritten_bytes) {
+    const int64_t limit = max_unwritten_bytes();
+    if (before_minus < (int64_t)bytes + limit) {
         _overcrowded = false;
     }
+    if (_on_writable != NULL &&
+        before_minus - (int64_t)bytes <= limit / 2 &&
+        _writable_notify_armed.load(butil::memory_order_seq_cst)) {
+        // Below the low-watermark with a producer rejected since last
+        // notification, wake the producers up.
+        NotifyOnWritable();
+    }
 }
 void Socket::AddOutputBytes(size_t bytes) {
     GetOrNewSharedPart()->out_size.fetch_add(bytes, butil::memory_order_relaxed);
-    _last_writetime_us.store(butil::cpuwide_time_us(),
+    // The timestamp only feeds idle-time bookkeeping at second granularity
+    // (e.g. logoff), the coarse clock is good enough and cheaper on this
+    // per-write path. Comparable with _last_readtime_us since both clocks
+    // are CLOCK_MONOTONIC based.
+    _last_writetime_us.store(butil::coarse_monotonic_time_us(),
                              butil::memory_order_relaxed);
     CancelUnwrittenBytes(bytes);
 }
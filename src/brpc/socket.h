@@ -21,6 +21,7 @@
 
 #include <iostream>                            // std::ostream
 #include <deque>                               // std::deque
+#include <vector>                              // std::vector
 #include <set>                                 // std::set
 #include "butil/atomicops.h"                    // butil::atomic
 #include "bthread/types.h"                      // bthread_id_t
@@ -53,6 +54,8 @@ class Socket;
 class AuthContext;
 class EventDispatcher;
 class Stream;
+class WriteBatcher;
+class SocketPool;
 
 // A special closure for processing the about-to-recycle socket. Socket does
 // not delete SocketUser, if you want, `delete this' at the end of
@@ -91,6 +94,32 @@ public:
     virtual ssize_t CutMessageIntoSSLChannel(SSL*, butil::IOBuf**, size_t) = 0;
 };
 
+// Pluggable transport for Socket, letting a userspace network stack
+// (DPDK-based f-stack, AF_XDP etc.) take over reads and writes while
+// IOBuf stays the data currency. Readiness is still signaled through the
+// regular paths: the stack should either make fd() a pollable handle
+// registered in EventDispatcher, or call Socket::StartInputEvent()/
+// HandleEpollOut() by itself when data/space becomes available.
+// The Socket does not delete SocketIO since one instance is typically
+// shared by all sockets of the stack.
+// NOTE: SSL is not supported on sockets with a SocketIO.
+class SocketIO {
+public:
+    virtual ~SocketIO() {}
+
+    // Append at most `size_hint' bytes read from the connection to `buf'.
+    // Semantics follow IOPortal::append_from_file_descriptor: returns
+    // #bytes appended, 0 on EOF, -1 otherwise with errno set(EAGAIN when
+    // nothing is readable at the moment).
+    virtual ssize_t Read(Socket* s, butil::IOPortal* buf,
+                         size_t size_hint) = 0;
+
+    // Cut data in `data_list'[0..ndata) into the connection. Semantics
+    // follow IOBuf::cut_multiple_into_file_descriptor.
+    virtual ssize_t Write(Socket* s, butil::IOBuf** data_list,
+                          size_t ndata) = 0;
+};
+
 // Application-level connect. After TCP connected, the client sends some
 // sort of "connect" message to the server to establish application-level
 // connection.
@@ -115,6 +144,22 @@ public:
     virtual void StopConnect(Socket*) = 0;
 };
 
+// Application-level heartbeat. Called by a shared scheduler (see
+// details/heartbeat_scheduler.h) when the host socket stayed idle for
+// SocketOptions.app_ping_interval_s, typically writing a small ping
+// message to keep the connection warm.
+// Instances of AppPing may be shared by multiple sockets and often
+// created by std::make_shared<T>() where T implements AppPing
+class AppPing {
+public:
+    virtual ~AppPing() {}
+
+    // Write the ping into `socket' with Socket::Write(). Must not block
+    // for long, it's called inline by the scheduler sweeping all due
+    // sockets of the second.
+    virtual void SendPing(Socket* socket) = 0;
+};
+
 // _s = per second, _m = per minute
 struct SocketStat {
     uint32_t in_size_s;
@@ -133,6 +178,7 @@ struct SocketVarsCollector {
         , channel_conn("rpc_channel_connection_count")
         , neventthread_second("rpc_event_thread_second", &neventthread)
         , nhealthcheck("rpc_health_check_count")
+        , nhealthcheck_second("rpc_health_check_second", &nhealthcheck)
         , nkeepwrite_second("rpc_keepwrite_second", &nkeepwrite)
         , nwaitepollout("rpc_waitepollout_count")
         , nwaitepollout_second("rpc_waitepollout_second", &nwaitepollout)
@@ -143,6 +189,7 @@ struct SocketVarsCollector {
     bvar::Adder<int> neventthread;
     bvar::PerSecond<bvar::Adder<int> > neventthread_second;
     bvar::Adder<int64_t> nhealthcheck;
+    bvar::PerSecond<bvar::Adder<int64_t> > nhealthcheck_second;
     bvar::Adder<int64_t> nkeepwrite;
     bvar::PerSecond<bvar::Adder<int64_t> > nkeepwrite_second;
     bvar::Adder<int64_t> nwaitepollout;
@@ -193,12 +240,41 @@ struct SocketOptions {
     std::shared_ptr<AppConnect> app_connect;
     // The created socket will set parsing_context with this value.
     Destroyable* initial_parsing_context;
+    // If `app_ping' is set and `app_ping_interval_s' is positive,
+    // app_ping->SendPing() is called on the socket after roughly every
+    // app_ping_interval_s seconds of inactivity. Pings of all sockets
+    // are scheduled by one shared timer wheel and jittered, making
+    // heartbeats on many mostly-idle connections cheap.
+    int app_ping_interval_s;
+    std::shared_ptr<AppPing> app_ping;
+    // When non-NULL, the socket reads and writes through this vtable
+    // instead of calling read/writev on `fd'. Not owned.
+    SocketIO* io;
+    // When positive, overrides -socket_max_unwritten_bytes for this socket:
+    // Write() fails with EOVERCROWDED once bytes queued but not yet written
+    // to the fd reach the value. Lets a few heavy streaming connections get
+    // a budget independent from ordinary RPC connections.
+    // Default: 0 (use the flag)
+    int64_t max_unwritten_bytes;
+    // When set, called in a separate bthread each time this socket recovers
+    // from overcrowding: unwritten bytes dropped below half of the limit
+    // after a Write() was rejected with EOVERCROWDED. The notification is
+    // edge-triggered: instead of retrying EOVERCROWDED in a loop, producers
+    // should suspend themselves(e.g. wait on a butex or SyncPoint) after
+    // the failed Write() and resume writing inside the callback. The
+    // callback may run before the failed Write() even returns and must
+    // tolerate spurious calls. The socket behind `id' may have been
+    // SetFailed(), Address() it before use. `arg' is on_writable_arg.
+    // Default: NULL (Write() still fails with EOVERCROWDED, no callback)
+    void (*on_writable)(SocketId id, void* arg);
+    void* on_writable_arg;
 };
 
 // Abstractions on reading from and writing into file descriptors.
 // NOTE: accessed by multiple threads(frequently), align it by cacheline.
 class BAIDU_CACHELINE_ALIGNMENT/*note*/ Socket {
 friend class EventDispatcher;
+friend class IOUringEventDispatcher;
 friend class InputMessenger;
 friend class Acceptor;
 friend class ConnectionsService;
@@ -212,6 +288,9 @@ friend class HealthCheckTask;
 friend class OnAppHealthCheckDone;
 friend class HealthCheckManager;
 friend class policy::H2GlobalStreamCreator;
+friend class WriteBatcher;
+friend class HeartbeatScheduler;
+friend class SocketPool;
     class SharedPart;
     struct Forbidden {};
     struct WriteRequest;
@@ -262,10 +341,23 @@ public:
         // Default: false
         bool ignore_eovercrowded;
 
+        // Treat the message as a self-contained control message(h2
+        // WINDOW_UPDATE/PING, streaming ACK...) which the background writer
+        // moves before ordinary messages pending on this socket, so that
+        // small control frames are not delayed behind megabytes of data.
+        // The message being written currently is never interrupted and the
+        // number of promotions between completions of ordinary messages is
+        // bounded by -socket_urgent_write_max_preempt to prevent starvation.
+        // CAUTION: urgent messages may be reordered against other messages,
+        // never set this on messages that the remote side must receive in
+        // sending order, e.g. requests using pipelined_count.
+        // Default: false
+        bool urgent;
+
         WriteOptions()
             : id_wait(INVALID_BTHREAD_ID), abstime(NULL)
             , pipelined_count(0), with_auth(false)
-            , ignore_eovercrowded(false) {}
+            , ignore_eovercrowded(false), urgent(false) {}
     };
     int Write(butil::IOBuf *msg, const WriteOptions* options = NULL);
     
@@ -324,6 +416,17 @@ public:
     // Returns 0 on success, -1 when the Socket was SetFailed().
     static int Address(SocketId id, SocketUniquePtr* ptr);
 
+    // Borrow the Socket associated with `id' WITHOUT changing the reference
+    // count, saving two atomic RMW per use compared with Address(). The
+    // memory of sockets is pooled and never returned to the system, thus
+    // the returned pointer is always dereferenceable, however the slot may
+    // be recycled for another socket at any time. Only use this function
+    // for brief read-only peeks(e.g. availability probing) from code that
+    // does not block between borrow and last access, and revalidate with a
+    // real Address() before acting on the socket.
+    // Returns NULL when `id' does not reference a valid socket.
+    static Socket* AddressBorrowed(SocketId id);
+
     // Re-address current socket into `ptr'.
     // Always succeed even if this socket is failed.
     void ReAddress(SocketUniquePtr* ptr);
@@ -351,6 +454,16 @@ public:
 
     int isolated_times() const;
 
+    // Bytes read from this connection but not consumed by protocol parsing
+    // yet. Approximate: re-synced as InputMessenger reads and cuts messages.
+    // Bounded by -socket_max_unconsumed_bytes.
+    int64_t unconsumed_in_bytes() const
+    { return _unconsumed_in_bytes.load(butil::memory_order_relaxed); }
+
+    // unconsumed_in_bytes() summed over all sockets, bounded by
+    // -max_total_unconsumed_bytes.
+    static int64_t TotalUnconsumedInBytes();
+
     void FeedbackCircuitBreaker(int error_code, int64_t latency_us);
 
     bool Failed() const;
@@ -449,12 +562,18 @@ public:
     // True if this socket was created by Connect.
     bool CreatedByConnect() const;
 
-    // Get an UNUSED socket connecting to the same place as this socket
-    // from the SocketPool of this socket.
-    int GetPooledSocket(SocketUniquePtr* pooled_socket);
+    // Get a socket connecting to the same place as this socket from the
+    // SocketPool of this socket. Normally the socket is UNUSED; when
+    // `allow_multiplex' is true (protocols with correlated responses,
+    // e.g. baidu_std), a connection already carrying fewer than
+    // -max_pooled_multiplex_calls concurrent calls may be handed out
+    // again, bounding #connections under high concurrency.
+    int GetPooledSocket(SocketUniquePtr* pooled_socket,
+                        bool allow_multiplex = false);
 
     // Return this socket which MUST be got from GetPooledSocket to its
-    // main_socket's pool.
+    // main_socket's pool. Multiplexed sockets go back only when their
+    // last concurrent call ends.
     int ReturnToPool();
 
     // True if this socket has SocketPool
@@ -480,11 +599,24 @@ public:
     // LoadBalancers or NamingServices that may reference the Socket, agent
     // socket can be used for the communication and replaced periodically but
     // the main socket is unchanged.
-    int GetAgentSocket(SocketUniquePtr* out, bool (*checkfn)(Socket*));
+    int GetAgentSocket(SocketUniquePtr* out, bool (*checkfn)(Socket*))
+    { return GetAgentSocket(out, 0, checkfn); }
+
+    // Same as above on the `index'-th slot. A socket has
+    // MAX_AGENT_SOCKET_NUM independent agent slots so that protocols
+    // multiplexing streams (namely http2) can spread new streams over
+    // several connections to the same place.
+    int GetAgentSocket(SocketUniquePtr* out, size_t index,
+                       bool (*checkfn)(Socket*));
 
     // Take a peek at existing agent socket (no creation).
     // Returns 0 on success.
-    int PeekAgentSocket(SocketUniquePtr* out) const;
+    int PeekAgentSocket(SocketUniquePtr* out) const
+    { return PeekAgentSocket(out, 0); }
+    int PeekAgentSocket(SocketUniquePtr* out, size_t index) const;
+
+    // Number of agent slots. @GetAgentSocket
+    static const size_t MAX_AGENT_SOCKET_NUM = 8;
 
     // Where the stats of this socket are accumulated to.
     SocketId main_socket_id() const;
@@ -534,6 +666,14 @@ private:
     int ConductError(bthread_id_t);
     int StartWrite(WriteRequest*, const WriteOptions&);
 
+    // Effective cap on unwritten bytes of this socket:
+    // SocketOptions.max_unwritten_bytes when positive, otherwise
+    // -socket_max_unwritten_bytes.
+    int64_t max_unwritten_bytes() const;
+
+    // Call `_on_writable' in a new bthread if the notification is armed.
+    void NotifyOnWritable();
+
     int Dereference();
 friend void DereferenceSocket(Socket*);
 
@@ -550,7 +690,12 @@ friend void DereferenceSocket(Socket*);
     // SSLState is SSL_UNKNOWN, try to detect at first), read data
     // using the corresponding method into `_read_buf'. Returns read
     // bytes on success, 0 on EOF, -1 otherwise and errno is set
-    ssize_t DoRead(size_t size_hint);  
+    ssize_t DoRead(size_t size_hint);
+
+    // Re-sync _unconsumed_in_bytes and the process-wide sum with the
+    // current length of `_read_buf'. Called from the reading bthread
+    // after reads/cuts and from places truncating `_read_buf'.
+    void SyncUnconsumedInBytes();
 
     // Based upon whether the underlying channel is using SSL, write
     // `req' using the corresponding method. Returns written bytes on
@@ -595,15 +740,35 @@ friend void DereferenceSocket(Socket*);
     static void* ProcessEvent(void*);
 
     static void* KeepWrite(void*);
+    // Flush a write queue whose first write was delayed by
+    // -socket_write_aggregation_us.
+    static void LaunchDelayedKeepWrite(void* arg);
 
     bool IsWriteComplete(WriteRequest* old_head, bool singular_node,
                          WriteRequest** new_tail);
 
+    // [Only called by the background writer owning the write queue]
+    // Stably move urgent WriteRequests in the list headed by *pnext before
+    // ordinary ones. *pcur_tail (when non-NULL) is updated if the tail of
+    // the list changes.
+    void PreemptUrgentWrites(WriteRequest** pnext, WriteRequest** pcur_tail);
+
     void ReturnFailedWriteRequest(
         WriteRequest*, int error_code, const std::string& error_text);
+    // Release everything of a failed WriteRequest except erroring its
+    // correlation id, which is returned for the caller to fail, possibly
+    // in a batch together with other requests of a drained write queue.
+    bthread_id_t ReclaimFailedWriteRequest(WriteRequest*);
     void ReturnSuccessfulWriteRequest(WriteRequest*);
+
+    // Allocate/free WriteRequests through the per-socket cache before
+    // falling back to butil::ObjectPool, see _write_req_cache.
+    WriteRequest* AllocWriteRequest();
+    void FreeWriteRequest(WriteRequest*);
+    // Return cached WriteRequests to the ObjectPool, called on recycle.
+    void DrainWriteRequestCache();
     WriteRequest* ReleaseWriteRequestsExceptLast(
-        WriteRequest*, int error_code, const std::string& error_text);
+        WriteRequest*, std::vector<bthread_id_t>* failed_ids);
     void ReleaseAllFailedWriteRequests(WriteRequest*);
 
     // Generic callback for Socket to handle epollout event
@@ -662,6 +827,14 @@ friend void DereferenceSocket(Socket*);
     void CancelUnwrittenBytes(size_t bytes);
 
 private:
+    // Fields are grouped by the threads that frequently modify them so
+    // that contention on one group does not invalidate cachelines of the
+    // others (the class itself is cacheline-aligned): the versioned
+    // refcount sits alone, then mostly-read config and fields of the
+    // reading thread, then rarely-written bookkeeping, and finally the
+    // write path on the last cacheline. CheckCachelineLayout() in
+    // socket.cpp fails compilation when the grouping is broken.
+
     // unsigned 32-bit version + signed 32-bit referenced-count.
     // Meaning of version:
     // * Created version: no SetFailed() is called on the Socket yet. Must be
@@ -670,13 +843,15 @@ private:
     //   also the version encoded in SocketId.
     // * Failed version: = created version + 1, SetFailed()-ed but returned.
     // * Other versions: the socket is already recycled.
+    // CASed from all threads addressing the socket, keep it alone on the
+    // first cacheline.
     butil::atomic<uint64_t> _versioned_ref;
 
     // In/Out bytes/messages, SocketPool etc
     // _shared_part is shared by a main socket and all its pooled sockets.
     // Can't use intrusive_ptr because the creation is based on optimistic
     // locking and relies on atomic CAS. We manage references manually.
-    butil::atomic<SharedPart*> _shared_part;
+    butil::atomic<SharedPart*> BAIDU_CACHELINE_ALIGNMENT _shared_part;
 
     // [ Set in dispatcher ]
     // To keep the callback in at most one bthread at any time. Read comments
@@ -693,6 +868,11 @@ private:
     int _tos;                // Type of service which is actually only 8bits.
     int64_t _reset_fd_real_us; // When _fd was reset, in microseconds.
 
+    // When the last Connect() started, in cpuwide microseconds. Read and
+    // cleared by CheckConnected() to feed the connect latency bvar. 0 when
+    // no connect is in progress.
+    int64_t _connect_start_us;
+
     // Address of peer. Initialized by SocketOptions.remote_side.
     butil::EndPoint _remote_side;
 
@@ -711,10 +891,18 @@ private:
     // Customize creation of the connection. Initialized by SocketOptions.conn
     SocketConnection* _conn;
 
+    // Pluggable transport replacing read/writev on the fd.
+    // Initialized by SocketOptions.io, not owned.
+    SocketIO* _io;
+
     // User-level connection after TCP-connected.
     // Initialized by SocketOptions.app_connect.
     std::shared_ptr<AppConnect> _app_connect;
 
+    // Heartbeat on idle connections, called by HeartbeatScheduler.
+    // Initialized by SocketOptions.app_ping.
+    std::shared_ptr<AppPing> _app_ping;
+
     // Identifier of this Socket in ResourcePool
     SocketId _this_id;
     
@@ -722,18 +910,21 @@ private:
     // iterating all protocol handlers each time.
     int _preferred_index;
 
-    // Number of HC since the last SetFailed() was called. Set to 0 when the
-    // socket is revived. Only set in HealthCheckTask::OnTriggeringTask()
-    int _hc_count;
-
     // Size of current incomplete message, set to 0 on complete.
     uint32_t _last_msg_size;
     // Average message size of last #MSG_SIZE_WINDOW messages (roughly)
     uint32_t _avg_msg_size;
+    // EWMA of bytes returned by recent reads, sizing the next read so that
+    // sockets receiving large bursts take them in few syscalls while idle
+    // sockets don't over-allocate blocks.
+    uint32_t _avg_read_size;
 
     // Storing data read from `_fd' but cut-off yet.
     butil::IOPortal _read_buf;
 
+    // Accounted length of _read_buf, see unconsumed_in_bytes().
+    butil::atomic<int64_t> _unconsumed_in_bytes;
+
     // Set with cpuwide_time_us() at last read operation
     butil::atomic<int64_t> _last_readtime_us;
 
@@ -745,9 +936,6 @@ private:
     // connection simultaneously.
     uint64_t _correlation_id;
 
-    // Non-zero when health-checking is on.
-    int _health_check_interval_s;
-
     // +-1 bit-+---31 bit---+
     // |  flag |   counter  |
     // +-------+------------+
@@ -777,8 +965,18 @@ private:
     ConnectionType _connection_type_for_progressive_read;
     butil::atomic<bool> _controller_released_socket;
 
-    // True if the socket is too full to write.
-    volatile bool _overcrowded;
+    // Concurrent pooled calls multiplexed on this socket and whether it
+    // is currently listed as shareable in its SocketPool. Both are
+    // guarded by the pool's mutex.
+    int _pooled_mux_calls;
+    bool _pooled_mux_shared;
+
+    // Edge-triggered writable notification, from SocketOptions.
+    void (*_on_writable)(SocketId, void*);
+    void* _on_writable_arg;
+    // True when a Write() failed with EOVERCROWDED and `_on_writable' has
+    // not been called since. Cleared by NotifyOnWritable().
+    butil::atomic<bool> _writable_notify_armed;
 
     bool _fail_me_at_server_stop;
 
@@ -795,7 +993,7 @@ private:
     int _error_code;
     std::string _error_text;
 
-    butil::atomic<SocketId> _agent_socket_id;
+    butil::atomic<SocketId> _agent_socket_ids[MAX_AGENT_SOCKET_NUM];
 
     butil::Mutex _pipeline_mutex;
     std::deque<PipelinedInfo>* _pipeline_q;
@@ -804,21 +1002,62 @@ private:
     pthread_mutex_t _id_wait_list_mutex;
     bthread_id_list_t _id_wait_list;
 
-    // Set with cpuwide_time_us() at last write operation
-    butil::atomic<int64_t> _last_writetime_us;
-    // Queued but written
-    butil::atomic<int64_t> _unwritten_bytes;
-    
+    butil::Mutex _stream_mutex;
+    std::set<StreamId> *_stream_set;
+
+    // Number of HC since the last SetFailed() was called. Set to 0 when the
+    // socket is revived. Only set in HealthCheckTask::OnTriggeringTask()
+    int _hc_count;
+
+    // Non-zero when health-checking is on.
+    int _health_check_interval_s;
+
+    butil::atomic<int64_t> _ninflight_app_health_check;
+
+    // Small cache of freed WriteRequests. Writers allocate in the calling
+    // bthread while the background writer frees in another worker, so a
+    // plain ObjectPool free always lands in the consumer's per-thread
+    // freelist and the objects bounce between freelists through the
+    // global pool. Parking a few requests here returns them to the
+    // threads writing this very socket. Each slot holds at most one
+    // request and is exchanged atomically, which is ABA-free. On its own
+    // cacheline since allocators and the background writer both touch
+    // it, keeping that traffic off the flush line below.
+    static const size_t WRITE_REQUEST_CACHE_SIZE = 4;
+    butil::atomic<WriteRequest*> BAIDU_CACHELINE_ALIGNMENT
+        _write_req_cache[WRITE_REQUEST_CACHE_SIZE];
+
+    // == The write path, on the last cacheline which extends to the end
+    // of the object so that flushing threads modify exactly one line. ==
+
+    // Storing data that are not flushed into `fd' yet.
+    butil::atomic<WriteRequest*> BAIDU_CACHELINE_ALIGNMENT _write_head;
+
     // Butex to wait for EPOLLOUT event
     butil::atomic<int>* _epollout_butex;
 
-    // Storing data that are not flushed into `fd' yet.
-    butil::atomic<WriteRequest*> _write_head;
+    // Queued but written
+    butil::atomic<int64_t> _unwritten_bytes;
 
-    butil::Mutex _stream_mutex;
-    std::set<StreamId> *_stream_set;
+    // Set with cpuwide_time_us() at last write operation
+    butil::atomic<int64_t> _last_writetime_us;
 
-    butil::atomic<int64_t> _ninflight_app_health_check;
+    // Pending WriteRequests with WriteOptions.urgent set. The background
+    // writer scans the queue for promotable requests only when positive.
+    butil::atomic<int32_t> _nurgent_unwritten;
+    // Urgent requests moved before ordinary ones since the last completion
+    // of an ordinary request. [Only accessed by the background writer]
+    int32_t _nurgent_promoted;
+
+    // True if the socket is too full to write.
+    volatile bool _overcrowded;
+
+    // Per-socket override of -socket_max_unwritten_bytes, 0 means using
+    // the flag. From SocketOptions.max_unwritten_bytes.
+    int64_t _max_unwritten_bytes;
+
+    // Compile-time checks of the grouping above, see socket.cpp.
+    static void CheckCachelineLayout();
 };
 
 } // namespace brpc
@@ -61,6 +61,12 @@ inline SocketOptions::SocketOptions()
     , conn(NULL)
     , app_connect(NULL)
     , initial_parsing_context(NULL)
+    , app_ping_interval_s(-1)
+    , app_ping(NULL)
+    , io(NULL)
+    , max_unwritten_bytes(0)
+    , on_writable(NULL)
+    , on_writable_arg(NULL)
 {}
 
 inline int Socket::Dereference() {
@@ -167,6 +173,16 @@ inline int Socket::Address(SocketId id, SocketUniquePtr* ptr) {
     return -1;
 }
 
+inline Socket* Socket::AddressBorrowed(SocketId id) {
+    Socket* const m = address_resource(SlotOfSocketId(id));
+    if (__builtin_expect(m != NULL, 1) &&
+        VersionOfVRef(m->_versioned_ref.load(butil::memory_order_acquire))
+        == VersionOfSocketId(id)) {
+        return m;
+    }
+    return NULL;
+}
+
 inline void Socket::ReAddress(SocketUniquePtr* ptr) {
     _versioned_ref.fetch_add(1, butil::memory_order_acquire);
     ptr->reset(this);
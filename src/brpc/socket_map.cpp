@@ -133,6 +133,7 @@ SocketMapOptions::SocketMapOptions()
 SocketMap::SocketMap()
     : _exposed_in_bvar(false)
     , _this_map_bvar(NULL)
+    , _map_size_bvar(GetMapSize, this)
     , _has_close_idle_thread(false) {
 }
 
@@ -142,10 +143,14 @@ SocketMap::~SocketMap() {
         bthread_stop(_close_idle_thread);
         bthread_join(_close_idle_thread, NULL);
     }
-    if (!_map.empty()) {
-        std::ostringstream err;
-        int nleft = 0;
-        for (Map::iterator it = _map.begin(); it != _map.end(); ++it) {
+    std::ostringstream err;
+    int nleft = 0;
+    for (size_t i = 0; i < NUM_SHARDS; ++i) {
+        Map& m = _shards[i].map;
+        if (!m.initialized()) {
+            continue;
+        }
+        for (Map::iterator it = m.begin(); it != m.end(); ++it) {
             SingleConnection* sc = &it->second;
             if ((!sc->socket->Failed() ||
                  sc->socket->health_check_interval() > 0/*HC enabled*/) &&
@@ -157,9 +162,9 @@ SocketMap::~SocketMap() {
                 err << ' ' << *sc->socket;
             }
         }
-        if (nleft) {
-            LOG(ERROR) << err.str();
-        }
+    }
+    if (nleft) {
+        LOG(ERROR) << err.str();
     }
 
     delete _this_map_bvar;
@@ -169,6 +174,43 @@ SocketMap::~SocketMap() {
     _options.socket_creator = NULL;
 }
 
+bool SocketMap::InitReadMap(ReadMap& bg, size_t suggested_map_size) {
+    if (!bg.initialized() && bg.init(suggested_map_size, 70) != 0) {
+        LOG(ERROR) << "Fail to init read view";
+        return false;
+    }
+    return true;
+}
+
+bool SocketMap::AddKeyToReadMap(ReadMap& bg, const SocketMapKey& key,
+                                const SocketId& id) {
+    if (!bg.initialized() && bg.init(1024, 70) != 0) {
+        LOG(ERROR) << "Fail to init read view";
+        return false;
+    }
+    bg[key] = id;
+    return true;
+}
+
+bool SocketMap::RemoveKeyFromReadMap(ReadMap& bg, const SocketMapKey& key) {
+    if (!bg.initialized()) {
+        return false;
+    }
+    return bg.erase(key) != 0;
+}
+
+void SocketMap::UpdateReadViewOnInsert(const SocketMapKey& key, SocketId id) {
+    const int64_t start_us = butil::cpuwide_time_us();
+    _read_view.Modify(AddKeyToReadMap, key, id);
+    _rebuild_latency << butil::cpuwide_time_us() - start_us;
+}
+
+void SocketMap::UpdateReadViewOnRemove(const SocketMapKey& key) {
+    const int64_t start_us = butil::cpuwide_time_us();
+    _read_view.Modify(RemoveKeyFromReadMap, key);
+    _rebuild_latency << butil::cpuwide_time_us() - start_us;
+}
+
 int SocketMap::Init(const SocketMapOptions& options) {
     if (_options.socket_creator != NULL) {
         LOG(ERROR) << "Already initialized";
@@ -179,8 +221,17 @@ int SocketMap::Init(const SocketMapOptions& options) {
         LOG(ERROR) << "SocketOptions.socket_creator must be set";
         return -1;
     }
-    if (_map.init(_options.suggested_map_size, 70) != 0) {
-        LOG(ERROR) << "Fail to init _map";
+    for (size_t i = 0; i < NUM_SHARDS; ++i) {
+        if (_shards[i].map.init(
+                _options.suggested_map_size / NUM_SHARDS + 1, 70) != 0) {
+            LOG(ERROR) << "Fail to init shard " << i;
+            return -1;
+        }
+    }
+    // Initialize both internal copies so that Find() never sees an
+    // uninitialized FlatMap.
+    if (!_read_view.Modify(InitReadMap, _options.suggested_map_size)) {
+        LOG(ERROR) << "Fail to init _read_view";
         return -1;
     }
     if (_options.idle_timeout_second_dynamic != NULL ||
@@ -197,22 +248,46 @@ int SocketMap::Init(const SocketMapOptions& options) {
 
 void SocketMap::Print(std::ostream& os) {
     // TODO: Elaborate.
-    size_t count = 0;
-    {
-        std::unique_lock<butil::Mutex> mu(_mutex);
-        count = _map.size();
-    }
-    os << "count=" << count;
+    os << "count=" << GetMapSize(this);
 }
 
 void SocketMap::PrintSocketMap(std::ostream& os, void* arg) {
     static_cast<SocketMap*>(arg)->Print(os);
 }
 
+size_t SocketMap::GetMapSize(void* arg) {
+    SocketMap* m = static_cast<SocketMap*>(arg);
+    size_t count = 0;
+    for (size_t i = 0; i < NUM_SHARDS; ++i) {
+        Shard& shard = m->_shards[i];
+        BAIDU_SCOPED_LOCK(shard.mutex);
+        if (shard.map.initialized()) {
+            count += shard.map.size();
+        }
+    }
+    return count;
+}
+
+void SocketMap::ShowBvarIfNeeded() {
+    if (FLAGS_show_socketmap_in_vars &&
+        !_exposed_in_bvar.exchange(true, butil::memory_order_relaxed)) {
+        char namebuf[64];
+        int len = snprintf(namebuf, sizeof(namebuf), "rpc_socketmap_%p", this);
+        _this_map_bvar = new bvar::PassiveStatus<std::string>(
+            butil::StringPiece(namebuf, len), PrintSocketMap, this);
+        len = snprintf(namebuf, sizeof(namebuf), "rpc_socketmap_%p_size", this);
+        _map_size_bvar.expose(butil::StringPiece(namebuf, len));
+        len = snprintf(namebuf, sizeof(namebuf), "rpc_socketmap_%p_rebuild",
+                       this);
+        _rebuild_latency.expose(butil::StringPiece(namebuf, len));
+    }
+}
+
 int SocketMap::Insert(const SocketMapKey& key, SocketId* id,
                       const std::shared_ptr<SocketSSLContext>& ssl_ctx) {
-    std::unique_lock<butil::Mutex> mu(_mutex);
-    SingleConnection* sc = _map.seek(key);
+    Shard& shard = shard_of(key);
+    std::unique_lock<butil::Mutex> mu(shard.mutex);
+    SingleConnection* sc = shard.map.seek(key);
     if (sc) {
         if (!sc->socket->Failed() ||
             sc->socket->health_check_interval() > 0/*HC enabled*/) {
@@ -222,10 +297,11 @@ int SocketMap::Insert(const SocketMapKey& key, SocketId* id,
         }
         // A socket w/o HC is failed (permanently), replace it.
         SocketUniquePtr ptr(sc->socket);  // Remove the ref added at insertion.
-        _map.erase(key); // in principle, we can override the entry in map w/o
-        // removing and inserting it again. But this would make error branches
-        // below have to remove the entry before returning, which is
+        shard.map.erase(key); // in principle, we can override the entry in map
+        // w/o removing and inserting it again. But this would make error
+        // branches below have to remove the entry before returning, which is
         // error-prone. We prefer code maintainability here.
+        UpdateReadViewOnRemove(key);
         sc = NULL;
     }
     SocketId tmp_id;
@@ -245,20 +321,13 @@ int SocketMap::Insert(const SocketMapKey& key, SocketId* id,
         return -1;
     }
     SingleConnection new_sc = { 1, ptr.release(), 0 };
-    _map[key] = new_sc;
+    shard.map[key] = new_sc;
     *id = tmp_id;
-    bool need_to_create_bvar = false;
-    if (FLAGS_show_socketmap_in_vars && !_exposed_in_bvar) {
-        _exposed_in_bvar = true;
-        need_to_create_bvar = true;
-    }
+    // Publish the new entry to readers. Done under the shard mutex so that
+    // updates to the read view of a same key never get out-of-order.
+    UpdateReadViewOnInsert(key, tmp_id);
     mu.unlock();
-    if (need_to_create_bvar) {
-        char namebuf[32];
-        int len = snprintf(namebuf, sizeof(namebuf), "rpc_socketmap_%p", this);
-        _this_map_bvar = new bvar::PassiveStatus<std::string>(
-            butil::StringPiece(namebuf, len), PrintSocketMap, this);
-    }
+    ShowBvarIfNeeded();
     return 0;
 }
 
@@ -269,8 +338,9 @@ void SocketMap::Remove(const SocketMapKey& key, SocketId expected_id) {
 void SocketMap::RemoveInternal(const SocketMapKey& key,
                                SocketId expected_id,
                                bool remove_orphan) {
-    std::unique_lock<butil::Mutex> mu(_mutex);
-    SingleConnection* sc = _map.seek(key);
+    Shard& shard = shard_of(key);
+    std::unique_lock<butil::Mutex> mu(shard.mutex);
+    SingleConnection* sc = shard.map.seek(key);
     if (!sc) {
         return;
     }
@@ -284,23 +354,14 @@ void SocketMap::RemoveInternal(const SocketMapKey& key,
             *_options.defer_close_second_dynamic
             : _options.defer_close_second;
         if (!remove_orphan && defer_close_second > 0) {
-            // Start count down on this Socket 
+            // Start count down on this Socket
             sc->no_ref_us = butil::cpuwide_time_us();
         } else {
             Socket* const s = sc->socket;
-            _map.erase(key);
-            bool need_to_create_bvar = false;
-            if (FLAGS_show_socketmap_in_vars && !_exposed_in_bvar) {
-                _exposed_in_bvar = true;
-                need_to_create_bvar = true;
-            }
+            shard.map.erase(key);
+            UpdateReadViewOnRemove(key);
             mu.unlock();
-            if (need_to_create_bvar) {
-                char namebuf[32];
-                int len = snprintf(namebuf, sizeof(namebuf), "rpc_socketmap_%p", this);
-                _this_map_bvar = new bvar::PassiveStatus<std::string>(
-                    butil::StringPiece(namebuf, len), PrintSocketMap, this);
-            }
+            ShowBvarIfNeeded();
             s->ReleaseAdditionalReference(); // release extra ref
             SocketUniquePtr ptr(s);  // Dereference
         }
@@ -308,8 +369,21 @@ void SocketMap::RemoveInternal(const SocketMapKey& key,
 }
 
 int SocketMap::Find(const SocketMapKey& key, SocketId* id) {
-    BAIDU_SCOPED_LOCK(_mutex);
-    SingleConnection* sc = _map.seek(key);
+    butil::DoublyBufferedData<ReadMap>::ScopedPtr ptr;
+    if (_read_view.Read(&ptr) == 0) {
+        if (ptr->initialized()) {
+            const SocketId* sid = ptr->seek(key);
+            if (sid) {
+                *id = *sid;
+                return 0;
+            }
+        }
+        return -1;
+    }
+    // Extremely rare fallback: read the authoritative shard.
+    Shard& shard = shard_of(key);
+    BAIDU_SCOPED_LOCK(shard.mutex);
+    SingleConnection* sc = shard.map.seek(key);
     if (sc) {
         *id = sc->socket->id();
         return 0;
@@ -319,28 +393,40 @@ int SocketMap::Find(const SocketMapKey& key, SocketId* id) {
 
 void SocketMap::List(std::vector<SocketId>* ids) {
     ids->clear();
-    BAIDU_SCOPED_LOCK(_mutex);
-    for (Map::iterator it = _map.begin(); it != _map.end(); ++it) {
-        ids->push_back(it->second.socket->id());
+    for (size_t i = 0; i < NUM_SHARDS; ++i) {
+        Shard& shard = _shards[i];
+        BAIDU_SCOPED_LOCK(shard.mutex);
+        for (Map::iterator it = shard.map.begin();
+             it != shard.map.end(); ++it) {
+            ids->push_back(it->second.socket->id());
+        }
     }
 }
 
 void SocketMap::List(std::vector<butil::EndPoint>* pts) {
     pts->clear();
-    BAIDU_SCOPED_LOCK(_mutex);
-    for (Map::iterator it = _map.begin(); it != _map.end(); ++it) {
-        pts->push_back(it->second.socket->remote_side());
+    for (size_t i = 0; i < NUM_SHARDS; ++i) {
+        Shard& shard = _shards[i];
+        BAIDU_SCOPED_LOCK(shard.mutex);
+        for (Map::iterator it = shard.map.begin();
+             it != shard.map.end(); ++it) {
+            pts->push_back(it->second.socket->remote_side());
+        }
     }
 }
 
 void SocketMap::ListOrphans(int64_t defer_us, std::vector<SocketMapKey>* out) {
     out->clear();
     const int64_t now = butil::cpuwide_time_us();
-    BAIDU_SCOPED_LOCK(_mutex);
-    for (Map::iterator it = _map.begin(); it != _map.end(); ++it) {
-        SingleConnection& sc = it->second;
-        if (sc.ref_count == 0 && now - sc.no_ref_us >= defer_us) {
-            out->push_back(it->first);
+    for (size_t i = 0; i < NUM_SHARDS; ++i) {
+        Shard& shard = _shards[i];
+        BAIDU_SCOPED_LOCK(shard.mutex);
+        for (Map::iterator it = shard.map.begin();
+             it != shard.map.end(); ++it) {
+            SingleConnection& sc = it->second;
+            if (sc.ref_count == 0 && now - sc.no_ref_us >= defer_us) {
+                out->push_back(it->first);
+            }
         }
     }
 }
@@ -21,7 +21,10 @@
 
 #include <vector>                             // std::vector
 #include "bvar/bvar.h"                        // bvar::PassiveStatus
+#include "bvar/latency_recorder.h"            // bvar::LatencyRecorder
+#include "butil/atomicops.h"                  // butil::atomic
 #include "butil/containers/flat_map.h"        // FlatMap
+#include "butil/containers/doubly_buffered_data.h" // DoublyBufferedData
 #include "brpc/socket_id.h"                   // SockdetId
 #include "brpc/options.pb.h"                  // ProtocolType
 #include "brpc/input_messenger.h"             // InputMessageHandler
@@ -157,6 +160,35 @@ public:
     const SocketMapOptions& options() const { return _options; }
 
 private:
+    struct SingleConnection {
+        int ref_count;
+        Socket* socket;
+        int64_t no_ref_us;
+    };
+    typedef butil::FlatMap<SocketMapKey, SingleConnection,
+                           SocketMapKeyHasher> Map;
+    // A read-only mapping from keys to SocketIds rebuilt from the shards
+    // on every insertion/removal. Find() reads it without grabbing any
+    // shard mutex.
+    typedef butil::FlatMap<SocketMapKey, SocketId,
+                           SocketMapKeyHasher> ReadMap;
+    // Authoritative entries are sharded by hash of the key so that
+    // concurrent Channel::Init/Remove on different keys rarely contend.
+    struct Shard {
+        butil::Mutex mutex;
+        Map map;
+    };
+    static const size_t NUM_SHARDS = 16;
+
+    Shard& shard_of(const SocketMapKey& key) {
+        return _shards[SocketMapKeyHasher()(key) % NUM_SHARDS];
+    }
+    void UpdateReadViewOnInsert(const SocketMapKey& key, SocketId id);
+    void UpdateReadViewOnRemove(const SocketMapKey& key);
+    static bool InitReadMap(ReadMap& bg, size_t suggested_map_size);
+    static bool AddKeyToReadMap(ReadMap& bg, const SocketMapKey& key,
+                                const SocketId& id);
+    static bool RemoveKeyFromReadMap(ReadMap& bg, const SocketMapKey& key);
     void RemoveInternal(const SocketMapKey& key, SocketId id,
                         bool remove_orphan);
     void ListOrphans(int64_t defer_us, std::vector<SocketMapKey>* out);
@@ -164,23 +196,17 @@ private:
     static void* RunWatchConnections(void*);
     void Print(std::ostream& os);
     static void PrintSocketMap(std::ostream& os, void* arg);
+    static size_t GetMapSize(void* arg);
+    void ShowBvarIfNeeded();
 
 private:
-    struct SingleConnection {
-        int ref_count;
-        Socket* socket;
-        int64_t no_ref_us;
-    };
-
-    // TODO: When RpcChannels connecting to one EndPoint are frequently created
-    //       and destroyed, a single map+mutex may become hot-spots.
-    typedef butil::FlatMap<SocketMapKey, SingleConnection,
-                           SocketMapKeyHasher> Map;
     SocketMapOptions _options;
-    butil::Mutex _mutex;
-    Map _map;
-    bool _exposed_in_bvar;
+    Shard _shards[NUM_SHARDS];
+    butil::DoublyBufferedData<ReadMap> _read_view;
+    butil::atomic<bool> _exposed_in_bvar;
     bvar::PassiveStatus<std::string>* _this_map_bvar;
+    bvar::PassiveStatus<size_t> _map_size_bvar;
+    bvar::LatencyRecorder _rebuild_latency;
     bool _has_close_idle_thread;
     bthread_t _close_idle_thread;
 };
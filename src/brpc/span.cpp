@@ -20,7 +20,9 @@
 #include <gflags/gflags.h>
 #include <leveldb/db.h>
 #include <leveldb/comparator.h>
+#include <leveldb/write_batch.h>
 #include "bthread/bthread.h"
+#include "bthread/unstable.h"            // bthread_timer_add
 #include "butil/scoped_lock.h"
 #include "butil/thread_local.h"
 #include "butil/string_printf.h"
@@ -31,6 +33,7 @@
 #include "butil/file_util.h"
 #include "brpc/shared_object.h"
 #include "brpc/reloadable_flags.h"
+#include "brpc/details/span_segments.h"
 #include "brpc/span.h"
 
 #define BRPC_SPAN_INFO_SEP "\1"
@@ -59,6 +62,18 @@ BRPC_VALIDATE_GFLAG(rpcz_keep_span_seconds, PositiveInteger);
 
 DEFINE_bool(rpcz_keep_span_db, false, "Don't remove DB of rpcz at program's exit");
 
+DEFINE_bool(rpcz_segment_storage, false,
+            "Store spans in time-partitioned mmap'd segments instead of "
+            "leveldb, bounding memory and making retention O(1) per dropped "
+            "segment. See src/brpc/details/span_segments.h");
+
+DEFINE_int32(rpcz_max_batched_spans, 32,
+             "Flush spans to leveldb when so many of them are batched");
+BRPC_VALIDATE_GFLAG(rpcz_max_batched_spans, PositiveInteger);
+
+// Upper bound of the time a batched span stays invisible to queries.
+const int64_t SPAN_BATCH_FLUSH_INTERVAL_US = 100000L/*100ms*/;
+
 struct IdGen {
     bool init;
     uint16_t seq;
@@ -116,6 +131,7 @@ Span* Span::CreateClientSpan(const std::string& full_method_name,
     span->_response_size = 0;
     span->_base_real_us = base_real_us;
     span->_received_real_us = 0;
+    span->_kernel_received_real_us = 0;
     span->_start_parse_real_us = 0;
     span->_start_callback_real_us = 0;
     span->_start_send_real_us = 0;
@@ -168,6 +184,7 @@ Span* Span::CreateServerSpan(
     span->_response_size = 0;
     span->_base_real_us = base_real_us;
     span->_received_real_us = 0;
+    span->_kernel_received_real_us = 0;
     span->_start_parse_real_us = 0;
     span->_start_callback_real_us = 0;
     span->_start_send_real_us = 0;
@@ -312,7 +329,12 @@ public:
 
     SpanDB() : id_db(NULL), time_db(NULL) { }
     static SpanDB* Open();
-    leveldb::Status Index(const Span* span, std::string* value_buf);
+    leveldb::Status AppendIndex(const Span* span,
+                                leveldb::WriteBatch* time_batch,
+                                leveldb::WriteBatch* id_batch,
+                                std::string* value_buf);
+    leveldb::Status WriteBatches(leveldb::WriteBatch* time_batch,
+                                 leveldb::WriteBatch* id_batch);
     leveldb::Status RemoveSpansBefore(int64_t tm);
 
 private:
@@ -349,6 +371,24 @@ static bool g_span_ending = false;  // don't open span again if this var is true
 // Can't use intrusive_ptr which has ctor/dtor issues.
 static SpanDB* g_span_db = NULL;
 bool has_span_db() { return !!g_span_db; }
+
+// Spans handed over by the collector are appended to these write batches
+// and written into leveldb together, turning 2 Put() per span into 2
+// Write() per batch. A batch is flushed when it holds
+// FLAGS_rpcz_max_batched_spans spans or SPAN_BATCH_FLUSH_INTERVAL_US
+// after its first span was appended, whichever comes first, so spans
+// stay invisible to queries for a bounded time only.
+struct SpanBatch {
+    butil::intrusive_ptr<SpanDB> db;
+    leveldb::WriteBatch time_batch;
+    leveldb::WriteBatch id_batch;
+    int nbatched;
+    bool flush_scheduled;
+
+    SpanBatch() : nbatched(0), flush_scheduled(false) {}
+};
+static pthread_mutex_t g_span_batch_mutex = PTHREAD_MUTEX_INITIALIZER;
+static SpanBatch* g_span_batch = NULL;
 bvar::CollectorSpeedLimit g_span_sl = BVAR_COLLECTOR_SPEED_LIMIT_INITIALIZER;
 static bvar::DisplaySamplingRatio s_display_sampling_ratio(
     "rpcz_sampling_ratio", &g_span_sl);
@@ -391,14 +431,54 @@ static void ResetSpanDB(SpanDB* db) {
     }
 }
 
+// Caller must hold g_span_batch_mutex.
+static void FlushSpanBatch() {
+    SpanBatch* b = g_span_batch;
+    if (b == NULL || b->nbatched == 0) {
+        return;
+    }
+    leveldb::Status st = b->db->WriteBatches(&b->time_batch, &b->id_batch);
+    b->time_batch.Clear();
+    b->id_batch.Clear();
+    b->nbatched = 0;
+    if (!st.ok()) {
+        LOG(WARNING) << st.ToString();
+        if (st.IsNotFound() || st.IsIOError() || st.IsCorruption()) {
+            b->db.reset();
+            ResetSpanDB(NULL);
+            return;
+        }
+    }
+}
+
+static void FlushSpanBatchAfterDelay(void*) {
+    BAIDU_SCOPED_LOCK(g_span_batch_mutex);
+    if (g_span_batch != NULL) {
+        g_span_batch->flush_scheduled = false;
+    }
+    FlushSpanBatch();
+}
+
 static void RemoveSpanDB() {
     g_span_ending = true;
+    if (FLAGS_rpcz_segment_storage) {
+        SpanSegmentStore::DestroyGlobal();
+        return;
+    }
+    {
+        BAIDU_SCOPED_LOCK(g_span_batch_mutex);
+        FlushSpanBatch();
+        if (g_span_batch != NULL) {
+            g_span_batch->db.reset();
+        }
+    }
     ResetSpanDB(NULL);
 }
 
 static void StartSpanIndexing() {
     atexit(RemoveSpanDB);
     g_span_prep = new SpanPreprocessor;
+    g_span_batch = new SpanBatch;
     started_span_indexing = true;
 }
 
@@ -439,6 +519,7 @@ static void Span2Proto(const Span* span, RpczSpan* out) {
     out->set_request_size(span->request_size());
     out->set_response_size(span->response_size());
     out->set_received_real_us(span->received_real_us());
+    out->set_kernel_received_real_us(span->kernel_received_real_us());
     out->set_start_parse_real_us(span->start_parse_real_us());
     out->set_start_callback_real_us(span->start_callback_real_us());
     out->set_start_send_real_us(span->start_send_real_us());
@@ -509,16 +590,10 @@ SpanDB* SpanDB::Open() {
     return db;
 }
 
-leveldb::Status SpanDB::Index(const Span* span, std::string* value_buf) {
-    leveldb::WriteOptions options;
-    options.sync = false;
-
-    leveldb::Status st;
-    
-    // NOTE: Writing into time_db before id_db so that if the second write
-    // fails, the entry in time_db will be finally removed when it's out
-    // of time window.
-
+leveldb::Status SpanDB::AppendIndex(const Span* span,
+                                    leveldb::WriteBatch* time_batch,
+                                    leveldb::WriteBatch* id_batch,
+                                    std::string* value_buf) {
     const int64_t start_time = span->GetStartRealTimeUs();
     BriefSpan brief;
     brief.set_trace_id(span->trace_id());
@@ -558,13 +633,9 @@ leveldb::Status SpanDB::Index(const Span* span, std::string* value_buf) {
     g_last_time_key = time_key;
     uint32_t time_data[2];
     ToBigEndian(time_key, time_data);
-    st = time_db->Put(options,
-                      leveldb::Slice((char*)time_data, sizeof(time_data)),
-                      leveldb::Slice(value_buf->data(), value_buf->size()));
-    if (!st.ok()) {
-        return st;
-    }
-    
+    time_batch->Put(leveldb::Slice((char*)time_data, sizeof(time_data)),
+                    leveldb::Slice(value_buf->data(), value_buf->size()));
+
     uint32_t key_data[4];
     ToBigEndian(span->trace_id(), key_data);
     ToBigEndian(span->span_id(), key_data + 2);
@@ -584,9 +655,22 @@ leveldb::Status SpanDB::Index(const Span* span, std::string* value_buf) {
         return leveldb::Status::InvalidArgument(
             leveldb::Slice("Fail to serialize RpczSpan"));
     }
-    leveldb::Slice value(value_buf->data(), value_buf->size());
-    st = id_db->Put(options, key, value);
-    return st;
+    id_batch->Put(key, leveldb::Slice(value_buf->data(), value_buf->size()));
+    return leveldb::Status::OK();
+}
+
+leveldb::Status SpanDB::WriteBatches(leveldb::WriteBatch* time_batch,
+                                     leveldb::WriteBatch* id_batch) {
+    leveldb::WriteOptions options;
+    options.sync = false;
+    // NOTE: Writing into time_db before id_db so that if the second write
+    // fails, the entries in time_db will be finally removed when they're
+    // out of time window.
+    leveldb::Status st = time_db->Write(options, time_batch);
+    if (!st.ok()) {
+        return st;
+    }
+    return id_db->Write(options, id_batch);
 }
 
 // NOTE: may take more than 100ms
@@ -632,10 +716,59 @@ leveldb::Status SpanDB::RemoveSpansBefore(int64_t tm) {
     return rc;
 }
 
-// Write span into leveldb.
+// Batch span into the pending write to leveldb.
 void Span::dump_and_destroy(size_t /*round*/) {
     StartIndexingIfNeeded();
-    
+
+    if (FLAGS_rpcz_segment_storage) {
+        SpanSegmentStore* store = SpanSegmentStore::GetGlobal();
+        if (store == NULL) {
+            destroy();
+            return;
+        }
+        const int64_t start_time = GetStartRealTimeUs();
+        // Keep time keys monotonic, for the same reason documented in
+        // AppendIndex above.
+        int64_t time_key = start_time;
+        if (time_key <= g_last_time_key) {
+            time_key = g_last_time_key + 1;
+        }
+        g_last_time_key = time_key;
+        BriefSpan brief;
+        brief.set_trace_id(trace_id());
+        brief.set_span_id(span_id());
+        brief.set_log_id(log_id());
+        brief.set_type(type());
+        brief.set_error_code(error_code());
+        brief.set_request_size(request_size());
+        brief.set_response_size(response_size());
+        brief.set_start_real_us(start_time);
+        brief.set_latency_us(GetEndRealTimeUs() - start_time);
+        brief.set_full_method_name(full_method_name());
+        RpczSpan value_proto;
+        Span2Proto(this, &value_proto);
+        // client spans should be reversed.
+        const size_t client_span_count = CountClientSpans();
+        for (size_t i = 0; i < client_span_count; ++i) {
+            value_proto.add_client_spans();
+        }
+        size_t i = 0;
+        for (const Span* p = _next_client; p; p = p->_next_client, ++i) {
+            Span2Proto(p, value_proto.mutable_client_spans(
+                           client_span_count - i - 1));
+        }
+        store->Append(trace_id(), span_id(), time_key, brief, value_proto);
+        destroy();
+
+        const int64_t now = butil::gettimeofday_us();
+        if (now > g_last_delete_tm + SPAN_DELETE_INTERVAL_US) {
+            g_last_delete_tm = now;
+            store->RemoveSegmentsBefore(
+                now - FLAGS_rpcz_keep_span_seconds * 1000000L);
+        }
+        return;
+    }
+
     std::string value_buf;
 
     butil::intrusive_ptr<SpanDB> db;
@@ -654,15 +787,34 @@ void Span::dump_and_destroy(size_t /*round*/) {
         db.reset(db2);
     }
 
-    leveldb::Status st = db->Index(this, &value_buf);
-    destroy();
-    if (!st.ok()) {
-        LOG(WARNING) << st.ToString();
-        if (st.IsNotFound() || st.IsIOError() || st.IsCorruption()) {
-            ResetSpanDB(NULL);
-            return;
+    {
+        BAIDU_SCOPED_LOCK(g_span_batch_mutex);
+        SpanBatch* b = g_span_batch;
+        if (b->db != db) {
+            // DB was replaced, flush pending spans to the old one.
+            FlushSpanBatch();
+            b->db = db;
+        }
+        leveldb::Status st = b->db->AppendIndex(
+            this, &b->time_batch, &b->id_batch, &value_buf);
+        if (!st.ok()) {
+            LOG(WARNING) << st.ToString();
+        } else if (++b->nbatched >= FLAGS_rpcz_max_batched_spans) {
+            FlushSpanBatch();
+        } else if (!b->flush_scheduled) {
+            bthread_timer_t timer;
+            if (bthread_timer_add(
+                    &timer,
+                    butil::microseconds_from_now(SPAN_BATCH_FLUSH_INTERVAL_US),
+                    FlushSpanBatchAfterDelay, NULL) == 0) {
+                b->flush_scheduled = true;
+            } else {
+                // Can't bound the delay, write through.
+                FlushSpanBatch();
+            }
         }
     }
+    destroy();
 
     // Remove old spans
     const int64_t now = butil::gettimeofday_us();
@@ -680,7 +832,21 @@ void Span::dump_and_destroy(size_t /*round*/) {
     }
 }
 
+// Make pending spans visible to the queries below.
+static void FlushSpanBatchForQuery() {
+    BAIDU_SCOPED_LOCK(g_span_batch_mutex);
+    FlushSpanBatch();
+}
+
 int FindSpan(uint64_t trace_id, uint64_t span_id, RpczSpan* response) {
+    if (FLAGS_rpcz_segment_storage) {
+        SpanSegmentStore* store = SpanSegmentStore::GetGlobalIfExists();
+        if (store == NULL) {
+            return -1;
+        }
+        return store->FindSpan(trace_id, span_id, response);
+    }
+    FlushSpanBatchForQuery();
     butil::intrusive_ptr<SpanDB> db;
     if (GetSpanDB(&db) != 0) {
         return -1;
@@ -703,6 +869,14 @@ int FindSpan(uint64_t trace_id, uint64_t span_id, RpczSpan* response) {
 
 void FindSpans(uint64_t trace_id, std::deque<RpczSpan>* out) {
     out->clear();
+    if (FLAGS_rpcz_segment_storage) {
+        SpanSegmentStore* store = SpanSegmentStore::GetGlobalIfExists();
+        if (store != NULL) {
+            store->FindSpans(trace_id, out);
+        }
+        return;
+    }
+    FlushSpanBatchForQuery();
     butil::intrusive_ptr<SpanDB> db;
     if (GetSpanDB(&db) != 0) {
         return;
@@ -735,6 +909,14 @@ void FindSpans(uint64_t trace_id, std::deque<RpczSpan>* out) {
 void ListSpans(int64_t starting_realtime, size_t max_scan,
                std::deque<BriefSpan>* out, SpanFilter* filter) {
     out->clear();
+    if (FLAGS_rpcz_segment_storage) {
+        SpanSegmentStore* store = SpanSegmentStore::GetGlobalIfExists();
+        if (store != NULL) {
+            store->ListSpans(starting_realtime, max_scan, out, filter);
+        }
+        return;
+    }
+    FlushSpanBatchForQuery();
     butil::intrusive_ptr<SpanDB> db;
     if (GetSpanDB(&db) != 0) {
         return;
@@ -772,6 +954,13 @@ void ListSpans(int64_t starting_realtime, size_t max_scan,
 }
 
 void DescribeSpanDB(std::ostream& os) {
+    if (FLAGS_rpcz_segment_storage) {
+        SpanSegmentStore* store = SpanSegmentStore::GetGlobalIfExists();
+        if (store != NULL) {
+            store->Describe(os);
+        }
+        return;
+    }
     butil::intrusive_ptr<SpanDB> db;
     if (GetSpanDB(&db) != 0) {
         return;
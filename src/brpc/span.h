@@ -102,6 +102,10 @@ public:
     void set_base_real_us(int64_t tm) { _base_real_us = tm; }
     void set_received_us(int64_t tm)
     { _received_real_us = tm + _base_real_us; }
+    // The parameter is an absolute realtime(from the kernel) rather than
+    // a cpuwide time, thus not biased by _base_real_us.
+    void set_kernel_received_real_us(int64_t tm)
+    { _kernel_received_real_us = tm; }
     void set_start_parse_us(int64_t tm)
     { _start_parse_real_us = tm + _base_real_us; }
     void set_start_callback_us(int64_t tm)
@@ -129,6 +133,7 @@ public:
     int request_size() const { return _request_size; }
     int response_size() const { return _response_size; }
     int64_t received_real_us() const { return _received_real_us; }
+    int64_t kernel_received_real_us() const { return _kernel_received_real_us; }
     int64_t start_parse_real_us() const { return _start_parse_real_us; }
     int64_t start_callback_real_us() const { return _start_callback_real_us; }
     int64_t start_send_real_us() const { return _start_send_real_us; }
@@ -166,6 +171,7 @@ private:
     int  _response_size;
     int64_t _base_real_us;
     int64_t _received_real_us;
+    int64_t _kernel_received_real_us;
     int64_t _start_parse_real_us;
     int64_t _start_callback_real_us;
     int64_t _start_send_real_us;
@@ -33,6 +33,9 @@ ServerSSLOptions::ServerSSLOptions()
     , release_buffer(false)
     , session_lifetime_s(300)
     , session_cache_size(20480)
+    , shared_session_cache(false)
+    , enable_early_data(false)
+    , enable_ktls(false)
     , ecdhe_curve_name("prime256v1")
 {}
 
@@ -134,6 +134,29 @@ struct ServerSSLOptions {
     // Default: 20480
     int session_cache_size;
 
+    // Share one lock-sharded session cache among all certificates of this
+    // server instead of the per-SSL_CTX cache which is protected by a single
+    // lock, so that session resumptions scale with concurrent handshakes
+    // and sessions established through one certificate (SNI) are resumable
+    // through another. session_lifetime_s and session_cache_size above
+    // still bound the shared cache.
+    // Default: false
+    bool shared_session_cache;
+
+    // Accept TLS1.3 early data (0-RTT) so that resuming clients may send
+    // requests in the first flight without waiting for the handshake.
+    // CAUTION: 0-RTT data can be replayed by an attacker, only enable this
+    // for services whose requests are idempotent. Requires OpenSSL >= 1.1.1.
+    // Default: false
+    bool enable_early_data;
+
+    // Offload TLS record encryption to the kernel (kTLS) after handshake
+    // when the negotiated cipher is supported, freeing userspace from
+    // copying and encrypting records. Requires OpenSSL >= 3.0 and a kernel
+    // with the tls module.
+    // Default: false
+    bool enable_ktls;
+
     // Cipher suites allowed for each SSL handshake. The format of this string
     // should follow that in `man 1 ciphers'. If empty, OpenSSL will choose
     // a default cipher based on the certificate information
@@ -19,6 +19,13 @@
 #include "brpc/stream.h"
 
 #include <gflags/gflags.h>
+#if defined(OS_LINUX)
+#include <sys/ioctl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/sockios.h>
+#endif
+#include "bvar/bvar.h"
 #include "butil/time.h"
 #include "butil/object_pool.h"
 #include "butil/unique_ptr.h"
@@ -38,14 +45,27 @@ DECLARE_bool(usercode_in_pthread);
 
 const static butil::IOBuf *TIMEOUT_TASK = (butil::IOBuf*)-1L;
 
-Stream::Stream() 
+// Total time writers spent blocked by full flow-control windows.
+static bvar::Adder<int64_t> s_stream_writer_stall_us(
+    "rpc_stream_writer_stall_us");
+// Flow-control window sizes sampled at each auto-tuning step.
+static bvar::IntRecorder s_stream_flow_window("rpc_stream_flow_window");
+
+Stream::Stream()
     : _host_socket(NULL)
     , _fake_socket_weak_ref(NULL)
+    , _notsent_bytes_var(NULL)
     , _connected(false)
     , _closed(false)
     , _produced(0)
     , _remote_consumed(0)
+    , _cur_buf_size(0)
+    , _probe_produced(0)
+    , _probe_consumed(0)
+    , _probe_time_us(0)
+    , _full_since_us(0)
     , _local_consumed(0)
+    , _last_feedback_consumed(0)
     , _parse_rpc_response(false)
     , _pending_buf(NULL)
     , _start_idle_timer_us(0)
@@ -58,6 +78,7 @@ Stream::Stream()
 
 Stream::~Stream() {
     CHECK(_host_socket == NULL);
+    CHECK(_notsent_bytes_var == NULL);
     bthread_mutex_destroy(&_connect_mutex);
     bthread_mutex_destroy(&_congestion_control_mutex);
     bthread_id_list_destroy(&_writable_wait_list);
@@ -71,6 +92,7 @@ int Stream::Create(const StreamOptions &options,
     s->_fake_socket_weak_ref = NULL;
     s->_connected = false;
     s->_options = options;
+    s->_cur_buf_size = options.max_buf_size;
     s->_closed = false;
     if (remote_settings != NULL) {
         s->_remote_settings.MergeFrom(*remote_settings);
@@ -157,8 +179,10 @@ ssize_t Stream::CutMessageIntoFileDescriptor(int /*fd*/,
     return len;
 }
 
-void Stream::WriteToHostSocket(butil::IOBuf* b) {
-    BRPC_HANDLE_EOVERCROWDED(_host_socket->Write(b));
+void Stream::WriteToHostSocket(butil::IOBuf* b, bool urgent) {
+    Socket::WriteOptions wopt;
+    wopt.urgent = urgent;
+    BRPC_HANDLE_EOVERCROWDED(_host_socket->Write(b, &wopt));
 }
 
 ssize_t Stream::CutMessageIntoSSLChannel(SSL*, butil::IOBuf**, size_t) {
@@ -262,15 +286,19 @@ void Stream::TriggerOnConnectIfNeed() {
 int Stream::AppendIfNotFull(const butil::IOBuf &data) {
     if (_options.max_buf_size > 0) {
         std::unique_lock<bthread_mutex_t> lck(_congestion_control_mutex);
-        if (_produced >= _remote_consumed + (size_t)_options.max_buf_size) {
+        if (_produced >= _remote_consumed + (size_t)_cur_buf_size) {
+            if (_full_since_us == 0) {
+                _full_since_us = butil::gettimeofday_us();
+            }
             const size_t saved_produced = _produced;
             const size_t saved_remote_consumed = _remote_consumed;
+            const int64_t saved_buf_size = _cur_buf_size;
             lck.unlock();
-            RPC_VLOG << "Stream=" << _id << " is full" 
+            RPC_VLOG << "Stream=" << _id << " is full"
                      << "_produced=" << saved_produced
                      << " _remote_consumed=" << saved_remote_consumed
                      << " gap=" << saved_produced - saved_remote_consumed
-                     << " max_buf_size=" << _options.max_buf_size;
+                     << " buf_size=" << saved_buf_size;
             return 1;
         }
         _produced += data.length();
@@ -291,15 +319,23 @@ void Stream::SetRemoteConsumed(size_t new_remote_consumed) {
     CHECK(_options.max_buf_size > 0);
     bthread_id_list_t tmplist;
     bthread_id_list_init(&tmplist, 0, 0);
+    const int64_t now_us = butil::gettimeofday_us();
     bthread_mutex_lock(&_congestion_control_mutex);
     if (_remote_consumed >= new_remote_consumed) {
         bthread_mutex_unlock(&_congestion_control_mutex);
         return;
     }
-    const bool was_full = _produced >= _remote_consumed + (size_t)_options.max_buf_size;
+    const bool was_full = _produced >= _remote_consumed + (size_t)_cur_buf_size;
+    if (_options.max_auto_buf_size > _options.max_buf_size) {
+        TuneBufSize(new_remote_consumed, now_us);
+    }
     _remote_consumed = new_remote_consumed;
-    const bool is_full = _produced >= _remote_consumed + (size_t)_options.max_buf_size;
+    const bool is_full = _produced >= _remote_consumed + (size_t)_cur_buf_size;
     if (was_full && !is_full) {
+        if (_full_since_us > 0) {
+            s_stream_writer_stall_us << now_us - _full_since_us;
+            _full_since_us = 0;
+        }
         bthread_id_list_swap(&tmplist, &_writable_wait_list);
     }
     bthread_mutex_unlock(&_congestion_control_mutex);
@@ -309,6 +345,38 @@ void Stream::SetRemoteConsumed(size_t new_remote_consumed) {
     bthread_id_list_destroy(&tmplist);
 }
 
+// Called with _congestion_control_mutex held.
+void Stream::TuneBufSize(size_t new_remote_consumed, int64_t now_us) {
+    if (_probe_time_us == 0) {
+        // Start the first probe.
+        _probe_produced = _produced;
+        _probe_consumed = new_remote_consumed;
+        _probe_time_us = now_us;
+        return;
+    }
+    if (new_remote_consumed < _probe_produced) {
+        // The probe is still in flight.
+        return;
+    }
+    // Everything produced before the probe started was consumed remotely,
+    // which takes one round trip at least. The bytes delivered meanwhile
+    // equal delivery-rate * RTT, i.e. the bandwidth-delay product. Double
+    // it for headroom and grow the window monotonically up to the limit.
+    int64_t target = 2 * (int64_t)(new_remote_consumed - _probe_consumed);
+    if (target > _options.max_auto_buf_size) {
+        target = _options.max_auto_buf_size;
+    }
+    if (target > _cur_buf_size) {
+        RPC_VLOG << "Stream=" << _id << " grow flow-control window from "
+                 << _cur_buf_size << " to " << target;
+        _cur_buf_size = target;
+        s_stream_flow_window << _cur_buf_size;
+    }
+    _probe_produced = _produced;
+    _probe_consumed = new_remote_consumed;
+    _probe_time_us = now_us;
+}
+
 void* Stream::RunOnWritable(void* arg) {
     WritableMeta *wm = (WritableMeta*)arg;
     wm->on_writable(wm->id, wm->arg, wm->error_code);
@@ -492,6 +560,11 @@ int Stream::Consume(void *meta, bthread::TaskIterator<butil::IOBuf*>& iter) {
     s->StopIdleTimer();
     if (iter.is_queue_stopped()) {
         // indicating the queue was closed
+        if (s->_notsent_bytes_var) {
+            // The bvar callback reads the host socket, remove it first.
+            delete s->_notsent_bytes_var;
+            s->_notsent_bytes_var = NULL;
+        }
         if (s->_host_socket) {
             DereferenceSocket(s->_host_socket);
             s->_host_socket = NULL;
@@ -524,9 +597,21 @@ int Stream::Consume(void *meta, bthread::TaskIterator<butil::IOBuf*>& iter) {
         }
     }
     mb.flush();
-    if (s->_remote_settings.need_feedback() && mb.total_length() > 0) {
+    if (s->_remote_settings.need_feedback()) {
         s->_local_consumed += mb.total_length();
-        s->SendFeedback();
+        // Acknowledging half of the remote window at once instead of
+        // every batch saves most feedback frames on busy streams without
+        // ever wedging the writer, which only blocks after producing a
+        // whole window. Peers not advertising their window size (older
+        // version) still get per-batch feedback. The idle timer flushes
+        // a pending feedback on quiet streams.
+        const int64_t remote_window = s->_remote_settings.buf_size();
+        const int64_t unacked = s->_local_consumed - s->_last_feedback_consumed;
+        if (unacked > 0 &&
+            (remote_window <= 0 || unacked >= remote_window / 2 ||
+             has_timeout_task)) {
+            s->SendFeedback();
+        }
     }
     s->StartIdleTimer();
     return 0;
@@ -538,9 +623,12 @@ void Stream::SendFeedback() {
     fm.set_stream_id(_remote_settings.stream_id());
     fm.set_source_stream_id(id());
     fm.mutable_feedback()->set_consumed_size(_local_consumed);
+    _last_feedback_consumed = _local_consumed;
     butil::IOBuf out;
     policy::PackStreamMessage(&out, fm, NULL);
-    WriteToHostSocket(&out);
+    // The peer stops producing when feedbacks lag behind, don't queue
+    // them after pending DATA.
+    WriteToHostSocket(&out, true);
 }
 
 int Stream::SetHostSocket(Socket *host_socket) {
@@ -555,13 +643,78 @@ int Stream::SetHostSocket(Socket *host_socket) {
         return -1;
     }
     _host_socket = ptr.release();
+    ApplySocketPacing();
     return 0;
 }
 
+void Stream::ApplySocketPacing() {
+    const int fd = _host_socket->fd();
+    if (fd < 0) {  // e.g. rdma or a failed connection.
+        return;
+    }
+#if defined(OS_LINUX) && defined(TCP_NOTSENT_LOWAT)
+    if (_options.tcp_notsent_lowat > 0) {
+        const int lowat = _options.tcp_notsent_lowat;
+        if (setsockopt(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT,
+                       &lowat, sizeof(lowat)) != 0) {
+            PLOG(WARNING) << "Fail to set TCP_NOTSENT_LOWAT of fd=" << fd
+                          << " to " << lowat;
+        }
+    }
+#endif
+#if defined(OS_LINUX) && defined(SO_MAX_PACING_RATE)
+    if (_options.max_pacing_rate > 0) {
+        const uint32_t rate =
+            _options.max_pacing_rate > (int64_t)UINT32_MAX
+            ? UINT32_MAX : (uint32_t)_options.max_pacing_rate;
+        if (setsockopt(fd, SOL_SOCKET, SO_MAX_PACING_RATE,
+                       &rate, sizeof(rate)) != 0) {
+            PLOG(WARNING) << "Fail to set SO_MAX_PACING_RATE of fd=" << fd
+                          << " to " << rate;
+        }
+    }
+#endif
+    if (_options.tcp_notsent_lowat > 0 && _notsent_bytes_var == NULL) {
+        char name[64];
+        snprintf(name, sizeof(name), "stream_%llu_notsent_bytes",
+                 (unsigned long long)id());
+        _notsent_bytes_var = new bvar::PassiveStatus<ssize_t>(
+            name, GetNotSentBytes, this);
+    }
+}
+
+ssize_t Stream::GetNotSentBytes(void* arg) {
+    Stream* s = (Stream*)arg;
+    Socket* const sock = s->_host_socket;
+    if (sock == NULL) {
+        return 0;
+    }
+    const int fd = sock->fd();
+    if (fd < 0) {
+        return 0;
+    }
+    int value = 0;
+#if defined(OS_LINUX) && defined(SIOCOUTQNSD)
+    // Bytes in the send queue not yet sent to the wire.
+    if (ioctl(fd, SIOCOUTQNSD, &value) != 0) {
+        return -1;
+    }
+#elif defined(TIOCOUTQ)
+    // Fallback: sent-but-unacked bytes are included as well.
+    if (ioctl(fd, TIOCOUTQ, &value) != 0) {
+        return -1;
+    }
+#endif
+    return value;
+}
+
 void Stream::FillSettings(StreamSettings *settings) {
     settings->set_stream_id(id());
     settings->set_need_feedback(_options.max_buf_size > 0);
     settings->set_writable(_options.handler != NULL);
+    if (_options.max_buf_size > 0) {
+        settings->set_buf_size(_options.max_buf_size);
+    }
 }
 
 void OnIdleTimeout(void *arg) {
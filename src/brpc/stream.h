@@ -50,8 +50,11 @@ public:
 struct StreamOptions {
     StreamOptions()
         : max_buf_size(2 * 1024 * 1024)
+        , max_auto_buf_size(0)
         , idle_timeout_ms(-1)
         , messages_in_batch(128)
+        , tcp_notsent_lowat(0)
+        , max_pacing_rate(0)
         , handler(NULL)
     {}
 
@@ -60,6 +63,14 @@ struct StreamOptions {
     // default: 2097152 (2M)
     int max_buf_size;
 
+    // When greater than max_buf_size, the flow-control window starts at
+    // max_buf_size and is enlarged automatically up to this limit
+    // according to the estimated bandwidth-delay product, so that streams
+    // over long-RTT links are not throttled by a window tuned for LAN.
+    // Ignored when max_buf_size <= 0.
+    // default: 0 (window fixed at max_buf_size)
+    int max_auto_buf_size;
+
     // Notify user when there's no data for at least |idle_timeout_ms|
     // milliseconds since the last time that HandleIdleTimeout or HandleInput 
     // finished.
@@ -70,6 +81,24 @@ struct StreamOptions {
     // default: 128
     size_t messages_in_batch;
 
+    // When positive, set TCP_NOTSENT_LOWAT(bytes) on the underlying
+    // connection once this stream connects: the kernel reports
+    // writability only when fewer than so many not-yet-sent bytes are
+    // queued, and brpc's writer already feeds on EPOLLOUT, so kernel
+    // queues stay shallow instead of buffering megabytes ahead of the
+    // wire. This makes end-to-end latency reflect the link and lets
+    // Close() take effect quickly. Note that the option applies to the
+    // whole connection which the stream may share with ordinary RPCs.
+    // A "stream_<id>_notsent_bytes" bvar is exposed for such streams.
+    // default: 0 (kernel default, the whole send buffer)
+    int tcp_notsent_lowat;
+
+    // When positive, cap the pacing rate(bytes per second) of the
+    // connection with SO_MAX_PACING_RATE. Effective with the fq qdisc or
+    // a pacing-capable congestion control(e.g. BBR).
+    // default: 0 (no cap)
+    int64_t max_pacing_rate;
+
     // Handle input message, if handler is NULL, the remote side is not allowd to
     // write any message, who will get EBADF on writting
     // default: NULL
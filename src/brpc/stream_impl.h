@@ -21,6 +21,7 @@
 
 #include "bthread/bthread.h"
 #include "bthread/execution_queue.h"
+#include "bvar/passive_status.h"
 #include "brpc/socket.h"
 #include "brpc/stream.h"
 #include "brpc/streaming_rpc_meta.pb.h"
@@ -71,14 +72,25 @@ friend class MessageBatcher;
     ~Stream();
     int Init(const StreamOptions options);
     void SetRemoteConsumed(size_t _remote_consumed);
+    void TuneBufSize(size_t new_remote_consumed, int64_t now_us);
     void TriggerOnConnectIfNeed();
     void Wait(void (*on_writable)(StreamId, void*, int), void* arg, 
               const timespec* due_time, bool new_thread, bthread_id_t *join_id);
     void SendFeedback();
     void StartIdleTimer();
     void StopIdleTimer();
+    // Apply tcp_notsent_lowat/max_pacing_rate of _options to the fd of the
+    // host socket and expose the not-sent-bytes bvar. Called from
+    // SetHostSocket().
+    void ApplySocketPacing();
+    // Bytes queued in the kernel send buffer of the host socket but not
+    // sent to the wire yet, source of _notsent_bytes_var.
+    static ssize_t GetNotSentBytes(void* arg);
     void HandleRpcResponse(butil::IOBuf* response_buffer);
-    void WriteToHostSocket(butil::IOBuf* b);
+    // Write `b' to the underlying connection. Set `urgent' for small
+    // self-contained control frames(namely FEEDBACK) so that they are not
+    // queued behind large DATA frames of other streams.
+    void WriteToHostSocket(butil::IOBuf* b, bool urgent = false);
 
     static int Consume(void *meta, bthread::TaskIterator<butil::IOBuf*>& iter);
     static int TriggerOnWritable(bthread_id_t id, void *data, int error_code);
@@ -103,6 +115,9 @@ friend class MessageBatcher;
 
     Socket*     _host_socket;  // Every stream within a Socket holds a reference
     Socket*     _fake_socket_weak_ref;  // Not holding reference
+    // Exposed when tcp_notsent_lowat > 0, destroyed before _host_socket
+    // is dereferenced.
+    bvar::PassiveStatus<ssize_t>* _notsent_bytes_var;
     StreamId    _id;
     StreamOptions _options;
 
@@ -114,9 +129,21 @@ friend class MessageBatcher;
     bthread_mutex_t _congestion_control_mutex;
     size_t _produced;
     size_t _remote_consumed;
+    // Effective flow-control window. Starts at max_buf_size and grows
+    // towards max_auto_buf_size when the latter is larger.
+    int64_t _cur_buf_size;
+    // One BDP probe waits until everything produced before it is consumed
+    // remotely, which takes one round trip at least.
+    size_t _probe_produced;
+    size_t _probe_consumed;
+    int64_t _probe_time_us;
+    // When the writer was blocked by a full window, 0 if not blocked.
+    int64_t _full_since_us;
     bthread_id_list_t _writable_wait_list;
 
     int64_t _local_consumed;
+    // _local_consumed when the last feedback was sent, for coalescing.
+    int64_t _last_feedback_consumed;
     StreamSettings _remote_settings;   
 
     bool _parse_rpc_response;
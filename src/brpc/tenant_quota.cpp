@@ -0,0 +1,222 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include "butil/time.h"
+#include "brpc/controller.h"
+#include "brpc/tenant_quota.h"
+
+namespace brpc {
+
+// A tenant not requesting for so long gives its weight back to the
+// active ones.
+static const int64_t ACTIVE_WINDOW_US = 1000000L;
+
+// Bucket of requests whose tenant cannot be told.
+static const char* const UNKNOWN_TENANT = "other";
+
+TenantQuotaOptions::TenantQuotaOptions()
+    : total_rate(0)
+    , default_weight(1) {
+}
+
+TenantQuota::TenantStat::TenantStat(int weight2, double tokens2,
+                                    int64_t now_us)
+    : weight(weight2)
+    , tokens(tokens2)
+    , last_refill_us(now_us)
+    , last_active_us(now_us)
+    , counted_active(false) {
+}
+
+TenantQuota::TenantQuota()
+    : _init(false)
+    , _active_weight_sum(0)
+    , _last_sweep_us(0) {
+}
+
+TenantQuota::~TenantQuota() {
+    for (std::map<std::string, TenantStat*>::iterator
+             it = _tenants.begin(); it != _tenants.end(); ++it) {
+        delete it->second;
+    }
+    _tenants.clear();
+}
+
+int TenantQuota::Init(const TenantQuotaOptions& options) {
+    if (options.total_rate <= 0) {
+        LOG(ERROR) << "Invalid total_rate=" << options.total_rate;
+        return -1;
+    }
+    if (options.default_weight <= 0) {
+        LOG(ERROR) << "Invalid default_weight=" << options.default_weight;
+        return -1;
+    }
+    for (std::map<std::string, int>::const_iterator
+             it = options.tenant_weights.begin();
+         it != options.tenant_weights.end(); ++it) {
+        if (it->second <= 0) {
+            LOG(ERROR) << "Invalid weight=" << it->second
+                       << " of tenant=" << it->first;
+            return -1;
+        }
+    }
+    _options = options;
+    _init = true;
+    return 0;
+}
+
+void TenantQuota::ExtractTenant(const Controller& cntl,
+                                std::string* tenant) const {
+    if (cntl.has_http_request()) {
+        const std::string* v = cntl.http_request().GetHeader("x-tenant");
+        if (v != NULL) {
+            *tenant = *v;
+            return;
+        }
+    }
+    tenant->clear();
+}
+
+TenantQuota::TenantStat* TenantQuota::GetTenantStat(
+    const std::string& tenant, int64_t now_us) {
+    std::map<std::string, TenantStat*>::iterator it = _tenants.find(tenant);
+    if (it != _tenants.end()) {
+        return it->second;
+    }
+    int weight = _options.default_weight;
+    std::map<std::string, int>::const_iterator
+        wit = _options.tenant_weights.find(tenant);
+    if (wit != _options.tenant_weights.end()) {
+        weight = wit->second;
+    }
+    // Negative tokens mark a fresh bucket to be filled up once the rate
+    // is known(after the weight joins _active_weight_sum).
+    TenantStat* st = new TenantStat(weight, -1, now_us);
+    _tenants[tenant] = st;
+    ExposeTenantStat(tenant, st);
+    return st;
+}
+
+void TenantQuota::SweepIdleTenants(int64_t now_us) {
+    for (std::map<std::string, TenantStat*>::iterator
+             it = _tenants.begin(); it != _tenants.end(); ++it) {
+        TenantStat* st = it->second;
+        if (st->counted_active &&
+            now_us - st->last_active_us > ACTIVE_WINDOW_US) {
+            _active_weight_sum -= st->weight;
+            st->counted_active = false;
+        }
+    }
+    _last_sweep_us = now_us;
+}
+
+bool TenantQuota::OnRequested(const Controller& cntl) {
+    if (!_init) {
+        // Uninitialized quota limits nothing rather than rejecting
+        // everything.
+        return true;
+    }
+    std::string tenant;
+    ExtractTenant(cntl, &tenant);
+    if (tenant.empty()) {
+        tenant = UNKNOWN_TENANT;
+    }
+    const int64_t now_us = butil::gettimeofday_us();
+    bool admitted = false;
+    TenantStat* st = NULL;
+    {
+        BAIDU_SCOPED_LOCK(_mutex);
+        if (now_us - _last_sweep_us > ACTIVE_WINDOW_US) {
+            SweepIdleTenants(now_us);
+        }
+        st = GetTenantStat(tenant, now_us);
+        if (!st->counted_active) {
+            _active_weight_sum += st->weight;
+            st->counted_active = true;
+        }
+        st->last_active_us = now_us;
+        // Weighted-fair share of the total rate among active tenants,
+        // bursting for one second at most.
+        const double rate = (double)_options.total_rate * st->weight
+            / _active_weight_sum;
+        const double burst = (rate > 1.0 ? rate : 1.0);
+        if (st->tokens < 0) {  // fresh bucket starts full.
+            st->tokens = burst;
+        } else {
+            st->tokens += rate * (now_us - st->last_refill_us) / 1000000.0;
+            if (st->tokens > burst) {
+                st->tokens = burst;
+            }
+        }
+        st->last_refill_us = now_us;
+        if (st->tokens >= 1.0) {
+            st->tokens -= 1.0;
+            admitted = true;
+        }
+    }
+    if (admitted) {
+        st->admitted << 1;
+    } else {
+        st->rejected << 1;
+    }
+    return admitted;
+}
+
+void TenantQuota::ExposeTenantStat(const std::string& tenant,
+                                   TenantStat* st) {
+    if (_bvar_prefix.empty()) {  // Expose() not called yet.
+        return;
+    }
+    std::string prefix = _bvar_prefix;
+    prefix.append("_tenant_");
+    bvar::to_underscored_name(&prefix, tenant);
+    st->admitted.expose_as(prefix, "admitted");
+    st->rejected.expose_as(prefix, "rejected");
+}
+
+void TenantQuota::GetTotals(int64_t* admitted, int64_t* rejected) {
+    int64_t nadmitted = 0;
+    int64_t nrejected = 0;
+    BAIDU_SCOPED_LOCK(_mutex);
+    for (std::map<std::string, TenantStat*>::iterator
+             it = _tenants.begin(); it != _tenants.end(); ++it) {
+        nadmitted += it->second->admitted.get_value();
+        nrejected += it->second->rejected.get_value();
+    }
+    if (admitted != NULL) {
+        *admitted = nadmitted;
+    }
+    if (rejected != NULL) {
+        *rejected = nrejected;
+    }
+}
+
+int TenantQuota::Expose(const butil::StringPiece& prefix) {
+    if (prefix.empty()) {
+        return -1;
+    }
+    BAIDU_SCOPED_LOCK(_mutex);
+    _bvar_prefix.assign(prefix.data(), prefix.size());
+    for (std::map<std::string, TenantStat*>::iterator
+             it = _tenants.begin(); it != _tenants.end(); ++it) {
+        ExposeTenantStat(it->first, it->second);
+    }
+    return 0;
+}
+
+} // namespace brpc
@@ -0,0 +1,138 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef BRPC_TENANT_QUOTA_H
+#define BRPC_TENANT_QUOTA_H
+
+#include <map>
+#include <string>
+#include "butil/macros.h"
+#include "butil/strings/string_piece.h"
+#include "butil/synchronization/lock.h"
+#include "bvar/bvar.h"
+
+namespace brpc {
+
+class Controller;
+
+struct TenantQuotaOptions {
+    TenantQuotaOptions();
+
+    // Total admission rate(requests per second) shared by all tenants.
+    // Must be positive.
+    // Default: 0 (Init() fails)
+    int64_t total_rate;
+
+    // Weight of tenants absent from `tenant_weights', including requests
+    // whose tenant cannot be told(they share one "other" bucket).
+    // Default: 1
+    int default_weight;
+
+    // Relative weights of known tenants. A tenant active within the last
+    // second is entitled to total_rate * weight / sum-of-active-weights
+    // requests per second, thus capacity left idle by inactive tenants is
+    // redistributed to the busy ones instead of being wasted.
+    std::map<std::string, int> tenant_weights;
+};
+
+// Tenant-aware admission control enforced before requests are dispatched
+// to services, so that tenants sharing the same methods cannot starve
+// each other. Each tenant owns a token bucket refilled at a weighted-fair
+// share of `total_rate' and requests exceeding the share are rejected
+// with ELIMIT. This runs before and composes with the method-level
+// ConcurrencyLimiter(MaxConcurrencyOf) which still bounds the overall
+// concurrency of admitted requests.
+//
+// Usage:
+//   static MyTenantQuota quota;  // or brpc::TenantQuota
+//   brpc::TenantQuotaOptions quota_options;
+//   quota_options.total_rate = 10000;
+//   quota_options.tenant_weights["vip"] = 8;
+//   CHECK_EQ(0, quota.Init(quota_options));
+//   server_options.tenant_quota = &quota;
+//
+// Per-tenant "<server_prefix>_tenant_<name>_admitted/_rejected" bvars are
+// exposed after the server starts.
+class TenantQuota {
+public:
+    TenantQuota();
+    virtual ~TenantQuota();
+
+    // Initialize with `options' before the server starts.
+    // Returns 0 on success, -1 otherwise.
+    int Init(const TenantQuotaOptions& options);
+
+    // Returns true when the request in `cntl' is admitted, false when its
+    // tenant ran out of quota. Called by the framework before dispatching
+    // the request, thread-safe.
+    bool OnRequested(const Controller& cntl);
+
+    // Tell the tenant of a request. Default implementation reads the
+    // "x-tenant" header of http requests and leaves `tenant' empty for
+    // other protocols(the empty key shares the "other" bucket). Override
+    // this to read the tenant from your own convention, e.g. a field
+    // inside the request or the result of authentication.
+    virtual void ExtractTenant(const Controller& cntl,
+                               std::string* tenant) const;
+
+    // Expose per-tenant bvars prefixed with `prefix'. Called by Server
+    // after it starts, tenants showing up later are exposed on creation.
+    // Returns 0 on success, -1 otherwise.
+    int Expose(const butil::StringPiece& prefix);
+
+    // Sum admitted/rejected counters over all tenants, shown at /overload.
+    // Either pointer may be NULL.
+    void GetTotals(int64_t* admitted, int64_t* rejected);
+
+private:
+DISALLOW_COPY_AND_ASSIGN(TenantQuota);
+
+    struct TenantStat {
+        TenantStat(int weight2, double tokens2, int64_t now_us);
+        int weight;
+        double tokens;
+        int64_t last_refill_us;
+        int64_t last_active_us;
+        bool counted_active;
+        bvar::Adder<int64_t> admitted;
+        bvar::Adder<int64_t> rejected;
+    };
+
+    // Find or create the bucket of `tenant', _mutex must be held.
+    TenantStat* GetTenantStat(const std::string& tenant, int64_t now_us);
+    // Remove idle tenants from _active_weight_sum, _mutex must be held.
+    void SweepIdleTenants(int64_t now_us);
+    // Expose bvars of `st', _mutex must be held.
+    void ExposeTenantStat(const std::string& tenant, TenantStat* st);
+
+    TenantQuotaOptions _options;
+    bool _init;
+    std::string _bvar_prefix;
+    butil::Mutex _mutex;
+    // Tenants are few(tens at most), a flat std::map under one mutex
+    // is cheaper than sharding.
+    std::map<std::string, TenantStat*> _tenants;
+    // Sum of weights of tenants active within the last second.
+    int64_t _active_weight_sum;
+    int64_t _last_sweep_us;
+};
+
+} // namespace brpc
+
+
+#endif // BRPC_TENANT_QUOTA_H
@@ -0,0 +1,91 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <errno.h>
+#include "butil/memory/singleton_on_pthread_once.h"
+#include "brpc/udp_socket_io.h"
+
+namespace brpc {
+
+// Drain at most this many datagrams per Read(). The caller reads again
+// when the parsing loop asks for more data, larger batches just delay
+// processing of the already-received queries.
+static const int MAX_DATAGRAMS_PER_READ = 16;
+
+// Largest payload of a single datagram.
+static const size_t MAX_DATAGRAM_SIZE = 65536;
+
+UdpSocketIO* UdpSocketIO::GetInstance() {
+    return butil::get_leaky_singleton<UdpSocketIO>();
+}
+
+ssize_t UdpSocketIO::Read(Socket* s, butil::IOPortal* buf,
+                          size_t /*size_hint*/) {
+    // One readv per datagram: the kernel returns exactly one datagram per
+    // call and IOPortal appends it into pooled blocks without an extra
+    // copy. Draining what is readable now amortizes the epoll wakeup over
+    // many small queries, similarly to recvmmsg.
+    ssize_t total = 0;
+    const int fd = s->fd();
+    for (int i = 0; i < MAX_DATAGRAMS_PER_READ; ++i) {
+        const ssize_t nr = buf->append_from_file_descriptor(
+            fd, MAX_DATAGRAM_SIZE);
+        if (nr < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN && total > 0) {
+                break;
+            }
+            return -1;
+        }
+        // nr == 0 is an empty datagram, not EOF; nothing to append.
+        total += nr;
+    }
+    if (total == 0) {
+        // Only empty datagrams were received. Returning 0 would be taken
+        // as EOF by the reading loop, which never happens on UDP.
+        errno = EAGAIN;
+        return -1;
+    }
+    return total;
+}
+
+ssize_t UdpSocketIO::Write(Socket* s, butil::IOBuf** data_list,
+                           size_t ndata) {
+    // Each queued message becomes exactly one datagram: one writev sends
+    // all blocks of the message in a single packet. Cutting every queued
+    // message in one call batches the sends like sendmmsg would.
+    ssize_t total = 0;
+    const int fd = s->fd();
+    for (size_t i = 0; i < ndata; ++i) {
+        while (!data_list[i]->empty()) {
+            const ssize_t nw = data_list[i]->cut_into_file_descriptor(
+                fd, data_list[i]->size());
+            if (nw < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return total > 0 ? total : -1;
+            }
+            total += nw;
+        }
+    }
+    return total;
+}
+
+} // namespace brpc
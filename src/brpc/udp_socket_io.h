@@ -0,0 +1,53 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef BRPC_UDP_SOCKET_IO_H
+#define BRPC_UDP_SOCKET_IO_H
+
+#include "brpc/socket.h"
+
+namespace brpc {
+
+// A SocketIO running a Socket over a *connected* SOCK_DGRAM fd, for
+// query-style request/response protocols whose messages are self-delimited
+// (esp-like: one request or response per datagram). Read() drains all
+// currently readable datagrams into pooled IOBuf blocks in one call;
+// Write() sends each queued message as exactly one datagram.
+//
+// Usage: connect(2) a SOCK_DGRAM fd to the peer, then create the Socket
+// with SocketOptions.fd set to the fd and SocketOptions.io set to
+// UdpSocketIO::GetInstance(). Events, parsing and writing flow through
+// the regular paths.
+//
+// Notices:
+// * Datagrams may be lost, duplicated or reordered. The protocol on top
+//   must tolerate all three, e.g. by timeout-based retries keyed on the
+//   correlation id carried in its header.
+// * A message larger than the path MTU fails with EMSGSIZE instead of
+//   being fragmented by this class.
+class UdpSocketIO : public SocketIO {
+public:
+    // Stateless, shared by all UDP sockets.
+    static UdpSocketIO* GetInstance();
+
+    ssize_t Read(Socket* s, butil::IOPortal* buf, size_t size_hint) override;
+    ssize_t Write(Socket* s, butil::IOBuf** data_list, size_t ndata) override;
+};
+
+} // namespace brpc
+
+#endif  // BRPC_UDP_SOCKET_IO_H
@@ -26,6 +26,7 @@
 #include "bthread/task_control.h"              // TaskControl
 #include "bthread/timer_thread.h"
 #include "bthread/list_of_abafree_id.h"
+#include "bthread/offcpu_profiler.h"
 #include "bthread/bthread.h"
 
 namespace bthread {
@@ -175,6 +176,9 @@ int bthread_start_urgent(bthread_t* __restrict tid,
                          void* __restrict arg) {
     bthread::TaskGroup* g = bthread::tls_task_group;
     if (g) {
+        if (attr != NULL && (attr->flags & BTHREAD_INLINE)) {
+            return bthread::TaskGroup::start_inline(&g, tid, attr, fn, arg);
+        }
         // start from worker
         return bthread::TaskGroup::start_foreground(&g, tid, attr, fn, arg);
     }
@@ -340,6 +344,30 @@ int bthread_timer_add(bthread_timer_t* id, timespec abstime,
     return ESTOP;
 }
 
+int bthread_timer_add_batch(bthread_timer_t* ids, size_t n, timespec abstime,
+                            void (*on_timer)(void*), void* const args[]) {
+    if (n == 0) {
+        return 0;
+    }
+    bthread::TaskControl* c = bthread::get_or_new_task_control();
+    if (c == NULL) {
+        return ENOMEM;
+    }
+    bthread::TimerThread* tt = bthread::get_or_create_global_timer_thread();
+    if (tt == NULL) {
+        return ENOMEM;
+    }
+    const size_t nsched = tt->schedule_batch(on_timer, args, n, abstime, ids);
+    if (nsched == n) {
+        return 0;
+    }
+    // All-or-nothing, remove the partially scheduled prefix.
+    for (size_t i = 0; i < nsched; ++i) {
+        tt->unschedule(ids[i]);
+    }
+    return ESTOP;
+}
+
 int bthread_timer_del(bthread_timer_t id) {
     bthread::TaskControl* c = bthread::get_task_control();
     if (c != NULL) {
@@ -358,7 +386,17 @@ int bthread_timer_del(bthread_timer_t id) {
 int bthread_usleep(uint64_t microseconds) {
     bthread::TaskGroup* g = bthread::tls_task_group;
     if (NULL != g && !g->is_current_pthread_task()) {
-        return bthread::TaskGroup::usleep(&g, microseconds);
+        const size_t sampling_range = bthread::StartOffCpuSampling();
+        if (!sampling_range) {
+            return bthread::TaskGroup::usleep(&g, microseconds);
+        }
+        const int64_t block_start_ns = butil::cpuwide_time_ns();
+        const int rc = bthread::TaskGroup::usleep(&g, microseconds);
+        const int saved_errno = errno;
+        bthread::SubmitOffCpuSample(
+            sampling_range, butil::cpuwide_time_ns() - block_start_ns);
+        errno = saved_errno;
+        return rc;
     }
     return ::usleep(microseconds);
 }
@@ -373,6 +411,26 @@ int bthread_yield(void) {
     return sched_yield();
 }
 
+int bthread_set_priority(int priority) {
+    if (priority < 0) {
+        return EINVAL;
+    }
+    bthread::TaskGroup* g = bthread::tls_task_group;
+    if (NULL != g && !g->is_current_pthread_task()) {
+        g->current_task()->base_priority = priority;
+        return 0;
+    }
+    return EINVAL;
+}
+
+int bthread_get_priority(void) {
+    bthread::TaskGroup* g = bthread::tls_task_group;
+    if (NULL != g && !g->is_current_pthread_task()) {
+        return g->current_task()->effective_priority();
+    }
+    return 0;
+}
+
 int bthread_set_worker_startfn(void (*start_fn)()) {
     if (start_fn == NULL) {
         return EINVAL;
@@ -146,11 +146,24 @@ extern int bthread_getconcurrency(void);
 // NOTE: currently concurrency cannot be reduced after any bthread created.
 extern int bthread_setconcurrency(int num);
 
-// Yield processor to another bthread. 
-// Notice that current implementation is not fair, which means that 
+// Yield processor to another bthread.
+// Notice that current implementation is not fair, which means that
 // even if bthread_yield() is called, suspended threads may still starve.
 extern int bthread_yield(void);
 
+// Set scheduling priority of the calling bthread to `priority'(>= 0,
+// default 0). bthreads remain cooperative: the priority does not preempt
+// running tasks, it is propagated to the holder of a contended
+// bthread_mutex_t so that a low-priority holder is scheduled ahead of
+// ordinary ready bthreads while higher-priority bthreads wait on the
+// mutex(priority inheritance), bounding priority inversion.
+// Returns 0 on success, EINVAL when the caller is not a bthread or
+// `priority' is negative.
+extern int bthread_set_priority(int priority);
+
+// Get scheduling priority of the calling bthread, 0 for non-bthreads.
+extern int bthread_get_priority(void);
+
 // Suspend current thread for at least `microseconds'
 // Interruptible by bthread_interrupt().
 extern int bthread_usleep(uint64_t microseconds);
@@ -299,6 +312,18 @@ extern int bthread_barrier_wait(bthread_barrier_t* barrier);
 extern int bthread_key_create(bthread_key_t* key,
                               void (*destructor)(void* data));
 
+// Create a key stored in an inline fast slot of thread-local storage:
+// bthread_getspecific on such keys is a single load instead of walking
+// the two-level KeyTable, roughly as cheap as pthread TLS. Intended for
+// very hot keys, e.g. a tracing context read at every log statement.
+// Only KEY_FAST_SLOT_NUM(4) fast keys exist in a process, returns EAGAIN
+// when they're exhausted. Unlike ordinary keys whose data may be cached
+// across bthreads by a bthread_keytable_pool_t, data of fast keys is
+// destructed when the bthread ends.
+// Returns 0 on success, error code otherwise.
+extern int bthread_key_create_fast(bthread_key_t* key,
+                                   void (*destructor)(void* data));
+
 // Delete a key previously returned by bthread_key_create().
 // It is the responsibility of the application to free the data related to
 // the deleted key in any running thread. No destructor is invoked by
@@ -19,6 +19,7 @@
 
 // Date: Tue Jul 22 17:30:12 CST 2014
 
+#include <gflags/gflags.h>
 #include "butil/atomicops.h"                // butil::atomic
 #include "butil/scoped_lock.h"              // BAIDU_SCOPED_LOCK
 #include "butil/macros.h"
@@ -36,6 +37,7 @@
 #include "bthread/timer_thread.h"
 #include "bthread/butex.h"
 #include "bthread/mutex.h"
+#include "bthread/offcpu_profiler.h"
 
 // This file implements butex.h
 // Provides futex-like semantics which is sequenced wait and wake operations
@@ -58,6 +60,31 @@
 
 namespace bthread {
 
+static bool pass_bool(const char*, bool) { return true; }
+
+DEFINE_bool(bthread_locality_aware_butex_wake, false,
+            "When a worker wakes one bthread blocked on a butex, push it "
+            "into the worker's own run queue instead of switching to it "
+            "immediately, provided that the waiter did not block on a "
+            "different NUMA node. The waker keeps running and the woken "
+            "bthread follows on a core whose cache already holds the data "
+            "protected by the butex, which helps mutex-heavy services");
+const bool ALLOW_UNUSED dummy_bthread_locality_aware_butex_wake =
+    ::GFLAGS_NS::RegisterFlagValidator(&FLAGS_bthread_locality_aware_butex_wake,
+                                    pass_bool);
+
+static bool non_negative_int32(const char*, int32_t v) { return v >= 0; }
+
+DEFINE_int32(bthread_batch_wake_min_waiters, 32,
+             "Wake-all on a butex with at least this many blocked bthreads "
+             "distributes them over worker groups in fixed-size batches, "
+             "one remote-queue round and one signal per batch instead of "
+             "funneling all of them into a single group. 0 disables "
+             "batching");
+const bool ALLOW_UNUSED dummy_bthread_batch_wake_min_waiters =
+    ::GFLAGS_NS::RegisterFlagValidator(&FLAGS_bthread_batch_wake_min_waiters,
+                                    non_negative_int32);
+
 #ifdef SHOW_BTHREAD_BUTEX_WAITER_COUNT_IN_VARS
 struct ButexWaiterCount : public bvar::Adder<int64_t> {
     ButexWaiterCount() : bvar::Adder<int64_t>("bthread_butex_waiter_count") {}
@@ -100,6 +127,8 @@ struct ButexBthreadWaiter : public ButexWaiter {
     int expected_value;
     Butex* initial_butex;
     TaskControl* control;
+    // NUMA node of the worker that the waiter blocked on, -1 when unbound.
+    int numa_node;
 };
 
 // pthread_task or main_task allocates this structure on stack and queue it
@@ -261,6 +290,21 @@ inline TaskGroup* get_task_group(TaskControl* c) {
     return g ? g : c->choose_one_group();
 }
 
+// True when the woken waiter can be pushed into the waking worker's run
+// queue without hurting locality: the waiter blocked on the same NUMA node
+// or workers are not bound to nodes at all.
+inline bool wake_into_local_queue(TaskGroup* g, const ButexBthreadWaiter* bbw) {
+    if (!FLAGS_bthread_locality_aware_butex_wake ||
+        (bbw->numa_node >= 0 && bbw->numa_node != g->numa_node())) {
+        return false;
+    }
+    // A priority-boosted waiter(e.g. a mutex holder that higher-priority
+    // bthreads wait on) preempts the waker instead of queuing behind it.
+    TaskMeta* wm = TaskGroup::address_meta(bbw->tid);
+    return wm == NULL ||
+        wm->effective_priority() <= g->current_task()->effective_priority();
+}
+
 int butex_wake(void* arg) {
     Butex* b = container_of(static_cast<butil::atomic<int>*>(arg), Butex, value);
     ButexWaiter* front = NULL;
@@ -281,18 +325,51 @@ int butex_wake(void* arg) {
     unsleep_if_necessary(bbw, get_global_timer_thread());
     TaskGroup* g = tls_task_group;
     if (g) {
-        TaskGroup::exchange(&g, bbw->tid);
+        if (wake_into_local_queue(g, bbw)) {
+            // Don't preempt the waker(often an unlocking bthread which
+            // is about to leave its critical section), queue the woken
+            // bthread behind it on this worker instead.
+            g->ready_to_run(bbw->tid);
+        } else {
+            TaskGroup::exchange(&g, bbw->tid);
+        }
     } else {
         bbw->control->choose_one_group()->ready_to_run_remote(bbw->tid);
     }
     return 1;
 }
 
+// Make all bthreads in `list' runnable by spreading them over worker
+// groups in fixed-size batches: each batch goes into the remote queue of
+// one group followed by a single signal, so that waking N bthreads costs
+// N/BATCH signals landing on different parking lots instead of either N
+// signals or one signal on a single overloaded group.
+static int batch_wake_bthreads(ButexWaiterList& list, TaskControl* control) {
+    static const size_t BATCH_WAKE_SIZE = 64;
+    bthread_t tids[BATCH_WAKE_SIZE];
+    int nwakeup = 0;
+    while (!list.empty()) {
+        size_t n = 0;
+        do {
+            // pop reversely
+            ButexBthreadWaiter* w = static_cast<ButexBthreadWaiter*>(
+                list.tail()->value());
+            w->RemoveFromList();
+            unsleep_if_necessary(w, get_global_timer_thread());
+            tids[n++] = w->tid;
+        } while (n < BATCH_WAKE_SIZE && !list.empty());
+        control->choose_one_group()->ready_to_run_remote_batch(tids, n);
+        nwakeup += n;
+    }
+    return nwakeup;
+}
+
 int butex_wake_all(void* arg) {
     Butex* b = container_of(static_cast<butil::atomic<int>*>(arg), Butex, value);
 
     ButexWaiterList bthread_waiters;
     ButexWaiterList pthread_waiters;
+    size_t nbthread_waiters = 0;
     {
         BAIDU_SCOPED_LOCK(b->waiter_lock);
         while (!b->waiters.empty()) {
@@ -301,6 +378,7 @@ int butex_wake_all(void* arg) {
             bw->container.store(NULL, butil::memory_order_relaxed);
             if (bw->tid) {
                 bthread_waiters.Append(bw);
+                ++nbthread_waiters;
             } else {
                 pthread_waiters.Append(bw);
             }
@@ -325,6 +403,16 @@ int butex_wake_all(void* arg) {
     unsleep_if_necessary(next, get_global_timer_thread());
     ++nwakeup;
     TaskGroup* g = get_task_group(next->control);
+    if (FLAGS_bthread_batch_wake_min_waiters > 0 &&
+        nbthread_waiters >= (size_t)FLAGS_bthread_batch_wake_min_waiters) {
+        nwakeup += batch_wake_bthreads(bthread_waiters, next->control);
+        if (g == tls_task_group) {
+            TaskGroup::exchange(&g, next->tid);
+        } else {
+            g->ready_to_run_remote(next->tid);
+        }
+        return nwakeup;
+    }
     const int saved_nwakeup = nwakeup;
     while (!bthread_waiters.empty()) {
         // pop reversely
@@ -441,7 +529,11 @@ int butex_requeue(void* arg, void* arg2) {
     unsleep_if_necessary(bbw, get_global_timer_thread());
     TaskGroup* g = tls_task_group;
     if (g) {
-        TaskGroup::exchange(&g, front->tid);
+        if (wake_into_local_queue(g, bbw)) {
+            g->ready_to_run(front->tid);
+        } else {
+            TaskGroup::exchange(&g, front->tid);
+        }
     } else {
         bbw->control->choose_one_group()->ready_to_run_remote(front->tid);
     }
@@ -618,7 +710,17 @@ int butex_wait(void* arg, int expected_value, const timespec* abstime) {
     }
     TaskGroup* g = tls_task_group;
     if (NULL == g || g->is_current_pthread_task()) {
-        return butex_wait_from_pthread(g, b, expected_value, abstime);
+        const size_t sampling_range = StartOffCpuSampling();
+        if (!sampling_range) {
+            return butex_wait_from_pthread(g, b, expected_value, abstime);
+        }
+        const int64_t block_start_ns = butil::cpuwide_time_ns();
+        const int rc = butex_wait_from_pthread(g, b, expected_value, abstime);
+        const int saved_errno = errno;
+        SubmitOffCpuSample(sampling_range,
+                           butil::cpuwide_time_ns() - block_start_ns);
+        errno = saved_errno;
+        return rc;
     }
     ButexBthreadWaiter bbw;
     // tid is 0 iff the thread is non-bthread
@@ -630,6 +732,7 @@ int butex_wait(void* arg, int expected_value, const timespec* abstime) {
     bbw.expected_value = expected_value;
     bbw.initial_butex = b;
     bbw.control = g->control();
+    bbw.numa_node = g->numa_node();
 
     if (abstime != NULL) {
         // Schedule timer before queueing. If the timer is triggered before
@@ -652,6 +755,13 @@ int butex_wait(void* arg, int expected_value, const timespec* abstime) {
     num_waiters << 1;
 #endif
 
+    // Sample the off-CPU time when the off-CPU profiler is on. The sampling
+    // decision is made before blocking, the stacktrace is taken after waking
+    // up(in SubmitOffCpuSample) which is still the stack that blocked.
+    const size_t sampling_range = StartOffCpuSampling();
+    const int64_t block_start_ns =
+        sampling_range ? butil::cpuwide_time_ns() : 0;
+
     // release fence matches with acquire fence in interrupt_and_consume_waiters
     // in task_group.cpp to guarantee visibility of `interrupted'.
     bbw.task_meta->current_waiter.store(&bbw, butil::memory_order_release);
@@ -672,6 +782,11 @@ int butex_wait(void* arg, int expected_value, const timespec* abstime) {
     num_waiters << -1;
 #endif
 
+    if (sampling_range) {
+        SubmitOffCpuSample(sampling_range,
+                           butil::cpuwide_time_ns() - block_start_ns);
+    }
+
     bool is_interrupted = false;
     if (bbw.task_meta->interrupted) {
         // Race with set and may consume multiple interruptions, which are OK.
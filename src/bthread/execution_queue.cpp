@@ -21,6 +21,7 @@
 
 #include "bthread/execution_queue.h"
 
+#include "bthread/unstable.h"            // bthread_timer_add
 #include "butil/memory/singleton_on_pthread_once.h"
 #include "butil/object_pool.h"           // butil::get_object
 #include "butil/resource_pool.h"         // butil::get_resource
@@ -89,7 +90,8 @@ void ExecutionQueueBase::start_execute(TaskNode* node) {
 
     ExecutionQueueVars* const vars = get_execq_vars();
     vars->execq_active_count << 1;
-    if (node->in_place) {
+    if (node->in_place ||
+        (_options.in_place_if_possible && !node->stop_task)) {
         int niterated = 0;
         _execute(node, node->high_priority, &niterated);
         TaskNode* tmp = node;
@@ -105,6 +107,20 @@ void ExecutionQueueBase::start_execute(TaskNode* node) {
     }
 
     if (nullptr == _options.executor) {
+        if (_options.max_delay_us > 0 && !node->high_priority &&
+            !node->stop_task && !node->iterated) {
+            // Let tasks accumulate before waking the consumer. Tasks pushed
+            // while the timer is pending are chained after |node| and will be
+            // consumed in the same wakeup.
+            bthread_timer_t timer;
+            if (bthread_timer_add(&timer,
+                                  butil::microseconds_from_now(_options.max_delay_us),
+                                  _launch_execute_tasks, node) == 0) {
+                return;
+            }
+            PLOG(FATAL) << "Fail to add timer";
+            // Fall through to wake the consumer immediately.
+        }
         bthread_t tid;
         // We start the execution thread in background instead of foreground as
         // we can't determine whether the code after execute() is urgent (like
@@ -189,6 +205,17 @@ void* ExecutionQueueBase::_execute_tasks(void* arg) {
     return NULL;
 }
 
+void ExecutionQueueBase::_launch_execute_tasks(void* arg) {
+    TaskNode* node = (TaskNode*)arg;
+    ExecutionQueueBase* m = (ExecutionQueueBase*)node->q;
+    bthread_t tid;
+    if (bthread_start_background(&tid, &m->_options.bthread_attr,
+                                 _execute_tasks, node) != 0) {
+        PLOG(FATAL) << "Fail to start bthread";
+        _execute_tasks(node);
+    }
+}
+
 void ExecutionQueueBase::return_task_node(TaskNode* node) {
     node->clear_before_return(_clear_func);
     butil::return_object<TaskNode>(node);
@@ -371,6 +398,78 @@ int ExecutionQueueBase::create(uint64_t* id, const ExecutionQueueOptions* option
     return ENOMEM;
 }
 
+ExecutionQueueGroup::ExecutionQueueGroup(const std::string& name,
+                                         int max_concurrency)
+    : _max_concurrency(max_concurrency > 0 ? max_concurrency
+                       : bthread_getconcurrency())
+    , _nworkers(0)
+    , _ready_batches(name + "_ready_batches")
+    , _workers(name + "_workers") {
+}
+
+ExecutionQueueGroup::~ExecutionQueueGroup() {
+    std::unique_lock<bthread::Mutex> lck(_mutex);
+    CHECK(_ready.empty()) << "Destructing ExecutionQueueGroup with ready "
+        "batches, some member queues are not stopped and joined";
+    while (_nworkers != 0) {
+        _workers_quit.wait(lck);
+    }
+}
+
+int ExecutionQueueGroup::submit(void* (*fn)(void*), void* args) {
+    const ReadyBatch rb = { fn, args };
+    bool start_worker = false;
+    {
+        std::unique_lock<bthread::Mutex> lck(_mutex);
+        _ready.push_back(rb);
+        if (_nworkers < _max_concurrency) {
+            ++_nworkers;
+            start_worker = true;
+        }
+    }
+    _ready_batches << 1;
+    if (!start_worker) {
+        // A running worker picks the batch up once it drains its current
+        // queue.
+        return 0;
+    }
+    _workers << 1;
+    bthread_t tid;
+    if (bthread_start_background(&tid, &BTHREAD_ATTR_NORMAL,
+                                 _run_worker, this) != 0) {
+        PLOG(FATAL) << "Fail to start bthread";
+        // Consume in place rather than losing the batch, same fallback as
+        // start_execute().
+        _worker_loop();
+    }
+    return 0;
+}
+
+void* ExecutionQueueGroup::_run_worker(void* arg) {
+    static_cast<ExecutionQueueGroup*>(arg)->_worker_loop();
+    return NULL;
+}
+
+void ExecutionQueueGroup::_worker_loop() {
+    for (;;) {
+        ReadyBatch rb;
+        {
+            std::unique_lock<bthread::Mutex> lck(_mutex);
+            if (_ready.empty()) {
+                if (--_nworkers == 0) {
+                    _workers_quit.notify_all();
+                }
+                break;
+            }
+            rb = _ready.front();
+            _ready.pop_front();
+        }
+        _ready_batches << -1;
+        rb.fn(rb.args);
+    }
+    _workers << -1;
+}
+
 inline bool TaskIteratorBase::should_break_for_high_priority_tasks() {
     if (!_high_priority && 
             _q->_high_priority_tasks.load(butil::memory_order_relaxed) > 0) {
@@ -390,6 +489,12 @@ void TaskIteratorBase::operator++() {
     if (should_break_for_high_priority_tasks()) {
         return;
     }  // else the next high_priority_task would be delayed for at most one task
+    if (_q->_options.max_batch_size > 0 &&
+        _num_iterated >= (int)_q->_options.max_batch_size) {
+        // The remaining tasks are handed to the next call to execute.
+        _should_break = true;
+        return;
+    }
 
     while (_cur_node && !_cur_node->stop_task) {
         if (_high_priority == _cur_node->high_priority) {
@@ -22,8 +22,13 @@
 #ifndef  BTHREAD_EXECUTION_QUEUE_H
 #define  BTHREAD_EXECUTION_QUEUE_H
 
+#include <deque>
+#include <string>
 #include "bthread/bthread.h"
+#include "bthread/mutex.h"
+#include "bthread/condition_variable.h"
 #include "butil/type_traits.h"
+#include "bvar/bvar.h"
 
 namespace bthread {
 
@@ -139,6 +144,55 @@ public:
     virtual int submit(void * (*fn)(void*), void* args) = 0;
 };
 
+// An Executor running member ExecutionQueues on a shared, bounded set of
+// bthread workers. Register a queue by pointing
+// ExecutionQueueOptions.executor at the group before starting it. A worker
+// finishing one queue's pending batch picks up the oldest ready sibling
+// next instead of quitting, so a backed-up queue cannot leave workers
+// idling on drained siblings. Ordering inside each queue is untouched
+// (its tasks are still consumed serially in pushing order); ordering
+// across queues of the group is unspecified.
+//
+// Depth of the group is exposed as bvars prefixed with |name|:
+//   <name>_ready_batches : pending batches waiting for a free worker
+//   <name>_workers       : workers currently running
+//
+// The group must outlive its member queues: stop and join all of them
+// before destroying the group. A task blocking on completion of another
+// queue in the same group may deadlock when all workers are busy, just
+// as with any bounded pool.
+class ExecutionQueueGroup : public Executor {
+public:
+    // |max_concurrency| caps simultaneously running workers, 0 means the
+    // worker thread number of bthread.
+    explicit ExecutionQueueGroup(const std::string& name,
+                                 int max_concurrency = 0);
+    ~ExecutionQueueGroup();
+
+    // @Executor
+    int submit(void* (*fn)(void*), void* args);
+
+    int max_concurrency() const { return _max_concurrency; }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(ExecutionQueueGroup);
+    struct ReadyBatch {
+        void* (*fn)(void*);
+        void* args;
+    };
+
+    static void* _run_worker(void* arg);
+    void _worker_loop();
+
+    int _max_concurrency;
+    int _nworkers;
+    std::deque<ReadyBatch> _ready;
+    bthread::Mutex _mutex;
+    bthread::ConditionVariable _workers_quit;
+    bvar::Adder<int64_t> _ready_batches;
+    bvar::Adder<int64_t> _workers;
+};
+
 struct ExecutionQueueOptions {
     ExecutionQueueOptions();
     // Attribute of the bthread which execute runs on
@@ -149,6 +203,27 @@ struct ExecutionQueueOptions {
     // Note that TaskOptions.in_place_if_possible = false will not work, if implementation of
     // Executor is in-place(synchronous).
     Executor * executor;
+
+    // Maximum number of tasks passed to one call to |execute|. When the
+    // limit is reached the iterator ends and remaining tasks are handed to
+    // the next call, bounding the latency that a long backlog adds to each
+    // wakeup of the consumer.
+    // Default: 0 (unlimited)
+    size_t max_batch_size;
+
+    // Delay between pushing the first task into an idle queue and waking
+    // the consumer, letting tasks accumulate into bigger batches at high
+    // rates instead of paying one wakeup per task. High-priority tasks and
+    // in-place execution are not delayed.
+    // Default: 0 (wake the consumer immediately)
+    int64_t max_delay_us;
+
+    // Execute tasks in the calling thread when the queue is idle instead
+    // of starting a bthread, as if every task was pushed with
+    // TASK_OPTIONS_INPLACE. Same deadlock caveat as
+    // TaskOptions.in_place_if_possible.
+    // Default: false
+    bool in_place_if_possible;
 };
 
 // Start a ExecutionQueue. If |options| is NULL, the queue will be created with
@@ -157,11 +232,25 @@ struct ExecutionQueueOptions {
 // NOTE: type |T| can be non-POD but must be copy-constructible
 template <typename T>
 int execution_queue_start(
-        ExecutionQueueId<T>* id, 
+        ExecutionQueueId<T>* id,
         const ExecutionQueueOptions* options,
         int (*execute)(void* meta, TaskIterator<T>& iter),
         void* meta);
 
+// Start a ExecutionQueue with a vectored |execute| which receives tasks
+// copied into a contiguous array instead of an iterator, friendlier to
+// consumers processing records in bulk (e.g. appending to a log). |execute|
+// may be called several times per wakeup, with at most
+// ExecutionQueueOptions.max_batch_size tasks per call when the option is
+// set. The queue being stopped is notified by tasks=NULL and n=0.
+// Returns 0 on success, errno otherwise
+template <typename T>
+int execution_queue_start(
+        ExecutionQueueId<T>* id,
+        const ExecutionQueueOptions* options,
+        int (*execute)(void* meta, T* tasks, size_t n),
+        void* meta);
+
 // Stop the ExecutionQueue.
 // After this function is called:
 //  - All the following calls to execution_queue_execute would fail immediately.
@@ -203,6 +203,7 @@ private:
     void _on_recycle();
     int _execute(TaskNode* head, bool high_priority, int* niterated);
     static void* _execute_tasks(void* arg);
+    static void _launch_execute_tasks(void* arg);
 
     static inline uint32_t _version_of_id(uint64_t id) WARN_UNUSED_RESULT {
         return (uint32_t)(id >> 32);
@@ -255,10 +256,16 @@ public:
     typedef bthread::ExecutionQueueId<T>                        id_t;
     typedef TaskIterator<T>                                     iterator;
     typedef int (*execute_func_t)(void*, iterator&);
+    typedef int (*vectored_execute_func_t)(void*, T*, size_t);
     typedef TaskAllocator<T>                                    allocator;
     BAIDU_CASSERT(sizeof(execute_func_t) == sizeof(void*),
                   sizeof_function_must_be_equal_to_sizeof_voidptr);
 
+    // Tasks passed to a vectored execute are copied into an on-stack array
+    // of roughly one page.
+    static const size_t VECTORED_BATCH_NITEM =
+        (4096 / sizeof(T)) > 0 ? (4096 / sizeof(T)) : 1;
+
     static void clear_task_mem(TaskNode* node) {
         T* const task = (T*)allocator::get_allocated_mem(node);
         task->~T();
@@ -271,9 +278,42 @@ public:
         return f(meta, static_cast<iterator&>(it));
     }
 
+    static int execute_task_vectored(void* meta, void* specific_function,
+                                     TaskIteratorBase& it) {
+        vectored_execute_func_t f = (vectored_execute_func_t)specific_function;
+        iterator& iter = static_cast<iterator&>(it);
+        if (iter.is_queue_stopped()) {
+            return f(meta, NULL, 0);
+        }
+        char storage[sizeof(T) * VECTORED_BATCH_NITEM]
+            __attribute__((aligned(16)));
+        T* const batch = (T*)storage;
+        int rc = 0;
+        while (iter) {
+            size_t n = 0;
+            for (; iter && n < VECTORED_BATCH_NITEM; ++iter, ++n) {
+                new (batch + n) T(*iter);
+            }
+            const int rc2 = f(meta, batch, n);
+            for (size_t i = 0; i < n; ++i) {
+                batch[i].~T();
+            }
+            if (rc2 != 0) {
+                rc = rc2;
+            }
+        }
+        return rc;
+    }
+
     inline static int create(id_t* id, const ExecutionQueueOptions* options,
                              execute_func_t execute_func, void* meta) {
-        return Base::create(&id->value, options, execute_task, 
+        return Base::create(&id->value, options, execute_task,
+                            clear_task_mem, meta, (void*)execute_func);
+    }
+
+    inline static int create(id_t* id, const ExecutionQueueOptions* options,
+                             vectored_execute_func_t execute_func, void* meta) {
+        return Base::create(&id->value, options, execute_task_vectored,
                             clear_task_mem, meta, (void*)execute_func);
     }
 
@@ -321,17 +361,27 @@ public:
 
 inline ExecutionQueueOptions::ExecutionQueueOptions()
     : bthread_attr(BTHREAD_ATTR_NORMAL), executor(NULL)
+    , max_batch_size(0), max_delay_us(0), in_place_if_possible(false)
 {}
 
 template <typename T>
 inline int execution_queue_start(
-        ExecutionQueueId<T>* id, 
+        ExecutionQueueId<T>* id,
         const ExecutionQueueOptions* options,
         int (*execute)(void* meta, TaskIterator<T>&),
         void* meta) {
    return ExecutionQueue<T>::create(id, options, execute, meta);
 }
 
+template <typename T>
+inline int execution_queue_start(
+        ExecutionQueueId<T>* id,
+        const ExecutionQueueOptions* options,
+        int (*execute)(void* meta, T* tasks, size_t n),
+        void* meta) {
+   return ExecutionQueue<T>::create(id, options, execute, meta);
+}
+
 template <typename T>
 typename ExecutionQueue<T>::scoped_ptr_t 
 execution_queue_address(ExecutionQueueId<T> id) {
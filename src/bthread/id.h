@@ -180,6 +180,13 @@ int bthread_id_create2_ranged(
 int bthread_id_error2_verbose(bthread_id_t id, int error_code,
                               const std::string& error_text,
                               const char *location);
+// Equivalent to calling bthread_id_error2 on each of the `nids' ids in
+// `ids' with the same error, in one pass sharing one error_text. Built
+// for bulk-failing the correlation ids of a drained write queue when a
+// connection breaks. Invalid ids are skipped silently.
+// Returns number of ids errored successfully.
+int bthread_id_error2_batched(const bthread_id_t* ids, size_t nids,
+                              int error_code, const std::string& error_text);
 int bthread_id_list_reset2(bthread_id_list_t* list, int error_code,
                            const std::string& error_text);
 int bthread_id_list_reset2_pthreadsafe(bthread_id_list_t* list, int error_code,
@@ -22,6 +22,7 @@
 #include <pthread.h>
 #include "butil/macros.h"
 #include "butil/atomicops.h"
+#include "butil/thread_local.h"                  // thread_atexit
 #include "bvar/passive_status.h"
 #include "bthread/errno.h"                       // EAGAIN
 #include "bthread/task_group.h"                  // TaskGroup
@@ -68,6 +69,16 @@ static size_t nfreekey = 0;
 static size_t nkey = 0;
 static uint32_t s_free_keys[KEYS_MAX];
 
+// Registry of fast keys(bthread_key_create*_fast) living in
+// LocalStorage.fast_slots. They're encoded as index = KEYS_MAX + slot to
+// be distinguishable from ordinary keys, and protected by s_key_mutex
+// like them.
+static KeyInfo s_fast_key_info[KEY_FAST_SLOT_NUM] = {};
+static size_t nfreefastkey = 0;
+static size_t nfastkey = 0;
+static uint32_t s_free_fast_keys[KEY_FAST_SLOT_NUM];
+static __thread bool tls_ever_set_fast_slot = false;
+
 // Stats.
 static butil::static_atomic<size_t> nkeytable = BUTIL_STATIC_ATOMIC_INIT(0);
 static butil::static_atomic<size_t> nsubkeytable = BUTIL_STATIC_ATOMIC_INIT(0);
@@ -204,16 +215,147 @@ private:
     SubKeyTable* _subs[KEY_1STLEVEL_SIZE];
 };
 
+// [Sharded keytable caches]
+// Each thread caches a handful of free KeyTables per pool, mirroring
+// ResourcePool's LocalPool: acquire/release only take the cache's own
+// mutex which is uncontended in steady state(only the owner thread locks
+// it on the fast path), instead of serializing every worker on
+// pool->mutex. Refills from and spills to the shared free list move
+// KEYTABLE_CACHE_BATCH tables at once. All caches are registered in a
+// global list so that bthread_keytable_pool_destroy() still destructs
+// cached tables and getstat() still counts them.
+struct KeyTableCache {
+    KeyTableCache* next;            // in s_keytable_cache_list
+    pthread_mutex_t mutex;
+    bthread_keytable_pool_t* pool;  // the pool cached tables belong to
+    KeyTable* free_list;
+    size_t nfree;
+};
+static const size_t KEYTABLE_CACHE_BATCH = 8;
+static const size_t KEYTABLE_CACHE_MAX = 2 * KEYTABLE_CACHE_BATCH;
+static pthread_mutex_t s_keytable_cache_list_mutex = PTHREAD_MUTEX_INITIALIZER;
+static KeyTableCache* s_keytable_cache_list = NULL;
+static __thread KeyTableCache* tls_keytable_cache = NULL;
+
+// Move all tables of `c' back to the pool they belong to, or delete them
+// if the pool was destroyed meanwhile. Called with c->mutex held.
+static void flush_keytable_cache(KeyTableCache* c) {
+    KeyTable* head = c->free_list;
+    c->free_list = NULL;
+    c->nfree = 0;
+    if (head == NULL) {
+        return;
+    }
+    KeyTable* tail = head;
+    while (tail->next) {
+        tail = tail->next;
+    }
+    {
+        std::unique_lock<pthread_mutex_t> mu(c->pool->mutex);
+        if (!c->pool->destroyed) {
+            tail->next = (KeyTable*)c->pool->free_keytables;
+            c->pool->free_keytables = head;
+            return;
+        }
+    }
+    while (head) {
+        KeyTable* kt = head;
+        head = head->next;
+        delete kt;
+    }
+}
+
+static void delete_keytable_cache(void* arg) {
+    KeyTableCache* c = (KeyTableCache*)arg;
+    {
+        BAIDU_SCOPED_LOCK(s_keytable_cache_list_mutex);
+        KeyTableCache** pprev = &s_keytable_cache_list;
+        while (*pprev != c) {
+            pprev = &(*pprev)->next;
+        }
+        *pprev = c->next;
+    }
+    pthread_mutex_lock(&c->mutex);
+    if (c->pool != NULL) {
+        flush_keytable_cache(c);
+    }
+    pthread_mutex_unlock(&c->mutex);
+    pthread_mutex_destroy(&c->mutex);
+    delete c;
+    tls_keytable_cache = NULL;
+}
+
+static KeyTableCache* get_keytable_cache() {
+    KeyTableCache* c = tls_keytable_cache;
+    if (c == NULL) {
+        c = new (std::nothrow) KeyTableCache;
+        if (NULL == c) {
+            return NULL;
+        }
+        pthread_mutex_init(&c->mutex, NULL);
+        c->pool = NULL;
+        c->free_list = NULL;
+        c->nfree = 0;
+        {
+            BAIDU_SCOPED_LOCK(s_keytable_cache_list_mutex);
+            c->next = s_keytable_cache_list;
+            s_keytable_cache_list = c;
+        }
+        butil::thread_atexit(delete_keytable_cache, c);
+        tls_keytable_cache = c;
+    }
+    return c;
+}
+
 static KeyTable* borrow_keytable(bthread_keytable_pool_t* pool) {
-    if (pool != NULL && pool->free_keytables) {
-        BAIDU_SCOPED_LOCK(pool->mutex);
-        KeyTable* p = (KeyTable*)pool->free_keytables;
-        if (p) {
+    if (pool == NULL) {
+        return NULL;
+    }
+    KeyTableCache* c = get_keytable_cache();
+    if (c == NULL) {
+        // Rare OOM, fall back to the shared free list.
+        if (pool->free_keytables) {
+            BAIDU_SCOPED_LOCK(pool->mutex);
+            KeyTable* p = (KeyTable*)pool->free_keytables;
+            if (p) {
+                pool->free_keytables = p->next;
+                return p;
+            }
+        }
+        return NULL;
+    }
+    std::unique_lock<pthread_mutex_t> mu(c->mutex);
+    if (c->pool == pool && c->free_list != NULL) {
+        KeyTable* p = c->free_list;
+        c->free_list = p->next;
+        --c->nfree;
+        return p;
+    }
+    if (pool->free_keytables == NULL) {  // intended rough check
+        return NULL;
+    }
+    if (c->pool != pool) {
+        if (c->pool != NULL) {
+            flush_keytable_cache(c);
+        }
+        c->pool = pool;
+    }
+    // Refill a batch: first table goes to the caller, the rest into the
+    // cache so following borrows don't touch pool->mutex.
+    BAIDU_SCOPED_LOCK(pool->mutex);
+    KeyTable* first = (KeyTable*)pool->free_keytables;
+    if (first != NULL) {
+        pool->free_keytables = first->next;
+        for (size_t i = 1; i < KEYTABLE_CACHE_BATCH &&
+                 pool->free_keytables != NULL; ++i) {
+            KeyTable* p = (KeyTable*)pool->free_keytables;
             pool->free_keytables = p->next;
-            return p;
+            p->next = c->free_list;
+            c->free_list = p;
+            ++c->nfree;
         }
     }
-    return NULL;
+    return first;
 }
 
 // Referenced in task_group.cpp, must be extern.
@@ -226,14 +368,53 @@ void return_keytable(bthread_keytable_pool_t* pool, KeyTable* kt) {
         delete kt;
         return;
     }
-    std::unique_lock<pthread_mutex_t> mu(pool->mutex);
-    if (pool->destroyed) {
-        mu.unlock();
-        delete kt;
+    KeyTableCache* c = get_keytable_cache();
+    if (c == NULL) {
+        // Rare OOM, fall back to the shared free list.
+        std::unique_lock<pthread_mutex_t> mu(pool->mutex);
+        if (pool->destroyed) {
+            mu.unlock();
+            delete kt;
+            return;
+        }
+        kt->next = (KeyTable*)pool->free_keytables;
+        pool->free_keytables = kt;
+        return;
+    }
+    std::unique_lock<pthread_mutex_t> mu(c->mutex);
+    if (c->pool != pool) {
+        if (c->pool != NULL) {
+            flush_keytable_cache(c);
+        }
+        c->pool = pool;
+    }
+    kt->next = c->free_list;
+    c->free_list = kt;
+    if (++c->nfree < KEYTABLE_CACHE_MAX) {
         return;
     }
-    kt->next = (KeyTable*)pool->free_keytables;
-    pool->free_keytables = kt;
+    // Spill a batch back so other workers can refill from the pool.
+    KeyTable* head = c->free_list;
+    KeyTable* tail = head;
+    for (size_t i = 1; i < KEYTABLE_CACHE_BATCH; ++i) {
+        tail = tail->next;
+    }
+    c->free_list = tail->next;
+    c->nfree -= KEYTABLE_CACHE_BATCH;
+    tail->next = NULL;
+    {
+        std::unique_lock<pthread_mutex_t> mu2(pool->mutex);
+        if (!pool->destroyed) {
+            tail->next = (KeyTable*)pool->free_keytables;
+            pool->free_keytables = head;
+            return;
+        }
+    }
+    while (head) {
+        KeyTable* p = head;
+        head = head->next;
+        delete p;
+    }
 }
 
 static void cleanup_pthread(void* arg) {
@@ -245,6 +426,29 @@ static void cleanup_pthread(void* arg) {
     }
 }
 
+// Referenced in task_group.cpp, must be extern.
+// Destruct data of fast keys in `ls', called when a bthread ends. Unlike
+// ordinary keys whose KeyTable may be cached in a keytable_pool, data of
+// fast keys never survives the bthread.
+void destroy_fast_key_slots(LocalStorage* ls) {
+    for (uint32_t i = 0; i < KEY_FAST_SLOT_NUM; ++i) {
+        KeyFastSlot& s = ls->fast_slots[i];
+        void* const data = s.data;
+        const uint32_t version = s.version;
+        // Reset before calling dtor which may get/set the slot again.
+        s.data = NULL;
+        s.version = 0;
+        if (data != NULL && version == s_fast_key_info[i].version &&
+            s_fast_key_info[i].dtor != NULL) {
+            s_fast_key_info[i].dtor(data, s_fast_key_info[i].dtor_args);
+        }
+    }
+}
+
+static void cleanup_fast_slots_pthread(void*) {
+    destroy_fast_key_slots(&tls_bls);
+}
+
 static void arg_as_dtor(void* data, const void* arg) {
     typedef void (*KeyDtor)(void*);
     return ((KeyDtor)arg)(data);
@@ -299,6 +503,29 @@ int bthread_keytable_pool_destroy(bthread_keytable_pool_t* pool) {
         }
         pool->destroyed = 1;
     }
+    // Collect tables cached by threads as well: the pool is marked
+    // destroyed already, caches racing with us delete their tables on
+    // their own when they see the flag.
+    {
+        BAIDU_SCOPED_LOCK(bthread::s_keytable_cache_list_mutex);
+        for (bthread::KeyTableCache* c = bthread::s_keytable_cache_list;
+             c != NULL; c = c->next) {
+            BAIDU_SCOPED_LOCK(c->mutex);
+            if (c->pool == pool) {
+                if (c->free_list != NULL) {
+                    bthread::KeyTable* tail = c->free_list;
+                    while (tail->next) {
+                        tail = tail->next;
+                    }
+                    tail->next = saved_free_keytables;
+                    saved_free_keytables = c->free_list;
+                    c->free_list = NULL;
+                    c->nfree = 0;
+                }
+                c->pool = NULL;
+            }
+        }
+    }
     // Cheat get/setspecific and destroy the keytables.
     bthread::TaskGroup* const g = bthread::tls_task_group;
     bthread::KeyTable* old_kt = bthread::tls_bls.keytable;
@@ -330,10 +557,23 @@ int bthread_keytable_pool_getstat(bthread_keytable_pool_t* pool,
         LOG(ERROR) << "Param[pool] or Param[stat] is NULL";
         return EINVAL;
     }
-    std::unique_lock<pthread_mutex_t> mu(pool->mutex);
     size_t count = 0;
-    bthread::KeyTable* p = (bthread::KeyTable*)pool->free_keytables;
-    for (; p; p = p->next, ++count) {}
+    {
+        std::unique_lock<pthread_mutex_t> mu(pool->mutex);
+        bthread::KeyTable* p = (bthread::KeyTable*)pool->free_keytables;
+        for (; p; p = p->next, ++count) {}
+    }
+    // Tables cached by threads are free as well.
+    {
+        BAIDU_SCOPED_LOCK(bthread::s_keytable_cache_list_mutex);
+        for (bthread::KeyTableCache* c = bthread::s_keytable_cache_list;
+             c != NULL; c = c->next) {
+            BAIDU_SCOPED_LOCK(c->mutex);
+            if (c->pool == pool) {
+                count += c->nfree;
+            }
+        }
+    }
     stat->nfree = count;
     return 0;
 }
@@ -412,7 +652,59 @@ int bthread_key_create(bthread_key_t* key, void (*dtor)(void*)) {
     }
 }
 
+int bthread_key_create2_fast(bthread_key_t* key,
+                             void (*dtor)(void*, const void*),
+                             const void* dtor_args) {
+    uint32_t slot = 0;
+    {
+        BAIDU_SCOPED_LOCK(bthread::s_key_mutex);
+        if (bthread::nfreefastkey > 0) {
+            slot = bthread::s_free_fast_keys[--bthread::nfreefastkey];
+        } else if (bthread::nfastkey < bthread::KEY_FAST_SLOT_NUM) {
+            slot = bthread::nfastkey++;
+        } else {
+            return EAGAIN;  // as bthread_key_create2 when keys are exhausted.
+        }
+    }
+    bthread::s_fast_key_info[slot].dtor = dtor;
+    bthread::s_fast_key_info[slot].dtor_args = dtor_args;
+    key->index = bthread::KEYS_MAX + slot;
+    key->version = bthread::s_fast_key_info[slot].version;
+    if (key->version == 0) {
+        ++bthread::s_fast_key_info[slot].version;
+        ++key->version;
+    }
+    return 0;
+}
+
+int bthread_key_create_fast(bthread_key_t* key, void (*dtor)(void*)) {
+    if (dtor == NULL) {
+        return bthread_key_create2_fast(key, NULL, NULL);
+    } else {
+        return bthread_key_create2_fast(
+            key, bthread::arg_as_dtor, (const void*)dtor);
+    }
+}
+
 int bthread_key_delete(bthread_key_t key) {
+    if (key.index >= bthread::KEYS_MAX) {
+        const uint32_t slot = key.index - bthread::KEYS_MAX;
+        if (slot < bthread::KEY_FAST_SLOT_NUM &&
+            key.version == bthread::s_fast_key_info[slot].version) {
+            BAIDU_SCOPED_LOCK(bthread::s_key_mutex);
+            if (key.version == bthread::s_fast_key_info[slot].version) {
+                if (++bthread::s_fast_key_info[slot].version == 0) {
+                    ++bthread::s_fast_key_info[slot].version;
+                }
+                bthread::s_fast_key_info[slot].dtor = NULL;
+                bthread::s_fast_key_info[slot].dtor_args = NULL;
+                bthread::s_free_fast_keys[bthread::nfreefastkey++] = slot;
+                return 0;
+            }
+        }
+        CHECK(false) << "bthread_key_delete is called on invalid " << key;
+        return EINVAL;
+    }
     if (key.index < bthread::KEYS_MAX &&
         key.version == bthread::s_key_info[key.index].version) {
         BAIDU_SCOPED_LOCK(bthread::s_key_mutex);
@@ -436,6 +728,25 @@ int bthread_key_delete(bthread_key_t key) {
 //  -> bthread_setspecific succeeds to borrow_keytable and overwrites old data
 //     at the position with newly created data, the old data is leaked.
 int bthread_setspecific(bthread_key_t key, void* data) {
+    if (key.index >= bthread::KEYS_MAX) {
+        const uint32_t slot = key.index - bthread::KEYS_MAX;
+        if (slot >= bthread::KEY_FAST_SLOT_NUM ||
+            key.version != bthread::s_fast_key_info[slot].version) {
+            CHECK(false) << "bthread_setspecific is called on invalid " << key;
+            return EINVAL;
+        }
+        bthread::KeyFastSlot& s = bthread::tls_bls.fast_slots[slot];
+        s.data = data;
+        s.version = key.version;
+        if (!bthread::tls_ever_set_fast_slot) {
+            bthread::tls_ever_set_fast_slot = true;
+            // bthreads are cleaned in task_group.cpp; this covers pthreads
+            // which may never create a KeyTable.
+            CHECK_EQ(0, butil::thread_atexit(
+                         bthread::cleanup_fast_slots_pthread, NULL));
+        }
+        return 0;
+    }
     bthread::KeyTable* kt = bthread::tls_bls.keytable;
     if (NULL == kt) {
         kt = new (std::nothrow) bthread::KeyTable;
@@ -456,6 +767,17 @@ int bthread_setspecific(bthread_key_t key, void* data) {
 }
 
 void* bthread_getspecific(bthread_key_t key) {
+    if (key.index >= bthread::KEYS_MAX) {
+        // Fast keys: a single load, no KeyTable indirections.
+        const uint32_t slot = key.index - bthread::KEYS_MAX;
+        if (slot < bthread::KEY_FAST_SLOT_NUM) {
+            const bthread::KeyFastSlot& s = bthread::tls_bls.fast_slots[slot];
+            if (s.version == key.version) {
+                return s.data;
+            }
+        }
+        return NULL;
+    }
     bthread::KeyTable* kt = bthread::tls_bls.keytable;
     if (kt) {
         return kt->get_data(key);
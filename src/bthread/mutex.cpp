@@ -23,6 +23,10 @@
 #include <execinfo.h>
 #include <dlfcn.h>                               // dlsym
 #include <fcntl.h>                               // O_RDONLY
+#include <algorithm>                             // std::min
+#include <ostream>
+#include <vector>
+#include <gflags/gflags.h>
 #include "butil/atomicops.h"
 #include "bvar/bvar.h"
 #include "bvar/collector.h"
@@ -42,12 +46,16 @@
 #include "bthread/mutex.h"                       // bthread_mutex_t
 #include "bthread/sys_futex.h"
 #include "bthread/log.h"
+#include "bthread/task_group.h"                  // TaskGroup, TaskMeta
 
 extern "C" {
 extern void* _dl_sym(void* handle, const char* symbol, void* caller);
 }
 
 namespace bthread {
+
+extern BAIDU_THREAD_LOCAL TaskGroup* tls_task_group;
+
 // Warm up backtrace before main().
 void* dummy_buf[4];
 const int ALLOW_UNUSED dummy_bt = backtrace(dummy_buf, arraysize(dummy_buf));
@@ -611,6 +619,129 @@ BUTIL_FORCE_INLINE int pthread_mutex_unlock_impl(pthread_mutex_t* mutex) {
     return rc;
 }
 
+// ------------- Always-on sampled recorder of bthread mutexes -------------
+// Unlike the start/stop contention profiler above, this recorder is cheap
+// enough to stay enabled in production: 1 out of every
+// FLAGS_bthread_contention_recorder_sample_rate contended lockings of a
+// bthread mutex is timed and pushed into a per-thread ring buffer which
+// /contentions/bthread dumps as plain text. It answers "which bthread
+// mutexes are hot right now" without starting a profiler first.
+
+DEFINE_int32(bthread_contention_recorder_sample_rate, 64,
+             "Record 1 out of so many contended lockings of bthread mutexes "
+             "and show them at /contentions/bthread, 0 disables recording");
+
+struct ContentionRecord {
+    bthread_mutex_t* mutex;  // identifies the lock, never dereferenced
+    void* caller;            // return address of bthread_mutex_(timed)lock
+    int64_t duration_ns;     // time blocked in the contended locking
+    int64_t time_us;         // gettimeofday_us() when the record was made
+};
+
+const size_t CONTENTION_RECORD_RING_CAP = 256;
+
+struct BAIDU_CACHELINE_ALIGNMENT ContentionRecordRing {
+    pthread_t owner;
+    // Total number of records ever pushed into this ring.
+    // records[(ntotal - 1) % CAP] is the newest one.
+    butil::atomic<size_t> ntotal;
+    ContentionRecord records[CONTENTION_RECORD_RING_CAP];
+};
+
+// Rings are registered once and never deleted so that the dumping thread
+// may read them without caring about exits of recording threads. The vector
+// is only mutated under the mutex; records themselves are read racily by
+// the dump, which may yield an occasional torn record -- acceptable for a
+// diagnosing page.
+static pthread_mutex_t g_record_ring_mutex = PTHREAD_MUTEX_INITIALIZER;
+static std::vector<ContentionRecordRing*>* g_record_rings = NULL;
+static __thread ContentionRecordRing* tls_record_ring = NULL;
+static __thread int tls_record_countdown = 0;
+
+// True for 1 out of every FLAGS_bthread_contention_recorder_sample_rate
+// calls in this thread.
+inline bool is_contention_recorded() {
+    const int rate = FLAGS_bthread_contention_recorder_sample_rate;
+    if (rate <= 0) {
+        return false;
+    }
+    if (++tls_record_countdown < rate) {
+        return false;
+    }
+    tls_record_countdown = 0;
+    return true;
+}
+
+static void record_contention(bthread_mutex_t* m, void* caller,
+                              int64_t duration_ns) {
+    ContentionRecordRing* ring = tls_record_ring;
+    if (NULL == ring) {
+        ring = new (std::nothrow) ContentionRecordRing;
+        if (NULL == ring) {
+            return;
+        }
+        memset(ring, 0, sizeof(*ring));
+        ring->owner = pthread_self();
+        tls_inside_lock = true;  // push_back may allocate and lock inside
+        pthread_mutex_lock(&g_record_ring_mutex);
+        if (NULL == g_record_rings) {
+            g_record_rings = new std::vector<ContentionRecordRing*>;
+        }
+        g_record_rings->push_back(ring);
+        pthread_mutex_unlock(&g_record_ring_mutex);
+        tls_inside_lock = false;
+        tls_record_ring = ring;
+    }
+    const size_t ntotal = ring->ntotal.load(butil::memory_order_relaxed);
+    ContentionRecord& r = ring->records[ntotal % CONTENTION_RECORD_RING_CAP];
+    r.mutex = m;
+    r.caller = caller;
+    r.duration_ns = duration_ns;
+    r.time_us = butil::gettimeofday_us();
+    // Publish after the fields are filled so that the dumping thread never
+    // treats a half-written record as valid.
+    ring->ntotal.store(ntotal + 1, butil::memory_order_release);
+}
+
+// Called from /contentions/bthread in brpc.
+void print_contention_records(std::ostream& os) {
+    const int rate = FLAGS_bthread_contention_recorder_sample_rate;
+    if (rate <= 0) {
+        os << "Recording is disabled, set -bthread_contention_recorder_"
+            "sample_rate to a positive number to enable\n";
+        return;
+    }
+    std::vector<ContentionRecordRing*> rings;
+    {
+        pthread_mutex_lock(&g_record_ring_mutex);
+        if (g_record_rings != NULL) {
+            rings = *g_record_rings;
+        }
+        pthread_mutex_unlock(&g_record_ring_mutex);
+    }
+    const int64_t now_us = butil::gettimeofday_us();
+    os << "sample_rate: 1/" << rate
+       << "\nrecording_threads: " << rings.size() << '\n';
+    for (size_t i = 0; i < rings.size(); ++i) {
+        const ContentionRecordRing* ring = rings[i];
+        const size_t ntotal = ring->ntotal.load(butil::memory_order_acquire);
+        const size_t n = std::min(ntotal, CONTENTION_RECORD_RING_CAP);
+        os << "\nthread=" << ring->owner << " sampled=" << ntotal << '\n';
+        for (size_t j = 0; j < n; ++j) {  // newest first
+            const ContentionRecord& r =
+                ring->records[(ntotal - 1 - j) % CONTENTION_RECORD_RING_CAP];
+            os << "mutex=" << (void*)r.mutex << " wait_ns=" << r.duration_ns
+               << " age_us=" << now_us - r.time_us
+               << " caller=" << r.caller;
+            Dl_info info;
+            if (dladdr(r.caller, &info) != 0 && info.dli_sname != NULL) {
+                os << ' ' << info.dli_sname;
+            }
+            os << '\n';
+        }
+    }
+}
+
 // Implement bthread_mutex_t related functions
 struct MutexInternal {
     butil::static_atomic<unsigned char> locked;
@@ -628,9 +759,44 @@ const MutexInternal MUTEX_LOCKED_RAW = {{1},{0},0};
 BAIDU_CASSERT(sizeof(unsigned) == sizeof(MutexInternal),
               sizeof_mutex_internal_must_equal_unsigned);
 
+// Remember the holder of `m' for priority inheritance, 0 when the holder
+// is a pthread. Called right after the lock is grabbed.
+inline void set_mutex_owner(bthread_mutex_t* m) {
+    TaskGroup* g = tls_task_group;
+    m->owner = (g != NULL && !g->is_current_main_task()) ?
+        g->current_tid() : 0;
+}
+
+// Boost the holder of `m' to at least `priority' so that it is scheduled
+// ahead of ordinary ready bthreads and leaves its critical section sooner
+// instead of inverting latency of higher-priority waiters. Racing with a
+// release is harmless: a stale boost is cleared when the boosted bthread
+// unlocks or when its TaskMeta is reused.
+inline void boost_mutex_owner(bthread_mutex_t* m, int priority) {
+    const bthread_t owner = m->owner;
+    if (owner == 0 || priority <= 0) {
+        return;
+    }
+    TaskMeta* om = TaskGroup::address_meta(owner);
+    if (om == NULL) {
+        return;
+    }
+    int cur = om->boosted_priority.load(butil::memory_order_relaxed);
+    while (cur < priority &&
+           !om->boosted_priority.compare_exchange_weak(
+               cur, priority, butil::memory_order_relaxed)) {
+    }
+}
+
 inline int mutex_lock_contended(bthread_mutex_t* m) {
     butil::atomic<unsigned>* whole = (butil::atomic<unsigned>*)m->butex;
+    TaskGroup* g = tls_task_group;
+    TaskMeta* const self_meta = (g != NULL && !g->is_current_main_task()) ?
+        g->current_task() : NULL;
     while (whole->exchange(BTHREAD_MUTEX_CONTENDED) & BTHREAD_MUTEX_LOCKED) {
+        if (self_meta != NULL) {
+            boost_mutex_owner(m, self_meta->effective_priority());
+        }
         if (bthread::butex_wait(whole, BTHREAD_MUTEX_CONTENDED, NULL) < 0 &&
             errno != EWOULDBLOCK && errno != EINTR/*note*/) {
             // a mutex lock should ignore interrruptions in general since
@@ -638,13 +804,20 @@ inline int mutex_lock_contended(bthread_mutex_t* m) {
             return errno;
         }
     }
+    set_mutex_owner(m);
     return 0;
 }
 
 inline int mutex_timedlock_contended(
     bthread_mutex_t* m, const struct timespec* __restrict abstime) {
     butil::atomic<unsigned>* whole = (butil::atomic<unsigned>*)m->butex;
+    TaskGroup* g = tls_task_group;
+    TaskMeta* const self_meta = (g != NULL && !g->is_current_main_task()) ?
+        g->current_task() : NULL;
     while (whole->exchange(BTHREAD_MUTEX_CONTENDED) & BTHREAD_MUTEX_LOCKED) {
+        if (self_meta != NULL) {
+            boost_mutex_owner(m, self_meta->effective_priority());
+        }
         if (bthread::butex_wait(whole, BTHREAD_MUTEX_CONTENDED, abstime) < 0 &&
             errno != EWOULDBLOCK && errno != EINTR/*note*/) {
             // a mutex lock should ignore interrruptions in general since
@@ -652,6 +825,7 @@ inline int mutex_timedlock_contended(
             return errno;
         }
     }
+    set_mutex_owner(m);
     return 0;
 }
 
@@ -705,6 +879,7 @@ int bthread_mutex_init(bthread_mutex_t* __restrict m,
         return ENOMEM;
     }
     *m->butex = 0;
+    m->owner = 0;
     return 0;
 }
 
@@ -716,6 +891,7 @@ int bthread_mutex_destroy(bthread_mutex_t* m) {
 int bthread_mutex_trylock(bthread_mutex_t* m) {
     bthread::MutexInternal* split = (bthread::MutexInternal*)m->butex;
     if (!split->locked.exchange(1, butil::memory_order_acquire)) {
+        bthread::set_mutex_owner(m);
         return 0;
     }
     return EBUSY;
@@ -728,15 +904,17 @@ int bthread_mutex_lock_contended(bthread_mutex_t* m) {
 int bthread_mutex_lock(bthread_mutex_t* m) {
     bthread::MutexInternal* split = (bthread::MutexInternal*)m->butex;
     if (!split->locked.exchange(1, butil::memory_order_acquire)) {
+        bthread::set_mutex_owner(m);
         return 0;
     }
+    const bool recorded = bthread::is_contention_recorded();
     // Don't sample when contention profiler is off.
-    if (!bthread::g_cp) {
-        return bthread::mutex_lock_contended(m);
+    size_t sampling_range = 0;
+    if (bthread::g_cp) {
+        // Ask Collector if this (contended) locking should be sampled.
+        sampling_range = bvar::is_collectable(&bthread::g_cp_sl);
     }
-    // Ask Collector if this (contended) locking should be sampled.
-    const size_t sampling_range = bvar::is_collectable(&bthread::g_cp_sl);
-    if (!sampling_range) { // Don't sample
+    if (!recorded && !sampling_range) { // Don't time the locking
         return bthread::mutex_lock_contended(m);
     }
     // Start sampling.
@@ -744,8 +922,12 @@ int bthread_mutex_lock(bthread_mutex_t* m) {
     // NOTE: Don't modify m->csite outside lock since multiple threads are
     // still contending with each other.
     const int rc = bthread::mutex_lock_contended(m);
-    if (!rc) { // Inside lock
-        m->csite.duration_ns = butil::cpuwide_time_ns() - start_ns;
+    const int64_t duration_ns = butil::cpuwide_time_ns() - start_ns;
+    if (recorded) {
+        bthread::record_contention(m, __builtin_return_address(0), duration_ns);
+    }
+    if (!rc && sampling_range) { // Inside lock
+        m->csite.duration_ns = duration_ns;
         m->csite.sampling_range = sampling_range;
     } // else rare
     return rc;
@@ -755,15 +937,17 @@ int bthread_mutex_timedlock(bthread_mutex_t* __restrict m,
                             const struct timespec* __restrict abstime) {
     bthread::MutexInternal* split = (bthread::MutexInternal*)m->butex;
     if (!split->locked.exchange(1, butil::memory_order_acquire)) {
+        bthread::set_mutex_owner(m);
         return 0;
     }
+    const bool recorded = bthread::is_contention_recorded();
     // Don't sample when contention profiler is off.
-    if (!bthread::g_cp) {
-        return bthread::mutex_timedlock_contended(m, abstime);
+    size_t sampling_range = 0;
+    if (bthread::g_cp) {
+        // Ask Collector if this (contended) locking should be sampled.
+        sampling_range = bvar::is_collectable(&bthread::g_cp_sl);
     }
-    // Ask Collector if this (contended) locking should be sampled.
-    const size_t sampling_range = bvar::is_collectable(&bthread::g_cp_sl);
-    if (!sampling_range) { // Don't sample
+    if (!recorded && !sampling_range) { // Don't time the locking
         return bthread::mutex_timedlock_contended(m, abstime);
     }
     // Start sampling.
@@ -771,12 +955,18 @@ int bthread_mutex_timedlock(bthread_mutex_t* __restrict m,
     // NOTE: Don't modify m->csite outside lock since multiple threads are
     // still contending with each other.
     const int rc = bthread::mutex_timedlock_contended(m, abstime);
+    const int64_t end_ns = butil::cpuwide_time_ns();
+    if (recorded) {
+        bthread::record_contention(m, __builtin_return_address(0),
+                                   end_ns - start_ns);
+    }
     if (!rc) { // Inside lock
-        m->csite.duration_ns = butil::cpuwide_time_ns() - start_ns;
-        m->csite.sampling_range = sampling_range;
-    } else if (rc == ETIMEDOUT) {
+        if (sampling_range) {
+            m->csite.duration_ns = end_ns - start_ns;
+            m->csite.sampling_range = sampling_range;
+        }
+    } else if (rc == ETIMEDOUT && sampling_range) {
         // Failed to lock due to ETIMEDOUT, submit the elapse directly.
-        const int64_t end_ns = butil::cpuwide_time_ns();
         const bthread_contention_site_t csite = {end_ns - start_ns, sampling_range};
         bthread::submit_contention(csite, end_ns);
     }
@@ -790,6 +980,18 @@ int bthread_mutex_unlock(bthread_mutex_t* m) {
         saved_csite = m->csite;
         bthread::make_contention_site_invalid(&m->csite);
     }
+    // Drop the owner and any priority inherited from waiters before the
+    // lock becomes grabbable, the boost belongs to the critical section
+    // only. With several mutexes held this is approximate: waiters of the
+    // still-held ones boost again before every butex_wait.
+    m->owner = 0;
+    {
+        bthread::TaskGroup* g = bthread::tls_task_group;
+        if (g != NULL && !g->is_current_main_task()) {
+            g->current_task()->boosted_priority.store(
+                0, butil::memory_order_relaxed);
+        }
+    }
     const unsigned prev = whole->exchange(0, butil::memory_order_release);
     // CAUTION: the mutex may be destroyed, check comments before butex_create
     if (prev == BTHREAD_MUTEX_LOCKED) {
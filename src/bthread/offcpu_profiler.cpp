@@ -0,0 +1,323 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <execinfo.h>
+#include <fcntl.h>
+#include <math.h>
+#include "butil/containers/flat_map.h"
+#include "butil/fd_guard.h"
+#include "butil/file_util.h"
+#include "butil/files/file.h"
+#include "butil/files/file_path.h"
+#include "butil/iobuf.h"
+#include "butil/logging.h"
+#include "butil/macros.h"
+#include "butil/object_pool.h"
+#include "butil/third_party/murmurhash3/murmurhash3.h"
+#include "butil/time.h"
+#include "bvar/collector.h"
+#include "bthread/offcpu_profiler.h"
+
+namespace bthread {
+
+// Modeled on the contention profiler in mutex.cpp: samples are speed
+// limited by the collector, deduplicated by their stacktrace and written
+// in the contention profile format understood by pprof.
+
+// For controlling off-CPU samples collected per second.
+static bvar::CollectorSpeedLimit g_ocp_sl = BVAR_COLLECTOR_SPEED_LIMIT_INITIALIZER;
+
+const size_t MAX_CACHED_OFFCPU_SAMPLES = 512;
+// Skip frames which are always same: the butex_wait/usleep wrapper and
+// SubmitOffCpuSample().
+const int OFFCPU_SKIPPED_STACK_FRAMES = 2;
+
+struct SampledOffCpu : public bvar::Collected {
+    // Time the bthread stayed blocked, normalized by sampling_range.
+    int64_t duration_ns;
+    // Number of samples, normalized by sampling_range.
+    double count;
+    int nframes;          // #elements in stack
+    void* stack[26];      // backtrace of the blocking callsite.
+
+    // Implement bvar::Collected
+    void dump_and_destroy(size_t round) override;
+    void destroy() override;
+    bvar::CollectorSpeedLimit* speed_limit() override { return &g_ocp_sl; }
+
+    size_t hash_code() const {
+        if (nframes == 0) {
+            return 0;
+        }
+        uint32_t code = 1;
+        uint32_t seed = nframes;
+        butil::MurmurHash3_x86_32(stack, sizeof(void*) * nframes, seed, &code);
+        return code;
+    }
+};
+
+BAIDU_CASSERT(sizeof(SampledOffCpu) == 256, be_friendly_to_allocator);
+
+struct OffCpuEqual {
+    bool operator()(const SampledOffCpu* c1, const SampledOffCpu* c2) const {
+        return c1->hash_code() == c2->hash_code() &&
+            c1->nframes == c2->nframes &&
+            memcmp(c1->stack, c2->stack, sizeof(void*) * c1->nframes) == 0;
+    }
+};
+
+struct OffCpuHash {
+    size_t operator()(const SampledOffCpu* c) const {
+        return c->hash_code();
+    }
+};
+
+// The global context of the off-CPU profiler.
+class OffCpuProfiler {
+public:
+    typedef butil::FlatMap<SampledOffCpu*, SampledOffCpu*,
+                           OffCpuHash, OffCpuEqual> SampleMap;
+
+    explicit OffCpuProfiler(const char* name);
+    ~OffCpuProfiler();
+
+    void dump_and_destroy(SampledOffCpu* c);
+
+    // Write buffered data into the resulting file. If `ending' is true,
+    // append content of /proc/self/maps and retry writing until the buffer
+    // is empty.
+    void flush_to_disk(bool ending);
+
+    void init_if_needed();
+private:
+    bool _init;             // false before first dump_and_destroy.
+    bool _first_write;      // true if buffer was not written to file yet.
+    std::string _filename;  // the file storing profiling result.
+    butil::IOBuf _disk_buf; // temp buf before saving the file.
+    SampleMap _dedup_map;   // combining same samples to make result smaller.
+};
+
+OffCpuProfiler::OffCpuProfiler(const char* name)
+    : _init(false)
+    , _first_write(true)
+    , _filename(name) {
+}
+
+OffCpuProfiler::~OffCpuProfiler() {
+    if (!_init) {
+        // Don't write file if dump_and_destroy was never called. We may
+        // create such instances in OffCpuProfilerStart.
+        return;
+    }
+    flush_to_disk(true);
+}
+
+void OffCpuProfiler::init_if_needed() {
+    if (!_init) {
+        // Already nanoseconds, set cycles/second to 1000000000. The file
+        // claims to be a contention profile so that pprof and flamegraph
+        // tools need no change to read wait-time attribution.
+        _disk_buf.append("--- contention\ncycles/second=1000000000\n");
+        CHECK_EQ(0, _dedup_map.init(1024, 60));
+        _init = true;
+    }
+}
+
+void OffCpuProfiler::dump_and_destroy(SampledOffCpu* c) {
+    init_if_needed();
+    SampledOffCpu** p_c2 = _dedup_map.seek(c);
+    if (p_c2) {
+        SampledOffCpu* c2 = *p_c2;
+        c2->duration_ns += c->duration_ns;
+        c2->count += c->count;
+        c->destroy();
+    } else {
+        _dedup_map.insert(c, c);
+    }
+    if (_dedup_map.size() > MAX_CACHED_OFFCPU_SAMPLES) {
+        flush_to_disk(false);
+    }
+}
+
+void OffCpuProfiler::flush_to_disk(bool ending) {
+    // Serialize samples in _dedup_map into _disk_buf.
+    if (!_dedup_map.empty()) {
+        butil::IOBufBuilder os;
+        for (SampleMap::const_iterator
+                 it = _dedup_map.begin(); it != _dedup_map.end(); ++it) {
+            SampledOffCpu* c = it->second;
+            os << c->duration_ns << ' ' << (size_t)ceil(c->count) << " @";
+            for (int i = OFFCPU_SKIPPED_STACK_FRAMES; i < c->nframes; ++i) {
+                os << ' ' << (void*)c->stack[i];
+            }
+            os << '\n';
+            c->destroy();
+        }
+        _dedup_map.clear();
+        _disk_buf.append(os.buf());
+    }
+
+    // Append /proc/self/maps to the end of the file, required by pprof.pl,
+    // otherwise the functions in sys libs are not interpreted.
+    if (ending) {
+        butil::IOPortal mem_maps;
+        const butil::fd_guard fd(open("/proc/self/maps", O_RDONLY));
+        if (fd >= 0) {
+            while (true) {
+                ssize_t nr = mem_maps.append_from_file_descriptor(fd, 8192);
+                if (nr < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    PLOG(ERROR) << "Fail to read /proc/self/maps";
+                    break;
+                }
+                if (nr == 0) {
+                    _disk_buf.append(mem_maps);
+                    break;
+                }
+            }
+        } else {
+            PLOG(ERROR) << "Fail to open /proc/self/maps";
+        }
+    }
+    // Write _disk_buf into _filename
+    butil::File::Error error;
+    butil::FilePath path(_filename);
+    butil::FilePath dir = path.DirName();
+    if (!butil::CreateDirectoryAndGetError(dir, &error)) {
+        LOG(ERROR) << "Fail to create directory=`" << dir.value()
+                   << "', " << error;
+        return;
+    }
+    // Truncate on first write, append on later writes.
+    int flag = O_APPEND;
+    if (_first_write) {
+        _first_write = false;
+        flag = O_TRUNC;
+    }
+    butil::fd_guard fd(open(_filename.c_str(), O_WRONLY|O_CREAT|flag, 0666));
+    if (fd < 0) {
+        PLOG(ERROR) << "Fail to open " << _filename;
+        return;
+    }
+    // Write once normally, write until empty in the end.
+    do {
+        ssize_t nw = _disk_buf.cut_into_file_descriptor(fd);
+        if (nw < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            PLOG(ERROR) << "Fail to write into " << _filename;
+            return;
+        }
+    } while (!_disk_buf.empty() && ending);
+}
+
+// Set with a valid instance when the off-CPU profiler is on, NULL
+// otherwise.
+static OffCpuProfiler* BAIDU_CACHELINE_ALIGNMENT g_ocp = NULL;
+// Protecting accesss to g_ocp.
+static pthread_mutex_t g_ocp_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void SampledOffCpu::dump_and_destroy(size_t /*round*/) {
+    if (g_ocp) {
+        // Must be protected with the mutex to avoid race with deletion of
+        // ctx. dump_and_destroy is called from the dumping thread only so
+        // the mutex is not contended at most of time.
+        BAIDU_SCOPED_LOCK(g_ocp_mutex);
+        if (g_ocp) {
+            g_ocp->dump_and_destroy(this);
+            return;
+        }
+    }
+    destroy();
+}
+
+void SampledOffCpu::destroy() {
+    butil::return_object(this);
+}
+
+bool OffCpuProfilerStart(const char* filename) {
+    if (filename == NULL) {
+        LOG(ERROR) << "Parameter [filename] is NULL";
+        return false;
+    }
+    // g_ocp is also the flag marking start/stop.
+    if (g_ocp) {
+        return false;
+    }
+    // Create the related bvar lazily.
+    static bvar::DisplaySamplingRatio g_sampling_ratio_var(
+        "offcpu_profiler_sampling_ratio", &g_ocp_sl);
+
+    // Optimistic locking. A not-used OffCpuProfiler does not write file.
+    std::unique_ptr<OffCpuProfiler> ctx(new OffCpuProfiler(filename));
+    {
+        BAIDU_SCOPED_LOCK(g_ocp_mutex);
+        if (g_ocp) {
+            return false;
+        }
+        g_ocp = ctx.release();
+    }
+    return true;
+}
+
+void OffCpuProfilerStop() {
+    OffCpuProfiler* ctx = NULL;
+    if (g_ocp) {
+        std::unique_lock<pthread_mutex_t> mu(g_ocp_mutex);
+        if (g_ocp) {
+            ctx = g_ocp;
+            g_ocp = NULL;
+            mu.unlock();
+
+            // make sure it's initialized in case no sample was gathered,
+            // otherwise nothing will be written and succeeding pprof fails.
+            ctx->init_if_needed();
+            // Deletion is safe because usages of g_ocp are inside
+            // g_ocp_mutex.
+            delete ctx;
+            return;
+        }
+    }
+    LOG(ERROR) << "Off-CPU profiler is not started!";
+}
+
+size_t StartOffCpuSampling() {
+    if (g_ocp == NULL) {
+        return 0;
+    }
+    return bvar::is_collectable(&g_ocp_sl);
+}
+
+void SubmitOffCpuSample(size_t sampling_range, int64_t duration_ns) {
+    SampledOffCpu* sc = butil::get_object<SampledOffCpu>();
+    if (NULL == sc) {
+        return;
+    }
+    // Normalize duration_ns and count so that they're addable in later
+    // processings. Notice that sampling_range is adjusted periodically by
+    // the collecting thread.
+    sc->duration_ns = duration_ns * bvar::COLLECTOR_SAMPLING_BASE
+        / sampling_range;
+    sc->count = bvar::COLLECTOR_SAMPLING_BASE / (double)sampling_range;
+    sc->nframes = backtrace(sc->stack, arraysize(sc->stack));
+    sc->submit(butil::gettimeofday_us());
+}
+
+}  // namespace bthread
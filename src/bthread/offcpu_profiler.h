@@ -0,0 +1,55 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef BTHREAD_OFFCPU_PROFILER_H
+#define BTHREAD_OFFCPU_PROFILER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace bthread {
+
+// The off-CPU(wait) profiler attributes time that bthreads spend blocked
+// - butex waits(mutex/condition/rpc joins/fd waits) and bthread_usleep -
+// to the callsites that blocked, complementing the CPU profiler which only
+// sees running code. Samples are rate-limited by the same collector
+// mechanism as the contention profiler, giving production-safe overhead,
+// and the result file uses the contention profile format so that pprof
+// and flamegraph tooling work unchanged. Browse /hotspots/offcpu of the
+// builtin services to use it.
+
+// Start dumping off-CPU samples into `filename'.
+// Returns false when a profiler is already running or filename is NULL.
+bool OffCpuProfilerStart(const char* filename);
+
+// Stop the off-CPU profiler and flush remaining samples into the file.
+void OffCpuProfilerStop();
+
+// Returns a non-zero sampling range when the blocking operation about to
+// happen should be sampled, 0 when the profiler is off or the sample is
+// skipped by the speed limit. Cheap enough to be called before every
+// butex_wait.
+size_t StartOffCpuSampling();
+
+// Record a wait of `duration_ns'. The backtrace is taken here, thus must
+// be called on the stack that blocked(right after the wait returns).
+// Only call with a non-zero result of StartOffCpuSampling().
+void SubmitOffCpuSample(size_t sampling_range, int64_t duration_ns);
+
+}  // namespace bthread
+
+#endif  // BTHREAD_OFFCPU_PROFILER_H
@@ -54,6 +54,14 @@ public:
         return _pending_signal.load(butil::memory_order_acquire);
     }
 
+    // True iff the state differs from `expected_state', namely new signals
+    // arrived or the lot was stopped. Cheap enough to be called in a spin
+    // loop before wait().
+    bool changed(const State& expected_state) {
+        return _pending_signal.load(butil::memory_order_acquire)
+            != expected_state.val;
+    }
+
     // Wait for tasks.
     // If the `expected_state' does not match, wait() may finish directly.
     void wait(const State& expected_state) {
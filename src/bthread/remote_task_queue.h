@@ -22,8 +22,10 @@
 #ifndef BTHREAD_REMOTE_TASK_QUEUE_H
 #define BTHREAD_REMOTE_TASK_QUEUE_H
 
-#include "butil/containers/bounded_queue.h"
+#include <stdlib.h>                      // malloc, free
+#include "butil/atomicops.h"
 #include "butil/macros.h"
+#include "bthread/types.h"               // bthread_t
 
 namespace bthread {
 
@@ -31,51 +33,112 @@ class TaskGroup;
 
 // A queue for storing bthreads created by non-workers. Since non-workers
 // randomly choose a TaskGroup to push which distributes the contentions,
-// this queue is simply implemented as a queue protected with a lock.
+// this used to be a queue protected with a lock. The lock (and the
+// cacheline ping-pong between pushers and the popping worker) still showed
+// up in profiles of cross-thread wakeup heavy servers, thus the queue is
+// now a bounded lock-free ring (Vyukov-style MPMC: each cell carries a
+// sequence number that tickets producers and consumers). Multi-consumer is
+// required because idle workers also pop here while stealing.
 // The function names should be self-explanatory.
 class RemoteTaskQueue {
 public:
-    RemoteTaskQueue() {}
+    RemoteTaskQueue() : _cells(NULL), _cap_mask(0), _head(0), _tail(0) {}
+
+    ~RemoteTaskQueue() {
+        free(_cells);
+        _cells = NULL;
+    }
 
     int init(size_t cap) {
-        const size_t memsize = sizeof(bthread_t) * cap;
-        void* q_mem = malloc(memsize);
-        if (q_mem == NULL) {
+        if (cap == 0 || _cells != NULL) {
+            return -1;
+        }
+        // Round up to power of 2 for masking.
+        size_t cap2 = 1;
+        while (cap2 < cap) {
+            cap2 <<= 1;
+        }
+        Cell* cells = (Cell*)malloc(sizeof(Cell) * cap2);
+        if (cells == NULL) {
             return -1;
         }
-        butil::BoundedQueue<bthread_t> q(q_mem, memsize, butil::OWNS_STORAGE);
-        _tasks.swap(q);
+        for (size_t i = 0; i < cap2; ++i) {
+            cells[i].seq.store(i, butil::memory_order_relaxed);
+        }
+        _cells = cells;
+        _cap_mask = cap2 - 1;
         return 0;
     }
 
     bool pop(bthread_t* task) {
-        if (_tasks.empty()) {
-            return false;
+        size_t pos = _head.load(butil::memory_order_relaxed);
+        Cell* c = NULL;
+        for (;;) {
+            c = &_cells[pos & _cap_mask];
+            const size_t seq = c->seq.load(butil::memory_order_acquire);
+            const intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (dif == 0) {
+                if (_head.compare_exchange_weak(
+                        pos, pos + 1, butil::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (dif < 0) {  // the cell was not filled yet, empty.
+                return false;
+            } else {
+                pos = _head.load(butil::memory_order_relaxed);
+            }
         }
-        _mutex.lock();
-        const bool result = _tasks.pop(task);
-        _mutex.unlock();
-        return result;
+        *task = c->value;
+        c->seq.store(pos + _cap_mask + 1, butil::memory_order_release);
+        return true;
     }
 
     bool push(bthread_t task) {
-        _mutex.lock();
-        const bool res = push_locked(task);
-        _mutex.unlock();
-        return res;
+        size_t pos = _tail.load(butil::memory_order_relaxed);
+        Cell* c = NULL;
+        for (;;) {
+            c = &_cells[pos & _cap_mask];
+            const size_t seq = c->seq.load(butil::memory_order_acquire);
+            const intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+            if (dif == 0) {
+                if (_tail.compare_exchange_weak(
+                        pos, pos + 1, butil::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (dif < 0) {  // the cell was not consumed yet, full.
+                return false;
+            } else {
+                pos = _tail.load(butil::memory_order_relaxed);
+            }
+        }
+        c->value = task;
+        c->seq.store(pos + 1, butil::memory_order_release);
+        return true;
     }
 
-    bool push_locked(bthread_t task) {
-        return _tasks.push(task);
+    size_t capacity() const { return _cap_mask + 1; }
+
+    // Approximate number of queued tasks, readable by any thread.
+    size_t volatile_size() const {
+        const size_t t = _tail.load(butil::memory_order_relaxed);
+        const size_t h = _head.load(butil::memory_order_relaxed);
+        return ((intptr_t)(t - h) > 0 ? t - h : 0);
     }
 
-    size_t capacity() const { return _tasks.capacity(); }
-    
 private:
 friend class TaskGroup;
     DISALLOW_COPY_AND_ASSIGN(RemoteTaskQueue);
-    butil::BoundedQueue<bthread_t> _tasks;
-    butil::Mutex _mutex;
+
+    struct Cell {
+        butil::atomic<size_t> seq;
+        bthread_t value;
+    };
+
+    Cell* _cells;
+    size_t _cap_mask;
+    // Pushers and poppers only dirty their own index.
+    BAIDU_CACHELINE_ALIGNMENT butil::atomic<size_t> _head;  // pop side
+    BAIDU_CACHELINE_ALIGNMENT butil::atomic<size_t> _tail;  // push side
 };
 
 }  // namespace bthread
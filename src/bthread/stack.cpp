@@ -23,7 +23,10 @@
 #include <sys/mman.h>                             // mmap, munmap, mprotect
 #include <algorithm>                              // std::max
 #include <stdlib.h>                               // posix_memalign
+#include <map>
+#include <vector>
 #include "butil/macros.h"                          // BAIDU_CASSERT
+#include "butil/synchronization/lock.h"
 #include "butil/memory/singleton_on_pthread_once.h"
 #include "butil/third_party/dynamic_annotations/dynamic_annotations.h" // RunningOnValgrind
 #include "butil/third_party/valgrind/valgrind.h"   // VALGRIND_STACK_REGISTER
@@ -37,6 +40,12 @@ DEFINE_int32(stack_size_large, 8388608, "size of large stacks");
 DEFINE_int32(guard_page_size, 4096, "size of guard page, allocate stacks by malloc if it's 0(not recommended)");
 DEFINE_int32(tc_stack_small, 32, "maximum small stacks cached by each thread");
 DEFINE_int32(tc_stack_normal, 8, "maximum normal stacks cached by each thread");
+DEFINE_int32(stack_arena_mb, 0, "If positive, reserve a continuous region of "
+             "this many megabytes at the first stack allocation and carve "
+             "guarded stacks out of it. Released stacks are decommitted with "
+             "madvise() and reused without entering mmap. 0(default) "
+             "allocates each stack with a separate mmap. Read once at the "
+             "first allocation");
 
 namespace bthread {
 
@@ -53,6 +62,124 @@ static int64_t get_stack_count(void*) {
 static bvar::PassiveStatus<int64_t> bvar_stack_count(
     "bthread_stack_count", get_stack_count, NULL);
 
+static butil::static_atomic<int64_t> s_arena_committed_bytes
+    = BUTIL_STATIC_ATOMIC_INIT(0);
+static int64_t get_arena_committed_bytes(void*) {
+    return s_arena_committed_bytes.load(butil::memory_order_relaxed);
+}
+static bvar::PassiveStatus<int64_t> bvar_arena_committed_bytes(
+    "bthread_stack_arena_committed_bytes", get_arena_committed_bytes, NULL);
+
+// Carves stacks out of one region reserved at the first allocation instead
+// of mmap-ing each of them. The region is reserved with PROT_NONE so that
+// untouched parts cost no memory: a stack is committed by mprotecting its
+// pages to read-write and the page(s) below it are left inaccessible as the
+// guard. Releasing a stack madvises the pages away and puts the block into
+// a free list keeping the pages mapped, thus a burst creating many bthreads
+// after a quiet period re-uses stacks without calling mmap/munmap at all.
+class StackArena {
+public:
+    StackArena() : _base(NULL), _reserved(0), _cursor(0), _failed(false) {}
+
+    // Returns the page-aligned base of a guard+stack block whose first
+    // `guardsize' bytes are inaccessible and remaining `stacksize' bytes
+    // are read-write, or NULL when the region is exhausted or unusable
+    // (caller should fall back to a separate mmap). Both sizes must be
+    // page-aligned.
+    void* allocate(int stacksize, int guardsize) {
+        const int memsize = stacksize + guardsize;
+        BAIDU_SCOPED_LOCK(_mutex);
+        if (_base.load(butil::memory_order_relaxed) == NULL &&
+            !reserve_region()) {
+            return NULL;
+        }
+        std::vector<void*>& free_blocks = _free_blocks[memsize];
+        if (!free_blocks.empty()) {
+            // Pages of a freed block are still read-write, re-committing
+            // is done lazily by the kernel at the first touch.
+            void* mem = free_blocks.back();
+            free_blocks.pop_back();
+            s_arena_committed_bytes.fetch_add(
+                stacksize, butil::memory_order_relaxed);
+            return mem;
+        }
+        if (_cursor + memsize > _reserved) {
+            return NULL;
+        }
+        char* mem = _base.load(butil::memory_order_relaxed) + _cursor;
+        if (mprotect(mem + guardsize, stacksize,
+                     (PROT_READ | PROT_WRITE)) != 0) {
+            PLOG_EVERY_SECOND(ERROR)
+                << "Fail to mprotect " << (void*)(mem + guardsize)
+                << " length=" << stacksize
+                << ", possibly limited by /proc/sys/vm/max_map_count";
+            return NULL;
+        }
+        _cursor += memsize;
+        s_arena_committed_bytes.fetch_add(
+            stacksize, butil::memory_order_relaxed);
+        return mem;
+    }
+
+    // Decommit the stack part of a block returned by allocate() and make
+    // the block reusable. Parameters must equal the ones to allocate().
+    void release(void* mem, int stacksize, int guardsize) {
+#if defined(MADV_FREE)
+        const int advice = MADV_FREE;
+#else
+        const int advice = MADV_DONTNEED;
+#endif
+        if (madvise((char*)mem + guardsize, stacksize, advice) != 0) {
+            PLOG_EVERY_SECOND(WARNING)
+                << "Fail to madvise " << (void*)((char*)mem + guardsize)
+                << " length=" << stacksize;
+        }
+        s_arena_committed_bytes.fetch_sub(
+            stacksize, butil::memory_order_relaxed);
+        BAIDU_SCOPED_LOCK(_mutex);
+        _free_blocks[stacksize + guardsize].push_back(mem);
+    }
+
+    bool contains(const void* mem) const {
+        const char* base = _base.load(butil::memory_order_acquire);
+        return base != NULL && (const char*)mem >= base &&
+            (const char*)mem < base + _reserved;
+    }
+
+private:
+    // Called under _mutex.
+    bool reserve_region() {
+        if (_failed) {
+            return false;
+        }
+        const size_t size = (size_t)FLAGS_stack_arena_mb * 1024 * 1024;
+        // PROT_NONE mappings are not charged against overcommit limits.
+        void* mem = mmap(NULL, size, PROT_NONE,
+                         (MAP_PRIVATE | MAP_ANONYMOUS), -1, 0);
+        if (MAP_FAILED == mem) {
+            PLOG(ERROR) << "Fail to reserve stack arena of " << size
+                        << " bytes, fall back to separate mmaps";
+            _failed = true;
+            return false;
+        }
+        _reserved = size;
+        _base.store((char*)mem, butil::memory_order_release);
+        return true;
+    }
+
+    butil::Mutex _mutex;
+    butil::atomic<char*> _base;
+    size_t _reserved;
+    size_t _cursor;
+    bool _failed;
+    // block size -> released blocks of that size.
+    std::map<int, std::vector<void*> > _free_blocks;
+};
+
+inline StackArena* get_stack_arena() {
+    return butil::get_leaky_singleton<StackArena>();
+}
+
 int allocate_stack_storage(StackStorage* s, int stacksize_in, int guardsize_in) {
     const static int PAGESIZE = getpagesize();
     const int PAGESIZE_M1 = PAGESIZE - 1;
@@ -89,6 +216,23 @@ int allocate_stack_storage(StackStorage* s, int stacksize_in, int guardsize_in)
             ~PAGESIZE_M1;
 
         const int memsize = stacksize + guardsize;
+        if (FLAGS_stack_arena_mb > 0) {
+            void* mem = get_stack_arena()->allocate(stacksize, guardsize);
+            if (mem != NULL) {
+                s_stack_count.fetch_add(1, butil::memory_order_relaxed);
+                s->bottom = (char*)mem + memsize;
+                s->stacksize = stacksize;
+                s->guardsize = guardsize;
+                if (RunningOnValgrind()) {
+                    s->valgrind_stack_id = VALGRIND_STACK_REGISTER(
+                        s->bottom, (char*)s->bottom - stacksize);
+                } else {
+                    s->valgrind_stack_id = 0;
+                }
+                return 0;
+            }
+            // Arena is exhausted or unusable, fall through to mmap.
+        }
         void* const mem = mmap(NULL, memsize, (PROT_READ | PROT_WRITE),
                                (MAP_PRIVATE | MAP_ANONYMOUS), -1, 0);
 
@@ -142,7 +286,12 @@ void deallocate_stack_storage(StackStorage* s) {
     if (s->guardsize <= 0) {
         free((char*)s->bottom - memsize);
     } else {
-        munmap((char*)s->bottom - memsize, memsize);
+        char* const mem = (char*)s->bottom - memsize;
+        if (FLAGS_stack_arena_mb > 0 && get_stack_arena()->contains(mem)) {
+            get_stack_arena()->release(mem, s->stacksize, s->guardsize);
+        } else {
+            munmap(mem, memsize);
+        }
     }
 }
 
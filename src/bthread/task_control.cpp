@@ -19,6 +19,10 @@
 
 // Date: Tue Jul 10 17:40:58 CST 2012
 
+#include <sched.h>                         // sched_setaffinity
+#include <algorithm>                       // std::min
+#include "butil/build_config.h"            // OS_LINUX
+#include "butil/memory/singleton_on_pthread_once.h"
 #include "butil/scoped_lock.h"             // BAIDU_SCOPED_LOCK
 #include "butil/errno.h"                   // berror
 #include "butil/logging.h"
@@ -38,6 +42,16 @@ DEFINE_int32(task_group_runqueue_capacity, 4096,
              "capacity of runqueue in each TaskGroup");
 DEFINE_int32(task_group_yield_before_idle, 0,
              "TaskGroup yields so many times before idle");
+DEFINE_bool(bthread_numa_aware, false,
+            "Bind worker pthreads to NUMA nodes round-robin and prefer "
+            "same-node victims in work stealing, avoiding cross-node "
+            "steals on multi-socket machines");
+DEFINE_int32(bthread_steal_batch_max, 4,
+             "Max number of bthreads stolen from one victim in one steal, "
+             "the first one is run immediately and extra ones are pushed "
+             "into the thief's own runqueue (where they remain stealable). "
+             "At most half of a victim's runqueue is taken regardless of "
+             "this value. 1 steals one bthread at a time as before");
 
 namespace bthread {
 
@@ -55,12 +69,95 @@ void run_worker_startfn() {
     }
 }
 
+#if defined(OS_LINUX)
+// CPUs of one NUMA node, parsed from sysfs.
+struct NumaNodeInfo {
+    cpu_set_t cpus;
+};
+static std::vector<NumaNodeInfo>* g_numa_nodes = NULL;
+static pthread_once_t g_numa_nodes_once = PTHREAD_ONCE_INIT;
+
+// Parse a sysfs cpulist such as "0-15,32-47" into `cpus'.
+// Returns number of cpus on success, -1 otherwise.
+static int parse_cpulist(const char* s, cpu_set_t* cpus) {
+    CPU_ZERO(cpus);
+    int ncpu = 0;
+    const char* p = s;
+    while (*p && *p != '\n') {
+        char* endptr = NULL;
+        const long first = strtol(p, &endptr, 10);
+        if (endptr == p || first < 0 || first >= CPU_SETSIZE) {
+            return -1;
+        }
+        long last = first;
+        p = endptr;
+        if (*p == '-') {
+            last = strtol(p + 1, &endptr, 10);
+            if (endptr == p + 1 || last < first || last >= CPU_SETSIZE) {
+                return -1;
+            }
+            p = endptr;
+        }
+        for (long i = first; i <= last; ++i) {
+            CPU_SET(i, cpus);
+            ++ncpu;
+        }
+        if (*p == ',') {
+            ++p;
+        }
+    }
+    return ncpu;
+}
+
+static void init_numa_topology() {
+    std::vector<NumaNodeInfo>* nodes = new std::vector<NumaNodeInfo>;
+    for (int node = 0; ; ++node) {
+        char path[64];
+        snprintf(path, sizeof(path),
+                 "/sys/devices/system/node/node%d/cpulist", node);
+        FILE* fp = fopen(path, "r");
+        if (fp == NULL) {
+            break;
+        }
+        char line[4096];
+        NumaNodeInfo info;
+        if (fgets(line, sizeof(line), fp) != NULL &&
+            parse_cpulist(line, &info.cpus) > 0) {
+            nodes->push_back(info);
+        }
+        fclose(fp);
+    }
+    g_numa_nodes = nodes;
+}
+#endif  // OS_LINUX
+
+void TaskControl::bind_worker_to_numa_node(TaskGroup* g) {
+#if defined(OS_LINUX)
+    pthread_once(&g_numa_nodes_once, init_numa_topology);
+    if (g_numa_nodes->size() <= 1) {
+        return;
+    }
+    static butil::atomic<size_t> next_node(0);
+    const size_t node = next_node.fetch_add(1, butil::memory_order_relaxed)
+        % g_numa_nodes->size();
+    if (sched_setaffinity(0, sizeof(cpu_set_t),
+                          &(*g_numa_nodes)[node].cpus) != 0) {
+        PLOG(WARNING) << "Fail to bind worker=" << pthread_self()
+                      << " to NUMA node " << node;
+        return;
+    }
+    g->_numa_node = (int)node;
+#else
+    (void)g;
+#endif
+}
+
 void* TaskControl::worker_thread(void* arg) {
-    run_worker_startfn();    
+    run_worker_startfn();
 #ifdef BAIDU_INTERNAL
     logging::ComlogInitializer comlog_initializer;
 #endif
-    
+
     TaskControl* c = static_cast<TaskControl*>(arg);
     TaskGroup* g = c->create_group();
     TaskStatistics stat;
@@ -68,6 +165,9 @@ void* TaskControl::worker_thread(void* arg) {
         LOG(ERROR) << "Fail to create TaskGroup in pthread=" << pthread_self();
         return NULL;
     }
+    if (FLAGS_bthread_numa_aware) {
+        c->bind_worker_to_numa_node(g);
+    }
     BT_VLOG << "Created worker=" << pthread_self()
             << " bthread=" << g->main_tid();
 
@@ -120,6 +220,10 @@ static int64_t get_cumulated_signal_count_from_this(void *arg) {
     return static_cast<TaskControl*>(arg)->get_cumulated_signal_count();
 }
 
+static int64_t get_total_runqueue_size_from_this(void* arg) {
+    return static_cast<TaskControl*>(arg)->get_total_runqueue_size();
+}
+
 TaskControl::TaskControl()
     // NOTE: all fileds must be initialized before the vars.
     : _ngroup(0)
@@ -128,6 +232,7 @@ TaskControl::TaskControl()
     , _concurrency(0)
     , _nworkers("bthread_worker_count")
     , _pending_time(NULL)
+    , _dispatch_time(NULL)
       // Delay exposure of following two vars because they rely on TC which
       // is not initialized yet.
     , _cumulated_worker_time(get_cumulated_worker_time_from_this, this)
@@ -137,6 +242,7 @@ TaskControl::TaskControl()
     , _cumulated_signal_count(get_cumulated_signal_count_from_this, this)
     , _signal_per_second(&_cumulated_signal_count)
     , _status(print_rq_sizes_in_the_tc, this)
+    , _runqueue_size(get_total_runqueue_size_from_this, this)
     , _nbthreads("bthread_count")
 {
     // calloc shall set memory to zero
@@ -172,6 +278,7 @@ int TaskControl::init(int concurrency) {
     _switch_per_second.expose("bthread_switch_second");
     _signal_per_second.expose("bthread_signal_second");
     _status.expose("bthread_group_status");
+    _runqueue_size.expose("bthread_runqueue_size");
 
     // Wait for at least one group is added so that choose_one_group()
     // never returns NULL.
@@ -219,6 +326,17 @@ TaskGroup* TaskControl::choose_one_group() {
     return NULL;
 }
 
+TaskGroup* TaskControl::affinity_group(unsigned affinity) {
+    const size_t ngroup = _ngroup.load(butil::memory_order_acquire);
+    if (ngroup != 0) {
+        // NOTE: the mapping changes when workers are added at runtime,
+        // which only weakens locality temporarily.
+        return _groups[affinity % ngroup];
+    }
+    CHECK(false) << "Impossible: ngroup is 0";
+    return NULL;
+}
+
 extern int stop_and_join_epoll_threads();
 
 void TaskControl::stop_and_join() {
@@ -332,6 +450,29 @@ int TaskControl::_destroy_group(TaskGroup* g) {
     return 0;
 }
 
+// Exposed stats of work stealing, wrapped in get_leaky_singleton since
+// steals may happen before/after construction/destruction of non-leaky
+// global bvars.
+struct StealStat {
+    StealStat()
+        : stolen_count("bthread_stolen_task_count")
+        , stolen_second("bthread_stolen_task_second", &stolen_count)
+        , contended_count("bthread_steal_contended_count")
+        , contended_second("bthread_steal_contended_second",
+                           &contended_count) {}
+
+    // Number of bthreads moved by stealing.
+    bvar::Adder<int64_t> stolen_count;
+    bvar::PerSecond<bvar::Adder<int64_t> > stolen_second;
+    // Number of times a thief saw a non-empty runqueue but got nothing
+    // out of it, i.e. lost the race against the victim or other thieves.
+    bvar::Adder<int64_t> contended_count;
+    bvar::PerSecond<bvar::Adder<int64_t> > contended_second;
+};
+inline StealStat* get_steal_stat() {
+    return butil::get_leaky_singleton<StealStat>();
+}
+
 bool TaskControl::steal_task(bthread_t* tid, size_t* seed, size_t offset) {
     // 1: Acquiring fence is paired with releasing fence in _add_group to
     // avoid accessing uninitialized slot of _groups.
@@ -340,20 +481,57 @@ bool TaskControl::steal_task(bthread_t* tid, size_t* seed, size_t offset) {
         return false;
     }
 
+    TaskGroup* const thief = tls_task_group;
+
+    // Prefer victims on the same NUMA node in the first pass, steal from
+    // any node in the second pass only when the local node ran dry.
+    const int my_node = (FLAGS_bthread_numa_aware && thief != NULL)
+        ? thief->_numa_node : -1;
+
+    // Steal a batch from one victim instead of a single bthread: under
+    // bursty fan-out a victim with a long runqueue is otherwise drained
+    // one CAS at a time by each thief. The first stolen bthread is run
+    // right away, the rest go into the thief's own runqueue where other
+    // thieves can still steal them.
+    static const size_t STEAL_BATCH_CAP = 32;
+    bthread_t tids[STEAL_BATCH_CAP];
+    size_t max_n = 1;
+    if (thief != NULL && FLAGS_bthread_steal_batch_max > 1) {
+        max_n = std::min((size_t)FLAGS_bthread_steal_batch_max,
+                         STEAL_BATCH_CAP);
+    }
+
     // NOTE: Don't return inside `for' iteration since we need to update |seed|
     bool stolen = false;
     size_t s = *seed;
-    for (size_t i = 0; i < ngroup; ++i, s += offset) {
-        TaskGroup* g = _groups[s % ngroup];
-        // g is possibly NULL because of concurrent _destroy_group
-        if (g) {
-            if (g->_rq.steal(tid)) {
-                stolen = true;
-                break;
-            }
-            if (g->_remote_rq.pop(tid)) {
-                stolen = true;
-                break;
+    const int npass = (my_node >= 0 ? 2 : 1);
+    for (int pass = 0; pass < npass && !stolen; ++pass) {
+        for (size_t i = 0; i < ngroup; ++i, s += offset) {
+            TaskGroup* g = _groups[s % ngroup];
+            // g is possibly NULL because of concurrent _destroy_group
+            if (g) {
+                if (my_node >= 0 &&
+                    (g->_numa_node == my_node) != (pass == 0)) {
+                    continue;
+                }
+                const size_t n = g->_rq.steal_batch(tids, max_n);
+                if (n > 0) {
+                    *tid = tids[0];
+                    for (size_t j = 1; j < n; ++j) {
+                        thief->push_rq(tids[j]);
+                    }
+                    get_steal_stat()->stolen_count << (int64_t)n;
+                    stolen = true;
+                    break;
+                }
+                if (g->_rq.volatile_size() != 0) {
+                    get_steal_stat()->contended_count << 1;
+                }
+                if (g->_remote_rq.pop(tid)) {
+                    get_steal_stat()->stolen_count << 1;
+                    stolen = true;
+                    break;
+                }
             }
         }
     }
@@ -393,6 +571,19 @@ void TaskControl::signal_task(int num_task) {
     }
 }
 
+int64_t TaskControl::get_total_runqueue_size() {
+    int64_t n = 0;
+    BAIDU_SCOPED_LOCK(_modify_group_mutex);
+    const size_t ngroup = _ngroup.load(butil::memory_order_relaxed);
+    for (size_t i = 0; i < ngroup; ++i) {
+        TaskGroup* g = _groups[i];
+        if (g) {
+            n += g->_rq.volatile_size() + g->_remote_rq.volatile_size();
+        }
+    }
+    return n;
+}
+
 void TaskControl::print_rq_sizes(std::ostream& os) {
     const size_t ngroup = _ngroup.load(butil::memory_order_relaxed);
     DEFINE_SMALL_ARRAY(int, nums, ngroup, 128);
@@ -440,12 +631,21 @@ int64_t TaskControl::get_cumulated_signal_count() {
     for (size_t i = 0; i < ngroup; ++i) {
         TaskGroup* g = _groups[i];
         if (g) {
-            c += g->_nsignaled + g->_remote_nsignaled;
+            c += g->_nsignaled +
+                g->_remote_nsignaled.load(butil::memory_order_relaxed);
         }
     }
     return c;
 }
 
+void TaskControl::get_sched_stat(SchedStat* stat) {
+    stat->nswitch = get_cumulated_switch_count();
+    stat->nsignal = get_cumulated_signal_count();
+    StealStat* ss = get_steal_stat();
+    stat->nstolen = ss->stolen_count.get_value();
+    stat->nsteal_contended = ss->contended_count.get_value();
+}
+
 bvar::LatencyRecorder* TaskControl::create_exposed_pending_time() {
     bool is_creator = false;
     _pending_time_mutex.lock();
@@ -462,4 +662,20 @@ bvar::LatencyRecorder* TaskControl::create_exposed_pending_time() {
     return pt;
 }
 
+bvar::LatencyRecorder* TaskControl::create_exposed_dispatch_time() {
+    bool is_creator = false;
+    _pending_time_mutex.lock();
+    bvar::LatencyRecorder* dt = _dispatch_time.load(butil::memory_order_consume);
+    if (!dt) {
+        dt = new bvar::LatencyRecorder;
+        _dispatch_time.store(dt, butil::memory_order_release);
+        is_creator = true;
+    }
+    _pending_time_mutex.unlock();
+    if (is_creator) {
+        dt->expose("bthread_dispatch");
+    }
+    return dt;
+}
+
 }  // namespace bthread
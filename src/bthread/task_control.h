@@ -66,10 +66,26 @@ public:
 
     void print_rq_sizes(std::ostream& os);
 
+    // Approximate total number of tasks pending in runqueues (local and
+    // remote) of all groups, a direct overload signal of workers.
+    int64_t get_total_runqueue_size();
+
     double get_cumulated_worker_time();
     int64_t get_cumulated_switch_count();
     int64_t get_cumulated_signal_count();
 
+    // Counted scheduling events since process start. Snapshotting before
+    // and after a fixed workload compares scheduler changes by event
+    // counts rather than noisy wall-clock time; with -bthread_steal_seed
+    // pinning the steal order the counts are reproducible across runs.
+    struct SchedStat {
+        int64_t nswitch;          // context switches between bthreads
+        int64_t nsignal;          // wakeup signals issued to workers
+        int64_t nstolen;          // bthreads moved between workers
+        int64_t nsteal_contended; // steals losing races on non-empty queues
+    };
+    void get_sched_stat(SchedStat* stat);
+
     // [Not thread safe] Add more worker threads.
     // Return the number of workers actually added, which may be less than |num|
     int add_workers(int num);
@@ -78,7 +94,16 @@ public:
     // If this method is called after init(), it never returns NULL.
     TaskGroup* choose_one_group();
 
+    // The TaskGroup that bthreads created with bthread_attr_t.affinity
+    // equal to `affinity' are queued to.
+    // If this method is called after init(), it never returns NULL.
+    TaskGroup* affinity_group(unsigned affinity);
+
 private:
+    // Bind the calling worker pthread (owning `g') to a NUMA node chosen
+    // round-robin when -bthread_numa_aware is on, so that steal_task can
+    // prefer victims on the same node.
+    void bind_worker_to_numa_node(TaskGroup* g);
     // Add/Remove a TaskGroup.
     // Returns 0 on success, -1 otherwise.
     int _add_group(TaskGroup*);
@@ -90,6 +115,8 @@ private:
 
     bvar::LatencyRecorder& exposed_pending_time();
     bvar::LatencyRecorder* create_exposed_pending_time();
+    bvar::LatencyRecorder& exposed_dispatch_time();
+    bvar::LatencyRecorder* create_exposed_dispatch_time();
 
     butil::atomic<size_t> _ngroup;
     TaskGroup** _groups;
@@ -100,8 +127,10 @@ private:
     std::vector<pthread_t> _workers;
 
     bvar::Adder<int64_t> _nworkers;
+    // Also guards creation of _dispatch_time.
     butil::Mutex _pending_time_mutex;
     butil::atomic<bvar::LatencyRecorder*> _pending_time;
+    butil::atomic<bvar::LatencyRecorder*> _dispatch_time;
     bvar::PassiveStatus<double> _cumulated_worker_time;
     bvar::PerSecond<bvar::PassiveStatus<double> > _worker_usage_second;
     bvar::PassiveStatus<int64_t> _cumulated_switch_count;
@@ -109,6 +138,7 @@ private:
     bvar::PassiveStatus<int64_t> _cumulated_signal_count;
     bvar::PerSecond<bvar::PassiveStatus<int64_t> > _signal_per_second;
     bvar::PassiveStatus<std::string> _status;
+    bvar::PassiveStatus<int64_t> _runqueue_size;
     bvar::Adder<int64_t> _nbthreads;
 
     static const int PARKING_LOT_NUM = 4;
@@ -123,6 +153,14 @@ inline bvar::LatencyRecorder& TaskControl::exposed_pending_time() {
     return *pt;
 }
 
+inline bvar::LatencyRecorder& TaskControl::exposed_dispatch_time() {
+    bvar::LatencyRecorder* dt = _dispatch_time.load(butil::memory_order_consume);
+    if (!dt) {
+        dt = create_exposed_dispatch_time();
+    }
+    return *dt;
+}
+
 }  // namespace bthread
 
 #endif  // BTHREAD_TASK_CONTROL_H
@@ -33,6 +33,7 @@
 #include "bthread/sys_futex.h"              // futex_wake_private
 #include "bthread/processor.h"              // cpu_relax
 #include "bthread/task_control.h"
+#include <algorithm>                        // std::min
 #include "bthread/task_group.h"
 #include "bthread/timer_thread.h"
 #include "bthread/errno.h"
@@ -40,7 +41,7 @@
 namespace bthread {
 
 static const bthread_attr_t BTHREAD_ATTR_TASKGROUP = {
-    BTHREAD_STACKTYPE_UNKNOWN, 0, NULL };
+    BTHREAD_STACKTYPE_UNKNOWN, 0, NULL, 0 };
 
 static bool pass_bool(const char*, bool) { return true; }
 
@@ -57,6 +58,57 @@ const bool ALLOW_UNUSED dummy_show_per_worker_usage_in_vars =
     ::GFLAGS_NS::RegisterFlagValidator(&FLAGS_show_per_worker_usage_in_vars,
                                     pass_bool);
 
+static bool pass_int32(const char*, int32_t) { return true; }
+
+DEFINE_int32(task_group_max_spin_before_park, 0,
+             "An idle worker spins up to so many iterations waiting for new "
+             "tasks before parking on the futex, trading a little CPU for "
+             "lower wakeup latency and fewer futex syscalls. The actual "
+             "count adapts to recent outcomes. 0 disables spinning.");
+const bool ALLOW_UNUSED dummy_task_group_max_spin_before_park =
+    ::GFLAGS_NS::RegisterFlagValidator(&FLAGS_task_group_max_spin_before_park,
+                                    pass_int32);
+
+DEFINE_int32(bthread_dispatch_sample_rate, 32,
+             "Sample 1/N of ready-to-run events to measure the delay "
+             "between a bthread becoming runnable and starting to run, "
+             "shown in /vars/bthread_dispatch_*. The delay rises before "
+             "CPU usage does when workers are saturated. 0 disables "
+             "the sampling.");
+const bool ALLOW_UNUSED dummy_bthread_dispatch_sample_rate =
+    ::GFLAGS_NS::RegisterFlagValidator(&FLAGS_bthread_dispatch_sample_rate,
+                                    pass_int32);
+
+static bool pass_int64(const char*, int64_t) { return true; }
+
+DEFINE_int64(bthread_steal_seed, -1,
+             "When >= 0, the steal order of each new worker is derived "
+             "from this value and the worker's creation ordinal instead "
+             "of a random seed, so runs of the same workload replay the "
+             "same victim sequence. Together with the counters of "
+             "TaskControl::get_sched_stat() this makes scheduler "
+             "benchmarks comparable by event counts instead of noisy "
+             "wall-clock time. Set before workers are created; already "
+             "started workers keep their seeds.");
+const bool ALLOW_UNUSED dummy_bthread_steal_seed =
+    ::GFLAGS_NS::RegisterFlagValidator(&FLAGS_bthread_steal_seed,
+                                    pass_int64);
+
+// 1/N per enqueueing thread, the first enqueue of a thread is sampled to
+// make lightly loaded processes still produce the vars.
+static __thread int tls_dispatch_sample_countdown = 0;
+inline bool is_dispatch_sampled() {
+    const int rate = FLAGS_bthread_dispatch_sample_rate;
+    if (rate <= 0) {
+        return false;
+    }
+    if (--tls_dispatch_sample_countdown > 0) {
+        return false;
+    }
+    tls_dispatch_sample_countdown = rate;
+    return true;
+}
+
 __thread TaskGroup* tls_task_group = NULL;
 // Sync with TaskMeta::local_storage when a bthread is created or destroyed.
 // During running, the two fields may be inconsistent, use tls_bls as the
@@ -65,6 +117,7 @@ __thread LocalStorage tls_bls = BTHREAD_LOCAL_STORAGE_INITIALIZER;
 
 // defined in bthread/key.cpp
 extern void return_keytable(bthread_keytable_pool_t*, KeyTable*);
+extern void destroy_fast_key_slots(LocalStorage* ls);
 
 // [Hacky] This is a special TLS set by bthread-rpc privately... to save
 // overhead of creation keytable, may be removed later.
@@ -115,13 +168,37 @@ bool TaskGroup::is_stopped(bthread_t tid) {
     return true;
 }
 
+bool TaskGroup::spin_before_park(const ParkingLot::State& expected_state) {
+    const int max_spin = FLAGS_task_group_max_spin_before_park;
+    if (max_spin <= 0) {
+        return false;
+    }
+    if (_adaptive_spin <= 0) {
+        _adaptive_spin = 16;
+    }
+    const int limit = std::min(_adaptive_spin, max_spin);
+    for (int i = 0; i < limit; ++i) {
+        if (_pl->changed(expected_state)) {
+            // Spinning paid off, spin longer next time (bounded).
+            _adaptive_spin = std::min(limit * 2, max_spin);
+            return true;
+        }
+        cpu_relax();
+    }
+    // Wasted the whole spin, back off.
+    _adaptive_spin = limit / 2;
+    return false;
+}
+
 bool TaskGroup::wait_task(bthread_t* tid) {
     do {
 #ifndef BTHREAD_DONT_SAVE_PARKING_STATE
         if (_last_pl_state.stopped()) {
             return false;
         }
-        _pl->wait(_last_pl_state);
+        if (!spin_before_park(_last_pl_state)) {
+            _pl->wait(_last_pl_state);
+        }
         if (steal_task(tid)) {
             return true;
         }
@@ -133,7 +210,9 @@ bool TaskGroup::wait_task(bthread_t* tid) {
         if (steal_task(tid)) {
             return true;
         }
-        _pl->wait(st);
+        if (!spin_before_park(st)) {
+            _pl->wait(st);
+        }
 #endif
     } while (true);
 }
@@ -191,10 +270,25 @@ TaskGroup::TaskGroup(TaskControl* c)
     , _pl(NULL) 
     , _main_stack(NULL)
     , _main_tid(0)
+    , _priority_next(0)
     , _remote_num_nosignal(0)
     , _remote_nsignaled(0)
+    , _numa_node(-1)
+    , _adaptive_spin(0)
 {
-    _steal_seed = butil::fast_rand();
+    if (FLAGS_bthread_steal_seed >= 0) {
+        // Creation ordinal of deterministically-seeded groups. Only
+        // consumed when the flag is on so that a fresh process seeds its
+        // workers 0, 1, 2... reproducibly.
+        static butil::static_atomic<uint64_t> s_steal_seed_ordinal
+            = BUTIL_STATIC_ATOMIC_INIT(0);
+        const uint64_t ordinal =
+            s_steal_seed_ordinal.fetch_add(1, butil::memory_order_relaxed);
+        _steal_seed = butil::fmix64((uint64_t)FLAGS_bthread_steal_seed
+                                    + ordinal * 0x9E3779B97F4A7C15ULL);
+    } else {
+        _steal_seed = butil::fast_rand();
+    }
     _steal_offset = OFFSET_TABLE[_steal_seed % ARRAY_SIZE(OFFSET_TABLE)];
     _pl = &c->_pl[butil::fmix64(pthread_numeric_id()) % TaskControl::PARKING_LOT_NUM];
     CHECK(c);
@@ -233,6 +327,8 @@ int TaskGroup::init(size_t runqueue_capacity) {
     m->stop = false;
     m->interrupted = false;
     m->about_to_quit = false;
+    m->base_priority = 0;
+    m->boosted_priority.store(0, butil::memory_order_relaxed);
     m->fn = NULL;
     m->arg = NULL;
     m->local_storage = LOCAL_STORAGE_INIT;
@@ -322,6 +418,8 @@ void TaskGroup::task_runner(intptr_t skip_remained) {
             tls_bls.keytable = NULL;
             m->local_storage.keytable = NULL; // optional
         }
+        // Data of fast keys never survives the bthread.
+        destroy_fast_key_slots(&tls_bls);
         
         // Increase the version and wake up all joiners, if resulting version
         // is 0, change it to 1 to make bthread_t never be 0. Any access
@@ -375,6 +473,8 @@ int TaskGroup::start_foreground(TaskGroup** pg,
     m->stop = false;
     m->interrupted = false;
     m->about_to_quit = false;
+    m->base_priority = 0;
+    m->boosted_priority.store(0, butil::memory_order_relaxed);
     m->fn = fn;
     m->arg = arg;
     CHECK(m->stack == NULL);
@@ -411,6 +511,80 @@ int TaskGroup::start_foreground(TaskGroup** pg,
     return 0;
 }
 
+// Max number of in-place executions nested on one stack. Each level runs as
+// ordinary stack frames of the borrowed stack, a small budget bounds the
+// total usage and converts deeper starts into normal bthreads.
+static const int MAX_INLINE_DEPTH = 4;
+
+int TaskGroup::start_inline(TaskGroup** pg,
+                            bthread_t* __restrict th,
+                            const bthread_attr_t* __restrict attr,
+                            void * (*fn)(void*),
+                            void* __restrict arg) {
+    if (__builtin_expect(!fn, 0)) {
+        return EINVAL;
+    }
+    TaskGroup* g = *pg;
+    TaskMeta* const caller = g->current_task();
+    if (g->_rq.volatile_size() != 0 ||
+        caller->inline_depth >= MAX_INLINE_DEPTH) {
+        return start_foreground(pg, th, attr, fn, arg);
+    }
+    const bthread_attr_t using_attr = (attr ? *attr : BTHREAD_ATTR_NORMAL);
+    butil::ResourceId<TaskMeta> slot;
+    TaskMeta* m = butil::get_resource(&slot);
+    if (__builtin_expect(!m, 0)) {
+        return ENOMEM;
+    }
+    CHECK(m->current_waiter.load(butil::memory_order_relaxed) == NULL);
+    m->stop = false;
+    m->interrupted = false;
+    m->about_to_quit = false;
+    m->base_priority = 0;
+    m->boosted_priority.store(0, butil::memory_order_relaxed);
+    m->fn = fn;
+    m->arg = arg;
+    CHECK(m->stack == NULL);
+    m->attr = using_attr;
+    m->local_storage = LOCAL_STORAGE_INIT;
+    m->cpuwide_start_ns = butil::cpuwide_time_ns();
+    m->stat = EMPTY_STAT;
+    m->tid = make_tid(*m->version_butex, slot);
+    *th = m->tid;
+    if (using_attr.flags & BTHREAD_LOG_START_AND_FINISH) {
+        LOG(INFO) << "Started bthread " << m->tid << " in-place";
+    }
+    g->_control->_nbthreads << 1;
+
+    ++caller->inline_depth;
+    try {
+        fn(arg);
+    } catch (ExitException& e) {
+        (void)e.value();
+    }
+    --caller->inline_depth;
+    // fn may have blocked and resumed on another worker.
+    *pg = tls_task_group;
+
+    if (using_attr.flags & BTHREAD_LOG_START_AND_FINISH) {
+        LOG(INFO) << "Finished bthread " << m->tid << ", cputime="
+                  << m->stat.cputime_ns / 1000000.0 << "ms";
+    }
+    // No keytable to return: local storage was shared with the caller.
+    // Make joiners and accessors see the end of the thread, same as the
+    // ending part of task_runner().
+    {
+        BAIDU_SCOPED_LOCK(m->version_lock);
+        if (0 == ++*m->version_butex) {
+            ++*m->version_butex;
+        }
+    }
+    butex_wake_except(m->version_butex, 0);
+    (*pg)->_control->_nbthreads << -1;
+    return_resource(slot);
+    return 0;
+}
+
 template <bool REMOTE>
 int TaskGroup::start_background(bthread_t* __restrict th,
                                 const bthread_attr_t* __restrict attr,
@@ -430,6 +604,8 @@ int TaskGroup::start_background(bthread_t* __restrict th,
     m->stop = false;
     m->interrupted = false;
     m->about_to_quit = false;
+    m->base_priority = 0;
+    m->boosted_priority.store(0, butil::memory_order_relaxed);
     m->fn = fn;
     m->arg = arg;
     CHECK(m->stack == NULL);
@@ -443,6 +619,15 @@ int TaskGroup::start_background(bthread_t* __restrict th,
         LOG(INFO) << "Started bthread " << m->tid;
     }
     _control->_nbthreads << 1;
+    if (using_attr.affinity != 0) {
+        TaskGroup* dest = _control->affinity_group(using_attr.affinity);
+        if (dest != NULL && dest != this) {
+            // Queue to the designated worker. Signal immediately:
+            // bthread_flush() of the caller can not reach `dest'.
+            dest->ready_to_run_remote(m->tid, false);
+            return 0;
+        }
+    }
     if (REMOTE) {
         ready_to_run_remote(m->tid, (using_attr.flags & BTHREAD_NOSIGNAL));
     } else {
@@ -507,19 +692,24 @@ TaskStatistics TaskGroup::main_stat() const {
 
 void TaskGroup::ending_sched(TaskGroup** pg) {
     TaskGroup* g = *pg;
-    bthread_t next_tid = 0;
-    // Find next task to run, if none, switch to idle thread of the group.
+    bthread_t next_tid = g->_priority_next;
+    if (next_tid != 0) {
+        // Run the priority-boosted mutex holder before anything queued.
+        g->_priority_next = 0;
+    } else {
+        // Find next task to run, if none, switch to idle thread of the group.
 #ifndef BTHREAD_FAIR_WSQ
-    // When BTHREAD_FAIR_WSQ is defined, profiling shows that cpu cost of
-    // WSQ::steal() in example/multi_threaded_echo_c++ changes from 1.9%
-    // to 2.9%
-    const bool popped = g->_rq.pop(&next_tid);
+        // When BTHREAD_FAIR_WSQ is defined, profiling shows that cpu cost of
+        // WSQ::steal() in example/multi_threaded_echo_c++ changes from 1.9%
+        // to 2.9%
+        const bool popped = g->_rq.pop(&next_tid);
 #else
-    const bool popped = g->_rq.steal(&next_tid);
+        const bool popped = g->_rq.steal(&next_tid);
 #endif
-    if (!popped && !g->steal_task(&next_tid)) {
-        // Jump to main task if there's no task to run.
-        next_tid = g->_main_tid;
+        if (!popped && !g->steal_task(&next_tid)) {
+            // Jump to main task if there's no task to run.
+            next_tid = g->_main_tid;
+        }
     }
 
     TaskMeta* const cur_meta = g->_cur_meta;
@@ -548,16 +738,21 @@ void TaskGroup::ending_sched(TaskGroup** pg) {
 
 void TaskGroup::sched(TaskGroup** pg) {
     TaskGroup* g = *pg;
-    bthread_t next_tid = 0;
-    // Find next task to run, if none, switch to idle thread of the group.
+    bthread_t next_tid = g->_priority_next;
+    if (next_tid != 0) {
+        // Run the priority-boosted mutex holder before anything queued.
+        g->_priority_next = 0;
+    } else {
+        // Find next task to run, if none, switch to idle thread of the group.
 #ifndef BTHREAD_FAIR_WSQ
-    const bool popped = g->_rq.pop(&next_tid);
+        const bool popped = g->_rq.pop(&next_tid);
 #else
-    const bool popped = g->_rq.steal(&next_tid);
+        const bool popped = g->_rq.steal(&next_tid);
 #endif
-    if (!popped && !g->steal_task(&next_tid)) {
-        // Jump to main task if there's no task to run.
-        next_tid = g->_main_tid;
+        if (!popped && !g->steal_task(&next_tid)) {
+            // Jump to main task if there's no task to run.
+            next_tid = g->_main_tid;
+        }
     }
     sched_to(pg, next_tid);
 }
@@ -584,6 +779,14 @@ void TaskGroup::sched_to(TaskGroup** pg, TaskMeta* next_meta) {
     }
     ++cur_meta->stat.nswitch;
     ++ g->_nswitch;
+    if (next_meta->enqueue_ns) {
+        // Delay between the sampled ready_to_run* and this run, `now' is
+        // already read for cputime above. Covers both first runs(through
+        // task_runner) and wakeups.
+        g->_control->exposed_dispatch_time() <<
+            (now - next_meta->enqueue_ns) / 1000L;
+        next_meta->enqueue_ns = 0;
+    }
     // Switch to the task
     if (__builtin_expect(next_meta != cur_meta, 1)) {
         g->_cur_meta = next_meta;
@@ -645,6 +848,19 @@ void TaskGroup::destroy_self() {
 }
 
 void TaskGroup::ready_to_run(bthread_t tid, bool nosignal) {
+    if (is_dispatch_sampled()) {
+        address_meta(tid)->enqueue_ns = butil::cpuwide_time_ns();
+    }
+    // A boosted bthread holds a mutex that higher-priority bthreads are
+    // blocked on, let it jump the queue and leave its critical section
+    // sooner. The slot is picked at the next reschedule of this worker,
+    // before the normal run queue.
+    if (_priority_next == 0 &&
+        address_meta(tid)->boosted_priority.load(butil::memory_order_relaxed)
+        > 0) {
+        _priority_next = tid;
+        return;
+    }
     push_rq(tid);
     if (nosignal) {
         ++_num_nosignal;
@@ -666,36 +882,49 @@ void TaskGroup::flush_nosignal_tasks() {
 }
 
 void TaskGroup::ready_to_run_remote(bthread_t tid, bool nosignal) {
-    _remote_rq._mutex.lock();
-    while (!_remote_rq.push_locked(tid)) {
-        flush_nosignal_tasks_remote_locked(_remote_rq._mutex);
+    if (is_dispatch_sampled()) {
+        address_meta(tid)->enqueue_ns = butil::cpuwide_time_ns();
+    }
+    while (!_remote_rq.push(tid)) {
+        flush_nosignal_tasks_remote();
         LOG_EVERY_SECOND(ERROR) << "_remote_rq is full, capacity="
                                 << _remote_rq.capacity();
         ::usleep(1000);
-        _remote_rq._mutex.lock();
     }
     if (nosignal) {
-        ++_remote_num_nosignal;
-        _remote_rq._mutex.unlock();
+        _remote_num_nosignal.fetch_add(1, butil::memory_order_relaxed);
     } else {
-        const int additional_signal = _remote_num_nosignal;
-        _remote_num_nosignal = 0;
-        _remote_nsignaled += 1 + additional_signal;
-        _remote_rq._mutex.unlock();
+        const int additional_signal =
+            _remote_num_nosignal.exchange(0, butil::memory_order_relaxed);
+        _remote_nsignaled.fetch_add(1 + additional_signal,
+                                    butil::memory_order_relaxed);
         _control->signal_task(1 + additional_signal);
     }
 }
 
-void TaskGroup::flush_nosignal_tasks_remote_locked(butil::Mutex& locked_mutex) {
-    const int val = _remote_num_nosignal;
-    if (!val) {
-        locked_mutex.unlock();
+void TaskGroup::ready_to_run_remote_batch(const bthread_t* tids, size_t n) {
+    if (n == 0) {
         return;
     }
-    _remote_num_nosignal = 0;
-    _remote_nsignaled += val;
-    locked_mutex.unlock();
-    _control->signal_task(val);
+    if (is_dispatch_sampled()) {
+        const int64_t now_ns = butil::cpuwide_time_ns();
+        for (size_t i = 0; i < n; ++i) {
+            address_meta(tids[i])->enqueue_ns = now_ns;
+        }
+    }
+    for (size_t i = 0; i < n; ++i) {
+        while (!_remote_rq.push(tids[i])) {
+            flush_nosignal_tasks_remote();
+            LOG_EVERY_SECOND(ERROR) << "_remote_rq is full, capacity="
+                                    << _remote_rq.capacity();
+            ::usleep(1000);
+        }
+    }
+    const int additional_signal =
+        _remote_num_nosignal.exchange(0, butil::memory_order_relaxed);
+    _remote_nsignaled.fetch_add((int)n + additional_signal,
+                                butil::memory_order_relaxed);
+    _control->signal_task((int)n + additional_signal);
 }
 
 void TaskGroup::ready_to_run_general(bthread_t tid, bool nosignal) {
@@ -63,6 +63,18 @@ public:
                                 void * (*fn)(void*),
                                 void* __restrict arg);
 
+    // Create task `fn(arg)' with attributes `attr' in TaskGroup *pg and run
+    // it in-place on the caller's stack when the run queue of *pg is empty
+    // and in-place executions are not nested too deeply, saving two context
+    // switches; otherwise equivalent to start_foreground(). See the comment
+    // on BTHREAD_INLINE in types.h for restrictions on `fn'.
+    // Return 0 on success, errno otherwise.
+    static int start_inline(TaskGroup** pg,
+                            bthread_t* __restrict tid,
+                            const bthread_attr_t* __restrict attr,
+                            void * (*fn)(void*),
+                            void* __restrict arg);
+
     // Create task `fn(arg)' with attributes `attr' in this TaskGroup, put the
     // identifier into `tid'. Schedule the new thread to run.
     //   Called from worker: start_background<false>
@@ -157,9 +169,12 @@ public:
 
     // Push a bthread into the runqueue from another non-worker thread.
     void ready_to_run_remote(bthread_t tid, bool nosignal = false);
-    void flush_nosignal_tasks_remote_locked(butil::Mutex& locked_mutex);
     void flush_nosignal_tasks_remote();
 
+    // Push `n' bthreads into the remote runqueue with one signal for the
+    // whole batch, cheaper than n ready_to_run_remote() for bulk wakeups.
+    void ready_to_run_remote_batch(const bthread_t* tids, size_t n);
+
     // Automatically decide the caller is remote or local, and call
     // the corresponding function.
     void ready_to_run_general(bthread_t tid, bool nosignal = false);
@@ -168,6 +183,10 @@ public:
     // The TaskControl that this TaskGroup belongs to.
     TaskControl* control() const { return _control; }
 
+    // NUMA node that this worker is bound to when -bthread_numa_aware is
+    // on, -1 otherwise.
+    int numa_node() const { return _numa_node; }
+
     // Call this instead of delete.
     void destroy_self();
 
@@ -211,6 +230,11 @@ friend class TaskControl;
     // loop calling this function should end.
     bool wait_task(bthread_t* tid);
 
+    // Spin for a while waiting for new signals of the parking lot before
+    // parking on the futex. The spin count adapts to recent outcomes.
+    // Returns true iff the state changed during the spin.
+    bool spin_before_park(const ParkingLot::State& expected_state);
+
     bool steal_task(bthread_t* tid) {
         if (_remote_rq.pop(tid)) {
             return true;
@@ -247,10 +271,20 @@ friend class TaskControl;
     size_t _steal_offset;
     ContextualStack* _main_stack;
     bthread_t _main_tid;
+    // A priority-boosted bthread(see TaskMeta::boosted_priority) made
+    // ready on this worker, run before anything in _rq to bound priority
+    // inversion. Only touched by the worker pthread, no atomics needed.
+    bthread_t _priority_next;
     WorkStealingQueue<bthread_t> _rq;
     RemoteTaskQueue _remote_rq;
-    int _remote_num_nosignal;
-    int _remote_nsignaled;
+    // Atomic because remote pushers update them without any lock.
+    butil::atomic<int> _remote_num_nosignal;
+    butil::atomic<int> _remote_nsignaled;
+    // NUMA node that the worker pthread is bound to when
+    // -bthread_numa_aware is on, -1 otherwise.
+    int _numa_node;
+    // Current spin count of spin_before_park().
+    int _adaptive_spin;
 };
 
 }  // namespace bthread
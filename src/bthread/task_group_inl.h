@@ -98,9 +98,13 @@ inline void TaskGroup::push_rq(bthread_t tid) {
 }
 
 inline void TaskGroup::flush_nosignal_tasks_remote() {
-    if (_remote_num_nosignal) {
-        _remote_rq._mutex.lock();
-        flush_nosignal_tasks_remote_locked(_remote_rq._mutex);
+    if (_remote_num_nosignal.load(butil::memory_order_relaxed)) {
+        const int val =
+            _remote_num_nosignal.exchange(0, butil::memory_order_relaxed);
+        if (val) {
+            _remote_nsignaled.fetch_add(val, butil::memory_order_relaxed);
+            _control->signal_task(val);
+        }
     }
 }
 
@@ -38,13 +38,31 @@ struct TaskStatistics {
 class KeyTable;
 struct ButexWaiter;
 
+// Number of keys created by bthread_key_create*_fast(), whose data is
+// stored inline in LocalStorage below instead of the two-level KeyTable,
+// making bthread_getspecific a single load. Kept small since the slots
+// are copied at every bthread switch.
+static const uint32_t KEY_FAST_SLOT_NUM = 4;
+
+// Data of one fast key. `version' avoids reading data of deleted or
+// never-set keys, same trick as in SubKeyTable(key.cpp).
+struct KeyFastSlot {
+    void* data;
+    uint32_t version;
+};
+
 struct LocalStorage {
     KeyTable* keytable;
     void* assigned_data;
     void* rpcz_parent_span;
+    // Serialized tracing baggage(butil::IOBuf*) of the server-side
+    // request being handled in this bthread, inherited by Channels
+    // called within the handler. Set around CallMethod by protocols.
+    void* rpc_baggage;
+    KeyFastSlot fast_slots[KEY_FAST_SLOT_NUM];
 };
 
-#define BTHREAD_LOCAL_STORAGE_INITIALIZER { NULL, NULL, NULL }
+#define BTHREAD_LOCAL_STORAGE_INITIALIZER { NULL, NULL, NULL, NULL, {} }
 
 const static LocalStorage LOCAL_STORAGE_INIT = BTHREAD_LOCAL_STORAGE_INITIALIZER;
 
@@ -61,7 +79,24 @@ struct TaskMeta {
 
     // Scheduling of the thread can be delayed.
     bool about_to_quit;
-    
+
+    // Base scheduling priority, set with bthread_set_priority(). Only
+    // consulted at a few scheduling decisions(queue-jumping of boosted
+    // tasks, butex wakeups), bthreads are still cooperative.
+    int base_priority;
+
+    // Priority inherited from higher-priority bthreads blocked on a
+    // bthread_mutex_t held by this task, so that the holder is scheduled
+    // ahead of ordinary ready tasks and cannot invert latency of its
+    // waiters. Bumped by waiters in mutex_lock_contended(), cleared in
+    // bthread_mutex_unlock().
+    butil::atomic<int> boosted_priority;
+
+    int effective_priority() const {
+        const int bp = boosted_priority.load(butil::memory_order_relaxed);
+        return bp > base_priority ? bp : base_priority;
+    }
+
     // [Not Reset] guarantee visibility of version_butex.
     pthread_spinlock_t version_lock;
     
@@ -86,6 +121,16 @@ struct TaskMeta {
     int64_t cpuwide_start_ns;
     TaskStatistics stat;
 
+    // When non-zero, time of the last sampled push to a runqueue
+    // (set in ready_to_run*), consumed and cleared in sched_to() to
+    // measure the dispatch delay shown in bthread_dispatch_* vars.
+    int64_t enqueue_ns;
+
+    // [Not Reset] Number of in-place executions (BTHREAD_INLINE) currently
+    // borrowing the stack of this task. Incremented/decremented in pairs by
+    // TaskGroup::start_inline, thus always 0 between runs.
+    int inline_depth;
+
     // bthread local storage, sync with tls_bls (defined in task_group.cpp)
     // when the bthread is created or destroyed.
     // DO NOT use this field directly, use tls_bls instead.
@@ -97,7 +142,9 @@ public:
     TaskMeta()
         : current_waiter(NULL)
         , current_sleep(0)
-        , stack(NULL) {
+        , stack(NULL)
+        , enqueue_ns(0)
+        , inline_depth(0) {
         pthread_spin_init(&version_lock, 0);
         version_butex = butex_create_checked<uint32_t>();
         *version_butex = 1;
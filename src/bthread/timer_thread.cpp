@@ -67,6 +67,8 @@ struct BAIDU_CACHELINE_ALIGNMENT TimerThread::Task {
 };
 
 // Timer tasks are sharded into different Buckets to reduce contentions.
+// Insertion and consumption are lock-free: tasks are pushed onto a Treiber
+// stack and the per-bucket nearest run time is maintained by a CAS-min.
 class BAIDU_CACHELINE_ALIGNMENT TimerThread::Bucket {
 public:
     Bucket()
@@ -80,20 +82,27 @@ public:
         TimerThread::TaskId task_id;
         bool earlier;
     };
-    
+
     // Schedule a task into this bucket.
     // Returns the TaskId and if it has the nearest run time.
     ScheduleResult schedule(void (*fn)(void*), void* arg,
                             const timespec& abstime);
 
+    // Schedule a batch of tasks sharing one run time into this bucket,
+    // published with a single CAS. Identifiers are put into ids.
+    // Returns the number of scheduled tasks, sets *earlier if the batch
+    // has the nearest run time.
+    size_t schedule_batch(void (*fn)(void*), void* const args[], size_t n,
+                          const timespec& abstime, TaskId* ids,
+                          bool* earlier);
+
     // Pull all scheduled tasks.
     // This function is called in timer thread.
     Task* consume_tasks();
 
 private:
-    internal::FastPthreadMutex _mutex;
-    int64_t _nearest_run_time;
-    Task* _task_head;
+    butil::atomic<int64_t> _nearest_run_time;
+    butil::atomic<Task*> _task_head;
 };
 
 // Utilies for making and extracting TaskId.
@@ -166,16 +175,16 @@ int TimerThread::start(const TimerThreadOptions* options_in) {
 
 TimerThread::Task* TimerThread::Bucket::consume_tasks() {
     Task* head = NULL;
-    if (_task_head) { // NOTE: schedule() and consume_tasks() are sequenced
-        // by TimerThread._nearest_run_time and fenced by TimerThread._mutex.
-        // We can avoid touching the mutex and related cacheline when the
-        // bucket is actually empty.
-        BAIDU_SCOPED_LOCK(_mutex);
-        if (_task_head) {
-            head = _task_head;
-            _task_head = NULL;
-            _nearest_run_time = std::numeric_limits<int64_t>::max();
-        }
+    // Don't touch the contended cacheline when the bucket is actually empty.
+    if (_task_head.load(butil::memory_order_relaxed)) {
+        // Reset _nearest_run_time BEFORE taking the list. A schedule()
+        // whose push is missed by the exchange below is ordered after the
+        // exchange on _task_head, thus surely sees the reset value and
+        // reports `earlier' to wake up TimerThread (paired acq_rel on both
+        // RMWs of _task_head).
+        _nearest_run_time.store(std::numeric_limits<int64_t>::max(),
+                                butil::memory_order_relaxed);
+        head = _task_head.exchange(NULL, butil::memory_order_acq_rel);
     }
     return head;
 }
@@ -200,20 +209,89 @@ TimerThread::Bucket::schedule(void (*fn)(void*), void* arg,
     }
     const TaskId id = make_task_id(slot_id, version);
     task->task_id = id;
+    // The task may be consumed and recycled once published, don't touch
+    // *task after the push.
+    const int64_t run_time = task->run_time;
     bool earlier = false;
-    {
-        BAIDU_SCOPED_LOCK(_mutex);
-        task->next = _task_head;
-        _task_head = task;
-        if (task->run_time < _nearest_run_time) {
-            _nearest_run_time = task->run_time;
+    // Lock-free push onto the bucket. The acq_rel makes the task content
+    // visible to consume_tasks and orders this push against the reset of
+    // _nearest_run_time in consume_tasks (see comments there).
+    Task* head = _task_head.load(butil::memory_order_relaxed);
+    do {
+        task->next = head;
+    } while (!_task_head.compare_exchange_weak(
+                 head, task, butil::memory_order_acq_rel,
+                 butil::memory_order_relaxed));
+    // CAS-min on the nearest run time of this bucket.
+    int64_t nearest = _nearest_run_time.load(butil::memory_order_relaxed);
+    while (run_time < nearest) {
+        if (_nearest_run_time.compare_exchange_weak(
+                nearest, run_time, butil::memory_order_relaxed)) {
             earlier = true;
+            break;
         }
     }
     ScheduleResult result = { id, earlier };
     return result;
 }
 
+size_t TimerThread::Bucket::schedule_batch(
+    void (*fn)(void*), void* const args[], size_t n,
+    const timespec& abstime, TaskId* ids, bool* earlier) {
+    *earlier = false;
+    const int64_t run_time = butil::timespec_to_microseconds(abstime);
+    Task* first = NULL;
+    Task* last = NULL;
+    size_t nsched = 0;
+    for (size_t i = 0; i < n; ++i) {
+        butil::ResourceId<Task> slot_id;
+        Task* task = butil::get_resource<Task>(&slot_id);
+        if (task == NULL) {
+            break;
+        }
+        task->next = NULL;
+        task->fn = fn;
+        task->arg = args[i];
+        task->run_time = run_time;
+        uint32_t version = task->version.load(butil::memory_order_relaxed);
+        if (version == 0) {  // skip 0.
+            task->version.fetch_add(2, butil::memory_order_relaxed);
+            version = 2;
+        }
+        ids[nsched] = make_task_id(slot_id, version);
+        task->task_id = ids[nsched];
+        ++nsched;
+        if (last != NULL) {
+            last->next = task;
+        } else {
+            first = task;
+        }
+        last = task;
+    }
+    if (first == NULL) {
+        return 0;
+    }
+    // Publish the whole chain with one CAS (same ordering rationale as in
+    // schedule). Tasks may be consumed and recycled once published, don't
+    // touch them afterwards.
+    Task* head = _task_head.load(butil::memory_order_relaxed);
+    do {
+        last->next = head;
+    } while (!_task_head.compare_exchange_weak(
+                 head, first, butil::memory_order_acq_rel,
+                 butil::memory_order_relaxed));
+    // One CAS-min for the whole batch since all tasks share the run time.
+    int64_t nearest = _nearest_run_time.load(butil::memory_order_relaxed);
+    while (run_time < nearest) {
+        if (_nearest_run_time.compare_exchange_weak(
+                nearest, run_time, butil::memory_order_relaxed)) {
+            *earlier = true;
+            break;
+        }
+    }
+    return nsched;
+}
+
 TimerThread::TaskId TimerThread::schedule(
     void (*fn)(void*), void* arg, const timespec& abstime) {
     if (_stop.load(butil::memory_order_relaxed) || !_started) {
@@ -227,21 +305,55 @@ TimerThread::TaskId TimerThread::schedule(
     if (result.earlier) {
         bool earlier = false;
         const int64_t run_time = butil::timespec_to_microseconds(abstime);
-        {
-            BAIDU_SCOPED_LOCK(_mutex);
-            if (run_time < _nearest_run_time) {
-                _nearest_run_time = run_time;
-                ++_nsignals;
+        int64_t nearest = _nearest_run_time.load(butil::memory_order_relaxed);
+        while (run_time < nearest) {
+            if (_nearest_run_time.compare_exchange_weak(
+                    nearest, run_time, butil::memory_order_relaxed)) {
                 earlier = true;
+                break;
             }
         }
         if (earlier) {
+            // Increased AFTER lowering _nearest_run_time so that the timer
+            // thread sampling _nsignals before checking _nearest_run_time
+            // cannot miss this wakeup.
+            _nsignals.fetch_add(1, butil::memory_order_release);
             futex_wake_private(&_nsignals, 1);
         }
     }
     return result.task_id;
 }
 
+size_t TimerThread::schedule_batch(void (*fn)(void*), void* const args[],
+                                   size_t n, const timespec& abstime,
+                                   TaskId* ids) {
+    if (n == 0 || _stop.load(butil::memory_order_relaxed) || !_started) {
+        return 0;
+    }
+    bool bucket_earlier = false;
+    const size_t nsched =
+        _buckets[butil::fmix64(pthread_numeric_id()) % _options.num_buckets]
+        .schedule_batch(fn, args, n, abstime, ids, &bucket_earlier);
+    if (bucket_earlier) {
+        bool earlier = false;
+        const int64_t run_time = butil::timespec_to_microseconds(abstime);
+        int64_t nearest = _nearest_run_time.load(butil::memory_order_relaxed);
+        while (run_time < nearest) {
+            if (_nearest_run_time.compare_exchange_weak(
+                    nearest, run_time, butil::memory_order_relaxed)) {
+                earlier = true;
+                break;
+            }
+        }
+        if (earlier) {
+            // See the comments in schedule().
+            _nsignals.fetch_add(1, butil::memory_order_release);
+            futex_wake_private(&_nsignals, 1);
+        }
+    }
+    return nsched;
+}
+
 // Notice that we don't recycle the Task in this function, let TimerThread::run
 // do it. The side effect is that we may allocated many unscheduled tasks before
 // TimerThread wakes up. The number is approximiately qps * timeout_s. Under the
@@ -343,10 +455,8 @@ void TimerThread::run() {
         // Clear _nearest_run_time before consuming tasks from buckets.
         // This helps us to be aware of earliest task of the new tasks before we
         // would run the consumed tasks.
-        {
-            BAIDU_SCOPED_LOCK(_mutex);
-            _nearest_run_time = std::numeric_limits<int64_t>::max();
-        }
+        _nearest_run_time.store(std::numeric_limits<int64_t>::max(),
+                                butil::memory_order_relaxed);
         
         // Pull tasks from buckets.
         for (size_t i = 0; i < _options.num_buckets; ++i) {
@@ -385,13 +495,11 @@ void TimerThread::run() {
             // are in descending orders, all tasks are "earliest" after every
             // insertion, and they'll grab _mutex and change _nearest_run_time
             // frequently, fortunately this is not true at most of time).
-            {
-                BAIDU_SCOPED_LOCK(_mutex);
-                if (task1->run_time > _nearest_run_time) {
-                    // a task is earlier than task1. We need to check buckets.
-                    pull_again = true;
-                    break;
-                }
+            if (task1->run_time >
+                _nearest_run_time.load(butil::memory_order_relaxed)) {
+                // a task is earlier than task1. We need to check buckets.
+                pull_again = true;
+                break;
             }
             std::pop_heap(tasks.begin(), tasks.end(), task_greater);
             tasks.pop_back();
@@ -413,17 +521,19 @@ void TimerThread::run() {
         // _nearest_run_time to prevent us from waiting on a non-earliest
         // task. We also use the _nsignal to make sure that if new task 
         // is earlier that the realtime that we wait for, we'll wake up.
-        int expected_nsignals = 0;
-        {
-            BAIDU_SCOPED_LOCK(_mutex);
-            if (next_run_time > _nearest_run_time) {
-                // a task is earlier that what we would wait for.
-                // We need to check buckets.
-                continue;
-            } else {
-                _nearest_run_time = next_run_time;
-                expected_nsignals = _nsignals;
-            }
+        // Sample _nsignals BEFORE checking _nearest_run_time: a scheduler
+        // lowering _nearest_run_time after the sample always increases
+        // _nsignals afterwards, which makes the futex_wait below return
+        // immediately instead of missing the earlier task.
+        const int expected_nsignals =
+            _nsignals.load(butil::memory_order_acquire);
+        int64_t nearest = _nearest_run_time.load(butil::memory_order_relaxed);
+        if (next_run_time > nearest ||
+            !_nearest_run_time.compare_exchange_strong(
+                nearest, next_run_time, butil::memory_order_relaxed)) {
+            // a task is earlier than what we would wait for.
+            // We need to check buckets.
+            continue;
         }
         timespec* ptimeout = NULL;
         timespec next_timeout = { 0, 0 };
@@ -442,12 +552,9 @@ void TimerThread::run() {
 void TimerThread::stop_and_join() {
     _stop.store(true, butil::memory_order_relaxed);
     if (_started) {
-        {
-            BAIDU_SCOPED_LOCK(_mutex);
-             // trigger pull_again and wakeup TimerThread
-            _nearest_run_time = 0;
-            ++_nsignals;
-        }
+        // trigger pull_again and wakeup TimerThread
+        _nearest_run_time.store(0, butil::memory_order_relaxed);
+        _nsignals.fetch_add(1, butil::memory_order_release);
         if (pthread_self() != _thread) {
             // stop_and_join was not called from a running task.
             // wake up the timer thread in case it is sleeping.
@@ -73,6 +73,14 @@ public:
     // Returns: identifier of the scheduled task, INVALID_TASK_ID on error.
     TaskId schedule(void (*fn)(void*), void* arg, const timespec& abstime);
 
+    // Schedule |fn(args[i])| for i in [0, n) to all run at realtime
+    // |abstime| approximately, amortizing the bucket publish and the
+    // wakeup check over the whole batch. Identifiers are put into
+    // ids[0..n), usable with unschedule() individually.
+    // Returns: number of scheduled tasks(a prefix of ids), n on success.
+    size_t schedule_batch(void (*fn)(void*), void* const args[], size_t n,
+                          const timespec& abstime, TaskId* ids);
+
     // Prevent the task denoted by `task_id' from running. `task_id' must be
     // returned by schedule() ever.
     // Returns:
@@ -95,11 +103,12 @@ private:
 
     TimerThreadOptions _options;
     Bucket* _buckets;        // list of tasks to be run
-    internal::FastPthreadMutex _mutex;    // protect _nearest_run_time
-    int64_t _nearest_run_time;
+    // Nearest run time of scheduled tasks, lowered by schedulers with a
+    // CAS-min and reset by the timer thread.
+    butil::atomic<int64_t> _nearest_run_time;
     // the futex for wake up timer thread. can't use _nearest_run_time because
     // it's 64-bit.
-    int _nsignals;
+    butil::atomic<int> _nsignals;
     pthread_t _thread;       // all scheduled task will be run on this thread
 };
 
@@ -45,6 +45,14 @@ typedef unsigned bthread_attrflags_t;
 static const bthread_attrflags_t BTHREAD_LOG_START_AND_FINISH = 8;
 static const bthread_attrflags_t BTHREAD_LOG_CONTEXT_SWITCH = 16;
 static const bthread_attrflags_t BTHREAD_NOSIGNAL = 32;
+// Hint for bthread_start_urgent: when the caller is a worker whose run queue
+// is empty, run the function in-place on the caller's stack instead of going
+// through two context switches. Limited to cheap functions: the function
+// shares the caller's bthread identity and local storage, and blocking inside
+// it blocks the caller. When the run queue is busy or in-place executions
+// nest too deeply, the thread is started normally. The returned tid is
+// joinable as usual.
+static const bthread_attrflags_t BTHREAD_INLINE = 64;
 
 // Key of thread-local data, created by bthread_key_create.
 typedef struct {
@@ -91,12 +99,21 @@ typedef struct bthread_attr_t {
     bthread_stacktype_t stack_type;
     bthread_attrflags_t flags;
     bthread_keytable_pool_t* keytable_pool;
+    // When non-zero, bthread_start_background() queues the thread to the
+    // worker designated by this value instead of the caller's worker, so
+    // that threads sharing the value start on the same worker and reuse
+    // its caches, e.g. all processing of one connection hashed by the
+    // SocketId. The affinity is best-effort: idle workers may still steal
+    // the thread when the designated worker is saturated, trading some
+    // locality for not leaving cores idle. Default: 0 (no affinity)
+    unsigned affinity;
 
 #if defined(__cplusplus)
     void operator=(unsigned stacktype_and_flags) {
         stack_type = (stacktype_and_flags & 7);
         flags = (stacktype_and_flags & ~(unsigned)7u);
         keytable_pool = NULL;
+        affinity = 0;
     }
     bthread_attr_t operator|(unsigned other_flags) const {
         CHECK(!(other_flags & 7)) << "flags=" << other_flags;
@@ -114,23 +131,24 @@ typedef struct bthread_attr_t {
 // obvious drawback is that you need more worker pthreads when you have a lot
 // of such bthreads.
 static const bthread_attr_t BTHREAD_ATTR_PTHREAD =
-{ BTHREAD_STACKTYPE_PTHREAD, 0, NULL };
+{ BTHREAD_STACKTYPE_PTHREAD, 0, NULL, 0 };
 
 // bthreads created with following attributes will have different size of
 // stacks. Default is BTHREAD_ATTR_NORMAL.
 static const bthread_attr_t BTHREAD_ATTR_SMALL =
-{ BTHREAD_STACKTYPE_SMALL, 0, NULL };
+{ BTHREAD_STACKTYPE_SMALL, 0, NULL, 0 };
 static const bthread_attr_t BTHREAD_ATTR_NORMAL =
-{ BTHREAD_STACKTYPE_NORMAL, 0, NULL };
+{ BTHREAD_STACKTYPE_NORMAL, 0, NULL, 0 };
 static const bthread_attr_t BTHREAD_ATTR_LARGE =
-{ BTHREAD_STACKTYPE_LARGE, 0, NULL };
+{ BTHREAD_STACKTYPE_LARGE, 0, NULL, 0 };
 
 // bthreads created with this attribute will print log when it's started,
 // context-switched, finished.
 static const bthread_attr_t BTHREAD_ATTR_DEBUG = {
     BTHREAD_STACKTYPE_NORMAL,
     BTHREAD_LOG_START_AND_FINISH | BTHREAD_LOG_CONTEXT_SWITCH,
-    NULL
+    NULL,
+    0
 };
 
 static const size_t BTHREAD_EPOLL_THREAD_NUM = 1;
@@ -159,6 +177,12 @@ typedef struct {
 typedef struct {
     unsigned* butex;
     bthread_contention_site_t csite;
+    // The bthread holding the mutex(0 when held by a pthread or free),
+    // best-effort and only consulted for priority inheritance: waiters
+    // enqueuing on a contended mutex boost the holder to their priority
+    // so that it cannot be starved off-CPU by ordinary ready bthreads
+    // while high-priority bthreads wait on it.
+    bthread_t owner;
 } bthread_mutex_t;
 
 typedef struct {
@@ -49,6 +49,19 @@ extern int bthread_about_to_quit();
 extern int bthread_timer_add(bthread_timer_t* id, timespec abstime,
                              void (*on_timer)(void*), void* arg);
 
+// Run `on_timer(args[i])' for i in [0, n) at or after real-time `abstime',
+// putting identifiers of the timers into ids[0..n). Scheduling a batch of
+// same-deadline timers this way is considerably cheaper than n separate
+// bthread_timer_add() calls under contention: the internal publish and the
+// wakeup of the timer thread are amortized over the whole batch. Each id
+// can still be deleted individually with bthread_timer_del().
+// Return 0 on success(all n timers scheduled), errno otherwise(none
+// scheduled).
+extern int bthread_timer_add_batch(bthread_timer_t* ids, size_t n,
+                                   timespec abstime,
+                                   void (*on_timer)(void*),
+                                   void* const args[]);
+
 // Unschedule the timer associated with `id'.
 // Returns: 0 - exist & not-run; 1 - still running; EINVAL - not exist.
 extern int bthread_timer_del(bthread_timer_t id);
@@ -97,6 +110,13 @@ extern int bthread_key_create2(bthread_key_t* key,
                                void (*destructor)(void* data, const void* dtor_arg),
                                const void* dtor_arg);
 
+// The fast-slot counterpart of bthread_key_create2, see
+// bthread_key_create_fast in bthread.h.
+extern int bthread_key_create2_fast(
+    bthread_key_t* key,
+    void (*destructor)(void* data, const void* dtor_arg),
+    const void* dtor_arg);
+
 // CAUTION: functions marked with [PRC INTERNAL] are NOT supposed to be called
 // by RPC users.
 
@@ -134,6 +134,52 @@ public:
         return true;
     }
 
+    // Steal up to `max_n' items from the queue into `vals'.
+    // Returns the number of stolen items, possibly 0.
+    // At most half of the items observed in the queue are taken so that
+    // a single thief does not drain a busy victim.
+    // May run in parallel with push() pop() or another steal().
+    //
+    // NOTE: items are still claimed with one CAS each. Claiming a range
+    // [t, t+n) with a single CAS on _top would be incorrect: pop() takes
+    // items from the bottom without touching _top (it only competes on
+    // _top for the last item), so any item but the one at _top may be
+    // popped concurrently and each claim must be re-verified against
+    // _bottom. Consecutive claims are still much cheaper than separate
+    // steal() calls from different schedulings since the cacheline of
+    // _top stays in the thief between them.
+    size_t steal_batch(T* vals, size_t max_n) {
+        size_t t = _top.load(butil::memory_order_acquire);
+        size_t b = _bottom.load(butil::memory_order_acquire);
+        if (t >= b) {
+            // Permit false negative for performance considerations.
+            return 0;
+        }
+        size_t n = 0;
+        while (n < max_n) {
+            butil::atomic_thread_fence(butil::memory_order_seq_cst);
+            b = _bottom.load(butil::memory_order_acquire);
+            if (t >= b) {
+                break;
+            }
+            // Take at most half of what is currently visible, counting
+            // items already taken in this batch. The first item is always
+            // eligible, matching steal() on a single-item queue.
+            if (n != 0 && 2 * (n + 1) > n + (b - t)) {
+                break;
+            }
+            vals[n] = _buffer[t & (_capacity - 1)];
+            if (_top.compare_exchange_strong(t, t + 1,
+                                             butil::memory_order_seq_cst,
+                                             butil::memory_order_relaxed)) {
+                ++n;
+                ++t;
+            }
+            // On failure `t' was reloaded by the CAS, retry on the new top.
+        }
+        return n;
+    }
+
     size_t volatile_size() const {
         const size_t b = _bottom.load(butil::memory_order_relaxed);
         const size_t t = _top.load(butil::memory_order_relaxed);
@@ -4,16 +4,133 @@
 
 #include "butil/base64.h"
 
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#include "butil/cpu.h"
+#endif
+
 #include "third_party/modp_b64/modp_b64.h"
 
 namespace butil {
 
+#if defined(__SSSE3__)
+namespace {
+
+bool HasSSSE3() {
+  static const bool has_ssse3 = CPU().has_ssse3();
+  return has_ssse3;
+}
+
+// Shuffle-based kernels from Mula & Lemire, "Faster Base64 Encoding and
+// Decoding Using AVX2 Instructions". Each iteration encodes 12 input bytes
+// into 16 characters or decodes 16 characters into 12 bytes; tails and
+// padding are handled by the scalar modp_b64 code.
+
+// Encodes 12-byte chunks of |src| into 16-character chunks of |dst| while
+// at least 16 readable bytes remain. Returns the number of bytes consumed,
+// always a multiple of 12.
+size_t EncodeChunksSSSE3(char* dst, const char* src, size_t len) {
+  // Offsets turning a 6-bit index into its base64 character, picked by the
+  // range the index falls in: 'A' for [0,26), 'a'-26 for [26,52),
+  // '0'-52 for [52,62), '+'-62 and '/'-63 for the last two.
+  const __m128i lut = _mm_setr_epi8(
+      65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0);
+  const char* const src_begin = src;
+  while (len >= 16) {
+    __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+    // Duplicate each 3-byte group so that every 16-bit lane holds the bytes
+    // its two 6-bit fields are extracted from.
+    in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7,
+                                           4, 5, 3, 4, 1, 2, 0, 1));
+    const __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0FC0FC00));
+    const __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+    const __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003F03F0));
+    const __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+    const __m128i indices = _mm_or_si128(t1, t3);
+    __m128i offsets = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+    const __m128i over_25 = _mm_cmpgt_epi8(indices, _mm_set1_epi8(25));
+    offsets = _mm_sub_epi8(offsets, over_25);
+    const __m128i out =
+        _mm_add_epi8(indices, _mm_shuffle_epi8(lut, offsets));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), out);
+    src += 12;
+    dst += 16;
+    len -= 12;
+  }
+  return src - src_begin;
+}
+
+// Decodes 16-character chunks of |src| into 12-byte chunks of |dst| while
+// more than 16 characters remain, so that padding is never seen here.
+// Stops at the first chunk with a non-base64 character and leaves it to the
+// scalar code, which reports the error. Returns the number of characters
+// consumed, always a multiple of 16. |dst| must have room for 16 bytes per
+// chunk; the trailing 4 garbage bytes are overwritten by the next chunk or
+// by the scalar tail.
+size_t DecodeChunksSSSE3(char* dst, const char* src, size_t len) {
+  const __m128i lut_lo = _mm_setr_epi8(
+      0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+      0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+  const __m128i lut_hi = _mm_setr_epi8(
+      0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+      0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+  const __m128i lut_roll = _mm_setr_epi8(
+      0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+  const __m128i mask_2F = _mm_set1_epi8(0x2F);
+  const char* const src_begin = src;
+  while (len >= 32) {
+    const __m128i str =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+    const __m128i hi_nibbles =
+        _mm_and_si128(_mm_srli_epi32(str, 4), mask_2F);
+    const __m128i lo_nibbles = _mm_and_si128(str, mask_2F);
+    const __m128i lo = _mm_shuffle_epi8(lut_lo, lo_nibbles);
+    const __m128i hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+    if (_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_and_si128(lo, hi),
+                                         _mm_setzero_si128())) != 0) {
+      break;  // a character outside the base64 alphabet.
+    }
+    const __m128i eq_2F = _mm_cmpeq_epi8(str, mask_2F);
+    const __m128i roll =
+        _mm_shuffle_epi8(lut_roll, _mm_add_epi8(eq_2F, hi_nibbles));
+    // Translate characters to 6-bit values, then pack each group of four
+    // into 3 bytes.
+    const __m128i values = _mm_add_epi8(str, roll);
+    const __m128i merged =
+        _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+    const __m128i packed =
+        _mm_madd_epi16(merged, _mm_set1_epi32(0x00011000));
+    const __m128i out = _mm_shuffle_epi8(
+        packed, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12,
+                              -1, -1, -1, -1));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), out);
+    src += 16;
+    dst += 12;
+    len -= 16;
+  }
+  return src - src_begin;
+}
+
+}  // namespace
+#endif  // __SSSE3__
+
 void Base64Encode(const StringPiece& input, std::string* output) {
   std::string temp;
   temp.resize(modp_b64_encode_len(input.size()));  // makes room for null byte
 
+  const char* src = input.data();
+  size_t src_len = input.size();
+  size_t output_size = 0;
+#if defined(__SSSE3__)
+  if (src_len >= 16 && HasSSSE3()) {
+    const size_t consumed = EncodeChunksSSSE3(&temp[0], src, src_len);
+    output_size = consumed / 12 * 16;
+    src += consumed;
+    src_len -= consumed;
+  }
+#endif
   // modp_b64_encode_len() returns at least 1, so temp[0] is safe to use.
-  size_t output_size = modp_b64_encode(&(temp[0]), input.data(), input.size());
+  output_size += modp_b64_encode(&temp[output_size], src, src_len);
 
   temp.resize(output_size);  // strips off null byte
   output->swap(temp);
@@ -23,11 +140,22 @@ bool Base64Decode(const StringPiece& input, std::string* output) {
   std::string temp;
   temp.resize(modp_b64_decode_len(input.size()));
 
+  const char* src = input.data();
+  size_t src_len = input.size();
+  size_t output_size = 0;
+#if defined(__SSSE3__)
+  if (src_len >= 32 && HasSSSE3()) {
+    const size_t consumed = DecodeChunksSSSE3(&temp[0], src, src_len);
+    output_size = consumed / 16 * 12;
+    src += consumed;
+    src_len -= consumed;
+  }
+#endif
   // does not null terminate result since result is binary data!
-  size_t input_size = input.size();
-  size_t output_size = modp_b64_decode(&(temp[0]), input.data(), input_size);
-  if (output_size == MODP_B64_ERROR)
+  size_t tail_size = modp_b64_decode(&temp[output_size], src, src_len);
+  if (tail_size == MODP_B64_ERROR)
     return false;
+  output_size += tail_size;
 
   temp.resize(output_size);
   output->swap(temp);
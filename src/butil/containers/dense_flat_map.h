@@ -0,0 +1,530 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// An open-addressing counterpart of FlatMap. While FlatMap chains
+// collided keys through allocated nodes and every miss chases pointers,
+// this map stores all elements in one flat array and keeps a byte of
+// control data per slot: 7 bits of the hash code for occupied slots,
+// special values for empty/deleted ones. Seeks compare 16 control bytes
+// at a time (one SSE2 instruction on x86-64) and only touch elements
+// whose control byte matches, so a probe rarely leaves two cache lines
+// even at high load factors. The seek/insert/erase/init API matches
+// FlatMap so hot call sites can switch by changing the type only.
+//
+// Differences from FlatMap:
+//  * elements may be moved to other slots by insert/erase (rehash),
+//    pointers returned by seek/insert are invalidated by modifications
+//    just like pointers into a std::vector.
+//  * erase() leaves a tombstone which is reclaimed by the next rehash.
+//  * nbucket is always rounded to power of 2 (group probing requires it),
+//    FLAT_MAP_ROUND_BUCKET_BY_USE_NEXT_PRIME does not apply.
+
+#ifndef BUTIL_DENSE_FLAT_MAP_H
+#define BUTIL_DENSE_FLAT_MAP_H
+
+#include <stdlib.h>                                // malloc/free
+#include <string.h>                                // memset
+#if defined(__SSE2__)
+#include <emmintrin.h>                             // _mm_cmpeq_epi8
+#endif
+#include "butil/containers/flat_map.h"             // FlatMapElement, hashers
+
+namespace butil {
+
+template <typename _Map, typename _Element> class DenseFlatMapIterator;
+
+// Bit i of the result is set iff ctrl[i] equals `pattern'.
+inline uint32_t dense_flatmap_match(const int8_t* ctrl, int8_t pattern) {
+#if defined(__SSE2__)
+    const __m128i group = _mm_loadu_si128((const __m128i*)ctrl);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(pattern)));
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < 16; ++i) {
+        mask |= (uint32_t)(ctrl[i] == pattern) << i;
+    }
+    return mask;
+#endif
+}
+
+// Bit i of the result is set iff ctrl[i] is empty or deleted.
+inline uint32_t dense_flatmap_match_non_full(const int8_t* ctrl) {
+#if defined(__SSE2__)
+    return _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)ctrl));
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < 16; ++i) {
+        mask |= (uint32_t)(ctrl[i] < 0) << i;
+    }
+    return mask;
+#endif
+}
+
+// NOTE: Objects stored in DenseFlatMap MUST be copyable, and are moved
+// around by rehashing, do not keep pointers into this map across
+// insert/erase/resize.
+template <typename _K, typename _T,
+          typename _Hash = DefaultHasher<_K>,
+          typename _Equal = DefaultEqualTo<_K> >
+class DenseFlatMap {
+public:
+    typedef _K key_type;
+    typedef _T mapped_type;
+    typedef FlatMapElement<_K, _T> Element;
+    typedef typename Element::value_type value_type;
+    typedef DenseFlatMapIterator<DenseFlatMap, value_type> iterator;
+    typedef DenseFlatMapIterator<DenseFlatMap, const value_type> const_iterator;
+    typedef _Hash hasher;
+    typedef _Equal key_equal;
+
+    static const size_t GROUP_SIZE = 16;
+
+    DenseFlatMap(const hasher& hashfn = hasher(),
+                 const key_equal& eql = key_equal());
+    ~DenseFlatMap();
+    DenseFlatMap(const DenseFlatMap& rhs);
+    void operator=(const DenseFlatMap& rhs);
+    void swap(DenseFlatMap& rhs);
+
+    // Must be called to initialize this map, otherwise insert/operator[]
+    // crashes, and seek/erase fails. Semantics of `nbucket' and
+    // `load_factor' are same with FlatMap except that nbucket is always
+    // rounded to power of 2 and tombstones count against the load.
+    int init(size_t nbucket, u_int load_factor = 80);
+
+    // Insert a pair of |key| and |value|, overwriting the value of an
+    // existing key. Returns address of the inserted value, NULL on error.
+    mapped_type* insert(const key_type& key, const mapped_type& value);
+
+    // Remove |key| and the associated value.
+    // Returns: 1 on erased, 0 otherwise.
+    template <typename K2>
+    size_t erase(const K2& key, mapped_type* old_value = NULL);
+
+    // Remove all items. Allocated spaces are NOT returned to system.
+    void clear();
+
+    // Search for the value associated with |key|.
+    // Returns: address of the value, NULL when |key| does not exist.
+    template <typename K2> mapped_type* seek(const K2& key) const;
+
+    // Get the value associated with |key|. If |key| does not exist,
+    // insert with a default-constructed value.
+    mapped_type& operator[](const key_type& key);
+
+    // Rehash into at least `nbucket' buckets, also reclaiming tombstones.
+    // Returns successful or not.
+    bool resize(size_t nbucket);
+
+    iterator begin() { return iterator(this, 0); }
+    iterator end() { return iterator(this, _nbucket); }
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, _nbucket); }
+
+    // True if init() was successfully called.
+    bool initialized() const { return _ctrl != NULL; }
+
+    bool empty() const { return _size == 0; }
+    size_t size() const { return _size; }
+    size_t bucket_count() const { return _nbucket; }
+    u_int load_factor() const { return _load_factor; }
+
+private:
+template <typename _Map, typename _Element> friend class DenseFlatMapIterator;
+
+    static const int8_t CTRL_EMPTY = (int8_t)-128;
+    static const int8_t CTRL_DELETED = (int8_t)-2;
+
+    static bool is_full(int8_t c) { return c >= 0; }
+    // Low 7 bits of the hash code go into control bytes, the rest selects
+    // the first probed group.
+    static int8_t ctrl_of(size_t hash_code)
+    { return (int8_t)(hash_code & 0x7f); }
+    size_t first_probe(size_t hash_code) const
+    { return (hash_code >> 7) & (_nbucket - 1); }
+
+    Element& element_at(size_t i) const
+    { return *reinterpret_cast<Element*>(_slots + i * sizeof(Element)); }
+
+    // Keep the mirrored first group (read by unaligned group loads at the
+    // end of the table) in sync.
+    void set_ctrl(size_t i, int8_t c) {
+        _ctrl[i] = c;
+        if (i < GROUP_SIZE) {
+            _ctrl[i + _nbucket] = c;
+        }
+    }
+
+    // Find the slot of |key|. Returns npos when |key| does not exist.
+    template <typename K2> size_t find_index(const K2& key) const;
+
+    // First empty/deleted slot along the probe sequence of `hash_code'.
+    size_t find_insert_index(size_t hash_code) const;
+
+    bool is_too_crowded(size_t size) const
+    { return (size + _ndeleted) * 100 >= _nbucket * _load_factor; }
+
+    static const size_t npos = (size_t)-1;
+
+    size_t _size;
+    size_t _ndeleted;
+    size_t _nbucket;
+    int8_t* _ctrl;
+    char* _slots;
+    u_int _load_factor;
+    hasher _hashfn;
+    key_equal _eql;
+};
+
+template <typename Map, typename Value> class DenseFlatMapIterator {
+public:
+    typedef Value value_type;
+    typedef Value& reference;
+    typedef Value* pointer;
+    typedef typename add_const<Value>::type ConstValue;
+    typedef std::forward_iterator_tag iterator_category;
+    typedef ptrdiff_t difference_type;
+    typedef typename remove_const<Value>::type NonConstValue;
+
+    DenseFlatMapIterator() : _map(NULL), _pos(0) {}
+    DenseFlatMapIterator(const Map* map, size_t pos) : _map(map), _pos(pos) {
+        if (!_map->initialized()) {
+            _pos = 0;
+        } else {
+            skip_non_full();
+        }
+    }
+    DenseFlatMapIterator(const DenseFlatMapIterator<Map, NonConstValue>& rhs)
+        : _map(rhs._map), _pos(rhs._pos) {}
+
+    bool operator==(const DenseFlatMapIterator& rhs) const
+    { return _pos == rhs._pos; }
+    bool operator!=(const DenseFlatMapIterator& rhs) const
+    { return _pos != rhs._pos; }
+
+    DenseFlatMapIterator& operator++() {
+        ++_pos;
+        skip_non_full();
+        return *this;
+    }
+    DenseFlatMapIterator operator++(int) {
+        DenseFlatMapIterator tmp = *this;
+        this->operator++();
+        return tmp;
+    }
+
+    reference operator*() const
+    { return _map->element_at(_pos).value_ref(); }
+    pointer operator->() const
+    { return &_map->element_at(_pos).value_ref(); }
+
+private:
+friend class DenseFlatMapIterator<Map, ConstValue>;
+friend class DenseFlatMap<typename Map::key_type, typename Map::mapped_type,
+                          typename Map::hasher, typename Map::key_equal>;
+
+    void skip_non_full() {
+        while (_pos < _map->_nbucket && !Map::is_full(_map->_ctrl[_pos])) {
+            ++_pos;
+        }
+    }
+
+    const Map* _map;
+    size_t _pos;
+};
+
+// Implement DenseFlatMap
+template <typename _K, typename _T, typename _H, typename _E>
+DenseFlatMap<_K, _T, _H, _E>::DenseFlatMap(const hasher& hashfn,
+                                           const key_equal& eql)
+    : _size(0)
+    , _ndeleted(0)
+    , _nbucket(0)
+    , _ctrl(NULL)
+    , _slots(NULL)
+    , _load_factor(0)
+    , _hashfn(hashfn)
+    , _eql(eql) {
+}
+
+template <typename _K, typename _T, typename _H, typename _E>
+DenseFlatMap<_K, _T, _H, _E>::~DenseFlatMap() {
+    clear();
+    free(_ctrl);
+    _ctrl = NULL;
+    free(_slots);
+    _slots = NULL;
+    _nbucket = 0;
+}
+
+template <typename _K, typename _T, typename _H, typename _E>
+DenseFlatMap<_K, _T, _H, _E>::DenseFlatMap(const DenseFlatMap& rhs)
+    : _size(0)
+    , _ndeleted(0)
+    , _nbucket(0)
+    , _ctrl(NULL)
+    , _slots(NULL)
+    , _load_factor(0)
+    , _hashfn(rhs._hashfn)
+    , _eql(rhs._eql) {
+    operator=(rhs);
+}
+
+template <typename _K, typename _T, typename _H, typename _E>
+void DenseFlatMap<_K, _T, _H, _E>::operator=(const DenseFlatMap& rhs) {
+    if (this == &rhs) {
+        return;
+    }
+    clear();
+    if (!rhs.initialized()) {
+        return;
+    }
+    if (!initialized() &&
+        init(rhs._nbucket, rhs._load_factor) != 0) {
+        LOG(ERROR) << "Fail to init map";
+        return;
+    }
+    for (const_iterator it = rhs.begin(); it != rhs.end(); ++it) {
+        operator[](Element::first_ref_from_value(*it)) =
+            Element::second_ref_from_value(*it);
+    }
+}
+
+template <typename _K, typename _T, typename _H, typename _E>
+void DenseFlatMap<_K, _T, _H, _E>::swap(DenseFlatMap& rhs) {
+    std::swap(rhs._size, _size);
+    std::swap(rhs._ndeleted, _ndeleted);
+    std::swap(rhs._nbucket, _nbucket);
+    std::swap(rhs._ctrl, _ctrl);
+    std::swap(rhs._slots, _slots);
+    std::swap(rhs._load_factor, _load_factor);
+    std::swap(rhs._hashfn, _hashfn);
+    std::swap(rhs._eql, _eql);
+}
+
+template <typename _K, typename _T, typename _H, typename _E>
+int DenseFlatMap<_K, _T, _H, _E>::init(size_t nbucket, u_int load_factor) {
+    if (initialized()) {
+        LOG(ERROR) << "Already initialized";
+        return -1;
+    }
+    if (load_factor < 10 || load_factor > 95) {
+        LOG(ERROR) << "Invalid load_factor=" << load_factor;
+        return -1;
+    }
+    // A probed group must never be entirely out of the table and an empty
+    // slot must exist to stop probing, both are guaranteed by rounding up
+    // and the load factor cap.
+    _nbucket = find_power2(nbucket < GROUP_SIZE ? GROUP_SIZE : nbucket);
+    _size = 0;
+    _ndeleted = 0;
+    _load_factor = load_factor;
+    _ctrl = (int8_t*)malloc(_nbucket + GROUP_SIZE);
+    if (NULL == _ctrl) {
+        LOG(ERROR) << "Fail to new _ctrl";
+        return -1;
+    }
+    memset(_ctrl, CTRL_EMPTY, _nbucket + GROUP_SIZE);
+    _slots = (char*)malloc(_nbucket * sizeof(Element));
+    if (NULL == _slots) {
+        LOG(ERROR) << "Fail to new _slots";
+        free(_ctrl);
+        _ctrl = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+template <typename _K, typename _T, typename _H, typename _E>
+template <typename K2>
+size_t DenseFlatMap<_K, _T, _H, _E>::find_index(const K2& key) const {
+    if (!initialized()) {
+        return npos;
+    }
+    const size_t hash_code = _hashfn(key);
+    const int8_t pattern = ctrl_of(hash_code);
+    size_t offset = first_probe(hash_code);
+    do {
+        uint32_t matches = dense_flatmap_match(_ctrl + offset, pattern);
+        while (matches) {
+            const size_t i =
+                (offset + __builtin_ctz(matches)) & (_nbucket - 1);
+            if (_eql(element_at(i).first_ref(), key)) {
+                return i;
+            }
+            matches &= matches - 1;
+        }
+        if (dense_flatmap_match(_ctrl + offset, CTRL_EMPTY)) {
+            return npos;
+        }
+        offset = (offset + GROUP_SIZE) & (_nbucket - 1);
+    } while (true);
+}
+
+template <typename _K, typename _T, typename _H, typename _E>
+size_t DenseFlatMap<_K, _T, _H, _E>::find_insert_index(
+    size_t hash_code) const {
+    size_t offset = first_probe(hash_code);
+    do {
+        const uint32_t matches = dense_flatmap_match_non_full(_ctrl + offset);
+        if (matches) {
+            return (offset + __builtin_ctz(matches)) & (_nbucket - 1);
+        }
+        offset = (offset + GROUP_SIZE) & (_nbucket - 1);
+    } while (true);
+}
+
+template <typename _K, typename _T, typename _H, typename _E>
+template <typename K2>
+_T* DenseFlatMap<_K, _T, _H, _E>::seek(const K2& key) const {
+    const size_t i = find_index(key);
+    return i != npos ? &element_at(i).second_ref() : NULL;
+}
+
+template <typename _K, typename _T, typename _H, typename _E>
+_T& DenseFlatMap<_K, _T, _H, _E>::operator[](const key_type& key) {
+    size_t i = find_index(key);
+    if (i != npos) {
+        return element_at(i).second_ref();
+    }
+    if (is_too_crowded(_size + 1) && !resize(_nbucket * 2)) {
+        // fail to resize is extremely unlikely, but we lose nothing by
+        // putting the value into the remaining free slots.
+    }
+    const size_t hash_code = _hashfn(key);
+    i = find_insert_index(hash_code);
+    if (_ctrl[i] == CTRL_DELETED) {
+        --_ndeleted;
+    }
+    set_ctrl(i, ctrl_of(hash_code));
+    new (&element_at(i)) Element(key);
+    ++_size;
+    return element_at(i).second_ref();
+}
+
+template <typename _K, typename _T, typename _H, typename _E>
+_T* DenseFlatMap<_K, _T, _H, _E>::insert(const key_type& key,
+                                         const mapped_type& value) {
+    mapped_type* p = &operator[](key);
+    *p = value;
+    return p;
+}
+
+template <typename _K, typename _T, typename _H, typename _E>
+template <typename K2>
+size_t DenseFlatMap<_K, _T, _H, _E>::erase(const K2& key,
+                                           mapped_type* old_value) {
+    const size_t i = find_index(key);
+    if (i == npos) {
+        return 0;
+    }
+    if (old_value) {
+        *old_value = element_at(i).second_ref();
+    }
+    element_at(i).~Element();
+    set_ctrl(i, CTRL_DELETED);
+    ++_ndeleted;
+    --_size;
+    return 1;
+}
+
+template <typename _K, typename _T, typename _H, typename _E>
+void DenseFlatMap<_K, _T, _H, _E>::clear() {
+    if (!initialized() || (0 == _size && 0 == _ndeleted)) {
+        return;
+    }
+    for (size_t i = 0; i < _nbucket; ++i) {
+        if (is_full(_ctrl[i])) {
+            element_at(i).~Element();
+        }
+    }
+    memset(_ctrl, CTRL_EMPTY, _nbucket + GROUP_SIZE);
+    _size = 0;
+    _ndeleted = 0;
+}
+
+template <typename _K, typename _T, typename _H, typename _E>
+bool DenseFlatMap<_K, _T, _H, _E>::resize(size_t nbucket2) {
+    if (!initialized()) {
+        return false;
+    }
+    DenseFlatMap new_map(_hashfn, _eql);
+    if (new_map.init(nbucket2, _load_factor) != 0) {
+        LOG(ERROR) << "Fail to init new_map, nbucket=" << nbucket2;
+        return false;
+    }
+    for (iterator it = begin(); it != end(); ++it) {
+        new_map[Element::first_ref_from_value(*it)] =
+            Element::second_ref_from_value(*it);
+    }
+    new_map.swap(*this);
+    return true;
+}
+
+// DenseFlatSet, counterpart of FlatSet.
+template <typename _K,
+          typename _Hash = DefaultHasher<_K>,
+          typename _Equal = DefaultEqualTo<_K> >
+class DenseFlatSet {
+public:
+    typedef DenseFlatMap<_K, FlatMapVoid, _Hash, _Equal> Map;
+    typedef typename Map::key_type key_type;
+    typedef typename Map::value_type value_type;
+    typedef typename Map::iterator iterator;
+    typedef typename Map::const_iterator const_iterator;
+    typedef typename Map::hasher hasher;
+    typedef typename Map::key_equal key_equal;
+
+    DenseFlatSet(const hasher& hashfn = hasher(),
+                 const key_equal& eql = key_equal())
+        : _map(hashfn, eql) {}
+    void swap(DenseFlatSet& rhs) { _map.swap(rhs._map); }
+
+    int init(size_t nbucket, u_int load_factor = 80)
+    { return _map.init(nbucket, load_factor); }
+
+    const void* insert(const key_type& key)
+    { return _map.insert(key, FlatMapVoid()); }
+
+    template <typename K2>
+    size_t erase(const K2& key) { return _map.erase(key, NULL); }
+
+    void clear() { return _map.clear(); }
+
+    template <typename K2>
+    const void* seek(const K2& key) const { return _map.seek(key); }
+
+    bool resize(size_t nbucket) { return _map.resize(nbucket); }
+
+    iterator begin() { return _map.begin(); }
+    iterator end() { return _map.end(); }
+    const_iterator begin() const { return _map.begin(); }
+    const_iterator end() const { return _map.end(); }
+
+    bool initialized() const { return _map.initialized(); }
+    bool empty() const { return _map.empty(); }
+    size_t size() const { return _map.size(); }
+    size_t bucket_count() const { return _map.bucket_count(); }
+    u_int load_factor() const { return _map.load_factor(); }
+
+private:
+    Map _map;
+};
+
+}  // namespace butil
+
+#endif  // BUTIL_DENSE_FLAT_MAP_H
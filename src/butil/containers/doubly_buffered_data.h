@@ -22,6 +22,7 @@
 
 #include <vector>                                       // std::vector
 #include <pthread.h>
+#include <sched.h>                                      // sched_yield
 #include "butil/scoped_lock.h"
 #include "butil/thread_local.h"
 #include "butil/logging.h"
@@ -51,6 +52,15 @@ namespace butil {
 
 class Void { };
 
+// Pass as the TLS parameter to remove the per-thread mutex from Read():
+// each reader publishes an epoch counter(odd while reading) instead of
+// locking, and Modify() waits until counters of all threads are even or
+// changed. A read is then one plain store, one fence and one plain store,
+// saving the two atomic rmw of an uncontended mutex, which matters for
+// maps read on every call in many worker threads, e.g. LB selection.
+// NOTE: user TLS is not supported in this mode.
+class Seq { };
+
 template <typename T, typename TLS = Void>
 class DoublyBufferedData {
     class Wrapper;
@@ -200,43 +210,102 @@ template <typename T>
 class DoublyBufferedDataWrapperBase<T, Void> {
 };
 
-
-template <typename T, typename TLS>
-class DoublyBufferedData<T, TLS>::Wrapper
-    : public DoublyBufferedDataWrapperBase<T, TLS> {
-friend class DoublyBufferedData;
+// Synchronizes one reading thread with Modify(). The default version
+// locks a thread-local mutex around reads which is only contended by
+// Modify() with an empty critical section.
+template <typename TLS>
+class DoublyBufferedDataReadSync {
 public:
-    explicit Wrapper(DoublyBufferedData* c) : _control(c) {
+    DoublyBufferedDataReadSync() {
         pthread_mutex_init(&_mutex, NULL);
     }
-    
-    ~Wrapper() {
-        if (_control != NULL) {
-            _control->RemoveWrapper(this);
-        }
+
+    ~DoublyBufferedDataReadSync() {
         pthread_mutex_destroy(&_mutex);
     }
 
     // _mutex will be locked by the calling pthread and DoublyBufferedData.
     // Most of the time, no modifications are done, so the mutex is
     // uncontended and fast.
-    inline void BeginRead() {
+    inline int BeginRead(const butil::atomic<int>& index) {
         pthread_mutex_lock(&_mutex);
+        return index.load(butil::memory_order_acquire);
     }
 
     inline void EndRead() {
         pthread_mutex_unlock(&_mutex);
     }
 
-    inline void WaitReadDone() {
+    // `bg_index' is the instance Modify() is about to change, unused by
+    // the mutex which blocks reads of both instances.
+    inline void WaitReadDone(int /*bg_index*/) {
         BAIDU_SCOPED_LOCK(_mutex);
     }
-    
+
 private:
-    DoublyBufferedData* _control;
     pthread_mutex_t _mutex;
 };
 
+// Mutex-free read path selected by passing Seq as the TLS parameter.
+// A reader tells which instance it reads through _hazard_index and
+// validates that the foreground was not flipped in between, retrying
+// on the (rare) flip. Modify() spins until no reader is left on the
+// instance that it is about to change.
+template <>
+class DoublyBufferedDataReadSync<Seq> {
+public:
+    DoublyBufferedDataReadSync() : _hazard_index(-1) {}
+
+    inline int BeginRead(const butil::atomic<int>& index) {
+        int fg_index;
+        do {
+            fg_index = index.load(butil::memory_order_acquire);
+            // The release pairs with the acquire in WaitReadDone() to
+            // make reads of previous foreground visible to Modify().
+            _hazard_index.store(fg_index, butil::memory_order_release);
+            // Order publishing of _hazard_index before re-reading
+            // `index': either Modify() sees the published index and
+            // waits for EndRead(), or the validation below fails and
+            // this thread moves to the new foreground.
+            butil::atomic_thread_fence(butil::memory_order_seq_cst);
+        } while (index.load(butil::memory_order_acquire) != fg_index);
+        return fg_index;
+    }
+
+    inline void EndRead() {
+        _hazard_index.store(-1, butil::memory_order_release);
+    }
+
+    inline void WaitReadDone(int bg_index) {
+        butil::atomic_thread_fence(butil::memory_order_seq_cst);
+        while (_hazard_index.load(butil::memory_order_acquire) == bg_index) {
+            sched_yield();
+        }
+    }
+
+private:
+    // Index of the instance being read, -1 when not reading.
+    butil::atomic<int> _hazard_index;
+};
+
+template <typename T, typename TLS>
+class DoublyBufferedData<T, TLS>::Wrapper
+    : public DoublyBufferedDataWrapperBase<T, TLS>
+    , public DoublyBufferedDataReadSync<TLS> {
+friend class DoublyBufferedData;
+public:
+    explicit Wrapper(DoublyBufferedData* c) : _control(c) {}
+
+    ~Wrapper() {
+        if (_control != NULL) {
+            _control->RemoveWrapper(this);
+        }
+    }
+
+private:
+    DoublyBufferedData* _control;
+};
+
 // Called when thread initializes thread-local wrapper.
 template <typename T, typename TLS>
 typename DoublyBufferedData<T, TLS>::Wrapper*
@@ -323,8 +392,7 @@ int DoublyBufferedData<T, TLS>::Read(
     }
     Wrapper* w = static_cast<Wrapper*>(pthread_getspecific(_wrapper_key));
     if (BAIDU_LIKELY(w != NULL)) {
-        w->BeginRead();
-        ptr->_data = UnsafeRead();
+        ptr->_data = _data + w->BeginRead(_index);
         ptr->_w = w;
         return 0;
     }
@@ -332,8 +400,7 @@ int DoublyBufferedData<T, TLS>::Read(
     if (BAIDU_LIKELY(w != NULL)) {
         const int rc = pthread_setspecific(_wrapper_key, w);
         if (rc == 0) {
-            w->BeginRead();
-            ptr->_data = UnsafeRead();
+            ptr->_data = _data + w->BeginRead(_index);
             ptr->_w = w;
             return 0;
         }
@@ -369,7 +436,7 @@ size_t DoublyBufferedData<T, TLS>::Modify(Fn& fn) {
     {
         BAIDU_SCOPED_LOCK(_wrappers_mutex);
         for (size_t i = 0; i < _wrappers.size(); ++i) {
-            _wrappers[i]->WaitReadDone();
+            _wrappers[i]->WaitReadDone(bg_index);
         }
     }
 
@@ -96,6 +96,7 @@
 #include <stdint.h>
 #include <functional>
 #include <iostream>                               // std::ostream
+#include <utility>                                // std::move
 #include "butil/type_traits.h"
 #include "butil/logging.h"
 #include "butil/find_cstr.h"
@@ -182,12 +183,28 @@ public:
     // Returns: address of the value
     template <typename K2> mapped_type* seek(const K2& key) const;
 
+    // Search for the values associated with the |n| keys in |keys| and
+    // store addresses of the values into |values|, NULL for absent keys.
+    // Results equal n calls to seek(). Hashes and prefetches the buckets
+    // of a batch of keys before resolving any of them, so cache misses of
+    // independent lookups overlap instead of forming a dependent-load
+    // chain per key. Noticeably faster than seeking in a loop when the
+    // map is bigger than CPU caches and n is more than a few.
+    template <typename K2>
+    void seek_multi(const K2* keys, size_t n, mapped_type** values) const;
+
     // Get the value associated with |key|. If |key| does not exist,
     // insert with a default-constructed value. If size()*100/bucket_count()
     // is more than load_factor, a resize will be done.
     // Returns reference of the value
     mapped_type& operator[](const key_type& key);
 
+#if defined(BUTIL_CXX11_ENABLED)
+    // Overload for rvalue keys, moving instead of copying the key into
+    // newly-inserted items. Useful when key_type allocates, e.g. std::string.
+    mapped_type& operator[](key_type&& key);
+#endif
+
     // Resize this map. This is optional because resizing will be triggered by
     // insert() or operator[] if there're too many items.
     // Returns successful or not.
@@ -243,6 +260,10 @@ public:
     struct Bucket {
         explicit Bucket(const _K& k) : next(NULL)
         { new (element_spaces) Element(k); }
+#if defined(BUTIL_CXX11_ENABLED)
+        explicit Bucket(_K&& k) : next(NULL)
+        { new (element_spaces) Element(std::move(k)); }
+#endif
         Bucket(const Bucket& other) : next(NULL)
         { new (element_spaces) Element(other.element()); }
         bool is_valid() const { return next != (const Bucket*)-1UL; }
@@ -354,6 +375,9 @@ public:
     // POD) which is wrong generally.
     explicit FlatMapElement(const K& k) : _key(k), _value(T()) {}
     //                                             ^^^^^^^^^^^
+#if defined(BUTIL_CXX11_ENABLED)
+    explicit FlatMapElement(K&& k) : _key(std::move(k)), _value(T()) {}
+#endif
     const K& first_ref() const { return _key; }
     T& second_ref() { return _value; }
     value_type& value_ref() { return *reinterpret_cast<value_type*>(this); }
@@ -497,6 +497,48 @@ _T* FlatMap<_K, _T, _H, _E, _S>::seek(const K2& key) const {
     return NULL;
 }
 
+template <typename _K, typename _T, typename _H, typename _E, bool _S>
+template <typename K2>
+void FlatMap<_K, _T, _H, _E, _S>::seek_multi(
+    const K2* keys, size_t n, _T** values) const {
+    if (!initialized()) {
+        for (size_t i = 0; i < n; ++i) {
+            values[i] = NULL;
+        }
+        return;
+    }
+    // Process keys in fixed-size batches: hash and prefetch the buckets of
+    // a whole batch first, then resolve them. Bucket loads of the batch
+    // miss the cache in parallel rather than one after another.
+    const size_t BATCH = 16;
+    size_t indexes[BATCH];
+    for (size_t begin = 0; begin < n; begin += BATCH) {
+        const size_t batch = (n - begin < BATCH ? n - begin : BATCH);
+        for (size_t i = 0; i < batch; ++i) {
+            indexes[i] = flatmap_mod(_hashfn(keys[begin + i]), _nbucket);
+            __builtin_prefetch(&_buckets[indexes[i]], 0/*read*/);
+        }
+        for (size_t i = 0; i < batch; ++i) {
+            Bucket& first_node = _buckets[indexes[i]];
+            _T** pvalue = &values[begin + i];
+            *pvalue = NULL;
+            if (!first_node.is_valid()) {
+                continue;
+            }
+            if (_eql(first_node.element().first_ref(), keys[begin + i])) {
+                *pvalue = &first_node.element().second_ref();
+                continue;
+            }
+            for (Bucket* p = first_node.next; p; p = p->next) {
+                if (_eql(p->element().first_ref(), keys[begin + i])) {
+                    *pvalue = &p->element().second_ref();
+                    break;
+                }
+            }
+        }
+    }
+}
+
 template <typename _K, typename _T, typename _H, typename _E, bool _S>
 _T& FlatMap<_K, _T, _H, _E, _S>::operator[](const key_type& key) {
     const size_t index = flatmap_mod(_hashfn(key), _nbucket);
@@ -545,6 +587,56 @@ _T& FlatMap<_K, _T, _H, _E, _S>::operator[](const key_type& key) {
     }
 }
 
+#if defined(BUTIL_CXX11_ENABLED)
+template <typename _K, typename _T, typename _H, typename _E, bool _S>
+_T& FlatMap<_K, _T, _H, _E, _S>::operator[](key_type&& key) {
+    const size_t index = flatmap_mod(_hashfn(key), _nbucket);
+    Bucket& first_node = _buckets[index];
+    if (!first_node.is_valid()) {
+        ++_size;
+        if (_S) {
+            bit_array_set(_thumbnail, index);
+        }
+        new (&first_node) Bucket(std::move(key));
+        return first_node.element().second_ref();
+    }
+    if (_eql(first_node.element().first_ref(), key)) {
+        return first_node.element().second_ref();
+    }
+    Bucket *p = first_node.next;
+    if (NULL == p) {
+        if (is_too_crowded(_size)) {
+            if (resize(_nbucket + 1)) {
+                return operator[](std::move(key));
+            }
+            // fail to resize is OK
+        }
+        ++_size;
+        Bucket* newp = new (_pool.get()) Bucket(std::move(key));
+        first_node.next = newp;
+        return newp->element().second_ref();
+    }
+    while (1) {
+        if (_eql(p->element().first_ref(), key)) {
+            return p->element().second_ref();
+        }
+        if (NULL == p->next) {
+            if (is_too_crowded(_size)) {
+                if (resize(_nbucket + 1)) {
+                    return operator[](std::move(key));
+                }
+                // fail to resize is OK
+            }
+            ++_size;
+            Bucket* newp = new (_pool.get()) Bucket(std::move(key));
+            p->next = newp;
+            return newp->element().second_ref();
+        }
+        p = p->next;
+    }
+}
+#endif  // BUTIL_CXX11_ENABLED
+
 template <typename _K, typename _T, typename _H, typename _E, bool _S>
 void FlatMap<_K, _T, _H, _E, _S>::save_iterator(
     const const_iterator& it, PositionHint* hint) const {
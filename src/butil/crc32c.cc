@@ -16,8 +16,15 @@
 #include <stdint.h>
 #ifdef __SSE4_2__
 #include <nmmintrin.h>
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
 #endif
 #include "butil/build_config.h"
+#include "butil/iobuf.h"
+
+#if (defined(__SSE4_2__) && defined(__LP64__)) || defined(__ARM_FEATURE_CRC32)
+#define BUTIL_CRC32C_HW3WAY 1
+#endif
 
 namespace butil {
 namespace crc32c {
@@ -322,13 +329,11 @@ static inline uint32_t LE_LOAD32(const uint8_t *p) {
   return DecodeFixed32(reinterpret_cast<const char*>(p));
 }
 
-#ifdef __SSE4_2__
-#ifdef __LP64__
+#if (defined(__SSE4_2__) && defined(__LP64__)) || defined(BUTIL_CRC32C_HW3WAY)
 static inline uint64_t LE_LOAD64(const uint8_t *p) {
   return DecodeFixed64(reinterpret_cast<const char*>(p));
 }
 #endif
-#endif
 
 static inline void Slow_CRC32(uint64_t* l, uint8_t const **p) {
   uint32_t c = static_cast<uint32_t>(*l ^ LE_LOAD32(*p));
@@ -421,6 +426,173 @@ uint32_t ExtendImpl(uint32_t crc, const char* buf, size_t size) {
   return static_cast<uint32_t>(l ^ 0xffffffffu);
 }
 
+#ifdef BUTIL_CRC32C_HW3WAY
+
+// Hardware crc32c instructions have a 3-cycle latency, thus a single
+// dependent chain leaves two thirds of the units idle. The kernel below
+// runs three independent chains over adjacent blocks and merges them with
+// precomputed zero-operators (the effect on a crc of appending N zero
+// bytes), following the scheme of Mark Adler's crc32c.c.
+
+static inline uint64_t CRC32C_U64(uint64_t crc, uint64_t v) {
+#ifdef __SSE4_2__
+  return _mm_crc32_u64(crc, v);
+#else
+  return __crc32cd(static_cast<uint32_t>(crc), v);
+#endif
+}
+
+static inline uint32_t CRC32C_U8(uint32_t crc, uint8_t v) {
+#ifdef __SSE4_2__
+  return _mm_crc32_u8(crc, v);
+#else
+  return __crc32cb(crc, v);
+#endif
+}
+
+// Multiply a matrix by a vector over GF(2)
+static uint32_t gf2_matrix_times(const uint32_t* mat, uint32_t vec) {
+  uint32_t sum = 0;
+  while (vec) {
+    if (vec & 1) {
+      sum ^= *mat;
+    }
+    vec >>= 1;
+    ++mat;
+  }
+  return sum;
+}
+
+// square = mat * mat over GF(2)
+static void gf2_matrix_square(uint32_t* square, const uint32_t* mat) {
+  for (int n = 0; n < 32; ++n) {
+    square[n] = gf2_matrix_times(mat, mat[n]);
+  }
+}
+
+// Construct the operator applying `len' zero bytes to a crc.
+static void crc32c_zeros_op(uint32_t* even, size_t len) {
+  uint32_t odd[32];  // odd-power-of-two zeros operator
+  // Operator for one zero bit.
+  odd[0] = 0x82f63b78;  // CRC-32C polynomial, reflected
+  uint32_t row = 1;
+  for (int n = 1; n < 32; ++n) {
+    odd[n] = row;
+    row <<= 1;
+  }
+  // Operator for two zero bits, then four.
+  gf2_matrix_square(even, odd);
+  gf2_matrix_square(odd, even);
+  // First square below puts the operator for one zero byte(eight zero bits)
+  // in even; next square puts the operator for two zero bytes in odd, and
+  // so on, until len has been rotated down to zero.
+  do {
+    gf2_matrix_square(even, odd);
+    len >>= 1;
+    if (len == 0) {
+      return;
+    }
+    gf2_matrix_square(odd, even);
+    len >>= 1;
+  } while (len);
+  // Answer ended up in odd, copy to even.
+  for (int n = 0; n < 32; ++n) {
+    even[n] = odd[n];
+  }
+}
+
+// Expand the zero-operator of `len' bytes into byte-indexed tables.
+static void crc32c_zeros(uint32_t zeros[][256], size_t len) {
+  uint32_t op[32];
+  crc32c_zeros_op(op, len);
+  for (uint32_t n = 0; n < 256; ++n) {
+    zeros[0][n] = gf2_matrix_times(op, n);
+    zeros[1][n] = gf2_matrix_times(op, n << 8);
+    zeros[2][n] = gf2_matrix_times(op, n << 16);
+    zeros[3][n] = gf2_matrix_times(op, n << 24);
+  }
+}
+
+// Sizes of the interleaved blocks. The long size amortizes the merging
+// cost on large inputs(e.g. checksummed attachments), the short one picks
+// up medium inputs.
+static const size_t CRC32C_LONG_BLOCK = 8192;
+static const size_t CRC32C_SHORT_BLOCK = 256;
+
+static uint32_t crc32c_long_zeros[4][256];
+static uint32_t crc32c_short_zeros[4][256];
+
+static void Init3WayTables() {
+  crc32c_zeros(crc32c_long_zeros, CRC32C_LONG_BLOCK);
+  crc32c_zeros(crc32c_short_zeros, CRC32C_SHORT_BLOCK);
+}
+
+// Apply the zeros operator table to crc.
+static inline uint32_t crc32c_shift(const uint32_t zeros[][256], uint32_t crc) {
+  return zeros[0][crc & 0xff] ^ zeros[1][(crc >> 8) & 0xff] ^
+         zeros[2][(crc >> 16) & 0xff] ^ zeros[3][crc >> 24];
+}
+
+static uint32_t Extend3Way(uint32_t crc, const char* buf, size_t size) {
+  const uint8_t* next = reinterpret_cast<const uint8_t*>(buf);
+  uint64_t crc0 = crc ^ 0xffffffffu;
+
+  // Process bytes until 8-byte aligned.
+  while (size && (reinterpret_cast<uintptr_t>(next) & 7) != 0) {
+    crc0 = CRC32C_U8(static_cast<uint32_t>(crc0), *next++);
+    --size;
+  }
+
+  // Three interleaved chains over long blocks, merged by applying the
+  // zeros operator of one block to the leading crcs.
+  while (size >= 3 * CRC32C_LONG_BLOCK) {
+    uint64_t crc1 = 0;
+    uint64_t crc2 = 0;
+    const uint8_t* const end = next + CRC32C_LONG_BLOCK;
+    do {
+      crc0 = CRC32C_U64(crc0, LE_LOAD64(next));
+      crc1 = CRC32C_U64(crc1, LE_LOAD64(next + CRC32C_LONG_BLOCK));
+      crc2 = CRC32C_U64(crc2, LE_LOAD64(next + 2 * CRC32C_LONG_BLOCK));
+      next += 8;
+    } while (next < end);
+    crc0 = crc32c_shift(crc32c_long_zeros, static_cast<uint32_t>(crc0)) ^ crc1;
+    crc0 = crc32c_shift(crc32c_long_zeros, static_cast<uint32_t>(crc0)) ^ crc2;
+    next += 2 * CRC32C_LONG_BLOCK;
+    size -= 3 * CRC32C_LONG_BLOCK;
+  }
+
+  // Ditto with short blocks.
+  while (size >= 3 * CRC32C_SHORT_BLOCK) {
+    uint64_t crc1 = 0;
+    uint64_t crc2 = 0;
+    const uint8_t* const end = next + CRC32C_SHORT_BLOCK;
+    do {
+      crc0 = CRC32C_U64(crc0, LE_LOAD64(next));
+      crc1 = CRC32C_U64(crc1, LE_LOAD64(next + CRC32C_SHORT_BLOCK));
+      crc2 = CRC32C_U64(crc2, LE_LOAD64(next + 2 * CRC32C_SHORT_BLOCK));
+      next += 8;
+    } while (next < end);
+    crc0 = crc32c_shift(crc32c_short_zeros, static_cast<uint32_t>(crc0)) ^ crc1;
+    crc0 = crc32c_shift(crc32c_short_zeros, static_cast<uint32_t>(crc0)) ^ crc2;
+    next += 2 * CRC32C_SHORT_BLOCK;
+    size -= 3 * CRC32C_SHORT_BLOCK;
+  }
+
+  // Single chain for what remains.
+  while (size >= 8) {
+    crc0 = CRC32C_U64(crc0, LE_LOAD64(next));
+    next += 8;
+    size -= 8;
+  }
+  while (size > 0) {
+    crc0 = CRC32C_U8(static_cast<uint32_t>(crc0), *next++);
+    --size;
+  }
+  return static_cast<uint32_t>(crc0) ^ 0xffffffffu;
+}
+
+#endif  // BUTIL_CRC32C_HW3WAY
+
 // Detect if SS42 or not.
 static bool isSSE42() {
 #if defined(__GNUC__) && defined(__x86_64__) && !defined(IOS_CROSS_COMPILE)
@@ -436,13 +608,28 @@ static bool isSSE42() {
 typedef uint32_t (*Function)(uint32_t, const char*, size_t);
 
 static inline Function Choose_Extend() {
-  return isSSE42() ? (Function)ExtendImpl<FastCRC32Functor> : 
+#if defined(BUTIL_CRC32C_HW3WAY)
+#if defined(__SSE4_2__)
+  if (isSSE42()) {
+    Init3WayTables();
+    return Extend3Way;
+  }
+#else
+  // __ARM_FEATURE_CRC32 means the target requires the crc instructions,
+  // no runtime detection needed.
+  Init3WayTables();
+  return Extend3Way;
+#endif
+#endif
+  return isSSE42() ? (Function)ExtendImpl<FastCRC32Functor> :
                     (Function)ExtendImpl<SlowCRC32Functor>;
 }
 
 bool IsFastCrc32Supported() {
 #ifdef __SSE4_2__
   return isSSE42();
+#elif defined(__ARM_FEATURE_CRC32)
+  return true;
 #else
   return false;
 #endif
@@ -453,5 +640,14 @@ uint32_t Extend(uint32_t crc, const char* buf, size_t size) {
   return ChosenExtend(crc, buf, size);
 }
 
+uint32_t Extend(uint32_t crc, const IOBuf& buf) {
+  const size_t n = buf.backing_block_num();
+  for (size_t i = 0; i < n; ++i) {
+    const StringPiece blk = buf.backing_block(i);
+    crc = Extend(crc, blk.data(), blk.size());
+  }
+  return crc;
+}
+
 }  // namespace crc32c
 }  // namespace butil
@@ -14,6 +14,9 @@
 #include <stdint.h>
 
 namespace butil {
+
+class IOBuf;
+
 namespace crc32c {
 
 extern bool IsFastCrc32Supported();
@@ -23,6 +26,10 @@ extern bool IsFastCrc32Supported();
 // crc32c of a stream of data.
 extern uint32_t Extend(uint32_t init_crc, const char* data, size_t n);
 
+// Above with an IOBuf, iterating its backing blocks without copying them
+// into a continuous buffer.
+extern uint32_t Extend(uint32_t init_crc, const IOBuf& data);
+
 // Return the crc32c of data[0,n-1]
 inline uint32_t Value(const char* data, size_t n) {
   return Extend(0, data, n);
@@ -30,11 +30,20 @@
 #include <limits.h>                        // CHAR_BIT
 #include <stdexcept>                       // std::invalid_argument
 #include "butil/build_config.h"             // ARCH_CPU_X86_64
+#if defined(OS_LINUX)
+#include <sys/sendfile.h>                  // sendfile
+#include <sys/mman.h>                      // madvise
+#elif defined(OS_MACOSX)
+#include <sys/socket.h>                    // sendfile
+#endif
 #include "butil/atomicops.h"                // butil::atomic
 #include "butil/thread_local.h"             // thread_atexit
 #include "butil/macros.h"                   // BAIDU_CASSERT
 #include "butil/logging.h"                  // CHECK, LOG
 #include "butil/fd_guard.h"                 // butil::fd_guard
+#include "butil/crc32c.h"                   // crc32c::Extend
+#include "butil/memory_sampler.h"           // SampleMemoryAllocation
+#include "butil/simd_search.h"              // simd::memmem
 #include "butil/iobuf.h"
 
 namespace butil {
@@ -163,6 +172,17 @@ inline void* cp(void *__restrict dest, const void *__restrict src, size_t n) {
 void* (*blockmem_allocate)(size_t) = ::malloc;
 void  (*blockmem_deallocate)(void*) = ::free;
 
+// Declared in iobuf.h, see the comment there.
+void (*copy_hook)(size_t num_copied) = NULL;
+
+// Report a deep copy of `n' bytes to the installed hook, if any.
+inline void notify_copy_hook(size_t n) {
+    void (*const hook)(size_t) = copy_hook;
+    if (BAIDU_UNLIKELY(hook != NULL) && n != 0) {
+        hook(n);
+    }
+}
+
 // Use default function pointers
 void reset_blockmem_allocate_and_deallocate() {
     blockmem_allocate = ::malloc;
@@ -172,6 +192,29 @@ void reset_blockmem_allocate_and_deallocate() {
 butil::static_atomic<size_t> g_nblock = BUTIL_STATIC_ATOMIC_INIT(0);
 butil::static_atomic<size_t> g_blockmem = BUTIL_STATIC_ATOMIC_INIT(0);
 butil::static_atomic<size_t> g_newbigview = BUTIL_STATIC_ATOMIC_INIT(0);
+butil::static_atomic<size_t> g_nmedium_block = BUTIL_STATIC_ATOMIC_INIT(0);
+butil::static_atomic<size_t> g_nhuge_block = BUTIL_STATIC_ATOMIC_INIT(0);
+
+// Larger size classes(whole block including the header) in addition to
+// DEFAULT_BLOCK_SIZE. Bulk reads in IOPortal allocate from these classes
+// to cut per-block bookkeeping and TLB misses of large messages.
+const size_t MEDIUM_BLOCK_SIZE = 64 * 1024;
+const size_t HUGE_BLOCK_SIZE = 256 * 1024;
+
+// Defined below. Pools a fully-dereferenced medium/huge block instead of
+// freeing it. Returns false if the block should be freed as usual.
+bool try_pool_dead_block(IOBuf::Block* b);
+
+// Alignment of the data of aligned blocks, enough for O_DIRECT on all
+// common logical block sizes(512/4096).
+const size_t ALIGNED_BLOCK_ALIGNMENT = 4096;
+// Data capacity of pooled aligned blocks. Off-capacity aligned blocks
+// (short tails) are created and freed directly.
+const size_t ALIGNED_BLOCK_DATA_CAP = 64 * 1024;
+
+// Ditto for aligned blocks of ALIGNED_BLOCK_DATA_CAP.
+bool try_pool_dead_aligned_block(IOBuf::Block* b);
+void drain_aligned_block_pool();
 
 }  // namespace iobuf
 
@@ -187,13 +230,29 @@ size_t IOBuf::new_bigview_count() {
     return iobuf::g_newbigview.load(butil::memory_order_relaxed);
 }
 
+size_t IOBuf::medium_block_count() {
+    return iobuf::g_nmedium_block.load(butil::memory_order_relaxed);
+}
+
+size_t IOBuf::huge_block_count() {
+    return iobuf::g_nhuge_block.load(butil::memory_order_relaxed);
+}
+
 const uint16_t IOBUF_BLOCK_FLAGS_USER_DATA = 0x1;
+const uint16_t IOBUF_BLOCK_FLAGS_FILE_REGION = 0x2;
+const uint16_t IOBUF_BLOCK_FLAGS_ALIGNED = 0x4;
 typedef void (*UserDataDeleter)(void*);
 
 struct UserDataExtension {
     UserDataDeleter deleter;
 };
 
+struct FileRegionExtension {
+    int fd;
+    off_t offset;
+    bool own_fd;
+};
+
 struct IOBuf::Block {
     butil::atomic<int> nshared;
     uint16_t flags;
@@ -219,6 +278,21 @@ struct IOBuf::Block {
                                     butil::memory_order_relaxed);
     }
 
+    // For blocks whose data is allocated separately from the header, e.g.
+    // aligned blocks where `data_in' is the start of the whole allocation.
+    Block(char* data_in, uint32_t data_size, uint16_t flags_in)
+        : nshared(1)
+        , flags(flags_in)
+        , abi_check(0)
+        , size(0)
+        , cap(data_size)
+        , portal_next(NULL)
+        , data(data_in) {
+        iobuf::g_nblock.fetch_add(1, butil::memory_order_relaxed);
+        iobuf::g_blockmem.fetch_add(data_size + sizeof(Block),
+                                    butil::memory_order_relaxed);
+    }
+
     Block(char* data_in, uint32_t data_size, UserDataDeleter deleter)
         : nshared(1)
         , flags(IOBUF_BLOCK_FLAGS_USER_DATA)
@@ -230,12 +304,33 @@ struct IOBuf::Block {
         get_user_data_extension()->deleter = deleter;
     }
 
+    Block(uint32_t region_size, int region_fd, off_t region_offset,
+          bool own_fd)
+        : nshared(1)
+        , flags(IOBUF_BLOCK_FLAGS_FILE_REGION)
+        , abi_check(0)
+        , size(region_size)
+        , cap(region_size)
+        , portal_next(NULL)
+        , data(NULL) {
+        FileRegionExtension* ext = get_file_region_extension();
+        ext->fd = region_fd;
+        ext->offset = region_offset;
+        ext->own_fd = own_fd;
+    }
+
     // Undefined behavior when (flags & IOBUF_BLOCK_FLAGS_USER_DATA) is 0.
     UserDataExtension* get_user_data_extension() {
         char* p = (char*)this;
         return (UserDataExtension*)(p + sizeof(Block));
     }
 
+    // Undefined behavior when (flags & IOBUF_BLOCK_FLAGS_FILE_REGION) is 0.
+    FileRegionExtension* get_file_region_extension() {
+        char* p = (char*)this;
+        return (FileRegionExtension*)(p + sizeof(Block));
+    }
+
     inline void check_abi() {
 #ifndef NDEBUG
         if (abi_check != 0) {
@@ -255,15 +350,48 @@ struct IOBuf::Block {
         if (nshared.fetch_sub(1, butil::memory_order_release) == 1) {
             butil::atomic_thread_fence(butil::memory_order_acquire);
             if (!flags) {
+                const size_t total_size = cap + sizeof(Block);
+                if (total_size > IOBuf::DEFAULT_BLOCK_SIZE &&
+                    iobuf::try_pool_dead_block(this)) {
+                    // Kept for reuse, still counted in g_nblock/g_blockmem
+                    // like blocks cached in TLS.
+                    return;
+                }
                 iobuf::g_nblock.fetch_sub(1, butil::memory_order_relaxed);
-                iobuf::g_blockmem.fetch_sub(cap + sizeof(Block),
+                iobuf::g_blockmem.fetch_sub(total_size,
                                             butil::memory_order_relaxed);
+                if (total_size == iobuf::MEDIUM_BLOCK_SIZE) {
+                    iobuf::g_nmedium_block.fetch_sub(
+                        1, butil::memory_order_relaxed);
+                } else if (total_size == iobuf::HUGE_BLOCK_SIZE) {
+                    iobuf::g_nhuge_block.fetch_sub(
+                        1, butil::memory_order_relaxed);
+                }
                 this->~Block();
                 iobuf::blockmem_deallocate(this);
+            } else if (flags & IOBUF_BLOCK_FLAGS_ALIGNED) {
+                if (iobuf::try_pool_dead_aligned_block(this)) {
+                    return;
+                }
+                iobuf::g_nblock.fetch_sub(1, butil::memory_order_relaxed);
+                iobuf::g_blockmem.fetch_sub(cap + sizeof(Block),
+                                            butil::memory_order_relaxed);
+                // The header lives at the end of the single aligned
+                // allocation which starts at `data'.
+                char* const mem = data;
+                this->~Block();
+                free(mem);
             } else if (flags & IOBUF_BLOCK_FLAGS_USER_DATA) {
                 get_user_data_extension()->deleter(data);
                 this->~Block();
                 free(this);
+            } else if (flags & IOBUF_BLOCK_FLAGS_FILE_REGION) {
+                FileRegionExtension* ext = get_file_region_extension();
+                if (ext->own_fd) {
+                    ::close(ext->fd);
+                }
+                this->~Block();
+                free(this);
             }
         }
     }
@@ -293,15 +421,266 @@ uint32_t block_size(IOBuf::Block const* b) {
     return b->size;
 }
 
+// === Global pools of free blocks, one per size class ===
+// Read-heavy threads (e.g. event dispatchers appending from fds) and the
+// threads consuming the data are often different, so blocks overflowing one
+// thread's TLS cache or dereferenced after consumption are pushed here and
+// reused by other threads instead of going back to malloc/free. Only
+// completely-owned blocks of an exact class size are pooled. The lists are
+// short and only touched on TLS over/underflow or large-block death, a
+// mutex is cheap enough.
+static const int NUM_BLOCK_CLASSES = 3;
+static const int MAX_POOLED_BLOCKS_BY_CLASS[NUM_BLOCK_CLASSES] = {
+    64 /*default*/, 16 /*medium*/, 8 /*huge*/ };
+
+static pthread_mutex_t g_block_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static IOBuf::Block* g_block_pool_head[NUM_BLOCK_CLASSES] = { NULL };
+static int g_block_pool_num[NUM_BLOCK_CLASSES] = { 0 };
+
+// Index of the class whose whole-block size(including the header) is
+// `total_size', -1 for off-class sizes which are never pooled.
+inline int block_class_index(size_t total_size) {
+    if (total_size == IOBuf::DEFAULT_BLOCK_SIZE) {
+        return 0;
+    }
+    if (total_size == MEDIUM_BLOCK_SIZE) {
+        return 1;
+    }
+    if (total_size == HUGE_BLOCK_SIZE) {
+        return 2;
+    }
+    return -1;
+}
+
+// `b' must be reset(nshared=1, size=0) by the caller.
+static bool push_block_to_pool(IOBuf::Block* b, int cls) {
+    if (g_block_pool_num[cls] >= MAX_POOLED_BLOCKS_BY_CLASS[cls]) {
+        return false;  // racy but harmless
+    }
+    pthread_mutex_lock(&g_block_pool_mutex);
+    if (g_block_pool_num[cls] >= MAX_POOLED_BLOCKS_BY_CLASS[cls]) {
+        pthread_mutex_unlock(&g_block_pool_mutex);
+        return false;
+    }
+    b->portal_next = g_block_pool_head[cls];
+    g_block_pool_head[cls] = b;
+    ++g_block_pool_num[cls];
+    pthread_mutex_unlock(&g_block_pool_mutex);
+    return true;
+}
+
+// Try to pool `b' for later reuse. Returns false if the block can't be
+// pooled (shared, non-class layout or pool is full) in which case the
+// caller should dec_ref() as before.
+static bool put_block_to_pool(IOBuf::Block* b) {
+    if (b->ref_count() != 1 || b->flags != 0) {
+        return false;
+    }
+    const int cls = block_class_index(b->cap + sizeof(IOBuf::Block));
+    if (cls < 0) {
+        return false;
+    }
+    b->size = 0;
+    return push_block_to_pool(b, cls);
+}
+
+// Called by Block::dec_ref() when the last reference of a medium/huge
+// block is released: revive the block into the matching pool. Default
+// blocks don't take this path, they are recycled through TLS caches.
+bool try_pool_dead_block(IOBuf::Block* b) {
+    const int cls = block_class_index(b->cap + sizeof(IOBuf::Block));
+    if (cls <= 0) {
+        return false;
+    }
+    // No one else references the block(ref hit 0), safe to reset.
+    b->nshared.store(1, butil::memory_order_relaxed);
+    b->size = 0;
+    return push_block_to_pool(b, cls);
+}
+
+static IOBuf::Block* get_block_from_pool(int cls) {
+    if (g_block_pool_head[cls] == NULL) { // racy but harmless
+        return NULL;
+    }
+    IOBuf::Block* b = NULL;
+    pthread_mutex_lock(&g_block_pool_mutex);
+    b = g_block_pool_head[cls];
+    if (b) {
+        g_block_pool_head[cls] = b->portal_next;
+        --g_block_pool_num[cls];
+    }
+    pthread_mutex_unlock(&g_block_pool_mutex);
+    if (b) {
+        b->portal_next = NULL;
+    }
+    return b;
+}
+
+// Used in UT: free all pooled blocks so that leak checks built on the
+// debug allocator see a clean slate. Frees directly instead of through
+// dec_ref() which would revive medium/huge blocks back into the pool.
+void drain_block_pools() {
+    IOBuf::Block* heads[NUM_BLOCK_CLASSES];
+    pthread_mutex_lock(&g_block_pool_mutex);
+    for (int i = 0; i < NUM_BLOCK_CLASSES; ++i) {
+        heads[i] = g_block_pool_head[i];
+        g_block_pool_head[i] = NULL;
+        g_block_pool_num[i] = 0;
+    }
+    pthread_mutex_unlock(&g_block_pool_mutex);
+    for (int i = 0; i < NUM_BLOCK_CLASSES; ++i) {
+        for (IOBuf::Block* b = heads[i]; b != NULL; ) {
+            IOBuf::Block* const saved_next = b->portal_next;
+            const size_t total_size = b->cap + sizeof(IOBuf::Block);
+            g_nblock.fetch_sub(1, butil::memory_order_relaxed);
+            g_blockmem.fetch_sub(total_size, butil::memory_order_relaxed);
+            if (total_size == MEDIUM_BLOCK_SIZE) {
+                g_nmedium_block.fetch_sub(1, butil::memory_order_relaxed);
+            } else if (total_size == HUGE_BLOCK_SIZE) {
+                g_nhuge_block.fetch_sub(1, butil::memory_order_relaxed);
+            }
+            b->~Block();
+            blockmem_deallocate(b);
+            b = saved_next;
+        }
+    }
+    drain_aligned_block_pool();
+}
+
+// === Pool of aligned blocks ===
+// Aligned blocks back O_DIRECT reads which are bulky and bursty, reuse
+// them like medium/huge blocks instead of round-tripping posix_memalign.
+static const int MAX_POOLED_ALIGNED_BLOCKS = 32;
+static pthread_mutex_t g_aligned_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static IOBuf::Block* g_aligned_pool_head = NULL;
+static int g_aligned_pool_num = 0;
+
+bool try_pool_dead_aligned_block(IOBuf::Block* b) {
+    if (b->cap != ALIGNED_BLOCK_DATA_CAP) {
+        return false;
+    }
+    if (g_aligned_pool_num >= MAX_POOLED_ALIGNED_BLOCKS) { // racy but harmless
+        return false;
+    }
+    // No one else references the block(ref hit 0), safe to reset.
+    b->nshared.store(1, butil::memory_order_relaxed);
+    b->size = 0;
+    pthread_mutex_lock(&g_aligned_pool_mutex);
+    if (g_aligned_pool_num >= MAX_POOLED_ALIGNED_BLOCKS) {
+        pthread_mutex_unlock(&g_aligned_pool_mutex);
+        return false;
+    }
+    b->portal_next = g_aligned_pool_head;
+    g_aligned_pool_head = b;
+    ++g_aligned_pool_num;
+    pthread_mutex_unlock(&g_aligned_pool_mutex);
+    return true;
+}
+
+static IOBuf::Block* get_aligned_block_from_pool() {
+    if (g_aligned_pool_head == NULL) { // racy but harmless
+        return NULL;
+    }
+    IOBuf::Block* b = NULL;
+    pthread_mutex_lock(&g_aligned_pool_mutex);
+    b = g_aligned_pool_head;
+    if (b) {
+        g_aligned_pool_head = b->portal_next;
+        --g_aligned_pool_num;
+    }
+    pthread_mutex_unlock(&g_aligned_pool_mutex);
+    if (b) {
+        b->portal_next = NULL;
+    }
+    return b;
+}
+
+// Create a block whose data is ALIGNED_BLOCK_ALIGNMENT-aligned and exactly
+// `data_cap'(must be a multiple of the alignment) bytes, suitable as the
+// target of O_DIRECT reads. The header is placed behind the data inside
+// one allocation.
+IOBuf::Block* create_aligned_block(size_t data_cap) {
+    if (data_cap == ALIGNED_BLOCK_DATA_CAP) {
+        IOBuf::Block* pooled = get_aligned_block_from_pool();
+        if (pooled) {
+            return pooled;
+        }
+    }
+    void* mem = NULL;
+    if (posix_memalign(&mem, ALIGNED_BLOCK_ALIGNMENT,
+                       data_cap + sizeof(IOBuf::Block)) != 0) {
+        return NULL;
+    }
+    SampleMemoryAllocation("iobuf_aligned_block",
+                           data_cap + sizeof(IOBuf::Block));
+    return new ((char*)mem + data_cap) IOBuf::Block(
+        (char*)mem, data_cap, IOBUF_BLOCK_FLAGS_ALIGNED);
+}
+
+// Ditto for the aligned pool, see drain_block_pools() below.
+void drain_aligned_block_pool() {
+    IOBuf::Block* head = NULL;
+    pthread_mutex_lock(&g_aligned_pool_mutex);
+    head = g_aligned_pool_head;
+    g_aligned_pool_head = NULL;
+    g_aligned_pool_num = 0;
+    pthread_mutex_unlock(&g_aligned_pool_mutex);
+    while (head != NULL) {
+        IOBuf::Block* const saved_next = head->portal_next;
+        g_nblock.fetch_sub(1, butil::memory_order_relaxed);
+        g_blockmem.fetch_sub(head->cap + sizeof(IOBuf::Block),
+                             butil::memory_order_relaxed);
+        char* const mem = head->data;
+        head->~Block();
+        free(mem);
+        head = saved_next;
+    }
+}
+
+// Release a block which is not cached in TLS anymore: prefer pooling over
+// freeing.
+inline void release_block(IOBuf::Block* b) {
+    if (!put_block_to_pool(b)) {
+        b->dec_ref();
+    }
+}
+
 inline IOBuf::Block* create_block(const size_t block_size) {
     if (block_size > 0xFFFFFFFFULL) {
         LOG(FATAL) << "block_size=" << block_size << " is too large";
         return NULL;
     }
+    const int cls = block_class_index(block_size);
+    if (cls >= 0) {
+        IOBuf::Block* pooled = get_block_from_pool(cls);
+        if (pooled) {
+            return pooled;
+        }
+    }
     char* mem = (char*)iobuf::blockmem_allocate(block_size);
     if (mem == NULL) {
         return NULL;
     }
+#if defined(OS_LINUX) && defined(MADV_HUGEPAGE)
+    if (block_size >= MEDIUM_BLOCK_SIZE) {
+        // Hint the kernel to back large blocks with transparent huge pages
+        // to cut TLB misses of bulk copies. malloc does not guarantee page
+        // alignment: advise the page-aligned interior and ignore failures,
+        // this is only an optimization.
+        const uintptr_t page_mask = 4096 - 1;
+        const uintptr_t start = ((uintptr_t)mem + page_mask) & ~page_mask;
+        const uintptr_t end = ((uintptr_t)mem + block_size) & ~page_mask;
+        if (end > start) {
+            madvise((void*)start, end - start, MADV_HUGEPAGE);
+        }
+    }
+#endif
+    if (block_size == MEDIUM_BLOCK_SIZE) {
+        g_nmedium_block.fetch_add(1, butil::memory_order_relaxed);
+    } else if (block_size == HUGE_BLOCK_SIZE) {
+        g_nhuge_block.fetch_add(1, butil::memory_order_relaxed);
+    }
+    SampleMemoryAllocation("iobuf_block", block_size);
     return new (mem) IOBuf::Block(mem + sizeof(IOBuf::Block),
                                   block_size - sizeof(IOBuf::Block));
 }
@@ -310,23 +689,78 @@ inline IOBuf::Block* create_block() {
     return create_block(IOBuf::DEFAULT_BLOCK_SIZE);
 }
 
+// Choose the block size for appending `demand' more bytes: medium/huge
+// blocks for bulk reads, 0 to use default-sized TLS blocks. Very large
+// demands are "unlimited" hints(e.g. LONG_MAX) rather than an estimation
+// of the incoming data, stick to default blocks for them.
+inline size_t append_block_size_for(size_t demand) {
+    if (demand > 4 * HUGE_BLOCK_SIZE) {
+        return 0;
+    }
+    if (demand >= HUGE_BLOCK_SIZE) {
+        return HUGE_BLOCK_SIZE;
+    }
+    if (demand >= MEDIUM_BLOCK_SIZE) {
+        return MEDIUM_BLOCK_SIZE;
+    }
+    return 0;
+}
+
 // === Share TLS blocks between appending operations ===
-// Max number of blocks in each TLS. This is a soft limit namely
-// release_tls_block_chain() may exceed this limit sometimes.
+// Initial max number of blocks in each TLS. The limit adapts between this
+// and HARD_MAX_BLOCKS_PER_THREAD according to the usage of each thread,
+// and is a soft limit namely release_tls_block_chain() may exceed it
+// sometimes.
 const int MAX_BLOCKS_PER_THREAD = 8;
+// The adapted per-thread limit never exceeds this.
+const int HARD_MAX_BLOCKS_PER_THREAD = 64;
+// Number of block acquisitions between two adaptions of the limit.
+const int TLS_ADAPT_PERIOD = 256;
+
+void remove_tls_block_chain();
 
 struct TLSData {
     // Head of the TLS block chain.
     IOBuf::Block* block_head;
-    
+
     // Number of TLS blocks
     int num_blocks;
-    
+
+    // Adapted limit of num_blocks, within [MAX_BLOCKS_PER_THREAD,
+    // HARD_MAX_BLOCKS_PER_THREAD].
+    int max_blocks;
+
     // True if the remote_tls_block_chain is registered to the thread.
     bool registered;
+
+    // Stats since last adaption of max_blocks.
+    int nacquire;        // acquisitions from the cache
+    int nmiss;           // acquisitions that had to create_block()
+    int ncapped;         // releases refused because num_blocks hit max_blocks
+    int high_watermark;  // max num_blocks seen
+
+    // Bumped by every operation on the cache. Unchanged between two scans
+    // of reclaim_idle_tls_block_caches() = the thread is idle.
+    size_t version;
+    size_t reclaimer_seen_version;
+
+    // Serializes accesses from the owning thread and the reclaimer.
+    // Nearly always uncontended: taken by the owner per block operation
+    // and by the reclaimer once per scan(seconds apart).
+    pthread_mutex_t mutex;
+
+    // Next registered TLSData, protected by g_tls_registry_mutex.
+    TLSData* next;
 };
 
-static __thread TLSData g_tls_data = { NULL, 0, false };
+static __thread TLSData g_tls_data = {
+    NULL, 0, MAX_BLOCKS_PER_THREAD, false, 0, 0, 0, 0, 0, 0,
+    PTHREAD_MUTEX_INITIALIZER, NULL };
+
+// All registered TLSData so that the reclaimer can walk caches of other
+// threads. Lock order: g_tls_registry_mutex before TLSData.mutex.
+static pthread_mutex_t g_tls_registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+static TLSData* g_tls_registry = NULL;
 
 // Used in UT
 IOBuf::Block* get_tls_block_head() { return g_tls_data.block_head; }
@@ -337,51 +771,189 @@ int get_tls_block_count() { return g_tls_data.num_blocks; }
 // of appending functions in IOPortal may be lowered.
 static butil::static_atomic<size_t> g_num_hit_tls_threshold = BUTIL_STATIC_ATOMIC_INIT(0);
 
-// Called in UT.
-void remove_tls_block_chain() {
-    TLSData& tls_data = g_tls_data;
-    IOBuf::Block* b = tls_data.block_head;
-    if (!b) {
+// Totals over all TLS caches, exposed through IOBuf::tls_block_*().
+static butil::static_atomic<size_t> g_tls_nblocks = BUTIL_STATIC_ATOMIC_INIT(0);
+static butil::static_atomic<size_t> g_tls_block_bytes = BUTIL_STATIC_ATOMIC_INIT(0);
+static butil::static_atomic<size_t> g_tls_nhit = BUTIL_STATIC_ATOMIC_INIT(0);
+static butil::static_atomic<size_t> g_tls_nmiss = BUTIL_STATIC_ATOMIC_INIT(0);
+static butil::static_atomic<size_t> g_tls_nreclaimed = BUTIL_STATIC_ATOMIC_INIT(0);
+
+// Update counters when `b' enters/leaves the TLS chain. Must be called
+// with tls_data.mutex held.
+inline void note_tls_block_added(TLSData& tls_data, IOBuf::Block* b) {
+    if (++tls_data.num_blocks > tls_data.high_watermark) {
+        tls_data.high_watermark = tls_data.num_blocks;
+    }
+    g_tls_nblocks.fetch_add(1, butil::memory_order_relaxed);
+    g_tls_block_bytes.fetch_add(b->cap + sizeof(IOBuf::Block),
+                                butil::memory_order_relaxed);
+}
+
+inline void note_tls_block_removed(TLSData& tls_data, IOBuf::Block* b) {
+    --tls_data.num_blocks;
+    g_tls_nblocks.fetch_sub(1, butil::memory_order_relaxed);
+    g_tls_block_bytes.fetch_sub(b->cap + sizeof(IOBuf::Block),
+                                butil::memory_order_relaxed);
+}
+
+// Merge per-thread hit/miss counters into the globals. Called at adaption
+// and when the chain is removed, to keep the hot path free of atomics.
+static void flush_tls_stats(TLSData& tls_data) {
+    if (tls_data.nacquire > tls_data.nmiss) {
+        g_tls_nhit.fetch_add(tls_data.nacquire - tls_data.nmiss,
+                             butil::memory_order_relaxed);
+    }
+    if (tls_data.nmiss > 0) {
+        g_tls_nmiss.fetch_add(tls_data.nmiss, butil::memory_order_relaxed);
+    }
+    tls_data.nacquire = 0;
+    tls_data.nmiss = 0;
+}
+
+// Cut blocks beyond `max_kept' off the tail of the chain. Trimming from
+// the tail keeps the head which share_tls_block() may have handed out.
+// Must be called with tls_data.mutex held, max_kept must be >= 1.
+static void trim_tls_chain(TLSData& tls_data, int max_kept) {
+    if (tls_data.num_blocks <= max_kept || tls_data.block_head == NULL) {
         return;
     }
-    tls_data.block_head = NULL;
-    int n = 0;
+    IOBuf::Block* last_kept = tls_data.block_head;
+    for (int i = 1; i < max_kept; ++i) {
+        last_kept = last_kept->portal_next;
+    }
+    IOBuf::Block* b = last_kept->portal_next;
+    last_kept->portal_next = NULL;
     do {
         IOBuf::Block* const saved_next = b->portal_next;
-        b->dec_ref();
+        note_tls_block_removed(tls_data, b);
+        release_block(b);
         b = saved_next;
-        ++n;
     } while (b);
+}
+
+// Resize max_blocks according to the stats of the last period: grow when
+// releases kept missing the cache(thrashing under large transfers), shrink
+// toward the high watermark when most of the cache sat unused. Must be
+// called with tls_data.mutex held.
+static void adapt_tls_max_blocks(TLSData& tls_data) {
+    if (tls_data.ncapped > 0) {
+        if (tls_data.max_blocks < HARD_MAX_BLOCKS_PER_THREAD) {
+            tls_data.max_blocks *= 2;
+        }
+    } else if (tls_data.high_watermark <= tls_data.max_blocks / 4 &&
+               tls_data.max_blocks > MAX_BLOCKS_PER_THREAD) {
+        tls_data.max_blocks /= 2;
+        trim_tls_chain(tls_data, tls_data.max_blocks);
+    }
+    tls_data.ncapped = 0;
+    tls_data.high_watermark = tls_data.num_blocks;
+    flush_tls_stats(tls_data);
+}
+
+// Account one acquisition and adapt max_blocks periodically. Must be
+// called with tls_data.mutex held.
+inline void account_tls_acquire(TLSData& tls_data, bool miss) {
+    if (miss) {
+        ++tls_data.nmiss;
+    }
+    if (++tls_data.nacquire >= TLS_ADAPT_PERIOD) {
+        adapt_tls_max_blocks(tls_data);
+    }
+}
+
+// Hook the calling thread's cache up for the reclaimer and free the chain
+// at thread exit. Must NOT be called with tls_data.mutex held: the
+// reclaimer locks the registry before entries.
+static void register_tls_data(TLSData& tls_data) {
+    butil::thread_atexit(remove_tls_block_chain);
+    pthread_mutex_lock(&g_tls_registry_mutex);
+    tls_data.next = g_tls_registry;
+    g_tls_registry = &tls_data;
+    pthread_mutex_unlock(&g_tls_registry_mutex);
+}
+
+static void unregister_tls_data(TLSData& tls_data) {
+    pthread_mutex_lock(&g_tls_registry_mutex);
+    for (TLSData** pd = &g_tls_registry; *pd != NULL; pd = &(*pd)->next) {
+        if (*pd == &tls_data) {
+            *pd = tls_data.next;
+            tls_data.next = NULL;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&g_tls_registry_mutex);
+}
+
+// Called in UT and at thread exit.
+void remove_tls_block_chain() {
+    TLSData& tls_data = g_tls_data;
+    pthread_mutex_lock(&tls_data.mutex);
+    ++tls_data.version;
+    IOBuf::Block* b = tls_data.block_head;
+    tls_data.block_head = NULL;
+    int n = 0;
+    for (IOBuf::Block* p = b; p != NULL; p = p->portal_next) {
+        ++n;
+        g_tls_block_bytes.fetch_sub(p->cap + sizeof(IOBuf::Block),
+                                    butil::memory_order_relaxed);
+    }
+    if (n > 0) {
+        g_tls_nblocks.fetch_sub(n, butil::memory_order_relaxed);
+    }
     CHECK_EQ(n, tls_data.num_blocks);
     tls_data.num_blocks = 0;
+    tls_data.ncapped = 0;
+    tls_data.high_watermark = 0;
+    flush_tls_stats(tls_data);
+    const bool was_registered = tls_data.registered;
+    tls_data.registered = false;
+    pthread_mutex_unlock(&tls_data.mutex);
+    while (b) {
+        IOBuf::Block* const saved_next = b->portal_next;
+        release_block(b);
+        b = saved_next;
+    }
+    if (was_registered) {
+        unregister_tls_data(tls_data);
+    }
 }
 
 // Get a (non-full) block from TLS.
 // Notice that the block is not removed from TLS.
 inline IOBuf::Block* share_tls_block() {
     TLSData& tls_data = g_tls_data;
-    IOBuf::Block* const b = tls_data.block_head;
-    if (b != NULL && !b->full()) {
-        return b;
+    bool do_register = false;
+    pthread_mutex_lock(&tls_data.mutex);
+    ++tls_data.version;
+    IOBuf::Block* b = tls_data.block_head;
+    bool miss = false;
+    if (b == NULL || b->full()) {
+        IOBuf::Block* new_block = NULL;
+        if (b) {
+            new_block = b->portal_next;
+            note_tls_block_removed(tls_data, b);
+            b->dec_ref();
+        }
+        if (!new_block) {
+            miss = true;
+            new_block = create_block(); // may be NULL
+            if (new_block) {
+                note_tls_block_added(tls_data, new_block);
+            }
+        }
+        tls_data.block_head = new_block;
+        b = new_block;
     }
-    IOBuf::Block* new_block = NULL;
-    if (b) {
-        new_block = b->portal_next;
-        b->dec_ref();
-        --tls_data.num_blocks;
-    } else if (!tls_data.registered) {
+    account_tls_acquire(tls_data, miss);
+    if (!tls_data.registered) {
         tls_data.registered = true;
-        // Only register atexit at the first time
-        butil::thread_atexit(remove_tls_block_chain);
+        do_register = true;
     }
-    if (!new_block) {
-        new_block = create_block(); // may be NULL
-        if (new_block) {
-            ++tls_data.num_blocks;
-        }
+    pthread_mutex_unlock(&tls_data.mutex);
+    if (do_register) {
+        register_tls_data(tls_data);
     }
-    tls_data.block_head = new_block;
-    return new_block;
+    return b;
 }
 
 // Return one block to TLS.
@@ -392,17 +964,28 @@ inline void release_tls_block(IOBuf::Block *b) {
     TLSData& tls_data = g_tls_data;
     if (b->full()) {
         b->dec_ref();
-    } else if (tls_data.num_blocks >= MAX_BLOCKS_PER_THREAD) {
-        b->dec_ref();
+        return;
+    }
+    bool do_register = false;
+    pthread_mutex_lock(&tls_data.mutex);
+    ++tls_data.version;
+    if (tls_data.num_blocks >= tls_data.max_blocks) {
+        ++tls_data.ncapped;
+        pthread_mutex_unlock(&tls_data.mutex);
+        release_block(b);
         g_num_hit_tls_threshold.fetch_add(1, butil::memory_order_relaxed);
-    } else {
-        b->portal_next = tls_data.block_head;
-        tls_data.block_head = b;
-        ++tls_data.num_blocks;
-        if (!tls_data.registered) {
-            tls_data.registered = true;
-            butil::thread_atexit(remove_tls_block_chain);
-        }
+        return;
+    }
+    b->portal_next = tls_data.block_head;
+    tls_data.block_head = b;
+    note_tls_block_added(tls_data, b);
+    if (!tls_data.registered) {
+        tls_data.registered = true;
+        do_register = true;
+    }
+    pthread_mutex_unlock(&tls_data.mutex);
+    if (do_register) {
+        register_tls_data(tls_data);
     }
 }
 
@@ -411,11 +994,16 @@ inline void release_tls_block(IOBuf::Block *b) {
 void release_tls_block_chain(IOBuf::Block* b) {
     TLSData& tls_data = g_tls_data;
     size_t n = 0;
-    if (tls_data.num_blocks >= MAX_BLOCKS_PER_THREAD) {
+    bool do_register = false;
+    pthread_mutex_lock(&tls_data.mutex);
+    ++tls_data.version;
+    if (tls_data.num_blocks >= tls_data.max_blocks) {
+        ++tls_data.ncapped;
+        pthread_mutex_unlock(&tls_data.mutex);
         do {
             ++n;
             IOBuf::Block* const saved_next = b->portal_next;
-            b->dec_ref();
+            release_block(b);
             b = saved_next;
         } while (b);
         g_num_hit_tls_threshold.fetch_add(n, butil::memory_order_relaxed);
@@ -426,6 +1014,7 @@ void release_tls_block_chain(IOBuf::Block* b) {
     do {
         ++n;
         CHECK(!b->full());
+        note_tls_block_added(tls_data, b);
         if (b->portal_next == NULL) {
             last_b = b;
             break;
@@ -434,34 +1023,76 @@ void release_tls_block_chain(IOBuf::Block* b) {
     } while (true);
     last_b->portal_next = tls_data.block_head;
     tls_data.block_head = first_b;
-    tls_data.num_blocks += n;
     if (!tls_data.registered) {
         tls_data.registered = true;
-        butil::thread_atexit(remove_tls_block_chain);
+        do_register = true;
+    }
+    pthread_mutex_unlock(&tls_data.mutex);
+    if (do_register) {
+        register_tls_data(tls_data);
     }
 }
 
 // Get and remove one (non-full) block from TLS. If TLS is empty, create one.
 IOBuf::Block* acquire_tls_block() {
     TLSData& tls_data = g_tls_data;
+    pthread_mutex_lock(&tls_data.mutex);
+    ++tls_data.version;
     IOBuf::Block* b = tls_data.block_head;
-    if (!b) {
-        return create_block();
-    }
-    while (b->full()) {
+    while (b != NULL && b->full()) {
         IOBuf::Block* const saved_next = b->portal_next;
+        note_tls_block_removed(tls_data, b);
         b->dec_ref();
         tls_data.block_head = saved_next;
-        --tls_data.num_blocks;
         b = saved_next;
-        if (!b) {
-            return create_block();
+    }
+    if (b != NULL) {
+        tls_data.block_head = b->portal_next;
+        note_tls_block_removed(tls_data, b);
+        b->portal_next = NULL;
+    }
+    account_tls_acquire(tls_data, b == NULL);
+    pthread_mutex_unlock(&tls_data.mutex);
+    return b != NULL ? b : create_block();
+}
+
+// Free cached blocks of threads that did no block operation since the
+// previous call, as long as the total TLS cache still exceeds
+// `keep_bytes'. The head block of each chain is never taken because
+// share_tls_block() hands it out and the owner may still be filling it.
+// Returns the number of reclaimed blocks.
+size_t reclaim_idle_tls_block_caches(size_t keep_bytes) {
+    size_t nreclaimed = 0;
+    pthread_mutex_lock(&g_tls_registry_mutex);
+    for (TLSData* d = g_tls_registry; d != NULL; d = d->next) {
+        pthread_mutex_lock(&d->mutex);
+        const bool idle = (d->version == d->reclaimer_seen_version);
+        d->reclaimer_seen_version = d->version;
+        IOBuf::Block* detached = NULL;
+        if (idle && d->block_head != NULL &&
+            g_tls_block_bytes.load(butil::memory_order_relaxed) > keep_bytes) {
+            detached = d->block_head->portal_next;
+            d->block_head->portal_next = NULL;
+            for (IOBuf::Block* p = detached; p != NULL; p = p->portal_next) {
+                note_tls_block_removed(*d, p);
+            }
+            if (d->high_watermark > d->num_blocks) {
+                d->high_watermark = d->num_blocks;
+            }
+        }
+        pthread_mutex_unlock(&d->mutex);
+        while (detached) {
+            IOBuf::Block* const saved_next = detached->portal_next;
+            release_block(detached);
+            detached = saved_next;
+            ++nreclaimed;
         }
     }
-    tls_data.block_head = b->portal_next;
-    --tls_data.num_blocks;
-    b->portal_next = NULL;
-    return b;
+    pthread_mutex_unlock(&g_tls_registry_mutex);
+    if (nreclaimed > 0) {
+        g_tls_nreclaimed.fetch_add(nreclaimed, butil::memory_order_relaxed);
+    }
+    return nreclaimed;
 }
 
 inline IOBuf::BlockRef* acquire_blockref_array(size_t cap) {
@@ -483,6 +1114,30 @@ size_t IOBuf::block_count_hit_tls_threshold() {
     return iobuf::g_num_hit_tls_threshold.load(butil::memory_order_relaxed);
 }
 
+size_t IOBuf::tls_block_count() {
+    return iobuf::g_tls_nblocks.load(butil::memory_order_relaxed);
+}
+
+size_t IOBuf::tls_block_memory() {
+    return iobuf::g_tls_block_bytes.load(butil::memory_order_relaxed);
+}
+
+size_t IOBuf::tls_block_hit_count() {
+    return iobuf::g_tls_nhit.load(butil::memory_order_relaxed);
+}
+
+size_t IOBuf::tls_block_miss_count() {
+    return iobuf::g_tls_nmiss.load(butil::memory_order_relaxed);
+}
+
+size_t IOBuf::tls_block_reclaimed_count() {
+    return iobuf::g_tls_nreclaimed.load(butil::memory_order_relaxed);
+}
+
+size_t IOBuf::reclaim_idle_tls_block_caches(size_t keep_bytes) {
+    return iobuf::reclaim_idle_tls_block_caches(keep_bytes);
+}
+
 BAIDU_CASSERT(sizeof(IOBuf::SmallView) == sizeof(IOBuf::BigView),
               sizeof_small_and_big_view_should_equal);
 
@@ -814,6 +1469,7 @@ size_t IOBuf::cutn(void* out, size_t n) {
     if (n > len) {
         n = len;
     }
+    iobuf::notify_copy_hook(n);
     const size_t saved_n = n;
     while (n) {   // length() == 0 does not enter
         IOBuf::BlockRef &r = _front_ref();
@@ -852,18 +1508,18 @@ size_t IOBuf::cutn(std::string* out, size_t n) {
 int IOBuf::_cut_by_char(IOBuf* out, char d) {
     const size_t nref = _ref_num();
     size_t n = 0;
-    
+
     for (size_t i = 0; i < nref; ++i) {
         IOBuf::BlockRef const& r = _ref_at(i);
         char const* const s = r.block->data + r.offset;
-        for (uint32_t j = 0; j < r.length; ++j, ++n) {
-            if (s[j] == d) {
-                // There's no way cutn/pop_front fails
-                cutn(out, n);
-                pop_front(1);
-                return 0;
-            }
+        char const* const p = (char const*)memchr(s, d, r.length);
+        if (p != NULL) {
+            // There's no way cutn/pop_front fails
+            cutn(out, n + (p - s));
+            pop_front(1);
+            return 0;
         }
+        n += r.length;
     }
 
     return -1;
@@ -872,16 +1528,19 @@ int IOBuf::_cut_by_char(IOBuf* out, char d) {
 int IOBuf::_cut_by_delim(IOBuf* out, char const* dbegin, size_t ndelim) {
     typedef unsigned long SigType;
     const size_t NMAX = sizeof(SigType);
-    
+
     if (ndelim > NMAX || ndelim > length()) {
         return -1;
     }
-    
+    if (ndelim == 1) {
+        return _cut_by_char(out, *dbegin);
+    }
+
     SigType dsig = 0;
     for (size_t i = 0; i < ndelim; ++i) {
         dsig = (dsig << CHAR_BIT) | static_cast<SigType>(dbegin[i]);
     }
-    
+
     const SigType SIGMASK =
         (ndelim == NMAX ? (SigType)-1 : (((SigType)1 << (ndelim * CHAR_BIT)) - 1));
 
@@ -892,16 +1551,42 @@ int IOBuf::_cut_by_delim(IOBuf* out, char const* dbegin, size_t ndelim) {
     for (size_t i = 0; i < nref; ++i) {
         IOBuf::BlockRef const& r = _ref_at(i);
         char const* const s = r.block->data + r.offset;
-        
-        for (uint32_t j = 0; j < r.length; ++j, ++n) {
+
+        // A delimiter may straddle the boundary to the previous block(s):
+        // run the byte-wise signature register over the first ndelim-1
+        // bytes to catch matches ending there. Such matches start before
+        // any match found inside this block by the vectorized search.
+        const uint32_t nboundary =
+            std::min<uint32_t>(ndelim - 1, r.length);
+        for (uint32_t j = 0; j < nboundary; ++j) {
             sig = ((sig << CHAR_BIT) | static_cast<SigType>(s[j])) & SIGMASK;
             if (sig == dsig) {
                 // There's no way cutn/pop_front fails
-                cutn(out, n + 1 - ndelim);
+                cutn(out, n + j + 1 - ndelim);
                 pop_front(ndelim);
                 return 0;
             }
         }
+        if (r.length >= ndelim) {
+            // Matches lying fully inside this block.
+            char const* const p = (char const*)butil::simd::memmem(
+                s, r.length, dbegin, ndelim);
+            if (p != NULL) {
+                cutn(out, n + (p - s));
+                pop_front(ndelim);
+                return 0;
+            }
+            // Refill the register with the trailing bytes for the
+            // boundary check of the next block.
+            sig = 0;
+            for (uint32_t j = r.length - (ndelim - 1); j < r.length; ++j) {
+                sig = ((sig << CHAR_BIT) | static_cast<SigType>(s[j]))
+                    & SIGMASK;
+            }
+        }
+        // Blocks shorter than the delimiter went through the register
+        // entirely in the boundary loop above.
+        n += r.length;
     }
 
     return -1;
@@ -911,11 +1596,25 @@ int IOBuf::_cut_by_delim(IOBuf* out, char const* dbegin, size_t ndelim) {
 // is too large(in the worst case) for bthreads with small stacks.
 static const size_t IOBUF_IOV_MAX = 256;
 
+namespace iobuf {
+// Defined along with append_file_region().
+bool is_file_region(IOBuf::Block const* b);
+ssize_t send_file_region(int fd, off_t dest_offset, const IOBuf::BlockRef& r);
+}
+
 ssize_t IOBuf::pcut_into_file_descriptor(int fd, off_t offset, size_t size_hint) {
     if (empty()) {
         return 0;
     }
-    
+
+    if (iobuf::is_file_region(_ref_at(0).block)) {
+        const ssize_t nw = iobuf::send_file_region(fd, offset, _ref_at(0));
+        if (nw > 0) {
+            pop_front(nw);
+        }
+        return nw;
+    }
+
     const size_t nref = std::min(_ref_num(), IOBUF_IOV_MAX);
     struct iovec vec[nref];
     size_t nvec = 0;
@@ -923,6 +1622,11 @@ ssize_t IOBuf::pcut_into_file_descriptor(int fd, off_t offset, size_t size_hint)
 
     do {
         IOBuf::BlockRef const& r = _ref_at(nvec);
+        if (iobuf::is_file_region(r.block)) {
+            // Flush in-memory refs before the region first; the region is
+            // emitted by sendfile in a later call.
+            break;
+        }
         vec[nvec].iov_base = r.block->data + r.offset;
         vec[nvec].iov_len = r.length;
         ++nvec;
@@ -954,6 +1658,14 @@ ssize_t IOBuf::cut_into_writer(IWriter* writer, size_t size_hint) {
 
     do {
         IOBuf::BlockRef const& r = _ref_at(nvec);
+        if (iobuf::is_file_region(r.block)) {
+            // File regions can only be emitted by sendfile into a fd.
+            if (nvec == 0) {
+                errno = EOPNOTSUPP;
+                return -1;
+            }
+            break;
+        }
         vec[nvec].iov_base = r.block->data + r.offset;
         vec[nvec].iov_len = r.length;
         ++nvec;
@@ -974,6 +1686,12 @@ ssize_t IOBuf::cut_into_SSL_channel(SSL* ssl, int* ssl_error) {
     }
     
     IOBuf::BlockRef const& r = _ref_at(0);
+    if (iobuf::is_file_region(r.block)) {
+        // File regions can only be emitted by sendfile into a fd.
+        errno = EOPNOTSUPP;
+        *ssl_error = SSL_ERROR_SYSCALL;
+        return -1;
+    }
     const int nw = SSL_write(ssl, r.block->data + r.offset, r.length);
     if (nw > 0) {
         pop_front(nw);
@@ -1046,14 +1764,26 @@ ssize_t IOBuf::pcut_multiple_into_file_descriptor(
     }
     struct iovec vec[IOBUF_IOV_MAX];
     size_t nvec = 0;
-    for (size_t i = 0; i < count; ++i) {
+    for (size_t i = 0; i < count && nvec < IOBUF_IOV_MAX; ++i) {
         const IOBuf* p = pieces[i];
         const size_t nref = p->_ref_num();
-        for (size_t j = 0; j < nref && nvec < IOBUF_IOV_MAX; ++j, ++nvec) {
+        size_t j = 0;
+        for (; j < nref && nvec < IOBUF_IOV_MAX; ++j, ++nvec) {
             IOBuf::BlockRef const& r = p->_ref_at(j);
+            if (iobuf::is_file_region(r.block)) {
+                break;
+            }
             vec[nvec].iov_base = r.block->data + r.offset;
             vec[nvec].iov_len = r.length;
         }
+        if (j < nref && iobuf::is_file_region(p->_ref_at(j).block)) {
+            if (nvec == 0) {
+                // The region is at the very front, emit it by sendfile.
+                return pieces[i]->pcut_into_file_descriptor(fd, offset);
+            }
+            // Flush in-memory refs before the region first.
+            break;
+        }
     }
 
     ssize_t nw = 0;
@@ -1160,6 +1890,7 @@ int IOBuf::append(void const* data, size_t count) {
     if (count == 1) {
         return push_back(*((char const*)data));
     }
+    iobuf::notify_copy_hook(count);
     size_t total_nc = 0;
     while (total_nc < count) {  // excluded count == 0
         IOBuf::Block* b = iobuf::share_tls_block();
@@ -1178,6 +1909,10 @@ int IOBuf::append(void const* data, size_t count) {
 }
 
 int IOBuf::appendv(const const_iovec* vec, size_t n) {
+    return appendv(vec, n, NULL);
+}
+
+int IOBuf::appendv(const const_iovec* vec, size_t n, uint32_t* crc32c_inout) {
     size_t offset = 0;
     for (size_t i = 0; i < n;) {
         IOBuf::Block* b = iobuf::share_tls_block();
@@ -1189,13 +1924,19 @@ int IOBuf::appendv(const const_iovec* vec, size_t n) {
             const const_iovec & vec_i = vec[i];
             const size_t nc = std::min(vec_i.iov_len - offset, b->left_space() - total_cp);
             iobuf::cp(b->data + b->size + total_cp, (char*)vec_i.iov_base + offset, nc);
+            if (crc32c_inout != NULL) {
+                // Checksum the bytes just copied while they are still in
+                // cache rather than walking the buffer again afterwards.
+                *crc32c_inout = butil::crc32c::Extend(
+                    *crc32c_inout, b->data + b->size + total_cp, nc);
+            }
             total_cp += nc;
             offset += nc;
             if (offset != vec_i.iov_len) {
                 break;
             }
         }
-        
+
         const IOBuf::BlockRef r = { (uint32_t)b->size, total_cp, b };
         b->size += total_cp;
         _push_back_ref(r);
@@ -1221,6 +1962,96 @@ int IOBuf::append_user_data(void* data, size_t size, void (*deleter)(void*)) {
     return 0;
 }
 
+int IOBuf::append_file_region(int fd, off_t offset, size_t size, bool own_fd) {
+    if (size > 0xFFFFFFFFULL - 100) {
+        LOG(FATAL) << "size=" << size << " is too large";
+        return -1;
+    }
+    if (fd < 0 || offset < 0 || size == 0) {
+        return -1;
+    }
+    char* mem = (char*)malloc(sizeof(IOBuf::Block) + sizeof(FileRegionExtension));
+    if (mem == NULL) {
+        return -1;
+    }
+    IOBuf::Block* b = new (mem) IOBuf::Block((uint32_t)size, fd, offset, own_fd);
+    const IOBuf::BlockRef r = { 0, b->cap, b };
+    _move_back_ref(r);
+    return 0;
+}
+
+ssize_t IOBuf::pappend_aligned_from_file_descriptor(
+    int fd, off_t offset, size_t max_count) {
+    const size_t align_mask = iobuf::ALIGNED_BLOCK_ALIGNMENT - 1;
+    size_t total = 0;
+    while (total < max_count) {
+        const size_t remaining = max_count - total;
+        size_t data_cap = iobuf::ALIGNED_BLOCK_DATA_CAP;
+        if (remaining < data_cap) {
+            // O_DIRECT requires the count to be a multiple of the logical
+            // block size, round the tail up; pread never reads past EOF.
+            data_cap = (remaining + align_mask) & ~align_mask;
+        }
+        IOBuf::Block* b = iobuf::create_aligned_block(data_cap);
+        if (NULL == b) {
+            errno = ENOMEM;
+            return total > 0 ? (ssize_t)total : -1;
+        }
+        const ssize_t nr = ::pread(fd, b->data, data_cap, offset + total);
+        if (nr <= 0) {
+            b->dec_ref();
+            if (nr < 0 && total == 0) {
+                return -1;
+            }
+            break;
+        }
+        const uint32_t kept = (size_t)nr < remaining ? nr : remaining;
+        b->size = kept;
+        const IOBuf::BlockRef r = { 0, kept, b };
+        _move_back_ref(r);
+        total += kept;
+        if ((size_t)nr < data_cap) {  // EOF
+            break;
+        }
+    }
+    return total;
+}
+
+namespace iobuf {
+
+bool is_file_region(IOBuf::Block const* b) {
+    return b->flags & IOBUF_BLOCK_FLAGS_FILE_REGION;
+}
+
+// Emit the file region referenced by `r' into `fd' with sendfile, never
+// copying the data through userspace. `dest_offset' (>=0 means pwrite
+// semantics) is not supported since sendfile always writes at the current
+// position of a socket/file.
+ssize_t send_file_region(int fd, off_t dest_offset, const IOBuf::BlockRef& r) {
+    if (dest_offset >= 0) {
+        errno = EOPNOTSUPP;
+        return -1;
+    }
+    FileRegionExtension* ext = r.block->get_file_region_extension();
+    off_t src_offset = ext->offset + r.offset;
+#if defined(OS_LINUX)
+    return ::sendfile(fd, ext->fd, &src_offset, r.length);
+#elif defined(OS_MACOSX)
+    off_t len = r.length;
+    const int rc = ::sendfile(ext->fd, fd, src_offset, &len, NULL, 0);
+    if (rc < 0 && len == 0) {
+        return -1;
+    }
+    // Partial writes set len to the number of bytes actually sent.
+    return (ssize_t)len;
+#else
+    errno = EOPNOTSUPP;
+    return -1;
+#endif
+}
+
+} // namespace iobuf
+
 int IOBuf::resize(size_t n, char c) {
     const size_t saved_len = length();
     if (n < saved_len) {
@@ -1380,6 +2211,7 @@ size_t IOBuf::copy_to(void* d, size_t n, size_t pos) const {
         m -= nc;
     }
     // If nref == 0, here returns 0 correctly
+    iobuf::notify_copy_hook(n - m);
     return n - m;
 }
 
@@ -1554,7 +2386,12 @@ ssize_t IOPortal::pappend_from_file_descriptor(
     // Prepare at most MAX_APPEND_IOVEC blocks or space of blocks >= max_count
     do {
         if (p == NULL) {
-            p = iobuf::acquire_tls_block();
+            // Allocate from a larger size class when a lot more data is
+            // demanded, otherwise use default-sized TLS blocks.
+            const size_t class_size =
+                iobuf::append_block_size_for(max_count - space);
+            p = (class_size != 0 ? iobuf::create_block(class_size)
+                                 : iobuf::acquire_tls_block());
             if (BAIDU_UNLIKELY(!p)) {
                 errno = ENOMEM;
                 return -1;
@@ -1615,7 +2452,10 @@ ssize_t IOPortal::append_from_reader(IReader* reader, size_t max_count) {
     // Prepare at most MAX_APPEND_IOVEC blocks or space of blocks >= max_count
     do {
         if (p == NULL) {
-            p = iobuf::acquire_tls_block();
+            const size_t class_size =
+                iobuf::append_block_size_for(max_count - space);
+            p = (class_size != 0 ? iobuf::create_block(class_size)
+                                 : iobuf::acquire_tls_block());
             if (BAIDU_UNLIKELY(!p)) {
                 errno = ENOMEM;
                 return -1;
@@ -1839,6 +2679,65 @@ size_t IOBufCutter::cutn(void* out, size_t n) {
     }
 }
 
+size_t IOBufCutter::cutn_batch(void* out, size_t record_size, size_t count) {
+    if (record_size == 0) {
+        return 0;
+    }
+    size_t ncut = 0;
+    char* dst = (char*)out;
+    while (ncut < count) {
+        const size_t size = (char*)_data_end - (char*)_data;
+        if (size >= record_size) {
+            // All whole records inside the current block are copied with
+            // one bounds check and one memcpy.
+            const size_t n = std::min(size / record_size, count - ncut);
+            const size_t nbytes = n * record_size;
+            memcpy(dst, _data, nbytes);
+            _data = (char*)_data + nbytes;
+            dst += nbytes;
+            ncut += n;
+        } else if (size == 0) {
+            if (!load_next_ref()) {
+                break;
+            }
+        } else {
+            // The next record straddles blocks, assemble it with cutn
+            // which also unloads the current block.
+            if (remaining_bytes() < record_size) {
+                break;
+            }
+            CHECK_EQ(record_size, cutn(dst, record_size));
+            dst += record_size;
+            ++ncut;
+        }
+    }
+    return ncut;
+}
+
+size_t IOBufCutter::fetch_batch(const void** data, size_t record_size,
+                                size_t max_count) {
+    if (record_size == 0 || max_count == 0) {
+        return 0;
+    }
+    size_t size = (char*)_data_end - (char*)_data;
+    if (size < record_size) {
+        if (size != 0) {
+            // Leading record straddles blocks, no contiguous span.
+            return 0;
+        }
+        if (!load_next_ref()) {
+            return 0;
+        }
+        size = (char*)_data_end - (char*)_data;
+        if (size < record_size) {
+            return 0;
+        }
+    }
+    *data = _data;
+    const size_t n = size / record_size;
+    return std::min(n, max_count);
+}
+
 IOBufAsZeroCopyInputStream::IOBufAsZeroCopyInputStream(const IOBuf& buf)
     : _ref_index(0)
     , _add_offset(0)
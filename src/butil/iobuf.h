@@ -50,6 +50,16 @@ struct ssl_st;
 }
 
 namespace butil {
+namespace iobuf {
+
+// Called with the number of bytes just deep-copied by copy_to(void*),
+// cutn(void*) and append(const void*, size_t) (and the string variants
+// funneled through them). Installed by samplers such as brpc's
+// /iobuf_copies to locate copies worth converting to zero-copy code.
+// NULL(default) leaves a single predictable branch in the copy paths.
+extern void (*copy_hook)(size_t num_copied);
+
+}  // namespace iobuf
 
 // IOBuf is a non-continuous buffer that can be cut and combined w/o copying
 // payload. It can be read from or flushed into file descriptors as well.
@@ -233,6 +243,13 @@ public:
     int appendv(const iovec* vec, size_t n)
     { return appendv((const const_iovec*)vec, n); }
 
+    // Above with *crc32c_inout extended over the appended bytes during the
+    // copy, while they are still in cache. Walks memory once instead of
+    // appending first and running butil::crc32c::Extend over the result.
+    int appendv(const const_iovec vec[], size_t n, uint32_t* crc32c_inout);
+    int appendv(const iovec* vec, size_t n, uint32_t* crc32c_inout)
+    { return appendv((const const_iovec*)vec, n, crc32c_inout); }
+
     // Append a c-style string to back side. (with copying)
     // Returns 0 on success, -1 otherwise.
     // NOTE: Returns 0 when `s' is empty.
@@ -248,6 +265,32 @@ public:
     // deleted using the deleter func when no IOBuf references it anymore.
     int append_user_data(void* data, size_t size, void (*deleter)(void*));
 
+    // Append a region of a file: `size' bytes of `fd' starting at `offset',
+    // WITHOUT reading the data into userspace. The region is emitted by
+    // sendfile when the IOBuf is written out with
+    // cut(_multiple)_into_file_descriptor, thus the data never touches
+    // userspace. If `own_fd' is true(default), `fd' is closed when no IOBuf
+    // references the region anymore.
+    // An IOBuf with file regions is write-only: reading APIs(copy_to,
+    // to_string, cut into SSL/IWriter...) on the region part have undefined
+    // behaviors. Moving/splitting/cutting between IOBufs works.
+    // Returns 0 on success, -1 otherwise.
+    int append_file_region(int fd, off_t offset, size_t size,
+                           bool own_fd = true);
+
+    // Append at most `max_count' bytes read from offset `offset' of `fd'
+    // into dedicated 4KB-aligned blocks, so that `fd' may be opened with
+    // O_DIRECT and the data bypasses the page cache end-to-end. `offset'
+    // and `max_count' should be multiples of the logical block size of the
+    // file as O_DIRECT requires; reads are issued in aligned chunks and a
+    // short read(EOF) appends only the bytes actually read. Also works on
+    // regular fds, with the alignment merely wasting the tail of the last
+    // block. Use append_file_region() as the zero-copy(sendfile) fallback
+    // when O_DIRECT is unavailable on the filesystem.
+    // Returns bytes appended, 0 on EOF, -1 otherwise and errno is set.
+    ssize_t pappend_aligned_from_file_descriptor(int fd, off_t offset,
+                                                 size_t max_count);
+
     // Resizes the buf to a length of n characters.
     // If n is smaller than the current length, all bytes after n will be
     // truncated.
@@ -342,6 +385,23 @@ public:
     static size_t block_memory();
     static size_t new_bigview_count();
     static size_t block_count_hit_tls_threshold();
+    // Number of blocks of the larger size classes(64K/256K) in use.
+    static size_t medium_block_count();
+    static size_t huge_block_count();
+    // Number of blocks/bytes cached in TLS of all threads.
+    static size_t tls_block_count();
+    static size_t tls_block_memory();
+    // Acquisitions served from/missed by TLS caches, flushed periodically
+    // from per-thread counters thus slightly behind.
+    static size_t tls_block_hit_count();
+    static size_t tls_block_miss_count();
+    // Blocks taken away from idle threads by reclaim_idle_tls_block_caches().
+    static size_t tls_block_reclaimed_count();
+    // Free blocks cached by threads that did no IOBuf operation since the
+    // previous call, as long as tls_block_memory() exceeds `keep_bytes'.
+    // Called periodically by a sampling thread in brpc. Returns the number
+    // of reclaimed blocks.
+    static size_t reclaim_idle_tls_block_caches(size_t keep_bytes);
 
     // Equal with a string/IOBuf or not.
     bool equals(const butil::StringPiece&) const;
@@ -498,6 +558,25 @@ public:
     // Return true on cut, false otherwise.
     bool cut1(void* data);
 
+    // Cut off up to `count' whole records of `record_size' bytes each and
+    // copy them contiguously into `out'. Records fully inside one block
+    // are copied with a single bounds check and memcpy per block instead
+    // of per record, making this much faster than calling
+    // cutn(out, record_size) in a loop for small fixed-size records.
+    // Partial records are never cut.
+    // Returns the number of records cut.
+    size_t cutn_batch(void* out, size_t record_size, size_t count);
+
+    // Point *data at a contiguous run of up to `max_count' whole records
+    // of `record_size' bytes inside the current block, without copying.
+    // The span stays valid until this cutter or the source IOBuf is
+    // modified; call pop_front(n * record_size) to consume it.
+    // Returns the number of records at *data. 0 means the remaining data
+    // is either empty or begins with a record straddling blocks, which
+    // cutn()/cutn_batch() can still assemble.
+    size_t fetch_batch(const void** data, size_t record_size,
+                       size_t max_count);
+
     // Copy n bytes into `data'
     // Returns bytes copied.
     size_t copy_to(void* data, size_t n);
@@ -679,7 +758,21 @@ public:
     // E5-2620 @ 2.00GHz
     // Returns 0 on success, -1 otherwise.
     int push_back(char c);
-    
+
+    // Reserve `n' bytes at the current position to be assigned later with
+    // unsafe_assign(), typically a protocol header patched after the
+    // message body is serialized and its size is known. Subsequent
+    // appends continue right behind the reserved bytes, in the same block
+    // when they fit, so small header+body messages stay contiguous.
+    // Returns an object representing the reserved area, INVALID_AREA on
+    // failure or n == 0.
+    IOBuf::Area reserve(size_t n);
+
+    // Copy `data' to the `area' returned by reserve(). `data' must be as
+    // long as the reserved size. See IOBuf::unsafe_assign() for caveats.
+    // Returns 0 on success, -1 otherwise.
+    int unsafe_assign(IOBuf::Area area, const void* data);
+
     IOBuf& buf() {
         shrink();
         return _buf;
@@ -315,6 +315,18 @@ inline int IOBufAppender::push_back(char c) {
     return 0;
 }
 
+inline IOBuf::Area IOBufAppender::reserve(size_t n) {
+    // Flush the cursor so that the reserved bytes are pushed behind
+    // everything appended so far. The next append re-acquires the shared
+    // tls block and continues right behind the reservation.
+    shrink();
+    return _buf.reserve(n);
+}
+
+inline int IOBufAppender::unsafe_assign(IOBuf::Area area, const void* data) {
+    return _buf.unsafe_assign(area, data);
+}
+
 inline int IOBufAppender::add_block() {
     int size = 0;
     if (_zc_stream.Next(&_data, &size)) {
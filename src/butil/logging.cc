@@ -62,6 +62,7 @@ typedef pthread_mutex_t* MutexHandle;
 #include <string>
 
 #include "butil/file_util.h"
+#include "butil/iobuf.h"
 #include "butil/debug/alias.h"
 #include "butil/debug/debugger.h"
 #include "butil/debug/stack_trace.h"
@@ -623,6 +624,119 @@ bool StringSink::OnLogMessage(int severity, const char* file, int line,
     return true;
 }
 
+struct AsyncLogSink::LogEntry {
+    LogEntry* next;
+    uint32_t size;
+    // Followed by `size' bytes of the formatted log line.
+    char* data() { return reinterpret_cast<char*>(this + 1); }
+};
+
+AsyncLogSink::AsyncLogSink(int fd, size_t max_buffered_bytes)
+    : _head(NULL)
+    , _buffered_bytes(0)
+    , _ndropped(0)
+    , _nreported_dropped(0)
+    , _max_buffered_bytes(max_buffered_bytes)
+    , _fd(fd)
+    , _stop(false) {
+    const int rc = pthread_create(&_flush_thread, NULL, RunFlushThread, this);
+    CHECK_EQ(0, rc) << "Fail to create flush thread of AsyncLogSink";
+}
+
+AsyncLogSink::~AsyncLogSink() {
+    _stop = true;
+    pthread_join(_flush_thread, NULL);
+}
+
+bool AsyncLogSink::OnLogMessage(int severity, const char* file, int line,
+                                const butil::StringPiece& content) {
+    if (_buffered_bytes.load(butil::memory_order_relaxed) >=
+        _max_buffered_bytes) {
+        // The flush thread can't keep up(stalled disk?), dropping is
+        // better than stalling the logging thread as well.
+        _ndropped.fetch_add(1, butil::memory_order_relaxed);
+        return true;
+    }
+    std::ostringstream os;
+    print_log_prefix(os, severity, file, line);
+    os.write(content.data(), content.size());
+    os << '\n';
+    const std::string log = os.str();
+    LogEntry* e = (LogEntry*)malloc(sizeof(LogEntry) + log.size());
+    if (NULL == e) {
+        _ndropped.fetch_add(1, butil::memory_order_relaxed);
+        return true;
+    }
+    e->size = log.size();
+    memcpy(e->data(), log.data(), log.size());
+    _buffered_bytes.fetch_add(log.size(), butil::memory_order_relaxed);
+    // Lock-free push. The list grows in reverse order and is reversed by
+    // the flush thread.
+    LogEntry* head = _head.load(butil::memory_order_relaxed);
+    do {
+        e->next = head;
+    } while (!_head.compare_exchange_weak(head, e, butil::memory_order_release,
+                                          butil::memory_order_relaxed));
+    return true;
+}
+
+void* AsyncLogSink::RunFlushThread(void* arg) {
+    static_cast<AsyncLogSink*>(arg)->FlushThread();
+    return NULL;
+}
+
+void AsyncLogSink::FlushThread() {
+    butil::IOBuf buf;
+    bool stopping = false;
+    while (!stopping) {
+        if (_stop) {
+            // Write out entries published before `_stop' and quit.
+            stopping = true;
+        }
+        LogEntry* e = _head.exchange(NULL, butil::memory_order_acquire);
+        if (e == NULL && !stopping) {
+            usleep(10 * 1000);
+            continue;
+        }
+        // Reverse into publishing order.
+        LogEntry* prev = NULL;
+        while (e != NULL) {
+            LogEntry* const next = e->next;
+            e->next = prev;
+            prev = e;
+            e = next;
+        }
+        size_t nbytes = 0;
+        for (e = prev; e != NULL;) {
+            buf.append(e->data(), e->size);
+            nbytes += e->size;
+            LogEntry* const next = e->next;
+            free(e);
+            e = next;
+        }
+        _buffered_bytes.fetch_sub(nbytes, butil::memory_order_relaxed);
+        const size_t ndropped = _ndropped.load(butil::memory_order_relaxed);
+        if (ndropped != _nreported_dropped) {
+            char msg[80];
+            snprintf(msg, sizeof(msg), "AsyncLogSink dropped %llu messages\n",
+                     (unsigned long long)(ndropped - _nreported_dropped));
+            buf.append(msg);
+            _nreported_dropped = ndropped;
+        }
+        while (!buf.empty()) {
+            if (buf.cut_into_file_descriptor(_fd) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                // Logging the error may go through this sink again, just
+                // drop the batch to avoid spinning.
+                buf.clear();
+                break;
+            }
+        }
+    }
+}
+
 CharArrayStreamBuf::~CharArrayStreamBuf() {
     free(_data);
 }
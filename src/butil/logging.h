@@ -328,6 +328,43 @@ private:
     butil::Lock _lock;
 };
 
+// A sink that never blocks the logging thread: OnLogMessage() pushes the
+// formatted line onto a lock-free queue and returns immediately; a
+// dedicated flush thread batches queued lines into an IOBuf and cuts it
+// into `fd'. When pending bytes exceed `max_buffered_bytes', new messages
+// are dropped and counted instead of blocking the logger; the number of
+// dropped messages is reported in-band once the queue drains.
+// Enable with logging::SetLogSink(new logging::AsyncLogSink(fd)); restore
+// the previous sink before deleting this one.
+class BUTIL_EXPORT AsyncLogSink : public LogSink {
+public:
+    explicit AsyncLogSink(int fd,
+                          size_t max_buffered_bytes = 8 * 1024 * 1024);
+    // Flushes buffered messages and joins the flush thread.
+    ~AsyncLogSink();
+
+    bool OnLogMessage(int severity, const char* file, int line,
+                      const butil::StringPiece& log_content) override;
+
+    // Number of messages dropped on a full queue so far.
+    size_t ndropped() const
+    { return _ndropped.load(butil::memory_order_relaxed); }
+
+private:
+    static void* RunFlushThread(void* arg);
+    void FlushThread();
+
+    struct LogEntry;
+    butil::atomic<LogEntry*> _head;
+    butil::atomic<size_t> _buffered_bytes;
+    butil::atomic<size_t> _ndropped;
+    size_t _nreported_dropped;  // flush thread only
+    const size_t _max_buffered_bytes;
+    const int _fd;
+    volatile bool _stop;
+    pthread_t _flush_thread;
+};
+
 typedef int LogSeverity;
 const LogSeverity BLOG_VERBOSE = -1;  // This is level 1 verbosity
 // Note: the log severities are used to index into the array of names,
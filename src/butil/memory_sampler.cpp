@@ -0,0 +1,134 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <gflags/gflags.h>
+#include <map>
+#include "butil/memory_sampler.h"
+#include "butil/atomicops.h"
+#include "butil/time.h"                              // gettimeofday_us
+#include "butil/scoped_lock.h"                       // BAIDU_SCOPED_LOCK
+#include "butil/synchronization/lock.h"              // Mutex
+#include "butil/memory/singleton_on_pthread_once.h"  // get_leaky_singleton
+
+namespace butil {
+
+DEFINE_int32(memory_sample_interval, 0,
+             "Record the calling stack of one in so many block allocations"
+             " of IOBuf and Resource/ObjectPool, shown at /memory_internals"
+             " of servers. <=0 disables the sampling");
+
+// Big enough to cover the hot call sites, small enough to scan at each
+// visit of /memory_internals.
+static const size_t MEMORY_SAMPLE_RING_SIZE = 256;
+
+namespace {
+struct SampleRing {
+    SampleRing() : nalloc(0), nsample(0) {
+        samples.resize(MEMORY_SAMPLE_RING_SIZE);
+    }
+    butil::atomic<int64_t> nalloc;  // all reported allocations
+    butil::Mutex mutex;
+    // Total samples ever taken, guarded by mutex. samples[nsample %
+    // MEMORY_SAMPLE_RING_SIZE] is the oldest sample when the ring wrapped.
+    uint64_t nsample;
+    std::vector<MemorySample> samples;
+};
+
+inline SampleRing* get_sample_ring() {
+    return butil::get_leaky_singleton<SampleRing>();
+}
+}  // namespace
+
+void SampleMemoryAllocation(const char* source, size_t bytes) {
+    const int interval = FLAGS_memory_sample_interval;
+    if (interval <= 0) {
+        return;
+    }
+    SampleRing* r = get_sample_ring();
+    if (r->nalloc.fetch_add(1, butil::memory_order_relaxed) % interval != 0) {
+        return;
+    }
+    MemorySample s;  // captures the stack
+    s.source = source;
+    s.bytes = bytes;
+    s.realtime_us = gettimeofday_us();
+    BAIDU_SCOPED_LOCK(r->mutex);
+    r->samples[r->nsample % MEMORY_SAMPLE_RING_SIZE] = s;
+    ++r->nsample;
+}
+
+void ListMemorySamples(std::vector<MemorySample>* out) {
+    out->clear();
+    SampleRing* r = get_sample_ring();
+    BAIDU_SCOPED_LOCK(r->mutex);
+    const uint64_t begin = r->nsample > MEMORY_SAMPLE_RING_SIZE ?
+        r->nsample - MEMORY_SAMPLE_RING_SIZE : 0;
+    out->reserve(r->nsample - begin);
+    for (uint64_t i = begin; i < r->nsample; ++i) {
+        out->push_back(r->samples[i % MEMORY_SAMPLE_RING_SIZE]);
+    }
+}
+
+void DescribeMemorySamples(std::ostream& os) {
+    std::vector<MemorySample> samples;
+    ListMemorySamples(&samples);
+    const int interval = FLAGS_memory_sample_interval;
+    SampleRing* r = get_sample_ring();
+    os << "memory_sample_interval: " << interval
+       << "\nreported_allocations: "
+       << r->nalloc.load(butil::memory_order_relaxed)
+       << "\nsamples_in_ring: " << samples.size()
+       << " (capacity=" << MEMORY_SAMPLE_RING_SIZE << ")\n";
+    if (interval <= 0) {
+        os << "(set -memory_sample_interval to a positive number to"
+            " enable the sampling)\n";
+    }
+    // Aggregate by (source, stack). One sample stands for roughly
+    // `interval' allocations of its size.
+    typedef std::pair<const char*, std::vector<const void*> > SiteKey;
+    struct SiteStat {
+        SiteStat() : count(0), sampled_bytes(0), repr(NULL) {}
+        size_t count;
+        size_t sampled_bytes;
+        const MemorySample* repr;
+    };
+    std::map<SiteKey, SiteStat> sites;
+    for (size_t i = 0; i < samples.size(); ++i) {
+        const MemorySample& s = samples[i];
+        size_t nframe = 0;
+        const void* const* frames = s.stack.Addresses(&nframe);
+        SiteKey key(s.source, std::vector<const void*>(
+                        frames, frames + nframe));
+        SiteStat& st = sites[key];
+        ++st.count;
+        st.sampled_bytes += s.bytes;
+        st.repr = &s;
+    }
+    for (std::map<SiteKey, SiteStat>::const_iterator
+             it = sites.begin(); it != sites.end(); ++it) {
+        const SiteStat& st = it->second;
+        os << "\nsource=" << it->first.first
+           << " samples=" << st.count
+           << " sampled_bytes=" << st.sampled_bytes
+           << " estimated_bytes=" << st.sampled_bytes * (size_t)
+            (interval > 0 ? interval : 1)
+           << '\n';
+        st.repr->stack.OutputToStream(&os);
+    }
+}
+
+}  // namespace butil
@@ -0,0 +1,57 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef BUTIL_MEMORY_SAMPLER_H
+#define BUTIL_MEMORY_SAMPLER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <ostream>
+#include <vector>
+#include "butil/debug/stack_trace.h"
+
+namespace butil {
+
+// One sampled block allocation. `stack' was captured inside the allocating
+// function, thus its first frames point at the allocator itself and the
+// following ones at the user code asking for memory.
+struct MemorySample {
+    MemorySample() : source(NULL), bytes(0), realtime_us(0) {}
+
+    const char* source;        // static string, e.g. "iobuf_block"
+    size_t bytes;              // size of the sampled allocation
+    int64_t realtime_us;       // when the sample was taken
+    debug::StackTrace stack;
+};
+
+// Record the calling stack of one in -memory_sample_interval block
+// allocations into a fixed-size ring, over all sources. Called by IOBuf
+// and Resource/ObjectPool when they allocate a new block (group). Nearly
+// free when the sampling is off(default) and amortizedly cheap when on.
+void SampleMemoryAllocation(const char* source, size_t bytes);
+
+// Copy current content of the ring into `out', oldest sample first.
+void ListMemorySamples(std::vector<MemorySample>* out);
+
+// Print the samples aggregated by calling stack, one paragraph per
+// distinct stack with sampled/estimated sizes. Served at
+// /memory_internals of servers.
+void DescribeMemorySamples(std::ostream& os);
+
+}  // namespace butil
+
+#endif  // BUTIL_MEMORY_SAMPLER_H
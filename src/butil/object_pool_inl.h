@@ -29,6 +29,7 @@
 #include "butil/macros.h"                 // BAIDU_CACHELINE_ALIGNMENT
 #include "butil/scoped_lock.h"            // BAIDU_SCOPED_LOCK
 #include "butil/thread_local.h"           // BAIDU_THREAD_LOCAL
+#include "butil/memory_sampler.h"         // SampleMemoryAllocation
 #include <vector>
 
 #ifdef BUTIL_OBJECT_POOL_NEED_FREE_ITEM_NUM
@@ -334,6 +335,7 @@ private:
         if (NULL == new_block) {
             return NULL;
         }
+        SampleMemoryAllocation("object_pool_block", sizeof(Block));
         size_t ngroup;
         do {
             ngroup = _ngroup.load(butil::memory_order_acquire);
@@ -370,6 +372,8 @@ private:
         if (ngroup < OP_MAX_BLOCK_NGROUP) {
             bg = new(std::nothrow) BlockGroup;
             if (NULL != bg) {
+                SampleMemoryAllocation("object_pool_block_group",
+                                       sizeof(BlockGroup));
                 // Release fence is paired with consume fence in add_block()
                 // to avoid un-constructed bg to be seen by other threads.
                 _block_groups[ngroup].store(bg, butil::memory_order_release);
@@ -24,11 +24,14 @@
 
 #include <iostream>                      // std::ostream
 #include <pthread.h>                     // pthread_mutex_t
+#include <sched.h>                       // sched_getcpu
 #include <algorithm>                     // std::max, std::min
 #include "butil/atomicops.h"              // butil::atomic
 #include "butil/macros.h"                 // BAIDU_CACHELINE_ALIGNMENT
 #include "butil/scoped_lock.h"            // BAIDU_SCOPED_LOCK
 #include "butil/thread_local.h"           // thread_atexit
+#include "butil/build_config.h"           // OS_LINUX
+#include "butil/memory_sampler.h"         // SampleMemoryAllocation
 #include <vector>
 
 #ifdef BUTIL_RESOURCE_POOL_NEED_FREE_ITEM_NUM
@@ -87,6 +90,25 @@ static const size_t RP_MAX_BLOCK_NGROUP = 65536;
 static const size_t RP_GROUP_NBLOCK_NBIT = 16;
 static const size_t RP_GROUP_NBLOCK = (1UL << RP_GROUP_NBLOCK_NBIT);
 static const size_t RP_INITIAL_FREE_LIST_SIZE = 1024;
+// Number of shards of the global free-chunk list, must be power of 2.
+// Threads running on nearby cpus(mapped to the same shard) exchange chunks
+// through the same shard, so that ids freed cross-thread tend to be reused
+// on the same NUMA node and the mutexes are unlikely to be contended.
+static const size_t RP_FREE_CHUNK_NSHARD = 16;
+
+// Shard of the global free-chunk list that the calling thread exchanges
+// chunks with, keyed by the cpu currently run on when available.
+inline size_t rp_current_free_chunk_shard() {
+#if defined(OS_LINUX)
+    const int cpu = sched_getcpu();
+    if (cpu >= 0) {
+        return (size_t)cpu & (RP_FREE_CHUNK_NSHARD - 1);
+    }
+#endif
+    // pthread_t is an address of the (aligned) thread descriptor on most
+    // platforms, skip the always-zero low bits.
+    return ((size_t)pthread_self() >> 9) & (RP_FREE_CHUNK_NSHARD - 1);
+}
 
 template <typename T>
 class ResourcePoolBlockItemNum {
@@ -374,12 +396,17 @@ public:
 
 private:
     ResourcePool() {
-        _free_chunks.reserve(RP_INITIAL_FREE_LIST_SIZE);
-        pthread_mutex_init(&_free_chunks_mutex, NULL);
+        for (size_t i = 0; i < RP_FREE_CHUNK_NSHARD; ++i) {
+            _free_chunk_shards[i].chunks.reserve(
+                RP_INITIAL_FREE_LIST_SIZE / RP_FREE_CHUNK_NSHARD);
+            pthread_mutex_init(&_free_chunk_shards[i].mutex, NULL);
+        }
     }
 
     ~ResourcePool() {
-        pthread_mutex_destroy(&_free_chunks_mutex);
+        for (size_t i = 0; i < RP_FREE_CHUNK_NSHARD; ++i) {
+            pthread_mutex_destroy(&_free_chunk_shards[i].mutex);
+        }
     }
 
     // Create a Block and append it to right-most BlockGroup.
@@ -388,6 +415,7 @@ private:
         if (NULL == new_block) {
             return NULL;
         }
+        SampleMemoryAllocation("resource_pool_block", sizeof(Block));
 
         size_t ngroup;
         do {
@@ -425,6 +453,8 @@ private:
         if (ngroup < RP_MAX_BLOCK_NGROUP) {
             bg = new(std::nothrow) BlockGroup;
             if (NULL != bg) {
+                SampleMemoryAllocation("resource_pool_block_group",
+                                       sizeof(BlockGroup));
                 // Release fence is paired with consume fence in address() and
                 // add_block() to avoid un-constructed bg to be seen by other
                 // threads.
@@ -505,24 +535,40 @@ private:
     }
 
 private:
+    // The global free-chunk list is sharded to keep cross-thread frees of
+    // hot types(Socket, bthread ids) off a single mutex. Whole chunks are
+    // exchanged with LocalPools, never individual items.
+    struct BAIDU_CACHELINE_ALIGNMENT FreeChunkShard {
+        pthread_mutex_t mutex;
+        std::vector<DynamicFreeChunk*> chunks;
+    };
+
     bool pop_free_chunk(FreeChunk& c) {
-        // Critical for the case that most return_object are called in
-        // different threads of get_object.
-        if (_free_chunks.empty()) {
-            return false;
-        }
-        pthread_mutex_lock(&_free_chunks_mutex);
-        if (_free_chunks.empty()) {
-            pthread_mutex_unlock(&_free_chunks_mutex);
-            return false;
+        // Start from the shard of the current cpu and steal from the other
+        // shards when it's empty.
+        const size_t s0 = rp_current_free_chunk_shard();
+        for (size_t i = 0; i < RP_FREE_CHUNK_NSHARD; ++i) {
+            FreeChunkShard& shard =
+                _free_chunk_shards[(s0 + i) & (RP_FREE_CHUNK_NSHARD - 1)];
+            // Critical for the case that most return_object are called in
+            // different threads of get_object.
+            if (shard.chunks.empty()) {
+                continue;
+            }
+            pthread_mutex_lock(&shard.mutex);
+            if (shard.chunks.empty()) {
+                pthread_mutex_unlock(&shard.mutex);
+                continue;
+            }
+            DynamicFreeChunk* p = shard.chunks.back();
+            shard.chunks.pop_back();
+            pthread_mutex_unlock(&shard.mutex);
+            c.nfree = p->nfree;
+            memcpy(c.ids, p->ids, sizeof(*p->ids) * p->nfree);
+            free(p);
+            return true;
         }
-        DynamicFreeChunk* p = _free_chunks.back();
-        _free_chunks.pop_back();
-        pthread_mutex_unlock(&_free_chunks_mutex);
-        c.nfree = p->nfree;
-        memcpy(c.ids, p->ids, sizeof(*p->ids) * p->nfree);
-        free(p);
-        return true;
+        return false;
     }
 
     bool push_free_chunk(const FreeChunk& c) {
@@ -533,12 +579,13 @@ private:
         }
         p->nfree = c.nfree;
         memcpy(p->ids, c.ids, sizeof(*c.ids) * c.nfree);
-        pthread_mutex_lock(&_free_chunks_mutex);
-        _free_chunks.push_back(p);
-        pthread_mutex_unlock(&_free_chunks_mutex);
+        FreeChunkShard& shard = _free_chunk_shards[rp_current_free_chunk_shard()];
+        pthread_mutex_lock(&shard.mutex);
+        shard.chunks.push_back(p);
+        pthread_mutex_unlock(&shard.mutex);
         return true;
     }
-    
+
     static butil::static_atomic<ResourcePool*> _singleton;
     static pthread_mutex_t _singleton_mutex;
     static BAIDU_THREAD_LOCAL LocalPool* _local_pool;
@@ -548,8 +595,7 @@ private:
     static pthread_mutex_t _change_thread_mutex;
     static butil::static_atomic<BlockGroup*> _block_groups[RP_MAX_BLOCK_NGROUP];
 
-    std::vector<DynamicFreeChunk*> _free_chunks;
-    pthread_mutex_t _free_chunks_mutex;
+    FreeChunkShard _free_chunk_shards[RP_FREE_CHUNK_NSHARD];
 
 #ifdef BUTIL_RESOURCE_POOL_NEED_FREE_ITEM_NUM
     static butil::static_atomic<size_t> _global_nfree;
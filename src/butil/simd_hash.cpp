@@ -0,0 +1,148 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <string.h>
+#include "butil/simd_hash.h"
+#include "butil/third_party/murmurhash3/murmurhash3.h"
+
+#if defined(__SSE4_1__)
+#include <smmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace butil {
+namespace simd {
+
+static const uint32_t MURMUR_C1 = 0xcc9e2d51;
+static const uint32_t MURMUR_C2 = 0x1b873593;
+
+static inline uint32_t rotl32(uint32_t x, int r) {
+    return (x << r) | (x >> (32 - r));
+}
+
+static inline uint32_t load32(const char* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// Feeds one 4-byte block into the hash state, same math as the body
+// loop of MurmurHash3_x86_32.
+static inline uint32_t murmur_body(uint32_t h1, uint32_t k1) {
+    k1 *= MURMUR_C1;
+    k1 = rotl32(k1, 15);
+    k1 *= MURMUR_C2;
+    h1 ^= k1;
+    h1 = rotl32(h1, 13);
+    return h1 * 5 + 0xe6546b64;
+}
+
+// Consumes the blocks of `key' from `from_block' on, then the tail and
+// the finalization, continuing from state `h1'.
+static uint32_t murmur_finish_lane(uint32_t h1, const StringPiece& key,
+                                   size_t from_block) {
+    const size_t nblocks = key.size() / 4;
+    for (size_t i = from_block; i < nblocks; ++i) {
+        h1 = murmur_body(h1, load32(key.data() + 4 * i));
+    }
+    const uint8_t* tail = (const uint8_t*)key.data() + nblocks * 4;
+    uint32_t k1 = 0;
+    switch (key.size() & 3) {
+    case 3: k1 ^= (uint32_t)tail[2] << 16; // fall through
+    case 2: k1 ^= (uint32_t)tail[1] << 8;  // fall through
+    case 1: k1 ^= tail[0];
+        k1 *= MURMUR_C1;
+        k1 = rotl32(k1, 15);
+        k1 *= MURMUR_C2;
+        h1 ^= k1;
+    }
+    // fmix32
+    h1 ^= (uint32_t)key.size();
+    h1 ^= h1 >> 16;
+    h1 *= 0x85ebca6b;
+    h1 ^= h1 >> 13;
+    h1 *= 0xc2b2ae35;
+    h1 ^= h1 >> 16;
+    return h1;
+}
+
+void MurmurHash3_x86_32_x4(const StringPiece keys[4], uint32_t seed,
+                           uint32_t out[4]) {
+#if defined(__SSE4_1__) || defined(__ARM_NEON)
+    // Number of 4-byte blocks every lane has, processed vectorized.
+    size_t common_blocks = keys[0].size() / 4;
+    for (int i = 1; i < 4; ++i) {
+        const size_t nblocks = keys[i].size() / 4;
+        if (nblocks < common_blocks) {
+            common_blocks = nblocks;
+        }
+    }
+#if defined(__SSE4_1__)
+    __m128i h = _mm_set1_epi32((int)seed);
+    const __m128i c1 = _mm_set1_epi32((int)MURMUR_C1);
+    const __m128i c2 = _mm_set1_epi32((int)MURMUR_C2);
+    for (size_t j = 0; j < common_blocks; ++j) {
+        // Lanes read from different addresses, gather them scalar.
+        __m128i k = _mm_set_epi32((int)load32(keys[3].data() + 4 * j),
+                                  (int)load32(keys[2].data() + 4 * j),
+                                  (int)load32(keys[1].data() + 4 * j),
+                                  (int)load32(keys[0].data() + 4 * j));
+        k = _mm_mullo_epi32(k, c1);
+        k = _mm_or_si128(_mm_slli_epi32(k, 15), _mm_srli_epi32(k, 17));
+        k = _mm_mullo_epi32(k, c2);
+        __m128i t = _mm_xor_si128(h, k);
+        t = _mm_or_si128(_mm_slli_epi32(t, 13), _mm_srli_epi32(t, 19));
+        h = _mm_add_epi32(_mm_mullo_epi32(t, _mm_set1_epi32(5)),
+                          _mm_set1_epi32((int)0xe6546b64));
+    }
+    uint32_t lanes[4];
+    _mm_storeu_si128((__m128i*)lanes, h);
+#else  // __ARM_NEON
+    uint32x4_t h = vdupq_n_u32(seed);
+    const uint32x4_t c1 = vdupq_n_u32(MURMUR_C1);
+    const uint32x4_t c2 = vdupq_n_u32(MURMUR_C2);
+    for (size_t j = 0; j < common_blocks; ++j) {
+        uint32_t gathered[4];
+        for (int i = 0; i < 4; ++i) {
+            gathered[i] = load32(keys[i].data() + 4 * j);
+        }
+        uint32x4_t k = vld1q_u32(gathered);
+        k = vmulq_u32(k, c1);
+        k = vorrq_u32(vshlq_n_u32(k, 15), vshrq_n_u32(k, 17));
+        k = vmulq_u32(k, c2);
+        uint32x4_t t = veorq_u32(h, k);
+        t = vorrq_u32(vshlq_n_u32(t, 13), vshrq_n_u32(t, 19));
+        h = vaddq_u32(vmulq_u32(t, vdupq_n_u32(5)),
+                      vdupq_n_u32(0xe6546b64));
+    }
+    uint32_t lanes[4];
+    vst1q_u32(lanes, h);
+#endif
+    for (int i = 0; i < 4; ++i) {
+        out[i] = murmur_finish_lane(lanes[i], keys[i], common_blocks);
+    }
+#else
+    for (int i = 0; i < 4; ++i) {
+        MurmurHash3_x86_32(keys[i].data(), (int)keys[i].size(), seed,
+                           &out[i]);
+    }
+#endif
+}
+
+} // namespace simd
+} // namespace butil
@@ -0,0 +1,44 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef BUTIL_SIMD_HASH_H
+#define BUTIL_SIMD_HASH_H
+
+#include <stdint.h>
+#include "butil/strings/string_piece.h"
+
+// Multi-lane hashing kernels for call sites hashing many short keys in
+// a row, such as building the virtual-node ring of consistent hashing
+// load balancers. SSE4.1 and NEON run the hash state of 4 independent
+// keys in the lanes of one vector register; elsewhere a scalar loop
+// gives the same results. Each batched function is bit-compatible with
+// its single-key counterpart.
+
+namespace butil {
+namespace simd {
+
+// Hashes the 4 keys exactly as 4 calls of MurmurHash3_x86_32(key, len,
+// seed, &out[i]) would. Keys may have different lengths; the vectorized
+// part covers their common prefix of 4-byte blocks and each lane is
+// finished separately.
+void MurmurHash3_x86_32_x4(const StringPiece keys[4], uint32_t seed,
+                           uint32_t out[4]);
+
+} // namespace simd
+} // namespace butil
+
+#endif  // BUTIL_SIMD_HASH_H
@@ -0,0 +1,163 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <string.h>
+#include "butil/simd_search.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace butil {
+namespace simd {
+
+#if defined(__ARM_NEON)
+// Narrow the 16 lane-wise 0x00/0xFF compare results into a 64-bit mask
+// with 4 bits per lane (there's no movemask on NEON, the narrowing shift
+// is the cheapest equivalent). Lane i matched iff bits [4i, 4i+4) are set.
+static inline uint64_t neon_mask(uint8x16_t eq) {
+    const uint8x8_t narrowed = vshrn_n_u16(vreinterpretq_u16_u8(eq), 4);
+    return vget_lane_u64(vreinterpret_u64_u8(narrowed), 0);
+}
+#endif
+
+const char* memchr2(const char* s, size_t n, char c1, char c2) {
+    if (n < 2) {
+        return NULL;
+    }
+#if defined(__SSE2__)
+    const __m128i v1 = _mm_set1_epi8(c1);
+    const __m128i v2 = _mm_set1_epi8(c2);
+    size_t i = 0;
+    // Load 16 bytes at i and at i+1: lane j covers the pair (i+j, i+j+1).
+    for (; i + 17 <= n; i += 16) {
+        const __m128i a = _mm_loadu_si128((const __m128i*)(s + i));
+        const __m128i b = _mm_loadu_si128((const __m128i*)(s + i + 1));
+        const int mask = _mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(a, v1), _mm_cmpeq_epi8(b, v2)));
+        if (mask != 0) {
+            return s + i + __builtin_ctz(mask);
+        }
+    }
+    for (; i + 2 <= n; ++i) {
+        if (s[i] == c1 && s[i + 1] == c2) {
+            return s + i;
+        }
+    }
+    return NULL;
+#elif defined(__ARM_NEON)
+    const uint8x16_t v1 = vdupq_n_u8((uint8_t)c1);
+    const uint8x16_t v2 = vdupq_n_u8((uint8_t)c2);
+    size_t i = 0;
+    for (; i + 17 <= n; i += 16) {
+        const uint8x16_t a = vld1q_u8((const uint8_t*)(s + i));
+        const uint8x16_t b = vld1q_u8((const uint8_t*)(s + i + 1));
+        const uint64_t mask = neon_mask(vandq_u8(vceqq_u8(a, v1),
+                                                 vceqq_u8(b, v2)));
+        if (mask != 0) {
+            return s + i + (__builtin_ctzll(mask) >> 2);
+        }
+    }
+    for (; i + 2 <= n; ++i) {
+        if (s[i] == c1 && s[i + 1] == c2) {
+            return s + i;
+        }
+    }
+    return NULL;
+#else
+    // libc memchr is vectorized on mainstream platforms, hop between
+    // occurrences of c1.
+    const char* p = s;
+    const char* const last = s + n - 1;  // c1 must be followed by a byte
+    while (p < last &&
+           (p = (const char*)::memchr(p, c1, last - p)) != NULL) {
+        if (p[1] == c2) {
+            return p;
+        }
+        ++p;
+    }
+    return NULL;
+#endif
+}
+
+const void* memmem(const void* haystack, size_t haystack_len,
+                   const void* needle, size_t needle_len) {
+    const char* const h = (const char*)haystack;
+    const char* const nd = (const char*)needle;
+    if (needle_len == 0) {
+        return haystack;
+    }
+    if (haystack_len < needle_len) {
+        return NULL;
+    }
+    if (needle_len == 1) {
+        return ::memchr(haystack, nd[0], haystack_len);
+    }
+    const char first = nd[0];
+    const char last = nd[needle_len - 1];
+    // Number of valid starting positions.
+    const size_t scan = haystack_len - needle_len + 1;
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128i vfirst = _mm_set1_epi8(first);
+    const __m128i vlast = _mm_set1_epi8(last);
+    for (; i + 16 <= scan; i += 16) {
+        const __m128i a = _mm_loadu_si128((const __m128i*)(h + i));
+        const __m128i b =
+            _mm_loadu_si128((const __m128i*)(h + i + needle_len - 1));
+        int mask = _mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(a, vfirst),
+                          _mm_cmpeq_epi8(b, vlast)));
+        while (mask != 0) {
+            const int j = __builtin_ctz(mask);
+            if (memcmp(h + i + j + 1, nd + 1, needle_len - 2) == 0) {
+                return h + i + j;
+            }
+            mask &= mask - 1;
+        }
+    }
+#elif defined(__ARM_NEON)
+    const uint8x16_t vfirst = vdupq_n_u8((uint8_t)first);
+    const uint8x16_t vlast = vdupq_n_u8((uint8_t)last);
+    for (; i + 16 <= scan; i += 16) {
+        const uint8x16_t a = vld1q_u8((const uint8_t*)(h + i));
+        const uint8x16_t b =
+            vld1q_u8((const uint8_t*)(h + i + needle_len - 1));
+        uint64_t mask = neon_mask(vandq_u8(vceqq_u8(a, vfirst),
+                                           vceqq_u8(b, vlast)));
+        while (mask != 0) {
+            const int j = __builtin_ctzll(mask) >> 2;
+            if (memcmp(h + i + j + 1, nd + 1, needle_len - 2) == 0) {
+                return h + i + j;
+            }
+            mask &= ~(0xFULL << (j * 4));
+        }
+    }
+#endif
+    for (; i < scan; ++i) {
+        if (h[i] == first && h[i + needle_len - 1] == last &&
+            memcmp(h + i + 1, nd + 1, needle_len - 2) == 0) {
+            return h + i;
+        }
+    }
+    return NULL;
+}
+
+} // namespace simd
+} // namespace butil
@@ -0,0 +1,51 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef BUTIL_SIMD_SEARCH_H
+#define BUTIL_SIMD_SEARCH_H
+
+#include <stddef.h>
+
+// Vectorized byte-scanning kernels shared by protocol parsers, replacing
+// the hand-rolled per-byte loops that used to be duplicated in them.
+// SSE2 and NEON are used when available, with a scalar fallback built on
+// libc memchr elsewhere. All functions scan raw memory; callers walk
+// IOBuf fragments themselves (see IOBuf::_cut_by_delim for an example of
+// handling patterns that straddle fragment boundaries).
+
+namespace butil {
+namespace simd {
+
+// Returns the position of the first occurrence of the adjacent bytes
+// `c1 c2' in [s, s+n), NULL when there is none. The typical use is
+// finding CRLF in line-based protocols.
+const char* memchr2(const char* s, size_t n, char c1, char c2);
+
+// Returns the position of the first occurrence of
+// [needle, needle+needle_len) in [haystack, haystack+haystack_len),
+// NULL when there is none. Candidates are located by comparing the first
+// and the last byte of the needle over 16 positions at once, only they
+// are verified with memcmp, which filters nearly all positions for
+// needles with any variety (multipart boundaries, delimiters etc.).
+// An empty needle matches at `haystack'.
+const void* memmem(const void* haystack, size_t haystack_len,
+                   const void* needle, size_t needle_len);
+
+} // namespace simd
+} // namespace butil
+
+#endif  // BUTIL_SIMD_SEARCH_H
@@ -293,6 +293,17 @@
     If any of these symbols is defined, RapidJSON defines the macro
     \c RAPIDJSON_SIMD to indicate the availability of the optimized code.
 */
+// Pick up the SIMD extensions enabled in the compilation flags so that
+// all translation units parse with the same(fastest available) code.
+#if !defined(RAPIDJSON_SSE42) && !defined(RAPIDJSON_SSE2) \
+    && !defined(RAPIDJSON_NO_SIMD)
+#if defined(__SSE4_2__)
+#define RAPIDJSON_SSE42
+#elif defined(__SSE2__)
+#define RAPIDJSON_SSE2
+#endif
+#endif
+
 #if defined(RAPIDJSON_SSE2) || defined(RAPIDJSON_SSE42) \
     || defined(RAPIDJSON_DOXYGEN_RUNNING)
 #define RAPIDJSON_SIMD
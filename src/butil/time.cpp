@@ -81,6 +81,28 @@ int64_t monotonic_time_ns() {
     return now.tv_sec * 1000000000L + now.tv_nsec;
 }
 
+int64_t coarse_monotonic_time_ns() {
+#if defined(CLOCK_MONOTONIC_COARSE)
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    return now.tv_sec * 1000000000L + now.tv_nsec;
+#else
+    return monotonic_time_ns();
+#endif
+}
+
+int64_t coarse_gettimeofday_us() {
+#if defined(CLOCK_REALTIME_COARSE)
+    timespec now;
+    clock_gettime(CLOCK_REALTIME_COARSE, &now);
+    return now.tv_sec * 1000000L + now.tv_nsec / 1000L;
+#else
+    timeval now;
+    gettimeofday(&now, NULL);
+    return now.tv_sec * 1000000L + now.tv_usec;
+#endif
+}
+
 namespace detail {
 
 // read_cpu_frequency() is modified from source code of glibc.
@@ -213,6 +213,30 @@ inline int64_t monotonic_time_s() {
     return monotonic_time_ns() / 1000000000L;
 }
 
+// ---------------------------------------------------------------
+// Coarse variants of the clocks above: values are maintained by the
+// kernel at tick granularity (1~4ms) and reading them costs a fraction
+// of the precise clocks without ever entering a real syscall. Use them
+// for timestamps that feed statistics or idle-time bookkeeping, NOT
+// for timeout math or anything billed by the microsecond.
+// Falls back to the precise clocks where coarse clocks are unavailable.
+// ---------------------------------------------------------------
+extern int64_t coarse_monotonic_time_ns();
+
+inline int64_t coarse_monotonic_time_us() {
+    return coarse_monotonic_time_ns() / 1000L;
+}
+
+inline int64_t coarse_monotonic_time_ms() {
+    return coarse_monotonic_time_ns() / 1000000L;
+}
+
+extern int64_t coarse_gettimeofday_us();
+
+inline int64_t coarse_gettimeofday_ms() {
+    return coarse_gettimeofday_us() / 1000L;
+}
+
 namespace detail {
 inline uint64_t clock_cycles() {
     unsigned int lo = 0;
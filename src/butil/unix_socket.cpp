@@ -20,6 +20,8 @@
 #include <sys/types.h>                          // socket
 #include <sys/socket.h>                         // ^
 #include <sys/un.h>                             // unix domain socket
+#include <string.h>                             // memcpy
+#include <unistd.h>                             // close
 #include "butil/fd_guard.h"                     // fd_guard
 #include "butil/logging.h"
 
@@ -72,4 +74,80 @@ int unix_socket_connect(const char* sockname) {
     return fd.release();
 }
 
+static const size_t MAX_PASSED_FDS = 16;
+
+int unix_socket_send_fds(int sockfd, const int* fds, size_t nfd) {
+    if (nfd == 0 || nfd > MAX_PASSED_FDS) {
+        errno = EINVAL;
+        return -1;
+    }
+    // One payload byte carrying the fd count, recvmsg of zero bytes would
+    // not block until the control message arrives.
+    char count = (char)nfd;
+    struct iovec iov = { &count, 1 };
+    char ctrl[CMSG_SPACE(sizeof(int) * MAX_PASSED_FDS)];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * nfd);
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * nfd);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * nfd);
+    ssize_t nw = -1;
+    do {
+        nw = sendmsg(sockfd, &msg, 0);
+    } while (nw < 0 && errno == EINTR);
+    if (nw != 1) {
+        PLOG(ERROR) << "Fail to send " << nfd << " fds via sockfd=" << sockfd;
+        return -1;
+    }
+    return 0;
+}
+
+int unix_socket_recv_fds(int sockfd, int* fds, size_t max_nfd) {
+    char count = 0;
+    struct iovec iov = { &count, 1 };
+    char ctrl[CMSG_SPACE(sizeof(int) * MAX_PASSED_FDS)];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl;
+    msg.msg_controllen = sizeof(ctrl);
+    ssize_t nr = -1;
+    do {
+        nr = recvmsg(sockfd, &msg, 0);
+    } while (nr < 0 && errno == EINTR);
+    if (nr != 1) {
+        PLOG_IF(ERROR, nr < 0) << "Fail to recvmsg from sockfd=" << sockfd;
+        return -1;
+    }
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET ||
+        cmsg->cmsg_type != SCM_RIGHTS) {
+        LOG(ERROR) << "No SCM_RIGHTS in the message from sockfd=" << sockfd;
+        errno = EINVAL;
+        return -1;
+    }
+    const size_t nfd = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    int received[MAX_PASSED_FDS];
+    memcpy(received, CMSG_DATA(cmsg), sizeof(int) * nfd);
+    if (nfd != (size_t)count || nfd > max_nfd) {
+        LOG(ERROR) << "Unexpected number of fds=" << nfd << " (declared="
+                   << (int)count << " max=" << max_nfd << ") from sockfd="
+                   << sockfd;
+        for (size_t i = 0; i < nfd; ++i) {
+            close(received[i]);
+        }
+        errno = EMSGSIZE;
+        return -1;
+    }
+    memcpy(fds, received, sizeof(int) * nfd);
+    return (int)nfd;
+}
+
 }  // namespace butil
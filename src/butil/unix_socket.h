@@ -36,6 +36,19 @@ int unix_socket_listen(const char* sockname);
 // Returns the file descriptor on success, -1 otherwise and errno is set.
 int unix_socket_connect(const char* sockname);
 
+// Send `nfd' open file descriptors in `fds' over the connected unix domain
+// socket `sockfd' (SCM_RIGHTS). The receiving process gets its own
+// descriptors referring to the same open files. At most 16 fds per call.
+// Returns 0 on success, -1 otherwise and errno is set.
+int unix_socket_send_fds(int sockfd, const int* fds, size_t nfd);
+
+// Counterpart of unix_socket_send_fds: receive at most `max_nfd' file
+// descriptors into `fds' from the connected unix domain socket `sockfd'.
+// Returns number of fds received on success, -1 otherwise and errno is set.
+// If the peer sent more than `max_nfd' fds, all received fds are closed
+// and -1 is returned.
+int unix_socket_recv_fds(int sockfd, int* fds, size_t max_nfd);
+
 }  // namespace butil
 
 #endif  // BUTIL_UNIX_SOCKET_H
@@ -148,6 +148,14 @@ public:
         }
     }
 
+    // [Unique] Fast path for addition which commutes with the exchange()
+    // issued by resets: the final sum is the same no matter how the two
+    // interleave, thus the CAS loop in modify() is unnecessary and one
+    // relaxed atomic add suffices. Only instantiable for integral T.
+    inline void add(T value2) {
+        _value.fetch_add(value2, butil::memory_order_relaxed);
+    }
+
 private:
     butil::atomic<T> _value;
 };
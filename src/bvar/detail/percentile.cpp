@@ -85,6 +85,41 @@ private:
     int64_t _latency;
 };
 
+// Same merging logic as AddLatency, amortizing the lock acquisition of
+// the thread-local samples over a whole array of latencies. The global
+// lock is still only taken when an interval fills up.
+class AddLatencyBatch {
+public:
+    AddLatencyBatch(const int64_t* latencies, size_t n)
+        : _latencies(latencies), _n(n) {}
+
+    void operator()(GlobalValue<Percentile::combiner_type>& global_value,
+                    ThreadLocalPercentileSamples& local_value) const {
+        for (size_t i = 0; i < _n; ++i) {
+            int64_t latency = _latencies[i];
+            if (latency < 0) {  // drop, already warned in add_batch().
+                continue;
+            }
+            const size_t index = get_interval_index(latency);
+            PercentileInterval<ThreadLocalPercentileSamples::SAMPLE_SIZE>&
+                interval = local_value.get_interval_at(index);
+            if (interval.full()) {
+                GlobalPercentileSamples* g = global_value.lock();
+                g->get_interval_at(index).merge(interval);
+                g->_num_added += interval.added_count();
+                global_value.unlock();
+                local_value._num_added -= interval.added_count();
+                interval.clear();
+            }
+            interval.add64(latency);
+            ++local_value._num_added;
+        }
+    }
+private:
+    const int64_t* _latencies;
+    size_t _n;
+};
+
 Percentile::Percentile() : _combiner(NULL), _sampler(NULL) {
     _combiner = new combiner_type;
 }
@@ -130,5 +165,31 @@ Percentile &Percentile::operator<<(int64_t latency) {
     return *this;
 }
 
+Percentile& Percentile::add_batch(const int64_t* latencies, size_t n) {
+    if (n == 0) {
+        return *this;
+    }
+    agent_type* agent = _combiner->get_or_create_tls_agent();
+    if (BAIDU_UNLIKELY(!agent)) {
+        LOG(FATAL) << "Fail to create agent";
+        return *this;
+    }
+    size_t num_negative = 0;
+    for (size_t i = 0; i < n; ++i) {
+        num_negative += (latencies[i] < 0);
+    }
+    if (BAIDU_UNLIKELY(num_negative != 0)) {
+        if (!_debug_name.empty()) {
+            LOG(WARNING) << num_negative << " inputs to `" << _debug_name
+                         << "' are negative, drop";
+        } else {
+            LOG(WARNING) << num_negative << " inputs to Percentile("
+                         << (void*)this << ") are negative, drop";
+        }
+    }
+    agent->merge_global(AddLatencyBatch(latencies, n));
+    return *this;
+}
+
 }  // namespace detail
 }  // namespace bvar
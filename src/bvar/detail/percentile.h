@@ -234,12 +234,14 @@ static const size_t NUM_INTERVALS = 32;
 
 // This declartion is a must for gcc 3.4
 class AddLatency;
+class AddLatencyBatch;
 
 // Group of PercentileIntervals.
 template <size_t SAMPLE_SIZE_IN>
 class PercentileSamples {
 public:
 friend class AddLatency;
+friend class AddLatencyBatch;
 
     static const size_t SAMPLE_SIZE = SAMPLE_SIZE_IN;
     
@@ -484,6 +486,12 @@ public:
     
     Percentile& operator<<(int64_t latency);
 
+    // Add `n' latencies in one shot, equivalent to streaming each element
+    // through operator<< but with a single agent lookup and a single lock
+    // round-trip on the thread-local samples. Negative latencies are
+    // dropped like in operator<<.
+    Percentile& add_batch(const int64_t* latencies, size_t n);
+
     bool valid() const { return _combiner != NULL && _combiner->valid(); }
     
     // This name is useful for warning negative latencies in operator<<
@@ -499,6 +507,48 @@ private:
     std::string _debug_name;
 };
 
+// Stages samples of one thread in a plain array and feeds them to the
+// Percentile with one add_batch() when the array is full, making the
+// common record a bare array append instead of a lock round-trip on the
+// thread-local samples.
+// Rules:
+//  - Construct and use a stage inside one thread only, and don't let it
+//    outlive the Percentile.
+//  - Staged samples are invisible to get_value()/reset() until flushed.
+//    Call flush() when the stream of samples may pause for long,
+//    otherwise tails of a burst may miss the window they belong to. The
+//    destructor flushes remaining samples.
+class PercentileStage {
+public:
+    static const size_t STAGE_SIZE = 64;
+
+    explicit PercentileStage(Percentile& p) : _percentile(p), _n(0) {}
+    ~PercentileStage() { flush(); }
+
+    PercentileStage& operator<<(int64_t latency) {
+        _staged[_n++] = latency;
+        if (_n == STAGE_SIZE) {
+            flush();
+        }
+        return *this;
+    }
+
+    // Push staged samples into the Percentile.
+    void flush() {
+        if (_n != 0) {
+            _percentile.add_batch(_staged, _n);
+            _n = 0;
+        }
+    }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(PercentileStage);
+
+    Percentile& _percentile;
+    size_t _n;
+    int64_t _staged[STAGE_SIZE];
+};
+
 }  // namespace detail
 }  // namespace bvar
 
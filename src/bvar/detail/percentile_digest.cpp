@@ -0,0 +1,161 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <math.h>                       // log exp ceil
+#include <limits>                       // std::numeric_limits
+#include "bvar/detail/percentile_digest.h"
+#include "butil/logging.h"
+
+namespace bvar {
+namespace detail {
+
+// log((1 + 0.01) / (1 - 0.01)), the logarithm of the bucket base gamma
+// yielding 1% relative error. Spelt as a literal to keep initialization
+// static, log() in an initializer would be dynamic.
+static const double LOG_GAMMA = 0.0200006667066695;
+static const double INV_LOG_GAMMA = 1.0 / LOG_GAMMA;
+
+size_t DigestSamples::bucket_index(int64_t x) {
+    if (x <= 1) {
+        // Bucket 0 covers [1, gamma), report 0 and 1 as ~1.
+        return 0;
+    }
+    if (x > std::numeric_limits<uint32_t>::max()) {
+        // Same clamping as Percentile: the overflowed value included in
+        // the last bucket does not affect the overall distribution much.
+        x = std::numeric_limits<uint32_t>::max();
+    }
+    const size_t index = (size_t)(::log((double)x) * INV_LOG_GAMMA);
+    return index < NUM_BUCKETS ? index : NUM_BUCKETS - 1;
+}
+
+int64_t DigestSamples::bucket_value(size_t index) {
+    // Geometric middle of [gamma^index, gamma^(index+1)).
+    return (int64_t)::llround(::exp((index + 0.5) * LOG_GAMMA));
+}
+
+void DigestSamples::merge(const DigestSamples& rhs) {
+    if (rhs._num_added == 0) {
+        return;
+    }
+    _num_added += rhs._num_added;
+    for (size_t i = 0; i < NUM_BUCKETS; ++i) {
+        _counts[i] += rhs._counts[i];
+    }
+}
+
+void DigestSamples::merge(const ThreadLocalDigestSamples& rhs) {
+    const uint32_t n = rhs.buffered_count();
+    for (uint32_t i = 0; i < n; ++i) {
+        ++_counts[rhs.bucket_at(i)];
+    }
+    _num_added += n;
+}
+
+int64_t DigestSamples::get_number(double ratio) const {
+    uint64_t n = (uint64_t)ceil(ratio * _num_added);
+    if (n > _num_added) {
+        n = _num_added;
+    } else if (n == 0) {
+        return 0;
+    }
+    uint64_t cumulated = 0;
+    for (size_t i = 0; i < NUM_BUCKETS; ++i) {
+        cumulated += _counts[i];
+        if (cumulated >= n) {
+            return bucket_value(i);
+        }
+    }
+    CHECK(false) << "Can't reach here";
+    return std::numeric_limits<uint32_t>::max();
+}
+
+void DigestSamples::describe(std::ostream& os) const {
+    os << this << "{num_added=" << _num_added;
+    for (size_t i = 0; i < NUM_BUCKETS; ++i) {
+        if (_counts[i]) {
+            os << ' ' << bucket_value(i) << '*' << _counts[i];
+        }
+    }
+    os << '}';
+}
+
+// Stage the bucket index into the thread-local buffer, flushing the
+// buffer into the global digest when it's full, similarly to AddLatency
+// in percentile.cpp.
+class AddDigestLatency {
+public:
+    AddDigestLatency(int64_t latency) : _latency(latency) {}
+
+    void operator()(GlobalValue<PercentileDigest::combiner_type>& global_value,
+                    ThreadLocalDigestSamples& local_value) const {
+        if (local_value.full()) {
+            DigestSamples* g = global_value.lock();
+            g->merge(local_value);
+            global_value.unlock();
+            local_value.clear();
+        }
+        local_value.add((uint16_t)DigestSamples::bucket_index(_latency));
+    }
+private:
+    int64_t _latency;
+};
+
+PercentileDigest::PercentileDigest() : _combiner(NULL), _sampler(NULL) {
+    _combiner = new combiner_type;
+}
+
+PercentileDigest::~PercentileDigest() {
+    // Have to destroy sampler first to avoid the race between destruction and
+    // sampler
+    if (_sampler != NULL) {
+        _sampler->destroy();
+        _sampler = NULL;
+    }
+    delete _combiner;
+}
+
+PercentileDigest::value_type PercentileDigest::reset() {
+    return _combiner->reset_all_agents();
+}
+
+PercentileDigest::value_type PercentileDigest::get_value() const {
+    return _combiner->combine_agents();
+}
+
+PercentileDigest& PercentileDigest::operator<<(int64_t latency) {
+    agent_type* agent = _combiner->get_or_create_tls_agent();
+    if (BAIDU_UNLIKELY(!agent)) {
+        LOG(FATAL) << "Fail to create agent";
+        return *this;
+    }
+    if (latency < 0) {
+        if (!_debug_name.empty()) {
+            LOG(WARNING) << "Input=" << latency << " to `" << _debug_name
+                       << "' is negative, drop";
+        } else {
+            LOG(WARNING) << "Input=" << latency << " to PercentileDigest("
+                       << (void*)this << ") is negative, drop";
+        }
+        return *this;
+    }
+    agent->merge_global(AddDigestLatency(latency));
+    return *this;
+}
+
+}  // namespace detail
+}  // namespace bvar
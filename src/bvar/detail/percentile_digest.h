@@ -0,0 +1,177 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef  BVAR_DETAIL_PERCENTILE_DIGEST_H
+#define  BVAR_DETAIL_PERCENTILE_DIGEST_H
+
+#include <string.h>                     // memset
+#include <stdint.h>                     // uint32_t
+#include <ostream>                      // std::ostream
+#include "butil/macros.h"                // DISALLOW_COPY_AND_ASSIGN
+#include "bvar/reducer.h"               // VoidOp
+#include "bvar/detail/combiner.h"       // AgentCombiner
+#include "bvar/detail/sampler.h"        // ReducerSampler
+
+namespace bvar {
+namespace detail {
+
+class ThreadLocalDigestSamples;
+
+// DDSketch-like digest of latencies: one counter per logarithmically
+// spaced bucket so that any quantile is off by at most ~1% of its true
+// value, no matter how many samples were added or how skewed the tail
+// is. Unlike PercentileSamples which randomly drops samples when
+// intervals overflow, merging digests just adds counters and loses
+// nothing, making p99.9/p99.99 over merged windows as accurate as over
+// a single one.
+class DigestSamples {
+public:
+    // Buckets cover [1, UINT32_MAX] with a relative width of ~2%
+    // (gamma = 1.01/0.99), each sample is reported as the geometric
+    // middle of its bucket, at most ~1% away from the true value.
+    static const size_t NUM_BUCKETS = 1110;
+
+    DigestSamples() { clear(); }
+
+    void clear() {
+        _num_added = 0;
+        memset(_counts, 0, sizeof(_counts));
+    }
+
+    // Add counters of another digest, losslessly.
+    void merge(const DigestSamples& rhs);
+
+    // Add bucket indexes staged in a thread-local buffer.
+    void merge(const ThreadLocalDigestSamples& rhs);
+
+    // Get the `ratio'-ile value. E.g. 0.99 means 99%-ile value.
+    int64_t get_number(double ratio) const;
+
+    // #samples ever added.
+    uint64_t added_count() const { return _num_added; }
+
+    // Index of the bucket that `x' falls into. Negative inputs must be
+    // filtered out by the caller, values over UINT32_MAX are clamped
+    // like in Percentile.
+    static size_t bucket_index(int64_t x);
+
+    // The value that bucket `index' stands for.
+    static int64_t bucket_value(size_t index);
+
+    // For debuggin.
+    void describe(std::ostream& os) const;
+
+private:
+    uint64_t _num_added;
+    uint32_t _counts[NUM_BUCKETS];
+};
+
+inline std::ostream& operator<<(std::ostream& os, const DigestSamples& s) {
+    s.describe(os);
+    return os;
+}
+
+// Bucket indexes staged in each thread, flushed into the global digest
+// when full so that the hot path only appends to a small local array.
+class ThreadLocalDigestSamples {
+public:
+    static const size_t BUFFER_SIZE = 128;
+
+    ThreadLocalDigestSamples() : _num_buffered(0) {}
+
+    bool full() const { return _num_buffered == BUFFER_SIZE; }
+
+    void clear() { _num_buffered = 0; }
+
+    void add(uint16_t bucket_index) { _buffer[_num_buffered++] = bucket_index; }
+
+    uint32_t buffered_count() const { return _num_buffered; }
+
+    uint16_t bucket_at(size_t index) const { return _buffer[index]; }
+
+private:
+    BAIDU_CASSERT(DigestSamples::NUM_BUCKETS <= 65536,
+                  bucket_index_must_be_16bit);
+
+    uint32_t _num_buffered;
+    uint16_t _buffer[BUFFER_SIZE];
+};
+
+// A drop-in alternative to Percentile backed by DigestSamples, with the
+// same reducer interface so that Window<> works on it unchanged.
+// NOTE: DON'T use it directly, select PERCENTILE_DIGEST on a
+// LatencyRecorder instead.
+class PercentileDigest {
+public:
+    struct AddDigestSamples {
+        void operator()(DigestSamples& b1, const DigestSamples& b2) const {
+            b1.merge(b2);
+        }
+        void operator()(DigestSamples& b1,
+                        const ThreadLocalDigestSamples& b2) const {
+            b1.merge(b2);
+        }
+    };
+
+    typedef DigestSamples                                   value_type;
+    typedef ReducerSampler<PercentileDigest,
+                           DigestSamples,
+                           AddDigestSamples, VoidOp>        sampler_type;
+    typedef AgentCombiner <DigestSamples,
+                           ThreadLocalDigestSamples,
+                           AddDigestSamples>                combiner_type;
+    typedef combiner_type::Agent                            agent_type;
+    PercentileDigest();
+    ~PercentileDigest();
+
+    AddDigestSamples op() const { return AddDigestSamples(); }
+    VoidOp inv_op() const { return VoidOp(); }
+
+    // The sampler for windows over the digest.
+    sampler_type* get_sampler() {
+        if (NULL == _sampler) {
+            _sampler = new sampler_type(this);
+            _sampler->schedule();
+        }
+        return _sampler;
+    }
+
+    value_type reset();
+
+    value_type get_value() const;
+
+    PercentileDigest& operator<<(int64_t latency);
+
+    bool valid() const { return _combiner != NULL && _combiner->valid(); }
+
+    // This name is useful for warning negative latencies in operator<<
+    void set_debug_name(const butil::StringPiece& name) {
+        _debug_name.assign(name.data(), name.size());
+    }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(PercentileDigest);
+
+    combiner_type*          _combiner;
+    sampler_type*           _sampler;
+    std::string _debug_name;
+};
+
+}  // namespace detail
+}  // namespace bvar
+
+#endif  //BVAR_DETAIL_PERCENTILE_DIGEST_H
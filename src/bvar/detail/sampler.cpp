@@ -17,6 +17,9 @@
 
 // Date: Tue Jul 28 18:14:40 CST 2015
 
+#include <sched.h>                       // sched_getcpu
+#include <gflags/gflags.h>
+#include "butil/build_config.h"          // OS_LINUX
 #include "butil/time.h"
 #include "butil/memory/singleton_on_pthread_once.h"
 #include "bvar/reducer.h"
@@ -27,6 +30,12 @@
 namespace bvar {
 namespace detail {
 
+DEFINE_int32(bvar_sampler_threads, 1,
+             "Number of threads periodically walking registered samplers. "
+             "Raise this on servers with a very large number of Window<> "
+             "variables when bvar_sampler_collector_usage approaches 1. "
+             "Read once at start-up");
+
 const int WARN_NOSLEEP_THRESHOLD = 2;
 
 // Combine two circular linked list into one.
@@ -47,43 +56,31 @@ struct CombineSampler {
 // of child as well, no need to register in the child again.
 static bool registered_atfork = false;
 
-// Call take_sample() of all scheduled samplers.
-// This can be done with regular timer thread, but it's way too slow(global
-// contention + log(N) heap manipulations). We need it to be super fast so that
-// creation overhead of Window<> is negliable.
-// The trick is to use Reducer<Sampler*, CombineSampler>. Each Sampler is
-// doubly linked, thus we can reduce multiple Samplers into one cicurlarly
-// doubly linked list, and multiple lists into larger lists. We create a
-// dedicated thread to periodically get_value() which is just the combined
-// list of Samplers. Waking through the list and call take_sample().
+static size_t sanitized_sampler_threads() {
+    int32_t n = FLAGS_bvar_sampler_threads;
+    if (n < 1) {
+        n = 1;
+    } else if (n > 16) {
+        n = 16;
+    }
+    return n;
+}
+
+// One shard of the sampler registry, owning a fraction of the scheduled
+// samplers and a thread walking them. Each Sampler is doubly linked, thus we
+// can reduce multiple Samplers into one circularly doubly linked list, and
+// multiple lists into larger lists, making registration wait-free.
 // If a Sampler needs to be deleted, we just mark it as unused and the
 // deletion is taken place in the thread as well.
-class SamplerCollector : public bvar::Reducer<Sampler*, CombineSampler> {
+class SamplerCollectorShard : public bvar::Reducer<Sampler*, CombineSampler> {
 public:
-    SamplerCollector()
+    SamplerCollectorShard()
         : _created(false)
         , _stop(false)
         , _cumulated_time_us(0) {
-        create_sampling_thread();
     }
-    ~SamplerCollector() {
-        if (_created) {
-            _stop = true;
-            pthread_join(_tid, NULL);
-            _created = false;
-        }
-    }
-
-private:
-    // Support for fork:
-    // * The singleton can be null before forking, the child callback will not
-    //   be registered.
-    // * If the singleton is not null before forking, the child callback will
-    //   be registered and the sampling thread will be re-created.
-    // * A forked program can be forked again.
-
-    static void child_callback_atfork() {
-        butil::get_leaky_singleton<SamplerCollector>()->after_forked_as_child();
+    ~SamplerCollectorShard() {
+        stop_and_join();
     }
 
     void create_sampling_thread() {
@@ -92,29 +89,34 @@ private:
             LOG(FATAL) << "Fail to create sampling_thread, " << berror(rc);
         } else {
             _created = true;
-            if (!registered_atfork) {
-                registered_atfork = true;
-                pthread_atfork(NULL, NULL, child_callback_atfork);
-            }
         }
     }
 
-    void after_forked_as_child() {
+    void stop_and_join() {
+        if (_created) {
+            _stop = true;
+            pthread_join(_tid, NULL);
+            _created = false;
+        }
+    }
+
+    // The sampling thread died with the parent process, create a new one
+    // in the child without joining the old.
+    void recreate_sampling_thread_after_fork() {
         _created = false;
         create_sampling_thread();
     }
 
+    int64_t cumulated_time_us() const { return _cumulated_time_us; }
+
+private:
     void run();
 
     static void* sampling_thread(void* arg) {
-        static_cast<SamplerCollector*>(arg)->run();
+        static_cast<SamplerCollectorShard*>(arg)->run();
         return NULL;
     }
 
-    static double get_cumulated_time(void* arg) {
-        return static_cast<SamplerCollector*>(arg)->_cumulated_time_us / 1000.0 / 1000.0;
-    }
-
 private:
     bool _created;
     bool _stop;
@@ -122,27 +124,105 @@ private:
     pthread_t _tid;
 };
 
+// Call take_sample() of all scheduled samplers.
+// This can be done with regular timer thread, but it's way too slow(global
+// contention + log(N) heap manipulations). We need it to be super fast so that
+// creation overhead of Window<> is negliable.
+// Samplers are sharded over several SamplerCollectorShard by the CPU of the
+// registering thread so that a huge number of variables (e.g. per-method
+// per-client metrics) does not saturate a single walking thread.
+class SamplerCollector {
+public:
+    SamplerCollector() : _nshard(sanitized_sampler_threads()) {
+        _shards = new SamplerCollectorShard[_nshard];
+        for (size_t i = 0; i < _nshard; ++i) {
+            _shards[i].create_sampling_thread();
+        }
+        if (!registered_atfork) {
+            registered_atfork = true;
+            pthread_atfork(NULL, NULL, child_callback_atfork);
+        }
+    }
+    ~SamplerCollector() {
+        for (size_t i = 0; i < _nshard; ++i) {
+            _shards[i].stop_and_join();
+        }
+        delete [] _shards;
+    }
+
+    void schedule(Sampler* s) {
+        _shards[current_shard()] << s;
+    }
+
+    static double get_cumulated_time(void* arg) {
+        SamplerCollector* sc = static_cast<SamplerCollector*>(arg);
+        int64_t sum_us = 0;
+        for (size_t i = 0; i < sc->_nshard; ++i) {
+            sum_us += sc->_shards[i].cumulated_time_us();
+        }
+        return sum_us / 1000.0 / 1000.0;
+    }
+
+private:
+    // Support for fork:
+    // * The singleton can be null before forking, the child callback will not
+    //   be registered.
+    // * If the singleton is not null before forking, the child callback will
+    //   be registered and the sampling threads will be re-created.
+    // * A forked program can be forked again.
+
+    static void child_callback_atfork() {
+        butil::get_leaky_singleton<SamplerCollector>()->after_forked_as_child();
+    }
+
+    void after_forked_as_child() {
+        for (size_t i = 0; i < _nshard; ++i) {
+            _shards[i].recreate_sampling_thread_after_fork();
+        }
+    }
+
+    size_t current_shard() const {
+        if (_nshard == 1) {
+            return 0;
+        }
+#if defined(OS_LINUX)
+        const int cpu = sched_getcpu();
+        if (cpu >= 0) {
+            return (size_t)cpu % _nshard;
+        }
+#endif
+        // Skip always-zero bits of the aligned thread descriptor.
+        return ((size_t)pthread_self() >> 9) % _nshard;
+    }
+
+private:
+    size_t _nshard;
+    SamplerCollectorShard* _shards;
+};
+
 #ifndef UNIT_TEST
 static PassiveStatus<double>* s_cumulated_time_bvar = NULL;
 static bvar::PerSecond<bvar::PassiveStatus<double> >* s_sampling_thread_usage_bvar = NULL;
-#endif
+static pthread_once_t s_usage_bvar_once = PTHREAD_ONCE_INIT;
 
-void SamplerCollector::run() {
-#ifndef UNIT_TEST
+static void create_usage_bvars() {
     // NOTE:
-    // * Following vars can't be created on thread's stack since this thread
-    //   may be adandoned at any time after forking.
+    // * Following vars can't be created on a sampling thread's stack since
+    //   the thread may be adandoned at any time after forking.
     // * They can't created inside the constructor of SamplerCollector as well,
     //   which results in deadlock.
-    if (s_cumulated_time_bvar == NULL) {
-        s_cumulated_time_bvar =
-            new PassiveStatus<double>(get_cumulated_time, this);
-    }
-    if (s_sampling_thread_usage_bvar == NULL) {
-        s_sampling_thread_usage_bvar =
-            new bvar::PerSecond<bvar::PassiveStatus<double> >(
-                    "bvar_sampler_collector_usage", s_cumulated_time_bvar, 10);
-    }
+    s_cumulated_time_bvar = new PassiveStatus<double>(
+            SamplerCollector::get_cumulated_time,
+            butil::get_leaky_singleton<SamplerCollector>());
+    s_sampling_thread_usage_bvar =
+        new bvar::PerSecond<bvar::PassiveStatus<double> >(
+                "bvar_sampler_collector_usage", s_cumulated_time_bvar, 10);
+}
+#endif
+
+void SamplerCollectorShard::run() {
+#ifndef UNIT_TEST
+    pthread_once(&s_usage_bvar_once, create_usage_bvars);
 #endif
 
     butil::LinkNode<Sampler> root;
@@ -183,7 +263,7 @@ void SamplerCollector::run() {
         }
         if (slept) {
             consecutive_nosleep = 0;
-        } else {            
+        } else {
             if (++consecutive_nosleep >= WARN_NOSLEEP_THRESHOLD) {
                 consecutive_nosleep = 0;
                 LOG(WARNING) << "bvar is busy at sampling for "
@@ -198,7 +278,7 @@ Sampler::Sampler() : _used(true) {}
 Sampler::~Sampler() {}
 
 void Sampler::schedule() {
-    *butil::get_leaky_singleton<SamplerCollector>() << this;
+    butil::get_leaky_singleton<SamplerCollector>()->schedule(this);
 }
 
 void Sampler::destroy() {
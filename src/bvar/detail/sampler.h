@@ -61,7 +61,7 @@ public:
 protected:
     virtual ~Sampler();
     
-friend class SamplerCollector;
+friend class SamplerCollectorShard;
     bool _used;
     // Sync destroy() and take_sample().
     butil::Mutex _mutex;
@@ -43,40 +43,64 @@ namespace detail {
 
 typedef PercentileSamples<1022> CombinedPercentileSamples;
 
-CDF::CDF(PercentileWindow* w) : _w(w) {}
+// Caller is responsible for deleting the return value.
+static DigestSamples* combine_digest(PercentileDigestWindow* w) {
+    DigestSamples* cb = new DigestSamples;
+    std::vector<DigestSamples> buckets;
+    w->get_samples(&buckets);
+    for (size_t i = 0; i < buckets.size(); ++i) {
+        cb->merge(buckets[i]);
+    }
+    return cb;
+}
+
+CDF::CDF(PercentileWindow* w, PercentileDigestWindow* dw) : _w(w), _dw(dw) {}
 
 CDF::~CDF() {
     hide();
 }
-    
+
 void CDF::describe(std::ostream& os, bool) const {
     os << "\"click to view\"";
 }
 
+// Works on both CombinedPercentileSamples and DigestSamples.
+template <typename T>
+static size_t fill_cdf_values(T* cb, std::pair<int, int>* values) {
+    size_t n = 0;
+    for (int i = 1; i < 10; ++i) {
+        values[n++] = std::make_pair(i*10, cb->get_number(i * 0.1));
+    }
+    for (int i = 91; i < 100; ++i) {
+        values[n++] = std::make_pair(i, cb->get_number(i * 0.01));
+    }
+    values[n++] = std::make_pair(100, cb->get_number(0.999));
+    values[n++] = std::make_pair(101, cb->get_number(0.9999));
+    return n;
+}
+
 int CDF::describe_series(
     std::ostream& os, const SeriesOptions& options) const {
-    if (_w == NULL) {
+    if (_w == NULL && _dw == NULL) {
         return 1;
     }
     if (options.test_only) {
         return 0;
     }
-    std::unique_ptr<CombinedPercentileSamples> cb(new CombinedPercentileSamples);
-    std::vector<GlobalPercentileSamples> buckets;
-    _w->get_samples(&buckets);
-    for (size_t i = 0; i < buckets.size(); ++i) {
-        cb->combine_of(buckets.begin(), buckets.end());
-    }
     std::pair<int, int> values[20];
     size_t n = 0;
-    for (int i = 1; i < 10; ++i) {
-        values[n++] = std::make_pair(i*10, cb->get_number(i * 0.1));
-    }
-    for (int i = 91; i < 100; ++i) {
-        values[n++] = std::make_pair(i, cb->get_number(i * 0.01));
+    if (_dw != NULL) {
+        std::unique_ptr<DigestSamples> cb(combine_digest(_dw));
+        n = fill_cdf_values(cb.get(), values);
+    } else {
+        std::unique_ptr<CombinedPercentileSamples> cb(new CombinedPercentileSamples);
+        std::vector<GlobalPercentileSamples> buckets;
+        _w->get_samples(&buckets);
+        for (size_t i = 0; i < buckets.size(); ++i) {
+            cb->combine_of(buckets.begin(), buckets.end());
+        }
+        n = fill_cdf_values(cb.get(), values);
     }
-    values[n++] = std::make_pair(100, cb->get_number(0.999));
-    values[n++] = std::make_pair(101, cb->get_number(0.9999));
     CHECK_EQ(n, arraysize(values));
     os << "{\"label\":\"cdf\",\"data\":[";
     for (size_t i = 0; i < n; ++i) {
@@ -132,41 +156,56 @@ static int64_t get_p3(void* arg) {
 }
 
 static Vector<int64_t, 4> get_latencies(void *arg) {
-    std::unique_ptr<CombinedPercentileSamples> cb(
-        combine((PercentileWindow*)arg));
-    // NOTE: We don't show 99.99% since it's often significantly larger than
-    // other values and make other curves on the plotted graph small and
-    // hard to read.
-    Vector<int64_t, 4> result;
-    result[0] = cb->get_number(FLAGS_bvar_latency_p1 / 100.0);
-    result[1] = cb->get_number(FLAGS_bvar_latency_p2 / 100.0);
-    result[2] = cb->get_number(FLAGS_bvar_latency_p3 / 100.0);
-    result[3] = cb->get_number(0.999);
-    return result;
+    return static_cast<LatencyRecorder*>(arg)->latency_percentiles();
 }
 
-LatencyRecorderBase::LatencyRecorderBase(time_t window_size)
+LatencyRecorderBase::LatencyRecorderBase(time_t window_size,
+                                         PercentileBackend backend)
     : _max_latency(0)
+    , _latency_digest(backend == PERCENTILE_DIGEST ?
+                      new PercentileDigest : (PercentileDigest*)NULL)
     , _latency_window(&_latency, window_size)
     , _max_latency_window(&_max_latency, window_size)
     , _count(get_recorder_count, &_latency)
     , _qps(get_window_recorder_qps, &_latency_window)
     , _latency_percentile_window(&_latency_percentile, window_size)
+    , _latency_digest_window(_latency_digest ?
+                             new PercentileDigestWindow(
+                                 _latency_digest.get(), window_size) :
+                             (PercentileDigestWindow*)NULL)
     , _latency_p1(get_p1, this)
     , _latency_p2(get_p2, this)
     , _latency_p3(get_p3, this)
     , _latency_999(get_percetile<999, 1000>, this)
     , _latency_9999(get_percetile<9999, 10000>, this)
-    , _latency_cdf(&_latency_percentile_window)
-    , _latency_percentiles(get_latencies, &_latency_percentile_window)
+    , _latency_cdf(&_latency_percentile_window, _latency_digest_window.get())
+    , _latency_percentiles(get_latencies, this)
 {}
 
 }  // namespace detail
 
 Vector<int64_t, 4> LatencyRecorder::latency_percentiles() const {
+    // NOTE: We don't show 99.99% since it's often significantly larger than
+    // other values and make other curves on the plotted graph small and
+    // hard to read.
+    Vector<int64_t, 4> result;
+    if (_latency_digest_window) {
+        std::unique_ptr<detail::DigestSamples> cb(
+            detail::combine_digest(_latency_digest_window.get()));
+        result[0] = cb->get_number(FLAGS_bvar_latency_p1 / 100.0);
+        result[1] = cb->get_number(FLAGS_bvar_latency_p2 / 100.0);
+        result[2] = cb->get_number(FLAGS_bvar_latency_p3 / 100.0);
+        result[3] = cb->get_number(0.999);
+        return result;
+    }
     // const_cast here is just to adapt parameter type and safe.
-    return detail::get_latencies(
-        const_cast<detail::PercentileWindow*>(&_latency_percentile_window));
+    std::unique_ptr<detail::CombinedPercentileSamples> cb(detail::combine(
+        const_cast<detail::PercentileWindow*>(&_latency_percentile_window)));
+    result[0] = cb->get_number(FLAGS_bvar_latency_p1 / 100.0);
+    result[1] = cb->get_number(FLAGS_bvar_latency_p2 / 100.0);
+    result[2] = cb->get_number(FLAGS_bvar_latency_p3 / 100.0);
+    result[3] = cb->get_number(0.999);
+    return result;
 }
 
 int64_t LatencyRecorder::qps(time_t window_size) const {
@@ -206,6 +245,9 @@ int LatencyRecorder::expose(const butil::StringPiece& prefix1,
     // set debug names for printing helpful error log.
     _latency.set_debug_name(prefix);
     _latency_percentile.set_debug_name(prefix);
+    if (_latency_digest) {
+        _latency_digest->set_debug_name(prefix);
+    }
 
     if (_latency_window.expose_as(prefix, "latency") != 0) {
         return -1;
@@ -252,6 +294,11 @@ int LatencyRecorder::expose(const butil::StringPiece& prefix1,
 }
 
 int64_t LatencyRecorder::latency_percentile(double ratio) const {
+    if (_latency_digest_window) {
+        std::unique_ptr<detail::DigestSamples> cb(
+            detail::combine_digest(_latency_digest_window.get()));
+        return cb->get_number(ratio);
+    }
     std::unique_ptr<detail::CombinedPercentileSamples> cb(
         combine((detail::PercentileWindow*)&_latency_percentile_window));
     return cb->get_number(ratio);
@@ -274,7 +321,11 @@ void LatencyRecorder::hide() {
 LatencyRecorder& LatencyRecorder::operator<<(int64_t latency) {
     _latency << latency;
     _max_latency << latency;
-    _latency_percentile << latency;
+    if (_latency_digest) {
+        *_latency_digest << latency;
+    } else {
+        _latency_percentile << latency;
+    }
     return *this;
 }
 
@@ -20,46 +20,69 @@
 #ifndef  BVAR_LATENCY_RECORDER_H
 #define  BVAR_LATENCY_RECORDER_H
 
+#include "butil/unique_ptr.h"
 #include "bvar/recorder.h"
 #include "bvar/reducer.h"
 #include "bvar/passive_status.h"
 #include "bvar/detail/percentile.h"
+#include "bvar/detail/percentile_digest.h"
 
 namespace bvar {
+
+// How a LatencyRecorder keeps percentiles.
+enum PercentileBackend {
+    // Random sampling into fixed-size intervals (the default). Cheapest
+    // in memory, but accuracy of long tails degrades at high QPS and
+    // merging windows drops samples.
+    PERCENTILE_SAMPLED = 0,
+    // DDSketch-style counters on logarithmic buckets: ~1% relative
+    // error on any quantile including p99.9/p99.99, lossless merging
+    // across windows and threads, at the cost of several KB of counters
+    // per recorder. See detail/percentile_digest.h.
+    PERCENTILE_DIGEST = 1
+};
+
 namespace detail {
 
 class Percentile;
 typedef Window<IntRecorder, SERIES_IN_SECOND> RecorderWindow;
 typedef Window<Maxer<int64_t>, SERIES_IN_SECOND> MaxWindow;
 typedef Window<Percentile, SERIES_IN_SECOND> PercentileWindow;
+typedef Window<PercentileDigest, SERIES_IN_SECOND> PercentileDigestWindow;
 
 // NOTE: Always use int64_t in the interfaces no matter what the impl. is.
 
 class CDF : public Variable {
 public:
-    explicit CDF(PercentileWindow* w);
+    explicit CDF(PercentileWindow* w, PercentileDigestWindow* dw = NULL);
     ~CDF();
     void describe(std::ostream& os, bool quote_string) const override;
     int describe_series(std::ostream& os, const SeriesOptions& options) const override;
 private:
-    PercentileWindow* _w; 
+    PercentileWindow* _w;
+    PercentileDigestWindow* _dw;  // overrides _w when non-NULL
 };
 
 // For mimic constructor inheritance.
 class LatencyRecorderBase {
 public:
-    explicit LatencyRecorderBase(time_t window_size);
+    explicit LatencyRecorderBase(time_t window_size,
+                                 PercentileBackend backend = PERCENTILE_SAMPLED);
     time_t window_size() const { return _latency_window.window_size(); }
 protected:
     IntRecorder _latency;
     Maxer<int64_t> _max_latency;
     Percentile _latency_percentile;
+    // Set only when PERCENTILE_DIGEST was selected, in which case it
+    // receives the samples instead of _latency_percentile.
+    std::unique_ptr<PercentileDigest> _latency_digest;
 
     RecorderWindow _latency_window;
     MaxWindow _max_latency_window;
     PassiveStatus<int64_t> _count;
     PassiveStatus<int64_t> _qps;
     PercentileWindow _latency_percentile_window;
+    std::unique_ptr<PercentileDigestWindow> _latency_digest_window;
     PassiveStatus<int64_t> _latency_p1;
     PassiveStatus<int64_t> _latency_p2;
     PassiveStatus<int64_t> _latency_p3;
@@ -77,20 +100,31 @@ class LatencyRecorder : public detail::LatencyRecorderBase {
 public:
     LatencyRecorder() : Base(-1) {}
     explicit LatencyRecorder(time_t window_size) : Base(window_size) {}
-    explicit LatencyRecorder(const butil::StringPiece& prefix) : Base(-1) {
+    explicit LatencyRecorder(PercentileBackend backend) : Base(-1, backend) {}
+    LatencyRecorder(time_t window_size,
+                    PercentileBackend backend) : Base(window_size, backend) {}
+    explicit LatencyRecorder(const butil::StringPiece& prefix,
+                             PercentileBackend backend = PERCENTILE_SAMPLED)
+        : Base(-1, backend) {
         expose(prefix);
     }
     LatencyRecorder(const butil::StringPiece& prefix,
-                    time_t window_size) : Base(window_size) {
+                    time_t window_size,
+                    PercentileBackend backend = PERCENTILE_SAMPLED)
+        : Base(window_size, backend) {
         expose(prefix);
     }
     LatencyRecorder(const butil::StringPiece& prefix1,
-                    const butil::StringPiece& prefix2) : Base(-1) {
+                    const butil::StringPiece& prefix2,
+                    PercentileBackend backend = PERCENTILE_SAMPLED)
+        : Base(-1, backend) {
         expose(prefix1, prefix2);
     }
     LatencyRecorder(const butil::StringPiece& prefix1,
                     const butil::StringPiece& prefix2,
-                    time_t window_size) : Base(window_size) {
+                    time_t window_size,
+                    PercentileBackend backend = PERCENTILE_SAMPLED)
+        : Base(window_size, backend) {
         expose(prefix1, prefix2);
     }
 
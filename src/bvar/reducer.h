@@ -142,6 +142,12 @@ public:
     // True if this reducer is constructed successfully.
     bool valid() const { return _combiner.valid(); }
 
+    // Get the agent of the calling thread, creating it on-demand. For views
+    // like ThreadLocalAdder which bind the agent once per thread and skip
+    // the lookup in later operator<<. Returns NULL on error.
+    agent_type* get_or_create_tls_agent()
+    { return _combiner.get_or_create_tls_agent(); }
+
     // Get instance of Op.
     const Op& op() const { return _combiner.op(); }
     const InvOp& inv_op() const { return _inv_op; }
@@ -238,6 +244,52 @@ public:
     ~Adder() { Variable::hide(); }
 };
 
+// A single-thread view of an Adder which binds the thread-local agent at
+// construction, so that operator<< skips the AgentGroup lookup paid by
+// Adder::operator<< and boils down to one relaxed atomic add on the
+// cacheline-aligned agent. Useful for counters ticking millions of times
+// per second in a long-running thread.
+// Rules:
+//  - Construct and use a view inside one thread only.
+//  - The view must not outlive the Adder or the thread: destroying the
+//    Adder invalidates all views on it. reset() on the Adder is fine.
+// Example:
+//   bvar::Adder<int64_t> g_counter;
+//   void* worker(void*) {
+//       bvar::ThreadLocalAdder<int64_t> local_counter(g_counter);
+//       while (...) {
+//           local_counter << 1;
+//       }
+//   }
+template <typename T>
+class ThreadLocalAdder {
+public:
+    typedef typename Adder<T>::agent_type agent_type;
+
+    explicit ThreadLocalAdder(Adder<T>& adder)
+        : _agent(adder.get_or_create_tls_agent()) {
+        // Additions on non-integral types do not commute with resets,
+        // they must go through the CAS loop in Adder::operator<<.
+        BAIDU_CASSERT(butil::is_integral<T>::value,
+                      ThreadLocalAdder_requires_integral_T);
+        LOG_IF(ERROR, _agent == NULL) << "Fail to create agent";
+    }
+
+    // True if the agent was bound successfully.
+    bool valid() const { return _agent != NULL; }
+
+    // Add a value, same semantics as Adder::operator<<.
+    ThreadLocalAdder& operator<<(T value) {
+        if (__builtin_expect(_agent != NULL, 1)) {
+            _agent->element.add(value);
+        }
+        return *this;
+    }
+
+private:
+    agent_type* _agent;
+};
+
 // bvar::Maxer<int> max_value;
 // max_value << 1 << 2 << 3 << 4;
 // LOG(INFO) << max_value.get_value(); // 4
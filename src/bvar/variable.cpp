@@ -29,6 +29,7 @@
 #include "butil/errno.h"                         // berror
 #include "butil/time.h"                          // milliseconds_from_now
 #include "butil/file_util.h"                     // butil::FilePath
+#include "butil/iobuf.h"                         // butil::IOBuf
 #include "bvar/gflag.h"
 #include "bvar/variable.h"
 
@@ -502,29 +503,58 @@ int Variable::dump_exposed(Dumper* dumper, const DumpOptions* poptions) {
             }
         }
     } else {
-        // Have to iterate all variables.
-        std::vector<std::string> varnames;
-        bvar::Variable::list_exposed(&varnames, opt.display_filter);
-        // Sort the names to make them more readable.
-        std::sort(varnames.begin(), varnames.end());
-        for (std::vector<std::string>::const_iterator
-                 it = varnames.begin(); it != varnames.end(); ++it) {
-            const std::string& name = *it;
-            if (white_matcher.match(name) && !black_matcher.match(name)) {
-                if (bvar::Variable::describe_exposed(
-                        name, os, opt.quote_string, opt.display_filter) != 0) {
+        // Have to iterate all variables. Describe matched ones during one
+        // pass of the sub maps instead of listing all names first and
+        // looking up each name again, which locks every sub map twice and
+        // rehashes every name.
+        typedef std::pair<std::string, std::string> NamedDescription;
+        std::vector<NamedDescription> described;
+        described.reserve(count_exposed());
+        VarMapWithLock* var_maps = get_var_maps();
+        for (size_t i = 0; i < SUB_MAP_COUNT; ++i) {
+            VarMapWithLock& m = var_maps[i];
+            const size_t first_index_in_submap = described.size();
+            std::unique_lock<pthread_mutex_t> mu(m.mutex);
+            size_t n = 0;
+            for (VarMap::const_iterator it = m.begin(); it != m.end(); ++it) {
+                if (++n >= 256/*max iterated one pass*/) {
+                    VarMap::PositionHint hint;
+                    m.save_iterator(it, &hint);
+                    n = 0;
+                    mu.unlock();  // yield
+                    mu.lock();
+                    it = m.restore_iterator(hint);
+                    if (it == m.begin()) { // resized
+                        described.resize(first_index_in_submap);
+                    }
+                    if (it == m.end()) {
+                        break;
+                    }
+                }
+                if (!(it->second.display_filter & opt.display_filter)) {
                     continue;
                 }
-                if (log_dummped) {
-                    dumpped_info << '\n' << name << ": " << streambuf.data();
+                if (white_matcher.match(it->first) &&
+                    !black_matcher.match(it->first)) {
+                    it->second.var->describe(os, opt.quote_string);
+                    described.push_back(NamedDescription(
+                        it->first, streambuf.data().as_string()));
+                    streambuf.reset();
                 }
-                if (!dumper->dump(name, streambuf.data())) {
-                    return -1;
-                }
-                streambuf.reset();
-                ++count;
             }
         }
+        // Sort the result to make it more readable.
+        std::sort(described.begin(), described.end());
+        for (std::vector<NamedDescription>::const_iterator
+                 it = described.begin(); it != described.end(); ++it) {
+            if (log_dummped) {
+                dumpped_info << '\n' << it->first << ": " << it->second;
+            }
+            if (!dumper->dump(it->first, it->second)) {
+                return -1;
+            }
+            ++count;
+        }
     }
     if (log_dummped) {
         LOG(INFO) << "Dumpped variables:" << dumpped_info.str();
@@ -532,6 +562,32 @@ int Variable::dump_exposed(Dumper* dumper, const DumpOptions* poptions) {
     return count;
 }
 
+class IOBufDumper : public Dumper {
+public:
+    explicit IOBufDumper(butil::IOBuf* buf) : _buf(buf) {}
+
+    bool dump(const std::string& name,
+              const butil::StringPiece& description) override {
+        _buf->append(name);
+        _buf->append(" : ");
+        _buf->append(description.data(), description.size());
+        _buf->push_back('\n');
+        return true;
+    }
+
+private:
+    butil::IOBuf* _buf;
+};
+
+int Variable::dump_exposed(butil::IOBuf* buf, const DumpOptions* poptions) {
+    if (NULL == buf) {
+        LOG(ERROR) << "Parameter[buf] is NULL";
+        return -1;
+    }
+    IOBufDumper dumper(buf);
+    return dump_exposed(&dumper, poptions);
+}
+
 
 // ============= export to files ==============
 
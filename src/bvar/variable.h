@@ -35,6 +35,10 @@ class any;
 }
 #endif
 
+namespace butil {
+class IOBuf;
+}
+
 namespace bvar {
 
 DECLARE_bool(save_series);
@@ -205,6 +209,15 @@ public:
     // Return number of dumped variables, -1 on error.
     static int dump_exposed(Dumper* dumper, const DumpOptions* options);
 
+    // Describe all exposed variables matching `white_wildcards' but
+    // `black_wildcards' into `buf', one "NAME : VALUE\n" per variable.
+    // Variables are described during one pass of the registry rather
+    // than listing all names first and querying them one by one, which
+    // is preferable for programs scraping many variables periodically.
+    // Use default options when `options' is NULL.
+    // Return number of dumped variables, -1 on error.
+    static int dump_exposed(butil::IOBuf* buf, const DumpOptions* options);
+
 protected:
     virtual int expose_impl(const butil::StringPiece& prefix,
                             const butil::StringPiece& name,
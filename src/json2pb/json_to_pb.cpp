@@ -22,8 +22,11 @@
 #include <sys/time.h>
 #include <time.h>
 #include <typeinfo>
-#include <limits> 
+#include <limits>
+#include <pthread.h>
 #include <google/protobuf/descriptor.h>
+#include "butil/containers/flat_map.h"
+#include "butil/logging.h"
 #include "json_to_pb.h"
 #include "zero_copy_stream_reader.h"       // ZeroCopyStreamReader
 #include "encode_decode.h"
@@ -413,20 +416,42 @@ bool JsonMapToProtoMap(const BUTIL_RAPIDJSON_NAMESPACE::Value& value,
     return true;
 }
 
-bool JsonValueToProtoMessage(const BUTIL_RAPIDJSON_NAMESPACE::Value& json_value,
-                             google::protobuf::Message* message,
-                             const Json2PbOptions& options,
-                             std::string* err) {
-    const google::protobuf::Descriptor* descriptor = message->GetDescriptor();
-    if (!json_value.IsObject()) {
-        J2PERROR(err, "`json_value' is not a json object. %s", descriptor->name().c_str());
-        return false;
-    }
+// Fields of a message type to be filled from json and their names shown
+// in json(after decode_name), resolved once per Descriptor and cached so
+// that converting each message does no descriptor walking, extension
+// scanning or name decoding.
+struct FieldInfo {
+    const google::protobuf::FieldDescriptor* field;
+    std::string json_name;
+};
+typedef std::vector<FieldInfo> MessageFields;
 
-    const google::protobuf::Reflection* reflection = message->GetReflection();
-    
-    std::vector<const google::protobuf::FieldDescriptor*> fields;
-    fields.reserve(64);
+static pthread_once_t s_field_cache_once = PTHREAD_ONCE_INIT;
+static pthread_rwlock_t s_field_cache_lock = PTHREAD_RWLOCK_INITIALIZER;
+static butil::FlatMap<const google::protobuf::Descriptor*,
+                      const MessageFields*>* s_field_cache = NULL;
+
+static void InitFieldCache() {
+    s_field_cache = new butil::FlatMap<const google::protobuf::Descriptor*,
+                                       const MessageFields*>;
+    CHECK_EQ(0, s_field_cache->init(64));
+}
+
+static const MessageFields* GetMessageFields(
+    const google::protobuf::Reflection* reflection,
+    const google::protobuf::Descriptor* descriptor) {
+    pthread_once(&s_field_cache_once, InitFieldCache);
+    pthread_rwlock_rdlock(&s_field_cache_lock);
+    const MessageFields* const* pcached = s_field_cache->seek(descriptor);
+    const MessageFields* cached = (pcached ? *pcached : NULL);
+    pthread_rwlock_unlock(&s_field_cache_lock);
+    if (cached != NULL) {
+        return cached;
+    }
+    MessageFields* fields = new MessageFields;
+    fields->reserve(descriptor->field_count());
+    // NOTE: extensions registered after the first conversion of a message
+    // type are not picked up.
     for (int i = 0; i < descriptor->extension_range_count(); ++i) {
         const google::protobuf::Descriptor::ExtensionRange*
             ext_range = descriptor->extension_range(i);
@@ -435,22 +460,51 @@ bool JsonValueToProtoMessage(const BUTIL_RAPIDJSON_NAMESPACE::Value& json_value,
             const google::protobuf::FieldDescriptor* field =
                 reflection->FindKnownExtensionByNumber(tag_number);
             if (field) {
-                fields.push_back(field);
+                fields->push_back(FieldInfo());
+                fields->back().field = field;
             }
         }
     }
     for (int i = 0; i < descriptor->field_count(); ++i) {
-        fields.push_back(descriptor->field(i));
+        fields->push_back(FieldInfo());
+        fields->back().field = descriptor->field(i);
     }
+    std::string decoded_name;
+    for (size_t i = 0; i < fields->size(); ++i) {
+        FieldInfo& info = (*fields)[i];
+        info.json_name = (decode_name(info.field->name(), decoded_name) ?
+                          decoded_name : info.field->name());
+    }
+    pthread_rwlock_wrlock(&s_field_cache_lock);
+    pcached = s_field_cache->seek(descriptor);
+    if (pcached != NULL) {  // another thread won the race.
+        cached = *pcached;
+        pthread_rwlock_unlock(&s_field_cache_lock);
+        delete fields;
+        return cached;
+    }
+    (*s_field_cache)[descriptor] = fields;
+    pthread_rwlock_unlock(&s_field_cache_lock);
+    return fields;
+}
+
+bool JsonValueToProtoMessage(const BUTIL_RAPIDJSON_NAMESPACE::Value& json_value,
+                             google::protobuf::Message* message,
+                             const Json2PbOptions& options,
+                             std::string* err) {
+    const google::protobuf::Descriptor* descriptor = message->GetDescriptor();
+    if (!json_value.IsObject()) {
+        J2PERROR(err, "`json_value' is not a json object. %s", descriptor->name().c_str());
+        return false;
+    }
+
+    const google::protobuf::Reflection* reflection = message->GetReflection();
+    const MessageFields* fields = GetMessageFields(reflection, descriptor);
 
-    std::string field_name_str_temp; 
     const BUTIL_RAPIDJSON_NAMESPACE::Value* value_ptr = NULL;
-    for (size_t i = 0; i < fields.size(); ++i) {
-        const google::protobuf::FieldDescriptor* field = fields[i];
-        
-        const std::string& orig_name = field->name();
-        bool res = decode_name(orig_name, field_name_str_temp); 
-        const std::string& field_name_str = (res ? field_name_str_temp : orig_name);
+    for (size_t i = 0; i < fields->size(); ++i) {
+        const google::protobuf::FieldDescriptor* field = (*fields)[i].field;
+        const std::string& field_name_str = (*fields)[i].json_name;
 
 #ifndef RAPIDJSON_VERSION_0_1
         BUTIL_RAPIDJSON_NAMESPACE::Value::ConstMemberIterator member =
@@ -50,6 +50,14 @@ public:
     template <typename Handler>
     bool Convert(const google::protobuf::Message& message, Handler& handler);
 
+    // Convert a single field rather than the whole message, e.g. dump a
+    // repeated field as a bare json array.
+    template <typename Handler>
+    bool ConvertField(const google::protobuf::Message& message,
+                      const google::protobuf::FieldDescriptor* field,
+                      Handler& handler)
+    { return _PbFieldToJson(message, field, handler); }
+
     const std::string& ErrorText() const { return _error; }
     
 private:
@@ -302,18 +310,31 @@ bool ProtoMessageToJsonStream(const google::protobuf::Message& message,
     return succ;
 }
 
+// Let rapidjson append directly into the output std::string, which saves
+// the copy from an intermediate rapidjson::StringBuffer.
+class StringAsStream {
+public:
+    typedef char Ch;
+    explicit StringAsStream(std::string* str) : _str(str) {}
+    void Put(char c) { _str->push_back(c); }
+    void Puts(const char* str, size_t length) { _str->append(str, length); }
+    void PutN(char c, size_t n) { _str->append(n, c); }
+    void Flush() {}
+private:
+    std::string* _str;
+};
+
 bool ProtoMessageToJson(const google::protobuf::Message& message,
                         std::string* json,
                         const Pb2JsonOptions& options,
                         std::string* error) {
-    // TODO(gejun): We could further wrap a std::string as a buffer to reduce
-    // a copying.
-    BUTIL_RAPIDJSON_NAMESPACE::StringBuffer buffer;
-    if (json2pb::ProtoMessageToJsonStream(message, options, buffer, error)) {
-        json->append(buffer.GetString(), buffer.GetSize());
-        return true;
+    const size_t old_size = json->size();
+    StringAsStream output(json);
+    if (!json2pb::ProtoMessageToJsonStream(message, options, output, error)) {
+        json->resize(old_size);  // remove partially written json.
+        return false;
     }
-    return false;
+    return true;
 }
 
 bool ProtoMessageToJson(const google::protobuf::Message& message,
@@ -333,4 +354,81 @@ bool ProtoMessageToJson(const google::protobuf::Message& message,
                         std::string* error) {
     return ProtoMessageToJson(message, stream, Pb2JsonOptions(), error);
 }
+
+PbToJsonArrayEmitter::PbToJsonArrayEmitter(
+    google::protobuf::io::ZeroCopyOutputStream* stream,
+    const Pb2JsonOptions& options)
+    : _stream(stream)
+    , _options(options)
+    , _started(false)
+    , _done(false) {
+}
+
+PbToJsonArrayEmitter::~PbToJsonArrayEmitter() {
+    Done();
+}
+
+bool PbToJsonArrayEmitter::Emit(const google::protobuf::Message& element) {
+    if (_done) {
+        _error = "Emit() is called after Done()";
+        return false;
+    }
+    // The wrapper is scoped to this call so that its destructor backs up
+    // unused buffer space and the written bytes become visible to the
+    // underlying stream (and readable on the wire for progressive
+    // attachments) once the element is complete.
+    ZeroCopyStreamWriter wrapper(_stream);
+    if (!_started) {
+        wrapper.Put('[');
+        _started = true;
+    } else {
+        wrapper.Put(',');
+    }
+    PbToJsonConverter converter(_options);
+    BUTIL_RAPIDJSON_NAMESPACE::OptimizedWriter<ZeroCopyStreamWriter>
+        writer(wrapper);
+    if (!converter.Convert(element, writer)) {
+        _error = converter.ErrorText();
+        return false;
+    }
+    return true;
+}
+
+void PbToJsonArrayEmitter::Done() {
+    if (_done) {
+        return;
+    }
+    _done = true;
+    ZeroCopyStreamWriter wrapper(_stream);
+    if (!_started) {
+        wrapper.Put('[');
+        _started = true;
+    }
+    wrapper.Put(']');
+}
+
+bool ProtoMessageToJsonStream(const google::protobuf::Message& message,
+                              const google::protobuf::FieldDescriptor* field,
+                              google::protobuf::io::ZeroCopyOutputStream* stream,
+                              const Pb2JsonOptions& options,
+                              std::string* error) {
+    if (field == NULL || !field->is_repeated()) {
+        if (error) {
+            *error = "Field is not repeated";
+        }
+        return false;
+    }
+    PbToJsonConverter converter(options);
+    ZeroCopyStreamWriter wrapper(stream);
+    BUTIL_RAPIDJSON_NAMESPACE::OptimizedWriter<ZeroCopyStreamWriter>
+        writer(wrapper);
+    if (!converter.ConvertField(message, field, writer)) {
+        if (error) {
+            error->clear();
+            error->append(converter.ErrorText());
+        }
+        return false;
+    }
+    return true;
+}
 } // namespace json2pb
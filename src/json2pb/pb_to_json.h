@@ -86,6 +86,54 @@ bool ProtoMessageToJson(const google::protobuf::Message& message,
 bool ProtoMessageToJson(const google::protobuf::Message& message,
                         google::protobuf::io::ZeroCopyOutputStream* json,
                         std::string* error = NULL);
+
+// Emit a JSON array to `stream' one element per Emit(), so that a list
+// response can be converted and written out while it is being iterated
+// instead of first materializing the complete message and its complete
+// JSON text. With an IOBuf or ProgressiveAttachment backed stream the
+// memory held at any moment is one element, not the whole listing.
+// Usage:
+//   PbToJsonArrayEmitter emitter(&stream, options);
+//   for (...) {
+//       if (!emitter.Emit(one_element)) { /* see ErrorText() */ }
+//   }
+//   emitter.Done();
+// NOTE: pretty_json is ignored, streamed output is always compact.
+class PbToJsonArrayEmitter {
+public:
+    explicit PbToJsonArrayEmitter(
+        google::protobuf::io::ZeroCopyOutputStream* stream,
+        const Pb2JsonOptions& options = Pb2JsonOptions());
+    // Close the array if Done() was not called.
+    ~PbToJsonArrayEmitter();
+
+    // Append `element' to the array. Returns false on conversion error
+    // which is described by ErrorText().
+    bool Emit(const google::protobuf::Message& element);
+
+    // Write the closing bracket. No Emit() is allowed afterwards.
+    void Done();
+
+    const std::string& ErrorText() const { return _error; }
+
+private:
+    google::protobuf::io::ZeroCopyOutputStream* _stream;
+    Pb2JsonOptions _options;
+    bool _started;
+    bool _done;
+    std::string _error;
+};
+
+// Convert repeated field `field' of `message' into a JSON array written
+// incrementally to `stream', the streaming counterpart of converting a
+// one-repeated-field response with ProtoMessageToJson. Returns true on
+// success. `error' (if not NULL) will be set with error message on
+// failure.
+bool ProtoMessageToJsonStream(const google::protobuf::Message& message,
+                              const google::protobuf::FieldDescriptor* field,
+                              google::protobuf::io::ZeroCopyOutputStream* stream,
+                              const Pb2JsonOptions& options,
+                              std::string* error = NULL);
 } // namespace json2pb
 
 #endif // BRPC_JSON2PB_PB_TO_JSON_H
@@ -136,6 +136,18 @@ const char* to_mcpack_typestr_uppercase(
     return tempbuf;
 }
 
+// True for typestrs whose serialized head is schema-constant so that
+// generated code caches it in a mcpack2pb::FieldTemplate. Heads of
+// string/binary embed the value size and objects/arrays are backpatched.
+static bool is_fixed_primitive_typestr(const char* s) {
+    return strcmp(s, "int8") == 0 || strcmp(s, "int16") == 0 ||
+        strcmp(s, "int32") == 0 || strcmp(s, "int64") == 0 ||
+        strcmp(s, "uint8") == 0 || strcmp(s, "uint16") == 0 ||
+        strcmp(s, "uint32") == 0 || strcmp(s, "uint64") == 0 ||
+        strcmp(s, "bool") == 0 || strcmp(s, "float") == 0 ||
+        strcmp(s, "double") == 0;
+}
+
 const char* describe_idl_type(ConvertibleIdlType type) {
     switch (type) {
     case IDL_AUTO:   return "IDL_AUTO";
@@ -736,13 +748,29 @@ static bool generate_parsing(const google::protobuf::Descriptor* d,
         }                                                               \
         return false;                                                   \
     }                                                                   \
-    (printer).Print(                                                    \
-        "if (msg.has_$lcfield$()) {\n"                                  \
-        "  serializer.add_$type$(\"$field$\", msg.$lcfield$());\n"      \
-        "}"                                                             \
-        , "type", to_mcpack_typestr(cit, (field))                       \
-        , "field", get_idl_name(field)                                  \
-        , "lcfield", (field)->lowercase_name());                        \
+    {                                                                   \
+        const char* const mc_typestr = to_mcpack_typestr(cit, (field)); \
+        if (is_fixed_primitive_typestr(mc_typestr)) {                   \
+            /* Head+name of the field never changes, serialize it */    \
+            /* once into a shared template, see serializer.h */         \
+            (printer).Print(                                            \
+                "if (msg.has_$lcfield$()) {\n"                          \
+                "  static const ::mcpack2pb::FieldTemplate ft_$lcfield$(\"$field$\");\n" \
+                "  serializer.add_$type$(ft_$lcfield$, msg.$lcfield$());\n" \
+                "}"                                                     \
+                , "type", mc_typestr                                    \
+                , "field", get_idl_name(field)                          \
+                , "lcfield", (field)->lowercase_name());                \
+        } else {                                                        \
+            (printer).Print(                                            \
+                "if (msg.has_$lcfield$()) {\n"                          \
+                "  serializer.add_$type$(\"$field$\", msg.$lcfield$());\n" \
+                "}"                                                     \
+                , "type", mc_typestr                                    \
+                , "field", get_idl_name(field)                          \
+                , "lcfield", (field)->lowercase_name());                \
+        }                                                               \
+    }                                                                   \
         if ((field)->options().GetExtension(idl_on)) {                  \
           (printer).Print(                                              \
             " else {\n"                                                 \
@@ -0,0 +1,148 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// mcpack2pb - Make protobuf be front-end of mcpack/compack
+
+#include "butil/logging.h"
+#include "mcpack2pb/object_view.h"
+
+namespace mcpack2pb {
+
+int ObjectView::init(const butil::IOBuf& buf) {
+    _buf = buf;
+    return build_index(true);
+}
+
+int ObjectView::build_index(bool unbox_first) {
+    if (_index.initialized()) {
+        _index.clear();
+    } else if (_index.init(32) != 0) {
+        LOG(ERROR) << "Fail to init _index";
+        return -1;
+    }
+    butil::IOBufAsZeroCopyInputStream zc_stream(_buf);
+    InputStream stream(&zc_stream);
+    size_t size = _buf.size();
+    if (unbox_first) {
+        size = unbox(&stream);
+        if (!stream.good()) {
+            LOG(WARNING) << "Fail to unbox the input";
+            return -1;
+        }
+    }
+    for (ObjectIterator it(&stream, size); it != NULL; ++it) {
+        // The stream is right at the value after cutting heads and name,
+        // thus popped_bytes() is the offset of the value inside _buf.
+        FieldRange range = { it->value.type(),
+                             (uint32_t)stream.popped_bytes(),
+                             (uint32_t)it->value.size() };
+        std::string name(it->name.data(), it->name.size());
+        _index[name] = range;
+    }
+    if (!stream.good()) {
+        LOG(WARNING) << "The input is not a valid object";
+        _index.clear();
+        return -1;
+    }
+    return (int)_index.size();
+}
+
+FieldType ObjectView::field_type(const std::string& name) const {
+    const FieldRange* range = seek_field(name);
+    return range != NULL ? range->type : FIELD_UNKNOWN;
+}
+
+// Seek `name' and decode the value with UnparsedValue::as_XXX which also
+// handles convertible types, e.g. get_int64 on an int32 field works.
+#define MCPACK2PB_OBJECT_VIEW_GET(CPPTYPE, M)                           \
+    CPPTYPE ObjectView::get_##M(const std::string& name,                \
+                                CPPTYPE default_value) const {          \
+        const FieldRange* range = seek_field(name);                     \
+        if (NULL == range) {                                            \
+            return default_value;                                       \
+        }                                                               \
+        butil::IOBuf sub;                                               \
+        _buf.append_to(&sub, range->size, range->offset);               \
+        butil::IOBufAsZeroCopyInputStream zc_stream(sub);               \
+        InputStream stream(&zc_stream);                                 \
+        UnparsedValue value(range->type, &stream, range->size);         \
+        return value.as_##M(name.c_str());                              \
+    }
+
+MCPACK2PB_OBJECT_VIEW_GET(int64_t, int64)
+MCPACK2PB_OBJECT_VIEW_GET(uint64_t, uint64)
+MCPACK2PB_OBJECT_VIEW_GET(int32_t, int32)
+MCPACK2PB_OBJECT_VIEW_GET(uint32_t, uint32)
+MCPACK2PB_OBJECT_VIEW_GET(bool, bool)
+MCPACK2PB_OBJECT_VIEW_GET(float, float)
+MCPACK2PB_OBJECT_VIEW_GET(double, double)
+
+#undef MCPACK2PB_OBJECT_VIEW_GET
+
+bool ObjectView::get_string(const std::string& name, std::string* out) const {
+    const FieldRange* range = seek_field(name);
+    if (NULL == range || range->type != FIELD_STRING) {
+        return false;
+    }
+    butil::IOBuf sub;
+    _buf.append_to(&sub, range->size, range->offset);
+    butil::IOBufAsZeroCopyInputStream zc_stream(sub);
+    InputStream stream(&zc_stream);
+    UnparsedValue value(range->type, &stream, range->size);
+    value.as_string(out, name.c_str());
+    return stream.good();
+}
+
+bool ObjectView::get_binary(const std::string& name, std::string* out) const {
+    const FieldRange* range = seek_field(name);
+    if (NULL == range || range->type != FIELD_BINARY) {
+        return false;
+    }
+    butil::IOBuf sub;
+    _buf.append_to(&sub, range->size, range->offset);
+    butil::IOBufAsZeroCopyInputStream zc_stream(sub);
+    InputStream stream(&zc_stream);
+    UnparsedValue value(range->type, &stream, range->size);
+    value.as_binary(out, name.c_str());
+    return stream.good();
+}
+
+int ObjectView::get_object(const std::string& name, ObjectView* view) const {
+    const FieldRange* range = seek_field(name);
+    if (NULL == range || range->type != FIELD_OBJECT) {
+        return -1;
+    }
+    view->_buf.clear();
+    _buf.append_to(&view->_buf, range->size, range->offset);
+    // The value of a named object is its fields laid out back-to-back,
+    // no extra header to strip.
+    return view->build_index(false);
+}
+
+bool ObjectView::get_raw(const std::string& name, FieldType* type,
+                         butil::IOBuf* out) const {
+    const FieldRange* range = seek_field(name);
+    if (NULL == range) {
+        return false;
+    }
+    *type = range->type;
+    out->clear();
+    _buf.append_to(out, range->size, range->offset);
+    return true;
+}
+
+}  // namespace mcpack2pb
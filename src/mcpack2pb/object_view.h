@@ -0,0 +1,117 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// mcpack2pb - Make protobuf be front-end of mcpack/compack
+
+#ifndef MCPACK2PB_MCPACK_OBJECT_VIEW_H
+#define MCPACK2PB_MCPACK_OBJECT_VIEW_H
+
+#include <string>
+#include "butil/iobuf.h"
+#include "butil/containers/flat_map.h"
+#include "mcpack2pb/parser.h"
+
+// CAUTION: Methods in this header is not intended to be public to users of
+// brpc, and subject to change at any future time.
+
+namespace mcpack2pb {
+
+// Lazily access fields of a packed mcpack/compack object without
+// converting the whole message to protobuf. init() scans the object once
+// and only records where each top-level field lies inside the IOBuf;
+// getters seek into the buffer and decode single values on demand, thus
+// untouched fields cost nothing but the scan. Useful for services that
+// read a few fields of big legacy messages.
+//
+// Example:
+//   ObjectView view;
+//   if (view.init(request_body) < 0) {
+//       ... not a valid object ...
+//   }
+//   const int64_t logid = view.get_int64("logid");
+//   std::string content;
+//   view.get_string("content", &content);
+//
+// This object references blocks of the IOBuf passed to init() and remains
+// valid after the IOBuf is cleared.
+class ObjectView {
+public:
+    ObjectView() {}
+
+    // Index top-level fields of the object packed in `buf' which starts
+    // with the wrapping object header(as carried in bodies of nshead
+    // requests). Values are not decoded.
+    // Returns number of fields on success, -1 on malformed input.
+    int init(const butil::IOBuf& buf);
+
+    bool has_field(const std::string& name) const
+    { return _index.initialized() && _index.seek(name) != NULL; }
+
+    size_t field_count() const
+    { return _index.initialized() ? _index.size() : 0; }
+
+    // Type of the field, FIELD_UNKNOWN when the field is absent.
+    FieldType field_type(const std::string& name) const;
+
+    // Decode a primitive field. Returns `default_value' when the field is
+    // absent. Types are converted as UnparsedValue does: mismatches that
+    // lose data log a FATAL and return 0 of the requested type.
+    int64_t get_int64(const std::string& name, int64_t default_value = 0) const;
+    uint64_t get_uint64(const std::string& name, uint64_t default_value = 0) const;
+    int32_t get_int32(const std::string& name, int32_t default_value = 0) const;
+    uint32_t get_uint32(const std::string& name, uint32_t default_value = 0) const;
+    bool get_bool(const std::string& name, bool default_value = false) const;
+    float get_float(const std::string& name, float default_value = 0) const;
+    double get_double(const std::string& name, double default_value = 0) const;
+
+    // Decode a string/binary field into `out'.
+    // Returns true on success, false when the field is absent or not a
+    // string/binary.
+    bool get_string(const std::string& name, std::string* out) const;
+    bool get_binary(const std::string& name, std::string* out) const;
+
+    // Make `view' a lazy view of the sub-object `name'.
+    // Returns number of fields of the sub-object, -1 when the field is
+    // absent, not an object or malformed.
+    int get_object(const std::string& name, ObjectView* view) const;
+
+    // Fetch the undecoded value of the field, e.g. to iterate an array
+    // field with ArrayIterator/ISOArrayIterator.
+    // Returns true on success, false when the field is absent.
+    bool get_raw(const std::string& name, FieldType* type,
+                 butil::IOBuf* out) const;
+
+private:
+    struct FieldRange {
+        FieldType type;
+        uint32_t offset;
+        uint32_t size;
+    };
+
+    // Index fields laid out in _buf[0.._buf.size()), optionally preceded
+    // by the wrapping object header.
+    int build_index(bool unbox_first);
+    const FieldRange* seek_field(const std::string& name) const
+    { return _index.initialized() ? _index.seek(name) : NULL; }
+
+    butil::IOBuf _buf;
+    butil::FlatMap<std::string, FieldRange> _index;
+};
+
+}  // namespace mcpack2pb
+
+#endif  // MCPACK2PB_MCPACK_OBJECT_VIEW_H
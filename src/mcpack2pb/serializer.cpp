@@ -204,6 +204,17 @@ inline bool object_add_item(Serializer::GroupInfo & group_info,
     return true;
 }
 
+inline bool object_add_item(Serializer::GroupInfo & group_info,
+                            const FieldTemplate& ft) {
+    // Name length was validated when the template was built.
+    if (group_info.type != FIELD_OBJECT) {
+        CHECK(false) << "Cannot add `" << ft.name() << "' to " << group_info;
+        return false;
+    }
+    ++group_info.item_count;
+    return true;
+}
+
 inline bool array_add_item(OutputStream* stream,
                            Serializer::GroupInfo & group_info,
                            FieldType item_type,
@@ -294,6 +305,51 @@ inline void add_primitive(OutputStream* stream,
     }
 }
 
+FieldTemplate::FieldTemplate(const StringWrapper& name) {
+    CHECK(!name.empty()) << "Empty name";
+    CHECK_LE(name.size(), 254u) << "Too long name=`" << name << '\'';
+    FieldFixedHead head;
+    head.set_type(0);  // patched by add_* with the real type.
+    head.set_name_size(name.size() + 1);
+    _head_and_name.reserve(sizeof(head) + name.size() + 1);
+    _head_and_name.append((const char*)&head, sizeof(head));
+    _head_and_name.append(name.data(), name.size() + 1);
+}
+
+StringWrapper FieldTemplate::name() const {
+    return StringWrapper(_head_and_name.c_str() + sizeof(FieldFixedHead));
+}
+
+template <typename T>
+inline void add_primitive(OutputStream* stream,
+                          Serializer::GroupInfo & group_info,
+                          const FieldTemplate& ft,
+                          T value) {
+    if (!stream->good()) {
+        return;
+    }
+    if (!object_add_item(group_info, ft)) {
+        return stream->set_bad();
+    }
+    const std::string& hn = ft.head_and_name();
+    void* data = stream->skip_continuous(hn.size() + sizeof(T));
+    if (data) {
+        fast_memcpy(data, hn.data(), hn.size());
+        *(char*)data = (char)GetFieldType<T>::value;
+        *(T*)((char*)data + hn.size()) = value;
+    } else {
+        // Crossing a block boundary, rebuild the head so that the type
+        // byte is correct without patching already-appended bytes.
+        FieldFixedHead head;
+        head.set_type(GetFieldType<T>::value);
+        head.set_name_size(hn.size() - sizeof(FieldFixedHead));
+        stream->append_packed_pod(head);
+        stream->append(hn.data() + sizeof(FieldFixedHead),
+                       hn.size() - sizeof(FieldFixedHead));
+        stream->append_packed_pod(value);
+    }
+}
+
 template <typename T>
 inline void add_primitives(OutputStream* stream,
                            Serializer::GroupInfo & group_info,
@@ -350,6 +406,29 @@ void Serializer::add_float(const StringWrapper& name, float value)
 void Serializer::add_double(const StringWrapper& name, double value)
 { add_primitive(_stream, peek_group_info(), name, value); }
 
+void Serializer::add_int8(const FieldTemplate& ft, int8_t value)
+{ add_primitive(_stream, peek_group_info(), ft, value); }
+void Serializer::add_int16(const FieldTemplate& ft, int16_t value)
+{ add_primitive(_stream, peek_group_info(), ft, value); }
+void Serializer::add_int32(const FieldTemplate& ft, int32_t value)
+{ add_primitive(_stream, peek_group_info(), ft, value); }
+void Serializer::add_int64(const FieldTemplate& ft, int64_t value)
+{ add_primitive(_stream, peek_group_info(), ft, value); }
+void Serializer::add_uint8(const FieldTemplate& ft, uint8_t value)
+{ add_primitive(_stream, peek_group_info(), ft, value); }
+void Serializer::add_uint16(const FieldTemplate& ft, uint16_t value)
+{ add_primitive(_stream, peek_group_info(), ft, value); }
+void Serializer::add_uint32(const FieldTemplate& ft, uint32_t value)
+{ add_primitive(_stream, peek_group_info(), ft, value); }
+void Serializer::add_uint64(const FieldTemplate& ft, uint64_t value)
+{ add_primitive(_stream, peek_group_info(), ft, value); }
+void Serializer::add_bool(const FieldTemplate& ft, bool value)
+{ add_primitive(_stream, peek_group_info(), ft, value); }
+void Serializer::add_float(const FieldTemplate& ft, float value)
+{ add_primitive(_stream, peek_group_info(), ft, value); }
+void Serializer::add_double(const FieldTemplate& ft, double value)
+{ add_primitive(_stream, peek_group_info(), ft, value); }
+
 void Serializer::add_int8(int8_t value)
 { add_primitive(_stream, peek_group_info(), value); }
 void Serializer::add_int16(int16_t value)
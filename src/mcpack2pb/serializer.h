@@ -147,6 +147,29 @@ inline std::ostream& operator<<(std::ostream& os, const StringWrapper& sw) {
     return os << butil::StringPiece(sw.data(), sw.size());
 }
 
+// Pre-serialized head of a named fixed-size primitive field. The bytes
+// before the value -- type byte, name size and the zero-terminated name
+// -- are structurally constant for a given schema, so generated
+// serializers build one template per field (in a function-local static)
+// and each add_*(FieldTemplate, value) appends the cached bytes in a
+// single copy, patching only the type byte and the value. Heads of
+// strings/raws embed the value size and do not qualify.
+class FieldTemplate {
+public:
+    // `name' must be non-empty and not longer than 254 bytes.
+    explicit FieldTemplate(const StringWrapper& name);
+
+    // The field name inside the cached bytes, zero-terminated.
+    StringWrapper name() const;
+
+    // Head + zero-terminated name, ready to be appended before the
+    // value. The first byte is a placeholder for the type.
+    const std::string& head_and_name() const { return _head_and_name; }
+
+private:
+    std::string _head_and_name;
+};
+
 class Serializer {
 public:
     // Serialize into `output'.
@@ -173,6 +196,21 @@ public:
     void add_float(const StringWrapper& name, float value);
     void add_double(const StringWrapper& name, double value);
 
+    // Append a primitive type whose head and name were pre-serialized
+    // into `ft', saving the per-request head assembly and name copy.
+    // Used by generated serializers for hot response schemas.
+    void add_int8(const FieldTemplate& ft, int8_t value);
+    void add_int16(const FieldTemplate& ft, int16_t value);
+    void add_int32(const FieldTemplate& ft, int32_t value);
+    void add_int64(const FieldTemplate& ft, int64_t value);
+    void add_uint8(const FieldTemplate& ft, uint8_t value);
+    void add_uint16(const FieldTemplate& ft, uint16_t value);
+    void add_uint32(const FieldTemplate& ft, uint32_t value);
+    void add_uint64(const FieldTemplate& ft, uint64_t value);
+    void add_bool(const FieldTemplate& ft, bool value);
+    void add_float(const FieldTemplate& ft, float value);
+    void add_double(const FieldTemplate& ft, double value);
+
     // Add a primitive type without name.
     // Used between begin_xxx_array() and end_xxx_array().
     void add_int8(int8_t value);
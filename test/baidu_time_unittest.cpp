@@ -125,6 +125,27 @@ TEST(BaiduTimeTest, cost_of_timer) {
     }
 }
 
+TEST(BaiduTimeTest, coarse_clocks) {
+    // Coarse clocks lag their precise counterparts by at most a kernel
+    // tick, give them a generous 100ms tolerance.
+    const int64_t TOLERANCE_US = 100000L;
+    const int64_t mono_us = butil::monotonic_time_us();
+    const int64_t coarse_mono_us = butil::coarse_monotonic_time_us();
+    ASSERT_LE(labs(mono_us - coarse_mono_us), TOLERANCE_US);
+
+    const int64_t real_us = butil::gettimeofday_us();
+    const int64_t coarse_real_us = butil::coarse_gettimeofday_us();
+    ASSERT_LE(labs(real_us - coarse_real_us), TOLERANCE_US);
+
+    // Monotonicity.
+    int64_t last_us = butil::coarse_monotonic_time_us();
+    for (int i = 0; i < 1000; ++i) {
+        const int64_t now_us = butil::coarse_monotonic_time_us();
+        ASSERT_GE(now_us, last_us);
+        last_us = now_us;
+    }
+}
+
 TEST(BaiduTimeTest, timespec) {
     timespec ts1 = { 0, -1 };
     butil::timespec_normalize(&ts1);
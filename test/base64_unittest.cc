@@ -24,4 +24,29 @@ TEST(Base64Test, Basic) {
   EXPECT_EQ(kText, decoded);
 }
 
+TEST(Base64Test, LongRoundTrip) {
+  // Long enough to exercise the vectorized bulk path at every tail length.
+  std::string input;
+  for (int i = 0; i < 1000; ++i)
+    input.push_back(static_cast<char>(i * 31 + i / 7));
+  for (size_t len = 0; len <= input.size(); len += 13) {
+    std::string encoded;
+    std::string decoded;
+    Base64Encode(input.substr(0, len), &encoded);
+    EXPECT_TRUE(Base64Decode(encoded, &decoded));
+    EXPECT_EQ(input.substr(0, len), decoded) << "len=" << len;
+  }
+}
+
+TEST(Base64Test, InvalidInput) {
+  std::string encoded;
+  Base64Encode(std::string(100, 'x'), &encoded);
+  std::string decoded;
+  for (size_t pos = 0; pos < encoded.size(); pos += 7) {
+    std::string bad = encoded;
+    bad[pos] = '#';
+    EXPECT_FALSE(Base64Decode(bad, &decoded)) << "pos=" << pos;
+  }
+}
+
 }  // namespace butil
@@ -0,0 +1,196 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// brpc - A framework to host and access services throughout Baidu.
+
+#include <gtest/gtest.h>
+#include "brpc/baggage.h"
+#include "brpc/server.h"
+#include "brpc/channel.h"
+#include "brpc/controller.h"
+#include "echo.pb.h"
+
+int main(int argc, char* argv[]) {
+    testing::InitGoogleTest(&argc, argv);
+    GFLAGS_NS::ParseCommandLineFlags(&argc, &argv, true);
+    return RUN_ALL_TESTS();
+}
+
+namespace {
+
+TEST(BaggageTest, append_and_find) {
+    butil::IOBuf baggage;
+    std::string value;
+    ASSERT_FALSE(brpc::FindBaggage(baggage, "trace", &value));
+
+    ASSERT_EQ(0, brpc::AppendBaggage(&baggage, "trace", "abc"));
+    ASSERT_EQ(0, brpc::AppendBaggage(&baggage, "tenant", ""));
+    ASSERT_TRUE(brpc::FindBaggage(baggage, "trace", &value));
+    ASSERT_EQ("abc", value);
+    ASSERT_TRUE(brpc::FindBaggage(baggage, "tenant", &value));
+    ASSERT_EQ("", value);
+    ASSERT_FALSE(brpc::FindBaggage(baggage, "nope", &value));
+
+    // Re-appending a key overrides it, the last occurrence wins.
+    ASSERT_EQ(0, brpc::AppendBaggage(&baggage, "trace", "def"));
+    ASSERT_TRUE(brpc::FindBaggage(baggage, "trace", &value));
+    ASSERT_EQ("def", value);
+}
+
+TEST(BaggageTest, bounded_by_flag) {
+    ASSERT_FALSE(GFLAGS_NS::SetCommandLineOption(
+        "max_baggage_size", "32").empty());
+    butil::IOBuf baggage;
+    ASSERT_EQ(0, brpc::AppendBaggage(&baggage, "key", "0123456789"));
+    // 17 bytes used, another pair of the same size exceeds 32.
+    ASSERT_EQ(-1, brpc::AppendBaggage(&baggage, "key", "0123456789"));
+    ASSERT_EQ(17u, baggage.size());
+    ASSERT_FALSE(GFLAGS_NS::SetCommandLineOption(
+        "max_baggage_size", "4096").empty());
+}
+
+class BackendService : public test::EchoService {
+public:
+    virtual void Echo(google::protobuf::RpcController* cntl_base,
+                      const test::EchoRequest*,
+                      test::EchoResponse* response,
+                      google::protobuf::Closure* done) {
+        brpc::ClosureGuard done_guard(done);
+        brpc::Controller* cntl = static_cast<brpc::Controller*>(cntl_base);
+        std::string value;
+        if (cntl->get_request_baggage("trace", &value)) {
+            response->set_message(value);
+        } else {
+            response->set_message("(no baggage)");
+        }
+    }
+};
+
+// Calls the backend without touching baggage: the received bytes must be
+// passed through automatically.
+class ProxyService : public test::EchoService {
+public:
+    explicit ProxyService(brpc::Channel* backend) : _backend(backend) {}
+    virtual void Echo(google::protobuf::RpcController*,
+                      const test::EchoRequest* request,
+                      test::EchoResponse* response,
+                      google::protobuf::Closure* done) {
+        brpc::ClosureGuard done_guard(done);
+        brpc::Controller backend_cntl;
+        test::EchoService_Stub stub(_backend);
+        stub.Echo(&backend_cntl, request, response, NULL);
+        EXPECT_FALSE(backend_cntl.Failed()) << backend_cntl.ErrorText();
+    }
+private:
+    brpc::Channel* _backend;
+};
+
+TEST(BaggageTest, propagated_through_passthrough_hop) {
+    BackendService backend_impl;
+    brpc::Server backend_server;
+    ASSERT_EQ(0, backend_server.AddService(&backend_impl,
+                                           brpc::SERVER_DOESNT_OWN_SERVICE));
+    ASSERT_EQ(0, backend_server.Start(8713, NULL));
+
+    brpc::Channel backend_channel;
+    ASSERT_EQ(0, backend_channel.Init("127.0.0.1:8713", NULL));
+
+    ProxyService proxy_impl(&backend_channel);
+    brpc::Server proxy_server;
+    ASSERT_EQ(0, proxy_server.AddService(&proxy_impl,
+                                         brpc::SERVER_DOESNT_OWN_SERVICE));
+    ASSERT_EQ(0, proxy_server.Start(8714, NULL));
+
+    brpc::Channel proxy_channel;
+    ASSERT_EQ(0, proxy_channel.Init("127.0.0.1:8714", NULL));
+    test::EchoService_Stub stub(&proxy_channel);
+
+    // Baggage set at the origin arrives at the backend through the proxy
+    // which never looked at it.
+    {
+        brpc::Controller cntl;
+        test::EchoRequest req;
+        test::EchoResponse res;
+        req.set_message("hello");
+        ASSERT_EQ(0, cntl.set_request_baggage("trace", "abc123"));
+        stub.Echo(&cntl, &req, &res, NULL);
+        ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+        ASSERT_EQ("abc123", res.message());
+    }
+    // Requests without baggage stay without it.
+    {
+        brpc::Controller cntl;
+        test::EchoRequest req;
+        test::EchoResponse res;
+        req.set_message("hello");
+        stub.Echo(&cntl, &req, &res, NULL);
+        ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+        ASSERT_EQ("(no baggage)", res.message());
+    }
+
+    proxy_server.Stop(0);
+    proxy_server.Join();
+    backend_server.Stop(0);
+    backend_server.Join();
+}
+
+// Baggage lives inside the request submessage of the rpc meta, so
+// baggage-carrying requests must skip the -cache_serialized_rpc_meta
+// skeleton path instead of having the baggage silently dropped.
+TEST(BaggageTest, not_dropped_by_cached_rpc_meta) {
+    BackendService backend_impl;
+    brpc::Server server;
+    ASSERT_EQ(0, server.AddService(&backend_impl,
+                                   brpc::SERVER_DOESNT_OWN_SERVICE));
+    ASSERT_EQ(0, server.Start(8718, NULL));
+
+    ASSERT_FALSE(GFLAGS_NS::SetCommandLineOption(
+        "cache_serialized_rpc_meta", "true").empty());
+
+    brpc::Channel channel;
+    ASSERT_EQ(0, channel.Init("127.0.0.1:8718", NULL));
+    test::EchoService_Stub stub(&channel);
+
+    // Warm up the skeleton cache with a baggage-less request.
+    {
+        brpc::Controller cntl;
+        test::EchoRequest req;
+        test::EchoResponse res;
+        req.set_message("hello");
+        stub.Echo(&cntl, &req, &res, NULL);
+        ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+        ASSERT_EQ("(no baggage)", res.message());
+    }
+    // The baggage must still arrive with the cached skeleton in place.
+    {
+        brpc::Controller cntl;
+        test::EchoRequest req;
+        test::EchoResponse res;
+        req.set_message("hello");
+        ASSERT_EQ(0, cntl.set_request_baggage("trace", "abc123"));
+        stub.Echo(&cntl, &req, &res, NULL);
+        ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+        ASSERT_EQ("abc123", res.message());
+    }
+
+    ASSERT_FALSE(GFLAGS_NS::SetCommandLineOption(
+        "cache_serialized_rpc_meta", "false").empty());
+    server.Stop(0);
+    server.Join();
+}
+
+} // namespace
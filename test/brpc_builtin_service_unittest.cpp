@@ -47,9 +47,12 @@
 #include "brpc/builtin/rpcz_service.h"         // RpczService
 #include "brpc/builtin/dir_service.h"          // DirService
 #include "brpc/builtin/pprof_service.h"        // PProfService
+#include "brpc/builtin/flamegraph.h"           // MakeFlameGraphFromProfile
+#include "butil/file_util.h"                   // butil::WriteFile
 #include "brpc/builtin/bthreads_service.h"     // BthreadsService
 #include "brpc/builtin/ids_service.h"          // IdsService
 #include "brpc/builtin/sockets_service.h"      // SocketsService
+#include "brpc/builtin/contentions_service.h"  // ContentionsService
 #include "brpc/builtin/common.h"
 #include "brpc/builtin/bad_method_service.h"
 #include "echo.pb.h"
@@ -63,6 +66,10 @@ DECLARE_bool(rpcz_hex_log_id);
 DECLARE_int32(idle_timeout_second);
 } // namespace rpc
 
+namespace bthread {
+DECLARE_int32(bthread_contention_recorder_sample_rate);
+} // namespace bthread
+
 int main(int argc, char* argv[]) {
     brpc::FLAGS_idle_timeout_second = 0;
     testing::InitGoogleTest(&argc, argv);
@@ -557,6 +564,31 @@ TEST_F(BuiltinServiceTest, status) {
     TestStatus(true);
 }
 
+TEST_F(BuiltinServiceTest, status_json) {
+    brpc::StatusService service;
+    brpc::StatusRequest req;
+    brpc::StatusResponse res;
+    EchoServiceImpl echo_svc;
+    ASSERT_EQ(0, _server.AddService(
+        &echo_svc, brpc::SERVER_DOESNT_OWN_SERVICE));
+    for (int i = 0; i < 2; ++i) {  // 2nd round hits the json cache
+        brpc::Controller cntl;
+        ClosureChecker done;
+        SetUpController(&cntl, false);
+        cntl.http_request().uri() = "/status?format=json";
+        service.default_method(&cntl, &req, &res, &done);
+        EXPECT_FALSE(cntl.Failed());
+        EXPECT_EQ("application/json", cntl.http_response().content_type());
+        const std::string body = cntl.response_attachment().to_string();
+        EXPECT_EQ('{', body[0]);
+        EXPECT_NE(std::string::npos, body.find("\"services\""));
+        EXPECT_NE(std::string::npos,
+                  body.find(test::EchoService::descriptor()->full_name()));
+        EXPECT_NE(std::string::npos, body.find("\"Echo\":{\"count\":"));
+    }
+    ASSERT_EQ(0, _server.RemoveService(&echo_svc));
+}
+
 TEST_F(BuiltinServiceTest, list) {
     brpc::ListService service(&_server);
     brpc::ListRequest req;
@@ -689,6 +721,31 @@ TEST_F(BuiltinServiceTest, pprof) {
     }
 }
 
+TEST_F(BuiltinServiceTest, native_flamegraph) {
+    // Synthesize a minimal binary CPU profile: header, two records sharing
+    // a frame, trailer.
+    const uintptr_t pc1 = (uintptr_t)&ProfilerFlush;
+    const uintptr_t pc2 = (uintptr_t)&getpid;
+    const uintptr_t slots[] = {
+        0, 3, 0, 10000, 0,
+        3, 2, pc1, pc2,
+        2, 1, pc2,
+        0, 1, 0
+    };
+    const char* path = "test_native_flamegraph.prof";
+    butil::WriteFile(butil::FilePath(path),
+                     (const char*)slots, sizeof(slots));
+    butil::IOBuf svg;
+    ASSERT_EQ(0, brpc::MakeFlameGraphFromProfile(path, &svg));
+    const std::string s = svg.to_string();
+    ASSERT_NE(std::string::npos, s.find("<svg "));
+    ASSERT_NE(std::string::npos, s.find("5 samples"));  // the "all" frame
+    // A corrupted profile must be rejected.
+    butil::WriteFile(butil::FilePath(path), "not a profile", 13);
+    ASSERT_EQ(-1, brpc::MakeFlameGraphFromProfile(path, &svg));
+    unlink(path);
+}
+
 TEST_F(BuiltinServiceTest, dir) {
     brpc::DirService service;
     brpc::DirRequest req;
@@ -800,6 +857,39 @@ TEST_F(BuiltinServiceTest, bthreads) {
     }    
 }
 
+void* lock_bthread_mutex(void* arg) {
+    bthread_mutex_t* m = (bthread_mutex_t*)arg;
+    bthread_mutex_lock(m);
+    bthread_mutex_unlock(m);
+    return NULL;
+}
+
+TEST_F(BuiltinServiceTest, contentions) {
+    const int saved_rate =
+        bthread::FLAGS_bthread_contention_recorder_sample_rate;
+    bthread::FLAGS_bthread_contention_recorder_sample_rate = 1;
+    // Make a contended locking to be recorded.
+    bthread_mutex_t m;
+    ASSERT_EQ(0, bthread_mutex_init(&m, NULL));
+    ASSERT_EQ(0, bthread_mutex_lock(&m));
+    bthread_t th;
+    ASSERT_EQ(0, bthread_start_background(&th, NULL, lock_bthread_mutex, &m));
+    bthread_usleep(100000);
+    ASSERT_EQ(0, bthread_mutex_unlock(&m));
+    ASSERT_EQ(0, bthread_join(th, NULL));
+    ASSERT_EQ(0, bthread_mutex_destroy(&m));
+
+    brpc::ContentionsService service;
+    brpc::ContentionsRequest req;
+    brpc::ContentionsResponse res;
+    ClosureChecker done;
+    brpc::Controller cntl;
+    service.bthread(&cntl, &req, &res, &done);
+    EXPECT_FALSE(cntl.Failed());
+    CheckContent(cntl, "wait_ns=");
+    bthread::FLAGS_bthread_contention_recorder_sample_rate = saved_rate;
+}
+
 TEST_F(BuiltinServiceTest, sockets) {
     brpc::SocketsService service;
     brpc::SocketsRequest req;
@@ -514,6 +514,39 @@ protected:
     };
 
 
+    class SetCodeAndSleepOnOdd : public SetCode {
+    public:
+        brpc::SubCall Map(
+            int channel_index,
+            const google::protobuf::MethodDescriptor* method,
+            const google::protobuf::Message* req_base,
+            google::protobuf::Message* response) {
+            test::EchoRequest* req = brpc::Clone<test::EchoRequest>(req_base);
+            req->set_code(channel_index + 1/*non-zero*/);
+            if (channel_index % 2) {
+                // Odd sub channels are stragglers.
+                req->set_sleep_us(2000000);
+            }
+            return brpc::SubCall(method, req, response->New(),
+                                 brpc::DELETE_REQUEST | brpc::DELETE_RESPONSE);
+        }
+    };
+
+    class Broadcaster : public brpc::CallMapper {
+    public:
+        brpc::SubCall Map(
+            int /*channel_index*/,
+            const google::protobuf::MethodDescriptor* method,
+            const google::protobuf::Message* request,
+            google::protobuf::Message* response) {
+            // Pass the request through so that it can share the serialized
+            // bytes when ParallelChannelOptions.share_serialized_request
+            // is on.
+            return brpc::SubCall(method, request, response->New(),
+                                 brpc::DELETE_RESPONSE);
+        }
+    };
+
     class GetReqAndAddRes : public brpc::CallMapper {
         brpc::SubCall Map(
             int channel_index,
@@ -586,6 +619,104 @@ protected:
         StopAndJoin();
     }
 
+    void TestSuccessShareSerializedRequestParallel(
+        bool single_server, bool async, bool short_connection) {
+        std::cout << " *** single=" << single_server
+                  << " async=" << async
+                  << " short=" << short_connection << std::endl;
+
+        ASSERT_EQ(0, StartAccept(_ep));
+        const size_t NCHANS = 8;
+        brpc::Channel subchans[NCHANS];
+        brpc::ParallelChannel channel;
+        brpc::ParallelChannelOptions options;
+        options.share_serialized_request = true;
+        ASSERT_EQ(0, channel.Init(&options));
+        for (size_t i = 0; i < NCHANS; ++i) {
+            SetUpChannel(&subchans[i], single_server, short_connection);
+            // Mix mapper-less sub channels with ones whose mapper passes
+            // the request through, both should use the shared bytes.
+            ASSERT_EQ(0, channel.AddChannel(
+                          &subchans[i], brpc::DOESNT_OWN_CHANNEL,
+                          ((i % 2) ? new Broadcaster : NULL), NULL));
+        }
+        brpc::Controller cntl;
+        test::EchoRequest req;
+        test::EchoResponse res;
+        req.set_message(__FUNCTION__);
+        req.set_code(23);
+        CallMethod(&channel, &cntl, &req, &res, async);
+
+        EXPECT_EQ(0, cntl.ErrorCode()) << cntl.ErrorText();
+        EXPECT_EQ(NCHANS, (size_t)cntl.sub_count());
+        for (int i = 0; i < cntl.sub_count(); ++i) {
+            EXPECT_TRUE(cntl.sub(i) && !cntl.sub(i)->Failed()) << "i=" << i;
+        }
+        EXPECT_EQ("received " + std::string(__FUNCTION__), res.message());
+        ASSERT_EQ(NCHANS, (size_t)res.code_list_size());
+        for (size_t i = 0; i < NCHANS; ++i) {
+            ASSERT_EQ(req.code(), res.code_list(i));
+        }
+        if (short_connection) {
+            // Sleep to let `_messenger' detect `Socket' being `SetFailed'
+            const int64_t start_time = butil::gettimeofday_us();
+            while (_messenger.ConnectionCount() != 0) {
+                EXPECT_LT(butil::gettimeofday_us(), start_time + 100000L/*100ms*/);
+                bthread_usleep(1000);
+            }
+        } else {
+            EXPECT_GE(1ul, _messenger.ConnectionCount());
+        }
+        StopAndJoin();
+    }
+
+    void TestSuccessLimitParallel(
+        bool single_server, bool async, bool short_connection) {
+        std::cout << " *** single=" << single_server
+                  << " async=" << async
+                  << " short=" << short_connection << std::endl;
+
+        ASSERT_EQ(0, StartAccept(_ep));
+        const size_t NCHANS = 4;
+        brpc::Channel subchans[NCHANS];
+        brpc::ParallelChannel channel;
+        brpc::ParallelChannelOptions options;
+        // Stragglers must be canceled by the quorum, not by the timeout.
+        options.timeout_ms = 5000;
+        options.success_limit = NCHANS / 2;
+        ASSERT_EQ(0, channel.Init(&options));
+        for (size_t i = 0; i < NCHANS; ++i) {
+            SetUpChannel(&subchans[i], single_server, short_connection);
+            ASSERT_EQ(0, channel.AddChannel(
+                          &subchans[i], brpc::DOESNT_OWN_CHANNEL,
+                          new SetCodeAndSleepOnOdd, NULL));
+        }
+        brpc::Controller cntl;
+        test::EchoRequest req;
+        test::EchoResponse res;
+        req.set_message(__FUNCTION__);
+        const int64_t start_us = butil::gettimeofday_us();
+        CallMethod(&channel, &cntl, &req, &res, async);
+
+        EXPECT_EQ(0, cntl.ErrorCode()) << cntl.ErrorText();
+        // Returned once the fast half responded, far before the 2s sleep
+        // of the stragglers.
+        EXPECT_LT(butil::gettimeofday_us() - start_us, 2000000L);
+        EXPECT_EQ(NCHANS, (size_t)cntl.sub_count());
+        int nsucceed = 0;
+        for (int i = 0; i < cntl.sub_count(); ++i) {
+            if (cntl.sub(i) != NULL && !cntl.sub(i)->Failed()) {
+                ++nsucceed;
+            } else if (i % 2) {
+                EXPECT_EQ(ECANCELED, cntl.sub(i)->ErrorCode()) << "i=" << i;
+            }
+        }
+        EXPECT_GE(nsucceed, options.success_limit);
+        EXPECT_EQ("received " + std::string(__FUNCTION__), res.message());
+        EXPECT_GE(res.code_list_size(), options.success_limit);
+        StopAndJoin();
+    }
+
     void TestSuccessDuplicatedParallel(
         bool single_server, bool async, bool short_connection) {
         std::cout << " *** single=" << single_server
@@ -2080,6 +2211,139 @@ TEST_F(ChannelTest, success) {
     }
 }
 
+TEST_F(ChannelTest, connection_stripes_to_single_server) {
+    ASSERT_EQ(0, StartAccept(_ep));
+    {
+        brpc::Channel channel;
+        brpc::ChannelOptions opt;
+        opt.connections_per_endpoint = 0;
+        ASSERT_EQ(-1, channel.Init(_ep, &opt));
+    }
+    const int NSTRIPES = 3;
+    brpc::Channel channel;
+    brpc::ChannelOptions opt;
+    opt.connections_per_endpoint = NSTRIPES;
+    ASSERT_EQ(0, channel.Init(_ep, &opt));
+    for (int i = 0; i < 32; ++i) {
+        brpc::Controller cntl;
+        test::EchoRequest req;
+        test::EchoResponse res;
+        req.set_message(__FUNCTION__);
+        CallMethod(&channel, &cntl, &req, &res, false);
+        ASSERT_EQ(0, cntl.ErrorCode()) << cntl.ErrorText();
+        ASSERT_EQ("received " + std::string(__FUNCTION__), res.message());
+        ASSERT_EQ(_ep, cntl.remote_side());
+    }
+    // Hashed correlation ids should have hit every stripe by now and
+    // stripes connect separately even to the same endpoint.
+    EXPECT_EQ((size_t)NSTRIPES, _messenger.ConnectionCount());
+    StopAndJoin();
+}
+
+class CountingBackupRequestPolicy : public brpc::BackupRequestPolicy {
+public:
+    CountingBackupRequestPolicy(int32_t backup_ms, bool allow_backup)
+        : _backup_ms(backup_ms)
+        , _allow_backup(allow_backup)
+        , nget(0), ndo(0), nend(0) {}
+    int32_t GetBackupRequestMs(const brpc::Controller*) const {
+        ++nget;
+        return _backup_ms;
+    }
+    bool DoBackup(const brpc::Controller*) {
+        ++ndo;
+        return _allow_backup;
+    }
+    void OnRPCEnd(const brpc::Controller*) { ++nend; }
+
+    int32_t _backup_ms;
+    bool _allow_backup;
+    mutable int nget;
+    int ndo;
+    int nend;
+};
+
+TEST_F(ChannelTest, backup_request_policy) {
+    ASSERT_EQ(0, StartAccept(_ep));
+    {
+        // The policy triggers a backup request while the original call
+        // is sleeping in the server.
+        CountingBackupRequestPolicy policy(10, true);
+        brpc::Channel channel;
+        brpc::ChannelOptions opt;
+        opt.timeout_ms = 5000;
+        opt.backup_request_policy = &policy;
+        ASSERT_EQ(0, channel.Init(_ep, &opt));
+        brpc::Controller cntl;
+        test::EchoRequest req;
+        test::EchoResponse res;
+        req.set_message(__FUNCTION__);
+        req.set_sleep_us(100000);
+        CallMethod(&channel, &cntl, &req, &res, false);
+        EXPECT_EQ(0, cntl.ErrorCode()) << cntl.ErrorText();
+        EXPECT_TRUE(cntl.has_backup_request());
+        EXPECT_EQ(1, policy.nget);
+        EXPECT_EQ(1, policy.ndo);
+        EXPECT_EQ(1, policy.nend);
+    }
+    {
+        // The policy denies the backup request(budget ran out), the call
+        // just keeps waiting for the original response.
+        CountingBackupRequestPolicy policy(10, false);
+        brpc::Channel channel;
+        brpc::ChannelOptions opt;
+        opt.timeout_ms = 5000;
+        opt.backup_request_policy = &policy;
+        ASSERT_EQ(0, channel.Init(_ep, &opt));
+        brpc::Controller cntl;
+        test::EchoRequest req;
+        test::EchoResponse res;
+        req.set_message(__FUNCTION__);
+        req.set_sleep_us(100000);
+        CallMethod(&channel, &cntl, &req, &res, false);
+        EXPECT_EQ(0, cntl.ErrorCode()) << cntl.ErrorText();
+        EXPECT_FALSE(cntl.has_backup_request());
+        EXPECT_EQ(1, policy.ndo);
+        EXPECT_EQ(1, policy.nend);
+    }
+    {
+        // A negative delay disables backup request for the call.
+        CountingBackupRequestPolicy policy(-1, true);
+        brpc::Channel channel;
+        brpc::ChannelOptions opt;
+        opt.backup_request_policy = &policy;
+        ASSERT_EQ(0, channel.Init(_ep, &opt));
+        brpc::Controller cntl;
+        test::EchoRequest req;
+        test::EchoResponse res;
+        req.set_message(__FUNCTION__);
+        CallMethod(&channel, &cntl, &req, &res, false);
+        EXPECT_EQ(0, cntl.ErrorCode()) << cntl.ErrorText();
+        EXPECT_FALSE(cntl.has_backup_request());
+        EXPECT_EQ(0, policy.ndo);
+        EXPECT_EQ(1, policy.nend);
+    }
+    StopAndJoin();
+}
+
+TEST_F(ChannelTest, adaptive_backup_request_policy_budget) {
+    brpc::AdaptiveBackupRequestPolicy policy(0.99, 50);
+    brpc::Controller cntl;
+    // No latency collected yet, backup requests are disabled.
+    ASSERT_EQ(-1, policy.GetBackupRequestMs(&cntl));
+    // Tokens start at full burst(100 backup requests).
+    for (int i = 0; i < 100; ++i) {
+        ASSERT_TRUE(policy.DoBackup(&cntl)) << "i=" << i;
+    }
+    ASSERT_FALSE(policy.DoBackup(&cntl));
+    // At 50%, two finished calls afford one more backup request.
+    policy.OnRPCEnd(&cntl);
+    ASSERT_FALSE(policy.DoBackup(&cntl));
+    policy.OnRPCEnd(&cntl);
+    ASSERT_TRUE(policy.DoBackup(&cntl));
+    ASSERT_FALSE(policy.DoBackup(&cntl));
+}
+
 TEST_F(ChannelTest, success_parallel) {
     for (int i = 0; i <= 1; ++i) { // Flag SingleServer 
         for (int j = 0; j <= 1; ++j) { // Flag Asynchronous
@@ -2090,6 +2354,26 @@ TEST_F(ChannelTest, success_parallel) {
     }
 }
 
+TEST_F(ChannelTest, success_parallel_share_serialized_request) {
+    for (int i = 0; i <= 1; ++i) { // Flag SingleServer
+        for (int j = 0; j <= 1; ++j) { // Flag Asynchronous
+            for (int k = 0; k <=1; ++k) { // Flag ShortConnection
+                TestSuccessShareSerializedRequestParallel(i, j, k);
+            }
+        }
+    }
+}
+
+TEST_F(ChannelTest, success_limit_parallel) {
+    for (int i = 0; i <= 1; ++i) { // Flag SingleServer
+        for (int j = 0; j <= 1; ++j) { // Flag Asynchronous
+            for (int k = 0; k <=1; ++k) { // Flag ShortConnection
+                TestSuccessLimitParallel(i, j, k);
+            }
+        }
+    }
+}
+
 TEST_F(ChannelTest, success_duplicated_parallel) {
     for (int i = 0; i <= 1; ++i) { // Flag SingleServer 
         for (int j = 0; j <= 1; ++j) { // Flag Asynchronous
@@ -48,6 +48,7 @@ const int kThreadNum = 3;
 } // namespace
 
 namespace brpc {
+DECLARE_int32(circuit_breaker_feedback_batch_size);
 DECLARE_int32(circuit_breaker_short_window_size);
 DECLARE_int32(circuit_breaker_long_window_size);
 DECLARE_int32(circuit_breaker_short_window_error_percent);
@@ -160,6 +161,51 @@ TEST_F(CircuitBreakerTest, should_isolate) {
     }
 }
 
+TEST_F(CircuitBreakerTest, batched_feedback) {
+    // The batch size is read when the breaker is constructed.
+    brpc::FLAGS_circuit_breaker_feedback_batch_size = 32;
+    std::unique_ptr<brpc::CircuitBreaker> batched_breaker(
+        new brpc::CircuitBreaker);
+    brpc::FLAGS_circuit_breaker_feedback_batch_size = 1;
+
+    std::vector<pthread_t> thread_list;
+    std::vector<std::unique_ptr<FeedbackControl>> fc_list;
+    for (int i = 0; i < kThreadNum; ++i) {
+        pthread_t tid = 0;
+        FeedbackControl* fc = new FeedbackControl(
+            2 * kLongWindowSize, 3, batched_breaker.get());
+        fc_list.emplace_back(fc);
+        pthread_create(&tid, nullptr, feed_back_thread, fc);
+        thread_list.push_back(tid);
+    }
+    for (int i = 0; i < kThreadNum; ++i) {
+        void* ret_data = nullptr;
+        ASSERT_EQ(pthread_join(thread_list[i], &ret_data), 0);
+        FeedbackControl* fc = static_cast<FeedbackControl*>(ret_data);
+        EXPECT_EQ(fc->_unhealthy_cnt, 0);
+        EXPECT_TRUE(fc->_healthy);
+    }
+
+    batched_breaker->Reset();
+    thread_list.clear();
+    fc_list.clear();
+    for (int i = 0; i < kThreadNum; ++i) {
+        pthread_t tid = 0;
+        FeedbackControl* fc = new FeedbackControl(
+            2 * kLongWindowSize, 50, batched_breaker.get());
+        fc_list.emplace_back(fc);
+        pthread_create(&tid, nullptr, feed_back_thread, fc);
+        thread_list.push_back(tid);
+    }
+    for (int i = 0; i < kThreadNum; ++i) {
+        void* ret_data = nullptr;
+        ASSERT_EQ(pthread_join(thread_list[i], &ret_data), 0);
+        FeedbackControl* fc = static_cast<FeedbackControl*>(ret_data);
+        EXPECT_GT(fc->_unhealthy_cnt, 0);
+        EXPECT_FALSE(fc->_healthy);
+    }
+}
+
 TEST_F(CircuitBreakerTest, isolation_duration_grow_and_reset) {
     std::vector<pthread_t> thread_list;
     std::vector<std::unique_ptr<FeedbackControl>> fc_list;
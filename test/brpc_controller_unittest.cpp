@@ -72,3 +72,23 @@ TEST_F(ControllerTest, notify_on_destruction) {
     delete cntl;
     ASSERT_TRUE(cancel);
 }
+
+TEST_F(ControllerTest, pooled_controller) {
+    brpc::Controller* cntl = brpc::GetPooledController();
+    ASSERT_TRUE(cntl != NULL);
+    ASSERT_FALSE(cntl->Failed());
+    cntl->SetFailed(ECANCELED, "set a failure");
+    cntl->request_attachment().append("dirty");
+    brpc::ReturnPooledController(cntl);
+
+    // The freshly got Controller is likely the one just returned and must
+    // be in its initial state again.
+    brpc::Controller* cntl2 = brpc::GetPooledController();
+    ASSERT_TRUE(cntl2 != NULL);
+    ASSERT_FALSE(cntl2->Failed());
+    ASSERT_EQ(0, cntl2->ErrorCode());
+    ASSERT_TRUE(cntl2->request_attachment().empty());
+    brpc::ReturnPooledController(cntl2);
+    // Returning NULL is a no-op.
+    brpc::ReturnPooledController(NULL);
+}
@@ -267,3 +267,40 @@ TEST_F(EventDispatcherTest, dispatch_tasks) {
     ASSERT_EQ(NCLIENT, info.free_item_num - old_info.free_item_num);
 #endif
 }
+
+namespace brpc {
+DECLARE_bool(event_dispatcher_nonblocking);
+}
+
+TEST_F(EventDispatcherTest, nonblocking_poll) {
+    // Reloadable, takes effect at the dispatcher's next poll.
+    brpc::FLAGS_event_dispatcher_nonblocking = true;
+    client_stop = false;
+
+    int fds[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    SocketExtra* sm = new SocketExtra;
+    butil::make_non_blocking(fds[0]);
+    brpc::SocketId socket_id;
+    brpc::SocketOptions options;
+    options.fd = fds[0];
+    options.user = sm;
+    options.on_edge_triggered_events = SocketExtra::OnEdgeTriggeredEvents;
+    ASSERT_EQ(0, brpc::Socket::Create(options, &socket_id));
+
+    ClientMeta* cm = new ClientMeta;
+    cm->fd = fds[1];
+    cm->times = 0;
+    cm->bytes = 0;
+    pthread_t cth;
+    ASSERT_EQ(0, pthread_create(&cth, NULL, client_thread, cm));
+
+    usleep(500 * 1000);
+    client_stop = true;
+    pthread_join(cth, NULL);
+
+    // Events are still dispatched when dispatchers poll nonblockingly.
+    ASSERT_GT(sm->bytes, 0ul);
+    brpc::FLAGS_event_dispatcher_nonblocking = false;
+    sleep(1);  // let the socket be recycled
+}
@@ -23,6 +23,8 @@
 #include "brpc/channel.h"
 #include "brpc/grpc.h"
 #include "butil/time.h"
+#include "butil/string_printf.h"
+#include "butil/sys_byteorder.h"
 #include "grpc.pb.h"
 
 int main(int argc, char* argv[]) {
@@ -153,6 +155,68 @@ TEST_F(GrpcTest, percent_decode) {
     EXPECT_TRUE(out == s2_expected_out) << s2_expected_out << " vs " << out;
 }
 
+static void AppendPrefixedMessage(butil::IOBuf* buf, const std::string& msg,
+                                  bool compressed) {
+    char prefix[5];
+    prefix[0] = (compressed ? 1 : 0);
+    *(uint32_t*)(prefix + 1) = butil::HostToNet32(msg.size());
+    buf->append(prefix, sizeof(prefix));
+    buf->append(msg);
+}
+
+TEST_F(GrpcTest, parse_grpc_messages) {
+    // A batch of small messages is sliced in one pass.
+    butil::IOBuf body;
+    const int N = 1000;
+    for (int i = 0; i < N; ++i) {
+        AppendPrefixedMessage(&body, butil::string_printf("msg_%d", i), i % 2);
+    }
+    std::vector<brpc::GrpcMessage> msgs;
+    ASSERT_EQ((ssize_t)N, brpc::ParseGrpcMessages(body, &msgs));
+    ASSERT_EQ((size_t)N, msgs.size());
+    for (int i = 0; i < N; ++i) {
+        EXPECT_EQ(butil::string_printf("msg_%d", i), msgs[i].data.to_string());
+        EXPECT_EQ(i % 2 != 0, msgs[i].compressed);
+    }
+
+    // Empty body has no messages.
+    msgs.clear();
+    ASSERT_EQ(0, brpc::ParseGrpcMessages(butil::IOBuf(), &msgs));
+    ASSERT_TRUE(msgs.empty());
+
+    // Empty message is fine.
+    butil::IOBuf empty_msg;
+    AppendPrefixedMessage(&empty_msg, "", false);
+    msgs.clear();
+    ASSERT_EQ(1, brpc::ParseGrpcMessages(empty_msg, &msgs));
+    ASSERT_TRUE(msgs[0].data.empty());
+
+    // Truncated prefix.
+    butil::IOBuf bad;
+    bad.append("\0\0\0", 3);
+    msgs.clear();
+    ASSERT_EQ(-1, brpc::ParseGrpcMessages(bad, &msgs));
+
+    // Truncated message: claims 4 bytes, carries 3.
+    bad.clear();
+    AppendPrefixedMessage(&bad, "abcd", false);
+    butil::IOBuf truncated;
+    bad.cutn(&truncated, bad.size() - 1);
+    msgs.clear();
+    ASSERT_EQ(-1, brpc::ParseGrpcMessages(truncated, &msgs));
+
+    // Reserved compression values are rejected, intact leading messages
+    // are still returned.
+    butil::IOBuf mixed;
+    AppendPrefixedMessage(&mixed, "ok", false);
+    char bad_prefix[5] = { 2, 0, 0, 0, 0 };
+    mixed.append(bad_prefix, sizeof(bad_prefix));
+    msgs.clear();
+    ASSERT_EQ(-1, brpc::ParseGrpcMessages(mixed, &msgs));
+    ASSERT_EQ(1u, msgs.size());
+    EXPECT_EQ("ok", msgs[0].data.to_string());
+}
+
 TEST_F(GrpcTest, sanity) {
     for (int i = 0; i < 2; ++i) { // if req use gzip or not
         for (int j = 0; j < 2; ++j) { // if res use gzip or not
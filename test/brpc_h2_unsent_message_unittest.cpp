@@ -32,6 +32,56 @@ int main(int argc, char* argv[]) {
     return RUN_ALL_TESTS();
 }
 
+TEST(H2UnsentMessage, grpc_ok_response_fragments) {
+    brpc::SocketId id;
+    brpc::SocketUniquePtr h2_client_sock;
+    brpc::SocketOptions h2_client_options;
+    h2_client_options.user = brpc::get_client_side_messenger();
+    EXPECT_EQ(0, brpc::Socket::Create(h2_client_options, &id));
+    EXPECT_EQ(0, brpc::Socket::Address(id, &h2_client_sock));
+
+    brpc::policy::H2Context* ctx =
+        new brpc::policy::H2Context(h2_client_sock.get(), NULL);
+    CHECK_EQ(ctx->Init(), 0);
+    h2_client_sock->initialize_parsing_context(&ctx);
+    ctx->_remote_window_left = brpc::H2Settings::MAX_WINDOW_SIZE;
+
+    brpc::Controller cntl;
+    cntl.http_response().set_status_code(200);
+    cntl.http_response().set_content_type("application/grpc");
+    brpc::policy::H2UnsentResponse* res =
+        brpc::policy::H2UnsentResponse::New(&cntl, 1, true/*is_grpc*/);
+    butil::IOBuf out;
+    ASSERT_TRUE(res->AppendAndDestroySelf(&out, h2_client_sock.get()).ok());
+
+    // The response has an empty body: a HEADERS frame followed by the
+    // trailer HEADERS frame. Decode both header blocks with a fresh HPacker
+    // to verify that the pre-encoded fragments do not depend on the dynamic
+    // table of the connection.
+    brpc::HPacker hpacker;
+    ASSERT_EQ(0, hpacker.Init(brpc::H2Settings::DEFAULT_HEADER_TABLE_SIZE));
+    std::map<std::string, std::string> headers;
+    for (int nframe = 0; nframe < 2; ++nframe) {
+        char head[9];
+        ASSERT_EQ(sizeof(head), out.cutn(head, sizeof(head)));
+        const uint32_t payload_size =
+            ((uint8_t)head[0] << 16) | ((uint8_t)head[1] << 8) | (uint8_t)head[2];
+        ASSERT_EQ(0x1/*H2_FRAME_HEADERS*/, head[3]);
+        butil::IOBuf payload;
+        ASSERT_EQ((size_t)payload_size, out.cutn(&payload, payload_size));
+        while (!payload.empty()) {
+            brpc::HPacker::Header h;
+            ASSERT_GT(hpacker.Decode(&payload, &h), 0);
+            headers[h.name] = h.value;
+        }
+    }
+    ASSERT_TRUE(out.empty());
+    ASSERT_EQ("200", headers[":status"]);
+    ASSERT_EQ("application/grpc", headers["content-type"]);
+    ASSERT_EQ("0", headers["grpc-status"]);
+    ASSERT_EQ(0u, headers.count("grpc-message"));
+}
+
 TEST(H2UnsentMessage, request_throughput) {
     brpc::Controller cntl;
     butil::IOBuf request_buf;
@@ -57,6 +57,34 @@ TEST_F(HPackTest, header_with_indexing) {
     ASSERT_EQ(h.value, h2.value);
 }
 
+// Exercise the pair-wise huffman encoder on every byte value, including
+// the rare long codes which overflow the bit accumulator in pairs.
+TEST_F(HPackTest, huffman_all_bytes_roundtrip) {
+    brpc::HPacker p1;
+    ASSERT_EQ(0, p1.Init(4096));
+    brpc::HPacker p2;
+    ASSERT_EQ(0, p2.Init(4096));
+    std::string value;
+    for (int i = 0; i < 256; ++i) {
+        value.append(7, (char)i);  // odd count per byte value
+    }
+    brpc::HPacker::Header h;
+    h.name = "x-bin";
+    h.value = value;
+    brpc::HPackOptions options;
+    options.index_policy = brpc::HPACK_NOT_INDEX_HEADER;
+    options.encode_name = true;
+    options.encode_value = true;
+    butil::IOBufAppender buf;
+    p1.Encode(&buf, h, options);
+    const ssize_t nwrite = buf.buf().size();
+    brpc::HPacker::Header h2;
+    ssize_t nread = p2.Decode(&buf.buf(), &h2);
+    ASSERT_EQ(nread, nwrite);
+    ASSERT_EQ(h.name, h2.name);
+    ASSERT_EQ(h.value, h2.value);
+}
+
 TEST_F(HPackTest, header_without_indexing) {
     brpc::HPacker p1;
     ASSERT_EQ(0, p1.Init(4096));
@@ -21,11 +21,14 @@
 #include <google/protobuf/descriptor.h>
 
 #include "brpc/server.h"
+#include "brpc/restful.h"
 #include "brpc/details/http_message.h"
 #include "brpc/policy/http_rpc_protocol.h"
+#include "brpc/policy/gzip_compress.h"
 #include "echo.pb.h"
 
 namespace brpc {
+DECLARE_bool(http_stream_decompress_body);
 namespace policy {
 Server::MethodProperty*
 FindMethodPropertyByURI(const std::string& uri_path, const Server* server,
@@ -144,6 +147,41 @@ TEST(HttpMessageTest, request_sanity) {
     ASSERT_EQ("test", *header.GetHeader("Authorization"));
 }
 
+TEST(HttpMessageTest, reset) {
+    const char *http_request =
+        "POST /path/file.html?sdfsdf=sdfs HTTP/1.1\r\n"
+        "Content-Type: json\r\n"
+        "Content-Length: 19\r\n"
+        "Host: myhost\r\n"
+        "\r\n"
+        "Message Body sdfsdf\r\n"
+    ;
+    brpc::HttpMessage http_message;
+    ASSERT_EQ((ssize_t)strlen(http_request),
+              http_message.ParseFromArray(http_request, strlen(http_request)));
+    ASSERT_TRUE(http_message.Completed());
+
+    // A reset message must be able to parse a message from scratch again.
+    http_message.Reset();
+    ASSERT_EQ(0UL, http_message.parsed_length());
+    ASSERT_EQ(brpc::HTTP_ON_MESSAGE_BEGIN, http_message.stage());
+    ASSERT_TRUE(http_message.body().empty());
+    ASSERT_TRUE(NULL == http_message.header().GetHeader("Host"));
+
+    const char *http_response =
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: text/plain\r\n"
+        "Content-Length: 2\r\n"
+        "\r\n"
+        "OK"
+    ;
+    ASSERT_EQ((ssize_t)strlen(http_response),
+              http_message.ParseFromArray(http_response, strlen(http_response)));
+    ASSERT_TRUE(http_message.Completed());
+    ASSERT_EQ("text/plain", http_message.header().content_type());
+    ASSERT_EQ("OK", http_message.body().to_string());
+}
+
 TEST(HttpMessageTest, response_sanity) {
     const char *http_response = 
         "HTTP/12.34 410 GoneBlah\r\n"
@@ -226,6 +264,51 @@ TEST(HttpMessageTest, parse_from_iobuf) {
     ASSERT_EQ("text/plain", http_message.header().content_type());
 }
 
+TEST(HttpMessageTest, stream_decompress_body) {
+    brpc::FLAGS_http_stream_decompress_body = true;
+    std::string content;
+    for (size_t i = 0; i < 100000; ++i) {
+        content.push_back('a' + i % 26);
+    }
+    butil::IOBuf plain;
+    plain.append(content);
+    butil::IOBuf compressed;
+    ASSERT_TRUE(brpc::policy::GzipCompress(plain, &compressed, NULL));
+
+    char header[1024];
+    snprintf(header, sizeof(header),
+            "POST /service/method HTTP/1.1\r\n"
+            "Content-Type: text/plain\r\n"
+            "Content-Encoding: gzip\r\n"
+            "Content-Length: %lu\r\n"
+            "\r\n",
+            compressed.size());
+    butil::IOBuf request;
+    request.append(header);
+    request.append(compressed);
+
+    // Feed the message in small pieces as the network would.
+    brpc::HttpMessage http_message;
+    while (!request.empty()) {
+        butil::IOBuf piece;
+        request.cutn(&piece, 512);
+        ASSERT_TRUE(http_message.ParseFromIOBuf(piece) >= 0);
+    }
+    ASSERT_TRUE(http_message.Completed());
+    ASSERT_EQ(content, http_message.body().to_string());
+    // The body was inflated during parsing.
+    ASSERT_EQ(NULL, http_message.header().GetHeader("content-encoding"));
+
+    // A corrupted stream fails the parse.
+    butil::IOBuf bad_request;
+    bad_request.append(header);
+    bad_request.append("definitely-not-gzip-data");
+    brpc::HttpMessage http_message2;
+    ASSERT_EQ(-1, http_message2.ParseFromIOBuf(bad_request));
+
+    brpc::FLAGS_http_stream_decompress_body = false;
+}
+
 TEST(HttpMessageTest, find_method_property_by_uri) {
     brpc::Server server;
     ASSERT_EQ(0, server.AddService(new test::EchoService(),
@@ -285,6 +368,33 @@ TEST(HttpMessageTest, find_method_property_by_uri) {
     ASSERT_FALSE(mp);
 }
 
+TEST(HttpMessageTest, uri_resolution_cache) {
+    brpc::Server server;
+    test::EchoService* svc = new test::EchoService();
+    ASSERT_EQ(0, server.AddService(svc, brpc::SERVER_OWNS_SERVICE));
+    ASSERT_EQ(0, server.Start(9238, NULL));
+    std::string unknown_method;
+    brpc::Server::MethodProperty* mp =
+        FindMethodPropertyByURI("/EchoService/Echo", &server, &unknown_method);
+    ASSERT_TRUE(mp);
+    ASSERT_EQ("test.EchoService.Echo", mp->method->full_name());
+    // Repeated resolutions of a same path are served from the TLS cache
+    // and yield the same property.
+    for (int i = 0; i < 3; ++i) {
+        ASSERT_EQ(mp, FindMethodPropertyByURI("/EchoService/Echo",
+                                              &server, &unknown_method));
+    }
+    // Changing the service set bumps the resolution version so that the
+    // cache does not serve entries pointing into removed services.
+    const uint64_t saved_ver = brpc::GetMethodResolutionVersion();
+    ASSERT_EQ(0, server.Stop(0));
+    ASSERT_EQ(0, server.Join());
+    ASSERT_EQ(0, server.RemoveService(svc));
+    ASSERT_LT(saved_ver, brpc::GetMethodResolutionVersion());
+    ASSERT_TRUE(FindMethodPropertyByURI("/EchoService/Echo",
+                                        &server, &unknown_method) == NULL);
+}
+
 TEST(HttpMessageTest, http_header) {
     brpc::HttpHeader header;
     
@@ -110,6 +110,67 @@ TEST_F(HttpParserTest, http_example) {
     LOG(INFO) << http_parser_execute(&parser, &settings, http_request, strlen(http_request));
 }
 
+static std::string s_headers;
+
+int on_header_field_cat(http_parser *, const char *at, const size_t length) {
+    s_headers.append("F:");
+    s_headers.append(at, length);
+    return 0;
+}
+
+int on_header_value_cat(http_parser *, const char *at, const size_t length) {
+    s_headers.append("V:");
+    s_headers.append(at, length);
+    return 0;
+}
+
+TEST_F(HttpParserTest, one_shot_and_byte_at_a_time_see_same_headers) {
+    // The bulk-scanning fast path of header names/values is only taken when
+    // more data is readily available, feeding the request byte-by-byte must
+    // invoke the same callbacks on the same data.
+    const char *http_request =
+        "GET /path/file.html HTTP/1.1\r\n"
+        "Host: www.example.com\r\n"
+        "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36"
+        " (KHTML, like Gecko) Chrome/51.0.2704.106 Safari/537.36\r\n"
+        "Accept-Encoding: gzip, deflate, sdch, br\r\n"
+        "Connection: keep-alive\r\n"
+        "\r\n"
+    ;
+    http_parser_settings settings;
+    memset(&settings, 0, sizeof(settings));
+    settings.on_header_field = on_header_field_cat;
+    settings.on_header_value = on_header_value_cat;
+
+    http_parser parser;
+    http_parser_init(&parser, brpc::HTTP_REQUEST);
+    const size_t len = strlen(http_request);
+    ASSERT_EQ(len, http_parser_execute(&parser, &settings, http_request, len));
+    ASSERT_EQ(brpc::HPE_OK, (brpc::http_errno)parser.http_errno);
+    const std::string one_shot = s_headers;
+
+    s_headers.clear();
+    http_parser_init(&parser, brpc::HTTP_REQUEST);
+    for (size_t i = 0; i < len; ++i) {
+        ASSERT_EQ(1u, http_parser_execute(&parser, &settings, http_request + i, 1));
+        ASSERT_EQ(brpc::HPE_OK, (brpc::http_errno)parser.http_errno);
+    }
+    ASSERT_EQ(one_shot, s_headers);
+    s_headers.clear();
+}
+
+TEST_F(HttpParserTest, overly_long_header_is_still_rejected) {
+    http_parser_settings settings;
+    memset(&settings, 0, sizeof(settings));
+    std::string http_request = "GET / HTTP/1.1\r\nUser-Agent: ";
+    http_request.append(BRPC_HTTP_MAX_HEADER_SIZE + 1, 'x');
+    http_parser parser;
+    http_parser_init(&parser, brpc::HTTP_REQUEST);
+    http_parser_execute(&parser, &settings, http_request.data(),
+                        http_request.size());
+    ASSERT_EQ(brpc::HPE_HEADER_OVERFLOW, (brpc::http_errno)parser.http_errno);
+}
+
 TEST_F(HttpParserTest, append_filename) {
     std::string dir;
 
@@ -485,6 +485,7 @@ public:
                         size_t num_repeat = 1)
         : _done_place(done_place)
         , _nrep(num_repeat)
+        , _use_cork(false)
         , _nwritten(0)
         , _ever_full(false)
         , _last_errno(0) {}
@@ -510,6 +511,9 @@ public:
         }
         ASSERT_GT(PA_DATA_LEN, 8u);  // long enough to hold a 64-bit decimal.
         char buf[PA_DATA_LEN];
+        if (_use_cork) {
+            pa->Cork();
+        }
         for (size_t c = 0; c < _nrep;) {
             CopyPAPrefixedWithSeqNo(buf, c);
             if (pa->Write(buf, sizeof(buf)) != 0) {
@@ -526,6 +530,14 @@ public:
                 _nwritten += PA_DATA_LEN;
             }
             ++c;
+            if (_use_cork && c % 10 == 0) {
+                // Flush 10 chunks in one write.
+                pa->Uncork();
+                pa->Cork();
+            }
+        }
+        if (_use_cork) {
+            pa->Uncork();
         }
         if (_done_place == DONE_AFTER_CREATE_PA_BEFORE_DESTROY_PA) {
             done_guard.reset(NULL);
@@ -579,6 +591,7 @@ public:
     }
     
     void set_done_place(DonePlace done_place) { _done_place = done_place; }
+    void set_use_cork(bool use_cork) { _use_cork = use_cork; }
     size_t written_bytes() const { return _nwritten; }
     bool ever_full() const { return _ever_full; }
     int last_errno() const { return _last_errno; }
@@ -586,6 +599,7 @@ public:
 private:
     DonePlace _done_place;
     size_t _nrep;
+    bool _use_cork;
     size_t _nwritten;
     bool _ever_full;
     int _last_errno;
@@ -776,6 +790,47 @@ TEST_F(HttpTest, read_short_body_progressively) {
     }
 }
 
+TEST_F(HttpTest, read_corked_body_progressively) {
+    butil::intrusive_ptr<ReadBody> reader;
+    const int port = 8923;
+    brpc::Server server;
+    const int NREP = 10000;
+    DownloadServiceImpl svc(DONE_BEFORE_CREATE_PA, NREP);
+    svc.set_use_cork(true);
+    EXPECT_EQ(0, server.AddService(&svc, brpc::SERVER_DOESNT_OWN_SERVICE));
+    EXPECT_EQ(0, server.Start(port, NULL));
+    {
+        brpc::Channel channel;
+        brpc::ChannelOptions options;
+        options.protocol = brpc::PROTOCOL_HTTP;
+        ASSERT_EQ(0, channel.Init(butil::EndPoint(butil::my_ip(), port), &options));
+        {
+            brpc::Controller cntl;
+            cntl.response_will_be_read_progressively();
+            cntl.http_request().uri() = "/DownloadService/Download";
+            channel.CallMethod(NULL, &cntl, NULL, NULL, NULL);
+            ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+            ASSERT_TRUE(cntl.response_attachment().empty());
+            reader.reset(new ReadBody);
+            cntl.ReadProgressiveAttachmentBy(reader.get());
+            size_t last_read = 0;
+            for (size_t i = 0; i < 3; ++i) {
+                sleep(1);
+                size_t current_read = reader->read_bytes();
+                LOG(INFO) << "read=" << current_read - last_read
+                          << " total=" << current_read;
+                last_read = current_read;
+            }
+            // ReadBody verifies that corked chunks still arrive in order
+            // and unchanged.
+            ASSERT_EQ(NREP * PA_DATA_LEN, svc.written_bytes());
+            ASSERT_EQ(NREP * PA_DATA_LEN, last_read);
+        }
+        ASSERT_TRUE(reader->destroyed());
+        ASSERT_EQ(0, reader->destroying_status().error_code());
+    }
+}
+
 TEST_F(HttpTest, read_progressively_after_cntl_destroys) {
     butil::intrusive_ptr<ReadBody> reader;
     {
@@ -1232,7 +1287,7 @@ TEST_F(HttpTest, http2_not_closing_socket_when_rpc_timeout) {
 
     brpc::SocketUniquePtr main_ptr;
     EXPECT_EQ(brpc::Socket::Address(channel._server_id, &main_ptr), 0);
-    brpc::SocketId agent_id = main_ptr->_agent_socket_id.load(butil::memory_order_relaxed);
+    brpc::SocketId agent_id = main_ptr->_agent_socket_ids[0].load(butil::memory_order_relaxed);
 
     for (int i = 0; i < 4; i++) {
         brpc::Controller cntl;
@@ -1243,7 +1298,7 @@ TEST_F(HttpTest, http2_not_closing_socket_when_rpc_timeout) {
         ASSERT_TRUE(cntl.Failed());
 
         brpc::SocketUniquePtr ptr;
-        brpc::SocketId id = main_ptr->_agent_socket_id.load(butil::memory_order_relaxed);
+        brpc::SocketId id = main_ptr->_agent_socket_ids[0].load(butil::memory_order_relaxed);
         EXPECT_EQ(id, agent_id);
     }
 
@@ -1256,7 +1311,7 @@ TEST_F(HttpTest, http2_not_closing_socket_when_rpc_timeout) {
         ASSERT_FALSE(cntl.Failed());
         ASSERT_EQ(EXP_RESPONSE, res.message());
         brpc::SocketUniquePtr ptr;
-        brpc::SocketId id = main_ptr->_agent_socket_id.load(butil::memory_order_relaxed);
+        brpc::SocketId id = main_ptr->_agent_socket_ids[0].load(butil::memory_order_relaxed);
         EXPECT_EQ(id, agent_id);
     }
 }
@@ -0,0 +1,133 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// brpc - A framework to host and access services throughout Baidu.
+
+#include <gtest/gtest.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <errno.h>
+#include <butil/sys_byteorder.h>
+#include "brpc/server.h"
+#include "brpc/socket.h"
+
+int main(int argc, char* argv[]) {
+    testing::InitGoogleTest(&argc, argv);
+    GFLAGS_NS::ParseCommandLineFlags(&argc, &argv, true);
+    return RUN_ALL_TESTS();
+}
+
+namespace {
+
+static int ConnectTo(int port) {
+    const int fd = socket(AF_INET, SOCK_STREAM, 0);
+    EXPECT_GE(fd, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    EXPECT_EQ(0, connect(fd, (sockaddr*)&addr, sizeof(addr)));
+    return fd;
+}
+
+// Write the 12-byte baidu_std header of a message whose body never
+// arrives completely, making the server buffer what we send.
+static void WriteIncompleteRpcHeader(int fd, uint32_t claimed_body_size) {
+    char header[12];
+    memcpy(header, "PRPC", 4);
+    const uint32_t body_size = butil::HostToNet32(claimed_body_size);
+    const uint32_t meta_size = butil::HostToNet32(16);
+    memcpy(header + 4, &body_size, 4);
+    memcpy(header + 8, &meta_size, 4);
+    ASSERT_EQ((ssize_t)sizeof(header), write(fd, header, sizeof(header)));
+}
+
+// Returns true when the remote side closed `fd' within `timeout_ms'.
+static bool WaitForClose(int fd, int timeout_ms) {
+    char buf[128];
+    for (int i = 0; i < timeout_ms / 10; ++i) {
+        const ssize_t nr = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+        if (nr == 0) {
+            return true;
+        }
+        if (nr < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            return true;
+        }
+        usleep(10 * 1000);
+    }
+    return false;
+}
+
+TEST(InboundQuotaTest, close_connection_exceeding_per_socket_cap) {
+    brpc::Server server;
+    ASSERT_EQ(0, server.Start(8711, NULL));
+    ASSERT_FALSE(GFLAGS_NS::SetCommandLineOption(
+        "socket_max_unconsumed_bytes", "16384").empty());
+
+    const int fd = ConnectTo(8711);
+    WriteIncompleteRpcHeader(fd, 8 * 1024 * 1024);
+    // Trickle an incomplete body until the server gives up on us.
+    char chunk[4096];
+    memset(chunk, 0, sizeof(chunk));
+    bool closed = false;
+    for (int i = 0; i < 64 && !closed; ++i) {
+        if (write(fd, chunk, sizeof(chunk)) < 0) {
+            closed = true;
+            break;
+        }
+        closed = WaitForClose(fd, 100);
+    }
+    ASSERT_TRUE(closed);
+    close(fd);
+
+    ASSERT_FALSE(GFLAGS_NS::SetCommandLineOption(
+        "socket_max_unconsumed_bytes", "0").empty());
+    server.Stop(0);
+    server.Join();
+}
+
+TEST(InboundQuotaTest, incomplete_message_kept_without_cap) {
+    brpc::Server server;
+    ASSERT_EQ(0, server.Start(8712, NULL));
+
+    const int fd = ConnectTo(8712);
+    WriteIncompleteRpcHeader(fd, 8 * 1024 * 1024);
+    char chunk[4096];
+    memset(chunk, 0, sizeof(chunk));
+    for (int i = 0; i < 16; ++i) {
+        ASSERT_EQ((ssize_t)sizeof(chunk), write(fd, chunk, sizeof(chunk)));
+    }
+    // Unconsumed bytes are accounted globally while buffered.
+    usleep(200 * 1000);
+    ASSERT_GE(brpc::Socket::TotalUnconsumedInBytes(), 12 + 16 * 4096);
+    // Without caps the connection stays open waiting for the rest.
+    ASSERT_FALSE(WaitForClose(fd, 300));
+    close(fd);
+
+    server.Stop(0);
+    server.Join();
+    // The accounting is released when the socket is recycled.
+    for (int i = 0; i < 100 &&
+         brpc::Socket::TotalUnconsumedInBytes() != 0; ++i) {
+        usleep(30 * 1000);
+    }
+    ASSERT_EQ(0, brpc::Socket::TotalUnconsumedInBytes());
+}
+
+} // namespace
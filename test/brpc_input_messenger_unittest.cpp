@@ -218,3 +218,58 @@ TEST_F(MessengerTest, dispatch_tasks) {
     sleep(1);
     LOG(WARNING) << "begin to exit!!!!";
 }
+
+DECLARE_bool(reuse_port);   // defined in butil/endpoint.cpp
+
+TEST_F(MessengerTest, reuseport_listeners) {
+    const bool saved_reuse_port = FLAGS_reuse_port;
+    FLAGS_reuse_port = true;
+    const butil::EndPoint point(butil::IP_ANY, 7879);
+    int listening_fd1 = butil::tcp_listen(point);
+    int listening_fd2 = butil::tcp_listen(point);
+    FLAGS_reuse_port = saved_reuse_port;
+#if !defined(SO_REUSEPORT)
+    LOG(WARNING) << "SO_REUSEPORT is not supported, skip this test";
+    close(listening_fd1);
+    close(listening_fd2);
+    return;
+#endif
+    ASSERT_TRUE(listening_fd1 > 0);
+    ASSERT_TRUE(listening_fd2 > 0);
+
+    const brpc::InputMessageHandler pairs[] = {
+        { brpc::policy::ParseHuluMessage,
+          EmptyProcessHuluRequest, NULL, NULL, "dummy_hulu" }
+    };
+    brpc::Acceptor messenger;
+    ASSERT_EQ(0, messenger.AddHandler(pairs[0]));
+    // AddExtraListener() before StartAccept() should fail.
+    ASSERT_EQ(-1, messenger.AddExtraListener(listening_fd2));
+    ASSERT_EQ(0, messenger.StartAccept(listening_fd1, -1, NULL));
+    ASSERT_EQ(0, messenger.AddExtraListener(listening_fd2));
+
+    const size_t NCONN = 16;
+    butil::fd_guard fds[NCONN];
+    for (size_t i = 0; i < NCONN; ++i) {
+        fds[i].reset(butil::tcp_connect(point, NULL));
+        ASSERT_TRUE(fds[i] >= 0) << berror();
+    }
+    // Wait until the connections are accepted.
+    for (int i = 0; i < 100 && messenger.ConnectionCount() != NCONN; ++i) {
+        usleep(10000);
+    }
+    ASSERT_EQ(NCONN, messenger.ConnectionCount());
+    // Every connection was counted by the listener accepting it.
+    int64_t nconn_total = 0;
+    ASSERT_EQ(2UL, messenger._listener_stats.size());
+    for (size_t i = 0; i < messenger._listener_stats.size(); ++i) {
+        nconn_total += messenger._listener_stats[i].nconn->get_value();
+    }
+    ASSERT_EQ((int64_t)NCONN, nconn_total);
+
+    for (size_t i = 0; i < NCONN; ++i) {
+        fds[i].reset(-1);
+    }
+    messenger.StopAccept(0);
+    messenger.Join();
+}
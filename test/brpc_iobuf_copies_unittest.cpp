@@ -0,0 +1,97 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// brpc - A framework to host and access services throughout Baidu.
+
+#include <gtest/gtest.h>
+#include <bvar/bvar.h>
+#include "butil/iobuf.h"
+#include "brpc/server.h"
+#include "brpc/channel.h"
+#include "brpc/controller.h"
+
+int main(int argc, char* argv[]) {
+    testing::InitGoogleTest(&argc, argv);
+    GFLAGS_NS::ParseCommandLineFlags(&argc, &argv, true);
+    return RUN_ALL_TESTS();
+}
+
+namespace {
+
+static int64_t GetSampledCopyCount() {
+    std::ostringstream os;
+    EXPECT_EQ(0, bvar::Variable::describe_exposed(
+                  "iobuf_sampled_copy_count", os));
+    return strtoll(os.str().c_str(), NULL, 10);
+}
+
+TEST(IOBufCopiesTest, sampling_follows_the_flag) {
+    // Off by default, the hook must not be installed.
+    ASSERT_TRUE(butil::iobuf::copy_hook == NULL);
+
+    ASSERT_FALSE(GFLAGS_NS::SetCommandLineOption(
+        "iobuf_copy_sample_min_bytes", "128").empty());
+    ASSERT_TRUE(butil::iobuf::copy_hook != NULL);
+
+    const int64_t count_before = GetSampledCopyCount();
+    butil::IOBuf buf;
+    char flat[256];
+    // Below the threshold: not sampled.
+    buf.append(flat, 64);
+    ASSERT_EQ(count_before, GetSampledCopyCount());
+    // At/above the threshold: append-in and copy-out are both sampled.
+    buf.append(flat, 256);
+    buf.copy_to(flat, 256);
+    ASSERT_EQ(count_before + 2, GetSampledCopyCount());
+
+    // Turning sampling off uninstalls the hook.
+    ASSERT_FALSE(GFLAGS_NS::SetCommandLineOption(
+        "iobuf_copy_sample_min_bytes", "-1").empty());
+    ASSERT_TRUE(butil::iobuf::copy_hook == NULL);
+    buf.copy_to(flat, 256);
+    ASSERT_EQ(count_before + 2, GetSampledCopyCount());
+}
+
+TEST(IOBufCopiesTest, page_shows_sampled_sites) {
+    brpc::Server server;
+    ASSERT_EQ(0, server.Start(8716, NULL));
+
+    ASSERT_FALSE(GFLAGS_NS::SetCommandLineOption(
+        "iobuf_copy_sample_min_bytes", "128").empty());
+    butil::IOBuf buf;
+    char flat[512];
+    buf.append(flat, sizeof(flat));
+
+    brpc::Channel channel;
+    brpc::ChannelOptions options;
+    options.protocol = brpc::PROTOCOL_HTTP;
+    ASSERT_EQ(0, channel.Init("127.0.0.1:8716", &options));
+    brpc::Controller cntl;
+    cntl.http_request().uri() = "/iobuf_copies";
+    channel.CallMethod(NULL, &cntl, NULL, NULL, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    const std::string body = cntl.response_attachment().to_string();
+    ASSERT_NE(std::string::npos, body.find("call sites")) << body;
+    ASSERT_EQ(std::string::npos, body.find("sampling off")) << body;
+
+    ASSERT_FALSE(GFLAGS_NS::SetCommandLineOption(
+        "iobuf_copy_sample_min_bytes", "-1").empty());
+    server.Stop(0);
+    server.Join();
+}
+
+} // namespace
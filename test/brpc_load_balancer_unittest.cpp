@@ -32,10 +32,12 @@
 #include "brpc/socket.h"
 #include "butil/strings/string_number_conversions.h"
 #include "brpc/excluded_servers.h" 
+#include "brpc/load_balancer.h"
 #include "brpc/policy/weighted_round_robin_load_balancer.h"
 #include "brpc/policy/round_robin_load_balancer.h"
 #include "brpc/policy/randomized_load_balancer.h"
 #include "brpc/policy/locality_aware_load_balancer.h"
+#include "brpc/policy/power_of_two_choices_load_balancer.h"
 #include "brpc/policy/consistent_hashing_load_balancer.h"
 #include "brpc/policy/hasher.h"
 #include "brpc/errno.pb.h"
@@ -124,6 +126,63 @@ TEST_F(LoadBalancerTest, doubly_buffered_data) {
     }
 }
 
+struct TwoLong {
+    TwoLong() : a(0), b(0) {}
+    long a;
+    long b;
+};
+
+bool AddOneToBoth(TwoLong& f) {
+    ++f.a;
+    ++f.b;
+    return true;
+}
+
+typedef butil::DoublyBufferedData<TwoLong, butil::Seq> SeqData;
+
+struct SeqReadArg {
+    SeqData* data;
+    volatile bool stop;
+};
+
+static void* seq_reader(void* void_arg) {
+    SeqReadArg* arg = (SeqReadArg*)void_arg;
+    while (!arg->stop) {
+        SeqData::ScopedPtr ptr;
+        EXPECT_EQ(0, arg->data->Read(&ptr));
+        // Modify() must not change an instance being read, in which case
+        // a reader would see a partially applied AddOneToBoth.
+        EXPECT_EQ(ptr->a, ptr->b);
+    }
+    return NULL;
+}
+
+TEST_F(LoadBalancerTest, doubly_buffered_data_seq) {
+    SeqData d;
+    {
+        SeqData::ScopedPtr ptr;
+        ASSERT_EQ(0, d.Read(&ptr));
+        ASSERT_EQ(0, ptr->a);
+    }
+    SeqReadArg arg = { &d, false };
+    pthread_t tids[8];
+    for (size_t i = 0; i < ARRAY_SIZE(tids); ++i) {
+        ASSERT_EQ(0, pthread_create(&tids[i], NULL, seq_reader, &arg));
+    }
+    const long N = 10000;
+    for (long i = 0; i < N; ++i) {
+        d.Modify(AddOneToBoth);
+    }
+    arg.stop = true;
+    for (size_t i = 0; i < ARRAY_SIZE(tids); ++i) {
+        ASSERT_EQ(0, pthread_join(tids[i], NULL));
+    }
+    SeqData::ScopedPtr ptr;
+    ASSERT_EQ(0, d.Read(&ptr));
+    ASSERT_EQ(N, ptr->a);
+    ASSERT_EQ(N, ptr->b);
+}
+
 typedef brpc::policy::LocalityAwareLoadBalancer LALB;
 
 static void ValidateWeightTree(
@@ -616,6 +675,138 @@ TEST_F(LoadBalancerTest, consistent_hashing) {
     }
 }
 
+TEST_F(LoadBalancerTest, consistent_hashing_bounded_load) {
+    brpc::policy::ConsistentHashingLoadBalancer proto_lb(
+        ::brpc::policy::CONS_HASH_LB_MURMUR3);
+    // load_factor must be > 1 or 0
+    ASSERT_TRUE(proto_lb.New("load_factor=0.5") == NULL);
+    brpc::LoadBalancer* lb = proto_lb.New("load_factor=1.5");
+    ASSERT_TRUE(lb != NULL);
+
+    const char* servers[] = {
+            "10.92.115.19:8833",
+            "10.42.108.25:8833",
+            "10.36.150.32:8833",
+            "10.92.149.48:8833",
+            "10.42.122.201:8833",
+    };
+    std::vector<brpc::ServerId> ids;
+    for (size_t i = 0; i < ARRAY_SIZE(servers); ++i) {
+        butil::EndPoint dummy;
+        ASSERT_EQ(0, str2endpoint(servers[i], &dummy));
+        brpc::ServerId id(8888);
+        brpc::SocketOptions options;
+        options.remote_side = dummy;
+        options.user = new SaveRecycle;
+        ASSERT_EQ(0, brpc::Socket::Create(options, &id.id));
+        ids.push_back(id);
+        ASSERT_TRUE(lb->AddServer(id));
+    }
+    // Hammer one key without feedback: inflight counts pile up on the
+    // key's primary server, selections must spill to other servers once
+    // it's over 1.5x the average instead of all landing on one backend.
+    const size_t SELECT_TIMES = 100;
+    std::map<brpc::SocketId, size_t> times;
+    std::vector<brpc::SocketId> selected;
+    brpc::LoadBalancer::SelectIn in = { 0, false, true, 0xdeadbeef, NULL };
+    for (size_t i = 0; i < SELECT_TIMES; ++i) {
+        brpc::SocketUniquePtr ptr;
+        brpc::LoadBalancer::SelectOut out(&ptr);
+        ASSERT_EQ(0, lb->SelectServer(in, &out));
+        ASSERT_TRUE(out.need_feedback);
+        ++times[ptr->id()];
+        selected.push_back(ptr->id());
+    }
+    ASSERT_GT(times.size(), 1ul);
+    for (std::map<brpc::SocketId, size_t>::iterator it = times.begin();
+         it != times.end(); ++it) {
+        // ceil(1.5 * (SELECT_TIMES + 1) / 5)
+        ASSERT_LE(it->second, 31ul) << it->first;
+    }
+    // Drain the counters, the ring behaves like plain chash again.
+    for (size_t i = 0; i < selected.size(); ++i) {
+        brpc::LoadBalancer::CallInfo info;
+        info.begin_time_us = 0;
+        info.server_id = selected[i];
+        info.error_code = 0;
+        info.controller = NULL;
+        lb->Feedback(info);
+    }
+    {
+        brpc::SocketUniquePtr ptr;
+        brpc::LoadBalancer::SelectOut out(&ptr);
+        ASSERT_EQ(0, lb->SelectServer(in, &out));
+        ASSERT_EQ(selected[0], ptr->id());
+    }
+    for (size_t i = 0; i < ids.size(); ++i) {
+        ASSERT_EQ(0, brpc::Socket::SetFailed(ids[i].id));
+    }
+    lb->Destroy();
+}
+
+TEST_F(LoadBalancerTest, power_of_two_choices) {
+    brpc::policy::PowerOfTwoChoicesLoadBalancer lb;
+    const char* servers[] = {
+            "10.92.115.19:8833",
+            "10.42.108.25:8833",
+            "10.36.150.32:8833",
+    };
+    std::vector<brpc::ServerId> ids;
+    for (size_t i = 0; i < ARRAY_SIZE(servers); ++i) {
+        butil::EndPoint dummy;
+        ASSERT_EQ(0, str2endpoint(servers[i], &dummy));
+        brpc::ServerId id(8888);
+        brpc::SocketOptions options;
+        options.remote_side = dummy;
+        options.user = new SaveRecycle;
+        ASSERT_EQ(0, brpc::Socket::Create(options, &id.id));
+        ids.push_back(id);
+        ASSERT_TRUE(lb.AddServer(id));
+        ASSERT_FALSE(lb.AddServer(id));  // dedup
+    }
+    // Make servers[0] look 100x slower than the other two through
+    // feedback, it should end up with clearly fewer selections: p2c
+    // sends it traffic only when both sampled servers are the slow one.
+    const brpc::SocketId slow_id = ids[0].id;
+    const size_t SELECT_TIMES = 10000;
+    std::map<brpc::SocketId, size_t> times;
+    brpc::LoadBalancer::SelectIn in = { 0, false, false, 0u, NULL };
+    for (size_t i = 0; i < SELECT_TIMES; ++i) {
+        brpc::SocketUniquePtr ptr;
+        brpc::LoadBalancer::SelectOut out(&ptr);
+        in.begin_time_us = butil::gettimeofday_us();
+        ASSERT_EQ(0, lb.SelectServer(in, &out));
+        ASSERT_TRUE(out.need_feedback);
+        ++times[ptr->id()];
+        brpc::LoadBalancer::CallInfo info;
+        // Fake the latency by backdating the begin time.
+        info.begin_time_us = butil::gettimeofday_us()
+            - (ptr->id() == slow_id ? 100000 : 1000);
+        info.server_id = ptr->id();
+        info.error_code = 0;
+        info.controller = NULL;
+        lb.Feedback(info);
+    }
+    ASSERT_EQ(ids.size(), times.size());
+    for (size_t i = 1; i < ids.size(); ++i) {
+        ASSERT_LT(times[slow_id], times[ids[i].id] / 2)
+            << "i=" << i << " slow=" << times[slow_id];
+    }
+    ASSERT_TRUE(lb.RemoveServer(ids[0]));
+    ASSERT_FALSE(lb.RemoveServer(ids[0]));
+    {
+        brpc::SocketUniquePtr ptr;
+        brpc::LoadBalancer::SelectOut out(&ptr);
+        in.begin_time_us = butil::gettimeofday_us();
+        ASSERT_EQ(0, lb.SelectServer(in, &out));
+        ASSERT_NE(slow_id, ptr->id());
+    }
+    std::cout << lb << '\n';
+    for (size_t i = 0; i < ids.size(); ++i) {
+        ASSERT_EQ(0, brpc::Socket::SetFailed(ids[i].id));
+    }
+}
+
 TEST_F(LoadBalancerTest, weighted_round_robin) {
     const char* servers[] = { 
             "10.92.115.19:8831", 
@@ -928,6 +1119,74 @@ TEST_F(LoadBalancerTest, invalid_lb_params) {
                            &options), -1);
 }
 
+TEST_F(LoadBalancerTest, slow_start) {
+    butil::intrusive_ptr<brpc::SharedLoadBalancer> lb(
+        new brpc::SharedLoadBalancer);
+    ASSERT_EQ(0, lb->Init("rr"));
+    const char* servers[] = {
+            "10.92.115.19:8833",
+            "10.42.108.25:8833",
+    };
+    std::vector<brpc::ServerId> ids;
+    for (size_t i = 0; i < ARRAY_SIZE(servers); ++i) {
+        butil::EndPoint dummy;
+        ASSERT_EQ(0, str2endpoint(servers[i], &dummy));
+        brpc::ServerId id(8888);
+        brpc::SocketOptions options;
+        options.remote_side = dummy;
+        options.user = new SaveRecycle;
+        ASSERT_EQ(0, brpc::Socket::Create(options, &id.id));
+        ids.push_back(id);
+        ASSERT_TRUE(lb->AddServer(id));
+    }
+    const int64_t WINDOW_S = 100;
+    brpc::FLAGS_lb_slow_start_window_s = WINDOW_S;
+    // Backdate servers[0] past the window so that only servers[1] warms up.
+    lb->_join_times.Modify(brpc::SharedLoadBalancer::AddJoinTime, ids[0].id,
+                           butil::gettimeofday_us() - 2 * WINDOW_S * 1000000L);
+    const size_t SELECT_TIMES = 10000;
+    std::map<brpc::SocketId, size_t> times;
+    brpc::LoadBalancer::SelectIn in = { 0, false, false, 0u, NULL };
+    for (size_t i = 0; i < SELECT_TIMES; ++i) {
+        brpc::SocketUniquePtr ptr;
+        brpc::LoadBalancer::SelectOut out(&ptr);
+        in.begin_time_us = butil::gettimeofday_us();
+        ASSERT_EQ(0, lb->SelectServer(in, &out));
+        ++times[ptr->id()];
+    }
+    // The fresh server gets some traffic(around 5%) but clearly less
+    // than the warmed-up one which takes the deflected selections.
+    ASSERT_GT(times[ids[1].id], 0ul);
+    ASSERT_LT(times[ids[1].id], times[ids[0].id] / 4)
+        << "fresh=" << times[ids[1].id] << " warm=" << times[ids[0].id];
+    // Backdate servers[1] as well, traffic should be even again.
+    lb->_join_times.Modify(brpc::SharedLoadBalancer::AddJoinTime, ids[1].id,
+                           butil::gettimeofday_us() - 2 * WINDOW_S * 1000000L);
+    times.clear();
+    for (size_t i = 0; i < SELECT_TIMES; ++i) {
+        brpc::SocketUniquePtr ptr;
+        brpc::LoadBalancer::SelectOut out(&ptr);
+        in.begin_time_us = butil::gettimeofday_us();
+        ASSERT_EQ(0, lb->SelectServer(in, &out));
+        ++times[ptr->id()];
+    }
+    ASSERT_LT(times[ids[0].id], times[ids[1].id] + SELECT_TIMES / 10);
+    ASSERT_LT(times[ids[1].id], times[ids[0].id] + SELECT_TIMES / 10);
+    // Removing a server drops its join time.
+    ASSERT_TRUE(lb->RemoveServer(ids[1]));
+    {
+        butil::DoublyBufferedData<
+            brpc::SharedLoadBalancer::JoinTimeMap>::ScopedPtr ptr;
+        ASSERT_EQ(0, lb->_join_times.Read(&ptr));
+        ASSERT_EQ(0ul, ptr->time_of_join.count(ids[1].id));
+        ASSERT_EQ(1ul, ptr->time_of_join.count(ids[0].id));
+    }
+    brpc::FLAGS_lb_slow_start_window_s = 0;
+    for (size_t i = 0; i < ids.size(); ++i) {
+        ASSERT_EQ(0, brpc::Socket::SetFailed(ids[i].id));
+    }
+}
+
 TEST_F(LoadBalancerTest, revived_from_all_failed_intergrated) {
     GFLAGS_NS::SetCommandLineOption("circuit_breaker_short_window_size", "20");
     GFLAGS_NS::SetCommandLineOption("circuit_breaker_short_window_error_percent", "30");
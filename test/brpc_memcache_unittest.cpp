@@ -168,6 +168,48 @@ TEST_F(MemcacheTest, sanity) {
     ASSERT_EQ(~0ul, cas_value3);
 }
 
+TEST_F(MemcacheTest, multi_get) {
+    if (g_mc_pid < 0) {
+        puts("Skipped due to absence of memcached");
+        return;
+    }
+    brpc::ChannelOptions options;
+    options.protocol = brpc::PROTOCOL_MEMCACHE;
+    brpc::Channel channel;
+    ASSERT_EQ(0, channel.Init("0.0.0.0:" MEMCACHED_PORT, &options));
+    brpc::MemcacheRequest request;
+    brpc::MemcacheResponse response;
+    brpc::Controller cntl;
+    request.Set("mget_key1", "value1", 0xdeadbeef, 10, 0);
+    request.Set("mget_key3", "value3", 0xbeefdead, 10, 0);
+    channel.CallMethod(NULL, &cntl, &request, &response, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    uint64_t cas_value = 0;
+    ASSERT_TRUE(response.PopSet(&cas_value)) << response.LastError();
+    ASSERT_TRUE(response.PopSet(&cas_value)) << response.LastError();
+
+    cntl.Reset();
+    request.Clear();
+    std::vector<butil::StringPiece> keys;
+    keys.push_back("mget_key1");
+    keys.push_back("mget_key2_missing");
+    keys.push_back("mget_key3");
+    ASSERT_TRUE(request.MultiGet(keys));
+    ASSERT_EQ(1, request.pipelined_count());
+    channel.CallMethod(NULL, &cntl, &request, &response, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    std::vector<brpc::MemcacheResponse::MultiGetHit> hits;
+    ASSERT_TRUE(response.PopMultiGet(keys.size(), &hits))
+        << response.LastError();
+    ASSERT_EQ(2ul, hits.size());
+    ASSERT_EQ(0ul, hits[0].index);
+    ASSERT_EQ("value1", hits[0].value.to_string());
+    ASSERT_EQ(0xdeadbeef, hits[0].flags);
+    ASSERT_EQ(2ul, hits[1].index);
+    ASSERT_EQ("value3", hits[1].value.to_string());
+    ASSERT_EQ(0xbeefdead, hits[1].flags);
+}
+
 TEST_F(MemcacheTest, incr_and_decr) {
     if (g_mc_pid < 0) {
         puts("Skipped due to absence of memcached");
@@ -0,0 +1,199 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// brpc - A framework to host and access services throughout Baidu.
+
+#include <gtest/gtest.h>
+#include <butil/atomicops.h>
+#include "brpc/server.h"
+#include "brpc/channel.h"
+#include "brpc/controller.h"
+#include "brpc/method_options.h"
+#include "echo.pb.h"
+
+int main(int argc, char* argv[]) {
+    testing::InitGoogleTest(&argc, argv);
+    GFLAGS_NS::ParseCommandLineFlags(&argc, &argv, true);
+    return RUN_ALL_TESTS();
+}
+
+namespace {
+
+class EchoServiceImpl : public test::EchoService {
+public:
+    EchoServiceImpl() : count(0) {}
+    virtual ~EchoServiceImpl() {}
+    virtual void Echo(google::protobuf::RpcController*,
+                      const test::EchoRequest* request,
+                      test::EchoResponse* response,
+                      google::protobuf::Closure* done) {
+        brpc::ClosureGuard done_guard(done);
+        count.fetch_add(1, butil::memory_order_relaxed);
+        response->set_message(request->message());
+    }
+
+    butil::atomic<int64_t> count;
+};
+
+class MethodOptionsTest : public ::testing::Test {
+protected:
+    MethodOptionsTest() {}
+    virtual ~MethodOptionsTest() {}
+};
+
+TEST_F(MethodOptionsTest, table_get_set_remove) {
+    brpc::MethodOptionsTable table;
+    brpc::DynamicMethodOptions opt;
+    ASSERT_EQ(0, table.version());
+    ASSERT_FALSE(table.Get("example.EchoService.Echo", &opt));
+
+    opt.max_concurrency = 10;
+    opt.response_compress_threshold = 512;
+    ASSERT_EQ(0, table.Set("example.EchoService.Echo", opt));
+    ASSERT_EQ(1, table.version());
+
+    brpc::DynamicMethodOptions read_opt;
+    ASSERT_TRUE(table.Get("example.EchoService.Echo", &read_opt));
+    ASSERT_EQ(10, read_opt.max_concurrency);
+    ASSERT_EQ(brpc::REQUEST_PRIORITY_UNSET, read_opt.request_priority);
+    ASSERT_EQ(512, read_opt.response_compress_threshold);
+    ASSERT_TRUE(read_opt.run_interceptors);
+
+    // Replacing bumps the version again.
+    opt.max_concurrency = 20;
+    ASSERT_EQ(0, table.Set("example.EchoService.Echo", opt));
+    ASSERT_EQ(2, table.version());
+    ASSERT_TRUE(table.Get("example.EchoService.Echo", &read_opt));
+    ASSERT_EQ(20, read_opt.max_concurrency);
+
+    ASSERT_EQ(-1, table.Remove("example.EchoService.NotExist"));
+    ASSERT_EQ(2, table.version());
+    ASSERT_EQ(0, table.Remove("example.EchoService.Echo"));
+    ASSERT_EQ(3, table.version());
+    ASSERT_FALSE(table.Get("example.EchoService.Echo", &read_opt));
+}
+
+TEST_F(MethodOptionsTest, defaults_keep_static_settings) {
+    brpc::DynamicMethodOptions opt;
+    ASSERT_EQ(-1, opt.max_concurrency);
+    ASSERT_EQ(brpc::REQUEST_PRIORITY_UNSET, opt.request_priority);
+    ASSERT_EQ(-1, opt.response_compress_threshold);
+    ASSERT_TRUE(opt.run_interceptors);
+}
+
+static int PostMethodOptions(brpc::Channel* http_channel,
+                             const std::string& uri_path) {
+    brpc::Controller cntl;
+    cntl.http_request().uri() = uri_path;
+    cntl.http_request().set_method(brpc::HTTP_METHOD_POST);
+    http_channel->CallMethod(NULL, &cntl, NULL, NULL, NULL);
+    return cntl.Failed() ? cntl.ErrorCode() : 0;
+}
+
+TEST_F(MethodOptionsTest, override_concurrency_over_http) {
+    EchoServiceImpl impl;
+    brpc::Server server;
+    ASSERT_EQ(0, server.AddService(&impl, brpc::SERVER_DOESNT_OWN_SERVICE));
+    ASSERT_EQ(0, server.Start(8710, NULL));
+
+    brpc::Channel channel;
+    ASSERT_EQ(0, channel.Init("127.0.0.1:8710", NULL));
+    test::EchoService_Stub stub(&channel);
+
+    brpc::ChannelOptions http_options;
+    http_options.protocol = brpc::PROTOCOL_HTTP;
+    brpc::Channel http_channel;
+    ASSERT_EQ(0, http_channel.Init("127.0.0.1:8710", &http_options));
+
+    // Normal calls succeed before any override.
+    {
+        brpc::Controller cntl;
+        test::EchoRequest req;
+        test::EchoResponse res;
+        req.set_message("hello");
+        stub.Echo(&cntl, &req, &res, NULL);
+        ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    }
+
+    // Unknown methods and builtin services are rejected.
+    ASSERT_EQ(brpc::ENOMETHOD, PostMethodOptions(
+        &http_channel,
+        "/method_options/test.EchoService.NotExist?max_concurrency=0"));
+    // Invalid values are rejected.
+    ASSERT_EQ(EINVAL, PostMethodOptions(
+        &http_channel,
+        "/method_options/test.EchoService.Echo?max_concurrency=abc"));
+    ASSERT_EQ(EINVAL, PostMethodOptions(
+        &http_channel,
+        "/method_options/test.EchoService.Echo?request_priority=urgent"));
+
+    // Drain the method with max_concurrency=0.
+    ASSERT_EQ(0, PostMethodOptions(
+        &http_channel,
+        "/method_options/test.EchoService.Echo?max_concurrency=0"));
+    ASSERT_EQ(1, server.method_options().version());
+    {
+        brpc::Controller cntl;
+        test::EchoRequest req;
+        test::EchoResponse res;
+        req.set_message("hello");
+        stub.Echo(&cntl, &req, &res, NULL);
+        ASSERT_TRUE(cntl.Failed());
+        ASSERT_EQ(brpc::ELIMIT, cntl.ErrorCode()) << cntl.ErrorText();
+    }
+
+    // Removing the override restores the method.
+    ASSERT_EQ(0, PostMethodOptions(
+        &http_channel, "/method_options/test.EchoService.Echo?remove"));
+    ASSERT_EQ(2, server.method_options().version());
+    {
+        brpc::Controller cntl;
+        test::EchoRequest req;
+        test::EchoResponse res;
+        req.set_message("hello");
+        stub.Echo(&cntl, &req, &res, NULL);
+        ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    }
+    // Removing again fails.
+    ASSERT_EQ(EINVAL, PostMethodOptions(
+        &http_channel, "/method_options/test.EchoService.Echo?remove"));
+
+    // GET lists the table without modifying it.
+    {
+        brpc::Controller cntl;
+        cntl.http_request().uri() = "/method_options";
+        http_channel.CallMethod(NULL, &cntl, NULL, NULL, NULL);
+        ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+        const std::string body = cntl.response_attachment().to_string();
+        ASSERT_NE(std::string::npos, body.find("version: 2")) << body;
+    }
+    // GET on a concrete method must not modify anything.
+    {
+        brpc::Controller cntl;
+        cntl.http_request().uri() =
+            "/method_options/test.EchoService.Echo?max_concurrency=0";
+        http_channel.CallMethod(NULL, &cntl, NULL, NULL, NULL);
+        ASSERT_TRUE(cntl.Failed());
+        ASSERT_EQ(EPERM, cntl.ErrorCode());
+    }
+    ASSERT_EQ(2, server.method_options().version());
+
+    server.Stop(0);
+    server.Join();
+}
+
+} // namespace
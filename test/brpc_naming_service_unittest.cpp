@@ -16,9 +16,12 @@
 // under the License.
 
 #include <stdio.h>
+#include <sys/stat.h>                          // mkdir
+#include <unistd.h>                            // unlink, rmdir
 #include <gtest/gtest.h>
 #include <vector>
 #include "butil/string_printf.h"
+#include "butil/file_util.h"
 #include "butil/files/temp_file.h"
 #include "bthread/bthread.h"
 #ifdef BAIDU_INTERNAL
@@ -30,15 +33,18 @@
 #include "brpc/policy/list_naming_service.h"
 #include "brpc/policy/remote_file_naming_service.h"
 #include "brpc/policy/discovery_naming_service.h"
+#include "brpc/details/naming_service_thread.h"
 #include "echo.pb.h"
 #include "brpc/server.h"
 
 
 namespace brpc {
 DECLARE_int32(health_check_interval);
+DECLARE_string(ns_backup_dir);
 
 namespace policy {
 
+DECLARE_int32(dns_cache_ttl_s);
 DECLARE_bool(consul_enable_degrade_to_file_naming_service);
 DECLARE_string(consul_file_naming_service_dir);
 DECLARE_string(consul_service_discovery_url);
@@ -117,6 +123,56 @@ TEST(NamingServiceTest, sanity) {
     }
 }
 
+class CountingWatcher : public brpc::NamingServiceWatcher {
+public:
+    CountingWatcher() : added_events(0), removed_events(0),
+                        nadded(0), nremoved(0) {}
+    void OnAddedServers(const std::vector<brpc::ServerId>& servers) {
+        ++added_events;
+        nadded += servers.size();
+    }
+    void OnRemovedServers(const std::vector<brpc::ServerId>& servers) {
+        ++removed_events;
+        nremoved += servers.size();
+    }
+    int added_events;
+    int removed_events;
+    size_t nadded;
+    size_t nremoved;
+};
+
+TEST(NamingServiceTest, reset_servers_skips_unchanged_lists) {
+    brpc::NamingServiceThread nsthr;
+    CountingWatcher watcher;
+    ASSERT_EQ(0, nsthr.AddWatcher(&watcher, NULL));
+    std::vector<brpc::ServerNode> servers;
+    for (int i = 0; i < 5; ++i) {
+        butil::EndPoint pt;
+        ASSERT_EQ(0, str2endpoint(butil::string_printf(
+            "10.127.0.%d:1234", i + 1).c_str(), &pt));
+        servers.push_back(brpc::ServerNode(pt));
+    }
+    nsthr._actions.ResetServers(servers);
+    ASSERT_EQ(1, watcher.added_events);
+    ASSERT_EQ(5u, watcher.nadded);
+    // Same list in different order: watchers must not be notified again.
+    std::reverse(servers.begin(), servers.end());
+    nsthr._actions.ResetServers(servers);
+    ASSERT_EQ(1, watcher.added_events);
+    ASSERT_EQ(0, watcher.removed_events);
+    // A real change still goes through.
+    brpc::ServerNode removed = servers.back();
+    servers.pop_back();
+    nsthr._actions.ResetServers(servers);
+    ASSERT_EQ(1, watcher.removed_events);
+    ASSERT_EQ(1u, watcher.nremoved);
+    servers.push_back(removed);
+    nsthr._actions.ResetServers(servers);
+    ASSERT_EQ(2, watcher.added_events);
+    ASSERT_EQ(6u, watcher.nadded);
+    ASSERT_EQ(0, nsthr.RemoveWatcher(&watcher));
+}
+
 TEST(NamingServiceTest, invalid_port) {
     std::vector<brpc::ServerNode> servers;
 
@@ -131,6 +187,57 @@ TEST(NamingServiceTest, invalid_port) {
     ASSERT_EQ(-1, dns.GetServers("brpc.baidu.com:99999", &servers));
 }
 
+TEST(NamingServiceTest, dns_cache) {
+    brpc::policy::FLAGS_dns_cache_ttl_s = 3600;
+
+    std::vector<brpc::ServerNode> servers;
+    brpc::policy::DomainNamingService dns;
+    ASSERT_EQ(0, dns.GetServers("localhost:1234", &servers));
+    ASSERT_FALSE(servers.empty());
+    const butil::ip_t expected_ip = servers[0].addr.ip;
+
+    // The cache is shared between instances and keyed by host only, a
+    // different port gets the cached addresses.
+    std::vector<brpc::ServerNode> servers2;
+    brpc::policy::DomainNamingService dns2;
+    ASSERT_EQ(0, dns2.GetServers("localhost:5678", &servers2));
+    ASSERT_EQ(servers.size(), servers2.size());
+    ASSERT_EQ(expected_ip, servers2[0].addr.ip);
+    ASSERT_EQ(5678, servers2[0].addr.port);
+
+    brpc::policy::FLAGS_dns_cache_ttl_s = 0;
+}
+
+TEST(NamingServiceTest, ns_backup_file) {
+    const char* const kDir = "./ns_backup_ut";
+    ASSERT_EQ(0, mkdir(kDir, 0755)) << berror();
+    brpc::FLAGS_ns_backup_dir = kDir;
+
+    // The server list is saved after a successful resolution.
+    butil::intrusive_ptr<brpc::NamingServiceThread> nst;
+    ASSERT_EQ(0, brpc::GetNamingServiceThread(
+                  &nst, "list://10.127.0.1:1234", NULL));
+    std::string content;
+    ASSERT_TRUE(butil::ReadFileToString(
+                    butil::FilePath("./ns_backup_ut/list_10.127.0.1_1234"),
+                    &content));
+    ASSERT_EQ(0u, content.find("10.127.0.1:1234"));
+
+    // An empty list:// resolves to no servers and normally fails Start,
+    // but a pre-existing backup file warms the thread up successfully.
+    FILE* fp = fopen("./ns_backup_ut/list_", "w");
+    ASSERT_TRUE(fp != NULL);
+    fprintf(fp, "10.127.0.2:5678\n");
+    fclose(fp);
+    butil::intrusive_ptr<brpc::NamingServiceThread> nst2;
+    ASSERT_EQ(0, brpc::GetNamingServiceThread(&nst2, "list://", NULL));
+
+    brpc::FLAGS_ns_backup_dir.clear();
+    unlink("./ns_backup_ut/list_10.127.0.1_1234");
+    unlink("./ns_backup_ut/list_");
+    rmdir(kDir);
+}
+
 TEST(NamingServiceTest, wrong_name) {
     std::vector<brpc::ServerNode> servers;
 
@@ -0,0 +1,133 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// brpc - A framework to host and access services throughout Baidu.
+
+#include <gtest/gtest.h>
+#include "bthread/bthread.h"
+#include "brpc/server.h"
+#include "brpc/channel.h"
+#include "brpc/controller.h"
+#include "brpc/socket.h"
+#include "echo.pb.h"
+
+int main(int argc, char* argv[]) {
+    testing::InitGoogleTest(&argc, argv);
+    GFLAGS_NS::ParseCommandLineFlags(&argc, &argv, true);
+    return RUN_ALL_TESTS();
+}
+
+namespace {
+
+class SleepyEchoService : public test::EchoService {
+public:
+    virtual void Echo(google::protobuf::RpcController*,
+                      const test::EchoRequest* request,
+                      test::EchoResponse* response,
+                      google::protobuf::Closure* done) {
+        brpc::ClosureGuard done_guard(done);
+        if (request->sleep_us() > 0) {
+            bthread_usleep(request->sleep_us());
+        }
+        response->set_message(request->message());
+    }
+};
+
+struct CallArgs {
+    brpc::Channel* channel;
+    int index;
+    bool failed;
+};
+
+static void* CallEcho(void* void_args) {
+    CallArgs* args = (CallArgs*)void_args;
+    brpc::Controller cntl;
+    test::EchoRequest req;
+    test::EchoResponse res;
+    char buf[32];
+    snprintf(buf, sizeof(buf), "hello-%d", args->index);
+    req.set_message(buf);
+    req.set_sleep_us(200 * 1000);
+    test::EchoService_Stub stub(args->channel);
+    stub.Echo(&cntl, &req, &res, NULL);
+    args->failed = cntl.Failed() || res.message() != buf;
+    EXPECT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    return NULL;
+}
+
+// Runs NCALL overlapping calls and returns #connections the pool ended
+// up with (all free after the calls).
+static int RunOverlappingCalls(brpc::Channel* channel) {
+    const int NCALL = 32;
+    bthread_t tids[NCALL];
+    CallArgs args[NCALL];
+    for (int i = 0; i < NCALL; ++i) {
+        args[i].channel = channel;
+        args[i].index = i;
+        args[i].failed = true;
+        EXPECT_EQ(0, bthread_start_background(
+                      &tids[i], NULL, CallEcho, &args[i]));
+    }
+    for (int i = 0; i < NCALL; ++i) {
+        bthread_join(tids[i], NULL);
+        EXPECT_FALSE(args[i].failed) << "call " << i;
+    }
+    brpc::SocketUniquePtr main_sock;
+    EXPECT_EQ(0, brpc::Socket::Address(channel->_server_id, &main_sock));
+    int numfree = 0;
+    int numinflight = 0;
+    EXPECT_TRUE(main_sock->GetPooledSocketStats(&numfree, &numinflight));
+    EXPECT_EQ(0, numinflight);
+    return numfree;
+}
+
+TEST(PooledMultiplexTest, bounded_multiplexing_caps_connections) {
+    SleepyEchoService service;
+    brpc::Server server;
+    ASSERT_EQ(0, server.AddService(&service, brpc::SERVER_DOESNT_OWN_SERVICE));
+    ASSERT_EQ(0, server.Start(8717, NULL));
+
+    brpc::ChannelOptions options;
+    options.connection_type = "pooled";
+    options.timeout_ms = 5000;
+
+    // Default (exclusive): overlapping calls each take a connection.
+    {
+        brpc::Channel channel;
+        ASSERT_EQ(0, channel.Init("127.0.0.1:8717", &options));
+        const int nconn = RunOverlappingCalls(&channel);
+        ASSERT_GE(nconn, 16) << "expected roughly one connection per call";
+    }
+
+    // With multiplexing, up to 8 concurrent calls share a connection.
+    ASSERT_FALSE(GFLAGS_NS::SetCommandLineOption(
+        "max_pooled_multiplex_calls", "8").empty());
+    {
+        brpc::Channel channel;
+        ASSERT_EQ(0, channel.Init("127.0.0.1:8717", &options));
+        const int nconn = RunOverlappingCalls(&channel);
+        ASSERT_LE(nconn, 8) << "connections not bounded by multiplexing";
+        ASSERT_GE(nconn, 1);
+    }
+    ASSERT_FALSE(GFLAGS_NS::SetCommandLineOption(
+        "max_pooled_multiplex_calls", "1").empty());
+
+    server.Stop(0);
+    server.Join();
+}
+
+} // namespace
@@ -21,7 +21,9 @@
 #include "brpc/server.h"
 #include "brpc/channel.h"
 #include "brpc/controller.h"
+#include "brpc/builtin/prometheus_metrics_service.h"
 #include "butil/strings/string_piece.h"
+#include "bvar/bvar.h"
 #include "echo.pb.h"
 
 int main(int argc, char* argv[]) {
@@ -142,3 +144,25 @@ TEST(PrometheusMetrics, sanity) {
     ASSERT_EQ(0, server.Stop(0));
     ASSERT_EQ(0, server.Join());
 }
+
+TEST(PrometheusMetrics, cached_gauges) {
+    bvar::Status<int64_t> gauge("test_cached_gauge", 42);
+    butil::IOBuf first;
+    ASSERT_EQ(0, brpc::DumpPrometheusMetricsToIOBuf(&first));
+    ASSERT_NE(butil::StringPiece::npos,
+              first.to_string().find("test_cached_gauge 42\n"));
+    // Unchanged value must be served from the cache identically.
+    butil::IOBuf second;
+    ASSERT_EQ(0, brpc::DumpPrometheusMetricsToIOBuf(&second));
+    ASSERT_NE(butil::StringPiece::npos,
+              second.to_string().find("test_cached_gauge 42\n"));
+    // A changed value must be re-rendered.
+    gauge.set_value(43);
+    butil::IOBuf third;
+    ASSERT_EQ(0, brpc::DumpPrometheusMetricsToIOBuf(&third));
+    const std::string third_str = third.to_string();
+    ASSERT_NE(butil::StringPiece::npos,
+              third_str.find("test_cached_gauge 43\n"));
+    ASSERT_EQ(butil::StringPiece::npos,
+              third_str.find("test_cached_gauge 42\n"));
+}
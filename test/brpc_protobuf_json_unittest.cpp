@@ -1094,6 +1094,59 @@ TEST_F(ProtobufJsonTest, pb_to_json_unicode_case) {
     ASSERT_TRUE(!info1.compare(buf.to_string()));
 }
                  
+TEST_F(ProtobufJsonTest, pb_to_json_array_emitter) {
+    // Emitting elements one by one produces the same array as converting
+    // a message holding all of them at once.
+    AddressBook address_book;
+    butil::IOBuf streamed;
+    butil::IOBufAsZeroCopyOutputStream stream(&streamed);
+    json2pb::Pb2JsonOptions option;
+    json2pb::PbToJsonArrayEmitter emitter(&stream, option);
+    for (int i = 0; i < 3; ++i) {
+        Person* person = address_book.add_person();
+        person->set_id(100 + i);
+        person->set_name("baidu");
+        person->set_datadouble(-345.67);
+        person->set_datafloat(8.6123);
+        ASSERT_TRUE(emitter.Emit(*person)) << emitter.ErrorText();
+    }
+    emitter.Done();
+
+    std::string batch;
+    std::string error;
+    ASSERT_TRUE(json2pb::ProtoMessageToJson(address_book, &batch, &error));
+    // Strip the wrapping {"person": ... }
+    const std::string expected =
+        batch.substr(batch.find('['), batch.rfind(']') - batch.find('[') + 1);
+    ASSERT_EQ(expected, streamed.to_string());
+
+    // The repeated-field walker writes the same array.
+    butil::IOBuf walked;
+    butil::IOBufAsZeroCopyOutputStream stream2(&walked);
+    const google::protobuf::FieldDescriptor* person_field =
+        address_book.GetDescriptor()->FindFieldByName("person");
+    ASSERT_TRUE(json2pb::ProtoMessageToJsonStream(
+                    address_book, person_field, &stream2, option, &error))
+        << error;
+    ASSERT_EQ(expected, walked.to_string());
+
+    // Non-repeated fields are rejected.
+    const google::protobuf::FieldDescriptor* name_field =
+        Person::descriptor()->FindFieldByName("name");
+    butil::IOBuf dummy;
+    butil::IOBufAsZeroCopyOutputStream stream3(&dummy);
+    ASSERT_FALSE(json2pb::ProtoMessageToJsonStream(
+                     address_book, name_field, &stream3, option, &error));
+
+    // An emitter without any Emit() still closes into an empty array.
+    butil::IOBuf empty;
+    butil::IOBufAsZeroCopyOutputStream stream4(&empty);
+    {
+        json2pb::PbToJsonArrayEmitter empty_emitter(&stream4);
+    }
+    ASSERT_EQ("[]", empty.to_string());
+}
+
 TEST_F(ProtobufJsonTest, pb_to_json_edge_case) {
     AddressBook address_book;
     
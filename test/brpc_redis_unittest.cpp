@@ -25,6 +25,7 @@
 #include <brpc/policy/redis_authenticator.h>
 #include <brpc/server.h>
 #include <brpc/redis_command.h>
+#include <brpc/redis_cluster_channel.h>
 #include <gtest/gtest.h>
 
 namespace brpc {
@@ -550,6 +551,61 @@ TEST_F(RedisTest, quote_and_escape) {
     request.Clear();
 }
 
+TEST_F(RedisTest, cluster_key_slot) {
+    // Check value of CRC16-CCITT, also the slot since 0x31C3 < 16384.
+    ASSERT_EQ(0x31C3, brpc::RedisClusterChannel::KeySlot("123456789"));
+    // Keys sharing a hash tag map to the slot of the tag content.
+    const int slot = brpc::RedisClusterChannel::KeySlot("user1000");
+    ASSERT_EQ(slot, brpc::RedisClusterChannel::KeySlot("{user1000}.following"));
+    ASSERT_EQ(slot, brpc::RedisClusterChannel::KeySlot("foo{user1000}bar"));
+    // An empty tag does not count, the whole key is hashed.
+    ASSERT_NE(brpc::RedisClusterChannel::KeySlot("foo"),
+              brpc::RedisClusterChannel::KeySlot("{}foo"));
+    // Only the first tag is considered.
+    ASSERT_EQ(brpc::RedisClusterChannel::KeySlot("{a}{b}"),
+              brpc::RedisClusterChannel::KeySlot("{a}{c}"));
+    // All slots must be in range for arbitrary keys.
+    for (int i = 0; i < 1000; ++i) {
+        char key[16];
+        snprintf(key, sizeof(key), "key-%d", i);
+        const int s = brpc::RedisClusterChannel::KeySlot(key);
+        ASSERT_GE(s, 0);
+        ASSERT_LT(s, 16384);
+    }
+}
+
+TEST_F(RedisTest, first_command_key) {
+    brpc::RedisRequest request;
+    std::string key;
+    ASSERT_FALSE(request.GetFirstCommandKey(&key));
+
+    ASSERT_TRUE(request.AddCommand("GET mykey"));
+    ASSERT_TRUE(request.GetFirstCommandKey(&key));
+    ASSERT_EQ("mykey", key);
+    request.Clear();
+
+    // Routing follows the first command of a pipeline.
+    ASSERT_TRUE(request.AddCommand("SET {tag}k1 v1"));
+    ASSERT_TRUE(request.AddCommand("SET {tag}k2 v2"));
+    ASSERT_TRUE(request.GetFirstCommandKey(&key));
+    ASSERT_EQ("{tag}k1", key);
+    request.Clear();
+
+    // Keyless commands have nothing to route on.
+    ASSERT_TRUE(request.AddCommand("PING"));
+    ASSERT_FALSE(request.GetFirstCommandKey(&key));
+    request.Clear();
+
+    // Binary keys survive extraction.
+    butil::StringPiece components[3];
+    components[0] = "SET";
+    components[1] = butil::StringPiece("a\0b", 3);
+    components[2] = "value";
+    ASSERT_TRUE(request.AddCommandByComponents(components, 3));
+    ASSERT_TRUE(request.GetFirstCommandKey(&key));
+    ASSERT_EQ(std::string("a\0b", 3), key);
+}
+
 std::string GetCompleteCommand(const std::vector<butil::StringPiece>& commands) {
 	std::string res;
     for (int i = 0; i < (int)commands.size(); ++i) {
@@ -803,6 +859,70 @@ TEST_F(RedisTest, redis_reply_codec) {
     }
 }
 
+TEST_F(RedisTest, integer_header_edge_cases) {
+    butil::Arena arena;
+    // 64-bit boundaries
+    {
+        brpc::RedisReply r(&arena);
+        butil::IOBuf buf;
+        buf.append(":9223372036854775807\r\n");
+        ASSERT_EQ(brpc::PARSE_OK, r.ConsumePartialIOBuf(buf));
+        ASSERT_EQ(std::numeric_limits<int64_t>::max(), r.integer());
+
+        brpc::RedisReply r2(&arena);
+        buf.append(":-42\r\n");
+        ASSERT_EQ(brpc::PARSE_OK, r2.ConsumePartialIOBuf(buf));
+        ASSERT_EQ(-42, r2.integer());
+    }
+    // overflowing or malformed integers are rejected instead of being
+    // silently clamped (as strtoll does)
+    {
+        const char* bad_input[] = {
+            ":9223372036854775808\r\n",  // INT64_MAX + 1
+            ":12a3\r\n",
+            ":+12\r\n",
+            ":\r\n",
+            ":-\r\n",
+            // no CRLF within the first 32 bytes, can never become valid
+            ":00000000000000000000000000000001\r\n",
+        };
+        for (size_t i = 0; i < arraysize(bad_input); ++i) {
+            brpc::RedisReply r(&arena);
+            butil::IOBuf buf;
+            buf.append(bad_input[i]);
+            ASSERT_EQ(brpc::PARSE_ERROR_ABSOLUTELY_WRONG,
+                      r.ConsumePartialIOBuf(buf)) << bad_input[i];
+        }
+    }
+    // headers cut off anywhere are still just not-enough-data
+    {
+        brpc::RedisReply r(&arena);
+        butil::IOBuf buf;
+        buf.append(":123");
+        ASSERT_EQ(brpc::PARSE_ERROR_NOT_ENOUGH_DATA, r.ConsumePartialIOBuf(buf));
+        buf.append("45\r");
+        ASSERT_EQ(brpc::PARSE_ERROR_NOT_ENOUGH_DATA, r.ConsumePartialIOBuf(buf));
+        buf.append("\n");
+        ASSERT_EQ(brpc::PARSE_OK, r.ConsumePartialIOBuf(buf));
+        ASSERT_EQ(12345, r.integer());
+    }
+    // same checks apply to the command parser
+    {
+        brpc::RedisCommandParser parser;
+        butil::IOBuf buf;
+        std::vector<butil::StringPiece> command_out;
+        buf.append("*00000000000000000000000000000001\r\n$4\r\nping\r\n");
+        ASSERT_EQ(brpc::PARSE_ERROR_ABSOLUTELY_WRONG,
+                  parser.Consume(buf, &command_out, &arena));
+        parser.Reset();
+        buf.clear();
+        buf.append("*1x\r\n");
+        ASSERT_EQ(brpc::PARSE_ERROR_ABSOLUTELY_WRONG,
+                  parser.Consume(buf, &command_out, &arena));
+        parser.Reset();
+    }
+}
+
 butil::Mutex s_mutex;
 std::unordered_map<std::string, std::string> m;
 std::unordered_map<std::string, int64_t> int_map;
@@ -1023,6 +1143,68 @@ TEST_F(RedisTest, server_sanity) {
     ASSERT_EQ("", response.reply(3).data());
 }
 
+class InlinePingHandler : public brpc::RedisCommandHandler {
+public:
+    InlinePingHandler() : _ninline(0), _nrun(0) {}
+
+    bool RunInline(const std::vector<butil::StringPiece>& args,
+                   brpc::RedisInlineReplyWriter* writer) {
+        if (args.size() != 1) {
+            // Exercise the fallback to Run().
+            return false;
+        }
+        ++_ninline;
+        writer->AddStatus("PONG");
+        return true;
+    }
+
+    brpc::RedisCommandHandlerResult Run(const std::vector<butil::StringPiece>& args,
+                                        brpc::RedisReply* output,
+                                        bool /*flush_batched*/) {
+        ++_nrun;
+        output->SetString(args[1].as_string());
+        return brpc::REDIS_CMD_HANDLED;
+    }
+
+    int _ninline;
+    int _nrun;
+};
+
+TEST_F(RedisTest, server_inline_reply) {
+    brpc::Server server;
+    brpc::ServerOptions server_options;
+    RedisServiceImpl* rsimpl = new RedisServiceImpl;
+    InlinePingHandler* ph = new InlinePingHandler;
+    rsimpl->AddCommandHandler("ping", ph);
+    server_options.redis_service = rsimpl;
+    brpc::PortRange pr(8081, 8900);
+    ASSERT_EQ(0, server.Start("127.0.0.1", pr, &server_options));
+
+    brpc::ChannelOptions options;
+    options.protocol = brpc::PROTOCOL_REDIS;
+    brpc::Channel channel;
+    ASSERT_EQ(0, channel.Init("127.0.0.1", server.listen_address().port, &options));
+
+    brpc::RedisRequest request;
+    brpc::RedisResponse response;
+    brpc::Controller cntl;
+    ASSERT_TRUE(request.AddCommand("ping"));
+    // Uppercase verb must find the handler as well.
+    ASSERT_TRUE(request.AddCommand("PING"));
+    ASSERT_TRUE(request.AddCommand("ping hello"));
+    channel.CallMethod(NULL, &cntl, &request, &response, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    ASSERT_EQ(3, response.reply_size());
+    ASSERT_EQ(brpc::REDIS_REPLY_STATUS, response.reply(0).type());
+    ASSERT_STREQ("PONG", response.reply(0).c_str());
+    ASSERT_EQ(brpc::REDIS_REPLY_STATUS, response.reply(1).type());
+    ASSERT_STREQ("PONG", response.reply(1).c_str());
+    ASSERT_EQ(brpc::REDIS_REPLY_STRING, response.reply(2).type());
+    ASSERT_STREQ("hello", response.reply(2).c_str());
+    ASSERT_EQ(2, ph->_ninline);
+    ASSERT_EQ(1, ph->_nrun);
+}
+
 void* incr_thread(void* arg) {
     brpc::Channel* c = static_cast<brpc::Channel*>(arg);
 
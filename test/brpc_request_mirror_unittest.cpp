@@ -0,0 +1,181 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// brpc - A framework to host and access services throughout Baidu.
+
+#include <gtest/gtest.h>
+#include <butil/time.h>
+#include <butil/atomicops.h>
+#include "brpc/server.h"
+#include "brpc/channel.h"
+#include "brpc/controller.h"
+#include "brpc/request_mirror.h"
+#include "echo.pb.h"
+
+int main(int argc, char* argv[]) {
+    testing::InitGoogleTest(&argc, argv);
+    GFLAGS_NS::ParseCommandLineFlags(&argc, &argv, true);
+    return RUN_ALL_TESTS();
+}
+
+namespace {
+
+class EchoServiceImpl : public test::EchoService {
+public:
+    EchoServiceImpl() : count(0), sleep_ms(0) {}
+    virtual ~EchoServiceImpl() {}
+    virtual void Echo(google::protobuf::RpcController*,
+                      const test::EchoRequest* request,
+                      test::EchoResponse* response,
+                      google::protobuf::Closure* done) {
+        brpc::ClosureGuard done_guard(done);
+        if (sleep_ms > 0) {
+            bthread_usleep(sleep_ms * 1000L);
+        }
+        count.fetch_add(1, butil::memory_order_relaxed);
+        response->set_message(request->message());
+    }
+
+    butil::atomic<int64_t> count;
+    int sleep_ms;
+};
+
+class RequestMirrorTest : public ::testing::Test {
+protected:
+    RequestMirrorTest() {}
+    virtual ~RequestMirrorTest() {}
+};
+
+TEST_F(RequestMirrorTest, init_validation) {
+    brpc::RequestMirror mirror;
+    brpc::RequestMirrorOptions options;
+    // Destination is required.
+    ASSERT_EQ(-1, mirror.Init(options));
+    options.naming_service_url = "127.0.0.1:8618";
+    options.sample_percent = 101;
+    ASSERT_EQ(-1, mirror.Init(options));
+    options.sample_percent = 5;
+    options.max_inflight = 0;
+    ASSERT_EQ(-1, mirror.Init(options));
+    options.max_inflight = 16;
+    ASSERT_EQ(0, mirror.Init(options));
+
+    // An uninitialized mirror never samples.
+    brpc::RequestMirror idle_mirror;
+    ASSERT_FALSE(idle_mirror.Sample());
+}
+
+TEST_F(RequestMirrorTest, mirror_sampled_requests) {
+    EchoServiceImpl mirror_impl;
+    brpc::Server mirror_server;
+    ASSERT_EQ(0, mirror_server.AddService(&mirror_impl,
+                                          brpc::SERVER_DOESNT_OWN_SERVICE));
+    ASSERT_EQ(0, mirror_server.Start(8618, NULL));
+
+    brpc::RequestMirror mirror;
+    brpc::RequestMirrorOptions mirror_options;
+    mirror_options.naming_service_url = "127.0.0.1:8618";
+    mirror_options.sample_percent = 100;
+    ASSERT_EQ(0, mirror.Init(mirror_options));
+    ASSERT_TRUE(mirror.Sample());
+
+    EchoServiceImpl impl;
+    brpc::Server server;
+    ASSERT_EQ(0, server.AddService(&impl, brpc::SERVER_DOESNT_OWN_SERVICE));
+    brpc::ServerOptions server_options;
+    server_options.request_mirror = &mirror;
+    ASSERT_EQ(0, server.Start(8619, &server_options));
+
+    brpc::Channel channel;
+    ASSERT_EQ(0, channel.Init("127.0.0.1:8619", NULL));
+    test::EchoService_Stub stub(&channel);
+    const int NCALL = 10;
+    for (int i = 0; i < NCALL; ++i) {
+        brpc::Controller cntl;
+        test::EchoRequest req;
+        test::EchoResponse res;
+        req.set_message("hello");
+        stub.Echo(&cntl, &req, &res, NULL);
+        ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+        ASSERT_EQ("hello", res.message());
+    }
+    ASSERT_EQ(NCALL, impl.count.load(butil::memory_order_relaxed));
+    // Mirrored calls are asynchronous, wait for their arrival.
+    for (int i = 0; i < 100 &&
+         mirror_impl.count.load(butil::memory_order_relaxed) < NCALL; ++i) {
+        bthread_usleep(30000);
+    }
+    ASSERT_EQ(NCALL, mirror_impl.count.load(butil::memory_order_relaxed));
+    ASSERT_EQ(NCALL, mirror._mirrored.get_value());
+    ASSERT_EQ(0, mirror._dropped.get_value());
+
+    server.Stop(0);
+    server.Join();
+    mirror_server.Stop(0);
+    mirror_server.Join();
+}
+
+TEST_F(RequestMirrorTest, drop_beyond_inflight_budget) {
+    EchoServiceImpl mirror_impl;
+    mirror_impl.sleep_ms = 100;
+    brpc::Server mirror_server;
+    ASSERT_EQ(0, mirror_server.AddService(&mirror_impl,
+                                          brpc::SERVER_DOESNT_OWN_SERVICE));
+    ASSERT_EQ(0, mirror_server.Start(8620, NULL));
+
+    brpc::RequestMirror mirror;
+    brpc::RequestMirrorOptions mirror_options;
+    mirror_options.naming_service_url = "127.0.0.1:8620";
+    mirror_options.sample_percent = 100;
+    mirror_options.max_inflight = 1;
+    mirror_options.timeout_ms = 2000;
+    ASSERT_EQ(0, mirror.Init(mirror_options));
+
+    EchoServiceImpl impl;
+    brpc::Server server;
+    ASSERT_EQ(0, server.AddService(&impl, brpc::SERVER_DOESNT_OWN_SERVICE));
+    brpc::ServerOptions server_options;
+    server_options.request_mirror = &mirror;
+    ASSERT_EQ(0, server.Start(8621, &server_options));
+
+    brpc::Channel channel;
+    ASSERT_EQ(0, channel.Init("127.0.0.1:8621", NULL));
+    test::EchoService_Stub stub(&channel);
+    const int NCALL = 20;
+    for (int i = 0; i < NCALL; ++i) {
+        brpc::Controller cntl;
+        test::EchoRequest req;
+        test::EchoResponse res;
+        req.set_message("hello");
+        stub.Echo(&cntl, &req, &res, NULL);
+        ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    }
+    // The mirror destination sleeps 100ms per call with an inflight
+    // budget of 1, most of the back-to-back requests must be dropped
+    // instead of piling up.
+    ASSERT_EQ(NCALL, impl.count.load(butil::memory_order_relaxed));
+    ASSERT_GT(mirror._dropped.get_value(), 0);
+    ASSERT_EQ(NCALL, mirror._mirrored.get_value() +
+                     mirror._dropped.get_value());
+
+    server.Stop(0);
+    server.Join();
+    mirror_server.Stop(0);
+    mirror_server.Join();
+}
+
+} // namespace
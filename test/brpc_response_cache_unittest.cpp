@@ -0,0 +1,177 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// brpc - A framework to host and access services throughout Baidu.
+
+#include <gtest/gtest.h>
+#include <butil/time.h>
+#include <butil/atomicops.h>
+#include "brpc/server.h"
+#include "brpc/channel.h"
+#include "brpc/controller.h"
+#include "brpc/response_cache.h"
+#include "echo.pb.h"
+
+int main(int argc, char* argv[]) {
+    testing::InitGoogleTest(&argc, argv);
+    GFLAGS_NS::ParseCommandLineFlags(&argc, &argv, true);
+    return RUN_ALL_TESTS();
+}
+
+namespace {
+
+const std::string EXP_RESPONSE = "world";
+
+class EchoServiceImpl : public test::EchoService {
+public:
+    EchoServiceImpl() : count(0) {}
+    virtual ~EchoServiceImpl() {}
+    virtual void Echo(google::protobuf::RpcController*,
+                      const test::EchoRequest* request,
+                      test::EchoResponse* response,
+                      google::protobuf::Closure* done) {
+        brpc::ClosureGuard done_guard(done);
+        count.fetch_add(1, butil::memory_order_relaxed);
+        response->set_message(EXP_RESPONSE + request->message());
+    }
+
+    butil::atomic<int64_t> count;
+};
+
+class ResponseCacheTest : public ::testing::Test {
+protected:
+    ResponseCacheTest() {}
+    virtual ~ResponseCacheTest() {}
+};
+
+static butil::IOBuf MakeBuf(const std::string& s) {
+    butil::IOBuf buf;
+    buf.append(s);
+    return buf;
+}
+
+TEST_F(ResponseCacheTest, put_get) {
+    brpc::ResponseCacheOptions options;
+    brpc::ResponseCache cache(options);
+    butil::IOBuf out;
+    ASSERT_FALSE(cache.Get("key1", &out));
+    cache.Put("key1", MakeBuf("value1"));
+    ASSERT_EQ(1UL, cache.size());
+    ASSERT_EQ(6UL, cache.bytes());
+    ASSERT_TRUE(cache.Get("key1", &out));
+    ASSERT_EQ("value1", out.to_string());
+    // Replacing an entry does not double-count its bytes.
+    cache.Put("key1", MakeBuf("longer_value1"));
+    ASSERT_EQ(1UL, cache.size());
+    ASSERT_EQ(13UL, cache.bytes());
+    ASSERT_TRUE(cache.Get("key1", &out));
+    ASSERT_EQ("longer_value1", out.to_string());
+    ASSERT_FALSE(cache.Get("key2", &out));
+}
+
+TEST_F(ResponseCacheTest, ttl) {
+    brpc::ResponseCacheOptions options;
+    options.ttl_ms = 50;
+    brpc::ResponseCache cache(options);
+    cache.Put("key1", MakeBuf("value1"));
+    butil::IOBuf out;
+    ASSERT_TRUE(cache.Get("key1", &out));
+    usleep(options.ttl_ms * 1000L + 20000);
+    ASSERT_FALSE(cache.Get("key1", &out));
+    // Stale entries are removed on Get.
+    ASSERT_EQ(0UL, cache.size());
+    ASSERT_EQ(0UL, cache.bytes());
+}
+
+TEST_F(ResponseCacheTest, evict_by_bytes) {
+    brpc::ResponseCacheOptions options;
+    options.max_bytes = 16;
+    brpc::ResponseCache cache(options);
+    cache.Put("key1", MakeBuf("12345678"));
+    cache.Put("key2", MakeBuf("12345678"));
+    ASSERT_EQ(2UL, cache.size());
+    ASSERT_EQ(16UL, cache.bytes());
+    butil::IOBuf out;
+    // Refresh key1 so that key2 is the least recently used.
+    ASSERT_TRUE(cache.Get("key1", &out));
+    cache.Put("key3", MakeBuf("1234"));
+    ASSERT_FALSE(cache.Get("key2", &out));
+    ASSERT_TRUE(cache.Get("key1", &out));
+    ASSERT_TRUE(cache.Get("key3", &out));
+    ASSERT_LE(cache.bytes(), options.max_bytes);
+    // Responses larger than the bound are not cached at all.
+    cache.Put("key4", MakeBuf("12345678123456781"));
+    ASSERT_FALSE(cache.Get("key4", &out));
+}
+
+TEST_F(ResponseCacheTest, cached_calls_skip_network) {
+    brpc::Server server;
+    EchoServiceImpl service;
+    ASSERT_EQ(0, server.AddService(&service, brpc::SERVER_DOESNT_OWN_SERVICE));
+    ASSERT_EQ(0, server.Start(8617, NULL));
+
+    brpc::ResponseCacheOptions cache_options;
+    cache_options.ttl_ms = 300;
+    brpc::ResponseCache cache(cache_options);
+    brpc::ChannelOptions options;
+    options.response_cache = &cache;
+    brpc::Channel channel;
+    ASSERT_EQ(0, channel.Init("127.0.0.1:8617", &options));
+    test::EchoService_Stub stub(&channel);
+
+    // The second identical call is served from the cache.
+    for (int i = 0; i < 2; ++i) {
+        brpc::Controller cntl;
+        test::EchoRequest req;
+        test::EchoResponse res;
+        req.set_message("hello");
+        stub.Echo(&cntl, &req, &res, NULL);
+        ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+        ASSERT_EQ(EXP_RESPONSE + "hello", res.message());
+    }
+    ASSERT_EQ(1, service.count.load(butil::memory_order_relaxed));
+
+    // A different request does not hit the cache.
+    {
+        brpc::Controller cntl;
+        test::EchoRequest req;
+        test::EchoResponse res;
+        req.set_message("hello2");
+        stub.Echo(&cntl, &req, &res, NULL);
+        ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+        ASSERT_EQ(EXP_RESPONSE + "hello2", res.message());
+    }
+    ASSERT_EQ(2, service.count.load(butil::memory_order_relaxed));
+
+    // The entry expires after ttl_ms and the call goes out again.
+    usleep(cache_options.ttl_ms * 1000L + 20000);
+    {
+        brpc::Controller cntl;
+        test::EchoRequest req;
+        test::EchoResponse res;
+        req.set_message("hello");
+        stub.Echo(&cntl, &req, &res, NULL);
+        ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+        ASSERT_EQ(EXP_RESPONSE + "hello", res.message());
+    }
+    ASSERT_EQ(3, service.count.load(butil::memory_order_relaxed));
+
+    ASSERT_EQ(0, server.Stop(0));
+    ASSERT_EQ(0, server.Join());
+}
+
+} //namespace
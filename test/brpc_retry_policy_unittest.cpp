@@ -0,0 +1,101 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// brpc - A framework to host and access services throughout Baidu.
+
+#include <gtest/gtest.h>
+#include <gflags/gflags.h>
+#include "brpc/controller.h"
+#include "brpc/retry_policy.h"
+#include "brpc/errno.pb.h"
+
+int main(int argc, char* argv[]) {
+    testing::InitGoogleTest(&argc, argv);
+    GFLAGS_NS::ParseCommandLineFlags(&argc, &argv, true);
+    return RUN_ALL_TESTS();
+}
+
+namespace brpc {
+DECLARE_int32(retry_budget_percent);
+}
+
+namespace {
+
+class RetryPolicyTest : public ::testing::Test {};
+
+static void SetRetryContext(brpc::Controller* cntl, int error_code,
+                            int nretry) {
+    cntl->_error_code = error_code;
+    cntl->_current_call.nretry = nretry;
+}
+
+TEST_F(RetryPolicyTest, default_policy_has_no_backoff) {
+    brpc::Controller cntl;
+    SetRetryContext(&cntl, brpc::EOVERCROWDED, 1);
+    ASSERT_EQ(0, brpc::DefaultRetryPolicy()->GetBackoffTimeMs(&cntl));
+}
+
+TEST_F(RetryPolicyTest, exponential_backoff_with_jitter) {
+    brpc::RetryPolicyWithBackoff policy(10, 1000);
+    brpc::Controller cntl;
+
+    // Jittered over [0, base * 2^(nretry-1)], capped by the maximum.
+    SetRetryContext(&cntl, brpc::EOVERCROWDED, 1);
+    ASSERT_TRUE(policy.DoRetry(&cntl));
+    for (int i = 0; i < 100; ++i) {
+        const int32_t ms = policy.GetBackoffTimeMs(&cntl);
+        ASSERT_GE(ms, 0);
+        ASSERT_LE(ms, 10);
+    }
+    SetRetryContext(&cntl, brpc::EOVERCROWDED, 5);
+    for (int i = 0; i < 100; ++i) {
+        ASSERT_LE(policy.GetBackoffTimeMs(&cntl), 160);
+    }
+    SetRetryContext(&cntl, brpc::EOVERCROWDED, 20);
+    for (int i = 0; i < 100; ++i) {
+        ASSERT_LE(policy.GetBackoffTimeMs(&cntl), 1000);
+    }
+
+    // Instance-level errors are retried immediately: the broken server
+    // was fed into its CircuitBreaker and excluded from selection.
+    SetRetryContext(&cntl, ECONNREFUSED, 1);
+    ASSERT_TRUE(policy.DoRetry(&cntl));
+    ASSERT_EQ(0, policy.GetBackoffTimeMs(&cntl));
+    SetRetryContext(&cntl, brpc::EFAILEDSOCKET, 3);
+    ASSERT_EQ(0, policy.GetBackoffTimeMs(&cntl));
+}
+
+TEST_F(RetryPolicyTest, retry_budget) {
+    // Disabled by default, retries are never denied.
+    ASSERT_EQ(0, brpc::FLAGS_retry_budget_percent);
+    ASSERT_TRUE(brpc::ConsumeRetryBudget());
+
+    brpc::FLAGS_retry_budget_percent = 10;
+    // Drain tokens possibly earned by other tests.
+    while (brpc::ConsumeRetryBudget()) {
+    }
+    // 10 begun requests earn exactly one retry at 10 percent.
+    for (int i = 0; i < 10; ++i) {
+        ASSERT_FALSE(brpc::ConsumeRetryBudget());
+        brpc::AddRetryBudget();
+    }
+    ASSERT_TRUE(brpc::ConsumeRetryBudget());
+    ASSERT_FALSE(brpc::ConsumeRetryBudget());
+    brpc::FLAGS_retry_budget_percent = 0;
+}
+
+} // namespace
@@ -255,6 +255,38 @@ private:
     int64_t _sleep_ms;
 };
 
+class FanoutStream : public brpc::RtmpServerStream {
+public:
+    void OnPlay(const brpc::RtmpPlayOptions& opt,
+                butil::Status* /*status*/,
+                google::protobuf::Closure* done) {
+        brpc::ClosureGuard done_guard(done);
+        LOG(INFO) << remote_side() << "|stream=" << stream_id()
+                  << ": Got play{stream_name=" << opt.stream_name << '}';
+    }
+};
+
+class FanoutService : public brpc::RtmpService {
+public:
+    brpc::RtmpServerStream* NewStream(const brpc::RtmpConnectRequest&) {
+        FanoutStream* stream = new FanoutStream;
+        BAIDU_SCOPED_LOCK(_mutex);
+        _streams.push_back(stream);
+        return stream;
+    }
+    std::vector<brpc::RtmpStreamBase*> streams() {
+        BAIDU_SCOPED_LOCK(_mutex);
+        std::vector<brpc::RtmpStreamBase*> copies;
+        for (size_t i = 0; i < _streams.size(); ++i) {
+            copies.push_back(_streams[i].get());
+        }
+        return copies;
+    }
+private:
+    butil::Mutex _mutex;
+    std::vector<butil::intrusive_ptr<FanoutStream> > _streams;
+};
+
 class PublishStream : public brpc::RtmpServerStream {
 public:
     PublishStream(int64_t sleep_ms)
@@ -555,6 +587,77 @@ TEST(RtmpTest, successfully_play_streams) {
     LOG(INFO) << "Quiting program...";
 }
 
+TEST(RtmpTest, send_messages_to_streams) {
+    FanoutService rtmp_service;
+    brpc::Server server;
+    brpc::ServerOptions server_opt;
+    server_opt.rtmp_service = &rtmp_service;
+    ASSERT_EQ(0, server.Start(8571, &server_opt));
+
+    brpc::RtmpClientOptions rtmp_opt;
+    rtmp_opt.app = "hello";
+    rtmp_opt.swfUrl = "anything";
+    rtmp_opt.tcUrl = "rtmp://heheda";
+    brpc::RtmpClient rtmp_client;
+    ASSERT_EQ(0, rtmp_client.Init("localhost:8571", rtmp_opt));
+
+    // Create multiple subscribers.
+    const int NSTREAM = 3;
+    brpc::DestroyingPtr<TestRtmpClientStream> cstreams[NSTREAM];
+    for (int i = 0; i < NSTREAM; ++i) {
+        cstreams[i].reset(new TestRtmpClientStream);
+        brpc::RtmpClientStreamOptions opt;
+        opt.play_name = butil::string_printf("play_name_%d", i);
+        opt.wait_until_play_or_publish_is_sent = true;
+        cstreams[i]->Init(&rtmp_client, opt);
+    }
+    // Wait until all play requests are processed at server-side.
+    std::vector<brpc::RtmpStreamBase*> sstreams;
+    for (int i = 0; i < 50; ++i) {
+        sstreams = rtmp_service.streams();
+        if ((int)sstreams.size() == NSTREAM) {
+            break;
+        }
+        bthread_usleep(100000);
+    }
+    ASSERT_EQ((size_t)NSTREAM, sstreams.size());
+    bthread_usleep(100000);
+
+    // Fan the same messages out to all subscribers, the payload is
+    // serialized once and shared.
+    brpc::RtmpVideoMessage vmsg;
+    brpc::RtmpAudioMessage amsg;
+    vmsg.timestamp = 1000;
+    amsg.timestamp = 1000;
+    for (int i = 0; i < 3; ++i) {
+        vmsg.timestamp += 20;
+        amsg.timestamp += 20;
+
+        vmsg.frame_type = brpc::FLV_VIDEO_FRAME_KEYFRAME;
+        vmsg.codec = brpc::FLV_VIDEO_AVC;
+        vmsg.data.clear();
+        vmsg.data.append(butil::string_printf("fanout_video_%d", i));
+        ASSERT_EQ((size_t)NSTREAM, brpc::RtmpStreamBase::
+                  SendVideoMessageToStreams(&sstreams[0], sstreams.size(),
+                                            vmsg));
+
+        amsg.codec = brpc::FLV_AUDIO_AAC;
+        amsg.rate = brpc::FLV_SOUND_RATE_44100HZ;
+        amsg.bits = brpc::FLV_SOUND_16BIT;
+        amsg.type = brpc::FLV_SOUND_STEREO;
+        amsg.data.clear();
+        amsg.data.append(butil::string_printf("fanout_audio_%d", i));
+        ASSERT_EQ((size_t)NSTREAM, brpc::RtmpStreamBase::
+                  SendAudioMessageToStreams(&sstreams[0], sstreams.size(),
+                                            amsg));
+    }
+    sleep(1);
+    for (int i = 0; i < NSTREAM; ++i) {
+        cstreams[i]->assertions_on_successful_play();
+    }
+    LOG(INFO) << "Quiting program...";
+}
+
 TEST(RtmpTest, fail_to_play_streams) {
     PlayingDummyService rtmp_service;
     brpc::Server server;
@@ -47,6 +47,7 @@
 #include "brpc/builtin/sockets_service.h"      // SocketsService
 #include "brpc/builtin/bad_method_service.h"
 #include "brpc/server.h"
+#include "brpc/details/server_private_accessor.h"
 #include "brpc/restful.h"
 #include "brpc/channel.h"
 #include "brpc/socket_map.h"
@@ -64,6 +65,8 @@ int main(int argc, char* argv[]) {
 namespace brpc {
 DECLARE_bool(enable_threads_service);
 DECLARE_bool(enable_dir_service);
+DECLARE_bool(baidu_std_save_serialized_request);
+DECLARE_bool(baidu_std_propagate_timeout);
 }
 
 namespace {
@@ -994,6 +997,126 @@ TEST_F(ServerTest, add_remove_service) {
     ASSERT_EQ(0ul, server.service_count());
 }
 
+TEST_F(ServerTest, find_method_by_index) {
+    brpc::Server server;
+    EchoServiceImpl echo_svc;
+    ASSERT_EQ(0, server.AddService(
+        &echo_svc, brpc::SERVER_DOESNT_OWN_SERVICE));
+    butil::EndPoint ep;
+    ASSERT_EQ(0, str2endpoint("127.0.0.1:8613", &ep));
+    ASSERT_EQ(0, server.Start(ep, NULL));
+
+    brpc::ServerPrivateAccessor accessor(&server);
+    const brpc::Server::MethodProperty* mp =
+        accessor.FindMethodPropertyByFullName(
+            test::EchoService::descriptor()->full_name(), "Echo");
+    ASSERT_TRUE(mp != NULL);
+    ASSERT_GE(mp->index, 0);
+    ASSERT_EQ(mp, accessor.FindMethodPropertyByIndex(mp->index));
+    ASSERT_TRUE(NULL == accessor.FindMethodPropertyByIndex(-1));
+    ASSERT_TRUE(NULL == accessor.FindMethodPropertyByIndex(99999999));
+
+    ASSERT_EQ(0, server.Stop(0));
+    ASSERT_EQ(0, server.Join());
+}
+
+static int g_ic_ctx_seed = 0;
+static std::vector<int> g_ic_after_ctxs;
+
+static int MarkBefore(brpc::Controller*,
+                      const google::protobuf::Message*, void** ctx) {
+    *ctx = (void*)(intptr_t)++g_ic_ctx_seed;
+    return 0;
+}
+static void MarkAfter(brpc::Controller*, void* ctx) {
+    g_ic_after_ctxs.push_back((int)(intptr_t)ctx);
+}
+static int RejectBefore(brpc::Controller*,
+                        const google::protobuf::Message*, void**) {
+    return EPERM;
+}
+
+TEST_F(ServerTest, method_interceptors) {
+    butil::EndPoint ep;
+    ASSERT_EQ(0, str2endpoint("127.0.0.1:8617", &ep));
+    g_ic_ctx_seed = 0;
+    g_ic_after_ctxs.clear();
+    {
+        brpc::Server server;
+        EchoServiceImpl echo_svc;
+        ASSERT_EQ(0, server.AddService(
+            &echo_svc, brpc::SERVER_DOESNT_OWN_SERVICE));
+        brpc::MethodInterceptor ic;
+        ic.before = MarkBefore;
+        ic.after = MarkAfter;
+        ASSERT_EQ(-1, server.AddMethodInterceptor(
+            "test.EchoService.UnknownMethod", ic));
+        // Two interceptors to verify ordering and per-interceptor contexts.
+        ASSERT_EQ(0, server.AddMethodInterceptor("test.EchoService.Echo", ic));
+        ASSERT_EQ(0, server.AddMethodInterceptor("test.EchoService.Echo", ic));
+        ASSERT_EQ(0, server.Start(ep, NULL));
+        // Too late to register.
+        ASSERT_EQ(-1, server.AddMethodInterceptor(
+            "test.EchoService.Echo", ic));
+
+        brpc::Channel chan;
+        ASSERT_EQ(0, chan.Init(ep, NULL));
+        brpc::Controller cntl;
+        test::EchoRequest req;
+        test::EchoResponse res;
+        req.set_message(EXP_REQUEST);
+        test::EchoService_Stub stub(&chan);
+        stub.Echo(&cntl, &req, &res, NULL);
+        ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+        ASSERT_EQ(EXP_RESPONSE, res.message());
+        // before() ran in order, after() in reverse order with the
+        // contexts set by the matching before().
+        ASSERT_EQ(2, g_ic_ctx_seed);
+        ASSERT_EQ(2u, g_ic_after_ctxs.size());
+        ASSERT_EQ(2, g_ic_after_ctxs[0]);
+        ASSERT_EQ(1, g_ic_after_ctxs[1]);
+        ASSERT_EQ(0, server.Stop(0));
+        ASSERT_EQ(0, server.Join());
+    }
+    {
+        brpc::Server server;
+        EchoServiceImpl echo_svc;
+        ASSERT_EQ(0, server.AddService(
+            &echo_svc, brpc::SERVER_DOESNT_OWN_SERVICE));
+        brpc::MethodInterceptor mark_ic;
+        mark_ic.before = MarkBefore;
+        mark_ic.after = MarkAfter;
+        brpc::MethodInterceptor reject_ic;
+        reject_ic.before = RejectBefore;
+        ASSERT_EQ(0, server.AddMethodInterceptor(
+            "test.EchoService.Echo", mark_ic));
+        ASSERT_EQ(0, server.AddMethodInterceptor(
+            "test.EchoService.Echo", reject_ic));
+        ASSERT_EQ(0, server.Start(ep, NULL));
+
+        g_ic_ctx_seed = 0;
+        g_ic_after_ctxs.clear();
+        const int64_t saved_count = echo_svc.count.load();
+        brpc::Channel chan;
+        ASSERT_EQ(0, chan.Init(ep, NULL));
+        brpc::Controller cntl;
+        test::EchoRequest req;
+        test::EchoResponse res;
+        req.set_message(EXP_REQUEST);
+        test::EchoService_Stub stub(&chan);
+        stub.Echo(&cntl, &req, &res, NULL);
+        ASSERT_TRUE(cntl.Failed());
+        ASSERT_EQ(EPERM, cntl.ErrorCode());
+        // The method was not called but after() of the interceptor that
+        // already ran before() was.
+        ASSERT_EQ(saved_count, echo_svc.count.load());
+        ASSERT_EQ(1u, g_ic_after_ctxs.size());
+        ASSERT_EQ(1, g_ic_after_ctxs[0]);
+        ASSERT_EQ(0, server.Stop(0));
+        ASSERT_EQ(0, server.Join());
+    }
+}
+
 void SendSleepRPC(butil::EndPoint ep, int sleep_ms, bool succ) {
     brpc::Channel channel;
     ASSERT_EQ(0, channel.Init(ep, NULL));
@@ -1171,6 +1294,138 @@ TEST_F(ServerTest, serving_requests) {
     ASSERT_EQ(0, server.Join());
 }
 
+class LazyEchoServiceImpl : public test::EchoService {
+public:
+    LazyEchoServiceImpl() : count(0) {}
+    virtual void Echo(google::protobuf::RpcController* cntl_base,
+                      const test::EchoRequest* request,
+                      test::EchoResponse* response,
+                      google::protobuf::Closure* done) {
+        brpc::ClosureGuard done_guard(done);
+        brpc::Controller* cntl = (brpc::Controller*)cntl_base;
+        ++count;
+        // The lazy field was cut out before parsing.
+        EXPECT_FALSE(request->has_lazy_blob());
+        EXPECT_EQ(EXP_REQUEST, request->message());
+        EXPECT_TRUE(cntl->has_lazy_request_field(6));
+        test::EchoRequest lazy_part;
+        EXPECT_TRUE(cntl->ParseLazyRequestField(6, &lazy_part));
+        EXPECT_EQ(std::string(100000, 'z'), lazy_part.lazy_blob());
+        response->set_message(EXP_RESPONSE);
+    }
+    butil::atomic<int> count;
+};
+
+TEST_F(ServerTest, lazy_request_fields) {
+    // Splitting serialized bytes keeps both parts parseable.
+    test::EchoRequest req;
+    req.set_message(EXP_REQUEST);
+    req.set_code(123);
+    req.set_lazy_blob(std::string(100000, 'z'));
+    butil::IOBuf wire;
+    butil::IOBufAsZeroCopyOutputStream wire_stream(&wire);
+    ASSERT_TRUE(req.SerializeToZeroCopyStream(&wire_stream));
+    std::vector<int> fields(1, 6);
+    butil::IOBuf eager;
+    std::vector<std::pair<int, butil::IOBuf> > lazy;
+    ASSERT_TRUE(brpc::RemoveLazyFieldsFromIOBuf(wire, fields, &eager, &lazy));
+    ASSERT_EQ(1u, lazy.size());
+    ASSERT_EQ(6, lazy[0].first);
+    ASSERT_EQ(wire.size(), eager.size() + lazy[0].second.size());
+    test::EchoRequest eager_part;
+    ASSERT_TRUE(brpc::ParsePbFromIOBuf(&eager_part, eager));
+    ASSERT_EQ(EXP_REQUEST, eager_part.message());
+    ASSERT_EQ(123, eager_part.code());
+    ASSERT_FALSE(eager_part.has_lazy_blob());
+    test::EchoRequest lazy_part;
+    butil::IOBufAsZeroCopyInputStream lazy_stream(lazy[0].second);
+    ASSERT_TRUE(lazy_part.ParsePartialFromZeroCopyStream(&lazy_stream));
+    ASSERT_EQ(req.lazy_blob(), lazy_part.lazy_blob());
+
+    // Unknown lazy field in valid data: nothing is removed.
+    butil::IOBuf eager2;
+    std::vector<std::pair<int, butil::IOBuf> > lazy2;
+    std::vector<int> absent_fields(1, 7);
+    ASSERT_TRUE(brpc::RemoveLazyFieldsFromIOBuf(
+                    wire, absent_fields, &eager2, &lazy2));
+    ASSERT_TRUE(lazy2.empty());
+    ASSERT_EQ(wire.size(), eager2.size());
+
+    // Served end-to-end through baidu_std.
+    butil::EndPoint ep;
+    ASSERT_EQ(0, str2endpoint("127.0.0.1:8619", &ep));
+    LazyEchoServiceImpl lazy_svc;
+    brpc::Server server;
+    brpc::ServiceOptions svc_opt;
+    svc_opt.ownership = brpc::SERVER_DOESNT_OWN_SERVICE;
+    svc_opt.lazy_request_fields = "Echo => 6";
+    ASSERT_EQ(0, server.AddService(&lazy_svc, svc_opt));
+    ASSERT_EQ(0, server.Start(ep, NULL));
+
+    brpc::Channel channel;
+    ASSERT_EQ(0, channel.Init(ep, NULL));
+    brpc::Controller cntl;
+    test::EchoResponse res;
+    test::EchoService_Stub stub(&channel);
+    stub.Echo(&cntl, &req, &res, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    ASSERT_EQ(EXP_RESPONSE, res.message());
+    ASSERT_EQ(1, lazy_svc.count.load());
+
+    ASSERT_EQ(0, server.Stop(0));
+    ASSERT_EQ(0, server.Join());
+
+    // Unparsable field numbers are rejected at AddService().
+    brpc::Server server2;
+    brpc::ServiceOptions bad_opt;
+    bad_opt.ownership = brpc::SERVER_DOESNT_OWN_SERVICE;
+    bad_opt.lazy_request_fields = "Echo => 2";  // int32, not length-delimited
+    ASSERT_EQ(-1, server2.AddService(&lazy_svc, bad_opt));
+    brpc::ServiceOptions bad_opt2;
+    bad_opt2.ownership = brpc::SERVER_DOESNT_OWN_SERVICE;
+    bad_opt2.lazy_request_fields = "Echo => 1";  // required
+    ASSERT_EQ(-1, server2.AddService(&lazy_svc, bad_opt2));
+}
+
+TEST_F(ServerTest, listen_fd_handoff) {
+    const char* HANDOFF_PATH = "./.handoff_test.sock";
+    butil::EndPoint ep;
+    ASSERT_EQ(0, str2endpoint("127.0.0.1:8618", &ep));
+    EchoServiceImpl svc1;
+    brpc::Server server1;
+    ASSERT_EQ(0, server1.AddService(&svc1, brpc::SERVER_DOESNT_OWN_SERVICE));
+    brpc::ServerOptions opt1;
+    opt1.listen_fd_handoff_path = HANDOFF_PATH;
+    ASSERT_EQ(0, server1.Start(ep, &opt1));
+
+    // Starting at the same port would normally fail with EADDRINUSE. With
+    // the same handoff path, the successor takes over the listening fd and
+    // the predecessor stops accepting.
+    EchoServiceImpl svc2;
+    brpc::Server server2;
+    ASSERT_EQ(0, server2.AddService(&svc2, brpc::SERVER_DOESNT_OWN_SERVICE));
+    brpc::ServerOptions opt2;
+    opt2.listen_fd_handoff_path = HANDOFF_PATH;
+    ASSERT_EQ(0, server2.Start(ep, &opt2));
+    ASSERT_EQ(ep.port, server2.listen_address().port);
+
+    // The predecessor stops accepting in its handoff thread.
+    usleep(100 * 1000);
+    ASSERT_EQ(brpc::Acceptor::STOPPING, server1._am->status());
+
+    // New connections are served by the successor.
+    SendMultipleRPC(ep, 1);
+    ASSERT_EQ(0, svc1.count.load());
+    ASSERT_EQ(1, svc2.count.load());
+
+    ASSERT_EQ(0, server1.Stop(0));
+    ASSERT_EQ(0, server1.Join());
+    ASSERT_EQ(0, server2.Stop(0));
+    ASSERT_EQ(0, server2.Join());
+    // The last server removed its socket file when stopped.
+    ASSERT_NE(0, access(HANDOFF_PATH, F_OK));
+}
+
 TEST_F(ServerTest, create_pid_file) {
     {
         brpc::Server server;
@@ -1307,7 +1562,17 @@ TEST_F(ServerTest, max_concurrency) {
     server1.MaxConcurrencyOf("test.EchoService.Echo") = 1;
     ASSERT_EQ(1, server1.MaxConcurrencyOf("test.EchoService.Echo"));
     server1.MaxConcurrencyOf(&service1, "Echo") = 2;
-    ASSERT_EQ(2, server1.MaxConcurrencyOf(&service1, "Echo")); 
+    ASSERT_EQ(2, server1.MaxConcurrencyOf(&service1, "Echo"));
+
+    ASSERT_EQ(brpc::REQUEST_PRIORITY_UNSET,
+              server1.RequestPriorityOf("test.EchoService.Echo"));
+    server1.RequestPriorityOf("test.EchoService.Echo") = brpc::REQUEST_PRIORITY_HIGH;
+    ASSERT_EQ(brpc::REQUEST_PRIORITY_HIGH,
+              server1.RequestPriorityOf("test.EchoService.Echo"));
+    server1.RequestPriorityOf(&service1, "Echo") = brpc::REQUEST_PRIORITY_NORMAL;
+    ASSERT_EQ(brpc::REQUEST_PRIORITY_NORMAL,
+              server1.RequestPriorityOf(&service1, "Echo"));
+    server1.RequestPriorityOf(&service1, "Echo") = brpc::REQUEST_PRIORITY_UNSET;
 
     ASSERT_EQ(0, server1.Start(port, NULL));
     brpc::Channel http_channel;
@@ -1366,4 +1631,66 @@ TEST_F(ServerTest, max_concurrency) {
     stub.Echo(&cntl4, &req, NULL, NULL);
     ASSERT_FALSE(cntl4.Failed()) << cntl4.ErrorText();
 }
+
+class ForwardEchoServiceImpl : public test::EchoService {
+public:
+    explicit ForwardEchoServiceImpl(brpc::Channel* backend)
+        : _backend(backend) {}
+    virtual void Echo(google::protobuf::RpcController* cntl_base,
+                      const test::EchoRequest*,
+                      test::EchoResponse* response,
+                      google::protobuf::Closure* done) {
+        brpc::ClosureGuard done_guard(done);
+        brpc::Controller* cntl = (brpc::Controller*)cntl_base;
+        ASSERT_TRUE(cntl->is_forwardable());
+        // Deadline propagated from the client's remaining budget.
+        ASSERT_GE(cntl->deadline_us(), 0);
+        cntl->ForwardTo(_backend, response);
+    }
+private:
+    brpc::Channel* _backend;
+};
+
+TEST_F(ServerTest, forward_to) {
+    const int backend_port = 9201;
+    const int proxy_port = 9202;
+    brpc::FLAGS_baidu_std_save_serialized_request = true;
+    brpc::FLAGS_baidu_std_propagate_timeout = true;
+
+    brpc::Server backend_server;
+    EchoServiceImpl backend_service;
+    ASSERT_EQ(0, backend_server.AddService(
+        &backend_service, brpc::SERVER_DOESNT_OWN_SERVICE));
+    ASSERT_EQ(0, backend_server.Start(backend_port, NULL));
+
+    brpc::Channel backend_channel;
+    ASSERT_EQ(0, backend_channel.Init("0.0.0.0", backend_port, NULL));
+    brpc::Server proxy_server;
+    ForwardEchoServiceImpl proxy_service(&backend_channel);
+    ASSERT_EQ(0, proxy_server.AddService(
+        &proxy_service, brpc::SERVER_DOESNT_OWN_SERVICE));
+    ASSERT_EQ(0, proxy_server.Start(proxy_port, NULL));
+
+    brpc::Channel channel;
+    ASSERT_EQ(0, channel.Init("0.0.0.0", proxy_port, NULL));
+    test::EchoService_Stub stub(&channel);
+    test::EchoRequest req;
+    test::EchoResponse res;
+    req.set_message(EXP_REQUEST);
+    brpc::Controller cntl;
+    cntl.set_timeout_ms(2000);
+    cntl.request_attachment().append("forwarded attachment");
+    stub.Echo(&cntl, &req, &res, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    ASSERT_EQ(EXP_RESPONSE, res.message());
+    ASSERT_EQ(1, backend_service.count.load(butil::memory_order_relaxed));
+
+    brpc::FLAGS_baidu_std_save_serialized_request = false;
+    brpc::FLAGS_baidu_std_propagate_timeout = false;
+
+    proxy_server.Stop(0);
+    proxy_server.Join();
+    backend_server.Stop(0);
+    backend_server.Join();
+}
 } //namespace
@@ -0,0 +1,124 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <gtest/gtest.h>
+#include <gflags/gflags.h>
+#include "butil/iobuf.h"
+#include "bthread/bthread.h"
+#include "brpc/details/singleflight.h"
+#include "echo.pb.h"
+
+namespace brpc {
+DECLARE_string(rpc_singleflight_methods);
+DECLARE_int32(rpc_singleflight_ttl_ms);
+} // namespace brpc
+
+namespace {
+
+struct FollowerArgs {
+    brpc::SingleflightEntry* entry;
+    int wait_rc;
+};
+
+void* RunFollower(void* arg) {
+    FollowerArgs* fa = static_cast<FollowerArgs*>(arg);
+    fa->wait_rc = fa->entry->Wait(NULL);
+    return NULL;
+}
+
+TEST(SingleflightTest, leader_follower_and_ttl) {
+    const google::protobuf::MethodDescriptor* md =
+        test::EchoService::descriptor()->method(0);
+    // Parsed once at first use, must be set before IsSingleflightMethod.
+    brpc::FLAGS_rpc_singleflight_methods = md->full_name();
+    ASSERT_TRUE(brpc::IsSingleflightMethod(md));
+    ASSERT_FALSE(brpc::IsSingleflightMethod(
+        test::EchoService::descriptor()->method(1)));
+
+    butil::IOBuf request;
+    request.append("singleflight-request");
+    butil::IOBuf attachment;
+    attachment.append("singleflight-attachment");
+
+    bool is_leader = false;
+    brpc::SingleflightEntry* leader =
+        brpc::SingleflightBegin(md, request, attachment, &is_leader);
+    ASSERT_TRUE(leader != NULL);
+    ASSERT_TRUE(is_leader);
+
+    // Identical bytes join the leader's entry.
+    is_leader = true;
+    brpc::SingleflightEntry* follower =
+        brpc::SingleflightBegin(md, request, attachment, &is_leader);
+    ASSERT_EQ(leader, follower);
+    ASSERT_FALSE(is_leader);
+
+    // Different bytes get their own leader entry.
+    butil::IOBuf request2;
+    request2.append("another-request");
+    is_leader = false;
+    brpc::SingleflightEntry* other =
+        brpc::SingleflightBegin(md, request2, attachment, &is_leader);
+    ASSERT_TRUE(other != NULL);
+    ASSERT_TRUE(is_leader);
+    ASSERT_NE(leader, other);
+
+    FollowerArgs fa = { follower, -2 };
+    bthread_t tid;
+    ASSERT_EQ(0, bthread_start_background(&tid, NULL, RunFollower, &fa));
+
+    butil::IOBuf res_body;
+    res_body.append("the-response");
+    butil::IOBuf res_attachment;
+    res_attachment.append("the-response-attachment");
+    brpc::SingleflightPublish(leader, 0, "", res_body, res_attachment);
+    ASSERT_EQ(0, bthread_join(tid, NULL));
+    ASSERT_EQ(0, fa.wait_rc);
+    ASSERT_EQ(0, follower->error_code);
+    ASSERT_TRUE(follower->res_body.equals(res_body));
+    ASSERT_TRUE(follower->attachment.equals(res_attachment));
+    leader->RemoveRefManually();
+    follower->RemoveRefManually();
+    brpc::SingleflightPublish(other, EINVAL, "mock error",
+                              butil::IOBuf(), butil::IOBuf());
+    ASSERT_EQ(EINVAL, other->error_code);
+    other->RemoveRefManually();
+
+    // With TTL=0 published entries left the table, the next identical
+    // request leads again.
+    is_leader = false;
+    brpc::SingleflightEntry* relead =
+        brpc::SingleflightBegin(md, request, attachment, &is_leader);
+    ASSERT_TRUE(relead != NULL);
+    ASSERT_TRUE(is_leader);
+
+    // With a TTL the published result keeps serving identical requests.
+    brpc::FLAGS_rpc_singleflight_ttl_ms = 10000;
+    brpc::SingleflightPublish(relead, 0, "", res_body, res_attachment);
+    is_leader = true;
+    brpc::SingleflightEntry* cached =
+        brpc::SingleflightBegin(md, request, attachment, &is_leader);
+    ASSERT_EQ(relead, cached);
+    ASSERT_FALSE(is_leader);
+    ASSERT_EQ(0, cached->Wait(NULL));  // already published
+    ASSERT_TRUE(cached->res_body.equals(res_body));
+    relead->RemoveRefManually();
+    cached->RemoveRefManually();
+    brpc::FLAGS_rpc_singleflight_ttl_ms = 0;
+}
+
+} // namespace
@@ -28,6 +28,8 @@
 #include "snappy_message.pb.h"
 #include "brpc/policy/snappy_compress.h"
 #include "brpc/policy/gzip_compress.h"
+#include "brpc/compress.h"
+#include "brpc/protocol.h"
 
 typedef bool (*Compress)(const google::protobuf::Message&, butil::IOBuf*);
 typedef bool (*Decompress)(const butil::IOBuf&, google::protobuf::Message*);
@@ -253,3 +255,118 @@ TEST_F(test_compress_method, mass_snappy_iobuf) {
     ASSERT_TRUE(strcmp(check_str.c_str(), text) == 0);
     delete [] text;
 }
+
+TEST_F(test_compress_method, parallel_gzip_roundtrip) {
+    // 5MB of moderately compressible data split into several members.
+    const size_t len = 5 * 1024 * 1024;
+    std::string text;
+    text.reserve(len);
+    for (size_t j = 0; j < len; ++j) {
+        text.push_back('a' + (j * 7) % 26);
+    }
+    butil::IOBuf buf;
+    buf.append(text);
+
+    butil::IOBuf compressed;
+    ASSERT_TRUE(brpc::policy::ParallelGzipCompress(buf, &compressed, NULL));
+    butil::IOBuf decompressed;
+    ASSERT_TRUE(brpc::policy::GzipDecompress(compressed, &decompressed));
+    ASSERT_EQ(text, decompressed.to_string());
+
+    // Small inputs fall back to single-member compression and roundtrip too.
+    butil::IOBuf small_buf;
+    small_buf.append("hello parallel gzip");
+    butil::IOBuf small_compressed, small_decompressed;
+    ASSERT_TRUE(brpc::policy::ParallelGzipCompress(
+                    small_buf, &small_compressed, NULL));
+    ASSERT_TRUE(brpc::policy::GzipDecompress(small_compressed,
+                                             &small_decompressed));
+    ASSERT_EQ("hello parallel gzip", small_decompressed.to_string());
+}
+
+TEST_F(test_compress_method, serialize_pb_to_iobuf) {
+    // Small messages take the array fast path, large ones fall back to
+    // the stream path, both must produce exactly what pb produces.
+    snappy_message::SnappyMessageProto small_msg;
+    small_msg.set_text("Hello World!");
+    for (int i = 0; i < 16; ++i) {
+        small_msg.add_numbers(i * 31);
+    }
+    butil::IOBuf small_buf;
+    ASSERT_TRUE(brpc::SerializePbToIOBuf(small_msg, &small_buf));
+    ASSERT_EQ(small_msg.SerializeAsString(), small_buf.to_string());
+
+    snappy_message::SnappyMessageProto large_msg;
+    large_msg.set_text(std::string(64 * 1024, 'x'));
+    butil::IOBuf large_buf;
+    ASSERT_TRUE(brpc::SerializePbToIOBuf(large_msg, &large_buf));
+    ASSERT_EQ(large_msg.SerializeAsString(), large_buf.to_string());
+
+    // SerializeAsCompressedData without compression appends, not replaces.
+    butil::IOBuf appended_buf;
+    appended_buf.append("prefix");
+    ASSERT_TRUE(brpc::SerializeAsCompressedData(
+                    small_msg, &appended_buf, brpc::COMPRESS_TYPE_NONE));
+    ASSERT_EQ("prefix" + small_msg.SerializeAsString(),
+              appended_buf.to_string());
+
+    snappy_message::SnappyMessageProto parsed;
+    ASSERT_TRUE(brpc::ParsePbFromIOBuf(&parsed, small_buf));
+    ASSERT_EQ(small_msg.text(), parsed.text());
+    ASSERT_EQ(small_msg.numbers_size(), parsed.numbers_size());
+}
+
+TEST_F(test_compress_method, snappy_framed_iobuf) {
+    // Small payload fits in one chunk.
+    butil::IOBuf small_buf, small_compressed, small_decompressed;
+    small_buf.append("this is a test");
+    ASSERT_TRUE(brpc::policy::SnappyFramedCompress(small_buf, &small_compressed));
+    // The stream must start with the stream identifier chunk.
+    char stream_id[10];
+    ASSERT_EQ(sizeof(stream_id),
+              small_compressed.copy_to(stream_id, sizeof(stream_id)));
+    ASSERT_EQ(0, memcmp(stream_id + 4, "sNaPpY", 6));
+    ASSERT_TRUE(brpc::policy::SnappyFramedDecompress(small_compressed,
+                                                     &small_decompressed));
+    ASSERT_EQ("this is a test", small_decompressed.to_string());
+
+    // Many small fragments plus large appends, crossing both the
+    // coalescing path and the direct-from-block path, and spanning
+    // multiple 64K chunks.
+    butil::IOBuf buf;
+    std::string expected;
+    for (int i = 0; i < 1000; ++i) {
+        char piece[16];
+        int len = snprintf(piece, sizeof(piece), "frag-%d,", i);
+        buf.append(piece, len);
+        expected.append(piece, len);
+    }
+    const std::string large(300 * 1000, 'z');
+    buf.append(large);
+    expected.append(large);
+    butil::IOBuf compressed, decompressed;
+    ASSERT_TRUE(brpc::policy::SnappyFramedCompress(buf, &compressed));
+    ASSERT_LT(compressed.size(), buf.size());
+    ASSERT_TRUE(brpc::policy::SnappyFramedDecompress(compressed, &decompressed));
+    ASSERT_EQ(expected, decompressed.to_string());
+
+    // Corrupted data must be rejected by the chunk crc.
+    std::string corrupted = compressed.to_string();
+    corrupted[corrupted.size() / 2] ^= 0x5a;
+    butil::IOBuf corrupted_buf, dummy;
+    corrupted_buf.append(corrupted);
+    ASSERT_FALSE(brpc::policy::SnappyFramedDecompress(corrupted_buf, &dummy));
+}
+
+TEST_F(test_compress_method, snappy_framed_pb) {
+    snappy_message::SnappyMessageProto old_msg;
+    old_msg.set_text(std::string(100 * 1000, 'a'));
+    old_msg.add_numbers(2);
+    old_msg.add_numbers(7);
+    butil::IOBuf buf;
+    ASSERT_TRUE(brpc::policy::SnappyFramedCompress(old_msg, &buf));
+    snappy_message::SnappyMessageProto new_msg;
+    ASSERT_TRUE(brpc::policy::SnappyFramedDecompress(buf, &new_msg));
+    ASSERT_EQ(old_msg.text(), new_msg.text());
+    ASSERT_EQ(2, new_msg.numbers_size());
+}
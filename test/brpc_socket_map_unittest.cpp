@@ -140,6 +140,31 @@ TEST_F(SocketMapTest, max_pool_size) {
         EXPECT_TRUE(ptrs[i]->Failed());
     }
 }
+
+TEST_F(SocketMapTest, many_keys) {
+    const int NKEY = 256;  // spread over all shards of the map
+    brpc::FLAGS_defer_close_second = 0;
+    brpc::SocketId ids[NKEY];
+    for (int i = 0; i < NKEY; ++i) {
+        butil::EndPoint ep;
+        ASSERT_EQ(0, butil::str2endpoint("127.0.0.1", 20000 + i, &ep));
+        ASSERT_EQ(0, brpc::SocketMapInsert(brpc::SocketMapKey(ep), &ids[i]));
+    }
+    for (int i = 0; i < NKEY; ++i) {
+        butil::EndPoint ep;
+        ASSERT_EQ(0, butil::str2endpoint("127.0.0.1", 20000 + i, &ep));
+        brpc::SocketId id;
+        ASSERT_EQ(0, brpc::SocketMapFind(brpc::SocketMapKey(ep), &id));
+        ASSERT_EQ(ids[i], id);
+    }
+    for (int i = 0; i < NKEY; ++i) {
+        butil::EndPoint ep;
+        ASSERT_EQ(0, butil::str2endpoint("127.0.0.1", 20000 + i, &ep));
+        brpc::SocketMapRemove(brpc::SocketMapKey(ep));
+        brpc::SocketId id;
+        ASSERT_EQ(-1, brpc::SocketMapFind(brpc::SocketMapKey(ep), &id));
+    }
+}
 } //namespace
 
 int main(int argc, char* argv[]) {
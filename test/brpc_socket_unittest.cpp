@@ -31,6 +31,8 @@
 #include "bthread/unstable.h"
 #include "bthread/task_control.h"
 #include "brpc/socket.h"
+#include "brpc/udp_socket_io.h"
+#include "brpc/details/health_check.h"
 #include "brpc/errno.pb.h"
 #include "brpc/acceptor.h"
 #include "brpc/policy/hulu_pbrpc_protocol.h"
@@ -108,6 +110,46 @@ class CheckRecycle : public brpc::SocketUser {
     }
 };
 
+TEST_F(SocketTest, write_request_cache) {
+    int fds[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    brpc::SocketId id = 0;
+    brpc::SocketOptions options;
+    options.fd = fds[1];
+    ASSERT_EQ(0, brpc::Socket::Create(options, &id));
+    brpc::SocketUniquePtr s;
+    ASSERT_EQ(0, brpc::Socket::Address(id, &s));
+
+    // Freed requests are parked on the socket and handed back to the
+    // next allocation instead of going through the ObjectPool.
+    typedef decltype(s->AllocWriteRequest()) WriteReqPtr;
+    const size_t N = brpc::Socket::WRITE_REQUEST_CACHE_SIZE;
+    std::vector<WriteReqPtr> reqs;
+    for (size_t i = 0; i < N + 1; ++i) {
+        WriteReqPtr req = s->AllocWriteRequest();
+        ASSERT_TRUE(req != NULL);
+        reqs.push_back(req);
+    }
+    // N fill the cache, the extra one overflows to the pool.
+    for (size_t i = 0; i < reqs.size(); ++i) {
+        s->FreeWriteRequest(reqs[i]);
+    }
+    for (size_t i = 0; i < N; ++i) {
+        WriteReqPtr req = s->AllocWriteRequest();
+        bool from_cache = false;
+        for (size_t j = 0; j < reqs.size(); ++j) {
+            from_cache |= (req == reqs[j]);
+        }
+        ASSERT_TRUE(from_cache) << "i=" << i;
+        s->FreeWriteRequest(req);
+    }
+    s->DrainWriteRequestCache();
+
+    ASSERT_EQ(0, s->SetFailed());
+    s->ReleaseAdditionalReference();
+    close(fds[0]);
+}
+
 TEST_F(SocketTest, not_recycle_until_zero_nref) {
     std::cout << "sizeof(Socket)=" << sizeof(brpc::Socket) << std::endl;
     int fds[2];
@@ -138,6 +180,37 @@ TEST_F(SocketTest, not_recycle_until_zero_nref) {
     ASSERT_EQ(-1, brpc::Socket::Address(id, &ptr));
 }
 
+TEST_F(SocketTest, address_borrowed) {
+    int fds[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    brpc::SocketId id = 8888;
+    butil::EndPoint dummy;
+    ASSERT_EQ(0, str2endpoint("192.168.1.26:8080", &dummy));
+    brpc::SocketOptions options;
+    options.fd = fds[1];
+    options.remote_side = dummy;
+    options.user = new CheckRecycle;
+    ASSERT_EQ(0, brpc::Socket::Create(options, &id));
+    {
+        brpc::SocketUniquePtr s;
+        ASSERT_EQ(0, brpc::Socket::Address(id, &s));
+        global_sock = s.get();
+        // Borrowing neither changes the refcount nor returns a different
+        // pointer than addressing.
+        const uint64_t vref_before =
+            s->_versioned_ref.load(butil::memory_order_relaxed);
+        ASSERT_EQ(s.get(), brpc::Socket::AddressBorrowed(id));
+        ASSERT_EQ(vref_before, s->_versioned_ref.load(butil::memory_order_relaxed));
+        ASSERT_EQ(0, s->SetFailed());
+        // SetFailed() bumps the version, the borrow must fail just like
+        // Address() although references are still held.
+        ASSERT_EQ((brpc::Socket*)NULL, brpc::Socket::AddressBorrowed(id));
+    }
+    ASSERT_EQ((brpc::Socket*)NULL, global_sock);
+    ASSERT_EQ((brpc::Socket*)NULL, brpc::Socket::AddressBorrowed(id));
+    close(fds[0]);
+}
+
 butil::atomic<int> winner_count(0);
 const int AUTH_ERR = -9;
 
@@ -154,6 +227,51 @@ void* auth_fighter(void* arg) {
     return NULL;
 }
 
+static bool AcceptWorkingSocket(brpc::Socket* s) {
+    return !s->Failed();
+}
+
+TEST_F(SocketTest, multiple_agent_sockets) {
+    butil::EndPoint dummy;
+    ASSERT_EQ(0, str2endpoint("192.168.1.26:8080", &dummy));
+    brpc::SocketOptions options;
+    options.remote_side = dummy;
+    brpc::SocketId id;
+    ASSERT_EQ(0, brpc::Socket::Create(options, &id));
+    brpc::SocketUniquePtr main_ptr;
+    ASSERT_EQ(0, brpc::Socket::Address(id, &main_ptr));
+
+    brpc::SocketUniquePtr a0;
+    brpc::SocketUniquePtr a1;
+    ASSERT_EQ(-1, main_ptr->PeekAgentSocket(&a0, 0));
+    ASSERT_EQ(0, main_ptr->GetAgentSocket(&a0, 0, NULL));
+    // Slots are independent sockets to the same place.
+    ASSERT_EQ(0, main_ptr->GetAgentSocket(&a1, 1, NULL));
+    ASSERT_NE(a0->id(), a1->id());
+    ASSERT_EQ(dummy, a1->remote_side());
+    // Getting a slot again returns the persisted socket.
+    brpc::SocketUniquePtr again;
+    ASSERT_EQ(0, main_ptr->GetAgentSocket(&again, 1, NULL));
+    ASSERT_EQ(a1->id(), again->id());
+    again.reset();
+    ASSERT_EQ(0, main_ptr->PeekAgentSocket(&again, 0));
+    ASSERT_EQ(a0->id(), again->id());
+    again.reset();
+    // Out-of-range slots are rejected.
+    ASSERT_EQ(-1, main_ptr->GetAgentSocket(
+        &again, brpc::Socket::MAX_AGENT_SOCKET_NUM, NULL));
+    // A slot whose socket no longer passes `checkfn' is replaced, other
+    // slots are untouched.
+    ASSERT_EQ(0, a1->SetFailed());
+    ASSERT_EQ(0, main_ptr->GetAgentSocket(&again, 1, AcceptWorkingSocket));
+    ASSERT_NE(a1->id(), again->id());
+    ASSERT_FALSE(again->Failed());
+    again.reset();
+    ASSERT_EQ(0, main_ptr->PeekAgentSocket(&again, 0));
+    ASSERT_EQ(a0->id(), again->id());
+    ASSERT_EQ(0, main_ptr->SetFailed());
+}
+
 TEST_F(SocketTest, authentication) {
     brpc::SocketId id;
     brpc::SocketOptions options;
@@ -287,6 +405,271 @@ TEST_F(SocketTest, single_threaded_write) {
     close(fds[0]);
 }
 
+// A "null driver" just forwarding to the fd, counting calls.
+class PassthroughIO : public brpc::SocketIO {
+public:
+    PassthroughIO() : nread(0), nwrite(0) {}
+
+    ssize_t Read(brpc::Socket* s, butil::IOPortal* buf, size_t size_hint) {
+        ++nread;
+        return buf->append_from_file_descriptor(s->fd(), size_hint);
+    }
+
+    ssize_t Write(brpc::Socket* s, butil::IOBuf** data_list, size_t ndata) {
+        ++nwrite;
+        return butil::IOBuf::cut_multiple_into_file_descriptor(
+            s->fd(), data_list, ndata);
+    }
+
+    int nread;
+    int nwrite;
+};
+
+TEST_F(SocketTest, socket_io) {
+    int fds[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    PassthroughIO io;
+    brpc::SocketId id;
+    brpc::SocketOptions options;
+    options.fd = fds[1];
+    options.io = &io;
+    ASSERT_EQ(0, brpc::Socket::Create(options, &id));
+    {
+        brpc::SocketUniquePtr s;
+        ASSERT_EQ(0, brpc::Socket::Address(id, &s));
+
+        const char MSG[] = "hello socket_io";
+        const size_t MSG_LEN = sizeof(MSG) - 1;
+        butil::IOBuf src;
+        src.append(MSG);
+        ASSERT_EQ(0, s->Write(&src));
+        char dest[64];
+        ASSERT_EQ((ssize_t)MSG_LEN, read(fds[0], dest, sizeof(dest)));
+        ASSERT_EQ(0, memcmp(MSG, dest, MSG_LEN));
+        ASSERT_EQ(1, io.nwrite);
+
+        ASSERT_EQ(5, write(fds[0], "world", 5));
+        ASSERT_EQ(5, s->DoRead(1024));
+        ASSERT_EQ(1, io.nread);
+        ASSERT_EQ("world", s->_read_buf.to_string());
+
+        ASSERT_EQ(0, s->SetFailed());
+    }
+    close(fds[0]);
+}
+
+TEST_F(SocketTest, write_aggregation) {
+    GFLAGS_NS::SetCommandLineOption("socket_write_aggregation_us", "2000");
+    int fds[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    brpc::SocketId id = 8888;
+    brpc::SocketOptions options;
+    options.fd = fds[1];
+    ASSERT_EQ(0, brpc::Socket::Create(options, &id));
+    {
+        brpc::SocketUniquePtr s;
+        ASSERT_EQ(0, brpc::Socket::Address(id, &s));
+        char buf[512];
+        size_t total_len = 0;
+        const int NMSG = 10;
+        for (int i = 0; i < NMSG; ++i) {
+            size_t len = snprintf(buf + total_len, sizeof(buf) - total_len,
+                                  "hello world! %d", i);
+            butil::IOBuf src;
+            src.append(buf + total_len, len);
+            total_len += len;
+            ASSERT_EQ(0, s->Write(&src));
+        }
+        // Delayed writes must still arrive intact and in order.
+        char dest[sizeof(buf)];
+        size_t nread = 0;
+        while (nread < total_len) {
+            ssize_t nr = read(fds[0], dest + nread, sizeof(dest) - nread);
+            ASSERT_GT(nr, 0);
+            nread += nr;
+        }
+        ASSERT_EQ(total_len, nread);
+        ASSERT_EQ(0, memcmp(buf, dest, total_len));
+        ASSERT_EQ(0, s->SetFailed());
+    }
+    close(fds[0]);
+    GFLAGS_NS::SetCommandLineOption("socket_write_aggregation_us", "0");
+}
+
+TEST_F(SocketTest, urgent_write_promotion) {
+    int fds[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    // Shrink the send buffer so that the first big write surely leaves
+    // a backlog behind the KeepWrite thread.
+    int sndbuf = 4096;
+    ASSERT_EQ(0, setsockopt(fds[1], SOL_SOCKET, SO_SNDBUF,
+                            &sndbuf, sizeof(sndbuf)));
+    brpc::SocketId id = 8888;
+    brpc::SocketOptions options;
+    options.fd = fds[1];
+    ASSERT_EQ(0, brpc::Socket::Create(options, &id));
+    {
+        brpc::SocketUniquePtr s;
+        ASSERT_EQ(0, brpc::Socket::Address(id, &s));
+        const std::string big_data(512 * 1024, 'a');
+        const std::string ordinary_data(64 * 1024, 'b');
+        const std::string urgent_data("URGENT!");
+        butil::IOBuf buf;
+        buf.append(big_data);
+        // Blocks the queue: only a piece fits into the kernel buffer
+        // since nothing is read yet.
+        ASSERT_EQ(0, s->Write(&buf));
+        buf.append(ordinary_data);
+        ASSERT_EQ(0, s->Write(&buf));
+        buf.append(urgent_data);
+        brpc::Socket::WriteOptions wopt;
+        wopt.urgent = true;
+        ASSERT_EQ(0, s->Write(&buf, &wopt));
+        // Let KeepWrite collect both pending requests and move the urgent
+        // one to the front, which happens without any read from fds[0].
+        bthread_usleep(50000);
+        // The urgent message must jump before the ordinary one, but never
+        // break into the message being written.
+        const std::string expected =
+            big_data + urgent_data + ordinary_data;
+        std::string dest(expected.size(), 0);
+        size_t nread = 0;
+        while (nread < dest.size()) {
+            ssize_t nr = read(fds[0], &dest[nread], dest.size() - nread);
+            ASSERT_GT(nr, 0);
+            nread += nr;
+        }
+        ASSERT_EQ(expected, dest);
+        ASSERT_EQ(0, s->SetFailed());
+    }
+    close(fds[0]);
+}
+
+TEST_F(SocketTest, udp_socket_io) {
+    int fds[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_DGRAM, 0, fds));
+    brpc::SocketId id = 8888;
+    brpc::SocketOptions options;
+    options.fd = fds[1];
+    options.io = brpc::UdpSocketIO::GetInstance();
+    ASSERT_EQ(0, brpc::Socket::Create(options, &id));
+    {
+        brpc::SocketUniquePtr s;
+        ASSERT_EQ(0, brpc::Socket::Address(id, &s));
+        // Each written message must arrive as its own datagram.
+        butil::IOBuf buf;
+        buf.append("first_query");
+        ASSERT_EQ(0, s->Write(&buf));
+        buf.append("second_query");
+        ASSERT_EQ(0, s->Write(&buf));
+        char dest[64];
+        ssize_t nr = recv(fds[0], dest, sizeof(dest), 0);
+        ASSERT_EQ((ssize_t)strlen("first_query"), nr);
+        ASSERT_EQ(0, memcmp("first_query", dest, nr));
+        nr = recv(fds[0], dest, sizeof(dest), 0);
+        ASSERT_EQ((ssize_t)strlen("second_query"), nr);
+        ASSERT_EQ(0, memcmp("second_query", dest, nr));
+        // Reading drains all pending datagrams into _read_buf at once.
+        ASSERT_EQ(5L, write(fds[0], "reply", 5));
+        ASSERT_EQ(6L, write(fds[0], "reply2", 6));
+        ASSERT_EQ(11L, s->DoRead(1024));
+        ASSERT_EQ("replyreply2", s->_read_buf.to_string());
+        ASSERT_EQ(0, s->SetFailed());
+    }
+    close(fds[0]);
+}
+
+static butil::atomic<int> g_on_writable_count(0);
+static void CountWritable(brpc::SocketId, void* arg) {
+    static_cast<butil::atomic<int>*>(arg)->fetch_add(
+        1, butil::memory_order_relaxed);
+}
+
+TEST_F(SocketTest, writable_notification) {
+    int fds[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    int sndbuf = 4096;
+    ASSERT_EQ(0, setsockopt(fds[1], SOL_SOCKET, SO_SNDBUF,
+                            &sndbuf, sizeof(sndbuf)));
+    brpc::SocketId id = 8888;
+    brpc::SocketOptions options;
+    options.fd = fds[1];
+    // A tiny per-socket budget, much smaller than
+    // -socket_max_unwritten_bytes.
+    options.max_unwritten_bytes = 16 * 1024;
+    options.on_writable = CountWritable;
+    options.on_writable_arg = &g_on_writable_count;
+    ASSERT_EQ(0, brpc::Socket::Create(options, &id));
+    {
+        brpc::SocketUniquePtr s;
+        ASSERT_EQ(0, brpc::Socket::Address(id, &s));
+        const std::string big_data(64 * 1024, 'a');
+        butil::IOBuf buf;
+        buf.append(big_data);
+        // The first write is always accepted and exceeds the budget.
+        ASSERT_EQ(0, s->Write(&buf));
+        ASSERT_TRUE(s->is_overcrowded());
+        // Rejected and arms the notification.
+        buf.append("x");
+        ASSERT_EQ(-1, s->Write(&buf));
+        ASSERT_EQ(brpc::EOVERCROWDED, errno);
+        ASSERT_EQ(0, g_on_writable_count.load(butil::memory_order_relaxed));
+        // Drain the queue. The callback must fire exactly once when the
+        // backlog drops below half of the budget.
+        std::string dest(big_data.size(), 0);
+        size_t nread = 0;
+        while (nread < dest.size()) {
+            ssize_t nr = read(fds[0], &dest[nread], dest.size() - nread);
+            ASSERT_GT(nr, 0);
+            nread += nr;
+        }
+        bthread_usleep(100000);
+        ASSERT_EQ(1, g_on_writable_count.load(butil::memory_order_relaxed));
+        ASSERT_FALSE(s->is_overcrowded());
+        // Writable again, and a successful write does not re-notify.
+        buf.append("y");
+        ASSERT_EQ(0, s->Write(&buf));
+        char c = 0;
+        ASSERT_EQ(1L, read(fds[0], &c, 1));
+        ASSERT_EQ('y', c);
+        bthread_usleep(50000);
+        ASSERT_EQ(1, g_on_writable_count.load(butil::memory_order_relaxed));
+        ASSERT_EQ(0, s->SetFailed());
+    }
+    close(fds[0]);
+}
+
+class TestAppPing : public brpc::AppPing {
+public:
+    void SendPing(brpc::Socket* socket) {
+        butil::IOBuf ping;
+        ping.append("PING");
+        socket->Write(&ping);
+    }
+};
+
+TEST_F(SocketTest, app_ping) {
+    int fds[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    brpc::SocketId id = 8888;
+    brpc::SocketOptions options;
+    options.fd = fds[1];
+    options.app_ping = std::make_shared<TestAppPing>();
+    options.app_ping_interval_s = 1;
+    ASSERT_EQ(0, brpc::Socket::Create(options, &id));
+    // The scheduler should ping the idle socket within a few seconds.
+    char dest[8];
+    ssize_t nr = read(fds[0], dest, sizeof(dest));
+    ASSERT_EQ(4, nr);
+    ASSERT_EQ(0, memcmp("PING", dest, 4));
+    {
+        brpc::SocketUniquePtr s;
+        ASSERT_EQ(0, brpc::Socket::Address(id, &s));
+        ASSERT_EQ(0, s->SetFailed());
+    }
+    close(fds[0]);
+}
+
 void EchoProcessHuluRequest(brpc::InputMessageBase* msg_base) {
     brpc::DestroyingPtr<brpc::policy::MostCommonMessage> msg(
         static_cast<brpc::policy::MostCommonMessage*>(msg_base));
@@ -487,6 +870,31 @@ TEST_F(SocketTest, fail_to_connect) {
     ASSERT_EQ(-1, brpc::Socket::Address(id, &ptr));
 }
 
+TEST_F(SocketTest, health_check_probe_interval) {
+    // Fixed interval by default.
+    ASSERT_EQ(3000, brpc::NextHealthCheckIntervalMs(3, 1));
+    ASSERT_EQ(3000, brpc::NextHealthCheckIntervalMs(3, 10));
+
+    // Doubled after each failed probe, capped by the flag.
+    GFLAGS_NS::SetCommandLineOption("health_check_backoff_max_s", "20");
+    ASSERT_EQ(3000, brpc::NextHealthCheckIntervalMs(3, 1));
+    ASSERT_EQ(6000, brpc::NextHealthCheckIntervalMs(3, 2));
+    ASSERT_EQ(12000, brpc::NextHealthCheckIntervalMs(3, 3));
+    ASSERT_EQ(20000, brpc::NextHealthCheckIntervalMs(3, 4));
+    ASSERT_EQ(20000, brpc::NextHealthCheckIntervalMs(3, 100));
+    // No backoff when the cap is not larger than the interval.
+    ASSERT_EQ(30000, brpc::NextHealthCheckIntervalMs(30, 100));
+
+    GFLAGS_NS::SetCommandLineOption("health_check_jitter_percent", "10");
+    for (int i = 0; i < 100; ++i) {
+        const int64_t ms = brpc::NextHealthCheckIntervalMs(3, 1);
+        ASSERT_GE(ms, 2700);
+        ASSERT_LE(ms, 3300);
+    }
+    GFLAGS_NS::SetCommandLineOption("health_check_backoff_max_s", "0");
+    GFLAGS_NS::SetCommandLineOption("health_check_jitter_percent", "0");
+}
+
 TEST_F(SocketTest, not_health_check_when_nref_hits_0) {
     brpc::SocketId id = 8888;
     butil::EndPoint point(butil::IP_ANY, 7584/*not listened*/);
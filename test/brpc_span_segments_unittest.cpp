@@ -0,0 +1,127 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// brpc - A framework to host and access services throughout Baidu.
+
+#include <gtest/gtest.h>
+#include <gflags/gflags.h>
+#include "brpc/details/span_segments.h"
+
+namespace brpc {
+DECLARE_int32(rpcz_segment_bytes);
+}
+
+int main(int argc, char* argv[]) {
+    testing::InitGoogleTest(&argc, argv);
+    GFLAGS_NS::ParseCommandLineFlags(&argc, &argv, true);
+    return RUN_ALL_TESTS();
+}
+
+namespace {
+
+const char* TEST_DIR = "./rpc_data/rpcz_segment_test";
+
+static void AppendSpan(brpc::SpanSegmentStore* store, uint64_t trace_id,
+                       uint64_t span_id, int64_t time_key) {
+    brpc::BriefSpan brief;
+    brief.set_trace_id(trace_id);
+    brief.set_span_id(span_id);
+    brief.set_start_real_us(time_key);
+    brief.set_full_method_name("test.EchoService.Echo");
+    brpc::RpczSpan full;
+    full.set_trace_id(trace_id);
+    full.set_span_id(span_id);
+    ASSERT_EQ(0, store->Append(trace_id, span_id, time_key, brief, full));
+}
+
+class SpanSegmentsTest : public ::testing::Test {};
+
+TEST_F(SpanSegmentsTest, find_by_correlation_id) {
+    brpc::SpanSegmentStore store;
+    ASSERT_EQ(0, store.Init(TEST_DIR));
+    AppendSpan(&store, 1, 10, 1000);
+    AppendSpan(&store, 1, 11, 1001);
+    AppendSpan(&store, 2, 20, 1002);
+
+    brpc::RpczSpan span;
+    ASSERT_EQ(0, store.FindSpan(1, 11, &span));
+    ASSERT_EQ(1UL, span.trace_id());
+    ASSERT_EQ(11UL, span.span_id());
+    ASSERT_EQ(-1, store.FindSpan(1, 999, &span));
+    ASSERT_EQ(-1, store.FindSpan(3, 10, &span));
+
+    std::deque<brpc::RpczSpan> spans;
+    store.FindSpans(1, &spans);
+    ASSERT_EQ(2UL, spans.size());
+    // Insertion order.
+    ASSERT_EQ(10UL, spans[0].span_id());
+    ASSERT_EQ(11UL, spans[1].span_id());
+}
+
+TEST_F(SpanSegmentsTest, list_by_time_range) {
+    brpc::SpanSegmentStore store;
+    ASSERT_EQ(0, store.Init(TEST_DIR));
+    for (int i = 0; i < 100; ++i) {
+        AppendSpan(&store, 100 + i, i, 1000 + i);
+    }
+    std::deque<brpc::BriefSpan> briefs;
+    // Newest-first starting from the given time.
+    store.ListSpans(1049, 10, &briefs, NULL);
+    ASSERT_EQ(10UL, briefs.size());
+    ASSERT_EQ(1049, briefs[0].start_real_us());
+    ASSERT_EQ(1040, briefs[9].start_real_us());
+    // A time before all spans matches nothing.
+    store.ListSpans(999, 10, &briefs, NULL);
+    ASSERT_TRUE(briefs.empty());
+    // Scanning past the oldest span stops there.
+    store.ListSpans(1004, 10, &briefs, NULL);
+    ASSERT_EQ(5UL, briefs.size());
+}
+
+TEST_F(SpanSegmentsTest, rotation_and_retention) {
+    const int32_t saved_segment_bytes = brpc::FLAGS_rpcz_segment_bytes;
+    // Tiny segments to force rotation.
+    brpc::FLAGS_rpcz_segment_bytes = 512;
+    {
+        brpc::SpanSegmentStore store;
+        ASSERT_EQ(0, store.Init(TEST_DIR));
+        const int N = 100;
+        for (int i = 0; i < N; ++i) {
+            AppendSpan(&store, 100 + i, i, 1000 + i);
+        }
+        ASSERT_GT(store._segments.size(), 1UL);
+
+        // Every span is still reachable across segments.
+        brpc::RpczSpan span;
+        for (int i = 0; i < N; ++i) {
+            ASSERT_EQ(0, store.FindSpan(100 + i, i, &span)) << "i=" << i;
+        }
+        std::deque<brpc::BriefSpan> briefs;
+        store.ListSpans(1000 + N, N, &briefs, NULL);
+        ASSERT_EQ((size_t)N, briefs.size());
+
+        // Dropping by time removes whole expired segments, the writable
+        // one always stays.
+        store.RemoveSegmentsBefore(1000 + N + 1);
+        ASSERT_EQ(1UL, store._segments.size());
+        store.ListSpans(1000 + N, N, &briefs, NULL);
+        ASSERT_LT(briefs.size(), (size_t)N);
+    }
+    brpc::FLAGS_rpcz_segment_bytes = saved_segment_bytes;
+}
+
+} // namespace
@@ -35,6 +35,7 @@
 #include "echo.pb.h"
 
 namespace brpc {
+DECLARE_int32(ssl_handshake_concurrency);
 void ExtractHostnames(X509* x, std::vector<std::string>* hostnames);
 } // namespace brpc
 
@@ -175,6 +176,88 @@ TEST_F(SSLTest, sanity) {
     ASSERT_EQ(0, server.Join());
 }
 
+TEST_F(SSLTest, handshake_concurrency_cap) {
+    const int port = 8613;
+    brpc::Server server;
+    brpc::ServerOptions options;
+
+    brpc::CertInfo cert;
+    cert.certificate = "cert1.crt";
+    cert.private_key = "cert1.key";
+    options.mutable_ssl_options()->default_cert = cert;
+
+    EchoServiceImpl echo_svc;
+    ASSERT_EQ(0, server.AddService(
+        &echo_svc, brpc::SERVER_DOESNT_OWN_SERVICE));
+    ASSERT_EQ(0, server.Start(port, &options));
+
+    // Short connections handshake on every RPC; with the cap at 1 they
+    // must queue behind each other and still all succeed.
+    const int32_t saved_cap = brpc::FLAGS_ssl_handshake_concurrency;
+    brpc::FLAGS_ssl_handshake_concurrency = 1;
+    const int NUM = 4;
+    const int COUNT = 20;
+    pthread_t tids[NUM];
+    {
+        brpc::Channel channel;
+        brpc::ChannelOptions coptions;
+        coptions.connection_type = "short";
+        coptions.mutable_ssl_options();
+        coptions.mutable_ssl_options()->sni_name = "localhost";
+        ASSERT_EQ(0, channel.Init("127.0.0.1", port, &coptions));
+        for (int i = 0; i < NUM; ++i) {
+            google::protobuf::Closure* thrd_func =
+                    brpc::NewCallback(SendMultipleRPC, &channel, COUNT);
+            EXPECT_EQ(0, pthread_create(&tids[i], NULL, RunClosure, thrd_func));
+        }
+        for (int i = 0; i < NUM; ++i) {
+            pthread_join(tids[i], NULL);
+        }
+    }
+    brpc::FLAGS_ssl_handshake_concurrency = saved_cap;
+
+    ASSERT_EQ(0, server.Stop(0));
+    ASSERT_EQ(0, server.Join());
+}
+
+TEST_F(SSLTest, shared_session_cache) {
+    const int port = 8613;
+    brpc::Server server;
+    brpc::ServerOptions options;
+
+    brpc::CertInfo cert;
+    cert.certificate = "cert1.crt";
+    cert.private_key = "cert1.key";
+    options.mutable_ssl_options()->default_cert = cert;
+    options.mutable_ssl_options()->shared_session_cache = true;
+
+    EchoServiceImpl echo_svc;
+    ASSERT_EQ(0, server.AddService(
+        &echo_svc, brpc::SERVER_DOESNT_OWN_SERVICE));
+    ASSERT_EQ(0, server.Start(port, &options));
+
+    test::EchoRequest req;
+    req.set_message(EXP_REQUEST);
+    // Each channel establishes a fresh connection; later handshakes may
+    // resume sessions of the earlier ones through the shared cache.
+    for (int i = 0; i < 3; ++i) {
+        test::EchoResponse res;
+        brpc::Channel channel;
+        brpc::ChannelOptions coptions;
+        coptions.mutable_ssl_options()->sni_name = "localhost";
+        ASSERT_EQ(0, channel.Init("localhost", port, &coptions));
+
+        brpc::Controller cntl;
+        test::EchoService_Stub stub(&channel);
+        stub.Echo(&cntl, &req, &res, NULL);
+        ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+        EXPECT_EQ(EXP_RESPONSE, res.message());
+    }
+
+    ASSERT_EQ(0, server.Stop(0));
+    ASSERT_EQ(0, server.Join());
+}
+
 void CheckCert(const char* cname, const char* cert) {
     const int port = 8613;
     brpc::Channel channel;
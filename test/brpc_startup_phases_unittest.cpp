@@ -0,0 +1,59 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// brpc - A framework to host and access services throughout Baidu.
+
+#include <gtest/gtest.h>
+#include <bvar/bvar.h>
+#include "brpc/global.h"
+#include "brpc/server.h"
+
+int main(int argc, char* argv[]) {
+    testing::InitGoogleTest(&argc, argv);
+    GFLAGS_NS::ParseCommandLineFlags(&argc, &argv, true);
+    return RUN_ALL_TESTS();
+}
+
+namespace {
+
+static std::string DescribeStartupPhases() {
+    std::ostringstream os;
+    EXPECT_EQ(0, bvar::Variable::describe_exposed("rpc_startup_phases", os));
+    return os.str();
+}
+
+TEST(StartupPhasesTest, recorded_during_initialization) {
+    brpc::Server server;
+    ASSERT_EQ(0, server.Start(8715, NULL));
+
+    // Global initialization and builtin service registration must have
+    // left their marks on the timeline.
+    const std::string phases = DescribeStartupPhases();
+    ASSERT_NE(std::string::npos, phases.find("global_init=")) << phases;
+    ASSERT_NE(std::string::npos, phases.find("protocols=")) << phases;
+    ASSERT_NE(std::string::npos, phases.find("builtin_services=")) << phases;
+
+    // User-recorded phases are appended to the same timeline.
+    brpc::RecordStartupPhase("warmup", 42);
+    ASSERT_NE(std::string::npos,
+              DescribeStartupPhases().find("warmup=42us"));
+
+    server.Stop(0);
+    server.Join();
+}
+
+} // namespace
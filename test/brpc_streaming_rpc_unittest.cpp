@@ -293,6 +293,38 @@ TEST_F(StreamingRpcTest, block) {
     ASSERT_EQ(N + N + N, handler._expected_next_value);
 }
 
+TEST_F(StreamingRpcTest, flow_control_window_auto_tuning) {
+    brpc::StreamOptions opt;
+    opt.max_buf_size = 1024;
+    opt.max_auto_buf_size = 64 * 1024;
+    brpc::StreamId id;
+    ASSERT_EQ(0, brpc::Stream::Create(opt, NULL, &id));
+    brpc::ScopedStream stream_guard(id);
+    brpc::SocketUniquePtr ptr;
+    ASSERT_EQ(0, brpc::Socket::Address(id, &ptr));
+    brpc::Stream* s = (brpc::Stream*)ptr->conn();
+    ASSERT_EQ(opt.max_buf_size, s->_cur_buf_size);
+    // The window size is advertised to the remote side so that it can
+    // coalesce feedbacks.
+    brpc::StreamSettings settings;
+    s->FillSettings(&settings);
+    ASSERT_EQ(opt.max_buf_size, settings.buf_size());
+    // The first feedback only starts the BDP probe.
+    s->_produced = 4096;
+    s->SetRemoteConsumed(100);
+    ASSERT_EQ(opt.max_buf_size, s->_cur_buf_size);
+    // Once everything produced before the probe was consumed remotely,
+    // the window grows to twice the bytes delivered during the round trip.
+    s->SetRemoteConsumed(5000);
+    ASSERT_EQ(2 * (5000 - 100), s->_cur_buf_size);
+    // The window is capped by max_auto_buf_size and never shrinks.
+    s->_produced = 1000000;
+    s->SetRemoteConsumed(900000);
+    ASSERT_EQ(opt.max_auto_buf_size, s->_cur_buf_size);
+    s->SetRemoteConsumed(900001);
+    ASSERT_EQ(opt.max_auto_buf_size, s->_cur_buf_size);
+}
+
 TEST_F(StreamingRpcTest, auto_close_if_host_socket_closed) {
     HandlerControl hc;
     OrderedInputHandler handler(&hc);
@@ -464,6 +496,51 @@ TEST_F(StreamingRpcTest, ping_pong) {
     ASSERT_EQ(0, reqh.idle_times());
 }
 
+TEST_F(StreamingRpcTest, notsent_lowat_and_bvar) {
+    OrderedInputHandler handler;
+    brpc::StreamOptions opt;
+    opt.handler = &handler;
+    brpc::Server server;
+    MyServiceWithStream service(opt);
+    ASSERT_EQ(0, server.AddService(&service, brpc::SERVER_DOESNT_OWN_SERVICE));
+    ASSERT_EQ(0, server.Start(9007, NULL));
+    brpc::Channel channel;
+    ASSERT_EQ(0, channel.Init("127.0.0.1:9007", NULL));
+    brpc::Controller cntl;
+    brpc::StreamId request_stream;
+    brpc::StreamOptions request_stream_options;
+    request_stream_options.tcp_notsent_lowat = 64 * 1024;
+    request_stream_options.max_pacing_rate = 100 * 1024 * 1024;
+    ASSERT_EQ(0, StreamCreate(&request_stream, cntl,
+                              &request_stream_options));
+    brpc::ScopedStream stream_guard(request_stream);
+    test::EchoService_Stub stub(&channel);
+    stub.Echo(&cntl, &request, &response, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText()
+        << " request_stream=" << request_stream;
+    const int N = 1000;
+    for (int i = 0; i < N; ++i) {
+        int network = htonl(i);
+        butil::IOBuf out;
+        out.append(&network, sizeof(network));
+        ASSERT_EQ(0, brpc::StreamWrite(request_stream, out)) << "i=" << i;
+    }
+    // The per-stream not-sent-bytes bvar is exposed while connected.
+    char var_name[64];
+    snprintf(var_name, sizeof(var_name), "stream_%llu_notsent_bytes",
+             (unsigned long long)request_stream);
+    ASSERT_NE("", bvar::Variable::describe_exposed(var_name));
+    usleep(10 * 1000);
+    ASSERT_EQ(0, brpc::StreamClose(request_stream));
+    while (!handler.stopped()) {
+        usleep(100);
+    }
+    // Removed together with the stream.
+    ASSERT_EQ("", bvar::Variable::describe_exposed(var_name));
+    server.Stop(0);
+    server.Join();
+}
+
 class SendNAfterAcceptStream : public AfterAcceptStream {
 public:
     explicit SendNAfterAcceptStream(int n)
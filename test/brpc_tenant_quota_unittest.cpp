@@ -0,0 +1,145 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// brpc - A framework to host and access services throughout Baidu.
+
+#include <gtest/gtest.h>
+#include "butil/time.h"
+#include "brpc/controller.h"
+#include "brpc/tenant_quota.h"
+
+namespace {
+
+class TenantQuotaTest : public ::testing::Test {
+protected:
+    void SetUp() {}
+    void TearDown() {}
+};
+
+static brpc::Controller* NewRequestOfTenant(const char* tenant) {
+    brpc::Controller* cntl = new brpc::Controller;
+    if (tenant != NULL) {
+        cntl->http_request().SetHeader("x-tenant", tenant);
+    }
+    return cntl;
+}
+
+TEST_F(TenantQuotaTest, init_validation) {
+    brpc::TenantQuotaOptions options;
+    brpc::TenantQuota quota;
+    ASSERT_EQ(-1, quota.Init(options));  // total_rate unset
+    options.total_rate = 100;
+    options.default_weight = 0;
+    ASSERT_EQ(-1, quota.Init(options));
+    options.default_weight = 1;
+    options.tenant_weights["bad"] = -1;
+    ASSERT_EQ(-1, quota.Init(options));
+    options.tenant_weights["bad"] = 2;
+    ASSERT_EQ(0, quota.Init(options));
+}
+
+TEST_F(TenantQuotaTest, extract_tenant) {
+    brpc::TenantQuota quota;
+    std::string tenant;
+    std::unique_ptr<brpc::Controller> cntl(NewRequestOfTenant("foo"));
+    quota.ExtractTenant(*cntl, &tenant);
+    ASSERT_EQ("foo", tenant);
+    // Requests without the header(or non-http ones) have no tenant.
+    cntl.reset(new brpc::Controller);
+    tenant = "stale";
+    quota.ExtractTenant(*cntl, &tenant);
+    ASSERT_TRUE(tenant.empty());
+}
+
+TEST_F(TenantQuotaTest, uninitialized_quota_limits_nothing) {
+    brpc::TenantQuota quota;
+    std::unique_ptr<brpc::Controller> cntl(NewRequestOfTenant("foo"));
+    for (int i = 0; i < 100; ++i) {
+        ASSERT_TRUE(quota.OnRequested(*cntl));
+    }
+}
+
+TEST_F(TenantQuotaTest, admit_and_reject) {
+    brpc::TenantQuotaOptions options;
+    options.total_rate = 100;
+    brpc::TenantQuota quota;
+    ASSERT_EQ(0, quota.Init(options));
+    std::unique_ptr<brpc::Controller> cntl(NewRequestOfTenant("a"));
+    // A fresh bucket starts full.
+    ASSERT_TRUE(quota.OnRequested(*cntl));
+    brpc::TenantQuota::TenantStat* st = quota._tenants["a"];
+    ASSERT_TRUE(st != NULL);
+    ASSERT_EQ(1, st->admitted.get_value());
+    // Drain the bucket by hand to avoid timing-sensitive loops: with less
+    // than one token the request must be rejected(the refill within the
+    // few microseconds since last_refill_us is far below one token).
+    st->tokens = 0.3;
+    ASSERT_FALSE(quota.OnRequested(*cntl));
+    ASSERT_EQ(1, st->rejected.get_value());
+    st->tokens = 2;
+    ASSERT_TRUE(quota.OnRequested(*cntl));
+    ASSERT_EQ(2, st->admitted.get_value());
+    ASSERT_EQ(1, st->rejected.get_value());
+}
+
+TEST_F(TenantQuotaTest, weighted_shares) {
+    brpc::TenantQuotaOptions options;
+    options.total_rate = 1000;
+    options.tenant_weights["vip"] = 3;
+    brpc::TenantQuota quota;
+    ASSERT_EQ(0, quota.Init(options));
+    std::unique_ptr<brpc::Controller> vip_cntl(NewRequestOfTenant("vip"));
+    std::unique_ptr<brpc::Controller> free_cntl(NewRequestOfTenant("free"));
+    std::unique_ptr<brpc::Controller> anon_cntl(NewRequestOfTenant(NULL));
+    ASSERT_TRUE(quota.OnRequested(*vip_cntl));
+    ASSERT_EQ(3, quota._active_weight_sum);
+    ASSERT_TRUE(quota.OnRequested(*free_cntl));
+    ASSERT_EQ(4, quota._active_weight_sum);
+    // Requests without a tenant share the "other" bucket.
+    ASSERT_TRUE(quota.OnRequested(*anon_cntl));
+    ASSERT_EQ(5, quota._active_weight_sum);
+    ASSERT_TRUE(quota._tenants.find("other") != quota._tenants.end());
+    ASSERT_EQ(3, quota._tenants["vip"]->weight);
+    ASSERT_EQ(1, quota._tenants["free"]->weight);
+    // Idle tenants give their weight back after the active window.
+    quota._tenants["free"]->last_active_us =
+        butil::gettimeofday_us() - 2000000L;
+    quota._tenants["other"]->last_active_us =
+        butil::gettimeofday_us() - 2000000L;
+    quota._last_sweep_us = 0;
+    ASSERT_TRUE(quota.OnRequested(*vip_cntl));
+    ASSERT_EQ(3, quota._active_weight_sum);
+}
+
+TEST_F(TenantQuotaTest, expose_bvars) {
+    brpc::TenantQuotaOptions options;
+    options.total_rate = 100;
+    brpc::TenantQuota quota;
+    ASSERT_EQ(0, quota.Init(options));
+    std::unique_ptr<brpc::Controller> cntl(NewRequestOfTenant("billing"));
+    ASSERT_TRUE(quota.OnRequested(*cntl));
+    ASSERT_EQ(0, quota.Expose("test_quota_server"));
+    ASSERT_EQ("1", bvar::Variable::describe_exposed(
+                  "test_quota_server_tenant_billing_admitted"));
+    // Tenants showing up after Expose() are exposed on creation.
+    std::unique_ptr<brpc::Controller> cntl2(NewRequestOfTenant("search"));
+    ASSERT_TRUE(quota.OnRequested(*cntl2));
+    ASSERT_EQ("0", bvar::Variable::describe_exposed(
+                  "test_quota_server_tenant_search_rejected"));
+}
+
+} //namespace
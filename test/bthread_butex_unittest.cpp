@@ -16,6 +16,7 @@
 // under the License.
 
 #include <gtest/gtest.h>
+#include <gflags/gflags.h>
 #include "butil/atomicops.h"
 #include "butil/time.h"
 #include "butil/macros.h"
@@ -27,6 +28,8 @@
 #include "bthread/unstable.h"
 
 namespace bthread {
+DECLARE_bool(bthread_locality_aware_butex_wake);
+DECLARE_int32(bthread_batch_wake_min_waiters);
 extern butil::atomic<TaskControl*> g_task_control;
 inline TaskControl* get_task_control() {
     return g_task_control.load(butil::memory_order_consume);
@@ -205,6 +208,58 @@ void* wait_butex(void* void_arg) {
     return NULL;
 }
 
+void* wake_butex(void* arg) {
+    EXPECT_EQ(1, bthread::butex_wake(arg));
+    return NULL;
+}
+
+TEST(ButexTest, locality_aware_wake) {
+    bthread::FLAGS_bthread_locality_aware_butex_wake = true;
+    int* butex = bthread::butex_create_checked<int>();
+    *butex = 7;
+    ButexWaitArg arg = { butex, 7, 1000, 0 };
+    bthread_t waiter_th;
+    ASSERT_EQ(0, bthread_start_urgent(&waiter_th, NULL, wait_butex, &arg));
+    usleep(20000);  // make sure the waiter is queued.
+    *butex = 8;
+    // Wake from a bthread so that the woken waiter goes through the
+    // local run queue of the waking worker.
+    bthread_t waker_th;
+    ASSERT_EQ(0, bthread_start_urgent(&waker_th, NULL, wake_butex, butex));
+    ASSERT_EQ(0, bthread_join(waker_th, NULL));
+    ASSERT_EQ(0, bthread_join(waiter_th, NULL));
+    bthread::FLAGS_bthread_locality_aware_butex_wake = false;
+    bthread::butex_destroy(butex);
+}
+
+TEST(ButexTest, batch_wake_all) {
+    const int saved_min_waiters = bthread::FLAGS_bthread_batch_wake_min_waiters;
+    // Make sure the batched path is taken.
+    bthread::FLAGS_bthread_batch_wake_min_waiters = 1;
+    int* butex = bthread::butex_create_checked<int>();
+    *butex = 7;
+    const size_t N = 200;
+    ButexWaitArg arg = { butex, 7, 30000, 0 };
+    bthread_t waiters[N];
+    for (size_t i = 0; i < N; ++i) {
+        ASSERT_EQ(0, bthread_start_background(
+                      &waiters[i], NULL, wait_butex, &arg));
+    }
+    *butex = 8;
+    // Waiters queue up asynchronously, wake until all of them left.
+    size_t nwakeup = 0;
+    for (int i = 0; i < 1000 && nwakeup < N; ++i) {
+        nwakeup += bthread::butex_wake_all(butex);
+        usleep(10000);
+    }
+    ASSERT_EQ(N, nwakeup);
+    for (size_t i = 0; i < N; ++i) {
+        ASSERT_EQ(0, bthread_join(waiters[i], NULL));
+    }
+    bthread::FLAGS_bthread_batch_wake_min_waiters = saved_min_waiters;
+    bthread::butex_destroy(butex);
+}
+
 TEST(ButexTest, wait_without_stop) {
     int* butex = bthread::butex_create_checked<int>();
     *butex = 7;
@@ -708,4 +708,194 @@ TEST_F(ExecutionQueueTest, cancel_unexecuted_high_priority_task) {
 
     ASSERT_EQ(12345, result);
 }
+
+struct BatchMeta {
+    int64_t sum;
+    size_t max_tasks_per_call;
+};
+
+int add_in_batches(void* meta, bthread::TaskIterator<LongIntTask>& iter) {
+    if (iter.is_queue_stopped()) {
+        stopped = true;
+        return 0;
+    }
+    BatchMeta* m = (BatchMeta*)meta;
+    size_t n = 0;
+    for (; iter; ++iter) {
+        if (iter->value == -100) {
+            g_suspending = true;
+            while (g_suspending) {
+                usleep(10);
+            }
+        } else {
+            m->sum += iter->value;
+        }
+        ++n;
+    }
+    if (n > m->max_tasks_per_call) {
+        m->max_tasks_per_call = n;
+    }
+    return 0;
+}
+
+TEST_F(ExecutionQueueTest, max_batch_size) {
+    bthread::ExecutionQueueId<LongIntTask> queue_id = { 0 }; // to suppress warnings
+    bthread::ExecutionQueueOptions options;
+    options.max_batch_size = 10;
+    BatchMeta m = { 0, 0 };
+    ASSERT_EQ(0, bthread::execution_queue_start(&queue_id, &options,
+                                                add_in_batches, &m));
+    g_suspending = false;
+    // Suspend the executor so that the following tasks pile up
+    ASSERT_EQ(0, bthread::execution_queue_execute(queue_id, -100));
+    while (!g_suspending) {
+        usleep(10);
+    }
+    int64_t expected = 0;
+    for (int i = 1; i <= 100; ++i) {
+        expected += i;
+        ASSERT_EQ(0, bthread::execution_queue_execute(queue_id, i));
+    }
+    g_suspending = false;
+    ASSERT_EQ(0, bthread::execution_queue_stop(queue_id));
+    ASSERT_EQ(0, bthread::execution_queue_join(queue_id));
+    ASSERT_EQ(expected, m.sum);
+    ASSERT_LE(m.max_tasks_per_call, options.max_batch_size);
+    ASSERT_TRUE(stopped);
+}
+
+int add_vectored(void* meta, LongIntTask* tasks, size_t n) {
+    if (tasks == NULL) {
+        EXPECT_EQ(0u, n);
+        stopped = true;
+        return 0;
+    }
+    int64_t* result = (int64_t*)meta;
+    for (size_t i = 0; i < n; ++i) {
+        *result += tasks[i].value;
+        if (tasks[i].event) { tasks[i].event->signal(); }
+    }
+    return 0;
+}
+
+TEST_F(ExecutionQueueTest, vectored_execute) {
+    int64_t result = 0;
+    int64_t expected_result = 0;
+    bthread::ExecutionQueueId<LongIntTask> queue_id;
+    bthread::ExecutionQueueOptions options;
+    ASSERT_EQ(0, bthread::execution_queue_start(&queue_id, &options,
+                                                add_vectored, &result));
+    for (int i = 0; i < 100; ++i) {
+        expected_result += i;
+        ASSERT_EQ(0, bthread::execution_queue_execute(queue_id, i));
+    }
+    ASSERT_EQ(0, bthread::execution_queue_stop(queue_id));
+    ASSERT_EQ(0, bthread::execution_queue_join(queue_id));
+    ASSERT_EQ(expected_result, result);
+    ASSERT_TRUE(stopped);
+}
+
+TEST_F(ExecutionQueueTest, queue_level_in_place) {
+    pthread_t thread_id = pthread_self();
+    bthread::ExecutionQueueId<LongIntTask> queue_id = { 0 }; // to suppress warnings
+    bthread::ExecutionQueueOptions options;
+    options.in_place_if_possible = true;
+    ASSERT_EQ(0, bthread::execution_queue_start(&queue_id, &options,
+                                                check_running_thread,
+                                                (void*)thread_id));
+    // No TASK_OPTIONS_INPLACE, yet the task runs in this thread.
+    ASSERT_EQ(0, bthread::execution_queue_execute(queue_id, 0));
+    ASSERT_EQ(0, bthread::execution_queue_stop(queue_id));
+    ASSERT_EQ(0, bthread::execution_queue_join(queue_id));
+}
+
+TEST_F(ExecutionQueueTest, max_delay) {
+    int64_t result = 0;
+    int64_t expected_result = 0;
+    bthread::ExecutionQueueId<LongIntTask> queue_id;
+    bthread::ExecutionQueueOptions options;
+    options.max_delay_us = 2000;
+    ASSERT_EQ(0, bthread::execution_queue_start(&queue_id, &options,
+                                                add, &result));
+    for (int i = 0; i < 100; ++i) {
+        expected_result += i;
+        ASSERT_EQ(0, bthread::execution_queue_execute(queue_id, i));
+    }
+    ASSERT_EQ(0, bthread::execution_queue_stop(queue_id));
+    ASSERT_EQ(0, bthread::execution_queue_join(queue_id));
+    ASSERT_EQ(expected_result, result);
+    ASSERT_TRUE(stopped);
+}
+
+struct GroupQueueMeta {
+    long expected_next;
+    int order_errors;
+    int64_t sum;
+    butil::atomic<int>* concurrent;
+    butil::atomic<int>* max_concurrent;
+};
+
+int group_execute(void* meta, bthread::TaskIterator<LongIntTask>& iter) {
+    if (iter.is_queue_stopped()) {
+        return 0;
+    }
+    GroupQueueMeta* m = (GroupQueueMeta*)meta;
+    const int cur = m->concurrent->fetch_add(1, butil::memory_order_relaxed) + 1;
+    int seen_max = m->max_concurrent->load(butil::memory_order_relaxed);
+    while (cur > seen_max && !m->max_concurrent->compare_exchange_weak(
+               seen_max, cur, butil::memory_order_relaxed)) {
+    }
+    for (; iter; ++iter) {
+        if (iter->value != m->expected_next++) {
+            ++m->order_errors;
+        }
+        m->sum += iter->value;
+    }
+    // Hold the worker briefly so that batches of sibling queues pile up
+    // and get picked up by a worker finishing this queue.
+    bthread_usleep(1000);
+    m->concurrent->fetch_sub(1, butil::memory_order_relaxed);
+    return 0;
+}
+
+TEST_F(ExecutionQueueTest, queue_group) {
+    const size_t NQUEUE = 8;
+    const long NTASK_PER_QUEUE = 300;
+    const int MAX_CONCURRENCY = 2;
+    butil::atomic<int> concurrent(0);
+    butil::atomic<int> max_concurrent(0);
+    bthread::ExecutionQueueGroup group("test_execq_group", MAX_CONCURRENCY);
+    ASSERT_EQ(MAX_CONCURRENCY, group.max_concurrency());
+    bthread::ExecutionQueueId<LongIntTask> queue_ids[NQUEUE];
+    GroupQueueMeta metas[NQUEUE];
+    bthread::ExecutionQueueOptions options;
+    options.executor = &group;
+    for (size_t i = 0; i < NQUEUE; ++i) {
+        metas[i].expected_next = 0;
+        metas[i].order_errors = 0;
+        metas[i].sum = 0;
+        metas[i].concurrent = &concurrent;
+        metas[i].max_concurrent = &max_concurrent;
+        ASSERT_EQ(0, bthread::execution_queue_start(&queue_ids[i], &options,
+                                                    group_execute, &metas[i]));
+    }
+    int64_t expected_sum = 0;
+    for (long v = 0; v < NTASK_PER_QUEUE; ++v) {
+        expected_sum += v;
+        for (size_t i = 0; i < NQUEUE; ++i) {
+            ASSERT_EQ(0, bthread::execution_queue_execute(queue_ids[i], v));
+        }
+    }
+    for (size_t i = 0; i < NQUEUE; ++i) {
+        ASSERT_EQ(0, bthread::execution_queue_stop(queue_ids[i]));
+        ASSERT_EQ(0, bthread::execution_queue_join(queue_ids[i]));
+    }
+    for (size_t i = 0; i < NQUEUE; ++i) {
+        ASSERT_EQ(0, metas[i].order_errors) << "i=" << i;
+        ASSERT_EQ(expected_sum, metas[i].sum) << "i=" << i;
+    }
+    ASSERT_LE(max_concurrent.load(butil::memory_order_relaxed),
+              MAX_CONCURRENCY);
+    ASSERT_GE(max_concurrent.load(butil::memory_order_relaxed), 1);
+}
 } // namespace
@@ -168,6 +168,43 @@ TEST(BthreadIdTest, doubly_destroy) {
     ASSERT_EQ(EINVAL, bthread_id_error(id2, EBADF));
 }
 
+struct OnError2Arg {
+    int error_code;
+    std::string error_text;
+};
+
+static int on_error2_destroy(bthread_id_t id, void* data, int error_code,
+                             const std::string& error_text) {
+    OnError2Arg* arg = static_cast<OnError2Arg*>(data);
+    arg->error_code = error_code;
+    arg->error_text = error_text;
+    return bthread_id_unlock_and_destroy(id);
+}
+
+TEST(BthreadIdTest, batched_error) {
+    const size_t N = 10;
+    bthread_id_t ids[N + 2];
+    OnError2Arg args[N];
+    for (size_t i = 0; i < N; ++i) {
+        args[i].error_code = 0;
+        ASSERT_EQ(0, bthread_id_create2(&ids[i], &args[i], on_error2_destroy));
+    }
+    // Invalid ids in the batch are skipped.
+    ids[N] = INVALID_BTHREAD_ID;
+    bthread_id_t destroyed;
+    ASSERT_EQ(0, bthread_id_create(&destroyed, NULL, NULL));
+    ASSERT_EQ(0, bthread_id_error(destroyed, EBADF));
+    ids[N + 1] = destroyed;
+
+    ASSERT_EQ((int)N, bthread_id_error2_batched(
+                  ids, N + 2, ECONNRESET, "broken"));
+    for (size_t i = 0; i < N; ++i) {
+        ASSERT_EQ(ECONNRESET, args[i].error_code) << "i=" << i;
+        ASSERT_EQ("broken", args[i].error_text) << "i=" << i;
+        ASSERT_EQ(EINVAL, bthread_id_error(ids[i], EBADF));
+    }
+}
+
 static int on_numeric_error(bthread_id_t id, void* data, int error_code) {
     std::vector<int>* result = static_cast<std::vector<int>*>(data);
     result->push_back(error_code);
@@ -24,6 +24,7 @@
 #include "butil/logging.h"
 #include "bthread/bthread.h"
 #include "bthread/unstable.h"
+#include "bthread/task_meta.h"               // KEY_FAST_SLOT_NUM
 
 extern "C" {
 int bthread_keytable_pool_size(bthread_keytable_pool_t* pool) {
@@ -403,4 +404,104 @@ TEST(KeyTest, using_pool) {
     ASSERT_EQ(0, bthread_key_delete(key));
 }
 
+static int g_counting_dtor_calls = 0;
+static void counting_dtor(void* d) {
+    ++g_counting_dtor_calls;
+    free(d);
+}
+
+static void* set_data_thread(void* args) {
+    bthread_key_t key = *(bthread_key_t*)args;
+    if (bthread_getspecific(key) == NULL) {
+        EXPECT_EQ(0, bthread_setspecific(key, malloc(8)));
+    }
+    return NULL;
+}
+
+TEST(KeyTest, pool_size_is_conserved_across_caches) {
+    bthread_key_t key;
+    ASSERT_EQ(0, bthread_key_create(&key, counting_dtor));
+
+    bthread_keytable_pool_t pool;
+    ASSERT_EQ(0, bthread_keytable_pool_init(&pool));
+
+    bthread_attr_t attr;
+    ASSERT_EQ(0, bthread_attr_init(&attr));
+    attr.keytable_pool = &pool;
+
+    // Enough sequential bthreads to cycle tables through the per-thread
+    // caches, including batch spills and refills.
+    for (int i = 0; i < 100; ++i) {
+        bthread_t bth;
+        ASSERT_EQ(0, bthread_start_urgent(&bth, &attr, set_data_thread, &key));
+        ASSERT_EQ(0, bthread_join(bth, NULL));
+    }
+    // Cached tables count as free and no table is lost or duplicated.
+    const int nfree = bthread_keytable_pool_size(&pool);
+    ASSERT_LE(1, nfree);
+
+    // Each table got its data exactly once(setspecific only when absent),
+    // so destroy must run the dtor once per free table, including tables
+    // sitting in thread caches.
+    g_counting_dtor_calls = 0;
+    ASSERT_EQ(0, bthread_keytable_pool_destroy(&pool));
+    ASSERT_EQ(nfree, g_counting_dtor_calls);
+
+    ASSERT_EQ(0, bthread_key_delete(key));
+}
+
+static butil::atomic<int> g_fast_ndestroy(0);
+static void fast_dtor(void* d) {
+    g_fast_ndestroy.fetch_add(1, butil::memory_order_relaxed);
+    free(d);
+}
+
+static void* fast_key_thread(void* args) {
+    bthread_key_t key = *(bthread_key_t*)args;
+    EXPECT_EQ(NULL, bthread_getspecific(key));
+    void* data = malloc(8);
+    EXPECT_EQ(0, bthread_setspecific(key, data));
+    EXPECT_EQ(data, bthread_getspecific(key));
+    return NULL;
+}
+
+TEST(KeyTest, fast_keys) {
+    bthread_key_t key;
+    ASSERT_EQ(0, bthread_key_create_fast(&key, fast_dtor));
+    ASSERT_EQ(NULL, bthread_getspecific(key));
+
+    // Unlike ordinary keys, data of fast keys is destructed when the
+    // bthread ends rather than when the KeyTable leaves the pool.
+    bthread_t bth;
+    ASSERT_EQ(0, bthread_start_urgent(&bth, NULL, fast_key_thread, &key));
+    ASSERT_EQ(0, bthread_join(bth, NULL));
+    ASSERT_EQ(1, g_fast_ndestroy.load(butil::memory_order_relaxed));
+
+    // Values set in pthreads are independent from bthreads.
+    void* pth_data = malloc(8);
+    ASSERT_EQ(0, bthread_setspecific(key, pth_data));
+    ASSERT_EQ(pth_data, bthread_getspecific(key));
+
+    // Only KEY_FAST_SLOT_NUM fast keys can exist at the same time.
+    bthread_key_t more_keys[bthread::KEY_FAST_SLOT_NUM];
+    for (size_t i = 0; i < bthread::KEY_FAST_SLOT_NUM - 1; ++i) {
+        ASSERT_EQ(0, bthread_key_create_fast(&more_keys[i], NULL));
+    }
+    ASSERT_EQ(EAGAIN, bthread_key_create_fast(
+                  &more_keys[bthread::KEY_FAST_SLOT_NUM - 1], NULL));
+    for (size_t i = 0; i < bthread::KEY_FAST_SLOT_NUM - 1; ++i) {
+        ASSERT_EQ(0, bthread_key_delete(more_keys[i]));
+    }
+
+    // Deleting a key invalidates set values, same as ordinary keys.
+    ASSERT_EQ(0, bthread_key_delete(key));
+    bthread_key_t key2;
+    ASSERT_EQ(0, bthread_key_create_fast(&key2, NULL));
+    ASSERT_EQ(key.index, key2.index);
+    ASSERT_EQ(NULL, bthread_getspecific(key2));
+    ASSERT_EQ(NULL, bthread_getspecific(key));
+    free(pth_data);
+    ASSERT_EQ(0, bthread_key_delete(key2));
+}
+
 }  // namespace
@@ -24,6 +24,7 @@
 #include "bthread/bthread.h"
 #include "bthread/butex.h"
 #include "bthread/task_control.h"
+#include "bthread/task_group.h"
 #include "bthread/mutex.h"
 #include "butil/gperftools_profiler.h"
 
@@ -266,4 +267,66 @@ TEST(MutexTest, mix_thread_types) {
         pthread_join(pthreads[i], NULL);
     }
 }
+
+struct PriorityInheritanceArg {
+    bthread_mutex_t* m;
+    bthread_t holder_tid;
+    volatile bool holder_locked;
+};
+
+void* pi_holder(void* arg) {
+    PriorityInheritanceArg* a = (PriorityInheritanceArg*)arg;
+    a->holder_tid = bthread_self();
+    bthread_mutex_lock(a->m);
+    a->holder_locked = true;
+    bthread_usleep(100000);  // stay inside the critical section for a while
+    bthread_mutex_unlock(a->m);
+    return NULL;
+}
+
+void* pi_waiter(void* arg) {
+    PriorityInheritanceArg* a = (PriorityInheritanceArg*)arg;
+    EXPECT_EQ(0, bthread_set_priority(2));
+    EXPECT_EQ(2, bthread_get_priority());
+    bthread_mutex_lock(a->m);
+    bthread_mutex_unlock(a->m);
+    return NULL;
+}
+
+TEST(MutexTest, priority_inheritance) {
+    ASSERT_EQ(EINVAL, bthread_set_priority(1));   // not a bthread
+    ASSERT_EQ(EINVAL, bthread_set_priority(-1));
+    ASSERT_EQ(0, bthread_get_priority());
+
+    bthread_mutex_t m;
+    ASSERT_EQ(0, bthread_mutex_init(&m, NULL));
+    ASSERT_EQ(0u, m.owner);
+    // pthread holders are not tracked.
+    ASSERT_EQ(0, bthread_mutex_lock(&m));
+    ASSERT_EQ(0u, m.owner);
+    ASSERT_EQ(0, bthread_mutex_unlock(&m));
+
+    PriorityInheritanceArg a = { &m, 0, false };
+    bthread_t holder;
+    ASSERT_EQ(0, bthread_start_background(&holder, NULL, pi_holder, &a));
+    while (!a.holder_locked) {
+        usleep(1000);
+    }
+    ASSERT_EQ(a.holder_tid, m.owner);
+    bthread::TaskMeta* hm = bthread::TaskGroup::address_meta(a.holder_tid);
+    ASSERT_TRUE(hm != NULL);
+    ASSERT_EQ(0, hm->boosted_priority.load(butil::memory_order_relaxed));
+
+    bthread_t waiter;
+    ASSERT_EQ(0, bthread_start_background(&waiter, NULL, pi_waiter, &a));
+    usleep(30000);  // waiter must have blocked and boosted the holder.
+    ASSERT_EQ(2, hm->boosted_priority.load(butil::memory_order_relaxed));
+
+    ASSERT_EQ(0, bthread_join(holder, NULL));
+    ASSERT_EQ(0, bthread_join(waiter, NULL));
+    // Owner and boost are dropped on unlock.
+    ASSERT_EQ(0u, m.owner);
+    ASSERT_EQ(0, hm->boosted_priority.load(butil::memory_order_relaxed));
+    ASSERT_EQ(0, bthread_mutex_destroy(&m));
+}
 } // namespace
@@ -0,0 +1,97 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <gtest/gtest.h>
+#include <gflags/gflags.h>
+#include "butil/third_party/murmurhash3/murmurhash3.h"  // fmix64
+#include "bthread/bthread.h"
+#include "bthread/task_group.h"
+#include "bthread/task_control.h"
+
+namespace bthread {
+DECLARE_int64(bthread_steal_seed);
+extern TaskControl* g_task_control;
+}
+
+namespace {
+
+static void* yield_thrice(void*) {
+    for (int i = 0; i < 3; ++i) {
+        bthread_yield();
+    }
+    return NULL;
+}
+
+TEST(SchedStatTest, counters_advance_with_workload) {
+    // Make sure workers are started.
+    bthread_t warmup;
+    ASSERT_EQ(0, bthread_start_background(&warmup, NULL, yield_thrice, NULL));
+    ASSERT_EQ(0, bthread_join(warmup, NULL));
+    bthread::TaskControl* c = bthread::g_task_control;
+    ASSERT_TRUE(c != NULL);
+
+    bthread::TaskControl::SchedStat before;
+    c->get_sched_stat(&before);
+
+    const int N = 100;
+    bthread_t tids[N];
+    for (int i = 0; i < N; ++i) {
+        ASSERT_EQ(0, bthread_start_background(
+                      &tids[i], NULL, yield_thrice, NULL));
+    }
+    for (int i = 0; i < N; ++i) {
+        ASSERT_EQ(0, bthread_join(tids[i], NULL));
+    }
+
+    bthread::TaskControl::SchedStat after;
+    c->get_sched_stat(&after);
+    // Each bthread switches in at least once.
+    ASSERT_GE(after.nswitch - before.nswitch, N);
+    ASSERT_GE(after.nsignal, before.nsignal);
+    ASSERT_GE(after.nstolen, before.nstolen);
+    ASSERT_GE(after.nsteal_contended, before.nsteal_contended);
+}
+
+TEST(SchedStatTest, steal_seed_flag_makes_seeds_deterministic) {
+    bthread::TaskControl* c = bthread::g_task_control;
+    ASSERT_TRUE(c != NULL);
+
+    const uint64_t SEED = 1234;
+    ASSERT_FALSE(GFLAGS_NS::SetCommandLineOption(
+        "bthread_steal_seed", "1234").empty());
+    bthread::TaskGroup g1(c);
+    bthread::TaskGroup g2(c);
+    ASSERT_FALSE(GFLAGS_NS::SetCommandLineOption(
+        "bthread_steal_seed", "-1").empty());
+
+    // Seeds must come from the deterministic sequence derived from the
+    // flag, not from fast_rand(). Workers started before this test may
+    // have consumed earlier ordinals, so scan a generous range.
+    bool found1 = false;
+    bool found2 = false;
+    for (uint64_t k = 0; k < 1024; ++k) {
+        const uint64_t expected =
+            butil::fmix64(SEED + k * 0x9E3779B97F4A7C15ULL);
+        found1 |= (g1._steal_seed == expected);
+        found2 |= (g2._steal_seed == expected);
+    }
+    ASSERT_TRUE(found1);
+    ASSERT_TRUE(found2);
+    ASSERT_NE(g1._steal_seed, g2._steal_seed);
+}
+
+} // namespace
@@ -156,6 +156,41 @@ TEST(TimerThreadTest, RunTasks) {
     keeper6.expect_first_run(keeper6_addtime);
 }
 
+TEST(TimerThreadTest, RunBatchedTasks) {
+    bthread::TimerThread timer_thread;
+    ASSERT_EQ(0, timer_thread.start(NULL));
+
+    const size_t N = 10;
+    timespec _1s_later = butil::seconds_from_now(1);
+    TimeKeeper* keepers[N];
+    void* args[N];
+    for (size_t i = 0; i < N; ++i) {
+        keepers[i] = new TimeKeeper(_1s_later, "batched");
+        args[i] = keepers[i];
+    }
+    bthread::TimerThread::TaskId ids[N];
+    ASSERT_EQ(N, timer_thread.schedule_batch(
+                  TimeKeeper::routine, args, N, _1s_later, ids));
+    for (size_t i = 0; i < N; ++i) {
+        keepers[i]->_task_id = ids[i];
+    }
+    // Individual tasks of a batch are still unschedulable.
+    ASSERT_EQ(0, timer_thread.unschedule(ids[0]));
+    ASSERT_EQ(0, timer_thread.unschedule(ids[N - 1]));
+
+    sleep(2);
+    timer_thread.stop_and_join();
+
+    keepers[0]->expect_not_run();
+    keepers[N - 1]->expect_not_run();
+    for (size_t i = 1; i + 1 < N; ++i) {
+        keepers[i]->expect_first_run();
+    }
+    for (size_t i = 0; i < N; ++i) {
+        delete keepers[i];
+    }
+}
+
 // If the scheduled time is before start time, then should run it
 // immediately.
 TEST(TimerThreadTest, start_after_schedule) {
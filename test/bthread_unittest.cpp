@@ -22,6 +22,7 @@
 #include "butil/logging.h"
 #include "butil/logging.h"
 #include "butil/gperftools_profiler.h"
+#include "bvar/bvar.h"
 #include "bthread/bthread.h"
 #include "bthread/unstable.h"
 #include "bthread/task_meta.h"
@@ -138,6 +139,40 @@ void* do_nothing(void* arg) {
     return NULL;
 }
 
+TEST_F(BthreadTest, dispatch_vars) {
+    // Enough bthreads to hit the 1/N enqueue sampling.
+    for (int i = 0; i < 100; ++i) {
+        bthread_t th;
+        ASSERT_EQ(0, bthread_start_background(&th, NULL, do_nothing, NULL));
+        ASSERT_EQ(0, bthread_join(th, NULL));
+    }
+    ASSERT_FALSE(bvar::Variable::describe_exposed("bthread_runqueue_size").empty());
+    const std::string ndispatch =
+        bvar::Variable::describe_exposed("bthread_dispatch_count");
+    ASSERT_FALSE(ndispatch.empty());
+    ASSERT_GT(strtol(ndispatch.c_str(), NULL, 10), 0L);
+}
+
+void* get_pthread(void*) {
+    return (void*)pthread_self();
+}
+
+TEST_F(BthreadTest, affinity_attribute) {
+    // Affinity is best-effort(idle workers still steal), just make sure
+    // threads with an affinity run and join normally.
+    bthread_attr_t attr = BTHREAD_ATTR_NORMAL;
+    attr.affinity = 12345;
+    bthread_t th[8];
+    for (size_t i = 0; i < ARRAY_SIZE(th); ++i) {
+        ASSERT_EQ(0, bthread_start_background(&th[i], &attr, get_pthread, NULL));
+    }
+    for (size_t i = 0; i < ARRAY_SIZE(th); ++i) {
+        void* ret = NULL;
+        ASSERT_EQ(0, bthread_join(th[i], &ret));
+        ASSERT_NE((void*)NULL, ret);
+    }
+}
+
 void* launcher(void* arg) {
     LOG(INFO) << "launcher(" << arg << ")";
     for (size_t i = 0; !stop; ++i) {
@@ -245,6 +280,36 @@ TEST_F(BthreadTest, bthread_join) {
     ASSERT_EQ(0, bthread_start_urgent(&th, NULL, join_self, NULL));
 }
 
+static pthread_t g_inline_run_thread;
+void* record_pthread(void* arg) {
+    g_inline_run_thread = pthread_self();
+    *(bool*)arg = true;
+    return NULL;
+}
+
+void* start_inline_bthread(void* arg) {
+    const pthread_t caller_thread = pthread_self();
+    bool called = false;
+    bthread_t th;
+    bthread_attr_t attr = BTHREAD_ATTR_NORMAL | BTHREAD_INLINE;
+    EXPECT_EQ(0, bthread_start_urgent(&th, &attr, record_pthread, &called));
+    // In-place execution finishes the function before returning.
+    EXPECT_TRUE(called);
+    EXPECT_TRUE(pthread_equal(caller_thread, g_inline_run_thread));
+    // The tid is still joinable.
+    EXPECT_EQ(0, bthread_join(th, NULL));
+    *(bool*)arg = true;
+    return NULL;
+}
+
+TEST_F(BthreadTest, inline_bthread) {
+    bool done = false;
+    bthread_t th;
+    ASSERT_EQ(0, bthread_start_urgent(&th, NULL, start_inline_bthread, &done));
+    ASSERT_EQ(0, bthread_join(th, NULL));
+    ASSERT_TRUE(done);
+}
+
 void* change_errno(void* arg) {
     errno = (intptr_t)arg;
     return NULL;
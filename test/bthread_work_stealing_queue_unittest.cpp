@@ -127,4 +127,97 @@ TEST(WSQTest, sanity) {
               << " popped=" << npopped
               << " left=" << (N - nstolen - npopped)  << std::endl;
 }
+
+TEST(WSQTest, steal_batch_takes_at_most_half) {
+    bthread::WorkStealingQueue<value_type> q;
+    ASSERT_EQ(0, q.init(64));
+    value_type vals[64];
+    // Empty queue.
+    ASSERT_EQ(0UL, q.steal_batch(vals, 8));
+    // A single item is stolen like steal() does.
+    ASSERT_TRUE(q.push(100));
+    ASSERT_EQ(1UL, q.steal_batch(vals, 8));
+    ASSERT_EQ(100UL, vals[0]);
+    ASSERT_EQ(0UL, q.volatile_size());
+    // No more than half of the queue is taken, in FIFO order from the top.
+    for (size_t i = 0; i < 10; ++i) {
+        ASSERT_TRUE(q.push(i));
+    }
+    const size_t n = q.steal_batch(vals, 8);
+    ASSERT_LE(1UL, n);
+    ASSERT_LE(n, 5UL);
+    for (size_t i = 0; i < n; ++i) {
+        ASSERT_EQ(i, vals[i]);
+    }
+    ASSERT_EQ(10 - n, q.volatile_size());
+    // max_n caps the batch.
+    const size_t n2 = q.steal_batch(vals, 1);
+    ASSERT_EQ(1UL, n2);
+    ASSERT_EQ(n, vals[0]);
+}
+
+void* steal_batch_thread(void* arg) {
+    std::vector<value_type> *stolen = new std::vector<value_type>;
+    stolen->reserve(N);
+    bthread::WorkStealingQueue<value_type> *q =
+        (bthread::WorkStealingQueue<value_type>*)arg;
+    value_type vals[4];
+    while (!g_stop) {
+        const size_t n = q->steal_batch(vals, ARRAY_SIZE(vals));
+        if (n > 0) {
+            stolen->insert(stolen->end(), vals, vals + n);
+        } else {
+            asm volatile("pause\n": : :"memory");
+        }
+    }
+    return stolen;
+}
+
+// Same harness as `sanity' with batched stealers: every pushed value
+// must still be consumed exactly once.
+TEST(WSQTest, steal_batch_sanity) {
+    g_stop = false;
+    bthread::WorkStealingQueue<value_type> q;
+    ASSERT_EQ(0, q.init(CAP));
+    pthread_t rth[8];
+    pthread_t wth, pop_th;
+    for (size_t i = 0; i < ARRAY_SIZE(rth); ++i) {
+        ASSERT_EQ(0, pthread_create(&rth[i], NULL, steal_batch_thread, &q));
+    }
+    ASSERT_EQ(0, pthread_create(&wth, NULL, push_thread, &q));
+    ASSERT_EQ(0, pthread_create(&pop_th, NULL, pop_thread, &q));
+
+    std::vector<value_type> values;
+    values.reserve(N);
+    size_t nstolen = 0, npopped = 0;
+    for (size_t i = 0; i < ARRAY_SIZE(rth); ++i) {
+        std::vector<value_type>* res = NULL;
+        pthread_join(rth[i], (void**)&res);
+        for (size_t j = 0; j < res->size(); ++j, ++nstolen) {
+            values.push_back((*res)[j]);
+        }
+    }
+    pthread_join(wth, NULL);
+    std::vector<value_type>* res = NULL;
+    pthread_join(pop_th, (void**)&res);
+    for (size_t j = 0; j < res->size(); ++j, ++npopped) {
+        values.push_back((*res)[j]);
+    }
+
+    value_type val;
+    while (q.pop(&val)) {
+        values.push_back(val);
+    }
+
+    std::sort(values.begin(), values.end());
+    values.resize(std::unique(values.begin(), values.end()) - values.begin());
+
+    ASSERT_EQ(N, values.size());
+    for (size_t i = 0; i < N; ++i) {
+        ASSERT_EQ(i, values[i]);
+    }
+    std::cout << "stolen=" << nstolen
+              << " popped=" << npopped
+              << " left=" << (N - nstolen - npopped)  << std::endl;
+}
 } // namespace
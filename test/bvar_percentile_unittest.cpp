@@ -18,6 +18,7 @@
 // Date: 2015/09/15 15:42:55
 
 #include "bvar/detail/percentile.h"
+#include "bvar/detail/percentile_digest.h"
 #include "butil/logging.h"
 #include <gtest/gtest.h>
 #include <fstream>
@@ -52,6 +53,73 @@ TEST_F(PercentileTest, add) {
     }
 }
 
+TEST_F(PercentileTest, add_batch) {
+    bvar::detail::Percentile p;
+    bvar::detail::PercentileStage stage(p);
+    for (int j = 0; j < 10; ++j) {
+        for (int i = 0; i < 10000; ++i) {
+            stage << (i + 1);
+        }
+        stage.flush();
+        bvar::detail::GlobalPercentileSamples b = p.reset();
+        uint32_t last_value = 0;
+        for (uint32_t k = 1; k <= 10u; ++k) {
+            uint32_t value = b.get_number(k / 10.0);
+            EXPECT_GE(value, last_value);
+            last_value = value;
+            EXPECT_GT(value, (k * 1000 - 500)) << "k=" << k;
+            EXPECT_LT(value, (k * 1000 + 500)) << "k=" << k;
+        }
+    }
+    // Negative values are dropped as in operator<<.
+    const int64_t values[4] = { 1, -2, 3, -4 };
+    p.add_batch(values, 4);
+    bvar::detail::GlobalPercentileSamples b = p.reset();
+    ASSERT_EQ(3u, b.get_number(1.0));
+}
+
+TEST_F(PercentileTest, digest_add) {
+    bvar::detail::PercentileDigest p;
+    for (int j = 0; j < 10; ++j) {
+        for (int i = 0; i < 10000; ++i) {
+            p << (i + 1);
+        }
+        bvar::detail::DigestSamples b = p.reset();
+        ASSERT_EQ(10000u, b.added_count());
+        int64_t last_value = 0;
+        for (int k = 1; k <= 10; ++k) {
+            const int64_t value = b.get_number(k / 10.0);
+            EXPECT_GE(value, last_value);
+            last_value = value;
+            // Buckets guarantee ~1% relative error.
+            EXPECT_GT(value, k * 1000 * 0.98) << "k=" << k;
+            EXPECT_LT(value, k * 1000 * 1.02) << "k=" << k;
+        }
+        // Unlike sampling, long tails stay accurate.
+        EXPECT_NEAR(b.get_number(0.999), 9990, 9990 * 0.02);
+        EXPECT_NEAR(b.get_number(0.9999), 9999, 9999 * 0.02);
+    }
+    // Negative values are dropped as in Percentile.
+    p << 10;
+    p << -10;
+    bvar::detail::DigestSamples b = p.reset();
+    ASSERT_EQ(1u, b.added_count());
+}
+
+TEST_F(PercentileTest, digest_merge_is_lossless) {
+    bvar::detail::PercentileDigest p1;
+    bvar::detail::PercentileDigest p2;
+    for (int i = 0; i < 1000; ++i) {
+        p1 << 100;
+        p2 << 1000000;
+    }
+    bvar::detail::DigestSamples b = p1.reset();
+    b.merge(p2.reset());
+    ASSERT_EQ(2000u, b.added_count());
+    EXPECT_NEAR(b.get_number(0.25), 100, 100 * 0.02);
+    EXPECT_NEAR(b.get_number(0.75), 1000000, 1000000 * 0.02);
+}
+
 TEST_F(PercentileTest, merge1) {
     // Merge 2 PercentileIntervals b1 and b2. b2 has double SAMPLE_SIZE
     // and num_added. Remaining samples of b1 and b2 in merged result should
@@ -102,6 +102,92 @@ TEST(RecorderTest, window) {
     }
 }
 
+TEST(RecorderTest, sharded_recorder) {
+    bvar::ShardedRecorder recorder;
+    ASSERT_TRUE(recorder.valid());
+    for (size_t i = 0; i < 100; ++i) {
+        recorder << 2;
+    }
+    ASSERT_EQ(2l, recorder.average());
+    for (size_t i = 0; i < 3; ++i) {
+        recorder << -8;
+    }
+    bvar::Stat stat = recorder.get_value();
+    ASSERT_EQ(200 - 24, stat.sum);
+    ASSERT_EQ(103, stat.num);
+    stat = recorder.reset();
+    ASSERT_EQ(103, stat.num);
+    ASSERT_EQ(0, recorder.get_value().num);
+    // Inputs beyond int survive since the pair is full-width.
+    recorder << 40000000000LL << 40000000000LL;
+    ASSERT_EQ(40000000000LL, recorder.average());
+}
+
+TEST(RecorderTest, adaptive_recorder) {
+    bvar::AdaptiveRecorder recorder;
+    ASSERT_TRUE(recorder.valid());
+    for (size_t i = 0; i < 100; ++i) {
+        recorder << 2;
+    }
+    ASSERT_FALSE(recorder.sharded());
+    ASSERT_EQ(2l, recorder.average());
+    // Fake enough CAS retries to trigger the switch, samples recorded
+    // before and after must both be visible.
+    recorder._int_part._cas_retries.store(
+        bvar::AdaptiveRecorder::MAX_CAS_RETRIES + 1,
+        butil::memory_order_relaxed);
+    recorder << 2;
+    ASSERT_TRUE(recorder.sharded());
+    for (size_t i = 0; i < 99; ++i) {
+        recorder << 2;
+    }
+    bvar::Stat stat = recorder.get_value();
+    ASSERT_EQ(400, stat.sum);
+    ASSERT_EQ(200, stat.num);
+    ASSERT_EQ(2l, recorder.average());
+    stat = recorder.reset();
+    ASSERT_EQ(200, stat.num);
+    ASSERT_EQ(0, recorder.get_value().num);
+}
+
+TEST(RecorderTest, adaptive_recorder_window) {
+    bvar::AdaptiveRecorder c1;
+    ASSERT_TRUE(c1.valid());
+    bvar::Window<bvar::AdaptiveRecorder> w1(&c1, 1);
+    bvar::Window<bvar::AdaptiveRecorder> w2(&c1, 2);
+    const int N = 5000;
+    int64_t last_time = butil::gettimeofday_us();
+    for (int i = 1; i <= N; ++i) {
+        c1 << i;
+        int64_t now = butil::gettimeofday_us();
+        if (now - last_time >= 1000000L) {
+            last_time = now;
+            LOG(INFO) << "c1=" << c1 << " w1=" << w1 << " w2=" << w2;
+        } else {
+            usleep(950);
+        }
+    }
+}
+
+TEST(RecorderTest, latency_recorder_digest) {
+    bvar::LatencyRecorder rec(bvar::PERCENTILE_DIGEST);
+    for (int i = 0; i < 10000; ++i) {
+        rec << (i + 1);
+    }
+    ASSERT_EQ(10000, rec.count());
+    // Wait for the sampler thread to take per-second windows.
+    sleep(2);
+    const int64_t p50 = rec.latency_percentile(0.5);
+    EXPECT_GT(p50, 4800);
+    EXPECT_LT(p50, 5200);
+    const int64_t p999 = rec.latency_percentile(0.999);
+    EXPECT_GT(p999, 9700);
+    EXPECT_LT(p999, 10200);
+    bvar::Vector<int64_t, 4> lp = rec.latency_percentiles();
+    EXPECT_GT(lp[3], 9700);
+    EXPECT_LT(lp[3], 10200);
+}
+
 TEST(RecorderTest, negative) {
     bvar::IntRecorder recorder;
     ASSERT_TRUE(recorder.valid());
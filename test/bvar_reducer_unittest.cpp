@@ -62,6 +62,41 @@ TEST_F(ReducerTest, adder) {
     ASSERT_EQ(-5, reducer3.get_value());
 }
 
+static void* thread_local_adder_counter(void* arg) {
+    bvar::Adder<uint64_t>* adder = (bvar::Adder<uint64_t>*)arg;
+    bvar::ThreadLocalAdder<uint64_t> local_adder(*adder);
+    EXPECT_TRUE(local_adder.valid());
+    for (size_t i = 0; i < 100000; ++i) {
+        local_adder << 2;
+    }
+    return NULL;
+}
+
+TEST_F(ReducerTest, thread_local_adder) {
+    bvar::Adder<uint64_t> adder;
+    ASSERT_TRUE(adder.valid());
+    bvar::ThreadLocalAdder<uint64_t> local_adder(adder);
+    ASSERT_TRUE(local_adder.valid());
+    local_adder << 2 << 4;
+    adder << 1;  // mixing with the slow path is fine
+    ASSERT_EQ(7ul, adder.get_value());
+    ASSERT_EQ(7ul, adder.reset());
+    local_adder << 3;
+    ASSERT_EQ(3ul, adder.get_value());
+    adder.reset();
+
+    const size_t NUM_THREAD = 8;
+    pthread_t threads[NUM_THREAD];
+    for (size_t i = 0; i < NUM_THREAD; ++i) {
+        pthread_create(&threads[i], NULL, &thread_local_adder_counter,
+                       (void*)&adder);
+    }
+    for (size_t i = 0; i < NUM_THREAD; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    ASSERT_EQ(2ul * NUM_THREAD * 100000, adder.get_value());
+}
+
 const size_t OPS_PER_THREAD = 500000;
 
 static void *thread_counter(void *arg) {
@@ -25,6 +25,7 @@
 #include <sstream>
 #include "butil/time.h"
 #include "butil/macros.h"
+#include "butil/iobuf.h"
 
 #include "bvar/bvar.h"
 
@@ -311,6 +312,31 @@ TEST_F(VariableTest, dump) {
     ASSERT_EQ(0UL, d._list.size());
 }
 
+TEST_F(VariableTest, dump_to_iobuf) {
+    butil::IOBuf buf;
+
+    // Nothing to dump yet.
+    ASSERT_EQ(0, bvar::Variable::dump_exposed(&buf, NULL));
+    ASSERT_TRUE(buf.empty());
+
+    bvar::Adder<int> v2("iobuf_var2");
+    v2 << 2;
+    bvar::Status<int> v1("iobuf_var1", 1);
+    bvar::Status<int> v3("foo.bar.Apple", "iobuf_var3", 3);
+
+    ASSERT_EQ(3, bvar::Variable::dump_exposed(&buf, NULL));
+    ASSERT_EQ("foo_bar_apple_iobuf_var3 : 3\n"
+              "iobuf_var1 : 1\n"
+              "iobuf_var2 : 2\n", buf.to_string());
+
+    buf.clear();
+    bvar::DumpOptions opts;
+    opts.white_wildcards = "iobuf_*";
+    opts.black_wildcards = "*var2";
+    ASSERT_EQ(1, bvar::Variable::dump_exposed(&buf, &opts));
+    ASSERT_EQ("iobuf_var1 : 1\n", buf.to_string());
+}
+
 TEST_F(VariableTest, latency_recorder) {
     bvar::LatencyRecorder rec;
     rec << 1 << 2 << 3;
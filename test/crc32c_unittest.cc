@@ -8,7 +8,10 @@
 // found in the LICENSE file. See the AUTHORS file for names of contributors.
 
 #include <gtest/gtest.h>
+#include <algorithm>
+#include <string>
 #include "butil/crc32c.h"
+#include "butil/iobuf.h"
 
 namespace butil {
 namespace crc32c {
@@ -69,6 +72,43 @@ TEST_F(CRC, Mask) {
   ASSERT_EQ(crc, Unmask(Unmask(Mask(Mask(crc)))));
 }
 
+TEST_F(CRC, large_input) {
+  // Large enough to go through the interleaved hardware kernel(3x8K blocks)
+  // at least twice.
+  const size_t N = 3 * 8192 * 2 + 1027;
+  std::string data(N, 0);
+  for (size_t i = 0; i < N; ++i) {
+    data[i] = static_cast<char>(i * 131 + 7);
+  }
+  const uint32_t whole = Value(data.data(), N);
+  // Extending in growing odd-sized chunks must yield the same crc.
+  uint32_t crc = 0;
+  size_t pos = 0;
+  size_t step = 1;
+  while (pos < N) {
+    const size_t len = std::min(step, N - pos);
+    crc = Extend(crc, data.data() + pos, len);
+    pos += len;
+    step = step * 2 + 1;
+  }
+  ASSERT_EQ(whole, crc);
+}
+
+TEST_F(CRC, extend_iobuf) {
+  butil::IOBuf buf;
+  std::string data;
+  for (int i = 0; i < 1000; ++i) {
+    const std::string piece(i * 17 % 2000 + 1, static_cast<char>(i));
+    data.append(piece);
+    buf.append(piece);
+  }
+  ASSERT_LT(1u, buf.backing_block_num());
+  ASSERT_EQ(Value(data.data(), data.size()), Extend(0, buf));
+  const uint32_t init_crc = Value("abc", 3);
+  ASSERT_EQ(Extend(init_crc, data.data(), data.size()),
+            Extend(init_crc, buf));
+}
+
 TEST_F(CRC, fast_is_on) {
   std::cout << "IsFastCrc32Supported=" << IsFastCrc32Supported() << std::endl;
 }
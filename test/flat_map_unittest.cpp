@@ -26,6 +26,7 @@
 #include "butil/logging.h"
 #include "butil/containers/hash_tables.h"
 #include "butil/containers/flat_map.h"
+#include "butil/containers/dense_flat_map.h"
 #include "butil/containers/pooled_map.h"
 #include "butil/containers/case_ignored_flat_map.h"
 
@@ -331,6 +332,39 @@ TEST_F(FlatMapTest, make_sure_all_methods_compile) {
     std::cout << std::endl;
 }
 
+TEST_F(FlatMapTest, operator_sqbr_moves_rvalue_key) {
+    butil::FlatMap<std::string, int> m;
+    ASSERT_EQ(0, m.init(16));
+    std::string key1 = "a_key_long_enough_to_defeat_small_string_optimization";
+    const char* const old_data = key1.data();
+    m[std::move(key1)] = 1;
+    ASSERT_EQ(1u, m.size());
+    bool moved = false;
+    for (butil::FlatMap<std::string, int>::const_iterator
+             it = m.begin(); it != m.end(); ++it) {
+        moved = (it->first.data() == old_data);
+    }
+    ASSERT_TRUE(moved);
+    // rvalue on an existing key does not insert a second item.
+    std::string key2 = "a_key_long_enough_to_defeat_small_string_optimization";
+    m[std::move(key2)] = 2;
+    ASSERT_EQ(1u, m.size());
+    ASSERT_EQ(2, *m.seek("a_key_long_enough_to_defeat_small_string_optimization"));
+    // resizing triggered from the rvalue overload keeps all items.
+    butil::FlatMap<std::string, size_t> m2;
+    ASSERT_EQ(0, m2.init(2, 50));
+    const size_t N = 1000;
+    for (size_t i = 0; i < N; ++i) {
+        m2[butil::string_printf("rvalue_key_%lu", i)] = i;
+    }
+    ASSERT_EQ(N, m2.size());
+    for (size_t i = 0; i < N; ++i) {
+        const size_t* p = m2.seek(butil::string_printf("rvalue_key_%lu", i));
+        ASSERT_TRUE(p != NULL) << "i=" << i;
+        ASSERT_EQ(i, *p);
+    }
+}
+
 TEST_F(FlatMapTest, flat_map_of_string) {
     std::vector<std::string> keys;
     butil::FlatMap<std::string, size_t> m1;
@@ -876,6 +910,40 @@ TEST_F(FlatMapTest, manipulate_uninitialized_map) {
     ASSERT_EQ(0u, m.load_factor());
 }
 
+TEST_F(FlatMapTest, seek_multi) {
+    butil::FlatMap<uint64_t, uint64_t> m;
+    ASSERT_EQ(0, m.init(32));
+    // Uninitialized/empty maps yield all-NULL.
+    uint64_t one_key = 1;
+    uint64_t* one_value = (uint64_t*)0x1;
+    butil::FlatMap<uint64_t, uint64_t> uninit;
+    uninit.seek_multi(&one_key, 1, &one_value);
+    ASSERT_EQ(NULL, one_value);
+
+    const size_t N = 1000;
+    for (size_t i = 0; i < N; i += 2) {  // even keys only
+        m[i] = i * 10;
+    }
+    // More keys than one internal batch, with hits, misses and duplicates.
+    std::vector<uint64_t> keys;
+    for (size_t i = 0; i < N; ++i) {
+        keys.push_back(i);
+        if (i % 100 == 0) {
+            keys.push_back(i);
+        }
+    }
+    std::vector<uint64_t*> values(keys.size(), (uint64_t*)0x1);
+    m.seek_multi(&keys[0], keys.size(), &values[0]);
+    for (size_t i = 0; i < keys.size(); ++i) {
+        ASSERT_EQ(m.seek(keys[i]), values[i]) << "i=" << i;
+        if (keys[i] % 2 == 0) {
+            ASSERT_EQ(keys[i] * 10, *values[i]);
+        } else {
+            ASSERT_EQ(NULL, values[i]);
+        }
+    }
+}
+
 TEST_F(FlatMapTest, perf_small_string_map) {
     butil::Timer tm1;
     butil::Timer tm2;
@@ -1298,4 +1366,108 @@ TEST_F(FlatMapTest, copy) {
     ASSERT_FALSE(m2.is_too_crowded(m1.size()));
 }
 
+TEST_F(FlatMapTest, dense_sanity) {
+    typedef butil::DenseFlatMap<uint64_t, long> Map;
+    Map m;
+    ASSERT_FALSE(m.initialized());
+    ASSERT_EQ(NULL, m.seek(1));
+    ASSERT_EQ(0, m.init(1000, 70));
+    ASSERT_TRUE(m.initialized());
+    ASSERT_EQ(0UL, m.size());
+    ASSERT_TRUE(m.empty());
+    // power-of-2 rounding as FlatMap does by default.
+    ASSERT_EQ(1024UL, m.bucket_count());
+
+    const uint64_t k1 = 1;
+    m[k1] = 10;
+    ASSERT_EQ(1UL, m.size());
+    long* p = m.seek(k1);
+    ASSERT_TRUE(p && *p == 10);
+    // Override
+    ASSERT_TRUE(m.insert(k1, 100));
+    ASSERT_EQ(1UL, m.size());
+    ASSERT_EQ(100, *m.seek(k1));
+
+    // hashed to the same control byte and group of k1.
+    const uint64_t k2 = k1 + (m.bucket_count() << 7);
+    m[k2] = 30;
+    ASSERT_EQ(2UL, m.size());
+    ASSERT_EQ(30, *m.seek(k2));
+    ASSERT_EQ(100, *m.seek(k1));
+    ASSERT_EQ(NULL, m.seek(2049));
+
+    size_t niterated = 0;
+    for (Map::iterator it = m.begin(); it != m.end(); ++it) {
+        ++niterated;
+        ASSERT_EQ(it->first + (it->first == k1 ? 99 : 29),
+                  (uint64_t)it->second);
+    }
+    ASSERT_EQ(2UL, niterated);
+
+    long old = 0;
+    ASSERT_EQ(1UL, m.erase(k1, &old));
+    ASSERT_EQ(100, old);
+    ASSERT_EQ(NULL, m.seek(k1));
+    ASSERT_EQ(30, *m.seek(k2));
+    ASSERT_EQ(0UL, m.erase(k1));
+
+    m.clear();
+    ASSERT_EQ(0UL, m.size());
+    ASSERT_TRUE(m.empty());
+    ASSERT_EQ(NULL, m.seek(k2));
+}
+
+TEST_F(FlatMapTest, dense_random_insert_erase) {
+    srand(0);
+    butil::DenseFlatMap<uint64_t, long> m;
+    std::map<uint64_t, long> ref;
+    // Small initial size to exercise resizing and tombstone reclaiming.
+    ASSERT_EQ(0, m.init(16));
+    for (int i = 0; i < 100000; ++i) {
+        const uint64_t k = rand() % 10000;
+        if (rand() % 3 == 0) {
+            ASSERT_EQ(ref.erase(k), m.erase(k));
+        } else {
+            m[k] = k + i;
+            ref[k] = k + i;
+        }
+    }
+    ASSERT_EQ(ref.size(), m.size());
+    for (std::map<uint64_t, long>::iterator it = ref.begin();
+         it != ref.end(); ++it) {
+        long* p = m.seek(it->first);
+        ASSERT_TRUE(p != NULL);
+        ASSERT_EQ(it->second, *p);
+    }
+    size_t niterated = 0;
+    for (butil::DenseFlatMap<uint64_t, long>::const_iterator it = m.begin();
+         it != m.end(); ++it) {
+        ASSERT_EQ(ref[it->first], it->second);
+        ++niterated;
+    }
+    ASSERT_EQ(ref.size(), niterated);
+}
+
+TEST_F(FlatMapTest, dense_flat_map_of_string) {
+    butil::DenseFlatMap<std::string, size_t> m;
+    ASSERT_EQ(0, m.init(32));
+    m["hello"] = 1;
+    m["world"] = 2;
+    ASSERT_TRUE(m.seek("hello") && *m.seek("hello") == 1);
+    ASSERT_TRUE(m.seek(butil::StringPiece("world")) &&
+                *m.seek(butil::StringPiece("world")) == 2);
+    butil::DenseFlatMap<std::string, size_t> m2 = m;
+    ASSERT_EQ(2UL, m2.size());
+    ASSERT_EQ(1UL, m2.erase("hello"));
+    ASSERT_EQ(1UL, m2.size());
+    ASSERT_EQ(2UL, m.size());
+    butil::DenseFlatSet<std::string> s;
+    ASSERT_EQ(0, s.init(32));
+    ASSERT_TRUE(s.insert("foo"));
+    ASSERT_TRUE(s.seek("foo"));
+    ASSERT_FALSE(s.seek("bar"));
+    ASSERT_EQ(1UL, s.erase("foo"));
+    ASSERT_FALSE(s.seek("foo"));
+}
+
 }
@@ -25,11 +25,18 @@
 #include <butil/macros.h>
 #include <butil/time.h>                 // Timer
 #include <butil/fd_utility.h>           // make_non_blocking
+#include <butil/crc32c.h>               // crc32c::Value
 #include <butil/iobuf.h>
 #include <butil/logging.h>
 #include <butil/fd_guard.h>
 #include <butil/errno.h>
 #include <butil/fast_rand.h>
+#include <butil/memory_sampler.h>       // ListMemorySamples
+#include <gflags/gflags.h>
+
+namespace butil {
+DECLARE_int32(memory_sample_interval);
+}
 #if BAZEL_TEST
 #include "test/iobuf.pb.h"
 #else
@@ -48,6 +55,7 @@ extern int get_tls_block_count();
 extern void remove_tls_block_chain();
 extern IOBuf::Block* acquire_tls_block();
 extern void release_tls_block_chain(IOBuf::Block* b);
+extern void drain_block_pools();
 extern uint32_t block_cap(IOBuf::Block const* b);
 extern uint32_t block_size(IOBuf::Block const* b);
 extern IOBuf::Block* get_portal_next(IOBuf::Block const* b);
@@ -88,6 +96,9 @@ inline bool is_debug_allocator_enabled() {
 void install_debug_allocator() {
     if (!is_debug_allocator_enabled()) {
         butil::iobuf::remove_tls_block_chain();
+        // Free blocks pooled before the switch, they are unknown to the
+        // debug allocator.
+        butil::iobuf::drain_block_pools();
         s_set.init(1024);
         butil::iobuf::blockmem_allocate = debug_block_allocate;
         butil::iobuf::blockmem_deallocate = debug_block_deallocate;
@@ -107,6 +118,8 @@ void show_prof_and_rm(const char* bin_name, const char* filename, size_t topn) {
 
 static void check_memory_leak() {
     if (is_debug_allocator_enabled()) {
+        // Blocks sitting in the global pools are not leaks.
+        butil::iobuf::drain_block_pools();
         butil::IOBuf::Block* p = butil::iobuf::get_tls_block_head();
         size_t n = 0;
         while (p) {
@@ -292,6 +305,23 @@ TEST_F(IOBufTest, appendv) {
     ASSERT_EQ(0, b.appendv(vec2, arraysize(vec2)));
     ASSERT_EQ(full_len, b.size());
     ASSERT_EQ(0, memcmp(str, b.to_string().data(), full_len));
+
+    // The fused variant appends the same bytes and computes the same
+    // checksum as a separate pass.
+    b.clear();
+    uint32_t crc = 0;
+    ASSERT_EQ(0, b.appendv(vec2, arraysize(vec2), &crc));
+    ASSERT_EQ(full_len, b.size());
+    ASSERT_EQ(0, memcmp(str, b.to_string().data(), full_len));
+    ASSERT_EQ(butil::crc32c::Value(str, full_len), crc);
+
+    // Extends the initial value, usable for streams.
+    uint32_t crc2 = butil::crc32c::Value(str, len1);
+    butil::IOBuf b2;
+    const_iovec rest[] = {{str + len1, len2}, {str + len1 + len2, len3}};
+    ASSERT_EQ(0, b2.appendv(rest, arraysize(rest), &crc2));
+    ASSERT_EQ(crc, crc2);
+    free(str);
 }
 
 TEST_F(IOBufTest, reserve) {
@@ -1475,6 +1505,26 @@ TEST_F(IOBufTest, appender) {
     ASSERT_EQ(str, buf3);
 }
 
+TEST_F(IOBufTest, appender_reserve) {
+    butil::IOBufAppender appender;
+    ASSERT_EQ(butil::IOBuf::INVALID_AREA, appender.reserve(0));
+    // Typical protocol-writer pattern: magic first, then a length patched
+    // after the body is written.
+    ASSERT_EQ(0, appender.append("PRPC", 4));
+    const butil::IOBuf::Area area = appender.reserve(8);
+    ASSERT_NE(butil::IOBuf::INVALID_AREA, area);
+    ASSERT_EQ(0, appender.append("hello world", 11));
+    char patched[8];
+    memset(patched, 'x', sizeof(patched));
+    ASSERT_EQ(0, appender.unsafe_assign(area, patched));
+    butil::IOBuf buf;
+    appender.move_to(buf);
+    ASSERT_EQ("PRPCxxxxxxxxhello world", buf.to_string());
+    // header, reserved bytes and body continue the same block: one
+    // contiguous ref, which is the point of reserving over prepending.
+    ASSERT_EQ(1u, buf.backing_block_num());
+}
+
 TEST_F(IOBufTest, appender_perf) {
     const size_t N1 = 100000;
     butil::Timer tm1;
@@ -1656,6 +1706,41 @@ TEST_F(IOBufTest, append_user_data_and_share) {
     ASSERT_EQ(data, my_free_params);
 }
 
+TEST_F(IOBufTest, append_file_region_and_cut_into_fd) {
+    std::string filedata;
+    for (int i = 0; i < 10000; ++i) {
+        filedata.push_back((char)(i * 31 + 1));
+    }
+    butil::TempFile tmpfile;
+    ASSERT_EQ(0, tmpfile.save_bin(filedata.data(), filedata.size()));
+    const int file_fd = open(tmpfile.fname(), O_RDONLY);
+    ASSERT_GE(file_fd, 0);
+
+    butil::IOBuf b1;
+    b1.append("header");
+    // b1 owns file_fd from now on.
+    ASSERT_EQ(0, b1.append_file_region(file_fd, 100, 5000));
+    b1.append("trailer");
+    std::string ref = "header" + filedata.substr(100, 5000) + "trailer";
+    ASSERT_EQ(ref.size(), b1.size());
+
+    int fds[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    butil::make_non_blocking(fds[0]);
+    butil::make_non_blocking(fds[1]);
+
+    butil::IOPortal b2;
+    while (!b1.empty() || b2.length() != ref.length()) {
+        errno = 0;
+        b1.cut_into_file_descriptor(fds[1]);
+        b2.append_from_file_descriptor(fds[0], LONG_MAX);
+    }
+    ASSERT_EQ(ref, to_str(b2));
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
 TEST_F(IOBufTest, acquire_tls_block) {
     butil::iobuf::remove_tls_block_chain();
     butil::IOBuf::Block* b = butil::iobuf::acquire_tls_block();
@@ -1680,4 +1765,241 @@ TEST_F(IOBufTest, acquire_tls_block) {
     ASSERT_NE(butil::iobuf::block_cap(b), butil::iobuf::block_size(b));
 }
 
+TEST_F(IOBufTest, tls_block_cache_adapts_upwards) {
+    install_debug_allocator();
+    butil::iobuf::remove_tls_block_chain();
+    // Two portals prepare blocks for reading simultaneously: returning the
+    // second chain overflows the initial limit(8) of the cache and is
+    // counted, raising the adaptive limit at the next adaption until both
+    // chains fit.
+    bool grown = false;
+    for (int round = 0; round < 200 && !grown; ++round) {
+        int fds[2];
+        ASSERT_EQ(0, pipe(fds));
+        butil::IOPortal p1;
+        butil::IOPortal p2;
+        ASSERT_EQ(1L, (long)write(fds[1], "x", 1));
+        ASSERT_EQ(1L, (long)p1.append_from_file_descriptor(fds[0], 60000));
+        ASSERT_EQ(1L, (long)write(fds[1], "y", 1));
+        ASSERT_EQ(1L, (long)p2.append_from_file_descriptor(fds[0], 60000));
+        ASSERT_EQ(0, close(fds[0]));
+        ASSERT_EQ(0, close(fds[1]));
+        p1.clear();
+        p2.clear();
+        grown = (butil::iobuf::get_tls_block_count() >= 12);
+    }
+    ASSERT_TRUE(grown);
+}
+
+TEST_F(IOBufTest, reclaim_idle_tls_block_caches) {
+    install_debug_allocator();
+    butil::iobuf::remove_tls_block_chain();
+    // Cache a handful of blocks.
+    int fds[2];
+    ASSERT_EQ(0, pipe(fds));
+    ASSERT_EQ(1L, (long)write(fds[1], "x", 1));
+    {
+        butil::IOPortal p;
+        ASSERT_EQ(1L, (long)p.append_from_file_descriptor(fds[0], 60000));
+    }
+    ASSERT_EQ(0, close(fds[0]));
+    ASSERT_EQ(0, close(fds[1]));
+    const int ncached = butil::iobuf::get_tls_block_count();
+    ASSERT_GE(ncached, 2);
+    // The first scan only snapshots activity, nothing is taken.
+    butil::IOBuf::reclaim_idle_tls_block_caches(0);
+    ASSERT_EQ(ncached, butil::iobuf::get_tls_block_count());
+    // No operation since the last scan: everything but the head block
+    // (which share_tls_block() may have handed out) is reclaimed.
+    const size_t reclaimed_before = butil::IOBuf::tls_block_reclaimed_count();
+    butil::IOBuf::reclaim_idle_tls_block_caches(0);
+    ASSERT_EQ(1, butil::iobuf::get_tls_block_count());
+    ASSERT_GE(butil::IOBuf::tls_block_reclaimed_count(),
+              reclaimed_before + ncached - 1);
+    // A thread active since the last scan is left alone.
+    butil::IOBuf::Block* const b = butil::iobuf::acquire_tls_block();
+    ASSERT_TRUE(b != NULL);
+    butil::iobuf::release_tls_block_chain(b);
+    butil::IOBuf::reclaim_idle_tls_block_caches(0);
+    ASSERT_EQ(1, butil::iobuf::get_tls_block_count());
+    // Nothing is taken while the total is under the limit.
+    butil::IOBuf::reclaim_idle_tls_block_caches((size_t)-1);
+    butil::IOBuf::reclaim_idle_tls_block_caches((size_t)-1);
+    ASSERT_EQ(1, butil::iobuf::get_tls_block_count());
+}
+
+TEST_F(IOBufTest, large_reads_use_large_blocks) {
+    const size_t DATA_SIZE = 300000;
+    std::string data(DATA_SIZE, 'x');
+    butil::TempFile tmpfile;
+    ASSERT_EQ(0, tmpfile.save_bin(data.data(), data.size()));
+    const int fd = open(tmpfile.fname(), O_RDONLY);
+    ASSERT_GE(fd, 0);
+
+    butil::IOPortal p;
+    size_t total = 0;
+    ssize_t nr = 0;
+    // A bounded max_count hints the real size: blocks should come from
+    // the larger size classes instead of ~37 default 8K blocks.
+    while ((nr = p.pappend_from_file_descriptor(
+                fd, total, DATA_SIZE - total)) > 0) {
+        total += nr;
+    }
+    close(fd);
+    ASSERT_EQ(DATA_SIZE, total);
+    ASSERT_EQ(data, to_str(p));
+    ASSERT_LE(p.backing_block_num(), 8u);
+}
+
+TEST_F(IOBufTest, pappend_aligned_from_file_descriptor) {
+    // 3 full 4K pages plus a partial tail.
+    const size_t DATA_SIZE = 3 * 4096 + 1234;
+    std::string data;
+    data.reserve(DATA_SIZE);
+    for (size_t i = 0; i < DATA_SIZE; ++i) {
+        data.push_back((char)((i * 131 + 7) & 0xFF));
+    }
+    butil::TempFile tmpfile;
+    ASSERT_EQ(0, tmpfile.save_bin(data.data(), data.size()));
+    // O_DIRECT may be unsupported by the filesystem running the test,
+    // alignment of the blocks does not depend on it.
+    int fd = open(tmpfile.fname(), O_RDONLY | O_DIRECT);
+    if (fd < 0) {
+        fd = open(tmpfile.fname(), O_RDONLY);
+    }
+    ASSERT_GE(fd, 0);
+
+    butil::IOBuf buf;
+    ASSERT_EQ((ssize_t)DATA_SIZE,
+              buf.pappend_aligned_from_file_descriptor(fd, 0, DATA_SIZE));
+    ASSERT_EQ(data, to_str(buf));
+    // Data of every block is 4K-aligned.
+    for (size_t i = 0; i < buf.backing_block_num(); ++i) {
+        ASSERT_EQ(0u, (uintptr_t)buf.backing_block(i).data() % 4096);
+    }
+    // EOF at an aligned offset past the file end.
+    const off_t eof_off = (DATA_SIZE + 4095) & ~(size_t)4095;
+    ASSERT_EQ(0, buf.pappend_aligned_from_file_descriptor(fd, eof_off, 4096));
+    ASSERT_EQ(-1, buf.pappend_aligned_from_file_descriptor(-1, 0, 4096));
+
+    // Reading a bounded range appends exactly that range.
+    butil::IOBuf part;
+    ASSERT_EQ(4096, part.pappend_aligned_from_file_descriptor(fd, 4096, 4096));
+    ASSERT_EQ(data.substr(4096, 4096), to_str(part));
+    close(fd);
+}
+
+TEST_F(IOBufTest, cutter_cutn_batch) {
+    // 60 does not divide the 8K block size so that some records straddle
+    // block boundaries.
+    const size_t RECORD_SIZE = 60;
+    const size_t NRECORD = 10000;
+    std::string data;
+    data.reserve(RECORD_SIZE * NRECORD);
+    for (size_t i = 0; i < NRECORD; ++i) {
+        char rec[RECORD_SIZE];
+        for (size_t j = 0; j < RECORD_SIZE; ++j) {
+            rec[j] = (char)((i * 131 + j) & 0xFF);
+        }
+        data.append(rec, sizeof(rec));
+    }
+    butil::IOBuf buf;
+    buf.append(data);
+
+    std::string cut;
+    cut.reserve(data.size());
+    butil::IOBufCutter cutter(&buf);
+    char records[37 * RECORD_SIZE];
+    size_t n = 0;
+    size_t total = 0;
+    while ((n = cutter.cutn_batch(records, RECORD_SIZE, 37)) > 0) {
+        cut.append(records, n * RECORD_SIZE);
+        total += n;
+    }
+    ASSERT_EQ(NRECORD, total);
+    ASSERT_EQ(data, cut);
+    // A trailing partial record is never cut.
+    buf.append(data.data(), RECORD_SIZE - 1);
+    ASSERT_EQ(0u, cutter.cutn_batch(records, RECORD_SIZE, 1));
+    ASSERT_EQ(RECORD_SIZE - 1, cutter.remaining_bytes());
+}
+
+TEST_F(IOBufTest, cutter_fetch_batch) {
+    const size_t RECORD_SIZE = 60;
+    const size_t NRECORD = 10000;
+    std::string data;
+    data.reserve(RECORD_SIZE * NRECORD);
+    for (size_t i = 0; i < NRECORD; ++i) {
+        char rec[RECORD_SIZE];
+        for (size_t j = 0; j < RECORD_SIZE; ++j) {
+            rec[j] = (char)((i * 37 + j) & 0xFF);
+        }
+        data.append(rec, sizeof(rec));
+    }
+    butil::IOBuf buf;
+    buf.append(data);
+
+    std::string read;
+    read.reserve(data.size());
+    butil::IOBufCutter cutter(&buf);
+    size_t total = 0;
+    char straddled[RECORD_SIZE];
+    while (total < NRECORD) {
+        const void* span = NULL;
+        const size_t n = cutter.fetch_batch(&span, RECORD_SIZE, NRECORD);
+        if (n > 0) {
+            // Zero-copy span of whole records inside one block.
+            read.append((const char*)span, n * RECORD_SIZE);
+            ASSERT_EQ(n * RECORD_SIZE,
+                      cutter.pop_front(n * RECORD_SIZE));
+            total += n;
+        } else {
+            // The next record straddles blocks.
+            ASSERT_EQ(RECORD_SIZE, cutter.cutn(straddled, RECORD_SIZE));
+            read.append(straddled, RECORD_SIZE);
+            ++total;
+        }
+    }
+    ASSERT_EQ(data, read);
+    const void* span = NULL;
+    ASSERT_EQ(0u, cutter.fetch_batch(&span, RECORD_SIZE, 1));
+}
+
+TEST_F(IOBufTest, memory_sampling) {
+    std::vector<butil::MemorySample> samples;
+    butil::ListMemorySamples(&samples);
+    const size_t nsample_before = samples.size();
+    butil::FLAGS_memory_sample_interval = 1;
+    {
+        // Keep enough blocks alive simultaneously to exhaust cached
+        // blocks and force fresh allocations.
+        std::vector<butil::IOBuf> bufs(16);
+        const std::string data(butil::IOBuf::DEFAULT_BLOCK_SIZE * 4, 'x');
+        for (size_t i = 0; i < bufs.size(); ++i) {
+            bufs[i].append(data);
+        }
+    }
+    butil::FLAGS_memory_sample_interval = 0;
+    butil::ListMemorySamples(&samples);
+    ASSERT_LT(nsample_before, samples.size());
+    bool seen_iobuf_block = false;
+    for (size_t i = 0; i < samples.size(); ++i) {
+        if (strcmp(samples[i].source, "iobuf_block") == 0) {
+            seen_iobuf_block = true;
+            ASSERT_LT(0u, samples[i].bytes);
+        }
+    }
+    ASSERT_TRUE(seen_iobuf_block);
+    std::ostringstream os;
+    butil::DescribeMemorySamples(os);
+    ASSERT_NE(std::string::npos, os.str().find("source=iobuf_block"));
+    // Disabled sampling records nothing.
+    butil::ListMemorySamples(&samples);
+    const size_t nsample_disabled = samples.size();
+    butil::IOBuf buf2;
+    buf2.append(std::string(butil::IOBuf::DEFAULT_BLOCK_SIZE * 2, 'y'));
+    butil::ListMemorySamples(&samples);
+    ASSERT_EQ(nsample_disabled, samples.size());
+}
+
 } // namespace
@@ -3,6 +3,7 @@
 // found in the LICENSE file.
 
 #include "butil/basictypes.h"
+#include "butil/file_util.h"
 #include "butil/logging.h"
 
 #include <gtest/gtest.h>
@@ -399,6 +400,57 @@ TEST_F(LoggingTest, as_ostream) {
     LOG(WARNING) << 1.123456789;
 }
 
+TEST_F(LoggingTest, async_log_sink) {
+    char tmpl[] = "/tmp/async_log_sink.XXXXXX";
+    const int fd = mkstemp(tmpl);
+    ASSERT_GE(fd, 0);
+    {
+        ::logging::AsyncLogSink sink(fd);
+        ::logging::LogSink* old_sink = ::logging::SetLogSink(&sink);
+        for (int i = 0; i < 100; ++i) {
+            LOG(WARNING) << "async_line_" << i;
+        }
+        ::logging::SetLogSink(old_sink);
+        // dtor joins the flush thread after writing everything out.
+    }
+    std::string content;
+    ASSERT_TRUE(butil::ReadFileToString(butil::FilePath(tmpl), &content));
+    // All lines present and in order.
+    size_t pos = 0;
+    for (int i = 0; i < 100; ++i) {
+        char expected[32];
+        snprintf(expected, sizeof(expected), "async_line_%d\n", i);
+        const size_t found = content.find(expected, pos);
+        ASSERT_NE(std::string::npos, found) << "i=" << i;
+        pos = found + 1;
+    }
+    close(fd);
+    unlink(tmpl);
+}
+
+TEST_F(LoggingTest, async_log_sink_drops_on_overflow) {
+    char tmpl[] = "/tmp/async_log_sink.XXXXXX";
+    const int fd = mkstemp(tmpl);
+    ASSERT_GE(fd, 0);
+    size_t ndropped = 0;
+    {
+        // A queue this small surely overflows before the 10ms flush.
+        ::logging::AsyncLogSink sink(fd, 64);
+        ::logging::LogSink* old_sink = ::logging::SetLogSink(&sink);
+        for (int i = 0; i < 10000; ++i) {
+            LOG(WARNING) << "flooding_line_" << i;
+        }
+        ::logging::SetLogSink(old_sink);
+        ndropped = sink.ndropped();
+    }
+    ASSERT_GT(ndropped, 0ul);
+    std::string content;
+    ASSERT_TRUE(butil::ReadFileToString(butil::FilePath(tmpl), &content));
+    ASSERT_NE(std::string::npos, content.find("dropped"));
+    close(fd);
+    unlink(tmpl);
+}
+
 TEST_F(LoggingTest, limited_logging) {
     for (int i = 0; i < 100000; ++i) {
         LOG_ONCE(INFO) << "HEHE1";
@@ -0,0 +1,76 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <gtest/gtest.h>
+#include <stdlib.h>
+#include <string>
+#include "butil/simd_hash.h"
+#include "butil/third_party/murmurhash3/murmurhash3.h"
+
+namespace {
+
+static uint32_t ReferenceMurmur(const butil::StringPiece& key,
+                                uint32_t seed) {
+    uint32_t h = 0;
+    butil::MurmurHash3_x86_32(key.data(), (int)key.size(), seed, &h);
+    return h;
+}
+
+TEST(SimdHashTest, murmur_x4_matches_scalar) {
+    srand(0);
+    for (int round = 0; round < 200; ++round) {
+        std::string storage[4];
+        butil::StringPiece keys[4];
+        for (int i = 0; i < 4; ++i) {
+            // Cover empty keys, sub-block keys and unequal lengths.
+            const size_t len = rand() % 64;
+            storage[i].resize(len);
+            for (size_t j = 0; j < len; ++j) {
+                storage[i][j] = (char)rand();
+            }
+            keys[i] = storage[i];
+        }
+        const uint32_t seed = (uint32_t)rand();
+        uint32_t batched[4];
+        butil::simd::MurmurHash3_x86_32_x4(keys, seed, batched);
+        for (int i = 0; i < 4; ++i) {
+            ASSERT_EQ(ReferenceMurmur(keys[i], seed), batched[i])
+                << "round=" << round << " lane=" << i
+                << " len=" << keys[i].size();
+        }
+    }
+}
+
+TEST(SimdHashTest, murmur_x4_vnode_style_keys) {
+    // The shape used by chash ring builds: same host, varying suffix.
+    for (int base = 0; base < 100; base += 4) {
+        char bufs[4][32];
+        butil::StringPiece keys[4];
+        for (int i = 0; i < 4; ++i) {
+            const int len = snprintf(bufs[i], sizeof(bufs[i]),
+                                     "10.20.30.40:8080-%d", base + i);
+            keys[i] = butil::StringPiece(bufs[i], len);
+        }
+        uint32_t batched[4];
+        butil::simd::MurmurHash3_x86_32_x4(keys, 0, batched);
+        for (int i = 0; i < 4; ++i) {
+            ASSERT_EQ(ReferenceMurmur(keys[i], 0), batched[i]) << keys[i];
+        }
+    }
+}
+
+} // namespace
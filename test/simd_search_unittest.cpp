@@ -0,0 +1,149 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <gtest/gtest.h>
+#include <string>
+#include "butil/simd_search.h"
+#include "butil/fast_rand.h"
+#include "butil/iobuf.h"
+
+namespace {
+
+// Byte-wise reference of memchr2.
+static const char* naive_memchr2(const char* s, size_t n, char c1, char c2) {
+    for (size_t i = 0; i + 2 <= n; ++i) {
+        if (s[i] == c1 && s[i + 1] == c2) {
+            return s + i;
+        }
+    }
+    return NULL;
+}
+
+TEST(SimdSearchTest, memchr2_basic) {
+    const std::string s = "GET / HTTP/1.1\r\nHost: example.org\r\n\r\n";
+    ASSERT_EQ(s.data() + 14,
+              butil::simd::memchr2(s.data(), s.size(), '\r', '\n'));
+    ASSERT_EQ(NULL, butil::simd::memchr2(s.data(), s.size(), '\r', 'X'));
+    ASSERT_EQ(NULL, butil::simd::memchr2(s.data(), 1, '\r', '\n'));
+    ASSERT_EQ(NULL, butil::simd::memchr2(s.data(), 0, '\r', '\n'));
+    // The trailing byte alone does not form a pair.
+    ASSERT_EQ(NULL, butil::simd::memchr2("ab\r", 3, '\r', '\n'));
+    // Overlapping pairs, the first one wins.
+    ASSERT_EQ(0, butil::simd::memchr2("aaab", 4, 'a', 'a') - "aaab" + 0);
+}
+
+TEST(SimdSearchTest, memchr2_positions_around_vector_width) {
+    // Exercise every alignment of the match relative to 16-byte steps.
+    for (size_t pos = 0; pos < 70; ++pos) {
+        std::string s(72, 'x');
+        s[pos] = '\r';
+        s[pos + 1] = '\n';
+        ASSERT_EQ(s.data() + pos,
+                  butil::simd::memchr2(s.data(), s.size(), '\r', '\n'))
+            << "pos=" << pos;
+    }
+}
+
+TEST(SimdSearchTest, memchr2_matches_naive_on_random_data) {
+    for (int round = 0; round < 200; ++round) {
+        std::string s;
+        const size_t n = butil::fast_rand_less_than(100);
+        for (size_t i = 0; i < n; ++i) {
+            // Small alphabet makes pairs frequent.
+            s.push_back('a' + (char)butil::fast_rand_less_than(3));
+        }
+        ASSERT_EQ(naive_memchr2(s.data(), s.size(), 'a', 'b'),
+                  butil::simd::memchr2(s.data(), s.size(), 'a', 'b'));
+    }
+}
+
+TEST(SimdSearchTest, memmem_basic) {
+    const std::string s = "--boundary\r\ndata--boundary--\r\n";
+    ASSERT_EQ(s.data(),
+              butil::simd::memmem(s.data(), s.size(), "--boundary", 10));
+    ASSERT_EQ(s.data() + 16,
+              butil::simd::memmem(s.data(), s.size(), "--boundary--", 12));
+    ASSERT_EQ(NULL,
+              butil::simd::memmem(s.data(), s.size(), "--missing", 9));
+    // Empty needle matches at the front.
+    ASSERT_EQ(s.data(), butil::simd::memmem(s.data(), s.size(), "", 0));
+    // Needle longer than haystack.
+    ASSERT_EQ(NULL, butil::simd::memmem("ab", 2, "abc", 3));
+    // Single-byte needle degrades to memchr.
+    ASSERT_EQ(s.data() + 10, butil::simd::memmem(s.data(), s.size(), "\r", 1));
+}
+
+TEST(SimdSearchTest, memmem_false_candidates) {
+    // First and last byte match at many positions, the middle does not.
+    std::string s;
+    for (int i = 0; i < 50; ++i) {
+        s += "aXa";
+    }
+    s += "aYa";
+    ASSERT_EQ(s.data() + 150, butil::simd::memmem(s.data(), s.size(),
+                                                  "aYa", 3));
+}
+
+TEST(SimdSearchTest, memmem_matches_naive_on_random_data) {
+    for (int round = 0; round < 200; ++round) {
+        std::string hay;
+        const size_t n = butil::fast_rand_less_than(200);
+        for (size_t i = 0; i < n; ++i) {
+            hay.push_back('a' + (char)butil::fast_rand_less_than(4));
+        }
+        std::string needle;
+        const size_t m = 1 + butil::fast_rand_less_than(6);
+        for (size_t i = 0; i < m; ++i) {
+            needle.push_back('a' + (char)butil::fast_rand_less_than(4));
+        }
+        const size_t expected = hay.find(needle);
+        const void* p = butil::simd::memmem(hay.data(), hay.size(),
+                                            needle.data(), needle.size());
+        if (expected == std::string::npos) {
+            ASSERT_EQ(NULL, p) << "hay=" << hay << " needle=" << needle;
+        } else {
+            ASSERT_EQ(hay.data() + expected, p)
+                << "hay=" << hay << " needle=" << needle;
+        }
+    }
+}
+
+TEST(SimdSearchTest, cut_until_delim_straddling_blocks) {
+    // Place the delimiter at every offset around the block capacity of
+    // IOBuf (8K minus the block header) so that some of the runs have it
+    // starting in one block and ending in the next.
+    const std::string DELIM = "--boundary--";
+    for (size_t pos = 8100; pos <= 8200; ++pos) {
+        std::string payload(pos, 'x');
+        payload += DELIM;
+        payload += "tail";
+        butil::IOBuf buf;
+        buf.append(payload);
+        butil::IOBuf before;
+        ASSERT_EQ(0, buf.cut_until(&before, DELIM)) << "pos=" << pos;
+        ASSERT_EQ(pos, before.size()) << "pos=" << pos;
+        ASSERT_EQ("tail", buf.to_string()) << "pos=" << pos;
+    }
+    // Absent delimiter leaves the buffer untouched.
+    butil::IOBuf buf;
+    buf.append(std::string(20000, 'x'));
+    butil::IOBuf before;
+    ASSERT_EQ(-1, buf.cut_until(&before, DELIM));
+    ASSERT_EQ(20000UL, buf.size());
+}
+
+} // namespace
@@ -16,11 +16,13 @@
 // under the License.
 
 
+#include <algorithm>
 #include <gflags/gflags.h>
 #include <butil/logging.h>
 #include <butil/time.h>
 #include <butil/macros.h>
 #include <butil/file_util.h>
+#include <butil/files/file_enumerator.h>
 #include <bvar/bvar.h>
 #include <bthread/bthread.h>
 #include <brpc/channel.h>
@@ -41,6 +43,10 @@ DEFINE_string(load_balancer, "", "The algorithm for load balancing");
 DEFINE_int32(timeout_ms, 100, "RPC timeout in milliseconds");
 DEFINE_int32(max_retry, 3, "Maximum retry times");
 DEFINE_int32(dummy_port, 8899, "Port of dummy server(to monitor replaying)");
+DEFINE_bool(use_mmap, true, "mmap() dumped files and access samples through "
+            "their offset indexes(written with -rpc_dump_write_index) so "
+            "that each thread only parses its own samples. Fall back to "
+            "sequential reading when any file has no index");
 
 bvar::LatencyRecorder g_latency_recorder("rpc_replay");
 bvar::Adder<int64_t> g_error_count("rpc_replay_error_count");
@@ -126,6 +132,119 @@ static void handle_response(brpc::Controller* cntl, int64_t start_time,
 
 butil::atomic<int> g_thread_offset(0);
 
+// mmap-ed readers over all dumped files, giving random access to samples
+// by a global index.
+class IndexedDump {
+public:
+    IndexedDump() : _total(0) {}
+
+    ~IndexedDump() {
+        for (size_t i = 0; i < _readers.size(); ++i) {
+            delete _readers[i];
+        }
+        _readers.clear();
+    }
+
+    // Map all files under `dir'. Returns false when the dir is empty or
+    // any file has no index.
+    bool Init(const std::string& dir) {
+        butil::FileEnumerator enumer(butil::FilePath(dir), false,
+                                     butil::FileEnumerator::FILES);
+        for (butil::FilePath name = enumer.Next(); !name.empty();
+             name = enumer.Next()) {
+            std::unique_ptr<brpc::IndexedSampleReader> reader(
+                new brpc::IndexedSampleReader);
+            if (reader->Open(name.value()) != 0) {
+                return false;
+            }
+            _begins.push_back(_total);
+            _total += reader->count();
+            _readers.push_back(reader.release());
+        }
+        return _total != 0;
+    }
+
+    // Total number of samples in all files.
+    size_t total() const { return _total; }
+
+    // Parse the idx-th sample among all files, zero-copy from the mapping.
+    // Returns the sample which should be deleted by caller.
+    brpc::SampledRequest* Get(size_t idx) const {
+        if (idx >= _total) {
+            return NULL;
+        }
+        const size_t i = std::upper_bound(_begins.begin(), _begins.end(), idx)
+            - _begins.begin() - 1;
+        return _readers[i]->Get(idx - _begins[i]);
+    }
+
+private:
+    std::vector<brpc::IndexedSampleReader*> _readers;
+    std::vector<size_t> _begins;  // begin index of each reader
+    size_t _total;
+};
+
+// Never deleted: requests of in-flight RPCs may still reference the
+// mappings when replaying threads quit.
+static IndexedDump* g_indexed_dump = NULL;
+
+// Send one sample and wait if running faster than the expected rate.
+// Ownership of `sample' is taken.
+static void replay_one_sample(ChannelGroup* chan_group,
+                              brpc::SampledRequest* sample,
+                              brpc::SerializedRequest* req,
+                              std::deque<int64_t>* timeq,
+                              size_t max_queue_size,
+                              double req_rate) {
+    std::unique_ptr<brpc::SampledRequest> sample_guard(sample);
+    brpc::Channel* chan = chan_group->channel(sample->meta.protocol_type());
+    if (chan == NULL) {
+        LOG(ERROR) << "No channel on protocol="
+                   << sample->meta.protocol_type();
+        return;
+    }
+
+    brpc::Controller* cntl = new brpc::Controller;
+    req->Clear();
+
+    cntl->reset_sampled_request(sample_guard.release());
+    if (sample->meta.attachment_size() > 0) {
+        sample->request.cutn(
+            &req->serialized_data(),
+            sample->request.size() - sample->meta.attachment_size());
+        cntl->request_attachment() = sample->request.movable();
+    } else {
+        req->serialized_data() = sample->request.movable();
+    }
+    g_sent_count << 1;
+    const int64_t start_time = butil::gettimeofday_us();
+    if (FLAGS_qps <= 0) {
+        chan->CallMethod(NULL/*use rpc_dump_context in cntl instead*/,
+                cntl, req, NULL/*ignore response*/, NULL);
+        handle_response(cntl, start_time, true);
+    } else {
+        google::protobuf::Closure* done =
+            brpc::NewCallback(handle_response, cntl, start_time, false);
+        chan->CallMethod(NULL/*use rpc_dump_context in cntl instead*/,
+                cntl, req, NULL/*ignore response*/, done);
+        const int64_t end_time = butil::gettimeofday_us();
+        int64_t expected_elp = 0;
+        int64_t actual_elp = 0;
+        timeq->push_back(end_time);
+        if (timeq->size() > max_queue_size) {
+            actual_elp = end_time - timeq->front();
+            timeq->pop_front();
+            expected_elp = (size_t)(1000000 * timeq->size() / req_rate);
+        } else {
+            actual_elp = end_time - timeq->front();
+            expected_elp = (size_t)(1000000 * (timeq->size() - 1) / req_rate);
+        }
+        if (actual_elp < expected_elp) {
+            bthread_usleep(expected_elp - actual_elp);
+        }
+    }
+}
+
 static void* replay_thread(void* arg) {
     ChannelGroup* chan_group = static_cast<ChannelGroup*>(arg);
     const int thread_offset = g_thread_offset.fetch_add(1, butil::memory_order_relaxed);
@@ -140,6 +259,21 @@ static void* replay_thread(void* arg) {
     }
     timeq.push_back(butil::gettimeofday_us());
     for (int i = 0; !brpc::IsAskedToQuit() && i < FLAGS_times; ++i) {
+        if (g_indexed_dump != NULL) {
+            // Jump directly to this thread's samples through the indexes
+            // instead of scanning and parsing the whole dump.
+            for (size_t j = thread_offset;
+                 !brpc::IsAskedToQuit() && j < g_indexed_dump->total();
+                 j += FLAGS_thread_num) {
+                brpc::SampledRequest* sample = g_indexed_dump->Get(j);
+                if (sample == NULL) {
+                    continue;
+                }
+                replay_one_sample(chan_group, sample, &req, &timeq,
+                                  MAX_QUEUE_SIZE, req_rate);
+            }
+            continue;
+        }
         brpc::SampleIterator it(FLAGS_dir);
         int j = 0;
         for (brpc::SampledRequest* sample = it.Next();
@@ -148,53 +282,8 @@ static void* replay_thread(void* arg) {
             if ((j % FLAGS_thread_num) != thread_offset) {
                 continue;
             }
-            brpc::Channel* chan =
-                chan_group->channel(sample->meta.protocol_type());
-            if (chan == NULL) {
-                LOG(ERROR) << "No channel on protocol="
-                           << sample->meta.protocol_type();
-                continue;
-            }
-            
-            brpc::Controller* cntl = new brpc::Controller;
-            req.Clear();
-            
-            cntl->reset_sampled_request(sample_guard.release());
-            if (sample->meta.attachment_size() > 0) {
-                sample->request.cutn(
-                    &req.serialized_data(),
-                    sample->request.size() - sample->meta.attachment_size());
-                cntl->request_attachment() = sample->request.movable();
-            } else {
-                req.serialized_data() = sample->request.movable();
-            }
-            g_sent_count << 1;
-            const int64_t start_time = butil::gettimeofday_us();
-            if (FLAGS_qps <= 0) {
-                chan->CallMethod(NULL/*use rpc_dump_context in cntl instead*/,
-                        cntl, &req, NULL/*ignore response*/, NULL);
-                handle_response(cntl, start_time, true);
-            } else {
-                google::protobuf::Closure* done =
-                    brpc::NewCallback(handle_response, cntl, start_time, false);
-                chan->CallMethod(NULL/*use rpc_dump_context in cntl instead*/,
-                        cntl, &req, NULL/*ignore response*/, done);
-                const int64_t end_time = butil::gettimeofday_us();
-                int64_t expected_elp = 0;
-                int64_t actual_elp = 0;
-                timeq.push_back(end_time);
-                if (timeq.size() > MAX_QUEUE_SIZE) {
-                    actual_elp = end_time - timeq.front();
-                    timeq.pop_front();
-                    expected_elp = (size_t)(1000000 * timeq.size() / req_rate);
-                } else {
-                    actual_elp = end_time - timeq.front();
-                    expected_elp = (size_t)(1000000 * (timeq.size() - 1) / req_rate);
-                }
-                if (actual_elp < expected_elp) {
-                    bthread_usleep(expected_elp - actual_elp);
-                }
-            }
+            replay_one_sample(chan_group, sample_guard.release(), &req,
+                              &timeq, MAX_QUEUE_SIZE, req_rate);
         }
     }
     return NULL;
@@ -220,6 +309,15 @@ int main(int argc, char* argv[]) {
         return -1;
     }
 
+    if (FLAGS_use_mmap) {
+        std::unique_ptr<IndexedDump> indexed_dump(new IndexedDump);
+        if (indexed_dump->Init(FLAGS_dir)) {
+            g_indexed_dump = indexed_dump.release();
+            LOG(INFO) << "Replay " << g_indexed_dump->total()
+                      << " samples through mmap-ed indexes";
+        }
+    }
+
     if (FLAGS_thread_num <= 0) {
         if (FLAGS_qps <= 0) { // unlimited qps
             FLAGS_thread_num = 50;
@@ -0,0 +1,86 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// Train a zstd dictionary from requests sampled by rpc_dump (see
+// docs/cn/rpc_press.md for how to enable -rpc_dump) and write it to a
+// file which can be loaded on both client and server with
+// -zstd_dict_file. brpc must be compiled with --with-zstd.
+
+#include <gflags/gflags.h>
+#include <butil/logging.h>
+#include <butil/file_util.h>
+#include <brpc/rpc_dump.h>
+
+#ifdef BRPC_WITH_ZSTD
+
+#include <zdict.h>
+#include <brpc/policy/zstd_compress.h>
+
+DEFINE_string(dir, "", "The directory of dumped requests");
+DEFINE_string(output, "zstd.dict", "The file to write the dictionary into");
+DEFINE_int32(dict_size, 112640, "Max size of the trained dictionary");
+DEFINE_int32(max_samples, 200000, "Read at most so many samples");
+
+int main(int argc, char* argv[]) {
+    google::ParseCommandLineFlags(&argc, &argv, true);
+    if (FLAGS_dir.empty() ||
+        !butil::DirectoryExists(butil::FilePath(FLAGS_dir))) {
+        LOG(ERROR) << "--dir=<dir-of-dumped-files> must be specified";
+        return -1;
+    }
+    if (FLAGS_dict_size <= 0) {
+        LOG(ERROR) << "Invalid --dict_size=" << FLAGS_dict_size;
+        return -1;
+    }
+    std::vector<butil::IOBuf> samples;
+    size_t total_bytes = 0;
+    brpc::SampleIterator it(FLAGS_dir);
+    for (brpc::SampledRequest* sample = it.Next();
+         sample != NULL; sample = it.Next()) {
+        if ((int)samples.size() < FLAGS_max_samples) {
+            samples.push_back(sample->request);
+            total_bytes += sample->request.size();
+        }
+        delete sample;
+    }
+    LOG(INFO) << "Read " << samples.size() << " samples("
+              << total_bytes << " bytes) from " << FLAGS_dir;
+    std::string dict;
+    if (!brpc::policy::ZstdTrainDict(samples, FLAGS_dict_size, &dict)) {
+        LOG(ERROR) << "Fail to train dictionary, note that training needs "
+            "many samples, roughly 100x the dictionary size";
+        return -1;
+    }
+    if (butil::WriteFile(butil::FilePath(FLAGS_output),
+                         dict.data(), dict.size()) != (int)dict.size()) {
+        PLOG(ERROR) << "Fail to write " << FLAGS_output;
+        return -1;
+    }
+    LOG(INFO) << "Wrote dictionary of " << dict.size() << " bytes id="
+              << ZDICT_getDictID(dict.data(), dict.size())
+              << " to " << FLAGS_output;
+    return 0;
+}
+
+#else // BRPC_WITH_ZSTD
+
+int main(int, char*[]) {
+    LOG(ERROR) << "rpc_zdict requires brpc compiled with --with-zstd";
+    return -1;
+}
+
+#endif // BRPC_WITH_ZSTD